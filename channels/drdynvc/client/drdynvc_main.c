@@ -1300,6 +1300,7 @@ static UINT drdynvc_virtual_channel_event_data_received(drdynvcPlugin* drdynvc,
                                                         UINT32 dataFlags)
 {
 	wStream* data_in;
+	BOOL sliced = FALSE;
 
 	if ((dataFlags & CHANNEL_FLAG_SUSPEND) || (dataFlags & CHANNEL_FLAG_RESUME))
 	{
@@ -1312,7 +1313,18 @@ static UINT drdynvc_virtual_channel_event_data_received(drdynvcPlugin* drdynvc,
 		if (drdynvc->data_in)
 			Stream_Release(drdynvc->data_in);
 
-		drdynvc->data_in = StreamPool_Take(mgr->pool, totalLength);
+		drdynvc->data_in = NULL;
+
+		/* A PDU received in a single chunk references the receive buffer instead of a copy */
+		if ((dataFlags & CHANNEL_FLAG_LAST) && (dataLength == totalLength) && drdynvc->rdpcontext)
+		{
+			drdynvc->data_in = freerdp_receive_slice(drdynvc->rdpcontext, pData, dataLength);
+
+			sliced = (drdynvc->data_in != NULL);
+		}
+
+		if (!drdynvc->data_in)
+			drdynvc->data_in = StreamPool_Take(mgr->pool, totalLength);
 	}
 
 	if (!(data_in = drdynvc->data_in))
@@ -1321,15 +1333,20 @@ static UINT drdynvc_virtual_channel_event_data_received(drdynvcPlugin* drdynvc,
 		return CHANNEL_RC_NO_MEMORY;
 	}
 
-	if (!Stream_EnsureRemainingCapacity(data_in, dataLength))
+	if (sliced)
+		Stream_Seek(data_in, dataLength);
+	else
 	{
-		WLog_Print(drdynvc->log, WLOG_ERROR, "Stream_EnsureRemainingCapacity failed!");
-		Stream_Release(drdynvc->data_in);
-		drdynvc->data_in = NULL;
-		return ERROR_INTERNAL_ERROR;
-	}
+		if (!Stream_EnsureRemainingCapacity(data_in, dataLength))
+		{
+			WLog_Print(drdynvc->log, WLOG_ERROR, "Stream_EnsureRemainingCapacity failed!");
+			Stream_Release(drdynvc->data_in);
+			drdynvc->data_in = NULL;
+			return ERROR_INTERNAL_ERROR;
+		}
 
-	Stream_Write(data_in, pData, dataLength);
+		Stream_Write(data_in, pData, dataLength);
+	}
 
 	if (dataFlags & CHANNEL_FLAG_LAST)
 	{
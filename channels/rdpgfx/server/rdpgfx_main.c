@@ -94,18 +94,18 @@ static UINT rdpgfx_server_packet_send(RdpgfxServerContext* context, wStream* s)
 {
 	UINT error;
 	UINT32 flags = 0;
-	ULONG written;
 	BYTE* pSrcData = Stream_Buffer(s);
 	UINT32 SrcSize = Stream_GetPosition(s);
 	wStream* fs;
-	/* Allocate new stream with enough capacity. Additional overhead is
-	 * descriptor (1 bytes) + segmentCount (2 bytes) + uncompressedSize (4 bytes)
-	 * + segmentCount * size (4 bytes) */
-	fs = Stream_New(NULL, SrcSize + 7 + (SrcSize / ZGFX_SEGMENTED_MAXSIZE + 1) * 4);
+	/* Take a stream with enough capacity from the channel manager, it is queued by
+	 * reference. Additional overhead is descriptor (1 bytes) + segmentCount (2 bytes)
+	 * + uncompressedSize (4 bytes) + segmentCount * size (4 bytes) */
+	fs = WTSVirtualChannelTakeStream(context->priv->rdpgfx_channel,
+	                                 SrcSize + 7 + (SrcSize / ZGFX_SEGMENTED_MAXSIZE + 1) * 4);
 
 	if (!fs)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
+		WLog_ERR(TAG, "WTSVirtualChannelTakeStream failed!");
 		error = CHANNEL_RC_NO_MEMORY;
 		goto out;
 	}
@@ -113,28 +113,22 @@ static UINT rdpgfx_server_packet_send(RdpgfxServerContext* context, wStream* s)
 	if (zgfx_compress_to_stream(context->priv->zgfx, fs, pSrcData, SrcSize, &flags) < 0)
 	{
 		WLog_ERR(TAG, "zgfx_compress_to_stream failed!");
+		Stream_Release(fs);
 		error = ERROR_INTERNAL_ERROR;
 		goto out;
 	}
 
-	if (!WTSVirtualChannelWrite(context->priv->rdpgfx_channel, (PCHAR)Stream_Buffer(fs),
-	                            Stream_GetPosition(fs), &written))
+	/* ownership of fs passes to the channel manager */
+	if (!WTSVirtualChannelWriteStream(context->priv->rdpgfx_channel, fs))
 	{
-		WLog_ERR(TAG, "WTSVirtualChannelWrite failed!");
+		WLog_ERR(TAG, "WTSVirtualChannelWriteStream failed!");
 		error = ERROR_INTERNAL_ERROR;
 		goto out;
 	}
 
-	if (written < Stream_GetPosition(fs))
-	{
-		WLog_WARN(TAG, "Unexpected bytes written: %" PRIu32 "/%" PRIuz "", written,
-		          Stream_GetPosition(fs));
-	}
-
 	error = CHANNEL_RC_OK;
 out:
-	Stream_Free(fs, TRUE);
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -145,21 +139,23 @@ out:
  * to the stream before return, but the pduLength field might be
  * changed in rdpgfx_server_single_packet_send.
  *
+ * @param context The rdpgfx server context, PDU streams are taken from its pool
  * @param cmdId The CommandID to write
  * @param dataLen estimated data length without header
  *
  * @return new stream
  */
-static wStream* rdpgfx_server_single_packet_new(UINT16 cmdId, UINT32 dataLen)
+static wStream* rdpgfx_server_single_packet_new(RdpgfxServerContext* context, UINT16 cmdId,
+                                                UINT32 dataLen)
 {
 	UINT error;
 	wStream* s;
 	UINT32 pduLength = rdpgfx_pdu_length(dataLen);
-	s = Stream_New(NULL, pduLength);
+	s = StreamPool_Take(context->priv->pool, pduLength);
 
 	if (!s)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
+		WLog_ERR(TAG, "StreamPool_Take failed!");
 		goto error;
 	}
 
@@ -171,7 +167,8 @@ static wStream* rdpgfx_server_single_packet_new(UINT16 cmdId, UINT32 dataLen)
 
 	return s;
 error:
-	Stream_Free(s, TRUE);
+	if (s)
+		Stream_Release(s);
 	return NULL;
 }
 
@@ -207,7 +204,7 @@ static UINT rdpgfx_send_caps_confirm_pdu(RdpgfxServerContext* context,
 	capsSet = capsConfirm->capsSet;
 	WINPR_ASSERT(capsSet);
 
-	s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_CAPSCONFIRM,
+	s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_CAPSCONFIRM,
 	                                    RDPGFX_CAPSET_BASE_SIZE + capsSet->length);
 
 	if (!s)
@@ -251,7 +248,7 @@ static UINT rdpgfx_send_reset_graphics_pdu(RdpgfxServerContext* context,
 		return ERROR_INVALID_DATA;
 	}
 
-	s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_RESETGRAPHICS,
+	s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_RESETGRAPHICS,
 	                                    RDPGFX_RESET_GRAPHICS_PDU_SIZE - RDPGFX_HEADER_SIZE);
 
 	if (!s)
@@ -287,7 +284,7 @@ static UINT rdpgfx_send_reset_graphics_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_evict_cache_entry_pdu(RdpgfxServerContext* context,
                                               const RDPGFX_EVICT_CACHE_ENTRY_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_EVICTCACHEENTRY, 2);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_EVICTCACHEENTRY, 2);
 
 	if (!s)
 	{
@@ -308,7 +305,7 @@ static UINT rdpgfx_send_cache_import_reply_pdu(RdpgfxServerContext* context,
                                                const RDPGFX_CACHE_IMPORT_REPLY_PDU* pdu)
 {
 	UINT16 index;
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_CACHEIMPORTREPLY,
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_CACHEIMPORTREPLY,
 	                                             2 + 2 * pdu->importedEntriesCount);
 
 	if (!s)
@@ -336,7 +333,7 @@ static UINT rdpgfx_send_cache_import_reply_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_create_surface_pdu(RdpgfxServerContext* context,
                                            const RDPGFX_CREATE_SURFACE_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_CREATESURFACE, 7);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_CREATESURFACE, 7);
 
 	WINPR_ASSERT(context);
 	WINPR_ASSERT(pdu);
@@ -364,7 +361,7 @@ static UINT rdpgfx_send_create_surface_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_delete_surface_pdu(RdpgfxServerContext* context,
                                            const RDPGFX_DELETE_SURFACE_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_DELETESURFACE, 2);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_DELETESURFACE, 2);
 
 	if (!s)
 	{
@@ -401,8 +398,8 @@ static INLINE BOOL rdpgfx_write_end_frame_pdu(wStream* s, const RDPGFX_END_FRAME
 static UINT rdpgfx_send_start_frame_pdu(RdpgfxServerContext* context,
                                         const RDPGFX_START_FRAME_PDU* pdu)
 {
-	wStream* s =
-	    rdpgfx_server_single_packet_new(RDPGFX_CMDID_STARTFRAME, RDPGFX_START_FRAME_PDU_SIZE);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_STARTFRAME,
+	                                             RDPGFX_START_FRAME_PDU_SIZE);
 
 	if (!s)
 	{
@@ -421,7 +418,8 @@ static UINT rdpgfx_send_start_frame_pdu(RdpgfxServerContext* context,
  */
 static UINT rdpgfx_send_end_frame_pdu(RdpgfxServerContext* context, const RDPGFX_END_FRAME_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_ENDFRAME, RDPGFX_END_FRAME_PDU_SIZE);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_ENDFRAME,
+	                                             RDPGFX_END_FRAME_PDU_SIZE);
 
 	if (!s)
 	{
@@ -706,7 +704,7 @@ static UINT rdpgfx_send_surface_command(RdpgfxServerContext* context,
 {
 	UINT error = CHANNEL_RC_OK;
 	wStream* s;
-	s = rdpgfx_server_single_packet_new(rdpgfx_surface_command_cmdid(cmd),
+	s = rdpgfx_server_single_packet_new(context, rdpgfx_surface_command_cmdid(cmd),
 	                                    rdpgfx_estimate_surface_command(cmd));
 
 	if (!s)
@@ -725,7 +723,7 @@ static UINT rdpgfx_send_surface_command(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -758,11 +756,11 @@ static UINT rdpgfx_send_surface_frame_command(RdpgfxServerContext* context,
 		size += rdpgfx_pdu_length(RDPGFX_END_FRAME_PDU_SIZE);
 	}
 
-	s = Stream_New(NULL, size);
+	s = StreamPool_Take(context->priv->pool, size);
 
 	if (!s)
 	{
-		WLog_ERR(TAG, "Stream_New failed!");
+		WLog_ERR(TAG, "StreamPool_Take failed!");
 		return CHANNEL_RC_NO_MEMORY;
 	}
 
@@ -824,7 +822,7 @@ static UINT rdpgfx_send_surface_frame_command(RdpgfxServerContext* context,
 
 	return rdpgfx_server_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -836,7 +834,7 @@ error:
 static UINT rdpgfx_send_delete_encoding_context_pdu(RdpgfxServerContext* context,
                                                     const RDPGFX_DELETE_ENCODING_CONTEXT_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_DELETEENCODINGCONTEXT, 6);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_DELETEENCODINGCONTEXT, 6);
 
 	if (!s)
 	{
@@ -860,8 +858,8 @@ static UINT rdpgfx_send_solid_fill_pdu(RdpgfxServerContext* context,
 	UINT error = CHANNEL_RC_OK;
 	UINT16 index;
 	RECTANGLE_16* fillRect;
-	wStream* s =
-	    rdpgfx_server_single_packet_new(RDPGFX_CMDID_SOLIDFILL, 8 + 8 * pdu->fillRectCount);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_SOLIDFILL,
+	                                             8 + 8 * pdu->fillRectCount);
 
 	if (!s)
 	{
@@ -893,7 +891,7 @@ static UINT rdpgfx_send_solid_fill_pdu(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -908,8 +906,8 @@ static UINT rdpgfx_send_surface_to_surface_pdu(RdpgfxServerContext* context,
 	UINT error = CHANNEL_RC_OK;
 	UINT16 index;
 	RDPGFX_POINT16* destPt;
-	wStream* s =
-	    rdpgfx_server_single_packet_new(RDPGFX_CMDID_SURFACETOSURFACE, 14 + 4 * pdu->destPtsCount);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_SURFACETOSURFACE,
+	                                             14 + 4 * pdu->destPtsCount);
 
 	if (!s)
 	{
@@ -942,7 +940,7 @@ static UINT rdpgfx_send_surface_to_surface_pdu(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -955,7 +953,7 @@ static UINT rdpgfx_send_surface_to_cache_pdu(RdpgfxServerContext* context,
                                              const RDPGFX_SURFACE_TO_CACHE_PDU* pdu)
 {
 	UINT error = CHANNEL_RC_OK;
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_SURFACETOCACHE, 20);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_SURFACETOCACHE, 20);
 
 	if (!s)
 	{
@@ -976,7 +974,7 @@ static UINT rdpgfx_send_surface_to_cache_pdu(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -991,8 +989,8 @@ static UINT rdpgfx_send_cache_to_surface_pdu(RdpgfxServerContext* context,
 	UINT error = CHANNEL_RC_OK;
 	UINT16 index;
 	RDPGFX_POINT16* destPt;
-	wStream* s =
-	    rdpgfx_server_single_packet_new(RDPGFX_CMDID_CACHETOSURFACE, 6 + 4 * pdu->destPtsCount);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_CACHETOSURFACE,
+	                                             6 + 4 * pdu->destPtsCount);
 
 	if (!s)
 	{
@@ -1017,7 +1015,7 @@ static UINT rdpgfx_send_cache_to_surface_pdu(RdpgfxServerContext* context,
 
 	return rdpgfx_server_single_packet_send(context, s);
 error:
-	Stream_Free(s, TRUE);
+	Stream_Release(s);
 	return error;
 }
 
@@ -1029,7 +1027,7 @@ error:
 static UINT rdpgfx_send_map_surface_to_output_pdu(RdpgfxServerContext* context,
                                                   const RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_MAPSURFACETOOUTPUT, 12);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_MAPSURFACETOOUTPUT, 12);
 
 	if (!s)
 	{
@@ -1052,7 +1050,7 @@ static UINT rdpgfx_send_map_surface_to_output_pdu(RdpgfxServerContext* context,
 static UINT rdpgfx_send_map_surface_to_window_pdu(RdpgfxServerContext* context,
                                                   const RDPGFX_MAP_SURFACE_TO_WINDOW_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_MAPSURFACETOWINDOW, 18);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_MAPSURFACETOWINDOW, 18);
 
 	if (!s)
 	{
@@ -1071,7 +1069,8 @@ static UINT
 rdpgfx_send_map_surface_to_scaled_window_pdu(RdpgfxServerContext* context,
                                              const RDPGFX_MAP_SURFACE_TO_SCALED_WINDOW_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_MAPSURFACETOSCALEDWINDOW, 26);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_MAPSURFACETOSCALEDWINDOW,
+	                                             26);
 
 	if (!s)
 	{
@@ -1256,7 +1255,8 @@ static UINT
 rdpgfx_send_map_surface_to_scaled_output_pdu(RdpgfxServerContext* context,
                                              const RDPGFX_MAP_SURFACE_TO_SCALED_OUTPUT_PDU* pdu)
 {
-	wStream* s = rdpgfx_server_single_packet_new(RDPGFX_CMDID_MAPSURFACETOSCALEDOUTPUT, 20);
+	wStream* s = rdpgfx_server_single_packet_new(context, RDPGFX_CMDID_MAPSURFACETOSCALEDOUTPUT,
+	                                             20);
 
 	if (!s)
 	{
@@ -1591,10 +1591,21 @@ RdpgfxServerContext* rdpgfx_server_context_new(HANDLE vcm)
 		goto out_free_priv;
 	}
 
+	/* Pool for serialized PDUs */
+	priv->pool = StreamPool_New(TRUE, 0);
+
+	if (!priv->pool)
+	{
+		WLog_ERR(TAG, "StreamPool_New failed!");
+		goto out_free_input;
+	}
+
 	priv->isOpened = FALSE;
 	priv->isReady = FALSE;
 	priv->ownThread = TRUE;
 	return (RdpgfxServerContext*)context;
+out_free_input:
+	Stream_Free(priv->input_stream, TRUE);
 out_free_priv:
 	free(context->priv);
 out_free:
@@ -1607,7 +1618,10 @@ void rdpgfx_server_context_free(RdpgfxServerContext* context)
 	rdpgfx_server_close(context);
 
 	if (context->priv)
+	{
 		Stream_Free(context->priv->input_stream, TRUE);
+		StreamPool_Free(context->priv->pool);
+	}
 
 	free(context->priv);
 	free(context);
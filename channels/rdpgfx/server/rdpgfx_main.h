@@ -33,6 +33,7 @@ struct s_rdpgfx_server_private
 	void* rdpgfx_channel;
 	DWORD SessionId;
 	wStream* input_stream;
+	wStreamPool* pool;
 	BOOL isOpened;
 	BOOL isReady;
 };
@@ -103,6 +103,7 @@
 #include "xf_keyboard.h"
 #include "xf_input.h"
 #include "xf_channels.h"
+#include "xf_shm.h"
 #include "xfreerdp.h"
 
 #include <freerdp/log.h>
@@ -368,6 +369,48 @@ static BOOL xf_desktop_resize(rdpContext* context)
 	return TRUE;
 }
 
+static BOOL xf_sw_create_image(xfContext* xfc)
+{
+	rdpGdi* gdi = xfc->common.context.gdi;
+	WINPR_ASSERT(gdi);
+
+	xf_shm_free_image(xfc, xfc->image, &xfc->imageSegment);
+	xfc->image = NULL;
+
+	/* With MIT-SHM the invalid rects are staged into a shared image on paint, the server reads
+	 * them from there instead of the socket. RAIL puts xfc->image directly, keep it unstaged. */
+	if (xfc->common.context.settings->SoftwareGdi && !xfc->remote_app)
+		xfc->image = xf_shm_create_image(xfc, &xfc->imageSegment, gdi->width, gdi->height);
+
+	if (!xfc->image)
+	{
+		xfc->image = XCreateImage(xfc->display, xfc->visual, xfc->depth, ZPixmap, 0,
+		                          (char*)gdi->primary_buffer, gdi->width, gdi->height,
+		                          xfc->scanline_pad, gdi->stride);
+
+		if (!xfc->image)
+			return FALSE;
+
+		xfc->image->byte_order = LSBFirst;
+		xfc->image->bitmap_bit_order = LSBFirst;
+	}
+
+	return TRUE;
+}
+
+static void xf_sw_put_image(xfContext* xfc, rdpGdi* gdi, INT32 x, INT32 y, UINT32 w, UINT32 h)
+{
+	if (xfc->imageSegment.attached)
+	{
+		freerdp_image_copy((BYTE*)xfc->image->data, gdi->dstFormat, xfc->image->bytes_per_line, x,
+		                   y, w, h, gdi->primary_buffer, gdi->dstFormat, gdi->stride, x, y, NULL,
+		                   FREERDP_FLIP_NONE);
+	}
+
+	xf_shm_put_image(xfc, xfc->primary, xfc->gc, xfc->image, &xfc->imageSegment, x, y, x, y, w,
+	                 h);
+}
+
 static BOOL xf_sw_end_paint(rdpContext* context)
 {
 	int i;
@@ -396,8 +439,10 @@ static BOOL xf_sw_end_paint(rdpContext* context)
 				return TRUE;
 
 			xf_lock_x11(xfc);
-			XPutImage(xfc->display, xfc->primary, xfc->gc, xfc->image, x, y, x, y, w, h);
+			xf_shm_wait(xfc);
+			xf_sw_put_image(xfc, gdi, x, y, w, h);
 			xf_draw_screen(xfc, x, y, w, h);
+			XFlush(xfc->display);
 			xf_unlock_x11(xfc);
 		}
 		else
@@ -406,6 +451,7 @@ static BOOL xf_sw_end_paint(rdpContext* context)
 				return TRUE;
 
 			xf_lock_x11(xfc);
+			xf_shm_wait(xfc);
 
 			for (i = 0; i < ninvalid; i++)
 			{
@@ -413,7 +459,7 @@ static BOOL xf_sw_end_paint(rdpContext* context)
 				y = cinvalid[i].y;
 				w = cinvalid[i].w;
 				h = cinvalid[i].h;
-				XPutImage(xfc->display, xfc->primary, xfc->gc, xfc->image, x, y, x, y, w, h);
+				xf_sw_put_image(xfc, gdi, x, y, w, h);
 				xf_draw_screen(xfc, x, y, w, h);
 			}
 
@@ -447,21 +493,9 @@ static BOOL xf_sw_desktop_resize(rdpContext* context)
 	if (!gdi_resize(gdi, settings->DesktopWidth, settings->DesktopHeight))
 		goto out;
 
-	if (xfc->image)
-	{
-		xfc->image->data = NULL;
-		XDestroyImage(xfc->image);
-	}
-
-	if (!(xfc->image = XCreateImage(xfc->display, xfc->visual, xfc->depth, ZPixmap, 0,
-	                                (char*)gdi->primary_buffer, gdi->width, gdi->height,
-	                                xfc->scanline_pad, gdi->stride)))
-	{
+	if (!xf_sw_create_image(xfc))
 		goto out;
-	}
 
-	xfc->image->byte_order = LSBFirst;
-	xfc->image->bitmap_bit_order = LSBFirst;
 	ret = xf_desktop_resize(context);
 out:
 	xf_unlock_x11(xfc);
@@ -584,7 +618,10 @@ static BOOL xf_process_x_events(freerdp* instance)
 		{
 			ZeroMemory(&xevent, sizeof(xevent));
 			XNextEvent(xfc->display, &xevent);
-			status = xf_event_process(instance, &xevent);
+
+			/* Only read to advance the processed serial, see xf_shm_wait */
+			if (!xf_shm_is_completion_event(xfc, &xevent))
+				status = xf_event_process(instance, &xevent);
 		}
 		xf_unlock_x11(xfc);
 		if (!status)
@@ -728,14 +765,8 @@ BOOL xf_create_window(xfContext* xfc)
 
 	if (!xfc->image)
 	{
-		rdpGdi* cgdi = xfc->common.context.gdi;
-		WINPR_ASSERT(cgdi);
-
-		xfc->image = XCreateImage(xfc->display, xfc->visual, xfc->depth, ZPixmap, 0,
-		                          (char*)cgdi->primary_buffer, settings->DesktopWidth,
-		                          settings->DesktopHeight, xfc->scanline_pad, cgdi->stride);
-		xfc->image->byte_order = LSBFirst;
-		xfc->image->bitmap_bit_order = LSBFirst;
+		if (!xf_sw_create_image(xfc))
+			return FALSE;
 	}
 
 	return TRUE;
@@ -765,8 +796,7 @@ static void xf_window_free(xfContext* xfc)
 
 	if (xfc->image)
 	{
-		xfc->image->data = NULL;
-		XDestroyImage(xfc->image);
+		xf_shm_free_image(xfc, xfc->image, &xfc->imageSegment);
 		xfc->image = NULL;
 	}
 
@@ -1888,6 +1918,8 @@ static BOOL xfreerdp_client_new(freerdp* instance, rdpContext* context)
 		goto fail_pixmap_info;
 	}
 
+	xf_shm_init(xfc);
+
 	xfc->vscreen.monitors = calloc(16, sizeof(MONITOR_INFO));
 
 	if (!xfc->vscreen.monitors)
@@ -25,6 +25,7 @@
 #include <freerdp/log.h>
 #include "xf_gfx.h"
 #include "xf_rail.h"
+#include "xf_shm.h"
 
 #include <X11/Xutil.h>
 
@@ -67,6 +68,10 @@ static UINT xf_OutputUpdate(xfContext* xfc, xfGfxSurface* surface)
 	if (!(rects = region16_rects(&surface->gdi.invalidRegion, &nbRects)))
 		return CHANNEL_RC_OK;
 
+	/* The stage of a shared image may still be read by the server for the previous frame */
+	if (surface->segment.attached)
+		xf_shm_wait(xfc);
+
 	for (x = 0; x < nbRects; x++)
 	{
 		const UINT32 nXSrc = rects[x].left;
@@ -88,8 +93,8 @@ static UINT xf_OutputUpdate(xfContext* xfc, xfGfxSurface* surface)
 
 		if (xfc->remote_app)
 		{
-			XPutImage(xfc->display, xfc->primary, xfc->gc, surface->image, nXSrc, nYSrc, nXDst,
-			          nYDst, dwidth, dheight);
+			xf_shm_put_image(xfc, xfc->primary, xfc->gc, surface->image, &surface->segment, nXSrc,
+			                 nYSrc, nXDst, nYDst, dwidth, dheight);
 			xf_lock_x11(xfc);
 			xf_rail_paint(xfc, nXDst, nYDst, nXDst + dwidth, nYDst + dheight);
 			xf_unlock_x11(xfc);
@@ -98,15 +103,15 @@ static UINT xf_OutputUpdate(xfContext* xfc, xfGfxSurface* surface)
 #ifdef WITH_XRENDER
 		    if (settings->SmartSizing || settings->MultiTouchGestures)
 		{
-			XPutImage(xfc->display, xfc->primary, xfc->gc, surface->image, nXSrc, nYSrc, nXDst,
-			          nYDst, dwidth, dheight);
+			xf_shm_put_image(xfc, xfc->primary, xfc->gc, surface->image, &surface->segment, nXSrc,
+			                 nYSrc, nXDst, nYDst, dwidth, dheight);
 			xf_draw_screen(xfc, nXDst, nYDst, dwidth, dheight);
 		}
 		else
 #endif
 		{
-			XPutImage(xfc->display, xfc->drawable, xfc->gc, surface->image, nXSrc, nYSrc, nXDst,
-			          nYDst, dwidth, dheight);
+			xf_shm_put_image(xfc, xfc->drawable, xfc->gc, surface->image, &surface->segment, nXSrc,
+			                 nYSrc, nXDst, nYDst, dwidth, dheight);
 		}
 	}
 
@@ -114,7 +119,8 @@ static UINT xf_OutputUpdate(xfContext* xfc, xfGfxSurface* surface)
 fail:
 	region16_clear(&surface->gdi.invalidRegion);
 	XSetClipMask(xfc->display, xfc->gc, None);
-	XSync(xfc->display, False);
+	/* All rects of the frame are queued, hand them to the server without waiting for it */
+	XFlush(xfc->display);
 	return rc;
 }
 
@@ -315,7 +321,17 @@ static UINT xf_CreateSurface(RdpgfxClientContext* context,
 
 	ZeroMemory(surface->gdi.data, size);
 
-	if (FreeRDPAreColorFormatsEqualNoAlpha(gdi->dstFormat, surface->gdi.format))
+	/* A shared image is always used as stage, decoders write the surface at any time while the
+	 * stage is only touched in xf_OutputUpdate after the previous frame was read. */
+	surface->image = xf_shm_create_image(xfc, &surface->segment, surface->gdi.width,
+	                                     surface->gdi.height);
+
+	if (surface->image)
+	{
+		surface->stage = (BYTE*)surface->image->data;
+		surface->stageScanline = surface->image->bytes_per_line;
+	}
+	else if (FreeRDPAreColorFormatsEqualNoAlpha(gdi->dstFormat, surface->gdi.format))
 	{
 		surface->image =
 		    XCreateImage(xfc->display, xfc->visual, xfc->depth, ZPixmap, 0,
@@ -363,8 +379,10 @@ static UINT xf_CreateSurface(RdpgfxClientContext* context,
 
 	return CHANNEL_RC_OK;
 error_set_surface_data:
-	surface->image->data = NULL;
-	XDestroyImage(surface->image);
+	if (surface->segment.attached)
+		surface->stage = NULL;
+
+	xf_shm_free_image(xfc, surface->image, &surface->segment);
 error_surface_image:
 	winpr_aligned_free(surface->stage);
 out_free_gdidata:
@@ -385,6 +403,8 @@ static UINT xf_DeleteSurface(RdpgfxClientContext* context,
 	rdpCodecs* codecs = NULL;
 	xfGfxSurface* surface = NULL;
 	UINT status;
+	rdpGdi* gdi = (rdpGdi*)context->custom;
+	xfContext* xfc = (xfContext*)gdi->context;
 	EnterCriticalSection(&context->mux);
 	surface = (xfGfxSurface*)context->GetSurfaceData(context, deleteSurface->surfaceId);
 
@@ -396,8 +416,10 @@ static UINT xf_DeleteSurface(RdpgfxClientContext* context,
 #ifdef WITH_GFX_H264
 		h264_context_free(surface->gdi.h264);
 #endif
-		surface->image->data = NULL;
-		XDestroyImage(surface->image);
+		if (surface->segment.attached)
+			surface->stage = NULL;
+
+		xf_shm_free_image(xfc, surface->image, &surface->segment);
 		winpr_aligned_free(surface->gdi.data);
 		winpr_aligned_free(surface->stage);
 		region16_uninit(&surface->gdi.invalidRegion);
@@ -24,6 +24,7 @@
 
 #include "xf_client.h"
 #include "xfreerdp.h"
+#include "xf_shm.h"
 
 #include <freerdp/gdi/gfx.h>
 
@@ -33,6 +34,7 @@ struct xf_gfx_surface
 	BYTE* stage;
 	UINT32 stageScanline;
 	XImage* image;
+	xfShmSegment segment;
 };
 typedef struct xf_gfx_surface xfGfxSurface;
 
@@ -0,0 +1,260 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 Shared Memory Presentation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <freerdp/log.h>
+
+#ifdef WITH_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
+
+#include "xf_shm.h"
+
+#define TAG CLIENT_TAG("x11")
+
+#ifdef WITH_XSHM
+static int xf_shm_opcode = 0;
+static BOOL xf_shm_attach_failed = FALSE;
+static int (*xf_shm_prev_error_handler)(Display*, XErrorEvent*) = NULL;
+
+static int xf_shm_error_handler(Display* display, XErrorEvent* event)
+{
+	if (event->request_code == xf_shm_opcode)
+	{
+		xf_shm_attach_failed = TRUE;
+		return 0;
+	}
+
+	return xf_shm_prev_error_handler(display, event);
+}
+
+/* A remote display or a server without access to our IPC namespace may advertise MIT-SHM and
+ * still reject the attach, trap that error instead of letting the default handler exit. */
+static BOOL xf_shm_attach(xfContext* xfc, XShmSegmentInfo* info)
+{
+	BOOL rc;
+
+	xf_lock_x11(xfc);
+	XSync(xfc->display, False);
+	xf_shm_attach_failed = FALSE;
+	xf_shm_prev_error_handler = XSetErrorHandler(xf_shm_error_handler);
+
+	if (!XShmAttach(xfc->display, info))
+		xf_shm_attach_failed = TRUE;
+
+	XSync(xfc->display, False);
+	XSetErrorHandler(xf_shm_prev_error_handler);
+	rc = !xf_shm_attach_failed;
+	xf_unlock_x11(xfc);
+	return rc;
+}
+
+static void xf_shm_release(XShmSegmentInfo* info)
+{
+	if (info->shmaddr && (info->shmaddr != (char*)-1))
+		shmdt(info->shmaddr);
+
+	if (info->shmid >= 0)
+		shmctl(info->shmid, IPC_RMID, NULL);
+
+	info->shmaddr = NULL;
+	info->shmid = -1;
+}
+#endif
+
+BOOL xf_shm_init(xfContext* xfc)
+{
+#ifdef WITH_XSHM
+	int event_base;
+	int error_base;
+	xfShmSegment probe = { 0 };
+	XImage* image;
+#endif
+
+	WINPR_ASSERT(xfc);
+	xfc->xshmAvailable = FALSE;
+	xfc->xshmSerial = 0;
+
+#ifdef WITH_XSHM
+	if (!XShmQueryExtension(xfc->display) ||
+	    !XQueryExtension(xfc->display, "MIT-SHM", &xf_shm_opcode, &event_base, &error_base))
+	{
+		WLog_DBG(TAG, "MIT-SHM not available, presenting with XPutImage");
+		return FALSE;
+	}
+
+	xfc->xshmEventBase = event_base;
+	xfc->xshmAvailable = TRUE;
+
+	/* Probe with a small image, the extension query alone does not tell whether the server can
+	 * map our segments. */
+	image = xf_shm_create_image(xfc, &probe, 16, 16);
+
+	if (!image)
+		return FALSE;
+
+	xf_shm_free_image(xfc, image, &probe);
+	WLog_DBG(TAG, "MIT-SHM available, presenting through shared images");
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+XImage* xf_shm_create_image(xfContext* xfc, xfShmSegment* segment, UINT32 width, UINT32 height)
+{
+#ifdef WITH_XSHM
+	XImage* image;
+	XShmSegmentInfo* info;
+
+	WINPR_ASSERT(xfc);
+	WINPR_ASSERT(segment);
+
+	ZeroMemory(segment, sizeof(xfShmSegment));
+	info = &segment->info;
+	info->shmid = -1;
+
+	if (!xfc->xshmAvailable)
+		return NULL;
+
+	image = XShmCreateImage(xfc->display, xfc->visual, xfc->depth, ZPixmap, NULL, info, width,
+	                        height);
+
+	if (!image)
+		return NULL;
+
+	info->shmid = shmget(IPC_PRIVATE, 1ull * image->bytes_per_line * image->height,
+	                     IPC_CREAT | 0600);
+
+	if (info->shmid < 0)
+		goto fail;
+
+	info->shmaddr = image->data = shmat(info->shmid, NULL, 0);
+
+	if (info->shmaddr == (char*)-1)
+		goto fail;
+
+	info->readOnly = True;
+
+	if (!xf_shm_attach(xfc, info))
+	{
+		WLog_WARN(TAG, "XShmAttach failed, falling back to XPutImage");
+		xfc->xshmAvailable = FALSE;
+		goto fail;
+	}
+
+	/* The server holds its own mapping now, mark the segment for removal so it can not outlive
+	 * the process. */
+	shmctl(info->shmid, IPC_RMID, NULL);
+	info->shmid = -1;
+	segment->attached = TRUE;
+	return image;
+fail:
+	xf_shm_release(info);
+	image->data = NULL;
+	XDestroyImage(image);
+	return NULL;
+#else
+	WINPR_UNUSED(xfc);
+	WINPR_UNUSED(width);
+	WINPR_UNUSED(height);
+	WINPR_ASSERT(segment);
+	ZeroMemory(segment, sizeof(xfShmSegment));
+	return NULL;
+#endif
+}
+
+void xf_shm_free_image(xfContext* xfc, XImage* image, xfShmSegment* segment)
+{
+	WINPR_ASSERT(xfc);
+
+	if (!image)
+		return;
+
+#ifdef WITH_XSHM
+	if (segment && segment->attached)
+	{
+		/* Requests are processed in order, a put still queued reads the segment before the
+		 * detach. Unmapping our side does not affect the server mapping. */
+		XShmDetach(xfc->display, &segment->info);
+		xf_shm_release(&segment->info);
+		segment->attached = FALSE;
+	}
+#else
+	WINPR_UNUSED(segment);
+#endif
+
+	image->data = NULL;
+	XDestroyImage(image);
+}
+
+void xf_shm_put_image(xfContext* xfc, Drawable drawable, GC gc, XImage* image,
+                      const xfShmSegment* segment, int src_x, int src_y, int dst_x, int dst_y,
+                      UINT32 width, UINT32 height)
+{
+	WINPR_ASSERT(xfc);
+
+#ifdef WITH_XSHM
+	if (segment && segment->attached)
+	{
+		/* Request a completion event, reading it advances the last processed serial so
+		 * xf_shm_wait does not need a round trip. */
+		xfc->xshmSerial = NextRequest(xfc->display);
+		XShmPutImage(xfc->display, drawable, gc, image, src_x, src_y, dst_x, dst_y, width, height,
+		             True);
+		return;
+	}
+#else
+	WINPR_UNUSED(segment);
+#endif
+
+	XPutImage(xfc->display, drawable, gc, image, src_x, src_y, dst_x, dst_y, width, height);
+}
+
+void xf_shm_wait(xfContext* xfc)
+{
+	WINPR_ASSERT(xfc);
+
+	if (xfc->xshmSerial == 0)
+		return;
+
+	if ((long)(xfc->xshmSerial - LastKnownRequestProcessed(xfc->display)) > 0)
+	{
+		XEventsQueued(xfc->display, QueuedAfterReading);
+
+		if ((long)(xfc->xshmSerial - LastKnownRequestProcessed(xfc->display)) > 0)
+			XSync(xfc->display, False);
+	}
+
+	xfc->xshmSerial = 0;
+}
+
+BOOL xf_shm_is_completion_event(xfContext* xfc, const XEvent* event)
+{
+	WINPR_ASSERT(xfc);
+	WINPR_ASSERT(event);
+
+#ifdef WITH_XSHM
+	if (xfc->xshmEventBase != 0)
+		return event->type == xfc->xshmEventBase + ShmCompletion;
+#endif
+
+	return FALSE;
+}
@@ -0,0 +1,56 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * X11 Shared Memory Presentation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_CLIENT_X11_SHM_H
+#define FREERDP_CLIENT_X11_SHM_H
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#ifdef WITH_XSHM
+#include <X11/extensions/XShm.h>
+#endif
+
+#include <winpr/wtypes.h>
+
+struct xf_shm_segment
+{
+#ifdef WITH_XSHM
+	XShmSegmentInfo info;
+#endif
+	BOOL attached;
+};
+typedef struct xf_shm_segment xfShmSegment;
+
+#include "xfreerdp.h"
+
+BOOL xf_shm_init(xfContext* xfc);
+
+/* Create an image backed by a segment shared with the X server. Returns NULL if MIT-SHM is not
+ * usable, the caller then falls back to a client side XImage. */
+XImage* xf_shm_create_image(xfContext* xfc, xfShmSegment* segment, UINT32 width, UINT32 height);
+void xf_shm_free_image(xfContext* xfc, XImage* image, xfShmSegment* segment);
+
+void xf_shm_put_image(xfContext* xfc, Drawable drawable, GC gc, XImage* image,
+                      const xfShmSegment* segment, int src_x, int src_y, int dst_x, int dst_y,
+                      UINT32 width, UINT32 height);
+
+/* Must be called before writing to the memory of a shared image that was put before. */
+void xf_shm_wait(xfContext* xfc);
+BOOL xf_shm_is_completion_event(xfContext* xfc, const XEvent* event);
+
+#endif /* FREERDP_CLIENT_X11_SHM_H */
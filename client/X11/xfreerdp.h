@@ -39,6 +39,7 @@ typedef struct xf_context xfContext;
 #include "xf_window.h"
 #include "xf_monitor.h"
 #include "xf_channels.h"
+#include "xf_shm.h"
 
 #if defined(CHANNEL_TSMF_CLIENT)
 #include <freerdp/client/tsmf.h>
@@ -275,6 +276,10 @@ struct xf_context
 
 	BOOL xkbAvailable;
 	BOOL xrenderAvailable;
+	BOOL xshmAvailable;
+	int xshmEventBase;
+	unsigned long xshmSerial;
+	xfShmSegment imageSegment;
 
 	/* value to be sent over wire for each logical client mouse button */
 	button_map button_map[NUM_BUTTONS_MAPPED];
@@ -42,6 +42,7 @@
 #include <freerdp/channels/disp.h>
 #include <freerdp/crypto/crypto.h>
 #include <freerdp/locale/keyboard.h>
+#include <freerdp/primitives.h>
 #include <freerdp/utils/passphrase.h>
 #include <freerdp/utils/proxy_utils.h>
 #include <freerdp/channels/urbdrc.h>
@@ -290,6 +291,54 @@ BOOL freerdp_client_print_buildconfig(void)
 	return TRUE;
 }
 
+static BOOL freerdp_client_set_primitives_hints(const char* value)
+{
+	int x;
+
+	for (x = PRIMITIVES_PURE_SOFT; x <= PRIMITIVES_FASTEST; x++)
+	{
+		if (_stricmp(value, primitives_hints_name((primitive_hints)x)) == 0)
+		{
+			primitives_set_hints((primitive_hints)x);
+			return TRUE;
+		}
+	}
+
+	WLog_ERR(TAG, "unknown primitives implementation '%s'", value);
+	return FALSE;
+}
+
+static void freerdp_client_print_primitives(void)
+{
+	size_t x;
+	const size_t count = primitives_slot_count();
+
+	printf("Primitives (%s), average duration of a call in ns\n",
+	       primitives_hints_name(primitives_get_hints()));
+	printf("%-24s %-10s %10s %10s %10s\n", "name", "active", "generic", "optimized", "opencl");
+
+	for (x = 0; x < count; x++)
+	{
+		size_t y;
+		primitives_slot_info info;
+
+		if (!primitives_get_slot_info(x, TRUE, &info))
+			continue;
+
+		printf("%-24s %-10s", info.name, primitives_hints_name(info.active));
+
+		for (y = 0; y < PRIMITIVES_AUTODETECT; y++)
+		{
+			if (info.available[y])
+				printf(" %10" PRIu64, info.nsPerCall[y]);
+			else
+				printf(" %10s", "-");
+		}
+
+		printf("\n");
+	}
+}
+
 static void freerdp_client_print_scancodes(void)
 {
 	DWORD x;
@@ -1503,6 +1552,20 @@ int freerdp_client_settings_command_line_status_print_ex(rdpSettings* settings,
 			freerdp_smartcard_list(settings);
 		}
 
+		arg = CommandLineFindArgumentA(largs, "primitives-list");
+
+		if (arg->Flags & COMMAND_LINE_VALUE_PRESENT)
+		{
+			/* report the selection a /primitives argument would make */
+			const COMMAND_LINE_ARGUMENT_A* hints = CommandLineFindArgumentA(largs, "primitives");
+
+			if ((hints->Flags & COMMAND_LINE_VALUE_PRESENT) &&
+			    !freerdp_client_set_primitives_hints(hints->Value))
+				goto out;
+
+			freerdp_client_print_primitives();
+		}
+
 		arg = CommandLineFindArgumentA(largs, "kbd-scancode-list");
 
 		if (arg->Flags & COMMAND_LINE_VALUE_PRESENT)
@@ -2844,6 +2907,11 @@ int freerdp_client_settings_parse_command_line_arguments(rdpSettings* settings,
 			if (!WLog_SetStringLogLevel(root, arg->Value))
 				return COMMAND_LINE_ERROR;
 		}
+		CommandLineSwitchCase(arg, "primitives")
+		{
+			if (!freerdp_client_set_primitives_hints(arg->Value))
+				return COMMAND_LINE_ERROR_UNEXPECTED_VALUE;
+		}
 		CommandLineSwitchCase(arg, "log-filters")
 		{
 			if (!WLog_AddStringLogFilters(arg->Value))
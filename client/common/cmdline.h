@@ -293,6 +293,11 @@ static const COMMAND_LINE_ARGUMENT_A global_cmd_args[] = {
 	  "Print base64 reconnect cookie after connecting" },
 	{ "printer", COMMAND_LINE_VALUE_OPTIONAL, "<name>[,<driver>]", NULL, NULL, -1, NULL,
 	  "Redirect printer device" },
+	{ "primitives", COMMAND_LINE_VALUE_REQUIRED,
+	  "generic|optimized|opencl|autodetect|fastest", NULL, NULL, -1, NULL,
+	  "Implementation of the image processing primitives" },
+	{ "primitives-list", COMMAND_LINE_VALUE_FLAG | COMMAND_LINE_PRINT, NULL, NULL, NULL, -1, NULL,
+	  "Benchmark the image processing primitives and list the implementation in use" },
 	{ "proxy", COMMAND_LINE_VALUE_REQUIRED, "[<proto>://][<user>:<password>@]<host>[:<port>]", NULL,
 	  NULL, -1, NULL,
 	  "Proxy settings: override env. var (see also environment variable below). Protocol "
@@ -23,6 +23,8 @@ else()
 	option(WITH_SSE2 "Enable SSE2 optimization." OFF)
 endif()
 
+CMAKE_DEPENDENT_OPTION(WITH_AVX2 "Enable AVX2 optimization (selected at runtime)." ON "WITH_SSE2" OFF)
+
 if(TARGET_ARCH MATCHES "ARM")
 	if (NOT DEFINED WITH_NEON)
 		option(WITH_NEON "Enable NEON optimization." ON)
@@ -38,6 +38,7 @@
 #include <winpr/winpr.h>
 #include <winpr/wtypes.h>
 #include <winpr/wtsapi.h>
+#include <winpr/stream.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -91,6 +92,16 @@ extern "C"
 
 	FREERDP_API UINT32 WTSChannelGetIdByHandle(HANDLE hChannelHandle);
 
+	/**
+	 * Scatter-gather send path: take a stream of at least size bytes from the pool of the
+	 * channel manager and serialize the PDU into it. WTSVirtualChannelWriteStream queues the
+	 * data up to the stream position by reference, dynamic channel data is chunked straight
+	 * into the transport when it is sent. The stream is released by the write in any case,
+	 * an unused stream is returned with Stream_Release before the server handle is closed.
+	 */
+	FREERDP_API wStream* WTSVirtualChannelTakeStream(HANDLE hChannelHandle, size_t size);
+	FREERDP_API BOOL WTSVirtualChannelWriteStream(HANDLE hChannelHandle, wStream* s);
+
 #ifdef __cplusplus
 }
 #endif
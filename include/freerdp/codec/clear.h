@@ -33,8 +33,13 @@ extern "C"
 {
 #endif
 
+	/**
+	 * Encodes a bitmap, the returned data is owned by the context and valid until the next call.
+	 * The context caches what the decoder has seen, so it must be used for a single connection.
+	 */
 	FREERDP_API int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize,
-	                               BYTE** ppDstData, UINT32* pDstSize);
+	                               UINT32 SrcFormat, UINT32 nWidth, UINT32 nHeight,
+	                               UINT32 nSrcStep, BYTE** ppDstData, UINT32* pDstSize);
 
 	FREERDP_API INT32 clear_decompress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize,
 	                                   UINT32 nWidth, UINT32 nHeight, BYTE* pDstData,
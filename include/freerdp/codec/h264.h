@@ -27,6 +27,7 @@
 #include <freerdp/channels/rdpgfx.h>
 
 typedef struct S_H264_CONTEXT_SUBSYSTEM H264_CONTEXT_SUBSYSTEM;
+typedef struct S_H264_RATE_CONTROL H264_RATE_CONTROL;
 typedef struct S_YUV_CONTEXT YUV_CONTEXT;
 
 typedef enum
@@ -68,6 +69,15 @@ typedef struct
 
 	void* lumaData;
 	wLog* log;
+
+	/* Per region quality: regions changing once (text, UI) are sent with
+	 * MinQP, regions changing every frame (video) drift towards MaxQP. */
+	BOOL AdaptiveQP;
+	UINT32 MinQP;
+	UINT32 MaxQP;
+	/* Bandwidth budget in bit/s (e.g. from autodetect), 0 to disable */
+	UINT32 TargetBitRate;
+	H264_RATE_CONTROL* rateControl;
 } H264_CONTEXT;
 
 #ifdef __cplusplus
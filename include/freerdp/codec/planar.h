@@ -95,6 +95,11 @@ struct S_BITMAP_PLANAR_CONTEXT
 	BYTE* pTempData;
 	UINT32 nTempStep;
 
+	size_t planesCapacity;
+	size_t rlePlanesCapacity;
+
+	struct S_CODEC_JOBS* jobs; /* encoder jobs on the thread pool, created on first use */
+
 	BOOL bgr;
 	BOOL topdown;
 };
@@ -43,6 +43,20 @@ extern "C"
 	                                     const REGION16* invalidRegion, BYTE** ppDstData,
 	                                     UINT32* pDstSize);
 
+	/**
+	 * Multi pass encoding: when enabled progressive_compress sends every tile at a
+	 * coarse quality first. The remaining precision is sent by progressive_compress_upgrade,
+	 * one quality step per call, which should be called whenever the link is idle.
+	 */
+	FREERDP_API BOOL progressive_context_set_upgrades(PROGRESSIVE_CONTEXT* progressive,
+	                                                  BOOL enable);
+	FREERDP_API int progressive_compress_upgrade(PROGRESSIVE_CONTEXT* progressive,
+	                                             REGION16* finalRegion, BYTE** ppDstData,
+	                                             UINT32* pDstSize);
+	FREERDP_API UINT32 progressive_compress_pending(PROGRESSIVE_CONTEXT* progressive);
+	FREERDP_API BOOL progressive_compress_discard(PROGRESSIVE_CONTEXT* progressive,
+	                                              const REGION16* region);
+
 	FREERDP_API INT32 progressive_decompress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
 	                                         UINT32 SrcSize, BYTE* pDstData, UINT32 DstFormat,
 	                                         UINT32 nDstStep, UINT32 nXDst, UINT32 nYDst,
@@ -190,6 +190,8 @@ extern "C"
 	                                   const RFX_MESSAGE* message);
 
 	FREERDP_API BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height);
+	FREERDP_API BOOL rfx_context_headers_pending(const RFX_CONTEXT* context);
+	FREERDP_API BOOL rfx_context_set_headers_sent(RFX_CONTEXT* context);
 
 	FREERDP_API RFX_CONTEXT* rfx_context_new_ex(BOOL encoder, UINT32 ThreadingFlags);
 	FREERDP_API RFX_CONTEXT* rfx_context_new(BOOL encoder);
@@ -32,6 +32,10 @@
 
 #define ZGFX_SEGMENTED_MAXSIZE 65535
 
+/* Compressor effort, level 0 sends segments uncompressed */
+#define ZGFX_COMPRESSION_LEVEL_DEFAULT 3
+#define ZGFX_COMPRESSION_LEVEL_MAX 9
+
 typedef struct S_ZGFX_CONTEXT ZGFX_CONTEXT;
 
 #ifdef __cplusplus
@@ -47,6 +51,8 @@ extern "C"
 	                                        const BYTE* pUncompressed, UINT32 uncompressedSize,
 	                                        UINT32* pFlags);
 
+	FREERDP_API BOOL zgfx_context_set_compression_level(ZGFX_CONTEXT* zgfx, UINT32 level);
+
 	FREERDP_API void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush);
 
 	FREERDP_API ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor);
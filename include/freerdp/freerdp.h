@@ -590,6 +590,11 @@ owned by rdpRdp */
 
 	FREERDP_API ULONG freerdp_get_transport_sent(rdpContext* context, BOOL resetCount);
 
+	/* References received data without copying it, the slice keeps the receive buffer alive
+	 * until it is released with Stream_Release. NULL if data is not inside a received PDU. */
+	FREERDP_API wStream* freerdp_receive_slice(rdpContext* context, const BYTE* data,
+	                                           size_t length);
+
 	FREERDP_API BOOL freerdp_nla_impersonate(rdpContext* context);
 	FREERDP_API BOOL freerdp_nla_revert_to_self(rdpContext* context);
 
@@ -195,9 +195,19 @@ typedef enum
 	PRIMITIVES_PURE_SOFT, /** use generic software implementation */
 	PRIMITIVES_ONLY_CPU,  /** use generic software or cpu optimized routines */
 	PRIMITIVES_ONLY_GPU,  /** use opencl optimized routines */
-	PRIMITIVES_AUTODETECT /** detect the best routines */
+	PRIMITIVES_AUTODETECT, /** detect the best routines */
+	PRIMITIVES_FASTEST     /** benchmark every primitive and use the fastest routine for each */
 } primitive_hints;
 
+/** @brief state of one member of primitives_t, see primitives_get_slot_info() */
+typedef struct
+{
+	const char* name;                        /**< name of the primitives_t member */
+	primitive_hints active;                  /**< implementation used by primitives_get() */
+	BOOL available[PRIMITIVES_AUTODETECT];   /**< per primitive_hints, has its own routine */
+	UINT64 nsPerCall[PRIMITIVES_AUTODETECT]; /**< per primitive_hints, 0 if not benchmarked */
+} primitives_slot_info;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -211,6 +221,19 @@ extern "C"
 	FREERDP_API BOOL primitives_init(primitives_t* p, primitive_hints hints);
 	FREERDP_API void primitives_uninit(void);
 
+	FREERDP_API const char* primitives_hints_name(primitive_hints hints);
+	FREERDP_API size_t primitives_slot_count(void);
+
+	/**
+	 * Reports which implementation primitives_get() uses for a member of primitives_t.
+	 *
+	 * @param index the member, 0 to primitives_slot_count() - 1
+	 * @param benchmark measure the available implementations on this CPU, takes some ms
+	 * @param info receives the report
+	 */
+	FREERDP_API BOOL primitives_get_slot_info(size_t index, BOOL benchmark,
+	                                          primitives_slot_info* info);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,6 +33,10 @@ struct proxy_config
 	/* server */
 	char* Host;
 	UINT16 Port;
+	BOOL FastCompression;
+	BOOL Reactor;                 /* multiplex sessions on a fixed set of worker threads */
+	UINT32 ReactorThreads;        /* 0 uses one worker per processor */
+	UINT32 ReactorConnectThreads; /* threads for blocking handshakes, 0 for the default */
 
 	/* target */
 	BOOL FixedTarget;
@@ -81,6 +85,7 @@ struct proxy_config
 
 	/* gfx settings */
 	BOOL DecodeGFX;
+	BOOL RawPassthrough; /* forward fast-path updates undecoded when both legs allow it */
 
 	/* modules */
 	char** Modules; /* module file names to load */
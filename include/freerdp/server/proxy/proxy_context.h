@@ -141,6 +141,9 @@ extern "C"
 		BOOL input_state_sync_pending;
 		UINT32 input_state;
 
+		/* Set while fast-path updates are forwarded without decoding them, see pf_update.c */
+		volatile LONG raw_updates;
+
 		wHashTable* interceptContextMap;
 		UINT32 computerNameLen;
 		BOOL computerNameUnicode;
@@ -48,6 +48,9 @@ typedef struct rdp_shadow_server rdpShadowServer;
 typedef struct rdp_shadow_screen rdpShadowScreen;
 typedef struct rdp_shadow_surface rdpShadowSurface;
 typedef struct rdp_shadow_encoder rdpShadowEncoder;
+typedef struct rdp_shadow_encode_cache rdpShadowEncodeCache;
+typedef struct rdp_shadow_frame rdpShadowFrame;
+typedef struct rdp_shadow_frame_queue rdpShadowFrameQueue;
 typedef struct rdp_shadow_capture rdpShadowCapture;
 typedef struct rdp_shadow_subsystem rdpShadowSubsystem;
 typedef struct rdp_shadow_multiclient_event rdpShadowMultiClientEvent;
@@ -88,6 +91,13 @@ typedef BOOL (*pfnShadowChannelAudinServerReceiveSamples)(rdpShadowSubsystem* su
                                                           const AUDIO_FORMAT* format, wStream* buf,
                                                           size_t nframes);
 
+typedef enum
+{
+	SHADOW_DAMAGE_NONE = 0, /* No hints, every frame is compared in full */
+	SHADOW_DAMAGE_HINT = 1, /* Only hinted areas may change, they are still compared */
+	SHADOW_DAMAGE_EXACT = 2 /* Hinted areas did change and are used without compare */
+} SHADOW_DAMAGE_MODE;
+
 struct rdp_shadow_client
 {
 	rdpContext context;
@@ -103,6 +113,7 @@ struct rdp_shadow_client
 	wMessageQueue* MsgQueue;
 	CRITICAL_SECTION lock;
 	REGION16 invalidRegion;
+	RDPGFX_CACHE_IMPORT_OFFER_PDU* cacheImportOffer; /* pending until the next GFX frame */
 	rdpShadowServer* server;
 	rdpShadowEncoder* encoder;
 	rdpShadowSubsystem* subsystem;
@@ -110,6 +121,12 @@ struct rdp_shadow_client
 	UINT32 pointerX;
 	UINT32 pointerY;
 
+	/* Published frames waiting to be encoded and frames sent but not acknowledged */
+	rdpShadowFrameQueue* encodeQueue;
+	rdpShadowFrameQueue* sendQueue;
+	rdpShadowFrame* frame; /* last frame encoded, owned by the client thread */
+	UINT64 lastFrameTime;
+
 	HANDLE vcm;
 	EncomspServerContext* encomsp;
 	RemdeskServerContext* remdesk;
@@ -130,12 +147,17 @@ struct rdp_shadow_server
 	rdpShadowSurface* lobby;
 	rdpShadowCapture* capture;
 	rdpShadowSubsystem* subsystem;
+	rdpShadowEncodeCache* encodeCache;
 
 	DWORD port;
 	BOOL mayView;
 	BOOL mayInteract;
 	BOOL shareSubRect;
 	BOOL authentication;
+	BOOL shareEncodedFrames;
+	BOOL progressiveUpgrades;
+	BOOL clearCodec;
+	BOOL gfxTileCache;
 	UINT32 selectedMonitor;
 	RECTANGLE_16 subRect;
 
@@ -145,6 +167,7 @@ struct rdp_shadow_server
 	UINT32 h264BitRate;
 	UINT32 h264FrameRate;
 	UINT32 h264QP;
+	BOOL h264AdaptiveQP;
 
 	char* ipcSocket;
 	char* ConfigPath;
@@ -168,6 +191,9 @@ struct rdp_shadow_surface
 
 	CRITICAL_SECTION lock;
 	REGION16 invalidRegion;
+
+	rdpShadowFrame* frame;         /* latest snapshot shared by the clients */
+	rdpShadowFrame* previousFrame; /* recycled by the next snapshot once unreferenced */
 };
 
 struct S_RDP_SHADOW_ENTRY_POINTS
@@ -220,6 +246,12 @@ struct rdp_shadow_subsystem
 	pfnShadowClientDisconnect ClientDisconnect;
 	pfnShadowClientCapabilities ClientCapabilities;
 
+	/* Damage hints published by the subsystem, see shadow_subsystem_damage_add */
+	SHADOW_DAMAGE_MODE damageMode;
+	CRITICAL_SECTION damageLock;
+	REGION16 damageRegion;
+	BOOL damageOverflow;
+
 	rdpShadowServer* server;
 };
 
@@ -311,8 +343,42 @@ extern "C"
 	                                       UINT32 nHeight, BYTE* pData2, UINT32 nStep2,
 	                                       RECTANGLE_16* rect);
 
+	FREERDP_API rdpShadowCapture* shadow_capture_new(rdpShadowServer* server);
+	FREERDP_API void shadow_capture_free(rdpShadowCapture* capture);
+
+	/**
+	 * Compares two frames in 16x16 tiles and stores every changed tile in region.
+	 * If hints is not NULL only tiles intersecting it are compared. With a capture the
+	 * tile rows are split across its thread pool work, without one they are compared inline.
+	 * @return 1 if a tile changed, 0 if not, a negative value on failure
+	 */
+	FREERDP_API int shadow_capture_compare_region(rdpShadowCapture* capture, const BYTE* pData1,
+	                                              UINT32 nStep1, UINT32 nWidth, UINT32 nHeight,
+	                                              const BYTE* pData2, UINT32 nStep2,
+	                                              const REGION16* hints, REGION16* region);
+
 	FREERDP_API void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem);
 
+	/**
+	 * Publishes a damaged rectangle (in surface coordinates) to the capture of the next frame.
+	 * Only used when damageMode is not SHADOW_DAMAGE_NONE, safe to call from any thread.
+	 */
+	FREERDP_API BOOL shadow_subsystem_damage_add(rdpShadowSubsystem* subsystem,
+	                                             const RECTANGLE_16* rect);
+
+	/**
+	 * Drops the pending hints, the next frame is compared in full.
+	 * Use when damage was lost, e.g. on a resize or an event queue overflow.
+	 */
+	FREERDP_API void shadow_subsystem_damage_invalidate(rdpShadowSubsystem* subsystem);
+
+	/**
+	 * Moves the damage published since the last call to region.
+	 * @return 1 if region holds all changes (it may be empty), 0 if the whole frame has to be
+	 * compared, a negative value on failure
+	 */
+	FREERDP_API int shadow_subsystem_damage_take(rdpShadowSubsystem* subsystem, REGION16* region);
+
 	FREERDP_API BOOL shadow_client_post_msg(rdpShadowClient* client, void* context, UINT32 type,
 	                                        SHADOW_MSG_OUT* msg, void* lParam);
 	FREERDP_API int shadow_client_boardcast_msg(rdpShadowServer* server, void* context, UINT32 type,
@@ -588,6 +588,7 @@ typedef struct
 #define FreeRDP_ForceEncryptedCsPdu (719)
 #define FreeRDP_HiDefRemoteApp (720)
 #define FreeRDP_CompressionLevel (721)
+#define FreeRDP_FastCompression (722)
 #define FreeRDP_IPv6Enabled (768)
 #define FreeRDP_ClientAddress (769)
 #define FreeRDP_ClientDir (770)
@@ -1053,7 +1054,12 @@ struct rdp_settings
 	ALIGN64 BOOL ForceEncryptedCsPdu;    /* 719 */
 	ALIGN64 BOOL HiDefRemoteApp;         /* 720 */
 	ALIGN64 UINT32 CompressionLevel;     /* 721 */
-	UINT64 padding0768[768 - 722];       /* 722 */
+	/* Local to the sending side, not negotiated. With RDP6 (ncrush) or RDP6.1 (xcrush)
+	 * bulk compression only the first match candidate is tried, which trades ratio for
+	 * speed. It cannot be a CompressionLevel value, a server overwrites that with the
+	 * type from the client info PDU. */
+	ALIGN64 BOOL FastCompression;        /* 722 */
+	UINT64 padding0768[768 - 723];       /* 723 */
 
 	/* Client Info (Extra) */
 	ALIGN64 BOOL IPv6Enabled;       /* 768 */
@@ -190,6 +190,7 @@ typedef BOOL (*pSaveSessionInfo)(rdpContext* context, UINT32 type, void* data);
 typedef BOOL (*pSetKeyboardImeStatus)(rdpContext* context, UINT16 imeId, UINT32 imeState,
                                       UINT32 imeConvMode);
 typedef BOOL (*pServerStatusInfo)(rdpContext* context, UINT32 status);
+typedef BOOL (*pFastPathUpdate)(rdpContext* context, BYTE updateCode, wStream* s);
 
 struct rdp_update
 {
@@ -231,7 +232,12 @@ struct rdp_update
 	 * fills BITMAP_DATA struct members: flags, cbCompMainBodySize and cbCompFirstRowSize.
 	 */
 	BOOL autoCalculateBitmapData; /* 71 */
-	UINT32 paddingE[80 - 72];     /* 72 */
+	/* if set on the client side, every reassembled and decompressed fast-path update is handed
+	 * to FastPathUpdate as is instead of being parsed. On the server side it sends such an
+	 * update unmodified.
+	 */
+	pFastPathUpdate FastPathUpdate; /* 72 */
+	UINT32 paddingE[80 - 73];       /* 73 */
 };
 
 #ifdef __cplusplus
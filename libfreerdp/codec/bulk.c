@@ -35,6 +35,7 @@ struct rdp_bulk
 	ALIGN64 rdpContext* context;
 	ALIGN64 UINT32 CompressionLevel;
 	ALIGN64 UINT32 CompressionMaxSize;
+	ALIGN64 BOOL FastCompression;
 	ALIGN64 MPPC_CONTEXT* mppcSend;
 	ALIGN64 MPPC_CONTEXT* mppcRecv;
 	ALIGN64 NCRUSH_CONTEXT* ncrushRecv;
@@ -80,6 +81,8 @@ static UINT32 bulk_compression_level(rdpBulk* bulk)
 	bulk->CompressionLevel = (settings->CompressionLevel >= PACKET_COMPR_TYPE_RDP61)
 	                             ? PACKET_COMPR_TYPE_RDP61
 	                             : settings->CompressionLevel;
+	/* CompressionLevel is the negotiated packet type, so fast mode is a separate setting */
+	bulk->FastCompression = settings->FastCompression;
 	return bulk->CompressionLevel;
 }
 
@@ -274,10 +277,12 @@ int bulk_compress(rdpBulk* bulk, const BYTE* pSrcData, UINT32 SrcSize, const BYT
 			                       pDstSize, pFlags);
 			break;
 		case PACKET_COMPR_TYPE_RDP6:
+			ncrush_set_fast_mode(bulk->ncrushSend, bulk->FastCompression);
 			status = ncrush_compress(bulk->ncrushSend, pSrcData, SrcSize, bulk->OutputBuffer,
 			                         ppDstData, pDstSize, pFlags);
 			break;
 		case PACKET_COMPR_TYPE_RDP61:
+			xcrush_set_fast_mode(bulk->xcrushSend, bulk->FastCompression);
 			status = xcrush_compress(bulk->xcrushSend, pSrcData, SrcSize, bulk->OutputBuffer,
 			                         ppDstData, pDstSize, pFlags);
 			break;
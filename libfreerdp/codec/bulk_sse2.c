@@ -0,0 +1,148 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Bulk Compression - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <emmintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "bulk_sse2.h"
+
+static INLINE UINT32 bulk_first_bit(UINT32 mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (UINT32)index;
+#else
+	return (UINT32)__builtin_ctz(mask);
+#endif
+}
+
+size_t bulk_match_length_sse2(const BYTE* a, const BYTE* b, size_t max)
+{
+	size_t length = 0;
+
+	while (max - length >= 16)
+	{
+		const __m128i va = _mm_loadu_si128((const __m128i*)&a[length]);
+		const __m128i vb = _mm_loadu_si128((const __m128i*)&b[length]);
+		const UINT32 mismatch = (UINT32)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xFFFF;
+
+		if (mismatch)
+			return length + bulk_first_bit(mismatch);
+
+		length += 16;
+	}
+
+	while ((length < max) && (a[length] == b[length]))
+		length++;
+
+	return length;
+}
+
+/**
+ * The xcrush hash at position p is the xor of rotl(data[p + 32 - k], k) for k in 0..31.
+ * Only its low 7 bits matter, which only the bytes with k in 0..6 (shifted left) and
+ * k in 25..31 (shifted right by 32 - k) contribute to.
+ */
+#define BULK_HASH_LEFT(_k)                                                                 \
+	_mm_slli_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i*)&data[p + 32 - (_k)]), \
+	                             _mm_set1_epi8((char)(0x7F >> (_k)))),                   \
+	               (_k))
+
+#define BULK_HASH_RIGHT(_k)                                                              \
+	_mm_and_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)&data[p + 32 - (_k)]), \
+	                             32 - (_k)),                                           \
+	              _mm_set1_epi8((char)(0xFF >> (32 - (_k)))))
+
+static INLINE BYTE bulk_chunk_hash(const BYTE* data, UINT32 p)
+{
+	UINT32 k;
+	BYTE hash = 0;
+
+	for (k = 0; k < 7; k++)
+		hash ^= (BYTE)((data[p + 32 - k] & (0x7F >> k)) << k);
+
+	for (k = 25; k < 32; k++)
+		hash ^= (BYTE)(data[p + 32 - k] >> (32 - k));
+
+	return hash;
+}
+
+UINT32 bulk_chunk_boundaries_sse2(const BYTE* data, UINT32* pos, UINT32 end, UINT32* boundaries,
+                                  UINT32 count)
+{
+	UINT32 n = 0;
+	UINT32 p = *pos;
+	const __m128i zero = _mm_setzero_si128();
+
+	while ((p + 16 <= end) && (n + 16 <= count))
+	{
+		__m128i hash = BULK_HASH_LEFT(0);
+		UINT32 mask;
+		hash = _mm_xor_si128(hash, BULK_HASH_LEFT(1));
+		hash = _mm_xor_si128(hash, BULK_HASH_LEFT(2));
+		hash = _mm_xor_si128(hash, BULK_HASH_LEFT(3));
+		hash = _mm_xor_si128(hash, BULK_HASH_LEFT(4));
+		hash = _mm_xor_si128(hash, BULK_HASH_LEFT(5));
+		hash = _mm_xor_si128(hash, BULK_HASH_LEFT(6));
+		hash = _mm_xor_si128(hash, BULK_HASH_RIGHT(25));
+		hash = _mm_xor_si128(hash, BULK_HASH_RIGHT(26));
+		hash = _mm_xor_si128(hash, BULK_HASH_RIGHT(27));
+		hash = _mm_xor_si128(hash, BULK_HASH_RIGHT(28));
+		hash = _mm_xor_si128(hash, BULK_HASH_RIGHT(29));
+		hash = _mm_xor_si128(hash, BULK_HASH_RIGHT(30));
+		hash = _mm_xor_si128(hash, BULK_HASH_RIGHT(31));
+		mask = (UINT32)_mm_movemask_epi8(_mm_cmpeq_epi8(hash, zero));
+
+		while (mask)
+		{
+			boundaries[n++] = p + bulk_first_bit(mask);
+			mask &= mask - 1;
+		}
+
+		p += 16;
+	}
+
+	for (; (p < end) && (n < count) && (p + 16 > end); p++)
+	{
+		if (!bulk_chunk_hash(data, p))
+			boundaries[n++] = p;
+	}
+
+	*pos = p;
+	return n;
+}
+
+void bulk_rebase_offsets_sse2(UINT16* dst, const UINT16* src, size_t count, UINT16 offset)
+{
+	size_t i = 0;
+	const __m128i value = _mm_set1_epi16((short)offset);
+
+	for (; i + 8 <= count; i += 8)
+	{
+		const __m128i v = _mm_loadu_si128((const __m128i*)&src[i]);
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_subs_epu16(v, value));
+	}
+
+	for (; i < count; i++)
+		dst[i] = (src[i] > offset) ? (UINT16)(src[i] - offset) : 0;
+}
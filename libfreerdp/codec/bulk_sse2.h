@@ -0,0 +1,37 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Bulk Compression - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_BULK_SSE2_H
+#define FREERDP_LIB_CODEC_BULK_SSE2_H
+
+#include <winpr/wtypes.h>
+#include <freerdp/api.h>
+
+/* Number of equal leading bytes of a and b, at most max */
+FREERDP_LOCAL size_t bulk_match_length_sse2(const BYTE* a, const BYTE* b, size_t max);
+
+/* Scans the xcrush rolling hash from *pos up to end for chunk boundaries, the positions
+ * where the low 7 bits of the hash over data[p + 1] .. data[p + 32] are zero.
+ * Stores at most count boundaries, advances *pos past the last scanned position. */
+FREERDP_LOCAL UINT32 bulk_chunk_boundaries_sse2(const BYTE* data, UINT32* pos, UINT32 end,
+                                                UINT32* boundaries, UINT32 count);
+
+/* dst[i] = src[i] - offset, clamped to 0 */
+FREERDP_LOCAL void bulk_rebase_offsets_sse2(UINT16* dst, const UINT16* src, size_t count,
+                                            UINT16 offset);
+
+#endif /* FREERDP_LIB_CODEC_BULK_SSE2_H */
@@ -38,6 +38,18 @@
 #define CLEARCODEC_VBAR_SIZE 32768
 #define CLEARCODEC_VBAR_SHORT_SIZE 16384
 
+#define CLEARCODEC_SUBCODEC_UNCOMPRESSED 0
+#define CLEARCODEC_SUBCODEC_NSCODEC 1
+#define CLEARCODEC_SUBCODEC_RLEX 2
+
+/* Encoder limits and lookup table sizes */
+#define CLEARCODEC_GLYPH_MAX_PIXELS 1024
+#define CLEARCODEC_BAND_MAX_HEIGHT 52
+#define CLEARCODEC_RLEX_MAX_COLORS 127
+#define CLEARCODEC_GLYPH_LOOKUP_SIZE 8192
+#define CLEARCODEC_VBAR_LOOKUP_SIZE 65536
+#define CLEARCODEC_VBAR_SHORT_LOOKUP_SIZE 32768
+
 typedef struct
 {
 	UINT32 size;
@@ -67,6 +79,22 @@ struct S_CLEAR_CONTEXT
 	CLEAR_VBAR_ENTRY VBarStorage[CLEARCODEC_VBAR_SIZE];
 	UINT32 ShortVBarStorageCursor;
 	CLEAR_VBAR_ENTRY ShortVBarStorage[CLEARCODEC_VBAR_SHORT_SIZE];
+
+	/* Encoder state, the caches above mirror the ones of the remote decoder */
+	BOOL CacheResetPending;
+	UINT32 GlyphCursor;
+	UINT32* GlyphLookup;
+	UINT32* VBarLookup;
+	UINT32* ShortVBarLookup;
+	UINT32* Pixels;
+	UINT32 PixelsSize;
+	UINT32* RowCover;
+	UINT32 RowCoverSize;
+	BYTE* Indices;
+	UINT32 IndicesSize;
+	wStream* EncodeStream;
+	wStream* BandsStream;
+	wStream* SubcodecStream;
 };
 
 static const UINT32 CLEAR_LOG2_FLOOR[256] = {
@@ -1117,11 +1145,798 @@ fail:
 	return rc;
 }
 
-int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, BYTE** ppDstData,
+static void clear_encoder_invalidate(CLEAR_CONTEXT* clear)
+{
+	/* Forget everything the decoder might know, the next frame resets its cursors */
+	ZeroMemory(clear->GlyphLookup, CLEARCODEC_GLYPH_LOOKUP_SIZE * sizeof(UINT32));
+	ZeroMemory(clear->VBarLookup, CLEARCODEC_VBAR_LOOKUP_SIZE * sizeof(UINT32));
+	ZeroMemory(clear->ShortVBarLookup, CLEARCODEC_VBAR_SHORT_LOOKUP_SIZE * sizeof(UINT32));
+	clear->GlyphCursor = 0;
+	clear->VBarStorageCursor = 0;
+	clear->ShortVBarStorageCursor = 0;
+	clear->CacheResetPending = TRUE;
+}
+
+static INLINE UINT32 clear_hash_pixels(const UINT32* pixels, UINT32 count)
+{
+	UINT32 i;
+	UINT32 hash = 2166136261u ^ count;
+
+	for (i = 0; i < count; i++)
+		hash = (hash ^ pixels[i]) * 16777619u;
+
+	return hash ^ (hash >> 15);
+}
+
+static INLINE BOOL clear_vbar_entry_equals(const CLEAR_VBAR_ENTRY* entry, const UINT32* pixels,
+                                           UINT32 count)
+{
+	if (entry->count != count)
+		return FALSE;
+
+	if (count == 0)
+		return TRUE;
+
+	return memcmp(entry->pixels, pixels, count * sizeof(UINT32)) == 0;
+}
+
+static BOOL clear_vbar_entry_store(CLEAR_CONTEXT* clear, CLEAR_VBAR_ENTRY* entry,
+                                   const UINT32* pixels, UINT32 count)
+{
+	/* The compressor keeps PIXEL_FORMAT_BGRX32, so an entry holds one UINT32 per pixel */
+	entry->count = count;
+
+	if (!resize_vbar_entry(clear, entry))
+		return FALSE;
+
+	if (count > 0)
+		CopyMemory(entry->pixels, pixels, count * sizeof(UINT32));
+
+	return TRUE;
+}
+
+static INLINE void clear_write_color(wStream* s, UINT32 color)
+{
+	Stream_Write_UINT8(s, color & 0xFF);         /* blue */
+	Stream_Write_UINT8(s, (color >> 8) & 0xFF);  /* green */
+	Stream_Write_UINT8(s, (color >> 16) & 0xFF); /* red */
+}
+
+static INLINE void clear_write_run_length(wStream* s, UINT32 runLength)
+{
+	if (runLength < 0xFF)
+	{
+		Stream_Write_UINT8(s, (BYTE)runLength);
+		return;
+	}
+
+	Stream_Write_UINT8(s, 0xFF);
+
+	if (runLength < 0xFFFF)
+	{
+		Stream_Write_UINT16(s, (UINT16)runLength);
+		return;
+	}
+
+	Stream_Write_UINT16(s, 0xFFFF);
+	Stream_Write_UINT32(s, runLength);
+}
+
+/* Looks up a color of the RLEX palette, adding it if there is room left */
+static INLINE BOOL clear_palette_index(UINT32* keys, BYTE* values, UINT32* palette,
+                                       UINT32* paletteCount, UINT32 color, BYTE* pIndex)
+{
+	UINT32 slot = ((color * 2654435761u) >> 24) & 0xFF;
+
+	while (keys[slot] != UINT32_MAX)
+	{
+		if (keys[slot] == color)
+		{
+			*pIndex = values[slot];
+			return TRUE;
+		}
+
+		slot = (slot + 1) & 0xFF;
+	}
+
+	if (*paletteCount >= CLEARCODEC_RLEX_MAX_COLORS)
+		return FALSE;
+
+	keys[slot] = color;
+	values[slot] = (BYTE)*paletteCount;
+	palette[*paletteCount] = color;
+	*pIndex = values[slot];
+	(*paletteCount)++;
+	return TRUE;
+}
+
+static BOOL clear_encode_prepare(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcFormat,
+                                 UINT32 nSrcStep, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 i;
+	const UINT32 count = nWidth * nHeight;
+
+	if (count > clear->PixelsSize)
+	{
+		UINT32* tmp = (UINT32*)realloc(clear->Pixels, count * sizeof(UINT32));
+
+		if (!tmp)
+			return FALSE;
+
+		clear->Pixels = tmp;
+		clear->PixelsSize = count;
+	}
+
+	if (2 * nHeight > clear->RowCoverSize)
+	{
+		UINT32* tmp = (UINT32*)realloc(clear->RowCover, 2 * nHeight * sizeof(UINT32));
+
+		if (!tmp)
+			return FALSE;
+
+		clear->RowCover = tmp;
+		clear->RowCoverSize = 2 * nHeight;
+	}
+
+	if (nWidth * CLEARCODEC_BAND_MAX_HEIGHT > clear->IndicesSize)
+	{
+		BYTE* tmp = (BYTE*)realloc(clear->Indices, nWidth * CLEARCODEC_BAND_MAX_HEIGHT);
+
+		if (!tmp)
+			return FALSE;
+
+		clear->Indices = tmp;
+		clear->IndicesSize = nWidth * CLEARCODEC_BAND_MAX_HEIGHT;
+	}
+
+	if (!freerdp_image_copy((BYTE*)clear->Pixels, PIXEL_FORMAT_BGRX32, nWidth * 4, 0, 0, nWidth,
+	                        nHeight, pSrcData, SrcFormat, nSrcStep, 0, 0, NULL,
+	                        FREERDP_FLIP_NONE))
+		return FALSE;
+
+	/* Pack as 0x00RRGGBB so that the alpha channel never breaks a match */
+	for (i = 0; i < count; i++)
+	{
+		const BYTE* pixel = (const BYTE*)&clear->Pixels[i];
+		clear->Pixels[i] = pixel[0] | ((UINT32)pixel[1] << 8) | ((UINT32)pixel[2] << 16);
+	}
+
+	ZeroMemory(clear->RowCover, 2 * nHeight * sizeof(UINT32));
+	return TRUE;
+}
+
+/**
+ * A bitmap small enough to be a glyph is stored in the glyph cache of the decoder,
+ * if the same content is sent again only its index is sent.
+ */
+static BOOL clear_encode_glyph(CLEAR_CONTEXT* clear, UINT32 nWidth, UINT32 nHeight,
+                               UINT16* pGlyphIndex, BOOL* pGlyphHit)
+{
+	UINT32 index;
+	UINT32 slot;
+	CLEAR_GLYPH_ENTRY* glyphEntry;
+	const UINT32 count = nWidth * nHeight;
+
+	slot = clear_hash_pixels(clear->Pixels, count) & (CLEARCODEC_GLYPH_LOOKUP_SIZE - 1);
+	index = clear->GlyphLookup[slot];
+
+	if (index > 0)
+	{
+		glyphEntry = &clear->GlyphCache[index - 1];
+
+		/* The decoder only needs as many pixels, the dimensions may differ */
+		if ((glyphEntry->count == count) &&
+		    (memcmp(glyphEntry->pixels, clear->Pixels, count * sizeof(UINT32)) == 0))
+		{
+			*pGlyphIndex = (UINT16)(index - 1);
+			*pGlyphHit = TRUE;
+			return TRUE;
+		}
+	}
+
+	index = clear->GlyphCursor;
+	clear->GlyphCursor = (clear->GlyphCursor + 1) % ARRAYSIZE(clear->GlyphCache);
+	glyphEntry = &clear->GlyphCache[index];
+
+	if (count > glyphEntry->size)
+	{
+		UINT32* tmp = (UINT32*)realloc(glyphEntry->pixels, count * sizeof(UINT32));
+
+		if (!tmp)
+			return FALSE;
+
+		glyphEntry->pixels = tmp;
+		glyphEntry->size = count;
+	}
+
+	glyphEntry->count = count;
+	CopyMemory(glyphEntry->pixels, clear->Pixels, count * sizeof(UINT32));
+	clear->GlyphLookup[slot] = index + 1;
+	*pGlyphIndex = (UINT16)index;
+	*pGlyphHit = FALSE;
+	return TRUE;
+}
+
+static BOOL clear_encode_residual(CLEAR_CONTEXT* clear, wStream* s, UINT32 nWidth, UINT32 nHeight)
+{
+	UINT32 x, y;
+	UINT32 color = 0;
+	UINT32 runLength = 0;
+	BOOL haveColor = FALSE;
+
+	/* Pixels covered by bands or subcodecs are overwritten, they extend any run */
+	for (y = 0; y < nHeight; y++)
+	{
+		const UINT32* row = &clear->Pixels[y * nWidth];
+		const UINT32 coverStart = clear->RowCover[2 * y];
+		const UINT32 coverEnd = clear->RowCover[2 * y + 1];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			if ((x >= coverStart) && (x < coverEnd))
+			{
+				runLength += coverEnd - coverStart;
+				x = coverEnd - 1;
+				continue;
+			}
+
+			if (haveColor && (row[x] != color))
+			{
+				if (!Stream_EnsureRemainingCapacity(s, 10))
+					return FALSE;
+
+				clear_write_color(s, color);
+				clear_write_run_length(s, runLength);
+				runLength = 0;
+			}
+
+			color = row[x];
+			haveColor = TRUE;
+			runLength++;
+		}
+	}
+
+	if (!haveColor)
+		return TRUE;
+
+	if (!Stream_EnsureRemainingCapacity(s, 10))
+		return FALSE;
+
+	clear_write_color(s, color);
+	clear_write_run_length(s, runLength);
+	return TRUE;
+}
+
+static void clear_read_vbar(const CLEAR_CONTEXT* clear, UINT32 nWidth, UINT32 x, UINT32 yStart,
+                            UINT32 vBarHeight, UINT32 colorBkg, UINT32* vBar, UINT32* pYOn,
+                            UINT32* pYOff)
+{
+	UINT32 y;
+	UINT32 vBarYOn = vBarHeight;
+	UINT32 vBarYOff = 0;
+
+	for (y = 0; y < vBarHeight; y++)
+	{
+		vBar[y] = clear->Pixels[(yStart + y) * nWidth + x];
+
+		if (vBar[y] != colorBkg)
+		{
+			if (vBarYOn == vBarHeight)
+				vBarYOn = y;
+
+			vBarYOff = y + 1;
+		}
+	}
+
+	*pYOn = (vBarYOff > 0) ? vBarYOn : 0;
+	*pYOff = vBarYOff;
+}
+
+/* The size of a band, given the cache content and the vBars repeated within the band */
+static UINT32 clear_estimate_band(const CLEAR_CONTEXT* clear, UINT32 nWidth, UINT32 xStart,
+                                  UINT32 xEnd, UINT32 yStart, UINT32 yEnd, UINT32 colorBkg)
+{
+	UINT32 x;
+	UINT32 hash;
+	UINT32 index;
+	UINT32 vBarYOn;
+	UINT32 vBarYOff;
+	UINT32 size = 11;
+	UINT32 seen[1024] = { 0 };
+	UINT32 vBar[CLEARCODEC_BAND_MAX_HEIGHT];
+	const UINT32 vBarHeight = yEnd - yStart;
+
+	for (x = xStart; x < xEnd; x++)
+	{
+		clear_read_vbar(clear, nWidth, x, yStart, vBarHeight, colorBkg, vBar, &vBarYOn, &vBarYOff);
+		hash = clear_hash_pixels(vBar, vBarHeight) | 1;
+		index = clear->VBarLookup[hash & (CLEARCODEC_VBAR_LOOKUP_SIZE - 1)];
+
+		if ((seen[hash % ARRAYSIZE(seen)] == hash) ||
+		    ((index > 0) &&
+		     clear_vbar_entry_equals(&clear->VBarStorage[index - 1], vBar, vBarHeight)))
+		{
+			size += 2;
+			continue;
+		}
+
+		seen[hash % ARRAYSIZE(seen)] = hash;
+		index = clear->ShortVBarLookup[clear_hash_pixels(&vBar[vBarYOn], vBarYOff - vBarYOn) &
+		                               (CLEARCODEC_VBAR_SHORT_LOOKUP_SIZE - 1)];
+
+		if ((index > 0) && clear_vbar_entry_equals(&clear->ShortVBarStorage[index - 1],
+		                                           &vBar[vBarYOn], vBarYOff - vBarYOn))
+			size += 3;
+		else
+			size += 2 + 3 * (vBarYOff - vBarYOn);
+	}
+
+	return size;
+}
+
+static BOOL clear_encode_band(CLEAR_CONTEXT* clear, wStream* s, UINT32 nWidth, UINT32 xStart,
+                              UINT32 xEnd, UINT32 yStart, UINT32 yEnd, UINT32 colorBkg)
+{
+	UINT32 x, y;
+	UINT32 vBar[CLEARCODEC_BAND_MAX_HEIGHT];
+	const UINT32 vBarHeight = yEnd - yStart;
+
+	if (!Stream_EnsureRemainingCapacity(s, 11))
+		return FALSE;
+
+	Stream_Write_UINT16(s, (UINT16)xStart);
+	Stream_Write_UINT16(s, (UINT16)(xEnd - 1));
+	Stream_Write_UINT16(s, (UINT16)yStart);
+	Stream_Write_UINT16(s, (UINT16)(yEnd - 1));
+	clear_write_color(s, colorBkg);
+
+	for (x = xStart; x < xEnd; x++)
+	{
+		UINT32 slot;
+		UINT32 shortSlot;
+		UINT32 index;
+		UINT32 vBarYOn;
+		UINT32 vBarYOff;
+		UINT32 vBarShortPixelCount;
+
+		clear_read_vbar(clear, nWidth, x, yStart, vBarHeight, colorBkg, vBar, &vBarYOn, &vBarYOff);
+		vBarShortPixelCount = vBarYOff - vBarYOn;
+
+		if (!Stream_EnsureRemainingCapacity(s, 2 + 3ull * vBarShortPixelCount))
+			return FALSE;
+
+		slot = clear_hash_pixels(vBar, vBarHeight) & (CLEARCODEC_VBAR_LOOKUP_SIZE - 1);
+		index = clear->VBarLookup[slot];
+
+		if ((index > 0) &&
+		    clear_vbar_entry_equals(&clear->VBarStorage[index - 1], vBar, vBarHeight))
+		{
+			Stream_Write_UINT16(s, (UINT16)(0x8000 | (index - 1))); /* VBAR_CACHE_HIT */
+			continue;
+		}
+
+		shortSlot = clear_hash_pixels(&vBar[vBarYOn], vBarShortPixelCount) &
+		            (CLEARCODEC_VBAR_SHORT_LOOKUP_SIZE - 1);
+		index = clear->ShortVBarLookup[shortSlot];
+
+		if ((index > 0) && clear_vbar_entry_equals(&clear->ShortVBarStorage[index - 1],
+		                                           &vBar[vBarYOn], vBarShortPixelCount))
+		{
+			Stream_Write_UINT16(s, (UINT16)(0x4000 | (index - 1))); /* SHORT_VBAR_CACHE_HIT */
+			Stream_Write_UINT8(s, (BYTE)vBarYOn);
+		}
+		else
+		{
+			/* SHORT_VBAR_CACHE_MISS */
+			Stream_Write_UINT16(s, (UINT16)((vBarYOff << 8) | vBarYOn));
+
+			for (y = vBarYOn; y < vBarYOff; y++)
+				clear_write_color(s, vBar[y]);
+
+			index = clear->ShortVBarStorageCursor;
+
+			if (!clear_vbar_entry_store(clear, &clear->ShortVBarStorage[index], &vBar[vBarYOn],
+			                            vBarShortPixelCount))
+				return FALSE;
+
+			clear->ShortVBarLookup[shortSlot] = index + 1;
+			clear->ShortVBarStorageCursor = (index + 1) % CLEARCODEC_VBAR_SHORT_SIZE;
+		}
+
+		/* Both short vBar variants make the decoder store the full vBar */
+		index = clear->VBarStorageCursor;
+
+		if (!clear_vbar_entry_store(clear, &clear->VBarStorage[index], vBar, vBarHeight))
+			return FALSE;
+
+		clear->VBarLookup[slot] = index + 1;
+		clear->VBarStorageCursor = (index + 1) % CLEARCODEC_VBAR_SIZE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_rlex(CLEAR_CONTEXT* clear, wStream* s, const UINT32* palette,
+                              UINT32 paletteCount, UINT32 pixelCount)
+{
+	UINT32 i;
+	UINT32 pixelIndex = 0;
+	const BYTE* indices = clear->Indices;
+	const UINT32 numBits = CLEAR_LOG2_FLOOR[paletteCount - 1] + 1;
+	const UINT32 maxSuiteDepth = (1u << (8 - numBits)) - 1;
+
+	if (!Stream_EnsureRemainingCapacity(s, 1 + 3ull * paletteCount))
+		return FALSE;
+
+	Stream_Write_UINT8(s, (BYTE)paletteCount);
+
+	for (i = 0; i < paletteCount; i++)
+		clear_write_color(s, palette[i]);
+
+	/* Each segment is a run of its start color followed by a suite of palette entries */
+	while (pixelIndex < pixelCount)
+	{
+		UINT32 runLength = 0;
+		UINT32 suiteDepth = 0;
+		const BYTE startIndex = indices[pixelIndex];
+
+		while ((pixelIndex + runLength + 1 < pixelCount) &&
+		       (indices[pixelIndex + runLength + 1] == startIndex))
+			runLength++;
+
+		pixelIndex += runLength;
+
+		while ((suiteDepth < maxSuiteDepth) && (pixelIndex + suiteDepth + 1 < pixelCount) &&
+		       (indices[pixelIndex + suiteDepth + 1] == startIndex + suiteDepth + 1))
+			suiteDepth++;
+
+		pixelIndex += suiteDepth + 1;
+
+		if (!Stream_EnsureRemainingCapacity(s, 8))
+			return FALSE;
+
+		Stream_Write_UINT8(s, (BYTE)((suiteDepth << numBits) | (startIndex + suiteDepth)));
+		clear_write_run_length(s, runLength);
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_subcodec(CLEAR_CONTEXT* clear, wStream* s, const BYTE* pSrcData,
+                                  UINT32 SrcFormat, UINT32 nSrcStep, UINT32 nWidth,
+                                  UINT32 xStart, UINT32 xEnd, UINT32 yStart, UINT32 yEnd,
+                                  const UINT32* palette, UINT32 paletteCount)
+{
+	UINT32 x, y;
+	size_t headerPos;
+	size_t dataPos;
+	size_t endPos;
+	BYTE subcodecId;
+	const UINT32 width = xEnd - xStart;
+	const UINT32 height = yEnd - yStart;
+
+	if (!Stream_EnsureRemainingCapacity(s, 13))
+		return FALSE;
+
+	headerPos = Stream_GetPosition(s);
+	Stream_Seek(s, 13);
+	dataPos = Stream_GetPosition(s);
+
+	if (paletteCount > 0)
+	{
+		subcodecId = CLEARCODEC_SUBCODEC_RLEX;
+
+		if (!clear_encode_rlex(clear, s, palette, paletteCount, width * height))
+			return FALSE;
+	}
+	else
+	{
+		const UINT32 nTempStep = width * FreeRDPGetBytesPerPixel(clear->format);
+		const BYTE* src =
+		    &pSrcData[yStart * nSrcStep + xStart * FreeRDPGetBytesPerPixel(SrcFormat)];
+
+		/* NSCodec is lossy, it is only used if it actually saves something */
+		subcodecId = CLEARCODEC_SUBCODEC_NSCODEC;
+
+		/* The NSCodec encoder expects a bottom up bitmap */
+		if (!clear_resize_buffer(clear, width, height))
+			return FALSE;
+
+		if (!freerdp_image_copy(clear->TempBuffer, clear->format, nTempStep, 0, 0, width, height,
+		                        src, SrcFormat, nSrcStep, 0, 0, NULL, FREERDP_FLIP_VERTICAL))
+			return FALSE;
+
+		if ((width * height < 64) ||
+		    !nsc_compose_message(clear->nsc, s, clear->TempBuffer, width, height, nTempStep) ||
+		    (Stream_GetPosition(s) - dataPos >= 3ull * width * height))
+		{
+			subcodecId = CLEARCODEC_SUBCODEC_UNCOMPRESSED;
+			Stream_SetPosition(s, dataPos);
+
+			if (!Stream_EnsureRemainingCapacity(s, 3ull * width * height))
+				return FALSE;
+
+			for (y = yStart; y < yEnd; y++)
+			{
+				for (x = xStart; x < xEnd; x++)
+					clear_write_color(s, clear->Pixels[y * nWidth + x]);
+			}
+		}
+	}
+
+	endPos = Stream_GetPosition(s);
+	Stream_SetPosition(s, headerPos);
+	Stream_Write_UINT16(s, (UINT16)xStart);
+	Stream_Write_UINT16(s, (UINT16)yStart);
+	Stream_Write_UINT16(s, (UINT16)width);
+	Stream_Write_UINT16(s, (UINT16)height);
+	Stream_Write_UINT32(s, (UINT32)(endPos - dataPos));
+	Stream_Write_UINT8(s, subcodecId);
+	Stream_SetPosition(s, endPos);
+	return TRUE;
+}
+
+/**
+ * Encodes up to CLEARCODEC_BAND_MAX_HEIGHT rows that are not a single color.
+ *
+ * Text and UI elements are sent as a band of vBars, which the decoder caches column by
+ * column, or with RLEX if that is smaller. Content with too many colors for RLEX that
+ * does not repeat goes to NSCodec. Pixels equal to the dominant color left and right of
+ * the encoded rectangle are part of the residual layer.
+ */
+static BOOL clear_encode_rows(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcFormat,
+                              UINT32 nSrcStep, UINT32 nWidth, UINT32 yStart, UINT32 yEnd)
+{
+	UINT32 x, y;
+	UINT32 colorBkg = 0;
+	UINT32 votes = 0;
+	UINT32 xStart = nWidth;
+	UINT32 xEnd = 0;
+	UINT32 runCount = 0;
+	UINT32 area;
+	UINT32 bandSize;
+	UINT32 pixelIndex = 0;
+	UINT32 paletteCount = 0;
+	BOOL paletteFull = FALSE;
+	UINT32 palette[CLEARCODEC_RLEX_MAX_COLORS];
+	UINT32 keys[256];
+	BYTE values[256];
+
+	/* Majority vote, finds the background if it covers more than half of the rows */
+	for (y = yStart; y < yEnd; y++)
+	{
+		const UINT32* row = &clear->Pixels[y * nWidth];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			if (votes == 0)
+			{
+				colorBkg = row[x];
+				votes = 1;
+			}
+			else if (row[x] == colorBkg)
+				votes++;
+			else
+				votes--;
+		}
+	}
+
+	for (y = yStart; y < yEnd; y++)
+	{
+		const UINT32* row = &clear->Pixels[y * nWidth];
+
+		for (x = 0; x < nWidth; x++)
+		{
+			if (row[x] != colorBkg)
+			{
+				xStart = MIN(xStart, x);
+				xEnd = MAX(xEnd, x + 1);
+			}
+		}
+	}
+
+	if (xStart >= xEnd)
+		return TRUE;
+
+	memset(keys, 0xFF, sizeof(keys));
+
+	for (y = yStart; y < yEnd; y++)
+	{
+		const UINT32* row = &clear->Pixels[y * nWidth];
+
+		for (x = xStart; x < xEnd; x++)
+		{
+			if ((x == xStart) || (row[x] != row[x - 1]))
+				runCount++;
+
+			if (!paletteFull &&
+			    !clear_palette_index(keys, values, palette, &paletteCount, row[x],
+			                         &clear->Indices[pixelIndex]))
+				paletteFull = TRUE;
+
+			pixelIndex++;
+		}
+	}
+
+	if (paletteFull)
+		paletteCount = 0;
+
+	for (y = yStart; y < yEnd; y++)
+	{
+		clear->RowCover[2 * y] = xStart;
+		clear->RowCover[2 * y + 1] = xEnd;
+	}
+
+	area = (xEnd - xStart) * (yEnd - yStart);
+	bandSize = clear_estimate_band(clear, nWidth, xStart, xEnd, yStart, yEnd, colorBkg);
+
+	/**
+	 * RLEX needs roughly two bytes per run. vBars sent now are cache hits later on,
+	 * so RLEX has to be clearly smaller.
+	 */
+	if ((paletteCount > 0) && (2 * (1 + 3 * paletteCount + 2 * runCount) < bandSize))
+		return clear_encode_subcodec(clear, clear->SubcodecStream, pSrcData, SrcFormat, nSrcStep,
+		                             nWidth, xStart, xEnd, yStart, yEnd, palette, paletteCount);
+
+	/* Lossless vBars are preferred over NSCodec unless they are expensive */
+	if ((paletteCount > 0) || (bandSize <= area))
+		return clear_encode_band(clear, clear->BandsStream, nWidth, xStart, xEnd, yStart, yEnd,
+		                         colorBkg);
+
+	return clear_encode_subcodec(clear, clear->SubcodecStream, pSrcData, SrcFormat, nSrcStep,
+	                             nWidth, xStart, xEnd, yStart, yEnd, NULL, 0);
+}
+
+static BOOL clear_row_is_uniform(const UINT32* row, UINT32 nWidth)
+{
+	UINT32 x;
+
+	for (x = 1; x < nWidth; x++)
+	{
+		if (row[x] != row[0])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL clear_encode_composition(CLEAR_CONTEXT* clear, wStream* s, const BYTE* pSrcData,
+                                     UINT32 SrcFormat, UINT32 nSrcStep, UINT32 nWidth,
+                                     UINT32 nHeight)
+{
+	UINT32 y = 0;
+	size_t headerPos;
+	size_t residualByteCount;
+	size_t bandsByteCount;
+	size_t subcodecByteCount;
+
+	Stream_SetPosition(clear->BandsStream, 0);
+	Stream_SetPosition(clear->SubcodecStream, 0);
+
+	/* Rows of a single color are left to the residual layer */
+	while (y < nHeight)
+	{
+		UINT32 yEnd = y + 1;
+
+		if (clear_row_is_uniform(&clear->Pixels[y * nWidth], nWidth))
+		{
+			y++;
+			continue;
+		}
+
+		while ((yEnd < nHeight) && (yEnd - y < CLEARCODEC_BAND_MAX_HEIGHT) &&
+		       !clear_row_is_uniform(&clear->Pixels[yEnd * nWidth], nWidth))
+			yEnd++;
+
+		if (!clear_encode_rows(clear, pSrcData, SrcFormat, nSrcStep, nWidth, y, yEnd))
+			return FALSE;
+
+		y = yEnd;
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, 12))
+		return FALSE;
+
+	headerPos = Stream_GetPosition(s);
+	Stream_Seek(s, 12);
+
+	if (!clear_encode_residual(clear, s, nWidth, nHeight))
+		return FALSE;
+
+	residualByteCount = Stream_GetPosition(s) - headerPos - 12;
+	bandsByteCount = Stream_GetPosition(clear->BandsStream);
+	subcodecByteCount = Stream_GetPosition(clear->SubcodecStream);
+
+	if ((residualByteCount > UINT32_MAX) || (bandsByteCount > UINT32_MAX) ||
+	    (subcodecByteCount > UINT32_MAX))
+		return FALSE;
+
+	if (!Stream_EnsureRemainingCapacity(s, bandsByteCount + subcodecByteCount))
+		return FALSE;
+
+	Stream_Write(s, Stream_Buffer(clear->BandsStream), bandsByteCount);
+	Stream_Write(s, Stream_Buffer(clear->SubcodecStream), subcodecByteCount);
+
+	Stream_SetPosition(s, headerPos);
+	Stream_Write_UINT32(s, (UINT32)residualByteCount);
+	Stream_Write_UINT32(s, (UINT32)bandsByteCount);
+	Stream_Write_UINT32(s, (UINT32)subcodecByteCount);
+	Stream_Seek(s, residualByteCount + bandsByteCount + subcodecByteCount);
+	return TRUE;
+}
+
+int clear_compress(CLEAR_CONTEXT* clear, const BYTE* pSrcData, UINT32 SrcSize, UINT32 SrcFormat,
+                   UINT32 nWidth, UINT32 nHeight, UINT32 nSrcStep, BYTE** ppDstData,
                    UINT32* pDstSize)
 {
-	WLog_ERR(TAG, "TODO: %s not implemented!", __FUNCTION__);
+	wStream* s;
+	UINT32 seqNumber;
+	BYTE glyphFlags = 0;
+	UINT16 glyphIndex = 0;
+	BOOL glyphHit = FALSE;
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+
+	if (!clear || !clear->Compressor || !pSrcData || !ppDstData || !pDstSize)
+		return -1;
+
+	if ((nWidth == 0) || (nHeight == 0) || (nWidth > 0xFFFF) || (nHeight > 0xFFFF) || (bpp == 0))
+		return -1;
+
+	if (nSrcStep == 0)
+		nSrcStep = nWidth * bpp;
+
+	if (1ull * nSrcStep * (nHeight - 1) + 1ull * nWidth * bpp > SrcSize)
+		return -1;
+
+	if (!clear_encode_prepare(clear, pSrcData, SrcFormat, nSrcStep, nWidth, nHeight))
+		return -2;
+
+	seqNumber = clear->seqNumber;
+
+	if (nWidth * nHeight <= CLEARCODEC_GLYPH_MAX_PIXELS)
+	{
+		if (!clear_encode_glyph(clear, nWidth, nHeight, &glyphIndex, &glyphHit))
+			goto fail;
+
+		glyphFlags |= CLEARCODEC_FLAG_GLYPH_INDEX;
+
+		if (glyphHit)
+			glyphFlags |= CLEARCODEC_FLAG_GLYPH_HIT;
+	}
+
+	if (clear->CacheResetPending)
+	{
+		glyphFlags |= CLEARCODEC_FLAG_CACHE_RESET;
+		clear->CacheResetPending = FALSE;
+	}
+
+	s = clear->EncodeStream;
+	Stream_SetPosition(s, 0);
+
+	if (!Stream_EnsureRemainingCapacity(s, 4))
+		goto fail;
+
+	Stream_Write_UINT8(s, glyphFlags);
+	Stream_Write_UINT8(s, (BYTE)seqNumber);
+	clear->seqNumber = (seqNumber + 1) % 256;
+
+	if (glyphFlags & CLEARCODEC_FLAG_GLYPH_INDEX)
+		Stream_Write_UINT16(s, glyphIndex);
+
+	if (!glyphHit)
+	{
+		if (!clear_encode_composition(clear, s, pSrcData, SrcFormat, nSrcStep, nWidth, nHeight))
+			goto fail;
+	}
+
+	*ppDstData = Stream_Buffer(s);
+	*pDstSize = (UINT32)Stream_GetPosition(s);
 	return 1;
+fail:
+	/* The frame is dropped and the caches might no longer match the decoder, start over */
+	clear->seqNumber = seqNumber;
+	clear_encoder_invalidate(clear);
+	return -3;
 }
 
 BOOL clear_context_reset(CLEAR_CONTEXT* clear)
@@ -1160,6 +1975,24 @@ CLEAR_CONTEXT* clear_context_new(BOOL Compressor)
 	if (!clear->TempBuffer)
 		goto error_nsc;
 
+	if (Compressor)
+	{
+		clear->GlyphLookup = (UINT32*)calloc(CLEARCODEC_GLYPH_LOOKUP_SIZE, sizeof(UINT32));
+		clear->VBarLookup = (UINT32*)calloc(CLEARCODEC_VBAR_LOOKUP_SIZE, sizeof(UINT32));
+		clear->ShortVBarLookup =
+		    (UINT32*)calloc(CLEARCODEC_VBAR_SHORT_LOOKUP_SIZE, sizeof(UINT32));
+		clear->EncodeStream = Stream_New(NULL, 4096);
+		clear->BandsStream = Stream_New(NULL, 4096);
+		clear->SubcodecStream = Stream_New(NULL, 4096);
+
+		if (!clear->GlyphLookup || !clear->VBarLookup || !clear->ShortVBarLookup ||
+		    !clear->EncodeStream || !clear->BandsStream || !clear->SubcodecStream)
+			goto error_nsc;
+
+		/* The first frame resets the vBar cursors of the decoder */
+		clear->CacheResetPending = TRUE;
+	}
+
 	if (!clear_context_reset(clear))
 		goto error_nsc;
 
@@ -1180,5 +2013,14 @@ void clear_context_free(CLEAR_CONTEXT* clear)
 	clear_reset_vbar_storage(clear, TRUE);
 	clear_reset_glyph_cache(clear);
 
+	free(clear->GlyphLookup);
+	free(clear->VBarLookup);
+	free(clear->ShortVBarLookup);
+	free(clear->Pixels);
+	free(clear->RowCover);
+	free(clear->Indices);
+	Stream_Free(clear->EncodeStream, TRUE);
+	Stream_Free(clear->BandsStream, TRUE);
+	Stream_Free(clear->SubcodecStream, TRUE);
 	free(clear);
 }
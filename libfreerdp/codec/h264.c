@@ -25,6 +25,8 @@
 #include <winpr/library.h>
 #include <winpr/bitstream.h>
 #include <winpr/synch.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/primitives.h>
 #include <freerdp/codec/h264.h>
@@ -115,13 +117,13 @@ INT32 avc420_decompress(H264_CONTEXT* h264, const BYTE* pSrcData, UINT32 SrcSize
 	return 1;
 }
 
-static BOOL allocate_h264_metablock(UINT32 QP, RECTANGLE_16* rectangles,
+static BOOL allocate_h264_metablock(const BYTE* qps, RECTANGLE_16* rectangles,
                                     RDPGFX_H264_METABLOCK* meta, size_t count)
 {
 	size_t x;
 
 	/* [MS-RDPEGFX] 2.2.4.4.2 RDPGFX_AVC420_QUANT_QUALITY */
-	if (!meta || (QP > UINT8_MAX))
+	if (!meta || !qps)
 		return FALSE;
 
 	meta->regionRects = rectangles;
@@ -139,11 +141,11 @@ static BOOL allocate_h264_metablock(UINT32 QP, RECTANGLE_16* rectangles,
 	for (x = 0; x < count; x++)
 	{
 		RDPGFX_H264_QUANT_QUALITY* cur = &meta->quantQualityVals[x];
-		cur->qp = (UINT8)QP;
+		cur->qp = qps[x];
 
 		/* qpVal bit 6 and 7 are flags, so mask them out here.
 		 * qualityVal is [0-100] so 100 - qpVal [0-64] is always in range */
-		cur->qualityVal = 100 - (QP & 0x3F);
+		cur->qualityVal = 100 - (qps[x] & 0x3F);
 	}
 	return TRUE;
 }
@@ -181,48 +183,331 @@ static INLINE BOOL diff_tile(const RECTANGLE_16* regionRect, BYTE* pYUVData[3],
 	return FALSE;
 }
 
-static BOOL detect_changes(BOOL firstFrameDone, const UINT32 QP, const RECTANGLE_16* regionRect,
-                           BYTE* pYUVData[3], BYTE* pOldYUVData[3], UINT32 const iStride[3],
-                           RDPGFX_H264_METABLOCK* meta)
+static void copy_yuv_rect(const RECTANGLE_16* rect, BYTE* pDstData[3], BYTE* pSrcData[3],
+                          UINT32 const iStride[3])
 {
+	size_t x, y;
+	const size_t size = rect->right - rect->left;
+
+	for (y = rect->top; y < rect->bottom; y++)
+	{
+		const size_t offset = y * iStride[0] + rect->left;
+		memcpy(&pDstData[0][offset], &pSrcData[0][offset], size);
+	}
+
+	for (x = 1; x < 3; x++)
+	{
+		for (y = rect->top / 2; y < (rect->bottom + 1) / 2; y++)
+		{
+			const size_t offset = y * iStride[x] + rect->left / 2;
+			memcpy(&pDstData[x][offset], &pSrcData[x][offset], (size + 1) / 2);
+		}
+	}
+}
+
+/* The next frame is taken as changed everywhere */
+static void h264_invalidate_reference(H264_CONTEXT* h264)
+{
+	if (h264 && h264->rateControl)
+		h264->rateControl->referenceSize = 0;
+}
+
+typedef struct
+{
+	H264_CONTEXT* h264;
+	const RECTANGLE_16* regionRect;
+	const BYTE* pSrcData;
+	UINT32 nSrcStep;
+	size_t bpp;
+	BOOL full;
+	size_t row;
+	RECTANGLE_16* rects;
+	size_t count;
+} H264_SOURCE_WORK_PARAM;
+
+/**
+ * Compares one tile row of the source with the reference copy of the last
+ * converted frame. Whole scanlines are compared first, only differing ones
+ * are split into tiles. Changed tiles are flagged in the tile map, copied to
+ * the reference and returned as horizontal runs to convert.
+ */
+static void detect_source_row(H264_SOURCE_WORK_PARAM* param)
+{
+	size_t column, y;
+	H264_CONTEXT* h264 = param->h264;
+	H264_RATE_CONTROL* ctrl = h264->rateControl;
+	const RECTANGLE_16* regionRect = param->regionRect;
+	const size_t bpp = param->bpp;
+	const size_t firstColumn = regionRect->left / H264_TILE_SIZE;
+	const size_t lastColumn = MIN((regionRect->right - 1) / H264_TILE_SIZE, ctrl->columns - 1);
+	const size_t top = MAX(regionRect->top, param->row * H264_TILE_SIZE);
+	const size_t bottom = MIN(regionRect->bottom, (param->row + 1) * H264_TILE_SIZE);
+	BYTE* changed = &ctrl->changed[param->row * ctrl->columns];
+	size_t pending = param->full ? 0 : lastColumn - firstColumn + 1;
+
+	for (column = firstColumn; column <= lastColumn; column++)
+		changed[column] = param->full ? 1 : 0;
+
+	for (y = top; (pending > 0) && (y < bottom); y++)
+	{
+		const BYTE* src = &param->pSrcData[y * param->nSrcStep];
+		const BYTE* ref = &ctrl->reference[y * param->nSrcStep];
+		const size_t left = regionRect->left * bpp;
+
+		if (memcmp(&src[left], &ref[left], regionRect->right * bpp - left) == 0)
+			continue;
+
+		for (column = firstColumn; column <= lastColumn; column++)
+		{
+			const size_t l = MAX(regionRect->left, column * H264_TILE_SIZE) * bpp;
+			const size_t r = MIN(regionRect->right, (column + 1) * H264_TILE_SIZE) * bpp;
+
+			if (changed[column] || (memcmp(&src[l], &ref[l], r - l) == 0))
+				continue;
+
+			changed[column] = 1;
+			pending--;
+		}
+	}
+
+	param->count = 0;
+
+	for (column = firstColumn; column <= lastColumn; column++)
+	{
+		size_t right;
+		RECTANGLE_16* rect;
+
+		if (!changed[column])
+			continue;
+
+		/* Runs start on even pixels so the 2x2 chroma subsampling matches a
+		 * conversion of the whole frame. */
+		rect = &param->rects[param->count++];
+		rect->left = (UINT16)(MAX(regionRect->left, column * H264_TILE_SIZE) & ~1u);
+		rect->top = (UINT16)(top & ~1u);
+		rect->bottom = (UINT16)MIN(h264->height, (bottom + 1) & ~1u);
+
+		while ((column < lastColumn) && changed[column + 1])
+			column++;
+
+		right = MIN(regionRect->right, (column + 1) * H264_TILE_SIZE);
+		rect->right = (UINT16)MIN(h264->width, (right + 1) & ~(size_t)1);
+
+		for (y = rect->top; y < rect->bottom; y++)
+		{
+			const size_t offset = y * param->nSrcStep + rect->left * bpp;
+			memcpy(&ctrl->reference[offset], &param->pSrcData[offset],
+			       (rect->right - rect->left) * bpp);
+		}
+	}
+}
+
+static void CALLBACK detect_source_row_work_callback(PTP_CALLBACK_INSTANCE instance,
+                                                     void* context, PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	detect_source_row((H264_SOURCE_WORK_PARAM*)context);
+}
+
+/**
+ * Compares regionRect of the source frame with the reference, so unchanged
+ * areas are neither converted to YUV nor compared again. The tile rows are
+ * independent and compared in parallel.
+ */
+static BOOL detect_source_changes(H264_CONTEXT* h264, BOOL full, const RECTANGLE_16* regionRect,
+                                  const BYTE* pSrcData, UINT32 nSrcStep, UINT32 SrcFormat,
+                                  RECTANGLE_16** ppRects, UINT32* pNumRects)
+{
+	BOOL rc = FALSE;
+	size_t x, rows, columns;
+	size_t count = 0;
+	RECTANGLE_16* rects = NULL;
+	H264_SOURCE_WORK_PARAM* params = NULL;
+	H264_RATE_CONTROL* ctrl = h264->rateControl;
+	const size_t bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+	const size_t referenceSize = (size_t)nSrcStep * h264->height;
+
+	*ppRects = NULL;
+	*pNumRects = 0;
+
+	if ((regionRect->left >= regionRect->right) || (regionRect->top >= regionRect->bottom))
+		return TRUE;
+
+	if ((bpp == 0) || (regionRect->right > h264->width) || (regionRect->bottom > h264->height) ||
+	    (h264->width * bpp > nSrcStep))
+		return FALSE;
+
+	if ((ctrl->referenceStep != nSrcStep) || (ctrl->referenceSize != referenceSize))
+	{
+		BYTE* reference = (BYTE*)calloc(referenceSize, sizeof(BYTE));
+
+		if (!reference)
+			return FALSE;
+
+		free(ctrl->reference);
+		ctrl->reference = reference;
+		ctrl->referenceSize = referenceSize;
+		ctrl->referenceStep = nSrcStep;
+		full = TRUE;
+	}
+
+	columns = (regionRect->right - 1) / H264_TILE_SIZE - regionRect->left / H264_TILE_SIZE + 1;
+	rows = (regionRect->bottom - 1) / H264_TILE_SIZE - regionRect->top / H264_TILE_SIZE + 1;
+	rects = (RECTANGLE_16*)calloc(columns * rows, sizeof(RECTANGLE_16));
+	params = (H264_SOURCE_WORK_PARAM*)calloc(rows, sizeof(H264_SOURCE_WORK_PARAM));
+
+	if (!rects || !params)
+		goto fail;
+
+	for (x = 0; x < rows; x++)
+	{
+		H264_SOURCE_WORK_PARAM* param = &params[x];
+		param->h264 = h264;
+		param->regionRect = regionRect;
+		param->pSrcData = pSrcData;
+		param->nSrcStep = nSrcStep;
+		param->bpp = bpp;
+		param->full = full;
+		param->row = regionRect->top / H264_TILE_SIZE + x;
+		param->rects = &rects[x * columns];
+	}
+
+	rc = codec_jobs_run(ctrl->jobs, params, sizeof(H264_SOURCE_WORK_PARAM), rows,
+	                    detect_source_row_work_callback);
+fail:
+	for (x = 0; rc && (x < rows); x++)
+	{
+		memmove(&rects[count], params[x].rects, params[x].count * sizeof(RECTANGLE_16));
+		count += params[x].count;
+	}
+
+	free(params);
+
+	if (!rc || (count == 0))
+	{
+		free(rects);
+		return rc;
+	}
+
+	*ppRects = rects;
+	*pNumRects = (UINT32)count;
+	return TRUE;
+}
+
+/**
+ * Collects the 64x64 tiles of regionRect flagged by detect_source_changes and
+ * assigns each a QP. With pOldYUVData set a flagged tile is only taken when
+ * its planes differ, as AVC444 splits a change on luma and chroma streams.
+ * The auxiliary (AVC444 chroma) planes are not laid out like the source, they
+ * are compared in whole 16 line bands and reuse the history of the luma pass.
+ */
+static BOOL detect_changes(H264_CONTEXT* h264, BOOL firstFrameDone, BOOL auxiliary,
+                           const RECTANGLE_16* regionRect, BYTE* pYUVData[3], BYTE* pOldYUVData[3],
+                           UINT32 const iStride[3], RDPGFX_H264_METABLOCK* meta)
+{
+	BOOL rc = FALSE;
 	size_t count = 0, wc, hc;
 	RECTANGLE_16* rectangles;
+	BYTE* qps;
+	H264_RATE_CONTROL* ctrl;
 
-	if (!regionRect || !pYUVData || !pOldYUVData || !iStride || !meta)
+	if (!h264 || !regionRect || !pYUVData || !iStride || !meta)
 		return FALSE;
 
-	wc = (regionRect->right - regionRect->left) / 64 + 1;
-	hc = (regionRect->bottom - regionRect->top) / 64 + 1;
-	rectangles = calloc(wc * hc, sizeof(RECTANGLE_16));
-	if (!rectangles)
+	ctrl = h264->rateControl;
+	if (!ctrl)
 		return FALSE;
+
+	wc = (regionRect->right - regionRect->left) / H264_TILE_SIZE + 2;
+	hc = (regionRect->bottom - regionRect->top) / H264_TILE_SIZE + 2;
+	rectangles = calloc(wc * hc, sizeof(RECTANGLE_16));
+	qps = calloc(wc * hc, sizeof(BYTE));
+	if (!rectangles || !qps)
+		goto fail;
 	if (!firstFrameDone)
 	{
 		rectangles[0] = *regionRect;
+		qps[0] = h264_rate_control_first_frame(h264, !auxiliary);
 		count = 1;
 	}
-	else
+	else if ((regionRect->left < regionRect->right) && (regionRect->top < regionRect->bottom))
 	{
-		size_t x, y;
-		for (y = regionRect->top; y < regionRect->bottom; y += 64)
+		size_t row, column;
+		const size_t lastColumn = MIN((regionRect->right - 1) / H264_TILE_SIZE, ctrl->columns - 1);
+		const size_t lastRow = MIN((regionRect->bottom - 1) / H264_TILE_SIZE, ctrl->rows - 1);
+
+		for (row = regionRect->top / H264_TILE_SIZE; row <= lastRow; row++)
 		{
-			for (x = regionRect->left; x < regionRect->right; x += 64)
+			int bandChanged = -1;
+
+			for (column = regionRect->left / H264_TILE_SIZE; column <= lastColumn; column++)
 			{
+				const size_t tile = row * ctrl->columns + column;
+				BOOL changed;
 				RECTANGLE_16 rect;
-				rect.left = (UINT16)MIN(UINT16_MAX, regionRect->left + x);
-				rect.top = (UINT16)MIN(UINT16_MAX, regionRect->top + y);
-				rect.right =
-				    (UINT16)MIN(UINT16_MAX, MIN(regionRect->left + x + 64, regionRect->right));
-				rect.bottom =
-				    (UINT16)MIN(UINT16_MAX, MIN(regionRect->top + y + 64, regionRect->bottom));
-				if (diff_tile(&rect, pYUVData, pOldYUVData, iStride))
+				rect.left = (UINT16)MAX(regionRect->left, column * H264_TILE_SIZE);
+				rect.top = (UINT16)MAX(regionRect->top, row * H264_TILE_SIZE);
+				rect.right = (UINT16)MIN(regionRect->right, (column + 1) * H264_TILE_SIZE);
+				rect.bottom = (UINT16)MIN(regionRect->bottom, (row + 1) * H264_TILE_SIZE);
+				changed = ctrl->changed[tile];
+
+				if (changed && pOldYUVData && auxiliary)
+				{
+					if (bandChanged < 0)
+					{
+						RECTANGLE_16 band = { 0 };
+						band.top = rect.top & ~15;
+						band.right = (UINT16)h264->width;
+						band.bottom = (rect.bottom + 15) & ~15;
+						bandChanged = diff_tile(&band, pYUVData, pOldYUVData, iStride);
+					}
+					changed = bandChanged;
+				}
+				else if (changed && pOldYUVData)
+					changed = diff_tile(&rect, pYUVData, pOldYUVData, iStride);
+
+				if (h264_rate_control_tile(h264, tile, changed, !auxiliary, &qps[count]))
 					rectangles[count++] = rect;
 			}
 		}
 	}
-	if (!allocate_h264_metablock(QP, rectangles, meta, count))
-		return FALSE;
-	return TRUE;
+	if (!allocate_h264_metablock(qps, rectangles, meta, count))
+		goto fail;
+	rectangles = NULL;
+	rc = TRUE;
+fail:
+	free(rectangles);
+	free(qps);
+	return rc;
+}
+
+/**
+ * Runs the encoder subsystem with the per frame rate control values. The
+ * subsystems read QP and BitRate from the context: in CQP mode the frame QP is
+ * the area weighted mean of the region QPs, in VBR mode the bitrate is capped
+ * by TargetBitRate.
+ */
+static int h264_compress_frame(H264_CONTEXT* h264, const BYTE** pYUVData,
+                               const RDPGFX_H264_METABLOCK* meta, BOOL auxiliary,
+                               BYTE** ppDstData, UINT32* pDstSize)
+{
+	int status;
+	const UINT32 QP = h264->QP;
+	const UINT32 BitRate = h264->BitRate;
+
+	if (h264->AdaptiveQP || (h264->TargetBitRate > 0))
+	{
+		h264->QP = h264_rate_control_frame_qp(h264, meta, auxiliary);
+
+		if (h264->TargetBitRate > 0)
+			h264->BitRate = MIN(BitRate, h264->TargetBitRate);
+	}
+
+	status = h264->subsystem->Compress(h264, pYUVData, h264->iStride, ppDstData, pDstSize);
+	h264->QP = QP;
+	h264->BitRate = BitRate;
+	return status;
 }
 
 INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat, UINT32 nSrcStep,
@@ -231,9 +516,9 @@ INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 {
 	size_t x;
 	INT32 rc = -1;
-	BYTE* pYUVData[3] = { 0 };
+	UINT32 numRects = 0;
+	RECTANGLE_16* rects = NULL;
 	const BYTE* pcYUVData[3] = { 0 };
-	BYTE* pOldYUVData[3] = { 0 };
 
 	if (!h264 || !regionRect || !meta || !h264->Compressor)
 		return -1;
@@ -244,29 +529,19 @@ INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	if (!avc420_ensure_buffer(h264, nSrcStep, nSrcWidth, nSrcHeight))
 		return -1;
 
-	if (h264->encodingBuffer)
-	{
-		for (x = 0; x < 3; x++)
-		{
-			pYUVData[x] = h264->pYUVData[x];
-			pOldYUVData[x] = h264->pOldYUVData[x];
-		}
-	}
-	else
-	{
-		for (x = 0; x < 3; x++)
-		{
-			pYUVData[x] = h264->pOldYUVData[x];
-			pOldYUVData[x] = h264->pYUVData[x];
-		}
-	}
-	h264->encodingBuffer = !h264->encodingBuffer;
+	if (!h264_rate_control_ensure(h264))
+		return -1;
 
-	if (!yuv420_context_encode(h264->yuv, pSrcData, nSrcStep, SrcFormat, h264->iStride, pYUVData,
-	                           regionRect, 1))
+	if (!detect_source_changes(h264, !h264->firstLumaFrameDone, regionRect, pSrcData, nSrcStep,
+	                           SrcFormat, &rects, &numRects))
 		goto fail;
 
-	if (!detect_changes(h264->firstLumaFrameDone, h264->QP, regionRect, pYUVData, pOldYUVData,
+	/* A changed source is taken as changed YUV, only the changed runs are converted */
+	if ((numRects > 0) && !yuv420_context_encode(h264->yuv, pSrcData, nSrcStep, SrcFormat,
+	                                             h264->iStride, h264->pYUVData, rects, numRects))
+		goto fail;
+
+	if (!detect_changes(h264, h264->firstLumaFrameDone, FALSE, regionRect, h264->pYUVData, NULL,
 	                    h264->iStride, meta))
 		goto fail;
 
@@ -277,18 +552,55 @@ INT32 avc420_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	}
 
 	for (x = 0; x < 3; x++)
-		pcYUVData[x] = pYUVData[x];
+		pcYUVData[x] = h264->pYUVData[x];
 
-	rc = h264->subsystem->Compress(h264, pcYUVData, h264->iStride, ppDstData, pDstSize);
+	rc = h264_compress_frame(h264, pcYUVData, meta, FALSE, ppDstData, pDstSize);
 	if (rc >= 0)
+	{
 		h264->firstLumaFrameDone = TRUE;
+		h264_rate_control_update(h264, *pDstSize);
+	}
 
 fail:
+	free(rects);
 	if (rc < 0)
+	{
+		h264_invalidate_reference(h264);
 		free_h264_metablock(meta);
+	}
 	return rc;
 }
 
+/**
+ * The auxiliary frame packs chroma in 16 line blocks (v1) or in the two image
+ * halves (v2), a part of it can only be converted in full width bands.
+ */
+static void avc444_source_bands(const H264_CONTEXT* h264, RECTANGLE_16* rects, UINT32* pNumRects)
+{
+	UINT32 x;
+	UINT32 count = 0;
+
+	for (x = 0; x < *pNumRects; x++)
+	{
+		const UINT16 top = rects[x].top & ~15;
+		const UINT16 bottom = (UINT16)MIN(h264->height, (rects[x].bottom + 15u) & ~15u);
+
+		if ((count > 0) && (top <= rects[count - 1].bottom))
+		{
+			rects[count - 1].bottom = MAX(rects[count - 1].bottom, bottom);
+			continue;
+		}
+
+		rects[count].left = 0;
+		rects[count].top = top;
+		rects[count].right = (UINT16)h264->width;
+		rects[count].bottom = bottom;
+		count++;
+	}
+
+	*pNumRects = count;
+}
+
 INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat, UINT32 nSrcStep,
                       UINT32 nSrcWidth, UINT32 nSrcHeight, BYTE version, const RECTANGLE_16* region,
                       BYTE* op, BYTE** ppDstData, UINT32* pDstSize, BYTE** ppAuxDstData,
@@ -298,6 +610,10 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	int rc = -1;
 	BYTE* coded;
 	UINT32 codedSize;
+	UINT32 x;
+	UINT32 numRects = 0;
+	RECTANGLE_16* rects = NULL;
+	size_t frameSize = 0;
 	BYTE** pYUV444Data;
 	BYTE** pOldYUV444Data;
 	BYTE** pYUVData;
@@ -315,30 +631,37 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	if (!avc444_ensure_buffer(h264, nSrcHeight))
 		return -1;
 
-	if (h264->encodingBuffer)
-	{
-		pYUV444Data = h264->pOldYUV444Data;
-		pOldYUV444Data = h264->pYUV444Data;
-		pYUVData = h264->pOldYUVData;
-		pOldYUVData = h264->pYUVData;
-	}
-	else
+	if (!h264_rate_control_ensure(h264))
+		return -1;
+
+	pYUV444Data = h264->pYUV444Data;
+	pOldYUV444Data = h264->pOldYUV444Data;
+	pYUVData = h264->pYUVData;
+	pOldYUVData = h264->pOldYUVData;
+
+	if (!detect_source_changes(h264, !h264->firstLumaFrameDone || !h264->firstChromaFrameDone,
+	                           region, pSrcData, nSrcStep, SrcFormat, &rects, &numRects))
+		goto fail;
+
+	avc444_source_bands(h264, rects, &numRects);
+
+	/* Keep the previous planes of the changed bands, a source change may
+	 * leave one of the two streams untouched. */
+	for (x = 0; x < numRects; x++)
 	{
-		pYUV444Data = h264->pYUV444Data;
-		pOldYUV444Data = h264->pOldYUV444Data;
-		pYUVData = h264->pYUVData;
-		pOldYUVData = h264->pOldYUVData;
+		copy_yuv_rect(&rects[x], pOldYUV444Data, pYUV444Data, h264->iStride);
+		copy_yuv_rect(&rects[x], pOldYUVData, pYUVData, h264->iStride);
 	}
-	h264->encodingBuffer = !h264->encodingBuffer;
 
-	if (!yuv444_context_encode(h264->yuv, version, pSrcData, nSrcStep, SrcFormat, h264->iStride,
-	                           pYUV444Data, pYUVData, region, 1))
+	if ((numRects > 0) &&
+	    !yuv444_context_encode(h264->yuv, version, pSrcData, nSrcStep, SrcFormat, h264->iStride,
+	                           pYUV444Data, pYUVData, rects, numRects))
 		goto fail;
 
-	if (!detect_changes(h264->firstLumaFrameDone, h264->QP, region, pYUV444Data, pOldYUV444Data,
-	                    h264->iStride, meta))
+	if (!detect_changes(h264, h264->firstLumaFrameDone, FALSE, region, pYUV444Data,
+	                    pOldYUV444Data, h264->iStride, meta))
 		goto fail;
-	if (!detect_changes(h264->firstChromaFrameDone, h264->QP, region, pYUVData, pOldYUVData,
+	if (!detect_changes(h264, h264->firstChromaFrameDone, TRUE, region, pYUVData, pOldYUVData,
 	                    h264->iStride, auxMeta))
 		goto fail;
 
@@ -365,29 +688,34 @@ INT32 avc444_compress(H264_CONTEXT* h264, const BYTE* pSrcData, DWORD SrcFormat,
 	{
 		const BYTE* pcYUV444Data[3] = { pYUV444Data[0], pYUV444Data[1], pYUV444Data[2] };
 
-		if (h264->subsystem->Compress(h264, pcYUV444Data, h264->iStride, &coded, &codedSize) < 0)
+		if (h264_compress_frame(h264, pcYUV444Data, meta, FALSE, &coded, &codedSize) < 0)
 			goto fail;
 		h264->firstLumaFrameDone = TRUE;
 		memcpy(h264->lumaData, coded, codedSize);
 		*ppDstData = h264->lumaData;
 		*pDstSize = codedSize;
+		frameSize += codedSize;
 	}
 
 	if ((*op == 0) || (*op == 2))
 	{
 		const BYTE* pcYUVData[3] = { pYUVData[0], pYUVData[1], pYUVData[2] };
 
-		if (h264->subsystem->Compress(h264, pcYUVData, h264->iStride, &coded, &codedSize) < 0)
+		if (h264_compress_frame(h264, pcYUVData, auxMeta, TRUE, &coded, &codedSize) < 0)
 			goto fail;
 		h264->firstChromaFrameDone = TRUE;
 		*ppAuxDstData = coded;
 		*pAuxDstSize = codedSize;
+		frameSize += codedSize;
 	}
 
+	h264_rate_control_update(h264, frameSize);
 	rc = 1;
 fail:
+	free(rects);
 	if (rc < 0)
 	{
+		h264_invalidate_reference(h264);
 		free_h264_metablock(meta);
 		free_h264_metablock(auxMeta);
 	}
@@ -669,6 +997,8 @@ H264_CONTEXT* h264_context_new(BOOL Compressor)
 		/* Default compressor settings, may be changed by caller */
 		h264->BitRate = 1000000;
 		h264->FrameRate = 30;
+		h264->MinQP = 18;
+		h264->MaxQP = 36;
 	}
 
 	if (!h264_context_init(h264))
@@ -704,6 +1034,7 @@ void h264_context_free(H264_CONTEXT* h264)
 			winpr_aligned_free(h264->pOldYUV444Data[x]);
 		}
 		winpr_aligned_free(h264->lumaData);
+		h264_rate_control_free(h264->rateControl);
 
 		yuv_context_free(h264->yuv);
 		free(h264);
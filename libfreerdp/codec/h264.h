@@ -23,8 +23,12 @@
 
 #include <freerdp/api.h>
 #include <freerdp/config.h>
+#include <winpr/pool.h>
+
 #include <freerdp/codec/h264.h>
 
+#include "jobs.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -51,6 +55,52 @@ extern "C"
 	FREERDP_LOCAL BOOL avc420_ensure_buffer(H264_CONTEXT* h264, UINT32 stride, UINT32 width,
 	                                        UINT32 height);
 
+#define H264_TILE_SIZE 64
+
+	struct S_H264_RATE_CONTROL
+	{
+		UINT32 columns;
+		UINT32 rows;
+		BYTE* activity; /* per tile change history, decays with every frame */
+		BYTE* sentQP;   /* QP the tile was last sent with */
+		BYTE* changed;  /* tile source differs from the reference this frame */
+
+		BYTE* reference; /* source frame as of the last conversion */
+		size_t referenceSize;
+		UINT32 referenceStep;
+
+		PTP_POOL pool;
+		TP_CALLBACK_ENVIRON env;
+		CODEC_JOBS* jobs; /* source change detection, one job per tile row */
+
+		INT32 qpOffset;
+		UINT64 avgFrameBits;
+
+		/* QP passed to the backend per stream (AVC420/AVC444 luma, AVC444 chroma) */
+		INT32 frameQP[2];
+		INT32 pendingQP[2];
+		UINT32 pendingFrames[2];
+	};
+
+	FREERDP_LOCAL BOOL h264_rate_control_ensure(H264_CONTEXT* h264);
+	FREERDP_LOCAL void h264_rate_control_free(H264_RATE_CONTROL* rc);
+
+	FREERDP_LOCAL BYTE h264_rate_control_region_qp(const H264_CONTEXT* h264, BYTE activity);
+
+	/* QP of the first frame, which is sent as a whole. With track set every tile is marked as
+	 * sent with it. */
+	FREERDP_LOCAL BYTE h264_rate_control_first_frame(H264_CONTEXT* h264, BOOL track);
+
+	/* Updates the change history of a tile (with track set) and returns TRUE with its QP if
+	 * the tile has to be announced in this frame. */
+	FREERDP_LOCAL BOOL h264_rate_control_tile(H264_CONTEXT* h264, size_t tile, BOOL changed,
+	                                          BOOL track, BYTE* pQP);
+
+	FREERDP_LOCAL void h264_rate_control_update(H264_CONTEXT* h264, size_t frameSize);
+	FREERDP_LOCAL UINT32 h264_rate_control_frame_qp(H264_CONTEXT* h264,
+	                                                const RDPGFX_H264_METABLOCK* meta,
+	                                                BOOL auxiliary);
+
 #ifdef WITH_MEDIACODEC
 	extern const H264_CONTEXT_SUBSYSTEM g_Subsystem_mediacodec;
 #endif
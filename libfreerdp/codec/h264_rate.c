@@ -0,0 +1,294 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * H.264 Rate Control
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
+
+#include "h264.h"
+
+#define H264_MAX_QP 51
+#define H264_MAX_QP_OFFSET 12
+
+/* Tiles with an activity below this changed at most once or twice recently */
+#define H264_ACTIVITY_STATIC 96
+
+/* The frame QP only follows the region QPs once they moved this far, or
+ * after a smaller move held for a number of frames. The encoder backends
+ * reconfigure themselves on every QP change. */
+#define H264_QP_HYSTERESIS 3
+#define H264_QP_SETTLE_FRAMES 8
+
+void h264_rate_control_free(H264_RATE_CONTROL* rc)
+{
+	if (!rc)
+		return;
+
+	free(rc->activity);
+	free(rc->sentQP);
+	free(rc->changed);
+	free(rc->reference);
+
+	codec_jobs_free(rc->jobs);
+
+	if (rc->pool)
+	{
+		CloseThreadpool(rc->pool);
+		DestroyThreadpoolEnvironment(&rc->env);
+	}
+
+	free(rc);
+}
+
+BOOL h264_rate_control_ensure(H264_CONTEXT* h264)
+{
+	H264_RATE_CONTROL* rc;
+	const UINT32 columns = (h264->width + H264_TILE_SIZE - 1) / H264_TILE_SIZE;
+	const UINT32 rows = (h264->height + H264_TILE_SIZE - 1) / H264_TILE_SIZE;
+
+	if (!h264->rateControl)
+	{
+		SYSTEM_INFO sysInfos;
+		h264->rateControl = (H264_RATE_CONTROL*)calloc(1, sizeof(H264_RATE_CONTROL));
+
+		if (!h264->rateControl)
+			return FALSE;
+
+		h264->rateControl->frameQP[0] = -1;
+		h264->rateControl->frameQP[1] = -1;
+		GetNativeSystemInfo(&sysInfos);
+
+		if (sysInfos.dwNumberOfProcessors > 1)
+		{
+			h264->rateControl->pool = CreateThreadpool(NULL);
+
+			if (!h264->rateControl->pool)
+				return FALSE;
+
+			InitializeThreadpoolEnvironment(&h264->rateControl->env);
+			SetThreadpoolCallbackPool(&h264->rateControl->env, h264->rateControl->pool);
+			h264->rateControl->jobs = codec_jobs_new(&h264->rateControl->env);
+
+			if (!h264->rateControl->jobs)
+				return FALSE;
+		}
+	}
+
+	rc = h264->rateControl;
+
+	if ((rc->columns != columns) || (rc->rows != rows) || !rc->activity)
+	{
+		const size_t count = MAX(1, (size_t)columns * rows);
+		BYTE* activity = (BYTE*)calloc(count, sizeof(BYTE));
+		BYTE* sentQP = (BYTE*)calloc(count, sizeof(BYTE));
+		BYTE* changed = (BYTE*)calloc(count, sizeof(BYTE));
+
+		if (!activity || !sentQP || !changed)
+		{
+			free(activity);
+			free(sentQP);
+			free(changed);
+			return FALSE;
+		}
+
+		free(rc->activity);
+		free(rc->sentQP);
+		free(rc->changed);
+		rc->activity = activity;
+		rc->sentQP = sentQP;
+		rc->changed = changed;
+		rc->columns = columns;
+		rc->rows = rows;
+	}
+
+	return TRUE;
+}
+
+static BYTE h264_clamp_qp(INT64 qp)
+{
+	if (qp < 0)
+		return 0;
+	if (qp > H264_MAX_QP)
+		return H264_MAX_QP;
+	return (BYTE)qp;
+}
+
+/**
+ * QP for a region given its change history. Without AdaptiveQP every region
+ * uses QP, corrected by the rate controller when a bandwidth budget is set.
+ */
+BYTE h264_rate_control_region_qp(const H264_CONTEXT* h264, BYTE activity)
+{
+	const H264_RATE_CONTROL* rc = h264->rateControl;
+	const INT32 offset = rc ? rc->qpOffset : 0;
+	INT64 qp;
+
+	if (!h264->AdaptiveQP)
+	{
+		if (h264->TargetBitRate == 0)
+			return (BYTE)MIN(h264->QP, UINT8_MAX);
+
+		return h264_clamp_qp((INT64)h264->QP + offset);
+	}
+
+	qp = MIN(h264->MinQP, h264->MaxQP);
+
+	if (activity > H264_ACTIVITY_STATIC)
+	{
+		const INT64 range = (INT64)MAX(h264->MinQP, h264->MaxQP) - qp;
+		qp += range * (activity - H264_ACTIVITY_STATIC) / (UINT8_MAX - H264_ACTIVITY_STATIC);
+	}
+
+	return h264_clamp_qp(qp + offset);
+}
+
+BYTE h264_rate_control_first_frame(H264_CONTEXT* h264, BOOL track)
+{
+	H264_RATE_CONTROL* rc = h264->rateControl;
+	const BYTE qp = h264_rate_control_region_qp(h264, 0);
+
+	if (track)
+		memset(rc->sentQP, qp, (size_t)rc->columns * rc->rows);
+
+	return qp;
+}
+
+BOOL h264_rate_control_tile(H264_CONTEXT* h264, size_t tile, BOOL changed, BOOL track,
+                            BYTE* pQP)
+{
+	BYTE qp;
+	H264_RATE_CONTROL* rc = h264->rateControl;
+	BYTE activity = rc->activity[tile];
+
+	if (track)
+	{
+		activity -= activity >> 2;
+		if (changed)
+			activity = (BYTE)MIN(UINT8_MAX, activity + 64);
+		rc->activity[tile] = activity;
+	}
+
+	if (!changed && (!h264->AdaptiveQP || (activity > H264_ACTIVITY_STATIC)))
+		return FALSE;
+
+	qp = h264_rate_control_region_qp(h264, activity);
+
+	/* Content that came to rest after being sent lossy is sent once more in
+	 * full quality. The frame is encoded as a whole anyway, the region only
+	 * tells the client to pick it up. */
+	if (!changed && (rc->sentQP[tile] <= qp))
+		return FALSE;
+
+	if (track)
+		rc->sentQP[tile] = qp;
+
+	*pQP = qp;
+	return TRUE;
+}
+
+/**
+ * Feeds the size of the last encoded frame back. When it runs over the per
+ * frame share of TargetBitRate all region QPs are raised, and lowered again
+ * once the stream is well within budget.
+ */
+void h264_rate_control_update(H264_CONTEXT* h264, size_t frameSize)
+{
+	UINT64 budget;
+	const UINT64 bits = frameSize * 8ull;
+	H264_RATE_CONTROL* rc = h264->rateControl;
+
+	if (!rc)
+		return;
+
+	if ((h264->TargetBitRate == 0) || (h264->FrameRate == 0))
+	{
+		rc->qpOffset = 0;
+		rc->avgFrameBits = 0;
+		return;
+	}
+
+	budget = h264->TargetBitRate / h264->FrameRate;
+
+	if (rc->avgFrameBits == 0)
+		rc->avgFrameBits = bits;
+	else
+		rc->avgFrameBits = (rc->avgFrameBits * 7 + bits) / 8;
+
+	if ((rc->avgFrameBits > budget + budget / 8) && (rc->qpOffset < H264_MAX_QP_OFFSET))
+		rc->qpOffset++;
+	else if ((rc->avgFrameBits < budget - budget / 4) && (rc->qpOffset > -H264_MAX_QP_OFFSET))
+		rc->qpOffset--;
+}
+
+/**
+ * The QP to run the encoder backend with: the area weighted mean of the region
+ * QPs, with hysteresis. The AVC444 chroma stream keeps its own state so the
+ * two streams do not undo each other.
+ */
+UINT32 h264_rate_control_frame_qp(H264_CONTEXT* h264, const RDPGFX_H264_METABLOCK* meta,
+                                  BOOL auxiliary)
+{
+	UINT64 area = 0;
+	UINT64 weighted = 0;
+	INT32 qp;
+	H264_RATE_CONTROL* rc = h264->rateControl;
+	const size_t stream = auxiliary ? 1 : 0;
+	INT32* frameQP;
+
+	if (!rc)
+		return h264->QP;
+
+	frameQP = &rc->frameQP[stream];
+
+	for (UINT32 x = 0; meta && (x < meta->numRegionRects); x++)
+	{
+		const RECTANGLE_16* rect = &meta->regionRects[x];
+		const UINT64 size = (UINT64)(rect->right - rect->left) * (rect->bottom - rect->top);
+		area += size;
+		weighted += size * (meta->quantQualityVals[x].qp & 0x3F);
+	}
+
+	if (area == 0)
+		return (*frameQP < 0) ? h264->QP : (UINT32)*frameQP;
+
+	qp = (INT32)((weighted + area / 2) / area);
+
+	if ((*frameQP < 0) || (abs(qp - *frameQP) >= H264_QP_HYSTERESIS))
+	{
+		*frameQP = qp;
+		rc->pendingFrames[stream] = 0;
+	}
+	else if (qp == *frameQP)
+		rc->pendingFrames[stream] = 0;
+	else if ((rc->pendingFrames[stream] > 0) && (rc->pendingQP[stream] == qp))
+	{
+		if (++rc->pendingFrames[stream] >= H264_QP_SETTLE_FRAMES)
+		{
+			*frameQP = qp;
+			rc->pendingFrames[stream] = 0;
+		}
+	}
+	else
+	{
+		rc->pendingQP[stream] = qp;
+		rc->pendingFrames[stream] = 1;
+	}
+
+	return (UINT32)*frameQP;
+}
@@ -0,0 +1,137 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Codec Parallel Jobs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/types.h>
+
+#include "jobs.h"
+
+struct S_CODEC_JOBS
+{
+	PTP_WORK work;
+	PTP_WORK* batch; /* work, once per helping worker */
+	size_t helpers;
+
+	BYTE* params;
+	size_t paramSize;
+	size_t count;
+	PTP_WORK_CALLBACK callback;
+	volatile LONG next;
+};
+
+static void codec_jobs_take(CODEC_JOBS* jobs)
+{
+	for (;;)
+	{
+		const size_t index = (size_t)InterlockedIncrement(&jobs->next) - 1;
+
+		if (index >= jobs->count)
+			break;
+
+		jobs->callback(NULL, &jobs->params[index * jobs->paramSize], NULL);
+	}
+}
+
+static void CALLBACK codec_jobs_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                              PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	codec_jobs_take((CODEC_JOBS*)context);
+}
+
+CODEC_JOBS* codec_jobs_new(PTP_CALLBACK_ENVIRON pcbe)
+{
+	size_t x;
+	SYSTEM_INFO sysInfos;
+	CODEC_JOBS* jobs;
+
+	GetNativeSystemInfo(&sysInfos);
+
+	/* Without a second processor every job runs on the calling thread */
+	if (sysInfos.dwNumberOfProcessors <= 1)
+		return NULL;
+
+	jobs = (CODEC_JOBS*)calloc(1, sizeof(CODEC_JOBS));
+
+	if (!jobs)
+		return NULL;
+
+	jobs->helpers = sysInfos.dwNumberOfProcessors - 1;
+	jobs->batch = (PTP_WORK*)calloc(jobs->helpers, sizeof(PTP_WORK));
+	jobs->work = CreateThreadpoolWork(codec_jobs_work_callback, jobs, pcbe);
+
+	if (!jobs->batch || !jobs->work)
+	{
+		codec_jobs_free(jobs);
+		return NULL;
+	}
+
+	for (x = 0; x < jobs->helpers; x++)
+		jobs->batch[x] = jobs->work;
+
+	return jobs;
+}
+
+void codec_jobs_free(CODEC_JOBS* jobs)
+{
+	if (!jobs)
+		return;
+
+	if (jobs->work)
+		CloseThreadpoolWork(jobs->work);
+
+	free(jobs->batch);
+	free(jobs);
+}
+
+BOOL codec_jobs_run(CODEC_JOBS* jobs, void* params, size_t paramSize, size_t count,
+                    PTP_WORK_CALLBACK callback)
+{
+	size_t x;
+
+	WINPR_ASSERT(params || (count == 0));
+	WINPR_ASSERT(callback);
+
+	if (!jobs || (count <= 1))
+	{
+		for (x = 0; x < count; x++)
+			callback(NULL, &((BYTE*)params)[x * paramSize], NULL);
+
+		return TRUE;
+	}
+
+	if (count > INT32_MAX)
+		return FALSE;
+
+	jobs->params = (BYTE*)params;
+	jobs->paramSize = paramSize;
+	jobs->count = count;
+	jobs->callback = callback;
+	jobs->next = 0;
+
+	winpr_SubmitThreadpoolWorkBatch(jobs->batch, MIN(jobs->helpers, count - 1));
+	codec_jobs_take(jobs);
+	WaitForThreadpoolWorkCallbacks(jobs->work, FALSE);
+	return TRUE;
+}
@@ -0,0 +1,52 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Codec Parallel Jobs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_JOBS_H
+#define FREERDP_LIB_CODEC_JOBS_H
+
+#include <freerdp/api.h>
+#include <winpr/pool.h>
+
+/**
+ * Runs an array of independent jobs of a codec context on the thread pool. The context keeps
+ * one work object, it is submitted once per helping worker and every callback takes the next
+ * job until none are left, so no work object is created per job or per frame.
+ */
+typedef struct S_CODEC_JOBS CODEC_JOBS;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	/* pcbe selects the pool, NULL for the default one */
+	FREERDP_LOCAL CODEC_JOBS* codec_jobs_new(PTP_CALLBACK_ENVIRON pcbe);
+	FREERDP_LOCAL void codec_jobs_free(CODEC_JOBS* jobs);
+
+	/**
+	 * Calls callback(NULL, &params[i], NULL) for each of count elements of paramSize bytes and
+	 * returns once all are done. The calling thread takes jobs as well. Without jobs, or with
+	 * a single job, everything runs on the calling thread.
+	 */
+	FREERDP_LOCAL BOOL codec_jobs_run(CODEC_JOBS* jobs, void* params, size_t paramSize,
+	                                  size_t count, PTP_WORK_CALLBACK callback);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_LIB_CODEC_JOBS_H */
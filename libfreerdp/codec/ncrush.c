@@ -26,15 +26,21 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/bitstream.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
 #include "ncrush.h"
 
+#if defined(WITH_SSE2)
+#include "bulk_sse2.h"
+#endif
+
 #define TAG FREERDP_TAG("codec")
 
 struct s_NCRUSH_CONTEXT
 {
 	ALIGN64 BOOL Compressor;
+	ALIGN64 BOOL Fast;
 	ALIGN64 BYTE* HistoryPtr;
 	ALIGN64 UINT32 HistoryOffset;
 	ALIGN64 UINT32 HistoryEndOffset;
@@ -2295,25 +2301,46 @@ static int ncrush_hash_table_add(NCRUSH_CONTEXT* ncrush, const BYTE* pSrcData, U
 	return 1;
 }
 
+static BOOL g_NCrushSSE2 = FALSE;
+
+static INIT_ONCE ncrush_init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK ncrush_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+
+#if defined(WITH_SSE2)
+	g_NCrushSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+	return TRUE;
+}
+
+/* Number of equal bytes at Ptr1 and Ptr2, the match may not reach past HistoryPtr */
 static int ncrush_find_match_length(const BYTE* Ptr1, const BYTE* Ptr2, BYTE* HistoryPtr)
 {
-	BYTE val1, val2;
-	const BYTE* Ptr = Ptr1;
+	size_t length = 0;
+	size_t max;
 
 	WINPR_ASSERT(Ptr1);
 	WINPR_ASSERT(Ptr2);
 	WINPR_ASSERT(HistoryPtr);
 
-	do
-	{
-		if (Ptr1 > HistoryPtr)
-			break;
+	if (Ptr1 > HistoryPtr)
+		return -1;
 
-		val1 = *Ptr1++;
-		val2 = *Ptr2++;
-	} while (val1 == val2);
+	max = (size_t)(HistoryPtr - Ptr1);
 
-	return Ptr1 - (Ptr + 1);
+#if defined(WITH_SSE2)
+	if (g_NCrushSSE2)
+		return (int)bulk_match_length_sse2(Ptr1, Ptr2, max);
+#endif
+
+	while ((length < max) && (Ptr1[length] == Ptr2[length]))
+		length++;
+
+	return (int)length;
 }
 
 static int ncrush_find_best_match(NCRUSH_CONTEXT* ncrush, UINT16 HistoryOffset,
@@ -2327,10 +2354,13 @@ static int ncrush_find_best_match(NCRUSH_CONTEXT* ncrush, UINT16 HistoryOffset,
 	UINT16 NextOffset;
 	UINT16 MatchOffset;
 	BYTE* HistoryBuffer;
+	int MaxRounds;
 
 	WINPR_ASSERT(ncrush);
 	WINPR_ASSERT(pMatchOffset);
 
+	MaxRounds = ncrush->Fast ? 1 : 4;
+
 	if (!ncrush->MatchTable[HistoryOffset])
 		return -1;
 
@@ -2342,7 +2372,7 @@ static int ncrush_find_best_match(NCRUSH_CONTEXT* ncrush, UINT16 HistoryOffset,
 	NextOffset = ncrush->MatchTable[Offset];
 	MatchPtr = &HistoryBuffer[MatchLength];
 
-	for (i = 0; i < 4; i++)
+	for (i = 0; i < MaxRounds; i++)
 	{
 		j = -1;
 
@@ -2454,6 +2484,18 @@ static int ncrush_move_encoder_windows(NCRUSH_CONTEXT* ncrush, BYTE* HistoryPtr)
 	MoveMemory(ncrush->HistoryBuffer, HistoryPtr - 32768, 32768);
 	HistoryOffset = HistoryPtr - 32768 - ncrush->HistoryBuffer;
 
+#if defined(WITH_SSE2)
+	if (g_NCrushSSE2)
+	{
+		bulk_rebase_offsets_sse2(ncrush->HashTable, ncrush->HashTable, 65536,
+		                         (UINT16)HistoryOffset);
+		bulk_rebase_offsets_sse2(ncrush->MatchTable, &ncrush->MatchTable[HistoryOffset], 32768,
+		                         (UINT16)HistoryOffset);
+		ZeroMemory(&ncrush->MatchTable[32768], 65536);
+		return 1;
+	}
+#endif
+
 	for (i = 0; i < 65536; i += 4)
 	{
 		NewHash = ncrush->HashTable[i + 0] - HistoryOffset;
@@ -2895,6 +2937,12 @@ static int ncrush_generate_tables(NCRUSH_CONTEXT* context)
 	return 1;
 }
 
+void ncrush_set_fast_mode(NCRUSH_CONTEXT* ncrush, BOOL fast)
+{
+	WINPR_ASSERT(ncrush);
+	ncrush->Fast = fast;
+}
+
 void ncrush_context_reset(NCRUSH_CONTEXT* ncrush, BOOL flush)
 {
 	WINPR_ASSERT(ncrush);
@@ -2919,6 +2967,7 @@ NCRUSH_CONTEXT* ncrush_context_new(BOOL Compressor)
 	if (!ncrush)
 		goto fail;
 
+	InitOnceExecuteOnce(&ncrush_init_once, ncrush_init, NULL, NULL);
 	ncrush->Compressor = Compressor;
 	ncrush->HistoryBufferSize = 65536;
 	ncrush->HistoryEndOffset = ncrush->HistoryBufferSize - 1;
@@ -41,6 +41,8 @@ extern "C"
 	                                    UINT32 SrcSize, const BYTE** ppDstData, UINT32* pDstSize,
 	                                    UINT32 flags);
 
+	FREERDP_LOCAL void ncrush_set_fast_mode(NCRUSH_CONTEXT* ncrush, BOOL fast);
+
 	FREERDP_LOCAL void ncrush_context_reset(NCRUSH_CONTEXT* ncrush, BOOL flush);
 
 	FREERDP_LOCAL NCRUSH_CONTEXT* ncrush_context_new(BOOL Compressor);
@@ -36,6 +36,10 @@
 
 #include "nsc_sse2.h"
 
+#if defined(WITH_AVX2)
+#include "nsc_avx2.h"
+#endif
+
 #include <freerdp/log.h>
 #define TAG FREERDP_TAG("codec.nsc")
 
@@ -345,7 +349,8 @@ NSC_CONTEXT* nsc_context_new(void)
 	WLog_OpenAppender(context->priv->log);
 	context->BitmapData = NULL;
 	context->decode = nsc_decode;
-	context->encode = nsc_encode;
+	context->encode_rows = nsc_encode_rows;
+	context->subsample_rows = nsc_subsample_rows;
 
 	PROFILER_CREATE(context->priv->prof_nsc_rle_decompress_data, "nsc_rle_decompress_data")
 	PROFILER_CREATE(context->priv->prof_nsc_decode, "nsc_decode")
@@ -356,6 +361,9 @@ NSC_CONTEXT* nsc_context_new(void)
 	context->ChromaSubsamplingLevel = 1;
 	/* init optimized methods */
 	NSC_INIT_SIMD(context);
+#if defined(WITH_AVX2)
+	nsc_init_avx2(context);
+#endif
 	return context;
 error:
 	nsc_context_free(context);
@@ -374,6 +382,8 @@ void nsc_context_free(NSC_CONTEXT* context)
 		for (i = 0; i < 5; i++)
 			free(context->priv->PlaneBuffers[i]);
 
+		free(context->priv->RleBuffer);
+		codec_jobs_free(context->priv->Jobs);
 		nsc_profiler_print(context->priv);
 		PROFILER_FREE(context->priv->prof_nsc_rle_decompress_data)
 		PROFILER_FREE(context->priv->prof_nsc_decode)
@@ -0,0 +1,214 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * NSCodec Library - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+
+#include <immintrin.h>
+
+#include <freerdp/codec/color.h>
+
+#include "nsc_types.h"
+#include "nsc_encode.h"
+#include "nsc_avx2.h"
+
+#if defined(WITH_SSE2)
+#include "nsc_sse2.h"
+#endif
+
+#ifdef _MSC_VER
+#define __attribute__(...)
+#endif
+
+#ifndef __clang__
+#define ATTRIBUTES __gnu_inline__, __always_inline__, __artificial__
+#else
+#define ATTRIBUTES __gnu_inline__, __always_inline__
+#endif
+
+/* Extract the byte at shift of 16 32bpp pixels as 16 bit values in pixel order */
+static __inline __m256i __attribute__((ATTRIBUTES))
+nsc_channel_avx2(__m256i p0, __m256i p1, int shift)
+{
+	const __m256i mask = _mm256_set1_epi32(0xFF);
+	const __m256i c0 = _mm256_and_si256(_mm256_srli_epi32(p0, shift), mask);
+	const __m256i c1 = _mm256_and_si256(_mm256_srli_epi32(p1, shift), mask);
+	return _mm256_permute4x64_epi64(_mm256_packus_epi32(c0, c1), 0xD8);
+}
+
+/* Pack two vectors of 16 bit values to bytes, a ends up in the low, b in the high half */
+static __inline __m256i __attribute__((ATTRIBUTES)) nsc_packus_avx2(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+}
+
+static __inline __m256i __attribute__((ATTRIBUTES)) nsc_packs_avx2(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+}
+
+/**
+ * Same arithmetic as the SSE2 version for 16 pixels at once. Only the 32bpp formats have
+ * a vector path, the others use the SSE2 or the generic code.
+ */
+static BOOL nsc_encode_rows_avx2(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline,
+                                 UINT32 top, UINT32 bottom)
+{
+	UINT32 y;
+	UINT32 rw;
+	int rshift;
+	int bshift;
+	int ashift;
+	__m128i ccl;
+
+	if (!context || !data || (scanline == 0))
+		return FALSE;
+
+	switch (context->format)
+	{
+		case PIXEL_FORMAT_BGRX32:
+		case PIXEL_FORMAT_BGRA32:
+			rshift = 16;
+			bshift = 0;
+			break;
+
+		case PIXEL_FORMAT_RGBX32:
+		case PIXEL_FORMAT_RGBA32:
+			rshift = 0;
+			bshift = 16;
+			break;
+
+		default:
+#if defined(WITH_SSE2)
+			return nsc_encode_rows_sse2(context, data, scanline, top, bottom);
+#else
+			return nsc_encode_rows(context, data, scanline, top, bottom);
+#endif
+	}
+
+	ashift = ((context->format == PIXEL_FORMAT_BGRA32) || (context->format == PIXEL_FORMAT_RGBA32))
+	             ? 24
+	             : -1;
+	rw = (context->ChromaSubsamplingLevel > 0 ? ROUND_UP_TO(context->width, 8) : context->width);
+	ccl = _mm_cvtsi32_si128((int)context->ColorLossLevel);
+
+	for (y = top; y < bottom; y++)
+	{
+		UINT32 x;
+		const BYTE* src = data + 1ull * (context->height - 1 - y) * scanline;
+		BYTE* yplane = context->priv->PlaneBuffers[0] + 1ull * y * rw;
+		BYTE* coplane = context->priv->PlaneBuffers[1] + 1ull * y * rw;
+		BYTE* cgplane = context->priv->PlaneBuffers[2] + 1ull * y * rw;
+		BYTE* aplane = context->priv->PlaneBuffers[3] + 1ull * y * context->width;
+
+		for (x = 0; x + 16 <= context->width; x += 16)
+		{
+			__m256i y_val;
+			__m256i co_val;
+			__m256i cg_val;
+			__m256i ya;
+			__m256i cocg;
+			const __m256i p0 = _mm256_loadu_si256((const __m256i*)src);
+			const __m256i p1 = _mm256_loadu_si256((const __m256i*)(src + 32));
+			const __m256i r_val = nsc_channel_avx2(p0, p1, rshift);
+			const __m256i g_val = nsc_channel_avx2(p0, p1, 8);
+			const __m256i b_val = nsc_channel_avx2(p0, p1, bshift);
+			const __m256i a_val =
+			    (ashift < 0) ? _mm256_set1_epi16(0xFF) : nsc_channel_avx2(p0, p1, ashift);
+
+			y_val = _mm256_srai_epi16(r_val, 2);
+			y_val = _mm256_add_epi16(y_val, _mm256_srai_epi16(g_val, 1));
+			y_val = _mm256_add_epi16(y_val, _mm256_srai_epi16(b_val, 2));
+			co_val = _mm256_sub_epi16(r_val, b_val);
+			co_val = _mm256_sra_epi16(co_val, ccl);
+			cg_val = _mm256_sub_epi16(g_val, _mm256_srai_epi16(r_val, 1));
+			cg_val = _mm256_sub_epi16(cg_val, _mm256_srai_epi16(b_val, 1));
+			cg_val = _mm256_sra_epi16(cg_val, ccl);
+
+			ya = nsc_packus_avx2(y_val, a_val);
+			cocg = nsc_packs_avx2(co_val, cg_val);
+			_mm_storeu_si128((__m128i*)&yplane[x], _mm256_castsi256_si128(ya));
+			_mm_storeu_si128((__m128i*)&aplane[x], _mm256_extracti128_si256(ya, 1));
+			_mm_storeu_si128((__m128i*)&coplane[x], _mm256_castsi256_si128(cocg));
+			_mm_storeu_si128((__m128i*)&cgplane[x], _mm256_extracti128_si256(cocg, 1));
+			src += 64;
+		}
+
+		nsc_encode_line(context, src, y, x);
+	}
+
+	return TRUE;
+}
+
+static void nsc_subsample_rows_avx2(NSC_CONTEXT* context, UINT32 top, UINT32 bottom)
+{
+	UINT32 y;
+	const __m256i mask = _mm256_set1_epi16(0xFF);
+	const __m256i bias = _mm256_set1_epi8((char)0x80);
+	const UINT32 tempWidth = ROUND_UP_TO(context->width, 8);
+	const UINT32 tempHeight = ROUND_UP_TO(context->height, 2);
+	const size_t chromaSize = 1ull * tempWidth * tempHeight / 4;
+
+	for (y = top; y < bottom; y++)
+	{
+		size_t i;
+
+		for (i = 0; i < 2; i++)
+		{
+			UINT32 x;
+			BYTE* dst =
+			    context->priv->PlaneBuffers[4] + i * chromaSize + 1ull * y * (tempWidth >> 1);
+			const BYTE* src0 = context->priv->PlaneBuffers[1 + i] + 2ull * y * tempWidth;
+			const BYTE* src1 = src0 + tempWidth;
+
+			for (x = 0; x + 16 <= tempWidth >> 1; x += 16)
+			{
+				__m256i val;
+				const __m256i t0 =
+				    _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)src0), bias);
+				const __m256i t1 =
+				    _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)src1), bias);
+				val = _mm256_add_epi16(_mm256_and_si256(t0, mask), _mm256_srli_epi16(t0, 8));
+				val = _mm256_add_epi16(val, _mm256_and_si256(t1, mask));
+				val = _mm256_srli_epi16(_mm256_add_epi16(val, _mm256_srli_epi16(t1, 8)), 2);
+				val = _mm256_xor_si256(nsc_packus_avx2(val, val), bias);
+				_mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(val));
+				dst += 16;
+				src0 += 32;
+				src1 += 32;
+			}
+
+			for (; x < tempWidth >> 1; x++)
+			{
+				*dst++ = nsc_avg4(src0, src1);
+				src0 += 2;
+				src1 += 2;
+			}
+		}
+	}
+}
+
+void nsc_init_avx2(NSC_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return;
+
+	PROFILER_RENAME(context->priv->prof_nsc_encode, "nsc_encode_avx2")
+	context->encode_rows = nsc_encode_rows_avx2;
+	context->subsample_rows = nsc_subsample_rows_avx2;
+}
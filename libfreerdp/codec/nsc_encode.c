@@ -26,6 +26,8 @@
 #include <string.h>
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/codec/nsc.h>
 #include <freerdp/codec/color.h>
@@ -43,7 +45,7 @@ typedef struct
 	UINT32 scanline;
 	BYTE* PlaneBuffer;
 	UINT32 MaxPlaneSize;
-	BYTE* PlaneBuffers[5];
+	const BYTE* PlaneBuffers[5];
 	UINT32 OrgByteCount[4];
 
 	UINT32 LumaPlaneByteCount;
@@ -109,191 +111,183 @@ fail:
 	return FALSE;
 }
 
-static BOOL nsc_encode_argb_to_aycocg(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline)
+/**
+ * Convert the pixels from x to the end of row y, src points to pixel x of the source row.
+ * With subsampling the row is padded to the plane width with its last pixel. The SIMD
+ * versions use this for the pixels that do not fill a whole vector.
+ */
+void nsc_encode_line(NSC_CONTEXT* context, const BYTE* src, UINT32 y, UINT32 x)
 {
-	UINT16 x;
-	UINT16 y;
-	UINT16 rw;
 	BYTE ccl;
-	const BYTE* src;
-	BYTE* yplane = NULL;
-	BYTE* coplane = NULL;
-	BYTE* cgplane = NULL;
-	BYTE* aplane = NULL;
+	BYTE* yplane;
+	BYTE* coplane;
+	BYTE* cgplane;
+	BYTE* aplane;
 	INT16 r_val;
 	INT16 g_val;
 	INT16 b_val;
 	BYTE a_val;
-	UINT32 tempWidth;
+	const UINT32 width = context->width;
+	const UINT32 tempWidth = ROUND_UP_TO(width, 8);
+	const UINT32 rw = (context->ChromaSubsamplingLevel ? tempWidth : width);
 
-	tempWidth = ROUND_UP_TO(context->width, 8);
-	rw = (context->ChromaSubsamplingLevel ? tempWidth : context->width);
 	ccl = context->ColorLossLevel;
+	yplane = context->priv->PlaneBuffers[0] + 1ull * y * rw;
+	coplane = context->priv->PlaneBuffers[1] + 1ull * y * rw;
+	cgplane = context->priv->PlaneBuffers[2] + 1ull * y * rw;
+	aplane = context->priv->PlaneBuffers[3] + 1ull * y * width;
 
-	for (y = 0; y < context->height; y++)
+	for (; x < width; x++)
 	{
-		src = data + (context->height - 1 - y) * scanline;
-		yplane = context->priv->PlaneBuffers[0] + y * rw;
-		coplane = context->priv->PlaneBuffers[1] + y * rw;
-		cgplane = context->priv->PlaneBuffers[2] + y * rw;
-		aplane = context->priv->PlaneBuffers[3] + y * context->width;
-
-		for (x = 0; x < context->width; x++)
+		switch (context->format)
 		{
-			switch (context->format)
+			case PIXEL_FORMAT_BGRX32:
+				b_val = *src++;
+				g_val = *src++;
+				r_val = *src++;
+				src++;
+				a_val = 0xFF;
+				break;
+
+			case PIXEL_FORMAT_BGRA32:
+				b_val = *src++;
+				g_val = *src++;
+				r_val = *src++;
+				a_val = *src++;
+				break;
+
+			case PIXEL_FORMAT_RGBX32:
+				r_val = *src++;
+				g_val = *src++;
+				b_val = *src++;
+				src++;
+				a_val = 0xFF;
+				break;
+
+			case PIXEL_FORMAT_RGBA32:
+				r_val = *src++;
+				g_val = *src++;
+				b_val = *src++;
+				a_val = *src++;
+				break;
+
+			case PIXEL_FORMAT_BGR24:
+				b_val = *src++;
+				g_val = *src++;
+				r_val = *src++;
+				a_val = 0xFF;
+				break;
+
+			case PIXEL_FORMAT_RGB24:
+				r_val = *src++;
+				g_val = *src++;
+				b_val = *src++;
+				a_val = 0xFF;
+				break;
+
+			case PIXEL_FORMAT_BGR16:
+				b_val = (INT16)(((*(src + 1)) & 0xF8) | ((*(src + 1)) >> 5));
+				g_val = (INT16)((((*(src + 1)) & 0x07) << 5) | (((*src) & 0xE0) >> 3));
+				r_val = (INT16)((((*src) & 0x1F) << 3) | (((*src) >> 2) & 0x07));
+				a_val = 0xFF;
+				src += 2;
+				break;
+
+			case PIXEL_FORMAT_RGB16:
+				r_val = (INT16)(((*(src + 1)) & 0xF8) | ((*(src + 1)) >> 5));
+				g_val = (INT16)((((*(src + 1)) & 0x07) << 5) | (((*src) & 0xE0) >> 3));
+				b_val = (INT16)((((*src) & 0x1F) << 3) | (((*src) >> 2) & 0x07));
+				a_val = 0xFF;
+				src += 2;
+				break;
+
+			case PIXEL_FORMAT_A4:
 			{
-				case PIXEL_FORMAT_BGRX32:
-					b_val = *src++;
-					g_val = *src++;
-					r_val = *src++;
-					src++;
-					a_val = 0xFF;
-					break;
-
-				case PIXEL_FORMAT_BGRA32:
-					b_val = *src++;
-					g_val = *src++;
-					r_val = *src++;
-					a_val = *src++;
-					break;
-
-				case PIXEL_FORMAT_RGBX32:
-					r_val = *src++;
-					g_val = *src++;
-					b_val = *src++;
-					src++;
-					a_val = 0xFF;
-					break;
-
-				case PIXEL_FORMAT_RGBA32:
-					r_val = *src++;
-					g_val = *src++;
-					b_val = *src++;
-					a_val = *src++;
-					break;
-
-				case PIXEL_FORMAT_BGR24:
-					b_val = *src++;
-					g_val = *src++;
-					r_val = *src++;
-					a_val = 0xFF;
-					break;
-
-				case PIXEL_FORMAT_RGB24:
-					r_val = *src++;
-					g_val = *src++;
-					b_val = *src++;
-					a_val = 0xFF;
-					break;
-
-				case PIXEL_FORMAT_BGR16:
-					b_val = (INT16)(((*(src + 1)) & 0xF8) | ((*(src + 1)) >> 5));
-					g_val = (INT16)((((*(src + 1)) & 0x07) << 5) | (((*src) & 0xE0) >> 3));
-					r_val = (INT16)((((*src) & 0x1F) << 3) | (((*src) >> 2) & 0x07));
-					a_val = 0xFF;
-					src += 2;
-					break;
-
-				case PIXEL_FORMAT_RGB16:
-					r_val = (INT16)(((*(src + 1)) & 0xF8) | ((*(src + 1)) >> 5));
-					g_val = (INT16)((((*(src + 1)) & 0x07) << 5) | (((*src) & 0xE0) >> 3));
-					b_val = (INT16)((((*src) & 0x1F) << 3) | (((*src) >> 2) & 0x07));
-					a_val = 0xFF;
-					src += 2;
-					break;
-
-				case PIXEL_FORMAT_A4:
-				{
-					int shift;
-					BYTE idx;
-					shift = (7 - (x % 8));
-					idx = ((*src) >> shift) & 1;
-					idx |= (((*(src + 1)) >> shift) & 1) << 1;
-					idx |= (((*(src + 2)) >> shift) & 1) << 2;
-					idx |= (((*(src + 3)) >> shift) & 1) << 3;
-					idx *= 3;
-					r_val = (INT16)context->palette[idx];
-					g_val = (INT16)context->palette[idx + 1];
-					b_val = (INT16)context->palette[idx + 2];
-
-					if (shift == 0)
-						src += 4;
-				}
-
-					a_val = 0xFF;
-					break;
-
-				case PIXEL_FORMAT_RGB8:
-				{
-					int idx = (*src) * 3;
-					r_val = (INT16)context->palette[idx];
-					g_val = (INT16)context->palette[idx + 1];
-					b_val = (INT16)context->palette[idx + 2];
-					src++;
-				}
-
-					a_val = 0xFF;
-					break;
-
-				default:
-					r_val = g_val = b_val = a_val = 0;
-					break;
+				int shift;
+				BYTE idx;
+				shift = (7 - (x % 8));
+				idx = ((*src) >> shift) & 1;
+				idx |= (((*(src + 1)) >> shift) & 1) << 1;
+				idx |= (((*(src + 2)) >> shift) & 1) << 2;
+				idx |= (((*(src + 3)) >> shift) & 1) << 3;
+				idx *= 3;
+				r_val = (INT16)context->palette[idx];
+				g_val = (INT16)context->palette[idx + 1];
+				b_val = (INT16)context->palette[idx + 2];
+
+				if (shift == 0)
+					src += 4;
 			}
 
-			*yplane++ = (BYTE)((r_val >> 2) + (g_val >> 1) + (b_val >> 2));
-			/* Perform color loss reduction here */
-			*coplane++ = (BYTE)((r_val - b_val) >> ccl);
-			*cgplane++ = (BYTE)((-(r_val >> 1) + g_val - (b_val >> 1)) >> ccl);
-			*aplane++ = a_val;
-		}
+				a_val = 0xFF;
+				break;
 
-		if (context->ChromaSubsamplingLevel && (x % 2) == 1)
-		{
-			*yplane = *(yplane - 1);
-			*coplane = *(coplane - 1);
-			*cgplane = *(cgplane - 1);
+			case PIXEL_FORMAT_RGB8:
+			{
+				int idx = (*src) * 3;
+				r_val = (INT16)context->palette[idx];
+				g_val = (INT16)context->palette[idx + 1];
+				b_val = (INT16)context->palette[idx + 2];
+				src++;
+			}
+
+				a_val = 0xFF;
+				break;
+
+			default:
+				r_val = g_val = b_val = a_val = 0;
+				break;
 		}
+
+		yplane[x] = (BYTE)((r_val >> 2) + (g_val >> 1) + (b_val >> 2));
+		/* Perform color loss reduction here */
+		coplane[x] = (BYTE)((r_val - b_val) >> ccl);
+		cgplane[x] = (BYTE)((-(r_val >> 1) + g_val - (b_val >> 1)) >> ccl);
+		aplane[x] = a_val;
 	}
 
-	if (context->ChromaSubsamplingLevel && (y % 2) == 1)
+	if (context->ChromaSubsamplingLevel && (width > 0))
 	{
-		yplane = context->priv->PlaneBuffers[0] + y * rw;
-		coplane = context->priv->PlaneBuffers[1] + y * rw;
-		cgplane = context->priv->PlaneBuffers[2] + y * rw;
-		CopyMemory(yplane, yplane - rw, rw);
-		CopyMemory(coplane, coplane - rw, rw);
-		CopyMemory(cgplane, cgplane - rw, rw);
+		FillMemory(&yplane[width], rw - width, yplane[width - 1]);
+		FillMemory(&coplane[width], rw - width, coplane[width - 1]);
+		FillMemory(&cgplane[width], rw - width, cgplane[width - 1]);
 	}
-
-	return TRUE;
 }
 
-static BOOL nsc_encode_subsampling(NSC_CONTEXT* context)
+BOOL nsc_encode_rows(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline, UINT32 top,
+                     UINT32 bottom)
 {
 	UINT32 y;
-	UINT32 tempWidth;
-	UINT32 tempHeight;
 
-	if (!context)
+	if (!context || !data || (scanline == 0))
 		return FALSE;
 
-	tempWidth = ROUND_UP_TO(context->width, 8);
-	tempHeight = ROUND_UP_TO(context->height, 2);
+	for (y = top; y < bottom; y++)
+	{
+		const BYTE* src = data + 1ull * (context->height - 1 - y) * scanline;
+		nsc_encode_line(context, src, y, 0);
+	}
 
-	if (tempHeight == 0)
-		return FALSE;
+	return TRUE;
+}
 
-	if (tempWidth > context->priv->PlaneBuffersLength / tempHeight)
-		return FALSE;
+void nsc_subsample_rows(NSC_CONTEXT* context, UINT32 top, UINT32 bottom)
+{
+	UINT32 y;
+	const UINT32 tempWidth = ROUND_UP_TO(context->width, 8);
+	const UINT32 tempHeight = ROUND_UP_TO(context->height, 2);
+	const size_t chromaSize = 1ull * tempWidth * tempHeight / 4;
 
-	for (y = 0; y < tempHeight >> 1; y++)
+	for (y = top; y < bottom; y++)
 	{
 		UINT32 x;
-		BYTE* co_dst = context->priv->PlaneBuffers[1] + y * (tempWidth >> 1);
-		BYTE* cg_dst = context->priv->PlaneBuffers[2] + y * (tempWidth >> 1);
-		const INT8* co_src0 = (INT8*)context->priv->PlaneBuffers[1] + (y << 1) * tempWidth;
+		BYTE* co_dst = context->priv->PlaneBuffers[4] + 1ull * y * (tempWidth >> 1);
+		BYTE* cg_dst = co_dst + chromaSize;
+		const INT8* co_src0 =
+		    (const INT8*)context->priv->PlaneBuffers[1] + 2ull * y * tempWidth;
 		const INT8* co_src1 = co_src0 + tempWidth;
-		const INT8* cg_src0 = (INT8*)context->priv->PlaneBuffers[2] + (y << 1) * tempWidth;
+		const INT8* cg_src0 =
+		    (const INT8*)context->priv->PlaneBuffers[2] + 2ull * y * tempWidth;
 		const INT8* cg_src1 = cg_src0 + tempWidth;
 
 		for (x = 0; x < tempWidth >> 1; x++)
@@ -310,109 +304,384 @@ static BOOL nsc_encode_subsampling(NSC_CONTEXT* context)
 			cg_src1 += 2;
 		}
 	}
-
-	return TRUE;
 }
 
-BOOL nsc_encode(NSC_CONTEXT* context, const BYTE* bmpdata, UINT32 rowstride)
+/**
+ * Returns the index of the first byte in [i, end) that starts a run, that is equals its
+ * successor within [i, end), or end if there is none. Eight byte pairs are checked at
+ * once, a zero byte in in[k] ^ in[k + 1] marks a run.
+ */
+static INLINE UINT32 nsc_rle_find_run(const BYTE* in, UINT32 i, UINT32 end)
 {
-	if (!context || !bmpdata || (rowstride == 0))
-		return FALSE;
+	while (i + 9 <= end)
+	{
+		UINT64 a;
+		UINT64 b;
+		UINT64 v;
+		memcpy(&a, &in[i], sizeof(a));
+		memcpy(&b, &in[i + 1], sizeof(b));
+		v = a ^ b;
 
-	if (!nsc_encode_argb_to_aycocg(context, bmpdata, rowstride))
-		return FALSE;
+		if (((v - 0x0101010101010101ull) & ~v & 0x8080808080808080ull) != 0)
+			break;
 
-	if (context->ChromaSubsamplingLevel)
+		i += 8;
+	}
+
+	for (; i + 1 < end; i++)
 	{
-		if (!nsc_encode_subsampling(context))
-			return FALSE;
+		if (in[i] == in[i + 1])
+			return i;
 	}
 
-	return TRUE;
+	return end;
+}
+
+/* Returns the index of the last byte of the run of in[i] within [i, end) */
+static INLINE UINT32 nsc_rle_run_end(const BYTE* in, UINT32 i, UINT32 end)
+{
+	const UINT64 pattern = 0x0101010101010101ull * in[i];
+
+	while (i + 9 <= end)
+	{
+		UINT64 v;
+		memcpy(&v, &in[i + 1], sizeof(v));
+
+		if (v != pattern)
+			break;
+
+		i += 8;
+	}
+
+	while ((i + 1 < end) && (in[i + 1] == in[i]))
+		i++;
+
+	return i;
 }
 
-static UINT32 nsc_rle_encode(const BYTE* in, BYTE* out, UINT32 originalSize)
+/**
+ * Run length encode length bytes, the tokens are the same as the bytewise encoder of
+ * the specification produces. Returns the encoded size or length if the output would not
+ * be smaller than the input. out must hold length + 7 bytes.
+ */
+static UINT32 nsc_rle_encode_segment(const BYTE* in, BYTE* out, UINT32 length)
 {
-	UINT32 left;
-	UINT32 runlength = 1;
+	UINT32 i = 0;
 	UINT32 planeSize = 0;
-	left = originalSize;
 
-	/**
-	 * We quit the loop if the running compressed size is larger than the original.
-	 * In such cases data will be sent uncompressed.
-	 */
-	while (left > 4 && planeSize < originalSize - 4)
+	while (i < length)
 	{
-		if (left > 5 && *in == *(in + 1))
-		{
-			runlength++;
-		}
-		else if (runlength == 1)
-		{
-			*out++ = *in;
-			planeSize++;
-		}
-		else if (runlength < 256)
+		UINT32 runlength;
+		UINT32 next = nsc_rle_find_run(in, i, length);
+
+		if (next - i >= length - planeSize)
+			return length;
+
+		CopyMemory(&out[planeSize], &in[i], next - i);
+		planeSize += next - i;
+		i = next;
+
+		if (i == length)
+			break;
+
+		next = nsc_rle_run_end(in, i, length);
+		runlength = next - i + 1;
+		out[planeSize++] = in[i];
+		out[planeSize++] = in[i];
+
+		if (runlength < 256)
 		{
-			*out++ = *in;
-			*out++ = *in;
-			*out++ = runlength - 2;
-			runlength = 1;
-			planeSize += 3;
+			out[planeSize++] = (BYTE)(runlength - 2);
 		}
 		else
 		{
-			*out++ = *in;
-			*out++ = *in;
-			*out++ = 0xFF;
-			*out++ = (runlength & 0x000000FF);
-			*out++ = (runlength & 0x0000FF00) >> 8;
-			*out++ = (runlength & 0x00FF0000) >> 16;
-			*out++ = (runlength & 0xFF000000) >> 24;
-			runlength = 1;
-			planeSize += 7;
+			out[planeSize++] = 0xFF;
+			out[planeSize++] = (runlength & 0x000000FF);
+			out[planeSize++] = (runlength & 0x0000FF00) >> 8;
+			out[planeSize++] = (runlength & 0x00FF0000) >> 16;
+			out[planeSize++] = (runlength & 0xFF000000) >> 24;
 		}
 
-		in++;
-		left--;
-	}
+		if (planeSize >= length)
+			return length;
 
-	if (planeSize < originalSize - 4)
-		CopyMemory(out, in, 4);
+		i = next + 1;
+	}
 
-	planeSize += 4;
 	return planeSize;
 }
 
-static void nsc_rle_compress_data(NSC_CONTEXT* context)
+#define NSC_BAND_HEIGHT 64
+#define NSC_THREADED_MIN_SIZE (256 * 256)
+#define NSC_RLE_SEGMENT_SIZE (128 * 1024)
+
+typedef struct
+{
+	NSC_CONTEXT* context;
+	const BYTE* data;
+	UINT32 scanline;
+	UINT32 top;
+	UINT32 bottom;
+	const BYTE* in;
+	BYTE* out;
+	UINT32 length;
+	UINT32 size;
+	BOOL success;
+} NSC_ENCODE_WORK_PARAM;
+
+static DWORD g_NscThreads = 1;
+
+static INIT_ONCE nsc_encoder_init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK nsc_encoder_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	SYSTEM_INFO sysInfos;
+
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+
+	GetNativeSystemInfo(&sysInfos);
+	g_NscThreads = MAX(1, sysInfos.dwNumberOfProcessors);
+	return TRUE;
+}
+
+static void CALLBACK nsc_convert_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                               PTP_WORK work)
+{
+	NSC_ENCODE_WORK_PARAM* param = (NSC_ENCODE_WORK_PARAM*)context;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	param->success = param->context->encode_rows(param->context, param->data, param->scanline,
+	                                             param->top, param->bottom);
+}
+
+static void CALLBACK nsc_subsample_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                                 PTP_WORK work)
+{
+	NSC_ENCODE_WORK_PARAM* param = (NSC_ENCODE_WORK_PARAM*)context;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	param->context->subsample_rows(param->context, param->top, param->bottom);
+	param->success = TRUE;
+}
+
+static void CALLBACK nsc_rle_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                           PTP_WORK work)
+{
+	NSC_ENCODE_WORK_PARAM* param = (NSC_ENCODE_WORK_PARAM*)context;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	param->size = nsc_rle_encode_segment(param->in, param->out, param->length);
+	param->success = TRUE;
+}
+
+static BOOL nsc_run_jobs(NSC_CONTEXT* context, NSC_ENCODE_WORK_PARAM* params, size_t count,
+                         PTP_WORK_CALLBACK callback, BOOL threaded)
+{
+	size_t i;
+
+	if (!codec_jobs_run(threaded ? context->priv->Jobs : NULL, params,
+	                    sizeof(NSC_ENCODE_WORK_PARAM), count, callback))
+		return FALSE;
+
+	for (i = 0; i < count; i++)
+	{
+		if (!params[i].success)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Run a job per band of bandHeight rows out of height rows */
+static BOOL nsc_run_band_jobs(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline,
+                              UINT32 height, UINT32 bandHeight, PTP_WORK_CALLBACK callback,
+                              BOOL threaded)
 {
-	UINT16 i;
-	UINT32 planeSize;
-	UINT32 originalSize;
+	UINT32 b;
+	BOOL rc;
+	NSC_ENCODE_WORK_PARAM* params;
+	const UINT32 bands = (height + bandHeight - 1) / bandHeight;
+
+	params = (NSC_ENCODE_WORK_PARAM*)calloc(MAX(1, bands), sizeof(NSC_ENCODE_WORK_PARAM));
+
+	if (!params)
+		return FALSE;
+
+	for (b = 0; b < bands; b++)
+	{
+		params[b].context = context;
+		params[b].data = data;
+		params[b].scanline = scanline;
+		params[b].top = b * bandHeight;
+		params[b].bottom = MIN(height, (b + 1) * bandHeight);
+	}
+
+	rc = nsc_run_jobs(context, params, bands, callback, threaded);
+	free(params);
+	return rc;
+}
+
+/**
+ * ARGB to AYCoCg conversion, colorloss reduction and chroma subsampling. Large bitmaps
+ * are cut into bands that are converted on the thread pool, the subsampling starts once
+ * all bands are done as it reads two source rows per output row.
+ */
+static BOOL nsc_encode_planes(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline,
+                              BOOL threaded)
+{
+	const UINT32 height = context->height;
+	const UINT32 chromaHeight = ROUND_UP_TO(height, 2) / 2;
+	const UINT32 tempWidth = ROUND_UP_TO(context->width, 8);
+	const UINT32 bandHeight = threaded ? NSC_BAND_HEIGHT : MAX(1, height);
+
+	if (!nsc_run_band_jobs(context, data, scanline, height, bandHeight, nsc_convert_work_callback,
+	                       threaded))
+		return FALSE;
+
+	if (!context->ChromaSubsamplingLevel)
+		return TRUE;
+
+	/* Duplicate the last row for odd heights */
+	if ((height % 2) == 1)
+	{
+		size_t i;
+
+		for (i = 0; i < 3; i++)
+		{
+			BYTE* plane = context->priv->PlaneBuffers[i] + 1ull * height * tempWidth;
+			CopyMemory(plane, plane - tempWidth, tempWidth);
+		}
+	}
+
+	return nsc_run_band_jobs(context, NULL, 0, chromaHeight,
+	                         threaded ? NSC_BAND_HEIGHT / 2 : MAX(1, chromaHeight),
+	                         nsc_subsample_work_callback, threaded);
+}
+
+/**
+ * Run length encode the planes. Each plane is cut into segments that are encoded on the
+ * thread pool into their own slot of the RLE buffer and compacted afterwards, the token
+ * stream stays valid at segment borders. A single segment per plane gives the output of
+ * the sequential encoder. planes is updated to the buffers to send.
+ */
+static BOOL nsc_rle_compress_data(NSC_CONTEXT* context, const BYTE* planes[4], BOOL threaded)
+{
+	size_t i;
+	size_t k;
+	size_t count = 0;
+	size_t needed = 0;
+	size_t offset = 0;
+	NSC_ENCODE_WORK_PARAM* params;
+	size_t segments[4] = { 0 }; /* upper bound first, then the actual count */
+
+	for (i = 0; i < 4; i++)
+	{
+		const UINT32 originalSize = context->OrgByteCount[i];
+
+		if (originalSize <= 4)
+			continue;
+
+		segments[i] =
+		    threaded ? (originalSize - 4 + NSC_RLE_SEGMENT_SIZE - 1) / NSC_RLE_SEGMENT_SIZE : 1;
+		count += segments[i];
+		needed += originalSize - 4 + 8 * segments[i];
+	}
+
+	if (needed > context->priv->RleBufferLength)
+	{
+		BYTE* tmp = (BYTE*)realloc(context->priv->RleBuffer, needed);
+
+		if (!tmp)
+			return FALSE;
+
+		context->priv->RleBuffer = tmp;
+		context->priv->RleBufferLength = needed;
+	}
+
+	params = (NSC_ENCODE_WORK_PARAM*)calloc(MAX(1, count), sizeof(NSC_ENCODE_WORK_PARAM));
+
+	if (!params)
+		return FALSE;
+
+	count = 0;
 
 	for (i = 0; i < 4; i++)
 	{
-		originalSize = context->OrgByteCount[i];
+		UINT32 start = 0;
+		const UINT32 length = context->OrgByteCount[i] - 4;
+		const size_t first = count;
 
-		if (originalSize == 0)
+		while ((segments[i] > 0) && (start < length))
 		{
-			planeSize = 0;
+			NSC_ENCODE_WORK_PARAM* param = &params[count++];
+			UINT32 end = threaded ? MIN(length, start + NSC_RLE_SEGMENT_SIZE) : length;
+
+			/**
+			 * Never split a run: the decoder takes a literal followed by the same value
+			 * for the start of a run, so a segment must end where the value changes.
+			 */
+			if (end < length)
+				end = nsc_rle_run_end(planes[i], end - 1, length) + 1;
+
+			param->in = planes[i] + start;
+			param->out = context->priv->RleBuffer + offset;
+			param->length = end - start;
+			offset += param->length + 8;
+			start = end;
 		}
-		else
+
+		segments[i] = count - first;
+	}
+
+	if (!nsc_run_jobs(context, params, count, nsc_rle_work_callback, threaded))
+	{
+		free(params);
+		return FALSE;
+	}
+
+	count = 0;
+
+	for (i = 0; i < 4; i++)
+	{
+		const UINT32 originalSize = context->OrgByteCount[i];
+		BYTE* dst = (segments[i] > 0) ? params[count].out : NULL;
+		UINT32 planeSize = 0;
+		BOOL compressed = TRUE;
+
+		for (k = 0; k < segments[i]; k++)
 		{
-			planeSize = nsc_rle_encode(context->priv->PlaneBuffers[i],
-			                           context->priv->PlaneBuffers[4], originalSize);
-
-			if (planeSize < originalSize)
-				CopyMemory(context->priv->PlaneBuffers[i], context->priv->PlaneBuffers[4],
-				           planeSize);
-			else
-				planeSize = originalSize;
+			const NSC_ENCODE_WORK_PARAM* param = &params[count++];
+
+			if (param->size >= param->length)
+				compressed = FALSE;
+			else if (compressed)
+			{
+				MoveMemory(&dst[planeSize], param->out, param->size);
+				planeSize += param->size;
+			}
 		}
 
-		context->PlaneByteCount[i] = planeSize;
+		/* The last 4 bytes are always raw */
+		if (compressed && dst && (planeSize + 4 < originalSize))
+		{
+			CopyMemory(&dst[planeSize], &planes[i][originalSize - 4], 4);
+			context->PlaneByteCount[i] = planeSize + 4;
+			planes[i] = dst;
+		}
+		else
+			context->PlaneByteCount[i] = originalSize;
 	}
+
+	free(params);
+	return TRUE;
 }
 
 static UINT32 nsc_compute_byte_count(NSC_CONTEXT* context, UINT32* ByteCount, UINT32 width,
@@ -483,32 +752,59 @@ BOOL nsc_compose_message(NSC_CONTEXT* context, wStream* s, const BYTE* data, UIN
                          UINT32 height, UINT32 scanline)
 {
 	BOOL rc;
+	BOOL threaded;
+	const BYTE* planes[4];
 	NSC_MESSAGE message = { 0 };
 
 	if (!context || !s || !data)
 		return FALSE;
 
+	InitOnceExecuteOnce(&nsc_encoder_init_once, nsc_encoder_init, NULL, NULL);
+
 	context->width = width;
 	context->height = height;
 
 	if (!nsc_context_initialize_encode(context))
 		return FALSE;
 
+	threaded = (g_NscThreads > 1) && (1ull * width * height >= NSC_THREADED_MIN_SIZE);
+
+	/* Without a work object the jobs run on this thread */
+	if (threaded && !context->priv->Jobs)
+		context->priv->Jobs = codec_jobs_new(NULL);
+
 	/* ARGB to AYCoCg conversion, chroma subsampling and colorloss reduction */
 	PROFILER_ENTER(context->priv->prof_nsc_encode)
-	rc = context->encode(context, data, scanline);
+	rc = nsc_encode_planes(context, data, scanline, threaded);
 	PROFILER_EXIT(context->priv->prof_nsc_encode)
 	if (!rc)
 		return FALSE;
 
+	planes[0] = context->priv->PlaneBuffers[0];
+	planes[3] = context->priv->PlaneBuffers[3];
+
+	if (context->ChromaSubsamplingLevel)
+	{
+		planes[1] = context->priv->PlaneBuffers[4];
+		planes[2] = context->priv->PlaneBuffers[4] + context->OrgByteCount[1];
+	}
+	else
+	{
+		planes[1] = context->priv->PlaneBuffers[1];
+		planes[2] = context->priv->PlaneBuffers[2];
+	}
+
 	/* RLE encode */
 	PROFILER_ENTER(context->priv->prof_nsc_rle_compress_data)
-	nsc_rle_compress_data(context);
+	rc = nsc_rle_compress_data(context, planes, threaded);
 	PROFILER_EXIT(context->priv->prof_nsc_rle_compress_data)
-	message.PlaneBuffers[0] = context->priv->PlaneBuffers[0];
-	message.PlaneBuffers[1] = context->priv->PlaneBuffers[1];
-	message.PlaneBuffers[2] = context->priv->PlaneBuffers[2];
-	message.PlaneBuffers[3] = context->priv->PlaneBuffers[3];
+	if (!rc)
+		return FALSE;
+
+	message.PlaneBuffers[0] = planes[0];
+	message.PlaneBuffers[1] = planes[1];
+	message.PlaneBuffers[2] = planes[2];
+	message.PlaneBuffers[3] = planes[3];
 	message.LumaPlaneByteCount = context->PlaneByteCount[0];
 	message.OrangeChromaPlaneByteCount = context->PlaneByteCount[1];
 	message.GreenChromaPlaneByteCount = context->PlaneByteCount[2];
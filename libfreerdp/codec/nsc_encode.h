@@ -24,6 +24,11 @@
 
 #include <freerdp/api.h>
 
-FREERDP_LOCAL BOOL nsc_encode(NSC_CONTEXT* context, const BYTE* bmpdata, UINT32 rowstride);
+#include "nsc_types.h"
+
+FREERDP_LOCAL BOOL nsc_encode_rows(NSC_CONTEXT* context, const BYTE* bmpdata, UINT32 rowstride,
+                                   UINT32 top, UINT32 bottom);
+FREERDP_LOCAL void nsc_subsample_rows(NSC_CONTEXT* context, UINT32 top, UINT32 bottom);
+FREERDP_LOCAL void nsc_encode_line(NSC_CONTEXT* context, const BYTE* src, UINT32 y, UINT32 x);
 
 #endif /* FREERDP_LIB_CODEC_NSC_ENCODE_H */
@@ -31,13 +31,15 @@
 #include <winpr/sysinfo.h>
 
 #include "nsc_types.h"
+#include "nsc_encode.h"
 #include "nsc_sse2.h"
 
-static BOOL nsc_encode_argb_to_aycocg_sse2(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline)
+BOOL nsc_encode_rows_sse2(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline, UINT32 top,
+                          UINT32 bottom)
 {
-	UINT16 x;
-	UINT16 y;
-	UINT16 rw;
+	UINT32 x;
+	UINT32 y;
+	UINT32 rw;
 	BYTE ccl;
 	const BYTE* src;
 	BYTE* yplane = NULL;
@@ -60,15 +62,16 @@ static BOOL nsc_encode_argb_to_aycocg_sse2(NSC_CONTEXT* context, const BYTE* dat
 	rw = (context->ChromaSubsamplingLevel > 0 ? tempWidth : context->width);
 	ccl = context->ColorLossLevel;
 
-	for (y = 0; y < context->height; y++)
+	for (y = top; y < bottom; y++)
 	{
-		src = data + (context->height - 1 - y) * scanline;
-		yplane = context->priv->PlaneBuffers[0] + y * rw;
-		coplane = context->priv->PlaneBuffers[1] + y * rw;
-		cgplane = context->priv->PlaneBuffers[2] + y * rw;
-		aplane = context->priv->PlaneBuffers[3] + y * context->width;
-
-		for (x = 0; x < context->width; x += 8)
+		src = data + 1ull * (context->height - 1 - y) * scanline;
+		yplane = context->priv->PlaneBuffers[0] + 1ull * y * rw;
+		coplane = context->priv->PlaneBuffers[1] + 1ull * y * rw;
+		cgplane = context->priv->PlaneBuffers[2] + 1ull * y * rw;
+		aplane = context->priv->PlaneBuffers[3] + 1ull * y * context->width;
+
+		/* Whole vectors only, the stores must not reach into rows of other bands */
+		for (x = 0; x + 8 <= context->width; x += 8)
 		{
 			switch (context->format)
 			{
@@ -279,103 +282,88 @@ static BOOL nsc_encode_argb_to_aycocg_sse2(NSC_CONTEXT* context, const BYTE* dat
 			cg_val = _mm_sub_epi16(cg_val, _mm_srai_epi16(b_val, 1));
 			cg_val = _mm_srai_epi16(cg_val, ccl);
 			y_val = _mm_packus_epi16(y_val, y_val);
-			_mm_storeu_si128((__m128i*)yplane, y_val);
+			_mm_storel_epi64((__m128i*)yplane, y_val);
 			co_val = _mm_packs_epi16(co_val, co_val);
-			_mm_storeu_si128((__m128i*)coplane, co_val);
+			_mm_storel_epi64((__m128i*)coplane, co_val);
 			cg_val = _mm_packs_epi16(cg_val, cg_val);
-			_mm_storeu_si128((__m128i*)cgplane, cg_val);
+			_mm_storel_epi64((__m128i*)cgplane, cg_val);
 			a_val = _mm_packus_epi16(a_val, a_val);
-			_mm_storeu_si128((__m128i*)aplane, a_val);
+			_mm_storel_epi64((__m128i*)aplane, a_val);
 			yplane += 8;
 			coplane += 8;
 			cgplane += 8;
 			aplane += 8;
 		}
 
-		if (context->ChromaSubsamplingLevel > 0 && (context->width % 2) == 1)
-		{
-			context->priv->PlaneBuffers[0][y * rw + context->width] =
-			    context->priv->PlaneBuffers[0][y * rw + context->width - 1];
-			context->priv->PlaneBuffers[1][y * rw + context->width] =
-			    context->priv->PlaneBuffers[1][y * rw + context->width - 1];
-			context->priv->PlaneBuffers[2][y * rw + context->width] =
-			    context->priv->PlaneBuffers[2][y * rw + context->width - 1];
-		}
-	}
-
-	if (context->ChromaSubsamplingLevel > 0 && (y % 2) == 1)
-	{
-		yplane = context->priv->PlaneBuffers[0] + y * rw;
-		coplane = context->priv->PlaneBuffers[1] + y * rw;
-		cgplane = context->priv->PlaneBuffers[2] + y * rw;
-		CopyMemory(yplane, yplane - rw, rw);
-		CopyMemory(coplane, coplane - rw, rw);
-		CopyMemory(cgplane, cgplane - rw, rw);
+		nsc_encode_line(context, src, y, x);
 	}
 
 	return TRUE;
 }
 
-static void nsc_encode_subsampling_sse2(NSC_CONTEXT* context)
+static void nsc_subsample_rows_sse2(NSC_CONTEXT* context, UINT32 top, UINT32 bottom)
 {
 	UINT32 y;
 	BYTE* co_dst;
 	BYTE* cg_dst;
-	INT8* co_src0;
-	INT8* co_src1;
-	INT8* cg_src0;
-	INT8* cg_src1;
+	const BYTE* co_src0;
+	const BYTE* co_src1;
+	const BYTE* cg_src0;
+	const BYTE* cg_src1;
 	UINT32 tempWidth;
 	UINT32 tempHeight;
-	__m128i t;
+	__m128i t0;
+	__m128i t1;
 	__m128i val;
-	__m128i mask = _mm_set1_epi16(0xFF);
+	const __m128i mask = _mm_set1_epi16(0xFF);
+	const __m128i bias = _mm_set1_epi8((char)0x80);
 	tempWidth = ROUND_UP_TO(context->width, 8);
 	tempHeight = ROUND_UP_TO(context->height, 2);
 
-	for (y = 0; y < tempHeight >> 1; y++)
+	for (y = top; y < bottom; y++)
 	{
 		UINT32 x;
-		co_dst = context->priv->PlaneBuffers[1] + y * (tempWidth >> 1);
-		cg_dst = context->priv->PlaneBuffers[2] + y * (tempWidth >> 1);
-		co_src0 = (INT8*)context->priv->PlaneBuffers[1] + (y << 1) * tempWidth;
+		co_dst = context->priv->PlaneBuffers[4] + 1ull * y * (tempWidth >> 1);
+		cg_dst = co_dst + 1ull * tempWidth * tempHeight / 4;
+		co_src0 = context->priv->PlaneBuffers[1] + 2ull * y * tempWidth;
 		co_src1 = co_src0 + tempWidth;
-		cg_src0 = (INT8*)context->priv->PlaneBuffers[2] + (y << 1) * tempWidth;
+		cg_src0 = context->priv->PlaneBuffers[2] + 2ull * y * tempWidth;
 		cg_src1 = cg_src0 + tempWidth;
 
-		for (x = 0; x < tempWidth >> 1; x += 8)
+		for (x = 0; x + 8 <= tempWidth >> 1; x += 8)
 		{
-			t = _mm_loadu_si128((__m128i*)co_src0);
-			t = _mm_avg_epu8(t, _mm_loadu_si128((__m128i*)co_src1));
-			val = _mm_and_si128(_mm_srli_si128(t, 1), mask);
-			val = _mm_avg_epu16(val, _mm_and_si128(t, mask));
-			val = _mm_packus_epi16(val, val);
-			_mm_storeu_si128((__m128i*)co_dst, val);
+			t0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)co_src0), bias);
+			t1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)co_src1), bias);
+			val = _mm_add_epi16(_mm_and_si128(t0, mask), _mm_srli_epi16(t0, 8));
+			val = _mm_add_epi16(val, _mm_and_si128(t1, mask));
+			val = _mm_srli_epi16(_mm_add_epi16(val, _mm_srli_epi16(t1, 8)), 2);
+			val = _mm_xor_si128(_mm_packus_epi16(val, val), bias);
+			_mm_storel_epi64((__m128i*)co_dst, val);
 			co_dst += 8;
 			co_src0 += 16;
 			co_src1 += 16;
-			t = _mm_loadu_si128((__m128i*)cg_src0);
-			t = _mm_avg_epu8(t, _mm_loadu_si128((__m128i*)cg_src1));
-			val = _mm_and_si128(_mm_srli_si128(t, 1), mask);
-			val = _mm_avg_epu16(val, _mm_and_si128(t, mask));
-			val = _mm_packus_epi16(val, val);
-			_mm_storeu_si128((__m128i*)cg_dst, val);
+			t0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)cg_src0), bias);
+			t1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)cg_src1), bias);
+			val = _mm_add_epi16(_mm_and_si128(t0, mask), _mm_srli_epi16(t0, 8));
+			val = _mm_add_epi16(val, _mm_and_si128(t1, mask));
+			val = _mm_srli_epi16(_mm_add_epi16(val, _mm_srli_epi16(t1, 8)), 2);
+			val = _mm_xor_si128(_mm_packus_epi16(val, val), bias);
+			_mm_storel_epi64((__m128i*)cg_dst, val);
 			cg_dst += 8;
 			cg_src0 += 16;
 			cg_src1 += 16;
 		}
-	}
-}
 
-static BOOL nsc_encode_sse2(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline)
-{
-	if (!nsc_encode_argb_to_aycocg_sse2(context, data, scanline))
-		return FALSE;
-
-	if (context->ChromaSubsamplingLevel > 0)
-		nsc_encode_subsampling_sse2(context);
-
-	return TRUE;
+		for (; x < tempWidth >> 1; x++)
+		{
+			*co_dst++ = nsc_avg4(co_src0, co_src1);
+			*cg_dst++ = nsc_avg4(cg_src0, cg_src1);
+			co_src0 += 2;
+			co_src1 += 2;
+			cg_src0 += 2;
+			cg_src1 += 2;
+		}
+	}
 }
 
 void nsc_init_sse2(NSC_CONTEXT* context)
@@ -384,5 +372,6 @@ void nsc_init_sse2(NSC_CONTEXT* context)
 		return;
 
 	PROFILER_RENAME(context->priv->prof_nsc_encode, "nsc_encode_sse2")
-	context->encode = nsc_encode_sse2;
+	context->encode_rows = nsc_encode_rows_sse2;
+	context->subsample_rows = nsc_subsample_rows_sse2;
 }
@@ -24,6 +24,8 @@
 #include <freerdp/api.h>
 
 FREERDP_LOCAL void nsc_init_sse2(NSC_CONTEXT* context);
+FREERDP_LOCAL BOOL nsc_encode_rows_sse2(NSC_CONTEXT* context, const BYTE* data, UINT32 scanline,
+                                        UINT32 top, UINT32 bottom);
 
 #ifdef WITH_SSE2
 #ifndef NSC_INIT_SIMD
@@ -30,6 +30,8 @@
 #include <freerdp/utils/profiler.h>
 #include <freerdp/codec/nsc.h>
 
+#include "jobs.h"
+
 #define ROUND_UP_TO(_b, _n) (_b + ((~(_b & (_n - 1)) + 0x1) & (_n - 1)))
 #define MINMAX(_v, _l, _h) ((_v) < (_l) ? (_l) : ((_v) > (_h) ? (_h) : (_v)))
 
@@ -40,6 +42,11 @@ typedef struct
 	BYTE* PlaneBuffers[5];     /* Decompressed Plane Buffers in the respective order */
 	UINT32 PlaneBuffersLength; /* Lengths of each plane buffer */
 
+	BYTE* RleBuffer;        /* Encoder RLE output, one slot per plane segment */
+	size_t RleBufferLength; /* Length of the RLE output buffer */
+
+	CODEC_JOBS* Jobs; /* Encoder jobs on the thread pool, NULL for a single thread */
+
 	/* profilers */
 	PROFILER_DEFINE(prof_nsc_rle_decompress_data)
 	PROFILER_DEFINE(prof_nsc_decode)
@@ -66,9 +73,28 @@ struct S_NSC_CONTEXT
 	const BYTE* palette;
 
 	BOOL (*decode)(NSC_CONTEXT* context);
-	BOOL (*encode)(NSC_CONTEXT* context, const BYTE* BitmapData, UINT32 rowstride);
+
+	/**
+	 * Convert the rows [top, bottom) of the bitmap to the Y, Co, Cg and A planes.
+	 * Subsampling writes the rows [top, bottom) of the subsampled Co and Cg planes to
+	 * PlaneBuffers[4]. Both only touch their own rows and may run concurrently.
+	 */
+	BOOL (*encode_rows)(NSC_CONTEXT* context, const BYTE* BitmapData, UINT32 rowstride,
+	                    UINT32 top, UINT32 bottom);
+	void (*subsample_rows)(NSC_CONTEXT* context, UINT32 top, UINT32 bottom);
 
 	NSC_CONTEXT_PRIV* priv;
 };
 
+/**
+ * Average of a 2x2 block of signed chroma values, rounded towards negative infinity like
+ * nsc_subsample_rows. The SIMD versions add 0x80 to each value to sum them unsigned, the
+ * bias of 4 * 0x80 divides out exactly and is removed again after the shift.
+ */
+static INLINE BYTE nsc_avg4(const BYTE* src0, const BYTE* src1)
+{
+	const INT16 sum = (INT16)(INT8)src0[0] + (INT8)src0[1] + (INT8)src1[0] + (INT8)src1[1];
+	return (BYTE)(sum >> 2);
+}
+
 #endif /* FREERDP_LIB_CODEC_NSC_TYPES_H */
@@ -24,12 +24,20 @@
 #include <winpr/crt.h>
 #include <winpr/assert.h>
 #include <winpr/print.h>
+#include <winpr/pool.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/primitives.h>
 #include <freerdp/log.h>
 #include <freerdp/codec/bitmap.h>
 #include <freerdp/codec/planar.h>
 
+#include "jobs.h"
+
+#if defined(WITH_SSE2)
+#include "planar_sse2.h"
+#endif
+
 #define TAG FREERDP_TAG("codec")
 
 #define PLANAR_ALIGN(val, align) \
@@ -1010,54 +1018,101 @@ BOOL planar_decompress(BITMAP_PLANAR_CONTEXT* planar, const BYTE* pSrcData, UINT
 	return TRUE;
 }
 
+static BOOL g_PlanarSSE2 = FALSE;
+static DWORD g_PlanarThreads = 1;
+
+static INIT_ONCE planar_encoder_init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK planar_encoder_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	SYSTEM_INFO sysInfos;
+
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+
+#if defined(WITH_SSE2)
+	g_PlanarSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+	GetNativeSystemInfo(&sysInfos);
+	g_PlanarThreads = MAX(1, sysInfos.dwNumberOfProcessors);
+	return TRUE;
+}
+
+/**
+ * Byte offsets of the alpha, red, green and blue channel in a 32bpp pixel,
+ * 0xFF for formats without alpha.
+ */
+static INLINE BOOL planar_get_byte_offsets(UINT32 format, BYTE offsets[4])
+{
+	BYTE r, g, b, a;
+	const BYTE probe[4] = { 0, 1, 2, 3 };
+
+	if (FreeRDPGetBitsPerPixel(format) != 32)
+		return FALSE;
+
+	FreeRDPSplitColor(FreeRDPReadColor(probe, format), format, &r, &g, &b, &a, NULL);
+
+	if ((r > 3) || (g > 3) || (b > 3) || ((a > 3) && (a != 0xFF)))
+		return FALSE;
+
+	offsets[0] = a;
+	offsets[1] = r;
+	offsets[2] = g;
+	offsets[3] = b;
+	return TRUE;
+}
+
 static INLINE BOOL freerdp_split_color_planes(BITMAP_PLANAR_CONTEXT* planar, const BYTE* data,
                                               UINT32 format, UINT32 width, UINT32 height,
-                                              UINT32 scanline, BYTE* planes[4])
+                                              UINT32 scanline, UINT32 top, UINT32 bottom,
+                                              BYTE* planes[4])
 {
+	UINT32 x, y;
+	BYTE offsets[4] = { 0 };
+	const size_t bpp = FreeRDPGetBytesPerPixel(format);
+	const BOOL direct = planar_get_byte_offsets(format, offsets);
+
 	WINPR_ASSERT(planar);
 
 	if ((width > INT32_MAX) || (height > INT32_MAX) || (scanline > INT32_MAX))
 		return FALSE;
 
-	if (scanline == 0)
-		scanline = width * FreeRDPGetBytesPerPixel(format);
-
-	if (planar->topdown)
+	for (y = top; y < bottom; y++)
 	{
-		UINT32 i, j, k = 0;
-		for (i = 0; i < height; i++)
+		const size_t k = (size_t)y * width;
+		const BYTE* pixel = &data[(size_t)scanline * (planar->topdown ? y : height - 1 - y)];
+		BYTE* dst[4] = { &planes[0][k], &planes[1][k], &planes[2][k], &planes[3][k] };
+
+		x = 0;
+
+		if (direct)
 		{
-			const BYTE* pixel = &data[scanline * (UINT32)i];
+#if defined(WITH_SSE2)
+			if (g_PlanarSSE2)
+				x = planar_split_line_32bpp_sse2(pixel, width, offsets, dst);
+#endif
 
-			for (j = 0; j < width; j++)
+			for (; x < width; x++)
 			{
-				const UINT32 color = FreeRDPReadColor(pixel, format);
-				pixel += FreeRDPGetBytesPerPixel(format);
-				FreeRDPSplitColor(color, format, &planes[1][k], &planes[2][k], &planes[3][k],
-				                  &planes[0][k], NULL);
-				k++;
+				const BYTE* p = &pixel[4ull * x];
+				dst[0][x] = (offsets[0] < 4) ? p[offsets[0]] : 0xFF;
+				dst[1][x] = p[offsets[1]];
+				dst[2][x] = p[offsets[2]];
+				dst[3][x] = p[offsets[3]];
 			}
 		}
-	}
-	else
-	{
-		INT64 i;
-		UINT32 j, k = 0;
-
-		for (i = (INT64)height - 1; i >= 0; i--)
+		else
 		{
-			const BYTE* pixel = &data[scanline * (UINT32)i];
-
-			for (j = 0; j < width; j++)
+			for (; x < width; x++)
 			{
-				const UINT32 color = FreeRDPReadColor(pixel, format);
-				pixel += FreeRDPGetBytesPerPixel(format);
-				FreeRDPSplitColor(color, format, &planes[1][k], &planes[2][k], &planes[3][k],
-				                  &planes[0][k], NULL);
-				k++;
+				const UINT32 color = FreeRDPReadColor(&pixel[bpp * x], format);
+				FreeRDPSplitColor(color, format, &dst[1][x], &dst[2][x], &dst[3][x], &dst[0][x],
+				                  NULL);
 			}
 		}
 	}
+
 	return TRUE;
 }
 
@@ -1175,6 +1230,29 @@ static INLINE UINT32 freerdp_bitmap_planar_write_rle_bytes(const BYTE* pInBuffer
 	return (pOutput - pOutBuffer);
 }
 
+/* Number of bytes equal to symbol at the start of pInput, compared a word at a time */
+static INLINE UINT32 planar_run_length(const BYTE* pInput, UINT32 inBufferSize, BYTE symbol)
+{
+	UINT32 nRunLength = 0;
+	const UINT64 pattern = 0x0101010101010101ull * symbol;
+
+	while (inBufferSize - nRunLength >= sizeof(UINT64))
+	{
+		UINT64 value;
+		memcpy(&value, &pInput[nRunLength], sizeof(value));
+
+		if (value != pattern)
+			break;
+
+		nRunLength += sizeof(UINT64);
+	}
+
+	while ((nRunLength < inBufferSize) && (pInput[nRunLength] == symbol))
+		nRunLength++;
+
+	return nRunLength;
+}
+
 static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffer,
                                                             UINT32 inBufferSize, BYTE* pOutBuffer,
                                                             UINT32 outBufferSize)
@@ -1185,7 +1263,6 @@ static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffe
 	const BYTE* pBytes;
 	UINT32 cRawBytes;
 	UINT32 nRunLength;
-	UINT32 bSymbolMatch;
 	UINT32 nBytesWritten;
 	UINT32 nTotalBytesWritten;
 	symbol = 0;
@@ -1203,12 +1280,22 @@ static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffe
 		if (!inBufferSize)
 			break;
 
-		bSymbolMatch = (symbol == *pInput) ? TRUE : FALSE;
+		/* Repeats of the last symbol only extend the run, take them in one go */
+		nBytesWritten = planar_run_length(pInput, inBufferSize, symbol);
+
+		if (nBytesWritten > 0)
+		{
+			nRunLength += nBytesWritten;
+			pInput += nBytesWritten;
+			inBufferSize -= nBytesWritten;
+			continue;
+		}
+
 		symbol = *pInput;
 		pInput++;
 		inBufferSize--;
 
-		if (nRunLength && !bSymbolMatch)
+		if (nRunLength)
 		{
 			if (nRunLength < 3)
 			{
@@ -1232,8 +1319,7 @@ static INLINE UINT32 freerdp_bitmap_planar_encode_rle_bytes(const BYTE* pInBuffe
 			}
 		}
 
-		nRunLength += bSymbolMatch;
-		cRawBytes += (!bSymbolMatch) ? TRUE : FALSE;
+		cRawBytes++;
 	} while (outBufferSize);
 
 	if (cRawBytes || nRunLength)
@@ -1295,64 +1381,28 @@ BOOL freerdp_bitmap_planar_compress_plane_rle(const BYTE* inPlane, UINT32 width,
 	return TRUE;
 }
 
-static INLINE BOOL freerdp_bitmap_planar_compress_planes_rle(BYTE* inPlanes[4], UINT32 width,
-                                                             UINT32 height, BYTE* outPlanes,
-                                                             UINT32* dstSizes, BOOL skipAlpha)
+static INLINE void planar_delta_encode_line(const BYTE* line, const BYTE* prevLine, BYTE* out,
+                                            UINT32 width)
 {
-	UINT32 outPlanesSize = width * height * 4;
-
-	/* AlphaPlane */
-	if (skipAlpha)
-	{
-		dstSizes[0] = 0;
-	}
-	else
-	{
-		dstSizes[0] = outPlanesSize;
+	UINT32 x = 0;
 
-		if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[0], width, height, outPlanes,
-		                                              &dstSizes[0]))
-			return FALSE;
+#if defined(WITH_SSE2)
+	if (g_PlanarSSE2)
+		x = planar_delta_encode_line_sse2(line, prevLine, out, width);
+#endif
 
-		outPlanes += dstSizes[0];
-		outPlanesSize -= dstSizes[0];
+	/* two's complement delta to sign magnitude: 2 * |d| for d >= 0, 2 * |d| - 1 otherwise */
+	for (; x < width; x++)
+	{
+		const BYTE delta = (BYTE)(line[x] - prevLine[x]);
+		out[x] = (BYTE)((delta << 1) ^ ((delta & 0x80) ? 0xFF : 0x00));
 	}
-
-	/* LumaOrRedPlane */
-	dstSizes[1] = outPlanesSize;
-
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[1], width, height, outPlanes,
-	                                              &dstSizes[1]))
-		return FALSE;
-
-	outPlanes += dstSizes[1];
-	outPlanesSize -= dstSizes[1];
-	/* OrangeChromaOrGreenPlane */
-	dstSizes[2] = outPlanesSize;
-
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[2], width, height, outPlanes,
-	                                              &dstSizes[2]))
-		return FALSE;
-
-	outPlanes += dstSizes[2];
-	outPlanesSize -= dstSizes[2];
-	/* GreenChromeOrBluePlane */
-	dstSizes[3] = outPlanesSize;
-
-	if (!freerdp_bitmap_planar_compress_plane_rle(inPlanes[3], width, height, outPlanes,
-	                                              &dstSizes[3]))
-		return FALSE;
-
-	return TRUE;
 }
 
 BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane, UINT32 width, UINT32 height,
                                                BYTE* outPlane)
 {
-	char s2c;
-	UINT32 y, x;
-	BYTE* outPtr;
-	const BYTE *srcPtr, *prevLinePtr;
+	UINT32 y;
 
 	if (!outPlane)
 	{
@@ -1363,44 +1413,205 @@ BYTE* freerdp_bitmap_planar_delta_encode_plane(const BYTE* inPlane, UINT32 width
 			return NULL;
 	}
 
+	InitOnceExecuteOnce(&planar_encoder_init_once, planar_encoder_init, NULL, NULL);
+
 	// first line is copied as is
 	CopyMemory(outPlane, inPlane, width);
-	outPtr = outPlane + width;
-	srcPtr = inPlane + width;
-	prevLinePtr = inPlane;
 
 	for (y = 1; y < height; y++)
 	{
-		for (x = 0; x < width; x++, outPtr++, srcPtr++, prevLinePtr++)
-		{
-			INT32 delta = *srcPtr - *prevLinePtr;
-			s2c = (delta >= 0) ? (char)delta : (char)(~((BYTE)(-delta)) + 1);
-			s2c = (s2c >= 0) ? (char)((UINT32)s2c << 1)
-			                 : (char)(((UINT32)(~((BYTE)s2c) + 1) << 1) - 1);
-			*outPtr = (BYTE)s2c;
-		}
+		const size_t k = 1ull * y * width;
+		planar_delta_encode_line(&inPlane[k], &inPlane[k - width], &outPlane[k], width);
 	}
 
 	return outPlane;
 }
 
-static INLINE BOOL freerdp_bitmap_planar_delta_encode_planes(BYTE* inPlanes[4], UINT32 width,
-                                                             UINT32 height, BYTE* outPlanes[4])
+/* Worst case RLE output of a single line: a control byte per 15 raw bytes */
+#define PLANAR_RLE_LINE_MAX(_width) ((_width) + (_width) / 15 + 2)
+
+#define PLANAR_BAND_HEIGHT 64
+#define PLANAR_THREADED_MIN_SIZE (128 * 128)
+
+typedef struct
+{
+	BITMAP_PLANAR_CONTEXT* planar;
+	const BYTE* data;
+	UINT32 format;
+	UINT32 width;
+	UINT32 height;
+	UINT32 scanline;
+	UINT32 plane;
+	UINT32 top;
+	UINT32 bottom;
+	UINT32 rleSize;
+	BOOL success;
+} PLANAR_ENCODE_WORK_PARAM;
+
+static INLINE size_t planar_rle_slot_offset(const PLANAR_ENCODE_WORK_PARAM* param)
+{
+	const size_t lineMax = PLANAR_RLE_LINE_MAX(param->width);
+	return lineMax * (1ull * param->plane * param->height + param->top);
+}
+
+static void CALLBACK planar_split_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                                PTP_WORK work)
+{
+	PLANAR_ENCODE_WORK_PARAM* param = (PLANAR_ENCODE_WORK_PARAM*)context;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	param->success = freerdp_split_color_planes(param->planar, param->data, param->format,
+	                                            param->width, param->height, param->scanline,
+	                                            param->top, param->bottom, param->planar->planes);
+}
+
+/* Delta encode the band of one plane and run length encode it into its own slot */
+static void CALLBACK planar_encode_work_callback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                                 PTP_WORK work)
 {
-	UINT32 i;
+	UINT32 y;
+	PLANAR_ENCODE_WORK_PARAM* param = (PLANAR_ENCODE_WORK_PARAM*)context;
+	BITMAP_PLANAR_CONTEXT* planar = param->planar;
+	const UINT32 width = param->width;
+	const BYTE* plane = planar->planes[param->plane];
+	BYTE* delta = planar->deltaPlanes[param->plane];
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
 
-	for (i = 0; i < 4; i++)
+	for (y = param->top; y < param->bottom; y++)
 	{
-		outPlanes[i] =
-		    freerdp_bitmap_planar_delta_encode_plane(inPlanes[i], width, height, outPlanes[i]);
+		const size_t k = 1ull * y * width;
+
+		if (y == 0)
+			CopyMemory(delta, plane, width);
+		else
+			planar_delta_encode_line(&plane[k], &plane[k - width], &delta[k], width);
+	}
+
+	param->rleSize = PLANAR_RLE_LINE_MAX(width) * (param->bottom - param->top);
+	param->success = freerdp_bitmap_planar_compress_plane_rle(
+	    &delta[1ull * param->top * width], width, param->bottom - param->top,
+	    &planar->rlePlanesBuffer[planar_rle_slot_offset(param)], &param->rleSize);
+}
+
+static BOOL planar_run_jobs(BITMAP_PLANAR_CONTEXT* planar, PLANAR_ENCODE_WORK_PARAM* params,
+                            size_t count, PTP_WORK_CALLBACK callback, BOOL threaded)
+{
+	size_t i;
+
+	if (!codec_jobs_run(threaded ? planar->jobs : NULL, params, sizeof(PLANAR_ENCODE_WORK_PARAM),
+	                    count, callback))
+		return FALSE;
 
-		if (!outPlanes[i])
+	for (i = 0; i < count; i++)
+	{
+		if (!params[i].success)
 			return FALSE;
 	}
 
 	return TRUE;
 }
 
+/**
+ * Split the bitmap into planes and, with RLE enabled, delta and run length encode them.
+ * Large bitmaps are cut into bands that are processed on the thread pool, first the
+ * split of all bands, then every (plane, band) pair. The RLE output of each pair lands
+ * in a worst case sized slot and is compacted into contiguous planes afterwards.
+ */
+static BOOL planar_encode_planes(BITMAP_PLANAR_CONTEXT* planar, const BYTE* data, UINT32 format,
+                                 UINT32 width, UINT32 height, UINT32 scanline, UINT32 dstSizes[4])
+{
+	UINT32 p, b;
+	size_t offset = 0;
+	BOOL success = FALSE;
+	PLANAR_ENCODE_WORK_PARAM local[4] = { 0 };
+	PLANAR_ENCODE_WORK_PARAM* params = local;
+	const UINT32 firstPlane = planar->AllowSkipAlpha ? 1 : 0;
+	BOOL threaded;
+	UINT32 bandHeight;
+	UINT32 bands;
+
+	if ((g_PlanarThreads > 1) && !planar->jobs)
+		planar->jobs = codec_jobs_new(NULL);
+
+	threaded = planar->jobs && (1ull * width * height >= PLANAR_THREADED_MIN_SIZE);
+	bandHeight = threaded ? PLANAR_BAND_HEIGHT : MAX(1, height);
+	bands = (height + bandHeight - 1) / bandHeight;
+
+	if (bands > 1)
+	{
+		params = (PLANAR_ENCODE_WORK_PARAM*)calloc(4ull * bands, sizeof(PLANAR_ENCODE_WORK_PARAM));
+
+		if (!params)
+			return FALSE;
+	}
+
+	for (b = 0; b < bands; b++)
+	{
+		PLANAR_ENCODE_WORK_PARAM* param = &params[b];
+		param->planar = planar;
+		param->data = data;
+		param->format = format;
+		param->width = width;
+		param->height = height;
+		param->scanline = scanline;
+		param->top = b * bandHeight;
+		param->bottom = MIN(height, param->top + bandHeight);
+	}
+
+	if (!planar_run_jobs(planar, params, bands, planar_split_work_callback, threaded))
+		goto fail;
+
+	if (planar->AllowRunLengthEncoding)
+	{
+		const size_t count = 1ull * (4 - firstPlane) * bands;
+
+		for (p = firstPlane; p < 4; p++)
+		{
+			for (b = 0; b < bands; b++)
+			{
+				PLANAR_ENCODE_WORK_PARAM* param = &params[(p - firstPlane) * bands + b];
+				*param = params[b];
+				param->plane = p;
+				param->top = b * bandHeight;
+				param->bottom = MIN(height, param->top + bandHeight);
+				param->success = FALSE;
+			}
+		}
+
+		if (!planar_run_jobs(planar, params, count, planar_encode_work_callback, threaded))
+			goto fail;
+
+		planar->rlePlanes[0] = planar->rlePlanesBuffer;
+		dstSizes[0] = 0;
+
+		for (p = firstPlane; p < 4; p++)
+		{
+			planar->rlePlanes[p] = &planar->rlePlanesBuffer[offset];
+			dstSizes[p] = 0;
+
+			for (b = 0; b < bands; b++)
+			{
+				const PLANAR_ENCODE_WORK_PARAM* param = &params[(p - firstPlane) * bands + b];
+				MoveMemory(&planar->rlePlanesBuffer[offset],
+				           &planar->rlePlanesBuffer[planar_rle_slot_offset(param)],
+				           param->rleSize);
+				offset += param->rleSize;
+				dstSizes[p] += param->rleSize;
+			}
+		}
+	}
+
+	success = TRUE;
+fail:
+	if (params != local)
+		free(params);
+	return success;
+}
+
 BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE* data,
                                      UINT32 format, UINT32 width, UINT32 height, UINT32 scanline,
                                      BYTE* dstData, UINT32* pDstSize)
@@ -1414,44 +1625,38 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 	if (!context || !context->rlePlanesBuffer)
 		return NULL;
 
+	InitOnceExecuteOnce(&planar_encoder_init_once, planar_encoder_init, NULL, NULL);
+
 	if (context->AllowSkipAlpha)
 		FormatHeader |= PLANAR_FORMAT_HEADER_NA;
 
 	planeSize = width * height;
 
+	if ((planeSize > context->maxPlaneSize) ||
+	    (4ull * height * PLANAR_RLE_LINE_MAX(width) > context->rlePlanesCapacity))
+	{
+		WLog_ERR(TAG, "bitmap %" PRIu32 "x%" PRIu32 " exceeds the context size %" PRIu32
+		              "x%" PRIu32,
+		         width, height, context->maxWidth, context->maxHeight);
+		return NULL;
+	}
+
+	if (scanline == 0)
+		scanline = width * FreeRDPGetBytesPerPixel(format);
+
 	if (!context->AllowSkipAlpha)
 		format = planar_invert_format(context, TRUE, format);
 
-	if (!freerdp_split_color_planes(context, data, format, width, height, scanline,
-	                                context->planes))
+	if (!planar_encode_planes(context, data, format, width, height, scanline, dstSizes))
 		return NULL;
 
 	if (context->AllowRunLengthEncoding)
 	{
-		if (!freerdp_bitmap_planar_delta_encode_planes(context->planes, width, height,
-		                                               context->deltaPlanes))
-			return NULL;
+		const size_t rawSize = 1ull * planeSize * (context->AllowSkipAlpha ? 3 : 4) + 1;
 
-		if (!freerdp_bitmap_planar_compress_planes_rle(context->deltaPlanes, width, height,
-		                                               context->rlePlanesBuffer, dstSizes,
-		                                               context->AllowSkipAlpha))
-			return NULL;
-
-		{
-			int offset = 0;
+		/* noise does not compress, the raw planes are smaller then */
+		if (1ull * dstSizes[0] + dstSizes[1] + dstSizes[2] + dstSizes[3] < rawSize)
 			FormatHeader |= PLANAR_FORMAT_HEADER_RLE;
-			context->rlePlanes[0] = &context->rlePlanesBuffer[offset];
-			offset += dstSizes[0];
-			context->rlePlanes[1] = &context->rlePlanesBuffer[offset];
-			offset += dstSizes[1];
-			context->rlePlanes[2] = &context->rlePlanesBuffer[offset];
-			offset += dstSizes[2];
-			context->rlePlanes[3] = &context->rlePlanesBuffer[offset];
-			// WLog_DBG(TAG, "R: [%"PRIu32"/%"PRIu32"] G: [%"PRIu32"/%"PRIu32"] B:
-			// [%"PRIu32"/%"PRIu32"]", 		dstSizes[1], planeSize, dstSizes[2], planeSize,
-			// dstSizes[3],
-			// planeSize);
-		}
 	}
 
 	if (FormatHeader & PLANAR_FORMAT_HEADER_RLE)
@@ -1575,6 +1780,8 @@ BYTE* freerdp_bitmap_compress_planar(BITMAP_PLANAR_CONTEXT* context, const BYTE*
 BOOL freerdp_bitmap_planar_context_reset(BITMAP_PLANAR_CONTEXT* context, UINT32 width,
                                          UINT32 height)
 {
+	size_t rleSize;
+
 	if (!context)
 		return FALSE;
 
@@ -1583,18 +1790,34 @@ BOOL freerdp_bitmap_planar_context_reset(BITMAP_PLANAR_CONTEXT* context, UINT32
 	context->maxHeight = PLANAR_ALIGN(height, 4);
 	context->maxPlaneSize = context->maxWidth * context->maxHeight;
 	context->nTempStep = context->maxWidth * 4;
-	free(context->planesBuffer);
-	free(context->pTempData);
-	free(context->deltaPlanesBuffer);
-	free(context->rlePlanesBuffer);
-	context->planesBuffer = calloc(context->maxPlaneSize, 4);
-	context->pTempData = calloc(context->maxPlaneSize, 6);
-	context->deltaPlanesBuffer = calloc(context->maxPlaneSize, 4);
-	context->rlePlanesBuffer = calloc(context->maxPlaneSize, 4);
+	rleSize = 4ull * context->maxHeight * PLANAR_RLE_LINE_MAX(context->maxWidth);
+
+	/* encoders reset the context for every bitmap, only reallocate when growing */
+	if (!context->planesBuffer || (context->maxPlaneSize > context->planesCapacity))
+	{
+		free(context->planesBuffer);
+		free(context->pTempData);
+		free(context->deltaPlanesBuffer);
+		context->planesBuffer = calloc(context->maxPlaneSize, 4);
+		context->pTempData = calloc(context->maxPlaneSize, 6);
+		context->deltaPlanesBuffer = calloc(context->maxPlaneSize, 4);
+		context->planesCapacity = context->maxPlaneSize;
+	}
+
+	if (!context->rlePlanesBuffer || (rleSize > context->rlePlanesCapacity))
+	{
+		free(context->rlePlanesBuffer);
+		context->rlePlanesBuffer = calloc(rleSize, 1);
+		context->rlePlanesCapacity = rleSize;
+	}
 
 	if (!context->planesBuffer || !context->pTempData || !context->deltaPlanesBuffer ||
 	    !context->rlePlanesBuffer)
+	{
+		context->planesCapacity = 0;
+		context->rlePlanesCapacity = 0;
 		return FALSE;
+	}
 
 	context->planes[0] = &context->planesBuffer[context->maxPlaneSize * 0];
 	context->planes[1] = &context->planesBuffer[context->maxPlaneSize * 1];
@@ -1648,6 +1871,7 @@ void freerdp_bitmap_planar_context_free(BITMAP_PLANAR_CONTEXT* context)
 	free(context->planesBuffer);
 	free(context->deltaPlanesBuffer);
 	free(context->rlePlanesBuffer);
+	codec_jobs_free(context->jobs);
 	free(context);
 }
 
@@ -0,0 +1,79 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <emmintrin.h>
+
+#include "planar_sse2.h"
+
+/* Byte n of each of the 16 pixels in a..d */
+static INLINE __m128i planar_extract_byte(__m128i a, __m128i b, __m128i c, __m128i d, int n)
+{
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i count = _mm_cvtsi32_si128(n * 8);
+	const __m128i ab = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(a, count), mask),
+	                                   _mm_and_si128(_mm_srl_epi32(b, count), mask));
+	const __m128i cd = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(c, count), mask),
+	                                   _mm_and_si128(_mm_srl_epi32(d, count), mask));
+	return _mm_packus_epi16(ab, cd);
+}
+
+UINT32 planar_split_line_32bpp_sse2(const BYTE* src, UINT32 width, const BYTE offsets[4],
+                                    BYTE* planes[4])
+{
+	UINT32 x;
+	size_t i;
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i*)&src[x * 4 + 0]);
+		const __m128i b = _mm_loadu_si128((const __m128i*)&src[x * 4 + 16]);
+		const __m128i c = _mm_loadu_si128((const __m128i*)&src[x * 4 + 32]);
+		const __m128i d = _mm_loadu_si128((const __m128i*)&src[x * 4 + 48]);
+
+		for (i = 0; i < 4; i++)
+		{
+			/* the pixels are loaded little endian, byte n is bits 8n..8n+7 */
+			const __m128i v = (offsets[i] < 4)
+			                      ? planar_extract_byte(a, b, c, d, offsets[i])
+			                      : _mm_set1_epi8((char)0xFF);
+			_mm_storeu_si128((__m128i*)&planes[i][x], v);
+		}
+	}
+
+	return x;
+}
+
+UINT32 planar_delta_encode_line_sse2(const BYTE* line, const BYTE* prevLine, BYTE* out,
+                                     UINT32 width)
+{
+	UINT32 x;
+	const __m128i zero = _mm_setzero_si128();
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const __m128i cur = _mm_loadu_si128((const __m128i*)&line[x]);
+		const __m128i prev = _mm_loadu_si128((const __m128i*)&prevLine[x]);
+		const __m128i delta = _mm_sub_epi8(cur, prev);
+		/* (delta << 1) ^ (delta >> 7): sign magnitude with the sign in bit 0 */
+		const __m128i sign = _mm_cmpgt_epi8(zero, delta);
+		_mm_storeu_si128((__m128i*)&out[x], _mm_xor_si128(_mm_add_epi8(delta, delta), sign));
+	}
+
+	return x;
+}
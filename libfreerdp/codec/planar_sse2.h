@@ -0,0 +1,33 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RDP6 Planar Codec - SSE2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_PLANAR_SSE2_H
+#define FREERDP_LIB_CODEC_PLANAR_SSE2_H
+
+#include <winpr/wtypes.h>
+#include <freerdp/api.h>
+
+/* Splits one line of 32bpp pixels, offsets[i] is the byte of plane i in a
+ * pixel or 0xFF for a constant 0xFF plane. Returns the pixels processed. */
+FREERDP_LOCAL UINT32 planar_split_line_32bpp_sse2(const BYTE* src, UINT32 width,
+                                                  const BYTE offsets[4], BYTE* planes[4]);
+
+/* Delta encodes one line against the previous one. Returns the bytes processed. */
+FREERDP_LOCAL UINT32 planar_delta_encode_line_sse2(const BYTE* line, const BYTE* prevLine,
+                                                   BYTE* out, UINT32 width);
+
+#endif /* FREERDP_LIB_CODEC_PLANAR_SSE2_H */
@@ -1813,7 +1813,6 @@ static INLINE int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive, wS
 				break;
 			}
 
-			SubmitThreadpoolWork(work_objects[index]);
 			close_cnt = index + 1;
 		}
 		else
@@ -1835,6 +1834,9 @@ static INLINE int progressive_process_tiles(PROGRESSIVE_CONTEXT* progressive, wS
 
 	if (progressive->rfx_context->priv->UseThreads)
 	{
+		/* Neighbouring tiles are decoded by the same worker */
+		winpr_SubmitThreadpoolWorkBatch(work_objects, close_cnt);
+
 		for (index = 0; index < close_cnt; index++)
 		{
 			WaitForThreadpoolWorkCallbacks(work_objects[index], FALSE);
@@ -1881,7 +1883,7 @@ static INLINE BOOL progressive_write_wb_context(PROGRESSIVE_CONTEXT* progressive
 	Stream_Write_UINT32(s, blockLen);                /* blockLen (4 bytes) */
 	Stream_Write_UINT8(s, 0);                        /* ctxId (1 byte) */
 	Stream_Write_UINT16(s, 64);                      /* tileSize (2 bytes) */
-	Stream_Write_UINT8(s, 0);                        /* flags (1 byte) */
+	Stream_Write_UINT8(s, progressive->upgrades ? RFX_SUBBAND_DIFFING : 0); /* flags (1 byte) */
 	return TRUE;
 }
 
@@ -1952,19 +1954,18 @@ static INLINE BOOL progressive_write_region(PROGRESSIVE_CONTEXT* progressive, wS
 }
 
 static INLINE BOOL progressive_write_frame_begin(PROGRESSIVE_CONTEXT* progressive, wStream* s,
-                                                 const RFX_MESSAGE* msg)
+                                                 UINT32 frameIdx)
 {
 	const UINT32 blockLen = 12;
 	WINPR_ASSERT(progressive);
 	WINPR_ASSERT(s);
-	WINPR_ASSERT(msg);
 
 	if (!Stream_EnsureRemainingCapacity(s, blockLen))
 		return FALSE;
 
 	Stream_Write_UINT16(s, PROGRESSIVE_WBT_FRAME_BEGIN); /* blockType (2 bytes) */
 	Stream_Write_UINT32(s, blockLen);                    /* blockLen (4 bytes) */
-	Stream_Write_UINT32(s, msg->frameIdx);               /* frameIndex (4 bytes) */
+	Stream_Write_UINT32(s, frameIdx);                    /* frameIndex (4 bytes) */
 	Stream_Write_UINT16(s, 1);                           /* regionCount (2 bytes) */
 
 	return TRUE;
@@ -2604,7 +2605,7 @@ static BOOL progressive_rfx_write_message_progressive_simple(PROGRESSIVE_CONTEXT
 	if (!progressive_write_wb_context(progressive, s))
 		return FALSE;
 
-	if (!progressive_write_frame_begin(progressive, s, msg))
+	if (!progressive_write_frame_begin(progressive, s, msg->frameIdx))
 		return FALSE;
 
 	if (!progressive_write_region(progressive, s, msg))
@@ -2623,6 +2624,911 @@ static BOOL progressive_rfx_write_message_progressive_simple(PROGRESSIVE_CONTEXT
 	return TRUE;
 }
 
+/**
+ * Multi pass encoder
+ *
+ * Tiles are sent with RFX_PROGRESSIVE_TILE_FIRST at the first quality of
+ * progressive_quality_ladder and refined with RFX_PROGRESSIVE_TILE_UPGRADE
+ * until the full quality is reached. The encoder keeps the full quality
+ * coefficients of every tile pending an upgrade and mirrors the decoder state
+ * (sign of the coefficients sent so far) to generate the SRL and RAW streams.
+ *
+ * Upgrades use the reduce-extrapolate DWT, as required by the decoder.
+ */
+
+#define PROGRESSIVE_QUALITY_FINAL 2
+#define PROGRESSIVE_FIRST_COMPONENT_MAX 8192
+#define PROGRESSIVE_UPGRADE_COMPONENT_MAX 16384
+
+static const RFX_COMPONENT_CODEC_QUANT progressive_quant_default = { 6, 6, 6, 6, 7,
+	                                                                 7, 8, 8, 8, 9 };
+
+/* LL3, HL3, LH3, HH3, HL2, LH2, HH2, HL1, LH1, HH1 */
+static const RFX_PROGRESSIVE_CODEC_QUANT progressive_quality_ladder[] = {
+	{ 25,
+	  { 2, 2, 2, 2, 3, 3, 3, 4, 4, 4 },
+	  { 3, 3, 3, 3, 4, 4, 4, 4, 4, 4 },
+	  { 3, 3, 3, 3, 4, 4, 4, 4, 4, 4 } },
+	{ 60,
+	  { 1, 1, 1, 1, 1, 1, 1, 2, 2, 2 },
+	  { 1, 1, 1, 1, 2, 2, 2, 2, 2, 2 },
+	  { 1, 1, 1, 1, 2, 2, 2, 2, 2, 2 } },
+	{ 100,
+	  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 },
+	  { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 } }
+};
+
+/* Subbands of the reduce-extrapolate layout, in coding order. The last one is LL3. */
+static const struct
+{
+	size_t offset;
+	size_t length;
+} progressive_rfx_bands[10] = { { 0, 1023 },    { 1023, 1023 }, { 2046, 961 }, { 3007, 272 },
+	                            { 3279, 272 },  { 3551, 256 },  { 3807, 72 },  { 3879, 72 },
+	                            { 3951, 64 },   { 4015, 81 } };
+
+static INLINE void progressive_rfx_quant_bands(const RFX_COMPONENT_CODEC_QUANT* q, BYTE* bands)
+{
+	bands[0] = q->HL1;
+	bands[1] = q->LH1;
+	bands[2] = q->HH1;
+	bands[3] = q->HL2;
+	bands[4] = q->LH2;
+	bands[5] = q->HH2;
+	bands[6] = q->HL3;
+	bands[7] = q->LH3;
+	bands[8] = q->HH3;
+	bands[9] = q->LL3;
+}
+
+static INLINE void progressive_rfx_quant_write(wStream* s, const RFX_COMPONENT_CODEC_QUANT* q)
+{
+	Stream_Write_UINT8(s, (UINT8)(q->LL3 + (q->HL3 << 4))); /* LL3 (4-bit), HL3 (4-bit) */
+	Stream_Write_UINT8(s, (UINT8)(q->LH3 + (q->HH3 << 4))); /* LH3 (4-bit), HH3 (4-bit) */
+	Stream_Write_UINT8(s, (UINT8)(q->HL2 + (q->LH2 << 4))); /* HL2 (4-bit), LH2 (4-bit) */
+	Stream_Write_UINT8(s, (UINT8)(q->HH2 + (q->HL1 << 4))); /* HH2 (4-bit), HL1 (4-bit) */
+	Stream_Write_UINT8(s, (UINT8)(q->LH1 + (q->HH1 << 4))); /* LH1 (4-bit), HH1 (4-bit) */
+}
+
+static INLINE INT16 progressive_rfx_clamp(INT32 value)
+{
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	return (INT16)value;
+}
+
+/* Forward transform of progressive_rfx_idwt_x/progressive_rfx_idwt_y */
+static INLINE void progressive_rfx_dwt_encode(const INT16* pSrc, size_t nSrcStep, INT16* pLowBand,
+                                              size_t nLowStep, INT16* pHighBand, size_t nHighStep,
+                                              size_t nLowCount, size_t nHighCount)
+{
+	size_t j;
+	INT32 H0, H1;
+
+	for (j = 0; j < nHighCount; j++)
+	{
+		const INT32 X0 = pSrc[(2 * j) * nSrcStep];
+		const INT32 X1 = pSrc[(2 * j + 1) * nSrcStep];
+		const INT32 X2 = pSrc[(2 * j + 2) * nSrcStep];
+		pHighBand[j * nHighStep] = progressive_rfx_clamp((X1 - ((X0 + X2) / 2)) / 2);
+	}
+
+	H0 = pHighBand[0];
+	pLowBand[0] = progressive_rfx_clamp(pSrc[0] + H0);
+
+	for (j = 1; j < nHighCount; j++)
+	{
+		H1 = pHighBand[j * nHighStep];
+		pLowBand[j * nLowStep] = progressive_rfx_clamp(pSrc[(2 * j) * nSrcStep] + ((H0 + H1) / 2));
+		H0 = H1;
+	}
+
+	if (nLowCount > (nHighCount + 1))
+	{
+		/* even count: the last sample is extrapolated */
+		const INT32 X0 = pSrc[(2 * nHighCount) * nSrcStep];
+		const INT32 X1 = pSrc[(2 * nHighCount + 1) * nSrcStep];
+		pLowBand[nHighCount * nLowStep] = progressive_rfx_clamp(X0 + (H0 / 2));
+		pLowBand[(nHighCount + 1) * nLowStep] = progressive_rfx_clamp((2 * X1) - X0);
+	}
+	else
+	{
+		const INT32 X0 = pSrc[(2 * nHighCount) * nSrcStep];
+		pLowBand[nHighCount * nLowStep] = progressive_rfx_clamp(X0 + H0);
+	}
+}
+
+static INLINE void progressive_rfx_dwt_2d_encode_block(INT16* buffer, INT16* temp, size_t level)
+{
+	size_t x, y;
+	INT16 *HL, *LH;
+	INT16 *HH, *LL;
+	INT16 *L, *H;
+
+	const size_t nBandL = progressive_rfx_get_band_l_count(level);
+	const size_t nBandH = progressive_rfx_get_band_h_count(level);
+	const size_t nStep = nBandL + nBandH;
+
+	HL = &buffer[0];
+	LH = &HL[nBandL * nBandH];
+	HH = &LH[nBandH * nBandL];
+	LL = &HH[nBandH * nBandH];
+	L = &temp[0];
+	H = &temp[nBandL * nStep];
+
+	/* vertical (src -> L + H) */
+	for (x = 0; x < nStep; x++)
+		progressive_rfx_dwt_encode(&buffer[x], nStep, &L[x], nStep, &H[x], nStep, nBandL, nBandH);
+
+	/* horizontal (L -> LL + HL) */
+	for (y = 0; y < nBandL; y++)
+		progressive_rfx_dwt_encode(&L[y * nStep], 1, &LL[y * nBandL], 1, &HL[y * nBandH], 1,
+		                           nBandL, nBandH);
+
+	/* horizontal (H -> LH + HH) */
+	for (y = 0; y < nBandH; y++)
+		progressive_rfx_dwt_encode(&H[y * nStep], 1, &LH[y * nBandL], 1, &HH[y * nBandH], 1,
+		                           nBandL, nBandH);
+}
+
+static INLINE void progressive_rfx_encode_coefficients(INT16* buffer, INT16* temp,
+                                                       const RFX_COMPONENT_CODEC_QUANT* quant)
+{
+	size_t band, index;
+	BYTE shift[10];
+
+	progressive_rfx_dwt_2d_encode_block(&buffer[0], temp, 1);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3007], temp, 2);
+	progressive_rfx_dwt_2d_encode_block(&buffer[3807], temp, 3);
+
+	/* The coefficients are scaled by << 5 at RGB->YCbCr phase: -6 + 5 = -1 */
+	progressive_rfx_quant_bands(quant, shift);
+	for (band = 0; band < ARRAYSIZE(progressive_rfx_bands); band++)
+	{
+		const UINT32 factor = shift[band] - 1;
+		const INT32 half = 1 << (factor - 1);
+		INT16* pBand = &buffer[progressive_rfx_bands[band].offset];
+
+		for (index = 0; index < progressive_rfx_bands[band].length; index++)
+			pBand[index] = (INT16)((pBand[index] + half) >> factor);
+	}
+}
+
+/* value of a coefficient with the lowest bitPos bits removed, as sent for the band */
+static INLINE INT16 progressive_rfx_coefficient_value(INT16 coeff, UINT32 bitPos, BOOL nonLL)
+{
+	if (!nonLL || (coeff >= 0))
+		return (INT16)(coeff >> bitPos);
+
+	return (INT16)(-((-coeff) >> bitPos));
+}
+
+static INLINE BOOL progressive_encode_tile_coefficients(PROGRESSIVE_CONTEXT* progressive,
+                                                        const BYTE* pSrcData, UINT32 SrcFormat,
+                                                        UINT32 ScanLine, UINT32 x, UINT32 y,
+                                                        UINT32 width, UINT32 height,
+                                                        INT16* coeffs)
+{
+	BOOL rc = FALSE;
+	size_t i;
+	UINT32 nX, nY;
+	BYTE* pixels = NULL;
+	BYTE* pBuffer = NULL;
+	INT16* temp = NULL;
+	INT16* pSrcDst[3];
+	static const prim_size_t roi_64x64 = { 64, 64 };
+	const primitives_t* prims = primitives_get();
+
+	WINPR_ASSERT((width > 0) && (width <= 64));
+	WINPR_ASSERT((height > 0) && (height <= 64));
+
+	pixels = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	pBuffer = (BYTE*)BufferPool_Take(progressive->bufferPool, -1);
+	temp = (INT16*)BufferPool_Take(progressive->bufferPool, -1); /* DWT buffer */
+	if (!pixels || !pBuffer || !temp)
+		goto fail;
+
+	if (!freerdp_image_copy(pixels, PIXEL_FORMAT_BGRX32, 64 * 4, 0, 0, width, height, pSrcData,
+	                        SrcFormat, ScanLine, x, y, NULL, FREERDP_FLIP_NONE))
+		goto fail;
+
+	pSrcDst[0] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 0) + 16])); /* Y/R buffer */
+	pSrcDst[1] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 1) + 16])); /* Cb/G buffer */
+	pSrcDst[2] = (INT16*)((BYTE*)(&pBuffer[((8192 + 32) * 2) + 16])); /* Cr/B buffer */
+
+	/* Partial tiles are padded by repeating the last row and column */
+	for (nY = 0; nY < 64; nY++)
+	{
+		const BYTE* src = &pixels[MIN(nY, height - 1) * 64 * 4];
+
+		for (nX = 0; nX < 64; nX++)
+		{
+			const BYTE* pixel = &src[MIN(nX, width - 1) * 4];
+			pSrcDst[0][nY * 64 + nX] = pixel[2];
+			pSrcDst[1][nY * 64 + nX] = pixel[1];
+			pSrcDst[2][nY * 64 + nX] = pixel[0];
+		}
+	}
+
+	if (prims->RGBToYCbCr_16s16s_P3P3((const INT16* const*)pSrcDst, 64 * sizeof(INT16), pSrcDst,
+	                                  64 * sizeof(INT16), &roi_64x64) != PRIMITIVES_SUCCESS)
+		goto fail;
+
+	for (i = 0; i < 3; i++)
+	{
+		progressive_rfx_encode_coefficients(pSrcDst[i], temp, &progressive_quant_default);
+		CopyMemory(&coeffs[i * 4096], pSrcDst[i], 4096 * sizeof(INT16));
+	}
+
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, pixels);
+	BufferPool_Return(progressive->bufferPool, pBuffer);
+	BufferPool_Return(progressive->bufferPool, temp);
+	return rc;
+}
+
+static INLINE int progressive_rfx_encode_component_first(PROGRESSIVE_CONTEXT* progressive,
+                                                         const RFX_COMPONENT_CODEC_QUANT* progQuant,
+                                                         const INT16* coeffs, INT16* buffer,
+                                                         BYTE* pDstData, UINT32 DstSize)
+{
+	size_t band, index;
+	BYTE bitPos[10];
+
+	progressive_rfx_quant_bands(progQuant, bitPos);
+	for (band = 0; band < ARRAYSIZE(progressive_rfx_bands); band++)
+	{
+		const BOOL nonLL = (band + 1) < ARRAYSIZE(progressive_rfx_bands);
+		const size_t offset = progressive_rfx_bands[band].offset;
+
+		for (index = 0; index < progressive_rfx_bands[band].length; index++)
+			buffer[offset + index] =
+			    progressive_rfx_coefficient_value(coeffs[offset + index], bitPos[band], nonLL);
+	}
+
+	rfx_differential_encode(&buffer[4015], 81); /* LL3 */
+
+	/* The RLGR encoder expects the destination to be initialized to zero */
+	ZeroMemory(pDstData, DstSize);
+	return progressive->rfx_context->rlgr_encode(RLGR1, buffer, 4096, pDstData, DstSize);
+}
+
+static INLINE BOOL progressive_write_tile_first(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                                UINT16 xIdx, UINT16 yIdx, const INT16* coeffs)
+{
+	size_t i, end;
+	BOOL rc = FALSE;
+	UINT16 len[3] = { 0 };
+	INT16* buffer = NULL;
+	const size_t start = Stream_GetPosition(s);
+	const RFX_PROGRESSIVE_CODEC_QUANT* quantProg = &progressive_quality_ladder[0];
+	const RFX_COMPONENT_CODEC_QUANT* progQuant[3] = { &quantProg->yQuantValues,
+		                                              &quantProg->cbQuantValues,
+		                                              &quantProg->crQuantValues };
+
+	if (!Stream_EnsureRemainingCapacity(s, 23 + 3 * PROGRESSIVE_FIRST_COMPONENT_MAX))
+		return FALSE;
+
+	buffer = (INT16*)BufferPool_Take(progressive->bufferPool, -1);
+	if (!buffer)
+		return FALSE;
+
+	Stream_Seek(s, 23);
+	for (i = 0; i < 3; i++)
+	{
+		const int status = progressive_rfx_encode_component_first(
+		    progressive, progQuant[i], &coeffs[i * 4096], buffer, Stream_Pointer(s),
+		    PROGRESSIVE_FIRST_COMPONENT_MAX);
+
+		if ((status < 0) || (status > PROGRESSIVE_FIRST_COMPONENT_MAX))
+			goto fail;
+
+		len[i] = (UINT16)status;
+		Stream_Seek(s, len[i]);
+	}
+
+	end = Stream_GetPosition(s);
+	Stream_SetPosition(s, start);
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_FIRST); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(end - start));      /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, xIdx);                       /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, yIdx);                       /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, 0);                           /* flags (1 byte) */
+	Stream_Write_UINT8(s, 0);                           /* quality (1 byte) */
+	Stream_Write_UINT16(s, len[0]);                     /* yLen (2 bytes) */
+	Stream_Write_UINT16(s, len[1]);                     /* cbLen (2 bytes) */
+	Stream_Write_UINT16(s, len[2]);                     /* crLen (2 bytes) */
+	Stream_Write_UINT16(s, 0);                          /* tailLen (2 bytes) */
+	Stream_SetPosition(s, end);
+	rc = TRUE;
+fail:
+	BufferPool_Return(progressive->bufferPool, buffer);
+	return rc;
+}
+
+static INLINE void progressive_rfx_bits_write(wBitStream* bs, UINT32 bits, UINT32 nbits)
+{
+	if (nbits == 0)
+		return;
+
+	BitStream_Write_Bits(bs, bits & ((1u << nbits) - 1u), nbits);
+}
+
+/* Inverse of progressive_rfx_srl_read */
+static INLINE void progressive_rfx_srl_write(RFX_PROGRESSIVE_UPGRADE_STATE* state, INT16 value,
+                                             UINT32 numBits)
+{
+	UINT32 mag;
+	const UINT32 k = state->kp / 8;
+	wBitStream* bs = state->srl;
+
+	if (value == 0)
+	{
+		state->nz++;
+
+		if (state->nz == (1 << k))
+		{
+			/* '0' bit, run of (1 << k) zeros */
+			progressive_rfx_bits_write(bs, 0, 1);
+			state->nz = 0;
+			state->kp += 4;
+
+			if (state->kp > 80)
+				state->kp = 80;
+		}
+
+		return;
+	}
+
+	/* '1' bit, run of nz < (1 << k) zeros in k bits, sign bit */
+	progressive_rfx_bits_write(bs, 1, 1);
+	progressive_rfx_bits_write(bs, (UINT32)state->nz, k);
+	progressive_rfx_bits_write(bs, (value < 0) ? 1 : 0, 1);
+	state->nz = 0;
+
+	if (state->kp < 6)
+		state->kp = 0;
+	else
+		state->kp -= 6;
+
+	if (numBits == 1)
+		return;
+
+	/* unary magnitude, the terminating '1' is omitted for the maximum value */
+	mag = (value < 0) ? (UINT32)(-value) : (UINT32)value;
+	progressive_rfx_bits_write(bs, 0, mag - 1);
+
+	if (mag < ((1u << numBits) - 1u))
+		progressive_rfx_bits_write(bs, 1, 1);
+}
+
+static INLINE UINT32 progressive_rfx_bits_finish(wBitStream* bs)
+{
+	BitStream_Flush(bs);
+	return (bs->position + 7) / 8;
+}
+
+static INLINE BOOL progressive_rfx_upgrade_component_write(
+    const RFX_COMPONENT_CODEC_QUANT* oldQuant, const RFX_COMPONENT_CODEC_QUANT* newQuant,
+    const INT16* coeffs, wStream* s, UINT16* srlLen, UINT16* rawLen)
+{
+	size_t band, index;
+	UINT32 length;
+	BYTE oldBitPos[10];
+	BYTE newBitPos[10];
+	wBitStream s_srl = { 0 };
+	wBitStream s_raw = { 0 };
+	RFX_PROGRESSIVE_UPGRADE_STATE state = { 0 };
+
+	progressive_rfx_quant_bands(oldQuant, oldBitPos);
+	progressive_rfx_quant_bands(newQuant, newBitPos);
+
+	/* SRL: coefficients that were still zero in the previous passes */
+	state.kp = 8;
+	state.srl = &s_srl;
+	BitStream_Attach(state.srl, Stream_Pointer(s), PROGRESSIVE_UPGRADE_COMPONENT_MAX);
+
+	for (band = 0; band + 1 < ARRAYSIZE(progressive_rfx_bands); band++)
+	{
+		const INT16* pBand = &coeffs[progressive_rfx_bands[band].offset];
+		const UINT32 numBits = oldBitPos[band] - newBitPos[band];
+
+		if (!numBits)
+			continue;
+
+		for (index = 0; index < progressive_rfx_bands[band].length; index++)
+		{
+			if (progressive_rfx_coefficient_value(pBand[index], oldBitPos[band], TRUE) != 0)
+				continue;
+
+			progressive_rfx_srl_write(
+			    &state, progressive_rfx_coefficient_value(pBand[index], newBitPos[band], TRUE),
+			    numBits);
+		}
+	}
+
+	if (state.nz > 0)
+		progressive_rfx_bits_write(state.srl, 0, 1);
+
+	length = progressive_rfx_bits_finish(state.srl);
+	*srlLen = (UINT16)length;
+	Stream_Seek(s, length);
+
+	/* RAW: refinement bits of coefficients already known to the decoder, and LL3 */
+	state.raw = &s_raw;
+	BitStream_Attach(state.raw, Stream_Pointer(s), PROGRESSIVE_UPGRADE_COMPONENT_MAX);
+
+	for (band = 0; band < ARRAYSIZE(progressive_rfx_bands); band++)
+	{
+		const BOOL nonLL = (band + 1) < ARRAYSIZE(progressive_rfx_bands);
+		const INT16* pBand = &coeffs[progressive_rfx_bands[band].offset];
+		const UINT32 numBits = oldBitPos[band] - newBitPos[band];
+
+		if (!numBits)
+			continue;
+
+		for (index = 0; index < progressive_rfx_bands[band].length; index++)
+		{
+			INT16 value;
+
+			if (nonLL)
+			{
+				if (progressive_rfx_coefficient_value(pBand[index], oldBitPos[band], TRUE) == 0)
+					continue;
+
+				value = progressive_rfx_coefficient_value(pBand[index], newBitPos[band], TRUE);
+				if (value < 0)
+					value = -value;
+			}
+			else
+				value = progressive_rfx_coefficient_value(pBand[index], newBitPos[band], FALSE);
+
+			progressive_rfx_bits_write(state.raw, (UINT32)value, numBits);
+		}
+	}
+
+	length = progressive_rfx_bits_finish(state.raw);
+	*rawLen = (UINT16)length;
+	Stream_Seek(s, length);
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_tile_upgrade(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                                  UINT16 xIdx, UINT16 yIdx, BYTE quality,
+                                                  const INT16* coeffs)
+{
+	size_t i, end;
+	UINT16 srlLen[3] = { 0 };
+	UINT16 rawLen[3] = { 0 };
+	const size_t start = Stream_GetPosition(s);
+	const RFX_PROGRESSIVE_CODEC_QUANT* oldQuant;
+	const RFX_PROGRESSIVE_CODEC_QUANT* newQuant;
+
+	WINPR_ASSERT(progressive);
+	WINPR_ASSERT((quality > 0) && (quality <= PROGRESSIVE_QUALITY_FINAL));
+
+	oldQuant = &progressive_quality_ladder[quality - 1];
+	newQuant = &progressive_quality_ladder[quality];
+
+	if (!Stream_EnsureRemainingCapacity(s, 26 + 3 * 2 * PROGRESSIVE_UPGRADE_COMPONENT_MAX))
+		return FALSE;
+
+	Stream_Seek(s, 26);
+	for (i = 0; i < 3; i++)
+	{
+		const RFX_COMPONENT_CODEC_QUANT* pOld = (i == 0)   ? &oldQuant->yQuantValues
+		                                        : (i == 1) ? &oldQuant->cbQuantValues
+		                                                   : &oldQuant->crQuantValues;
+		const RFX_COMPONENT_CODEC_QUANT* pNew = (i == 0)   ? &newQuant->yQuantValues
+		                                        : (i == 1) ? &newQuant->cbQuantValues
+		                                                   : &newQuant->crQuantValues;
+
+		if (!progressive_rfx_upgrade_component_write(pOld, pNew, &coeffs[i * 4096], s, &srlLen[i],
+		                                             &rawLen[i]))
+			return FALSE;
+	}
+
+	end = Stream_GetPosition(s);
+	Stream_SetPosition(s, start);
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_TILE_UPGRADE); /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)(end - start));        /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxY (1 byte) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxCb (1 byte) */
+	Stream_Write_UINT8(s, 0);                             /* quantIdxCr (1 byte) */
+	Stream_Write_UINT16(s, xIdx);                         /* xIdx (2 bytes) */
+	Stream_Write_UINT16(s, yIdx);                         /* yIdx (2 bytes) */
+	Stream_Write_UINT8(s, quality);                       /* quality (1 byte) */
+	Stream_Write_UINT16(s, srlLen[0]);                    /* ySrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[0]);                    /* yRawLen (2 bytes) */
+	Stream_Write_UINT16(s, srlLen[1]);                    /* cbSrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[1]);                    /* cbRawLen (2 bytes) */
+	Stream_Write_UINT16(s, srlLen[2]);                    /* crSrlLen (2 bytes) */
+	Stream_Write_UINT16(s, rawLen[2]);                    /* crRawLen (2 bytes) */
+	Stream_SetPosition(s, end);
+	return TRUE;
+}
+
+static INLINE BOOL progressive_write_region_progressive(PROGRESSIVE_CONTEXT* progressive,
+                                                        wStream* s, const RFX_RECT* rects,
+                                                        UINT32 numRects, UINT32 numTiles)
+{
+	UINT32 i;
+	const size_t blockLen = 18 + numRects * 8 + 5 + ARRAYSIZE(progressive_quality_ladder) * 16;
+
+	WINPR_ASSERT(progressive);
+	WINPR_ASSERT(rects || (numRects == 0));
+
+	if ((numRects == 0) || (numRects > UINT16_MAX) || (numTiles > UINT16_MAX))
+		return FALSE;
+
+	if (!Stream_EnsureRemainingCapacity(s, blockLen))
+		return FALSE;
+
+	/* blockLen and tilesDataSize are updated by progressive_write_region_finish */
+	Stream_Write_UINT16(s, PROGRESSIVE_WBT_REGION);                    /* blockType (2 bytes) */
+	Stream_Write_UINT32(s, (UINT32)blockLen);                          /* blockLen (4 bytes) */
+	Stream_Write_UINT8(s, 64);                                         /* tileSize (1 byte) */
+	Stream_Write_UINT16(s, (UINT16)numRects);                          /* numRects (2 bytes) */
+	Stream_Write_UINT8(s, 1);                                          /* numQuant (1 byte) */
+	Stream_Write_UINT8(s, ARRAYSIZE(progressive_quality_ladder));      /* numProgQuant (1 byte) */
+	Stream_Write_UINT8(s, RFX_DWT_REDUCE_EXTRAPOLATE);                 /* flags (1 byte) */
+	Stream_Write_UINT16(s, (UINT16)numTiles);                          /* numTiles (2 bytes) */
+	Stream_Write_UINT32(s, 0);                                         /* tilesDataSize (4 bytes) */
+
+	for (i = 0; i < numRects; i++)
+	{
+		/* TS_RFX_RECT */
+		Stream_Write_UINT16(s, rects[i].x);      /* x (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].y);      /* y (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].width);  /* width (2 bytes) */
+		Stream_Write_UINT16(s, rects[i].height); /* height (2 bytes) */
+	}
+
+	progressive_rfx_quant_write(s, &progressive_quant_default);
+
+	for (i = 0; i < ARRAYSIZE(progressive_quality_ladder); i++)
+	{
+		/* RFX_PROGRESSIVE_CODEC_QUANT */
+		const RFX_PROGRESSIVE_CODEC_QUANT* quantProg = &progressive_quality_ladder[i];
+		Stream_Write_UINT8(s, quantProg->quality); /* quality (1 byte) */
+		progressive_rfx_quant_write(s, &quantProg->yQuantValues);
+		progressive_rfx_quant_write(s, &quantProg->cbQuantValues);
+		progressive_rfx_quant_write(s, &quantProg->crQuantValues);
+	}
+
+	return TRUE;
+}
+
+static INLINE void progressive_write_region_finish(wStream* s, size_t regionStart,
+                                                   size_t tilesStart)
+{
+	const size_t end = Stream_GetPosition(s);
+
+	Stream_SetPosition(s, regionStart + 2);
+	Stream_Write_UINT32(s, (UINT32)(end - regionStart)); /* blockLen (4 bytes) */
+	Stream_SetPosition(s, regionStart + 14);
+	Stream_Write_UINT32(s, (UINT32)(end - tilesStart)); /* tilesDataSize (4 bytes) */
+	Stream_SetPosition(s, end);
+}
+
+static INLINE BOOL progressive_write_frame_progressive_begin(PROGRESSIVE_CONTEXT* progressive,
+                                                             wStream* s, const RFX_RECT* rects,
+                                                             UINT32 numRects, UINT32 numTiles,
+                                                             size_t* pRegionStart)
+{
+	if (!progressive_write_wb_sync(progressive, s))
+		return FALSE;
+
+	if (!progressive_write_wb_context(progressive, s))
+		return FALSE;
+
+	if (!progressive_write_frame_begin(progressive, s, progressive->rfx_context->frameIdx++))
+		return FALSE;
+
+	*pRegionStart = Stream_GetPosition(s);
+	return progressive_write_region_progressive(progressive, s, rects, numRects, numTiles);
+}
+
+static void progressive_encoder_tiles_free(PROGRESSIVE_CONTEXT* progressive)
+{
+	UINT32 i;
+
+	WINPR_ASSERT(progressive);
+
+	if (progressive->encoderTiles)
+	{
+		for (i = 0; i < progressive->gridWidth * progressive->gridHeight; i++)
+			free(progressive->encoderTiles[i].coeffs);
+	}
+
+	free(progressive->encoderTiles);
+	progressive->encoderTiles = NULL;
+	progressive->pendingTiles = 0;
+	progressive->width = 0;
+	progressive->height = 0;
+	progressive->gridWidth = 0;
+	progressive->gridHeight = 0;
+}
+
+static BOOL progressive_encoder_tiles_resize(PROGRESSIVE_CONTEXT* progressive, UINT32 width,
+                                             UINT32 height)
+{
+	WINPR_ASSERT(progressive);
+
+	if (progressive->encoderTiles && (progressive->width == width) &&
+	    (progressive->height == height))
+		return TRUE;
+
+	progressive_encoder_tiles_free(progressive);
+	progressive->gridWidth = (width + 63) / 64;
+	progressive->gridHeight = (height + 63) / 64;
+	progressive->encoderTiles = (PROGRESSIVE_ENCODER_TILE*)calloc(
+	    progressive->gridWidth * progressive->gridHeight, sizeof(PROGRESSIVE_ENCODER_TILE));
+
+	if (!progressive->encoderTiles)
+	{
+		progressive->gridWidth = 0;
+		progressive->gridHeight = 0;
+		return FALSE;
+	}
+
+	progressive->width = width;
+	progressive->height = height;
+	return TRUE;
+}
+
+static void progressive_encoder_tile_done(PROGRESSIVE_CONTEXT* progressive,
+                                          PROGRESSIVE_ENCODER_TILE* tile)
+{
+	if (!tile->coeffs)
+		return;
+
+	free(tile->coeffs);
+	tile->coeffs = NULL;
+	tile->quality = PROGRESSIVE_QUALITY_FINAL;
+	WINPR_ASSERT(progressive->pendingTiles > 0);
+	progressive->pendingTiles--;
+}
+
+static void progressive_encoder_mark_tiles(PROGRESSIVE_CONTEXT* progressive, const RFX_RECT* rect)
+{
+	UINT32 xIdx, yIdx;
+	const UINT32 right = MIN(progressive->width, (UINT32)rect->x + rect->width);
+	const UINT32 bottom = MIN(progressive->height, (UINT32)rect->y + rect->height);
+
+	for (yIdx = rect->y / 64; yIdx < (bottom + 63) / 64; yIdx++)
+	{
+		for (xIdx = rect->x / 64; xIdx < (right + 63) / 64; xIdx++)
+		{
+			PROGRESSIVE_ENCODER_TILE* tile =
+			    &progressive->encoderTiles[yIdx * progressive->gridWidth + xIdx];
+			const RECTANGLE_16 part = { (UINT16)MAX(xIdx * 64, rect->x),
+				                        (UINT16)MAX(yIdx * 64, rect->y),
+				                        (UINT16)MIN((xIdx + 1) * 64, right),
+				                        (UINT16)MIN((yIdx + 1) * 64, bottom) };
+
+			if (!tile->dirty)
+			{
+				tile->dirty = TRUE;
+
+				/* A pending tile keeps the area shown at reduced quality */
+				if (!tile->coeffs)
+				{
+					tile->rect = part;
+					continue;
+				}
+			}
+
+			tile->rect.left = MIN(tile->rect.left, part.left);
+			tile->rect.top = MIN(tile->rect.top, part.top);
+			tile->rect.right = MAX(tile->rect.right, part.right);
+			tile->rect.bottom = MAX(tile->rect.bottom, part.bottom);
+		}
+	}
+}
+
+static BOOL progressive_compress_tiles_first(PROGRESSIVE_CONTEXT* progressive, wStream* s,
+                                             const BYTE* pSrcData, UINT32 SrcFormat,
+                                             UINT32 ScanLine, const RFX_RECT* rects,
+                                             UINT32 numRects)
+{
+	BOOL rc = FALSE;
+	UINT32 i, xIdx, yIdx;
+	UINT32 numTiles = 0;
+	size_t regionStart, tilesStart;
+
+	for (i = 0; i < numRects; i++)
+		progressive_encoder_mark_tiles(progressive, &rects[i]);
+
+	for (i = 0; i < progressive->gridWidth * progressive->gridHeight; i++)
+	{
+		if (progressive->encoderTiles[i].dirty)
+			numTiles++;
+	}
+
+	if (!progressive_write_frame_progressive_begin(progressive, s, rects, numRects, numTiles,
+	                                               &regionStart))
+		goto fail;
+
+	tilesStart = Stream_GetPosition(s);
+	for (yIdx = 0; yIdx < progressive->gridHeight; yIdx++)
+	{
+		for (xIdx = 0; xIdx < progressive->gridWidth; xIdx++)
+		{
+			PROGRESSIVE_ENCODER_TILE* tile =
+			    &progressive->encoderTiles[yIdx * progressive->gridWidth + xIdx];
+
+			if (!tile->dirty)
+				continue;
+
+			tile->dirty = FALSE;
+			if (!tile->coeffs)
+			{
+				tile->coeffs = (INT16*)calloc(3 * 4096, sizeof(INT16));
+				if (!tile->coeffs)
+					goto fail;
+				progressive->pendingTiles++;
+			}
+
+			tile->quality = 0;
+			if (!progressive_encode_tile_coefficients(
+			        progressive, pSrcData, SrcFormat, ScanLine, xIdx * 64, yIdx * 64,
+			        MIN(64, progressive->width - xIdx * 64),
+			        MIN(64, progressive->height - yIdx * 64), tile->coeffs))
+				goto fail;
+
+			if (!progressive_write_tile_first(progressive, s, (UINT16)xIdx, (UINT16)yIdx,
+			                                  tile->coeffs))
+				goto fail;
+		}
+	}
+
+	progressive_write_region_finish(s, regionStart, tilesStart);
+
+	if (!progressive_write_frame_end(progressive, s))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	for (i = 0; i < progressive->gridWidth * progressive->gridHeight; i++)
+		progressive->encoderTiles[i].dirty = FALSE;
+	return rc;
+}
+
+BOOL progressive_context_set_upgrades(PROGRESSIVE_CONTEXT* progressive, BOOL enable)
+{
+	if (!progressive || !progressive->Compressor)
+		return FALSE;
+
+	if (!enable)
+		progressive_encoder_tiles_free(progressive);
+
+	progressive->upgrades = enable;
+	return TRUE;
+}
+
+UINT32 progressive_compress_pending(PROGRESSIVE_CONTEXT* progressive)
+{
+	if (!progressive)
+		return 0;
+
+	return progressive->pendingTiles;
+}
+
+BOOL progressive_compress_discard(PROGRESSIVE_CONTEXT* progressive, const REGION16* region)
+{
+	UINT32 i, nbRects;
+	const RECTANGLE_16* rects;
+
+	if (!progressive || !region)
+		return FALSE;
+
+	if (progressive->pendingTiles == 0)
+		return TRUE;
+
+	rects = region16_rects(region, &nbRects);
+	for (i = 0; i < nbRects; i++)
+	{
+		UINT32 xIdx, yIdx;
+		const RECTANGLE_16* rect = &rects[i];
+		const UINT32 right = MIN(progressive->width, rect->right);
+		const UINT32 bottom = MIN(progressive->height, rect->bottom);
+
+		for (yIdx = rect->top / 64; yIdx < (bottom + 63) / 64; yIdx++)
+		{
+			for (xIdx = rect->left / 64; xIdx < (right + 63) / 64; xIdx++)
+				progressive_encoder_tile_done(
+				    progressive, &progressive->encoderTiles[yIdx * progressive->gridWidth + xIdx]);
+		}
+	}
+
+	return TRUE;
+}
+
+int progressive_compress_upgrade(PROGRESSIVE_CONTEXT* progressive, REGION16* finalRegion,
+                                 BYTE** ppDstData, UINT32* pDstSize)
+{
+	wStream* s;
+	RFX_RECT* rects;
+	UINT32 i, xIdx, yIdx;
+	UINT32 numTiles = 0;
+	size_t regionStart, tilesStart;
+
+	if (!progressive || !ppDstData || !pDstSize)
+		return -1;
+
+	if (progressive->pendingTiles == 0)
+		return 0;
+
+	if (!Stream_EnsureCapacity(progressive->rects, progressive->pendingTiles * sizeof(RFX_RECT)))
+		return -5;
+
+	rects = (RFX_RECT*)Stream_Buffer(progressive->rects);
+	for (i = 0; i < progressive->gridWidth * progressive->gridHeight; i++)
+	{
+		const PROGRESSIVE_ENCODER_TILE* tile = &progressive->encoderTiles[i];
+
+		if (!tile->coeffs)
+			continue;
+
+		rects[numTiles].x = tile->rect.left;
+		rects[numTiles].y = tile->rect.top;
+		rects[numTiles].width = tile->rect.right - tile->rect.left;
+		rects[numTiles].height = tile->rect.bottom - tile->rect.top;
+		numTiles++;
+	}
+
+	s = progressive->buffer;
+	Stream_SetPosition(s, 0);
+
+	if (!progressive_write_frame_progressive_begin(progressive, s, rects, numTiles, numTiles,
+	                                               &regionStart))
+		return -6;
+
+	tilesStart = Stream_GetPosition(s);
+	for (yIdx = 0; yIdx < progressive->gridHeight; yIdx++)
+	{
+		for (xIdx = 0; xIdx < progressive->gridWidth; xIdx++)
+		{
+			PROGRESSIVE_ENCODER_TILE* tile =
+			    &progressive->encoderTiles[yIdx * progressive->gridWidth + xIdx];
+
+			if (!tile->coeffs)
+				continue;
+
+			tile->quality++;
+			if (!progressive_write_tile_upgrade(progressive, s, (UINT16)xIdx, (UINT16)yIdx,
+			                                    tile->quality, tile->coeffs))
+				return -6;
+
+			if (tile->quality == PROGRESSIVE_QUALITY_FINAL)
+			{
+				if (finalRegion &&
+				    !region16_union_rect(finalRegion, finalRegion, &tile->rect))
+					return -6;
+
+				progressive_encoder_tile_done(progressive, tile);
+			}
+		}
+	}
+
+	progressive_write_region_finish(s, regionStart, tilesStart);
+
+	if (!progressive_write_frame_end(progressive, s))
+		return -6;
+
+	*pDstSize = Stream_GetPosition(s);
+	*ppDstData = Stream_Buffer(s);
+	return 1;
+}
+
 int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData, UINT32 SrcSize,
                          UINT32 SrcFormat, UINT32 Width, UINT32 Height, UINT32 ScanLine,
                          const REGION16* invalidRegion, BYTE** ppDstData, UINT32* pDstSize)
@@ -2719,6 +3625,23 @@ int progressive_compress(PROGRESSIVE_CONTEXT* progressive, const BYTE* pSrcData,
 	s = progressive->buffer;
 	Stream_SetPosition(s, 0);
 
+	if (progressive->upgrades)
+	{
+		if (!progressive_encoder_tiles_resize(progressive, Width, Height))
+			goto fail;
+
+		if (!progressive_compress_tiles_first(progressive, s, pSrcData, SrcFormat, ScanLine, rects,
+		                                      numRects))
+		{
+			WLog_ERR(TAG, "failed to encode progressive first pass");
+			goto fail;
+		}
+
+		*pDstSize = Stream_GetPosition(s);
+		*ppDstData = Stream_Buffer(s);
+		return 1;
+	}
+
 	progressive->rfx_context->mode = RLGR1;
 	progressive->rfx_context->width = Width;
 	progressive->rfx_context->height = Height;
@@ -2750,6 +3673,8 @@ BOOL progressive_context_reset(PROGRESSIVE_CONTEXT* progressive)
 	if (!progressive)
 		return FALSE;
 
+	progressive_encoder_tiles_free(progressive);
+
 	return TRUE;
 }
 
@@ -2797,6 +3722,7 @@ void progressive_context_free(PROGRESSIVE_CONTEXT* progressive)
 	if (!progressive)
 		return;
 
+	progressive_encoder_tiles_free(progressive);
 	Stream_Free(progressive->buffer, TRUE);
 	Stream_Free(progressive->rects, TRUE);
 	rfx_context_free(progressive->rfx_context);
@@ -25,6 +25,7 @@
 #include <winpr/collections.h>
 
 #include <freerdp/codec/rfx.h>
+#include <freerdp/codec/region.h>
 
 #define RFX_SUBBAND_DIFFING 0x01
 
@@ -197,6 +198,14 @@ typedef struct
 	UINT32* updatedTileIndices;
 } PROGRESSIVE_SURFACE_CONTEXT;
 
+typedef struct
+{
+	BOOL dirty;        /* tile is part of the frame being encoded */
+	BYTE quality;      /* index of the last pass sent in the quality ladder */
+	RECTANGLE_16 rect; /* area of the tile the client shows at reduced quality */
+	INT16* coeffs;     /* full quality coefficients (Y, Cb, Cr) of a tile pending upgrades */
+} PROGRESSIVE_ENCODER_TILE;
+
 typedef enum
 {
 	FLAG_WBT_SYNC = 0x01,
@@ -224,6 +233,15 @@ struct S_PROGRESSIVE_CONTEXT
 	wStream* buffer;
 	wStream* rects;
 	RFX_CONTEXT* rfx_context;
+
+	/* multi pass encoder, tiles are sent coarse first and upgraded later */
+	BOOL upgrades;
+	UINT32 width;
+	UINT32 height;
+	UINT32 gridWidth;
+	UINT32 gridHeight;
+	PROGRESSIVE_ENCODER_TILE* encoderTiles;
+	UINT32 pendingTiles;
 };
 
 #endif /* INTERNAL_CODEC_PROGRESSIVE_H */
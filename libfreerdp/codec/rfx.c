@@ -50,6 +50,9 @@
 
 #include "rfx_sse2.h"
 #include "rfx_neon.h"
+#if defined(WITH_AVX2)
+#include "rfx_avx2.h"
+#endif
 
 #define TAG FREERDP_TAG("codec")
 
@@ -347,6 +350,9 @@ RFX_CONTEXT* rfx_context_new_ex(BOOL encoder, UINT32 ThreadingFlags)
 	context->rlgr_decode = rfx_rlgr_decode;
 	context->rlgr_encode = rfx_rlgr_encode;
 	RFX_INIT_SIMD(context);
+#if defined(WITH_AVX2)
+	rfx_init_avx2(context);
+#endif
 	context->state = RFX_STATE_SEND_HEADERS;
 	context->expectedDataBlockType = WBT_FRAME_BEGIN;
 	return context;
@@ -430,6 +436,32 @@ BOOL rfx_context_reset(RFX_CONTEXT* context, UINT32 width, UINT32 height)
 	return TRUE;
 }
 
+/**
+ * @return TRUE if the next message written by the encoder carries the codec headers
+ */
+BOOL rfx_context_headers_pending(const RFX_CONTEXT* context)
+{
+	if (!context)
+		return FALSE;
+
+	return context->state == RFX_STATE_SEND_HEADERS;
+}
+
+/**
+ * The codec headers reached the decoder with a message written by another encoder context,
+ * messages of this context no longer need to carry them.
+ */
+BOOL rfx_context_set_headers_sent(RFX_CONTEXT* context)
+{
+	if (!context || !context->encoder)
+		return FALSE;
+
+	if (context->state == RFX_STATE_SEND_HEADERS)
+		context->state = RFX_STATE_SEND_FRAME_DATA;
+
+	return TRUE;
+}
+
 static BOOL rfx_process_message_sync(RFX_CONTEXT* context, wStream* s)
 {
 	UINT32 magic;
@@ -966,7 +998,6 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* messa
 					break;
 				}
 
-				SubmitThreadpoolWork(work_objects[i]);
 				close_cnt = i + 1;
 			}
 			else
@@ -978,6 +1009,9 @@ static BOOL rfx_process_message_tileset(RFX_CONTEXT* context, RFX_MESSAGE* messa
 
 	if (context->priv->UseThreads)
 	{
+		/* Neighbouring tiles are decoded by the same worker */
+		winpr_SubmitThreadpoolWorkBatch(work_objects, close_cnt);
+
 		for (i = 0; i < close_cnt; i++)
 		{
 			WaitForThreadpoolWorkCallbacks(work_objects[i], FALSE);
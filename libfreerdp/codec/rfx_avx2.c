@@ -0,0 +1,401 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * RemoteFX Codec Library - AVX2 Optimizations
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/sysinfo.h>
+
+#include <immintrin.h>
+
+#include "rfx_types.h"
+#include "rfx_avx2.h"
+
+#ifdef _MSC_VER
+#define __attribute__(...)
+#endif
+
+#ifndef __clang__
+#define ATTRIBUTES __gnu_inline__, __always_inline__, __artificial__
+#else
+#define ATTRIBUTES __gnu_inline__, __always_inline__
+#endif
+
+/*
+ * The functions below work on the same data layout as the SSE2 versions but process
+ * 16 coefficients at once. The buffers are only 16 byte aligned, so unaligned loads
+ * and stores are used throughout.
+ *
+ * The horizontal DWT passes run over a whole sub-band at once: rows are stored
+ * back to back, so a vector covers one row of the 16x16 sub-band, half a row of the
+ * 32x32 sub-band or two rows of the 8x8 sub-band. The lanes holding the first and the
+ * last coefficient of a row need the mirrored boundary values and are patched with
+ * the masks returned by rfx_dwt_row_first_avx2 and rfx_dwt_row_last_avx2.
+ */
+
+static __inline __m256i __attribute__((ATTRIBUTES))
+rfx_dwt_row_first_avx2(size_t subband_width, size_t n)
+{
+	if (subband_width == 8)
+		return _mm256_setr_epi16(-1, 0, 0, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0, 0, 0, 0);
+
+	if ((n % subband_width) == 0)
+		return _mm256_setr_epi16(-1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	return _mm256_setzero_si256();
+}
+
+static __inline __m256i __attribute__((ATTRIBUTES))
+rfx_dwt_row_last_avx2(size_t subband_width, size_t n)
+{
+	if (subband_width == 8)
+		return _mm256_setr_epi16(0, 0, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0, 0, 0, 0, -1);
+
+	if (((n + 16) % subband_width) == 0)
+		return _mm256_setr_epi16(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+
+	return _mm256_setzero_si256();
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_quantization_decode_block_avx2(INT16* buffer, const size_t buffer_size, const UINT32 factor)
+{
+	__m256i* ptr = (__m256i*)buffer;
+	const __m256i* buf_end = (const __m256i*)(buffer + buffer_size);
+
+	if (factor == 0)
+		return;
+
+	do
+	{
+		const __m256i a = _mm256_loadu_si256(ptr);
+		_mm256_storeu_si256(ptr, _mm256_slli_epi16(a, (int)factor));
+		ptr++;
+	} while (ptr < buf_end);
+}
+
+static void rfx_quantization_decode_avx2(INT16* buffer, const UINT32* quantVals)
+{
+	rfx_quantization_decode_block_avx2(&buffer[0], 1024, quantVals[8] - 1);    /* HL1 */
+	rfx_quantization_decode_block_avx2(&buffer[1024], 1024, quantVals[7] - 1); /* LH1 */
+	rfx_quantization_decode_block_avx2(&buffer[2048], 1024, quantVals[9] - 1); /* HH1 */
+	rfx_quantization_decode_block_avx2(&buffer[3072], 256, quantVals[5] - 1);  /* HL2 */
+	rfx_quantization_decode_block_avx2(&buffer[3328], 256, quantVals[4] - 1);  /* LH2 */
+	rfx_quantization_decode_block_avx2(&buffer[3584], 256, quantVals[6] - 1);  /* HH2 */
+	rfx_quantization_decode_block_avx2(&buffer[3840], 64, quantVals[2] - 1);   /* HL3 */
+	rfx_quantization_decode_block_avx2(&buffer[3904], 64, quantVals[1] - 1);   /* LH3 */
+	rfx_quantization_decode_block_avx2(&buffer[3968], 64, quantVals[3] - 1);   /* HH3 */
+	rfx_quantization_decode_block_avx2(&buffer[4032], 64, quantVals[0] - 1);   /* LL3 */
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_quantization_encode_block_avx2(INT16* buffer, const size_t buffer_size, const UINT32 factor)
+{
+	__m256i half;
+	__m256i* ptr = (__m256i*)buffer;
+	const __m256i* buf_end = (const __m256i*)(buffer + buffer_size);
+
+	if (factor == 0)
+		return;
+
+	half = _mm256_set1_epi16((INT16)(1 << (factor - 1)));
+
+	do
+	{
+		__m256i a = _mm256_loadu_si256(ptr);
+		a = _mm256_add_epi16(a, half);
+		a = _mm256_srai_epi16(a, (int)factor);
+		_mm256_storeu_si256(ptr, a);
+		ptr++;
+	} while (ptr < buf_end);
+}
+
+static void rfx_quantization_encode_avx2(INT16* buffer, const UINT32* quantization_values)
+{
+	rfx_quantization_encode_block_avx2(buffer, 1024, quantization_values[8] - 6);        /* HL1 */
+	rfx_quantization_encode_block_avx2(buffer + 1024, 1024, quantization_values[7] - 6); /* LH1 */
+	rfx_quantization_encode_block_avx2(buffer + 2048, 1024, quantization_values[9] - 6); /* HH1 */
+	rfx_quantization_encode_block_avx2(buffer + 3072, 256, quantization_values[5] - 6);  /* HL2 */
+	rfx_quantization_encode_block_avx2(buffer + 3328, 256, quantization_values[4] - 6);  /* LH2 */
+	rfx_quantization_encode_block_avx2(buffer + 3584, 256, quantization_values[6] - 6);  /* HH2 */
+	rfx_quantization_encode_block_avx2(buffer + 3840, 64, quantization_values[2] - 6);   /* HL3 */
+	rfx_quantization_encode_block_avx2(buffer + 3904, 64, quantization_values[1] - 6);   /* LH3 */
+	rfx_quantization_encode_block_avx2(buffer + 3968, 64, quantization_values[3] - 6);   /* HH3 */
+	rfx_quantization_encode_block_avx2(buffer + 4032, 64, quantization_values[0] - 6);   /* LL3 */
+	rfx_quantization_encode_block_avx2(buffer, 4096, 5);
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_decode_block_horiz_avx2(INT16* l, const INT16* h, INT16* dst, size_t subband_width)
+{
+	size_t n;
+	const size_t total = subband_width * subband_width;
+	const __m256i one = _mm256_set1_epi16(1);
+
+	/* Even coefficients, stored back to l */
+	for (n = 0; n < total; n += 16)
+	{
+		/* dst[2n] = l[n] - ((h[n-1] + h[n] + 1) >> 1); */
+		const __m256i first = rfx_dwt_row_first_avx2(subband_width, n);
+		const __m256i l_n = _mm256_loadu_si256((const __m256i*)&l[n]);
+		const __m256i h_n = _mm256_loadu_si256((const __m256i*)&h[n]);
+		__m256i h_n_m = _mm256_loadu_si256((const __m256i*)(h + n - 1));
+		__m256i tmp_n;
+		h_n_m = _mm256_blendv_epi8(h_n_m, h_n, first);
+		tmp_n = _mm256_add_epi16(_mm256_add_epi16(h_n, h_n_m), one);
+		tmp_n = _mm256_srai_epi16(tmp_n, 1);
+		_mm256_storeu_si256((__m256i*)&l[n], _mm256_sub_epi16(l_n, tmp_n));
+	}
+
+	/* Odd coefficients, interleaved with the even ones into dst */
+	for (n = 0; n < total; n += 16)
+	{
+		/* dst[2n + 1] = (h[n] << 1) + ((dst[2n] + dst[2n + 2]) >> 1); */
+		const __m256i last = rfx_dwt_row_last_avx2(subband_width, n);
+		const __m256i h_n = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)&h[n]), 1);
+		const __m256i dst_n = _mm256_loadu_si256((const __m256i*)&l[n]);
+		__m256i dst_n_p = _mm256_loadu_si256((const __m256i*)&l[n + 1]);
+		__m256i tmp_n;
+		__m256i lo;
+		__m256i hi;
+		dst_n_p = _mm256_blendv_epi8(dst_n_p, dst_n, last);
+		tmp_n = _mm256_srai_epi16(_mm256_add_epi16(dst_n, dst_n_p), 1);
+		tmp_n = _mm256_add_epi16(tmp_n, h_n);
+		/* unpack works per 128 bit lane, the permutes restore the linear order */
+		lo = _mm256_unpacklo_epi16(dst_n, tmp_n);
+		hi = _mm256_unpackhi_epi16(dst_n, tmp_n);
+		_mm256_storeu_si256((__m256i*)&dst[2 * n], _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)&dst[2 * n + 16], _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_decode_block_vert_avx2(const INT16* l, const INT16* h, INT16* dst, size_t subband_width)
+{
+	size_t x, n;
+	const size_t total_width = subband_width + subband_width;
+	const __m256i one = _mm256_set1_epi16(1);
+
+	/* Even coefficients */
+	for (n = 0; n < subband_width; n++)
+	{
+		for (x = 0; x < total_width; x += 16)
+		{
+			/* dst[2n] = l[n] - ((h[n-1] + h[n] + 1) >> 1); */
+			const __m256i l_n = _mm256_loadu_si256((const __m256i*)&l[n * total_width + x]);
+			const __m256i h_n = _mm256_loadu_si256((const __m256i*)&h[n * total_width + x]);
+			__m256i tmp_n = _mm256_add_epi16(h_n, one);
+
+			if (n == 0)
+				tmp_n = _mm256_add_epi16(tmp_n, h_n);
+			else
+				tmp_n = _mm256_add_epi16(
+				    tmp_n, _mm256_loadu_si256((const __m256i*)&h[(n - 1) * total_width + x]));
+
+			tmp_n = _mm256_srai_epi16(tmp_n, 1);
+			_mm256_storeu_si256((__m256i*)&dst[2 * n * total_width + x],
+			                    _mm256_sub_epi16(l_n, tmp_n));
+		}
+	}
+
+	/* Odd coefficients */
+	for (n = 0; n < subband_width; n++)
+	{
+		INT16* dst_ptr = &dst[(2 * n + 1) * total_width];
+
+		for (x = 0; x < total_width; x += 16)
+		{
+			/* dst[2n + 1] = (h[n] << 1) + ((dst[2n] + dst[2n + 2]) >> 1); */
+			const __m256i h_n =
+			    _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)&h[n * total_width + x]), 1);
+			const __m256i dst_n_m = _mm256_loadu_si256((const __m256i*)&dst_ptr[x - total_width]);
+			__m256i tmp_n;
+
+			if (n == subband_width - 1)
+				tmp_n = _mm256_add_epi16(dst_n_m, dst_n_m);
+			else
+				tmp_n = _mm256_add_epi16(
+				    dst_n_m, _mm256_loadu_si256((const __m256i*)&dst_ptr[x + total_width]));
+
+			tmp_n = _mm256_srai_epi16(tmp_n, 1);
+			_mm256_storeu_si256((__m256i*)&dst_ptr[x], _mm256_add_epi16(tmp_n, h_n));
+		}
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_decode_block_avx2(INT16* buffer, INT16* idwt, size_t subband_width)
+{
+	INT16 *hl, *lh, *hh, *ll;
+	INT16 *l_dst, *h_dst;
+	/* Inverse DWT in horizontal direction, results in 2 sub-bands in L, H order in tmp buffer idwt.
+	 */
+	/* The 4 sub-bands are stored in HL(0), LH(1), HH(2), LL(3) order. */
+	/* The lower part L uses LL(3) and HL(0). */
+	/* The higher part H uses LH(1) and HH(2). */
+	ll = buffer + subband_width * subband_width * 3;
+	hl = buffer;
+	l_dst = idwt;
+	rfx_dwt_2d_decode_block_horiz_avx2(ll, hl, l_dst, subband_width);
+	lh = buffer + subband_width * subband_width;
+	hh = buffer + subband_width * subband_width * 2;
+	h_dst = idwt + subband_width * subband_width * 2;
+	rfx_dwt_2d_decode_block_horiz_avx2(lh, hh, h_dst, subband_width);
+	/* Inverse DWT in vertical direction, results are stored in original buffer. */
+	rfx_dwt_2d_decode_block_vert_avx2(l_dst, h_dst, buffer, subband_width);
+}
+
+static void rfx_dwt_2d_decode_avx2(INT16* buffer, INT16* dwt_buffer)
+{
+	rfx_dwt_2d_decode_block_avx2(&buffer[3840], dwt_buffer, 8);
+	rfx_dwt_2d_decode_block_avx2(&buffer[3072], dwt_buffer, 16);
+	rfx_dwt_2d_decode_block_avx2(&buffer[0], dwt_buffer, 32);
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_encode_block_vert_avx2(const INT16* src, INT16* l, INT16* h, size_t subband_width)
+{
+	size_t x, n;
+	const size_t total_width = subband_width << 1;
+
+	for (n = 0; n < subband_width; n++)
+	{
+		const INT16* src_ptr = &src[2 * n * total_width];
+		INT16* l_ptr = &l[n * total_width];
+		INT16* h_ptr = &h[n * total_width];
+
+		for (x = 0; x < total_width; x += 16)
+		{
+			const __m256i src_2n = _mm256_loadu_si256((const __m256i*)&src_ptr[x]);
+			const __m256i src_2n_1 =
+			    _mm256_loadu_si256((const __m256i*)&src_ptr[x + total_width]);
+			const __m256i src_2n_2 =
+			    (n < subband_width - 1)
+			        ? _mm256_loadu_si256((const __m256i*)&src_ptr[x + 2 * total_width])
+			        : src_2n;
+			__m256i h_n;
+			__m256i h_n_m;
+			__m256i l_n;
+
+			/* h[n] = (src[2n + 1] - ((src[2n] + src[2n + 2]) >> 1)) >> 1 */
+			h_n = _mm256_srai_epi16(_mm256_add_epi16(src_2n, src_2n_2), 1);
+			h_n = _mm256_srai_epi16(_mm256_sub_epi16(src_2n_1, h_n), 1);
+			_mm256_storeu_si256((__m256i*)&h_ptr[x], h_n);
+
+			if (n == 0)
+				h_n_m = h_n;
+			else
+				h_n_m = _mm256_loadu_si256((const __m256i*)&h_ptr[x - total_width]);
+
+			/* l[n] = src[2n] + ((h[n - 1] + h[n]) >> 1) */
+			l_n = _mm256_srai_epi16(_mm256_add_epi16(h_n_m, h_n), 1);
+			_mm256_storeu_si256((__m256i*)&l_ptr[x], _mm256_add_epi16(l_n, src_2n));
+		}
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_encode_block_horiz_avx2(const INT16* src, INT16* l, INT16* h, size_t subband_width)
+{
+	size_t n;
+	const size_t total = subband_width * subband_width;
+	/* Moves the even coefficients of each 128 bit lane to its lower half */
+	const __m256i deinterleave = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11,
+	                                              14, 15, 0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7,
+	                                              10, 11, 14, 15);
+
+	for (n = 0; n < total; n += 16)
+	{
+		const __m256i first = rfx_dwt_row_first_avx2(subband_width, n);
+		const __m256i last = rfx_dwt_row_last_avx2(subband_width, n);
+		const __m256i a = _mm256_permute4x64_epi64(
+		    _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[2 * n]), deinterleave),
+		    0xD8);
+		const __m256i b = _mm256_permute4x64_epi64(
+		    _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)&src[2 * n + 16]),
+		                        deinterleave),
+		    0xD8);
+		const __m256i src_2n = _mm256_permute2x128_si256(a, b, 0x20);
+		const __m256i src_2n_1 = _mm256_permute2x128_si256(a, b, 0x31);
+		__m256i src_2n_2;
+		__m256i h_n;
+		__m256i h_n_m;
+		__m256i l_n;
+
+		/* src[2n + 2]: shift the even coefficients by one, the top lane comes from the next
+		 * vector unless the row ends here */
+		src_2n_2 = _mm256_alignr_epi8(_mm256_permute2x128_si256(src_2n, src_2n, 0x81), src_2n, 2);
+
+		if ((subband_width > 8) && (((n + 16) % subband_width) != 0))
+			src_2n_2 = _mm256_insert_epi16(src_2n_2, src[2 * n + 32], 15);
+
+		src_2n_2 = _mm256_blendv_epi8(src_2n_2, src_2n, last);
+
+		/* h[n] = (src[2n + 1] - ((src[2n] + src[2n + 2]) >> 1)) >> 1 */
+		h_n = _mm256_srai_epi16(_mm256_add_epi16(src_2n, src_2n_2), 1);
+		h_n = _mm256_srai_epi16(_mm256_sub_epi16(src_2n_1, h_n), 1);
+		_mm256_storeu_si256((__m256i*)&h[n], h_n);
+		h_n_m = _mm256_loadu_si256((const __m256i*)(h + n - 1));
+		h_n_m = _mm256_blendv_epi8(h_n_m, h_n, first);
+
+		/* l[n] = src[2n] + ((h[n - 1] + h[n]) >> 1) */
+		l_n = _mm256_srai_epi16(_mm256_add_epi16(h_n_m, h_n), 1);
+		_mm256_storeu_si256((__m256i*)&l[n], _mm256_add_epi16(l_n, src_2n));
+	}
+}
+
+static __inline void __attribute__((ATTRIBUTES))
+rfx_dwt_2d_encode_block_avx2(INT16* buffer, INT16* dwt, size_t subband_width)
+{
+	INT16 *hl, *lh, *hh, *ll;
+	INT16 *l_src, *h_src;
+	/* DWT in vertical direction, results in 2 sub-bands in L, H order in tmp buffer dwt. */
+	l_src = dwt;
+	h_src = dwt + subband_width * subband_width * 2;
+	rfx_dwt_2d_encode_block_vert_avx2(buffer, l_src, h_src, subband_width);
+	/* DWT in horizontal direction, results in 4 sub-bands in HL(0), LH(1), HH(2), LL(3) order,
+	 * stored in original buffer. */
+	/* The lower part L generates LL(3) and HL(0). */
+	/* The higher part H generates LH(1) and HH(2). */
+	ll = buffer + subband_width * subband_width * 3;
+	hl = buffer;
+	lh = buffer + subband_width * subband_width;
+	hh = buffer + subband_width * subband_width * 2;
+	rfx_dwt_2d_encode_block_horiz_avx2(l_src, ll, hl, subband_width);
+	rfx_dwt_2d_encode_block_horiz_avx2(h_src, lh, hh, subband_width);
+}
+
+static void rfx_dwt_2d_encode_avx2(INT16* buffer, INT16* dwt_buffer)
+{
+	rfx_dwt_2d_encode_block_avx2(buffer, dwt_buffer, 32);
+	rfx_dwt_2d_encode_block_avx2(buffer + 3072, dwt_buffer, 16);
+	rfx_dwt_2d_encode_block_avx2(buffer + 3840, dwt_buffer, 8);
+}
+
+void rfx_init_avx2(RFX_CONTEXT* context)
+{
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		return;
+
+	PROFILER_RENAME(context->priv->prof_rfx_quantization_decode, "rfx_quantization_decode_avx2")
+	PROFILER_RENAME(context->priv->prof_rfx_quantization_encode, "rfx_quantization_encode_avx2")
+	PROFILER_RENAME(context->priv->prof_rfx_dwt_2d_decode, "rfx_dwt_2d_decode_avx2")
+	PROFILER_RENAME(context->priv->prof_rfx_dwt_2d_encode, "rfx_dwt_2d_encode_avx2")
+	context->quantization_decode = rfx_quantization_decode_avx2;
+	context->quantization_encode = rfx_quantization_encode_avx2;
+	context->dwt_2d_decode = rfx_dwt_2d_decode_avx2;
+	context->dwt_2d_encode = rfx_dwt_2d_encode_avx2;
+}
@@ -0,0 +1,1352 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Codec Benchmark
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Runs the encoders and decoders on reproducible corpora and prints the results as JSON.
+ *
+ * The corpus consists of synthetic images generated from a fixed seed and of recorded
+ * screen content (the bitmaps shipped with the codec tests or images given with --image).
+ * Every codec runs `warmup + iterations` rounds per image, a round encodes the whole image
+ * and decodes the result again. The decoded data is not compared for the lossy codecs,
+ * the bulk compressors are verified to round trip.
+ *
+ * For every codec, operation and image the report contains the throughput (MPix/s for the
+ * image codecs, MB/s of uncompressed data for all), the average output size and the
+ * p50/p99 latency of a round in microseconds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winpr/crt.h>
+#include <winpr/image.h>
+#include <winpr/stream.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/rfx.h>
+#include <freerdp/codec/nsc.h>
+#include <freerdp/codec/planar.h>
+#include <freerdp/codec/interleaved.h>
+#include <freerdp/codec/progressive.h>
+#include <freerdp/codec/clear.h>
+#include <freerdp/codec/h264.h>
+#include <freerdp/codec/zgfx.h>
+#include <freerdp/codec/bulk.h>
+#include <freerdp/channels/rdpgfx.h>
+#include <freerdp/settings.h>
+#include <freerdp/utils/stopwatch.h>
+
+#include "../mppc.h"
+#include "../ncrush.h"
+#include "../xcrush.h"
+
+#define BENCH_TILE_SIZE 64
+#define BENCH_TILE_BUFFER_SIZE (BENCH_TILE_SIZE * BENCH_TILE_SIZE * 4 * 2)
+#define BENCH_BULK_CHUNK_SIZE 8192
+#define BENCH_BULK_BUFFER_SIZE 65536
+
+typedef struct
+{
+	char name[64];
+	UINT32 width;
+	UINT32 height;
+	UINT32 stride;
+	BYTE* data;
+} BENCH_IMAGE;
+
+typedef struct
+{
+	size_t iterations;
+	size_t warmup;
+	const char* filter;
+	FILE* out;
+	size_t reported;
+	BOOL failed;
+	STOPWATCH* sw;
+	UINT64* encode;
+	UINT64* decode;
+	size_t bytesOut;
+} BENCH_CONTEXT;
+
+typedef BOOL (*bench_codec_fn)(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image);
+
+typedef struct
+{
+	const char* name;
+	bench_codec_fn fn;
+} BENCH_CODEC;
+
+static UINT32 bench_rand(UINT32* seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 16) & 0x7FFF;
+}
+
+static BOOL bench_image_alloc(BENCH_IMAGE* image, const char* name, UINT32 width, UINT32 height)
+{
+	WINPR_ASSERT(image);
+
+	sprintf_s(image->name, sizeof(image->name), "%s", name);
+	image->width = width;
+	image->height = height;
+	image->stride = width * 4;
+	image->data = winpr_aligned_malloc(1ull * image->stride * height, 32);
+	return image->data != NULL;
+}
+
+static void bench_image_free(BENCH_IMAGE* image)
+{
+	if (!image)
+		return;
+
+	winpr_aligned_free(image->data);
+	image->data = NULL;
+}
+
+static void bench_fill_rect(BENCH_IMAGE* image, UINT32 x, UINT32 y, UINT32 w, UINT32 h,
+                            UINT32 color)
+{
+	UINT32 row, col;
+
+	for (row = y; (row < y + h) && (row < image->height); row++)
+	{
+		for (col = x; (col < x + w) && (col < image->width); col++)
+			FreeRDPWriteColor(&image->data[row * image->stride + col * 4], PIXEL_FORMAT_BGRX32,
+			                  color);
+	}
+}
+
+/* Smooth gradients, the best case for the transform codecs */
+static BOOL bench_generate_gradient(BENCH_IMAGE* image, UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+
+	if (!bench_image_alloc(image, "synthetic-gradient", width, height))
+		return FALSE;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			const BYTE r = (BYTE)((x * 255) / width);
+			const BYTE g = (BYTE)((y * 255) / height);
+			const BYTE b = (BYTE)(((x + y) * 255) / (width + height));
+			FreeRDPWriteColor(&image->data[y * image->stride + x * 4], PIXEL_FORMAT_BGRX32,
+			                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, r, g, b, 0xFF));
+		}
+	}
+
+	return TRUE;
+}
+
+/* Uncorrelated pixels, the worst case for every codec */
+static BOOL bench_generate_noise(BENCH_IMAGE* image, UINT32 width, UINT32 height)
+{
+	size_t x;
+	UINT32 seed = 0x5EED;
+
+	if (!bench_image_alloc(image, "synthetic-noise", width, height))
+		return FALSE;
+
+	for (x = 0; x < 1ull * image->stride * height; x++)
+		image->data[x] = (BYTE)bench_rand(&seed);
+
+	return TRUE;
+}
+
+/* Flat windows with text like glyph rows, resembles typical desktop content */
+static BOOL bench_generate_desktop(BENCH_IMAGE* image, UINT32 width, UINT32 height)
+{
+	UINT32 x, y, w;
+	UINT32 seed = 0xDE5C;
+	const UINT32 background = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0x3A, 0x6E, 0xA5, 0xFF);
+	const UINT32 window = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0xF0, 0xF0, 0xF0, 0xFF);
+	const UINT32 title = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0x20, 0x40, 0x80, 0xFF);
+	const UINT32 text = FreeRDPGetColor(PIXEL_FORMAT_BGRX32, 0x10, 0x10, 0x10, 0xFF);
+
+	if (!bench_image_alloc(image, "synthetic-desktop", width, height))
+		return FALSE;
+
+	bench_fill_rect(image, 0, 0, width, height, background);
+
+	for (w = 0; w < 4; w++)
+	{
+		const UINT32 wx = bench_rand(&seed) % (width / 2 + 1);
+		const UINT32 wy = bench_rand(&seed) % (height / 2 + 1);
+		const UINT32 ww = width / 3 + bench_rand(&seed) % (width / 4 + 1);
+		const UINT32 wh = height / 3 + bench_rand(&seed) % (height / 4 + 1);
+
+		bench_fill_rect(image, wx, wy, ww, wh, window);
+		bench_fill_rect(image, wx, wy, ww, 24, title);
+
+		for (y = wy + 32; y + 12 < wy + wh; y += 16)
+		{
+			for (x = wx + 8; x + 8 < wx + ww; x += 7)
+			{
+				/* glyphs are a few random strokes in a 6x10 cell, some cells are blank */
+				if ((bench_rand(&seed) % 8) == 0)
+					continue;
+
+				bench_fill_rect(image, x + bench_rand(&seed) % 3, y, 1, 10, text);
+				bench_fill_rect(image, x, y + bench_rand(&seed) % 10, 5, 1, text);
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL bench_load_image(BENCH_IMAGE* image, const char* path)
+{
+	BOOL rc = FALSE;
+	UINT32 format;
+	const char* name;
+	wImage* img = winpr_image_new();
+
+	if (!img)
+		return FALSE;
+
+	if (winpr_image_read(img, path) <= 0)
+	{
+		fprintf(stderr, "failed to read image %s\n", path);
+		goto fail;
+	}
+
+	switch (img->bitsPerPixel)
+	{
+		case 32:
+			format = PIXEL_FORMAT_BGRX32;
+			break;
+
+		case 24:
+			format = PIXEL_FORMAT_BGR24;
+			break;
+
+		default:
+			fprintf(stderr, "unsupported image depth %" PRIu32 " of %s\n", img->bitsPerPixel,
+			        path);
+			goto fail;
+	}
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	if (!bench_image_alloc(image, name, img->width, img->height))
+		goto fail;
+
+	rc = freerdp_image_copy(image->data, PIXEL_FORMAT_BGRX32, image->stride, 0, 0, img->width,
+	                        img->height, img->data, format, img->scanline, 0, 0, NULL,
+	                        FREERDP_FLIP_NONE);
+
+	if (!rc)
+		bench_image_free(image);
+
+fail:
+	winpr_image_free(img, TRUE);
+	return rc;
+}
+
+static void bench_start(BENCH_CONTEXT* ctx)
+{
+	stopwatch_reset(ctx->sw);
+	stopwatch_start(ctx->sw);
+}
+
+static void bench_stop(BENCH_CONTEXT* ctx, UINT64* samples, size_t round)
+{
+	stopwatch_stop(ctx->sw);
+
+	if (round >= ctx->warmup)
+		samples[round - ctx->warmup] = ctx->sw->elapsed;
+}
+
+static int bench_compare_samples(const void* a, const void* b)
+{
+	const UINT64 va = *(const UINT64*)a;
+	const UINT64 vb = *(const UINT64*)b;
+
+	if (va < vb)
+		return -1;
+
+	return (va > vb) ? 1 : 0;
+}
+
+static void bench_json_string(FILE* out, const char* str)
+{
+	fputc('"', out);
+
+	for (; *str; str++)
+	{
+		if ((*str == '"') || (*str == '\\'))
+			fputc('\\', out);
+
+		if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char)*str);
+		else
+			fputc(*str, out);
+	}
+
+	fputc('"', out);
+}
+
+/**
+ * Writes one result record. The samples are sorted in place.
+ *
+ * @param status "ok", "unsupported" or "failed", the numbers are only written for "ok"
+ */
+static void bench_report(BENCH_CONTEXT* ctx, const char* codec, const char* operation,
+                         const BENCH_IMAGE* image, size_t bytesIn, BOOL pixels, UINT64* samples,
+                         const char* status)
+{
+	FILE* out = ctx->out;
+
+	fprintf(out, "%s\n    { \"codec\": ", ctx->reported ? "," : "");
+	bench_json_string(out, codec);
+	fprintf(out, ", \"operation\": ");
+	bench_json_string(out, operation);
+	fprintf(out, ", \"corpus\": ");
+	bench_json_string(out, image->name);
+	fprintf(out, ", \"width\": %" PRIu32 ", \"height\": %" PRIu32 ", \"status\": ", image->width,
+	        image->height);
+	bench_json_string(out, status);
+
+	if (strcmp(status, "ok") == 0)
+	{
+		size_t x;
+		UINT64 total = 0;
+		double seconds;
+		const size_t n = ctx->iterations;
+
+		qsort(samples, n, sizeof(UINT64), bench_compare_samples);
+
+		for (x = 0; x < n; x++)
+			total += samples[x];
+
+		/* The stopwatch has microsecond resolution, tiny images may run below that */
+		seconds = (total > 0 ? total : 1) / 1000000.0;
+
+		fprintf(out,
+		        ", \"iterations\": %" PRIuz ", \"bytes_in\": %" PRIuz ", \"bytes_out\": %" PRIuz
+		        ", \"mb_per_sec\": %.3f",
+		        n, bytesIn, ctx->bytesOut / n, (1.0 * bytesIn * n) / seconds / 1000000.0);
+
+		if (pixels)
+			fprintf(out, ", \"mpix_per_sec\": %.3f",
+			        (1.0 * image->width * image->height * n) / seconds / 1000000.0);
+
+		fprintf(out,
+		        ", \"p50_us\": %" PRIu64 ", \"p99_us\": %" PRIu64 ", \"min_us\": %" PRIu64
+		        ", \"max_us\": %" PRIu64,
+		        samples[(n - 1) * 50 / 100], samples[(n - 1) * 99 / 100], samples[0],
+		        samples[n - 1]);
+	}
+	else if (strcmp(status, "failed") == 0)
+		ctx->failed = TRUE;
+
+	fprintf(out, " }");
+	ctx->reported++;
+}
+
+static void bench_report_pair(BENCH_CONTEXT* ctx, const char* codec, const BENCH_IMAGE* image,
+                              size_t bytesIn, BOOL pixels, const char* status)
+{
+	const size_t bytesOut = ctx->bytesOut;
+
+	bench_report(ctx, codec, "encode", image, bytesIn, pixels, ctx->encode, status);
+	/* decode rounds consume what the encode rounds produced */
+	bench_report(ctx, codec, "decode", image, bytesIn, pixels, ctx->decode, status);
+	ctx->bytesOut = bytesOut;
+}
+
+static size_t bench_rounds(const BENCH_CONTEXT* ctx)
+{
+	return ctx->warmup + ctx->iterations;
+}
+
+static BOOL bench_rfx(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	size_t round;
+	const char* status = "failed";
+	RFX_CONTEXT* encoder = rfx_context_new(TRUE);
+	RFX_CONTEXT* decoder = rfx_context_new(FALSE);
+	wStream* s = Stream_New(NULL, 1024);
+	BYTE* dst = winpr_aligned_malloc(1ull * image->stride * image->height, 32);
+	const RFX_RECT rect = { 0, 0, (UINT16)image->width, (UINT16)image->height };
+	REGION16 invalid;
+
+	region16_init(&invalid);
+
+	if (!encoder || !decoder || !s || !dst)
+		goto fail;
+
+	if (!rfx_context_reset(encoder, image->width, image->height))
+		goto fail;
+
+	encoder->mode = RLGR3;
+	rfx_context_set_pixel_format(encoder, PIXEL_FORMAT_BGRX32);
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		BOOL rc;
+
+		Stream_SetPosition(s, 0);
+		bench_start(ctx);
+		rc = rfx_compose_message(encoder, s, &rect, 1, image->data, image->width, image->height,
+		                         image->stride);
+		bench_stop(ctx, ctx->encode, round);
+
+		if (!rc)
+			goto fail;
+
+		if (round >= ctx->warmup)
+			ctx->bytesOut += Stream_GetPosition(s);
+
+		bench_start(ctx);
+		rc = rfx_process_message(decoder, Stream_Buffer(s), (UINT32)Stream_GetPosition(s), 0, 0,
+		                         dst, PIXEL_FORMAT_BGRX32, image->stride, image->height, &invalid);
+		bench_stop(ctx, ctx->decode, round);
+
+		if (!rc)
+			goto fail;
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, "rfx", image, 1ull * image->width * image->height * 4, TRUE, status);
+	region16_uninit(&invalid);
+	winpr_aligned_free(dst);
+	Stream_Free(s, TRUE);
+	rfx_context_free(decoder);
+	rfx_context_free(encoder);
+	return TRUE;
+}
+
+static BOOL bench_nsc(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	size_t round;
+	const char* status = "failed";
+	NSC_CONTEXT* encoder = nsc_context_new();
+	NSC_CONTEXT* decoder = nsc_context_new();
+	wStream* s = Stream_New(NULL, 1024);
+	BYTE* dst = winpr_aligned_malloc(1ull * image->stride * image->height, 32);
+
+	if (!encoder || !decoder || !s || !dst)
+		goto fail;
+
+	if (!nsc_context_reset(encoder, image->width, image->height) ||
+	    !nsc_context_set_parameters(encoder, NSC_COLOR_FORMAT, PIXEL_FORMAT_BGRX32))
+		goto fail;
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		BOOL rc;
+
+		Stream_SetPosition(s, 0);
+		bench_start(ctx);
+		rc = nsc_compose_message(encoder, s, image->data, image->width, image->height,
+		                         image->stride);
+		bench_stop(ctx, ctx->encode, round);
+
+		if (!rc)
+			goto fail;
+
+		if (round >= ctx->warmup)
+			ctx->bytesOut += Stream_GetPosition(s);
+
+		bench_start(ctx);
+		rc = nsc_process_message(decoder, 32, image->width, image->height, Stream_Buffer(s),
+		                         (UINT32)Stream_GetPosition(s), dst, PIXEL_FORMAT_BGRX32,
+		                         image->stride, 0, 0, image->width, image->height,
+		                         FREERDP_FLIP_NONE);
+		bench_stop(ctx, ctx->decode, round);
+
+		if (!rc)
+			goto fail;
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, "nsc", image, 1ull * image->width * image->height * 4, TRUE, status);
+	winpr_aligned_free(dst);
+	Stream_Free(s, TRUE);
+	nsc_context_free(decoder);
+	nsc_context_free(encoder);
+	return TRUE;
+}
+
+/* The bitmap update codecs work on 64x64 tiles, like the server does */
+typedef struct
+{
+	UINT32 x;
+	UINT32 y;
+	UINT32 width;
+	UINT32 height;
+	UINT32 size;
+	BYTE* data;
+} BENCH_TILE;
+
+static BENCH_TILE* bench_tiles_new(const BENCH_IMAGE* image, size_t* count)
+{
+	UINT32 x, y;
+	size_t n = 0;
+	const size_t cols = (image->width + BENCH_TILE_SIZE - 1) / BENCH_TILE_SIZE;
+	const size_t rows = (image->height + BENCH_TILE_SIZE - 1) / BENCH_TILE_SIZE;
+	BENCH_TILE* tiles = calloc(cols * rows, sizeof(BENCH_TILE));
+
+	if (!tiles)
+		return NULL;
+
+	for (y = 0; y < image->height; y += BENCH_TILE_SIZE)
+	{
+		for (x = 0; x < image->width; x += BENCH_TILE_SIZE)
+		{
+			BENCH_TILE* tile = &tiles[n];
+			tile->x = x;
+			tile->y = y;
+			tile->width = MIN(BENCH_TILE_SIZE, image->width - x) & ~3u;
+			tile->height = MIN(BENCH_TILE_SIZE, image->height - y);
+
+			/* interleaved needs a width aligned to 4, the server skips smaller slivers */
+			if ((tile->width < 4) || (tile->height < 4))
+				continue;
+
+			if (!(tile->data = malloc(BENCH_TILE_BUFFER_SIZE)))
+				goto fail;
+
+			n++;
+		}
+	}
+
+	*count = n;
+	return tiles;
+fail:
+	for (x = 0; x < n; x++)
+		free(tiles[x].data);
+
+	free(tiles);
+	return NULL;
+}
+
+static void bench_tiles_free(BENCH_TILE* tiles, size_t count)
+{
+	size_t x;
+
+	if (!tiles)
+		return;
+
+	for (x = 0; x < count; x++)
+		free(tiles[x].data);
+
+	free(tiles);
+}
+
+static BOOL bench_planar(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	size_t round, x;
+	size_t count = 0;
+	const char* status = "failed";
+	const DWORD flags = PLANAR_FORMAT_HEADER_RLE | PLANAR_FORMAT_HEADER_NA;
+	BITMAP_PLANAR_CONTEXT* encoder =
+	    freerdp_bitmap_planar_context_new(flags, BENCH_TILE_SIZE, BENCH_TILE_SIZE);
+	BITMAP_PLANAR_CONTEXT* decoder =
+	    freerdp_bitmap_planar_context_new(flags, BENCH_TILE_SIZE, BENCH_TILE_SIZE);
+	BENCH_TILE* tiles = bench_tiles_new(image, &count);
+	BYTE* dst = winpr_aligned_malloc(1ull * image->stride * image->height, 32);
+
+	if (!encoder || !decoder || !tiles || !dst)
+		goto fail;
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		bench_start(ctx);
+
+		for (x = 0; x < count; x++)
+		{
+			BENCH_TILE* tile = &tiles[x];
+			const BYTE* src = &image->data[tile->y * image->stride + tile->x * 4];
+
+			if (!freerdp_bitmap_compress_planar(encoder, src, PIXEL_FORMAT_BGRX32, tile->width,
+			                                    tile->height, image->stride, tile->data,
+			                                    &tile->size))
+				goto fail;
+		}
+
+		bench_stop(ctx, ctx->encode, round);
+		bench_start(ctx);
+
+		for (x = 0; x < count; x++)
+		{
+			const BENCH_TILE* tile = &tiles[x];
+
+			if (!planar_decompress(decoder, tile->data, tile->size, tile->width, tile->height, dst,
+			                       PIXEL_FORMAT_BGRX32, image->stride, tile->x, tile->y,
+			                       tile->width, tile->height, FALSE))
+				goto fail;
+		}
+
+		bench_stop(ctx, ctx->decode, round);
+
+		for (x = 0; (round >= ctx->warmup) && (x < count); x++)
+			ctx->bytesOut += tiles[x].size;
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, "planar", image, 1ull * image->width * image->height * 4, TRUE,
+	                  status);
+	winpr_aligned_free(dst);
+	bench_tiles_free(tiles, count);
+	freerdp_bitmap_planar_context_free(decoder);
+	freerdp_bitmap_planar_context_free(encoder);
+	return TRUE;
+}
+
+static BOOL bench_interleaved(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	size_t round, x;
+	size_t count = 0;
+	const char* status = "failed";
+	const UINT32 bpp = 24;
+	BITMAP_INTERLEAVED_CONTEXT* encoder = bitmap_interleaved_context_new(TRUE);
+	BITMAP_INTERLEAVED_CONTEXT* decoder = bitmap_interleaved_context_new(FALSE);
+	BENCH_TILE* tiles = bench_tiles_new(image, &count);
+	BYTE* dst = winpr_aligned_malloc(1ull * image->stride * image->height, 32);
+
+	if (!encoder || !decoder || !tiles || !dst)
+		goto fail;
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		bench_start(ctx);
+
+		for (x = 0; x < count; x++)
+		{
+			BENCH_TILE* tile = &tiles[x];
+			tile->size = BENCH_TILE_BUFFER_SIZE;
+
+			if (!interleaved_compress(encoder, tile->data, &tile->size, tile->width, tile->height,
+			                          image->data, PIXEL_FORMAT_BGRX32, image->stride, tile->x,
+			                          tile->y, NULL, bpp))
+				goto fail;
+		}
+
+		bench_stop(ctx, ctx->encode, round);
+		bench_start(ctx);
+
+		for (x = 0; x < count; x++)
+		{
+			const BENCH_TILE* tile = &tiles[x];
+
+			if (!interleaved_decompress(decoder, tile->data, tile->size, tile->width,
+			                            tile->height, bpp, dst, PIXEL_FORMAT_BGRX32, image->stride,
+			                            tile->x, tile->y, tile->width, tile->height, NULL))
+				goto fail;
+		}
+
+		bench_stop(ctx, ctx->decode, round);
+
+		for (x = 0; (round >= ctx->warmup) && (x < count); x++)
+			ctx->bytesOut += tiles[x].size;
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, "interleaved", image, 1ull * image->width * image->height * 4, TRUE,
+	                  status);
+	winpr_aligned_free(dst);
+	bench_tiles_free(tiles, count);
+	bitmap_interleaved_context_free(decoder);
+	bitmap_interleaved_context_free(encoder);
+	return TRUE;
+}
+
+static BOOL bench_progressive(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	size_t round;
+	const char* status = "failed";
+	PROGRESSIVE_CONTEXT* encoder = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* decoder = progressive_context_new(FALSE);
+	BYTE* dst = winpr_aligned_malloc(1ull * image->stride * image->height, 32);
+	REGION16 invalid;
+
+	region16_init(&invalid);
+
+	if (!encoder || !decoder || !dst)
+		goto fail;
+
+	if (progressive_create_surface_context(decoder, 0, image->width, image->height) <= 0)
+		goto fail;
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		int rc;
+		BYTE* data = NULL;
+		UINT32 size = 0;
+
+		/* The encoder skips unchanged tiles, start every round from scratch */
+		progressive_context_reset(encoder);
+		bench_start(ctx);
+		rc = progressive_compress(encoder, image->data, image->stride * image->height,
+		                          PIXEL_FORMAT_BGRX32, image->width, image->height, image->stride,
+		                          NULL, &data, &size);
+		bench_stop(ctx, ctx->encode, round);
+
+		if (rc <= 0)
+			goto fail;
+
+		if (round >= ctx->warmup)
+			ctx->bytesOut += size;
+
+		bench_start(ctx);
+		rc = progressive_decompress(decoder, data, size, dst, PIXEL_FORMAT_BGRX32, image->stride,
+		                            0, 0, &invalid, 0, (UINT32)round);
+		bench_stop(ctx, ctx->decode, round);
+
+		if (rc < 0)
+			goto fail;
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, "progressive", image, 1ull * image->width * image->height * 4, TRUE,
+	                  status);
+	region16_uninit(&invalid);
+	winpr_aligned_free(dst);
+	progressive_context_free(decoder);
+	progressive_context_free(encoder);
+	return TRUE;
+}
+
+static BOOL bench_clear(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	size_t round;
+	const char* status = "failed";
+	CLEAR_CONTEXT* encoder = NULL;
+	CLEAR_CONTEXT* decoder = NULL;
+	BYTE* dst = winpr_aligned_malloc(1ull * image->stride * image->height, 32);
+
+	if (!dst)
+		goto fail;
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		int rc;
+		BYTE* data = NULL;
+		UINT32 size = 0;
+
+		/* The vBar and glyph caches would turn every later round into cache hits */
+		clear_context_free(encoder);
+		clear_context_free(decoder);
+		encoder = clear_context_new(TRUE);
+		decoder = clear_context_new(FALSE);
+
+		if (!encoder || !decoder)
+			goto fail;
+
+		bench_start(ctx);
+		rc = clear_compress(encoder, image->data, image->stride * image->height,
+		                    PIXEL_FORMAT_BGRX32, image->width, image->height, image->stride, &data,
+		                    &size);
+		bench_stop(ctx, ctx->encode, round);
+
+		if (rc < 0)
+			goto fail;
+
+		if (round >= ctx->warmup)
+			ctx->bytesOut += size;
+
+		bench_start(ctx);
+		rc = clear_decompress(decoder, data, size, image->width, image->height, dst,
+		                      PIXEL_FORMAT_BGRX32, image->stride, 0, 0, image->width,
+		                      image->height, NULL);
+		bench_stop(ctx, ctx->decode, round);
+
+		if (rc < 0)
+			goto fail;
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, "clear", image, 1ull * image->width * image->height * 4, TRUE, status);
+	winpr_aligned_free(dst);
+	clear_context_free(decoder);
+	clear_context_free(encoder);
+	return TRUE;
+}
+
+static BOOL bench_h264(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image, BOOL avc444)
+{
+	size_t round;
+	const char* codec = avc444 ? "avc444" : "avc420";
+	const char* status = "failed";
+	H264_CONTEXT* encoder = NULL;
+	H264_CONTEXT* decoder = NULL;
+	BYTE* dst = NULL;
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)image->width, (UINT16)image->height };
+
+	/* Without an H264 backend (OpenH264, FFmpeg, ...) the contexts can not be created */
+	encoder = h264_context_new(TRUE);
+	decoder = h264_context_new(FALSE);
+
+	if (!encoder || !decoder)
+	{
+		status = "unsupported";
+		goto fail;
+	}
+
+	if (!h264_context_reset(encoder, image->width, image->height) ||
+	    !h264_context_reset(decoder, image->width, image->height))
+		goto fail;
+
+	if (!(dst = winpr_aligned_malloc(1ull * image->stride * image->height, 32)))
+		goto fail;
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		INT32 rc;
+		BYTE op = 0;
+		BYTE* data = NULL;
+		BYTE* aux = NULL;
+		UINT32 size = 0;
+		UINT32 auxSize = 0;
+		RDPGFX_H264_METABLOCK meta = { 0 };
+		RDPGFX_H264_METABLOCK auxMeta = { 0 };
+
+		bench_start(ctx);
+
+		if (avc444)
+			rc = avc444_compress(encoder, image->data, PIXEL_FORMAT_BGRX32, image->stride,
+			                     image->width, image->height, 1, &rect, &op, &data, &size, &aux,
+			                     &auxSize, &meta, &auxMeta);
+		else
+			rc = avc420_compress(encoder, image->data, PIXEL_FORMAT_BGRX32, image->stride,
+			                     image->width, image->height, &rect, &data, &size, &meta);
+
+		bench_stop(ctx, ctx->encode, round);
+		free_h264_metablock(&meta);
+		free_h264_metablock(&auxMeta);
+
+		if (rc < 0)
+			goto fail;
+
+		if (round >= ctx->warmup)
+			ctx->bytesOut += size + auxSize;
+
+		bench_start(ctx);
+
+		if (avc444)
+			rc = avc444_decompress(decoder, op, &rect, 1, data, size, &rect, 1, aux, auxSize, dst,
+			                       PIXEL_FORMAT_BGRX32, image->stride, image->width,
+			                       image->height, RDPGFX_CODECID_AVC444);
+		else
+			rc = avc420_decompress(decoder, data, size, dst, PIXEL_FORMAT_BGRX32, image->stride,
+			                       image->width, image->height, &rect, 1);
+
+		bench_stop(ctx, ctx->decode, round);
+
+		if (rc < 0)
+			goto fail;
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, codec, image, 1ull * image->width * image->height * 4, TRUE, status);
+	winpr_aligned_free(dst);
+	h264_context_free(decoder);
+	h264_context_free(encoder);
+	return TRUE;
+}
+
+static BOOL bench_avc420(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	return bench_h264(ctx, image, FALSE);
+}
+
+static BOOL bench_avc444(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	return bench_h264(ctx, image, TRUE);
+}
+
+/* The bulk compressors share one signature once wrapped */
+typedef enum
+{
+	BENCH_BULK_MPPC_8K,
+	BENCH_BULK_MPPC_64K,
+	BENCH_BULK_NCRUSH,
+	BENCH_BULK_XCRUSH,
+	BENCH_BULK_ZGFX
+} BENCH_BULK_TYPE;
+
+typedef struct
+{
+	BENCH_BULK_TYPE type;
+	MPPC_CONTEXT* mppc;
+	NCRUSH_CONTEXT* ncrush;
+	XCRUSH_CONTEXT* xcrush;
+	ZGFX_CONTEXT* zgfx;
+} BENCH_BULK;
+
+static BOOL bench_bulk_init(BENCH_BULK* bulk, BENCH_BULK_TYPE type, BOOL compressor)
+{
+	bulk->type = type;
+
+	switch (type)
+	{
+		case BENCH_BULK_MPPC_8K:
+			return (bulk->mppc = mppc_context_new(0, compressor)) != NULL;
+
+		case BENCH_BULK_MPPC_64K:
+			return (bulk->mppc = mppc_context_new(1, compressor)) != NULL;
+
+		case BENCH_BULK_NCRUSH:
+			return (bulk->ncrush = ncrush_context_new(compressor)) != NULL;
+
+		case BENCH_BULK_XCRUSH:
+			return (bulk->xcrush = xcrush_context_new(compressor)) != NULL;
+
+		case BENCH_BULK_ZGFX:
+			return (bulk->zgfx = zgfx_context_new(compressor)) != NULL;
+
+		default:
+			return FALSE;
+	}
+}
+
+static void bench_bulk_uninit(BENCH_BULK* bulk)
+{
+	mppc_context_free(bulk->mppc);
+	ncrush_context_free(bulk->ncrush);
+	xcrush_context_free(bulk->xcrush);
+	zgfx_context_free(bulk->zgfx);
+}
+
+/**
+ * Compresses one chunk into dst, which holds at least BENCH_BULK_BUFFER_SIZE bytes.
+ *
+ * @return the compressed size or -1 on failure
+ */
+static int bench_bulk_compress(BENCH_BULK* bulk, const BYTE* src, UINT32 size, BYTE* dst,
+                               UINT32* flags)
+{
+	int rc = -1;
+	const BYTE* data = NULL;
+	BYTE* zdata = NULL;
+	UINT32 dstSize = BENCH_BULK_BUFFER_SIZE;
+
+	*flags = 0;
+
+	switch (bulk->type)
+	{
+		case BENCH_BULK_MPPC_8K:
+		case BENCH_BULK_MPPC_64K:
+			rc = mppc_compress(bulk->mppc, src, size, dst, &data, &dstSize, flags);
+			break;
+
+		case BENCH_BULK_NCRUSH:
+			rc = ncrush_compress(bulk->ncrush, src, size, dst, &data, &dstSize, flags);
+			break;
+
+		case BENCH_BULK_XCRUSH:
+			rc = xcrush_compress(bulk->xcrush, src, size, dst, &data, &dstSize, flags);
+			break;
+
+		case BENCH_BULK_ZGFX:
+			rc = zgfx_compress(bulk->zgfx, src, size, &zdata, &dstSize, flags);
+			data = zdata;
+			break;
+
+		default:
+			break;
+	}
+
+	if ((rc < 0) || !data || (dstSize > BENCH_BULK_BUFFER_SIZE))
+		rc = -1;
+	else
+	{
+		/* uncompressed chunks point to the source */
+		if (data != dst)
+			memcpy(dst, data, dstSize);
+
+		rc = (int)dstSize;
+	}
+
+	free(zdata);
+	return rc;
+}
+
+static BOOL bench_bulk_decompress(BENCH_BULK* bulk, const BYTE* src, UINT32 size, UINT32 flags,
+                                  const BYTE* expected, UINT32 expectedSize)
+{
+	int rc = -1;
+	BYTE* zdata = NULL;
+	const BYTE* data = NULL;
+	UINT32 dstSize = 0;
+	BOOL equal;
+
+	switch (bulk->type)
+	{
+		case BENCH_BULK_MPPC_8K:
+			rc = mppc_decompress(bulk->mppc, src, size, &data, &dstSize,
+			                     flags | PACKET_COMPR_TYPE_8K);
+			break;
+
+		case BENCH_BULK_MPPC_64K:
+			rc = mppc_decompress(bulk->mppc, src, size, &data, &dstSize,
+			                     flags | PACKET_COMPR_TYPE_64K);
+			break;
+
+		case BENCH_BULK_NCRUSH:
+			rc = ncrush_decompress(bulk->ncrush, src, size, &data, &dstSize,
+			                       flags | PACKET_COMPR_TYPE_RDP6);
+			break;
+
+		case BENCH_BULK_XCRUSH:
+			rc = xcrush_decompress(bulk->xcrush, src, size, &data, &dstSize,
+			                       flags | PACKET_COMPR_TYPE_RDP61);
+			break;
+
+		case BENCH_BULK_ZGFX:
+			rc = zgfx_decompress(bulk->zgfx, src, size, &zdata, &dstSize, flags);
+			data = zdata;
+			break;
+
+		default:
+			break;
+	}
+
+	equal = (rc >= 0) && data && (dstSize == expectedSize) &&
+	        (memcmp(data, expected, expectedSize) == 0);
+	free(zdata);
+	return equal;
+}
+
+static BOOL bench_bulk(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image, BENCH_BULK_TYPE type,
+                       const char* codec)
+{
+	size_t round, x;
+	const char* status = "failed";
+	const size_t length = 1ull * image->stride * image->height;
+	const size_t chunks = (length + BENCH_BULK_CHUNK_SIZE - 1) / BENCH_BULK_CHUNK_SIZE;
+	BENCH_BULK compressor = { 0 };
+	BENCH_BULK decompressor = { 0 };
+	BYTE* out = calloc(chunks, BENCH_BULK_BUFFER_SIZE);
+	UINT32* sizes = calloc(chunks, sizeof(UINT32));
+	UINT32* flags = calloc(chunks, sizeof(UINT32));
+
+	if (!out || !sizes || !flags)
+		goto fail;
+
+	/* The history of both sides runs on through all rounds, like on a connection */
+	if (!bench_bulk_init(&compressor, type, TRUE) || !bench_bulk_init(&decompressor, type, FALSE))
+		goto fail;
+
+	for (round = 0; round < bench_rounds(ctx); round++)
+	{
+		bench_start(ctx);
+
+		for (x = 0; x < chunks; x++)
+		{
+			const size_t offset = x * BENCH_BULK_CHUNK_SIZE;
+			const UINT32 size = (UINT32)MIN(BENCH_BULK_CHUNK_SIZE, length - offset);
+			const int rc = bench_bulk_compress(&compressor, &image->data[offset], size,
+			                                   &out[x * BENCH_BULK_BUFFER_SIZE], &flags[x]);
+
+			if (rc < 0)
+				goto fail;
+
+			sizes[x] = (UINT32)rc;
+		}
+
+		bench_stop(ctx, ctx->encode, round);
+		bench_start(ctx);
+
+		for (x = 0; x < chunks; x++)
+		{
+			const size_t offset = x * BENCH_BULK_CHUNK_SIZE;
+			const UINT32 size = (UINT32)MIN(BENCH_BULK_CHUNK_SIZE, length - offset);
+
+			if (!bench_bulk_decompress(&decompressor, &out[x * BENCH_BULK_BUFFER_SIZE], sizes[x],
+			                           flags[x], &image->data[offset], size))
+				goto fail;
+		}
+
+		bench_stop(ctx, ctx->decode, round);
+
+		for (x = 0; (round >= ctx->warmup) && (x < chunks); x++)
+			ctx->bytesOut += sizes[x];
+	}
+
+	status = "ok";
+fail:
+	bench_report_pair(ctx, codec, image, length, FALSE, status);
+	bench_bulk_uninit(&decompressor);
+	bench_bulk_uninit(&compressor);
+	free(flags);
+	free(sizes);
+	free(out);
+	return TRUE;
+}
+
+static BOOL bench_mppc_8k(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	return bench_bulk(ctx, image, BENCH_BULK_MPPC_8K, "mppc-8k");
+}
+
+static BOOL bench_mppc_64k(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	return bench_bulk(ctx, image, BENCH_BULK_MPPC_64K, "mppc-64k");
+}
+
+static BOOL bench_ncrush(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	return bench_bulk(ctx, image, BENCH_BULK_NCRUSH, "ncrush");
+}
+
+static BOOL bench_xcrush(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	return bench_bulk(ctx, image, BENCH_BULK_XCRUSH, "xcrush");
+}
+
+static BOOL bench_zgfx(BENCH_CONTEXT* ctx, const BENCH_IMAGE* image)
+{
+	return bench_bulk(ctx, image, BENCH_BULK_ZGFX, "zgfx");
+}
+
+static const BENCH_CODEC codecs[] = {
+	{ "rfx", bench_rfx },
+	{ "nsc", bench_nsc },
+	{ "planar", bench_planar },
+	{ "interleaved", bench_interleaved },
+	{ "progressive", bench_progressive },
+	{ "clear", bench_clear },
+	{ "avc420", bench_avc420 },
+	{ "avc444", bench_avc444 },
+	{ "mppc-8k", bench_mppc_8k },
+	{ "mppc-64k", bench_mppc_64k },
+	{ "ncrush", bench_ncrush },
+	{ "xcrush", bench_xcrush },
+	{ "zgfx", bench_zgfx }
+};
+
+static BOOL bench_selected(const BENCH_CONTEXT* ctx, const char* name)
+{
+	const size_t len = strlen(name);
+	const char* cur = ctx->filter;
+
+	if (!cur)
+		return TRUE;
+
+	/* comma separated list of codec names */
+	while ((cur = strstr(cur, name)))
+	{
+		const BOOL start = (cur == ctx->filter) || (cur[-1] == ',');
+		const BOOL end = (cur[len] == '\0') || (cur[len] == ',');
+
+		if (start && end)
+			return TRUE;
+
+		cur += len;
+	}
+
+	return FALSE;
+}
+
+static void bench_usage(const char* name)
+{
+	size_t x;
+
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "  --iterations <n>   measured rounds per codec and image (default 20)\n"
+	        "  --warmup <n>       unmeasured rounds before (default 2)\n"
+	        "  --size <w>x<h>     size of the synthetic images (default 1920x1080)\n"
+	        "  --codecs <list>    comma separated codecs to run (default all)\n"
+	        "  --image <file>     add a recorded image to the corpus, may be repeated\n"
+	        "  --no-samples       do not add the bitmaps shipped with the tests\n"
+	        "  --output <file>    write the JSON report to a file instead of stdout\n"
+	        "  --quick            2 rounds on small synthetic images, for smoke tests\n"
+	        "Codecs:",
+	        name);
+
+	for (x = 0; x < ARRAYSIZE(codecs); x++)
+		fprintf(stderr, " %s", codecs[x].name);
+
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char* argv[])
+{
+	int x;
+	size_t c, i;
+	int rc = -1;
+	BOOL samples = TRUE;
+	UINT32 width = 1920;
+	UINT32 height = 1080;
+	const char* output = NULL;
+	size_t nimages = 0;
+	BENCH_IMAGE* images = calloc((size_t)argc + 6, sizeof(BENCH_IMAGE));
+	BENCH_CONTEXT ctx = { 0 };
+
+	ctx.iterations = 20;
+	ctx.warmup = 2;
+	ctx.out = stdout;
+
+	if (!images)
+		return -1;
+
+	for (x = 1; x < argc; x++)
+	{
+		const char* arg = argv[x];
+		const char* val = (x + 1 < argc) ? argv[x + 1] : NULL;
+
+		if (strcmp(arg, "--quick") == 0)
+		{
+			ctx.iterations = 2;
+			ctx.warmup = 0;
+			width = 256;
+			height = 128;
+			samples = FALSE;
+			continue;
+		}
+		else if (strcmp(arg, "--no-samples") == 0)
+		{
+			samples = FALSE;
+			continue;
+		}
+		else if ((strcmp(arg, "--help") == 0) || (strcmp(arg, "-h") == 0))
+		{
+			bench_usage(argv[0]);
+			rc = 0;
+			goto fail;
+		}
+		else if (!val)
+		{
+			bench_usage(argv[0]);
+			goto fail;
+		}
+		else if (strcmp(arg, "--iterations") == 0)
+			ctx.iterations = strtoul(val, NULL, 0);
+		else if (strcmp(arg, "--warmup") == 0)
+			ctx.warmup = strtoul(val, NULL, 0);
+		else if (strcmp(arg, "--size") == 0)
+		{
+			if (sscanf(val, "%" PRIu32 "x%" PRIu32, &width, &height) != 2)
+			{
+				bench_usage(argv[0]);
+				goto fail;
+			}
+		}
+		else if (strcmp(arg, "--codecs") == 0)
+			ctx.filter = val;
+		else if (strcmp(arg, "--output") == 0)
+			output = val;
+		else if (strcmp(arg, "--image") == 0)
+		{
+			if (!bench_load_image(&images[nimages], val))
+				goto fail;
+
+			nimages++;
+		}
+		else
+		{
+			bench_usage(argv[0]);
+			goto fail;
+		}
+
+		x++;
+	}
+
+	if ((ctx.iterations == 0) || (width < 16) || (height < 16) || (width > UINT16_MAX) ||
+	    (height > UINT16_MAX))
+	{
+		bench_usage(argv[0]);
+		goto fail;
+	}
+
+	if (!bench_generate_desktop(&images[nimages++], width, height) ||
+	    !bench_generate_gradient(&images[nimages++], width, height) ||
+	    !bench_generate_noise(&images[nimages++], width, height))
+		goto fail;
+
+	if (samples)
+	{
+		char path[1024] = { 0 };
+
+		sprintf_s(path, sizeof(path), "%s/progressive.bmp", CMAKE_CURRENT_SOURCE_DIR);
+
+		if (!bench_load_image(&images[nimages], path))
+			goto fail;
+
+		nimages++;
+	}
+
+	ctx.sw = stopwatch_create();
+	ctx.encode = calloc(ctx.iterations, sizeof(UINT64));
+	ctx.decode = calloc(ctx.iterations, sizeof(UINT64));
+
+	if (!ctx.sw || !ctx.encode || !ctx.decode)
+		goto fail;
+
+	if (output && !(ctx.out = winpr_fopen(output, "w")))
+	{
+		fprintf(stderr, "failed to open %s\n", output);
+		ctx.out = stdout;
+		goto fail;
+	}
+
+	fprintf(ctx.out, "{\n  \"benchmark\": \"freerdp-codec\",\n  \"version\": 1,\n");
+	fprintf(ctx.out, "  \"features\": { \"sse2\": %s, \"avx2\": %s, \"neon\": %s },\n",
+	        IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) ? "true" : "false",
+	        IsProcessorFeaturePresentEx(PF_EX_AVX2) ? "true" : "false",
+	        IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE) ? "true" : "false");
+	fprintf(ctx.out, "  \"iterations\": %" PRIuz ",\n  \"warmup\": %" PRIuz ",\n  \"results\": [",
+	        ctx.iterations, ctx.warmup);
+
+	for (c = 0; c < ARRAYSIZE(codecs); c++)
+	{
+		if (!bench_selected(&ctx, codecs[c].name))
+			continue;
+
+		for (i = 0; i < nimages; i++)
+		{
+			ctx.bytesOut = 0;
+
+			if (!codecs[c].fn(&ctx, &images[i]))
+				ctx.failed = TRUE;
+
+			fflush(ctx.out);
+		}
+	}
+
+	fprintf(ctx.out, "\n  ]\n}\n");
+	rc = ctx.failed ? -1 : 0;
+fail:
+	if (ctx.out && (ctx.out != stdout))
+		fclose(ctx.out);
+
+	free(ctx.decode);
+	free(ctx.encode);
+	stopwatch_free(ctx.sw);
+
+	for (i = 0; i < nimages; i++)
+		bench_image_free(&images[i]);
+
+	free(images);
+	return rc;
+}
@@ -1,5 +1,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/crypto.h>
 
 #include <freerdp/codec/clear.h>
 
@@ -71,6 +72,186 @@ fail:
 	return rc;
 }
 
+static void test_ClearFillRect(BYTE* data, UINT32 stride, UINT32 x, UINT32 y, UINT32 width,
+                               UINT32 height, UINT32 color)
+{
+	UINT32 i, j;
+
+	for (j = y; j < y + height; j++)
+	{
+		for (i = x; i < x + width; i++)
+			FreeRDPWriteColor(&data[j * stride + i * 4], PIXEL_FORMAT_BGRX32, color);
+	}
+}
+
+/* Lines of repeated anti-aliased glyphs on a white background, with a toolbar on top */
+static void test_ClearDrawText(BYTE* data, UINT32 width, UINT32 height)
+{
+	UINT32 i, x, y;
+	BYTE glyphs[16][12 * 8];
+	const UINT32 stride = width * 4;
+	const UINT32 shades[8] = { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+		                       0xFFFFFFFF, 0xFFC0C0C0, 0xFF606060, 0xFF000000 };
+
+	winpr_RAND(&glyphs[0][0], sizeof(glyphs));
+	test_ClearFillRect(data, stride, 0, 0, width, height, 0xFFFFFFFF);
+	test_ClearFillRect(data, stride, 0, 0, width, 24, 0xFFD4D0C8);
+	test_ClearFillRect(data, stride, 0, 23, width, 1, 0xFF808080);
+
+	for (x = 4; x + 16 < width; x += 24)
+		test_ClearFillRect(data, stride, x, 4, 16, 16, 0xFF3060A0 + x);
+
+	for (y = 32, i = 0; y + 12 < height; y += 16)
+	{
+		for (x = 8; x + 8 < width; x += 10, i++)
+		{
+			UINT32 gx, gy;
+			const BYTE* glyph = glyphs[(i * 7) % 16];
+
+			if ((i % 11) == 10)
+				continue;
+
+			for (gy = 0; gy < 12; gy++)
+			{
+				for (gx = 0; gx < 8; gx++)
+					FreeRDPWriteColor(&data[(y + gy) * stride + (x + gx) * 4],
+					                  PIXEL_FORMAT_BGRX32, shades[glyph[gy * 8 + gx] % 8]);
+			}
+		}
+	}
+}
+
+static void test_ClearDrawGradient(BYTE* data, UINT32 width, UINT32 height)
+{
+	UINT32 x, y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+			FreeRDPWriteColor(&data[y * width * 4 + x * 4], PIXEL_FORMAT_BGRX32,
+			                  FreeRDPGetColor(PIXEL_FORMAT_BGRX32, x * 255 / width,
+			                                  y * 255 / height, 0x80, 0xFF));
+	}
+}
+
+static UINT32 test_ClearMaxDifference(const BYTE* a, const BYTE* b, UINT32 width, UINT32 height)
+{
+	UINT32 i;
+	UINT32 diff = 0;
+
+	for (i = 0; i < width * height * 4; i++)
+	{
+		if ((i % 4) != 3)
+			diff = MAX(diff, (UINT32)abs((int)a[i] - (int)b[i]));
+	}
+
+	return diff;
+}
+
+static BOOL test_ClearRoundTripFrame(CLEAR_CONTEXT* encoder, CLEAR_CONTEXT* decoder,
+                                     const BYTE* image, UINT32 width, UINT32 height,
+                                     UINT32 maxDifference, UINT32* pSize)
+{
+	BOOL rc = FALSE;
+	int status;
+	UINT32 diff;
+	BYTE* pDstData = NULL;
+	UINT32 DstSize = 0;
+	BYTE* output = calloc(width * height, 4);
+
+	if (!output)
+		return FALSE;
+
+	status = clear_compress(encoder, image, width * height * 4, PIXEL_FORMAT_BGRX32, width,
+	                        height, width * 4, &pDstData, &DstSize);
+
+	if (status < 0)
+	{
+		printf("clear_compress %" PRIu32 "x%" PRIu32 " failed: %d\n", width, height, status);
+		goto fail;
+	}
+
+	status = clear_decompress(decoder, pDstData, DstSize, width, height, output,
+	                          PIXEL_FORMAT_BGRX32, width * 4, 0, 0, width, height, NULL);
+
+	if (status != 0)
+	{
+		printf("clear_decompress %" PRIu32 "x%" PRIu32 " failed: %d\n", width, height, status);
+		goto fail;
+	}
+
+	diff = test_ClearMaxDifference(image, output, width, height);
+	printf("clear %" PRIu32 "x%" PRIu32 ": %" PRIu32 " -> %" PRIu32 " bytes, difference %" PRIu32
+	       "\n",
+	       width, height, width * height * 4, DstSize, diff);
+
+	if (diff > maxDifference)
+		goto fail;
+
+	*pSize = DstSize;
+	rc = TRUE;
+fail:
+	free(output);
+	return rc;
+}
+
+static BOOL test_ClearRoundTrip(void)
+{
+	BOOL rc = FALSE;
+	UINT32 first = 0;
+	UINT32 size = 0;
+	const UINT32 width = 640;
+	const UINT32 height = 200;
+	BYTE* text = calloc(width * height, 4);
+	BYTE* gradient = calloc(width * height, 4);
+	CLEAR_CONTEXT* encoder = clear_context_new(TRUE);
+	CLEAR_CONTEXT* decoder = clear_context_new(FALSE);
+
+	if (!text || !gradient || !encoder || !decoder)
+		goto fail;
+
+	test_ClearDrawText(text, width, height);
+	test_ClearDrawGradient(gradient, width, height);
+
+	/* Bands, RLEX and residual are lossless */
+	if (!test_ClearRoundTripFrame(encoder, decoder, text, width, height, 0, &first))
+		goto fail;
+
+	if (first * 16 > width * height * 4)
+		goto fail;
+
+	/* The second time every vBar is a cache hit */
+	if (!test_ClearRoundTripFrame(encoder, decoder, text, width, height, 0, &size))
+		goto fail;
+
+	if (size >= first)
+		goto fail;
+
+	/* NSCodec is lossy */
+	if (!test_ClearRoundTripFrame(encoder, decoder, gradient, width, height, 16, &size))
+		goto fail;
+
+	if (!test_ClearRoundTripFrame(encoder, decoder, gradient, 17, 13, 0, &size))
+		goto fail;
+
+	/* Small bitmaps are glyphs, the second time only the glyph index is sent */
+	test_ClearDrawText(text, 32, 24);
+
+	if (!test_ClearRoundTripFrame(encoder, decoder, text, 32, 24, 0, &size))
+		goto fail;
+
+	if (!test_ClearRoundTripFrame(encoder, decoder, text, 32, 24, 0, &size) || (size != 4))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	clear_context_free(encoder);
+	clear_context_free(decoder);
+	free(text);
+	free(gradient);
+	return rc;
+}
+
 int TestFreeRDPCodecClear(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -90,5 +271,8 @@ int TestFreeRDPCodecClear(int argc, char* argv[])
 	if (!test_ClearDecompressExample(4, 7, 15, TEST_CLEAR_EXAMPLE_4, sizeof(TEST_CLEAR_EXAMPLE_4)))
 		return -1;
 
+	if (!test_ClearRoundTrip())
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,271 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include <freerdp/codec/h264.h>
+
+/* The rate control is local to the library, it is built into this test and needs no encoder */
+#include "../h264.h"
+
+static void test_init_context(H264_CONTEXT* h264)
+{
+	ZeroMemory(h264, sizeof(H264_CONTEXT));
+	h264->Compressor = TRUE;
+	h264->width = 200;
+	h264->height = 130;
+	h264->QP = 24;
+	h264->FrameRate = 30;
+	h264->BitRate = 1000000;
+	h264->MinQP = 18;
+	h264->MaxQP = 36;
+}
+
+static BOOL test_tile_activity(void)
+{
+	BOOL rc = FALSE;
+	BYTE qp = 0;
+	BYTE last = 0;
+	size_t sent = 0;
+	H264_CONTEXT h264;
+	H264_RATE_CONTROL* ctrl;
+
+	test_init_context(&h264);
+	h264.AdaptiveQP = TRUE;
+
+	if (!h264_rate_control_ensure(&h264))
+		goto fail;
+
+	ctrl = h264.rateControl;
+
+	if ((ctrl->columns != 4) || (ctrl->rows != 3))
+	{
+		fprintf(stderr, "tile map %" PRIu32 "x%" PRIu32 "\n", ctrl->columns, ctrl->rows);
+		goto fail;
+	}
+
+	/* The first frame is sent whole at the best quality */
+	if (h264_rate_control_first_frame(&h264, TRUE) != h264.MinQP)
+		goto fail;
+
+	/* A tile changing every frame drifts towards MaxQP and is always announced */
+	for (size_t x = 0; x < 20; x++)
+	{
+		if (!h264_rate_control_tile(&h264, 5, TRUE, TRUE, &qp) || (qp < last))
+		{
+			fprintf(stderr, "busy tile frame %" PRIuz ": qp %" PRIu8 "\n", x, qp);
+			goto fail;
+		}
+
+		last = qp;
+	}
+
+	if ((qp != h264.MaxQP) || (ctrl->sentQP[5] != h264.MaxQP))
+	{
+		fprintf(stderr, "busy tile ends at qp %" PRIu8 "\n", qp);
+		goto fail;
+	}
+
+	/* The chroma pass of AVC444 reads the history without changing it */
+	if (!h264_rate_control_tile(&h264, 5, TRUE, FALSE, &qp) || (ctrl->activity[5] != UINT8_MAX))
+		goto fail;
+
+	/* Once it settles it is announced exactly once more, at MinQP */
+	for (size_t x = 0; x < 20; x++)
+	{
+		if (!h264_rate_control_tile(&h264, 5, FALSE, TRUE, &qp))
+			continue;
+
+		if (qp != h264.MinQP)
+		{
+			fprintf(stderr, "settled tile resent at qp %" PRIu8 "\n", qp);
+			goto fail;
+		}
+
+		sent++;
+	}
+
+	if ((sent != 1) || (ctrl->sentQP[5] != h264.MinQP))
+	{
+		fprintf(stderr, "settled tile resent %" PRIuz " times\n", sent);
+		goto fail;
+	}
+
+	/* Tiles that never changed were sent with the first frame */
+	if (h264_rate_control_tile(&h264, 0, FALSE, TRUE, &qp))
+		goto fail;
+
+	/* Without AdaptiveQP every changed tile uses QP and nothing is resent */
+	h264.AdaptiveQP = FALSE;
+
+	if (!h264_rate_control_tile(&h264, 6, TRUE, TRUE, &qp) || (qp != h264.QP))
+		goto fail;
+
+	for (size_t x = 0; x < 20; x++)
+	{
+		if (h264_rate_control_tile(&h264, 6, FALSE, TRUE, &qp))
+			goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	h264_rate_control_free(h264.rateControl);
+	return rc;
+}
+
+static BOOL test_bitrate(void)
+{
+	BOOL rc = FALSE;
+	H264_CONTEXT h264;
+	H264_RATE_CONTROL* ctrl;
+
+	test_init_context(&h264);
+
+	if (!h264_rate_control_ensure(&h264))
+		goto fail;
+
+	ctrl = h264.rateControl;
+
+	/* Without a budget the sizes are ignored */
+	h264_rate_control_update(&h264, 1000000);
+
+	if ((ctrl->qpOffset != 0) || (h264_rate_control_region_qp(&h264, 0) != h264.QP))
+		goto fail;
+
+	/* 80 kbit frames against a 33 kbit budget raise QP up to the bound */
+	h264.TargetBitRate = 1000000;
+
+	for (size_t x = 0; x < 30; x++)
+		h264_rate_control_update(&h264, 10000);
+
+	if ((ctrl->qpOffset != 12) || (h264_rate_control_region_qp(&h264, 0) != h264.QP + 12))
+	{
+		fprintf(stderr, "over budget: offset %" PRId32 "\n", ctrl->qpOffset);
+		goto fail;
+	}
+
+	/* Well within budget QP is lowered again, down to the other bound */
+	for (size_t x = 0; x < 100; x++)
+		h264_rate_control_update(&h264, 100);
+
+	if ((ctrl->qpOffset != -12) || (h264_rate_control_region_qp(&h264, 0) != h264.QP - 12))
+	{
+		fprintf(stderr, "within budget: offset %" PRId32 "\n", ctrl->qpOffset);
+		goto fail;
+	}
+
+	/* Adaptive region QPs are corrected by the same offset */
+	h264.AdaptiveQP = TRUE;
+
+	if (h264_rate_control_region_qp(&h264, 0) != h264.MinQP - 12)
+		goto fail;
+
+	h264.TargetBitRate = 0;
+	h264_rate_control_update(&h264, 100);
+
+	if (ctrl->qpOffset != 0)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	h264_rate_control_free(h264.rateControl);
+	return rc;
+}
+
+static UINT32 test_frame_qp(H264_CONTEXT* h264, BOOL auxiliary, BYTE qp1, BYTE qp2)
+{
+	RECTANGLE_16 rects[2] = { { 0, 0, 64, 64 }, { 64, 0, 128, 64 } };
+	RDPGFX_H264_QUANT_QUALITY quality[2] = { 0 };
+	RDPGFX_H264_METABLOCK meta = { 0 };
+
+	quality[0].qp = qp1;
+	quality[1].qp = qp2;
+	meta.numRegionRects = 2;
+	meta.regionRects = rects;
+	meta.quantQualityVals = quality;
+	return h264_rate_control_frame_qp(h264, &meta, auxiliary);
+}
+
+static BOOL test_frame_hysteresis(void)
+{
+	BOOL rc = FALSE;
+	H264_CONTEXT h264;
+	RDPGFX_H264_METABLOCK empty = { 0 };
+
+	test_init_context(&h264);
+
+	if (!h264_rate_control_ensure(&h264))
+		goto fail;
+
+	/* Without regions the configured QP is used */
+	if (h264_rate_control_frame_qp(&h264, &empty, FALSE) != h264.QP)
+		goto fail;
+
+	/* The area weighted mean of the regions */
+	if (test_frame_qp(&h264, FALSE, 20, 40) != 30)
+		goto fail;
+
+	/* Small moves are held for a while, then taken */
+	for (size_t x = 1; x < 8; x++)
+	{
+		if (test_frame_qp(&h264, FALSE, 31, 31) != 30)
+		{
+			fprintf(stderr, "small move taken after %" PRIuz " frames\n", x);
+			goto fail;
+		}
+	}
+
+	if (test_frame_qp(&h264, FALSE, 31, 31) != 31)
+		goto fail;
+
+	/* A small move that does not persist is dropped */
+	for (size_t x = 0; x < 16; x++)
+	{
+		const BYTE qp = (x & 1) ? 32 : 30;
+
+		if (test_frame_qp(&h264, FALSE, qp, qp) != 31)
+		{
+			fprintf(stderr, "alternating QP changed the frame QP\n");
+			goto fail;
+		}
+	}
+
+	/* Large moves are taken at once */
+	if (test_frame_qp(&h264, FALSE, 40, 40) != 40)
+		goto fail;
+
+	if (test_frame_qp(&h264, FALSE, 22, 22) != 22)
+		goto fail;
+
+	/* The AVC444 chroma stream does not disturb the luma one */
+	if (test_frame_qp(&h264, TRUE, 40, 40) != 40)
+		goto fail;
+
+	if (test_frame_qp(&h264, FALSE, 23, 23) != 22)
+		goto fail;
+
+	/* A frame without regions keeps the current QP */
+	if (h264_rate_control_frame_qp(&h264, &empty, FALSE) != 22)
+		goto fail;
+
+	rc = TRUE;
+fail:
+	h264_rate_control_free(h264.rateControl);
+	return rc;
+}
+
+int TestFreeRDPCodecH264RateControl(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_tile_activity())
+		return -1;
+
+	if (!test_bitrate())
+		return -1;
+
+	if (!test_frame_hysteresis())
+		return -1;
+
+	return 0;
+}
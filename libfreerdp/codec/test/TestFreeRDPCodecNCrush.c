@@ -2,6 +2,7 @@
 #include <winpr/print.h>
 
 #include "../ncrush.h"
+#include "bulk_test.h"
 
 static const BYTE TEST_BELLS_DATA[] = "for.whom.the.bell.tolls,.the.bell.tolls.for.thee!";
 
@@ -107,6 +108,38 @@ fail:
 	return rc;
 }
 
+static int test_compress(void* encoder, const BYTE* pSrcData, UINT32 SrcSize, BYTE* pDstBuffer,
+                         const BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
+{
+	return ncrush_compress((NCRUSH_CONTEXT*)encoder, pSrcData, SrcSize, pDstBuffer, ppDstData,
+	                       pDstSize, pFlags);
+}
+
+static int test_decompress(void* decoder, const BYTE* pSrcData, UINT32 SrcSize,
+                           const BYTE** ppDstData, UINT32* pDstSize, UINT32 flags)
+{
+	return ncrush_decompress((NCRUSH_CONTEXT*)decoder, pSrcData, SrcSize, ppDstData, pDstSize,
+	                         flags);
+}
+
+static BOOL test_NCrushRoundtrip(BOOL fast)
+{
+	BOOL rc = FALSE;
+	NCRUSH_CONTEXT* encoder = ncrush_context_new(TRUE);
+	NCRUSH_CONTEXT* decoder = ncrush_context_new(FALSE);
+
+	if (!encoder || !decoder)
+		goto fail;
+
+	ncrush_set_fast_mode(encoder, fast);
+	rc = bulk_test_roundtrip(__FUNCTION__, encoder, decoder, test_compress, test_decompress,
+	                         PACKET_COMPRESSED | PACKET_AT_FRONT | PACKET_FLUSHED);
+fail:
+	ncrush_context_free(encoder);
+	ncrush_context_free(decoder);
+	return rc;
+}
+
 int TestFreeRDPCodecNCrush(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -118,5 +151,8 @@ int TestFreeRDPCodecNCrush(int argc, char* argv[])
 	if (!test_NCrushDecompressBells())
 		return -1;
 
+	if (!test_NCrushRoundtrip(FALSE) || !test_NCrushRoundtrip(TRUE))
+		return -1;
+
 	return 0;
 }
@@ -0,0 +1,243 @@
+#include <freerdp/config.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/codec/nsc.h>
+#include <freerdp/codec/color.h>
+
+/* The row conversions are local to the library, testing builds export them */
+#include "../nsc_types.h"
+#include "../nsc_encode.h"
+#include "../nsc_sse2.h"
+#include "../nsc_avx2.h"
+
+/* Largest per channel difference of an encode/decode round trip with ColorLossLevel 1 */
+#define NSC_TEST_TOLERANCE 2
+
+/**
+ * Fill the image with 2x2 blocks of a single color so chroma subsampling is lossless.
+ * Every other band of 16 rows is flat to get long runs for the RLE.
+ */
+static void fill_image(BYTE* data, UINT32 width, UINT32 height, UINT32 stride, UINT32 seed)
+{
+	UINT32 x;
+	UINT32 y;
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width; x++)
+		{
+			BYTE* pixel = &data[1ull * y * stride + 4ull * x];
+			UINT32 color = seed;
+
+			if (((y / 16) % 2) == 0)
+				color ^= (x / 2) * 2654435761u ^ (y / 2) * 40503u;
+
+			pixel[0] = color & 0xFF;
+			pixel[1] = (color >> 8) & 0xFF;
+			pixel[2] = (color >> 16) & 0xFF;
+			pixel[3] = 0xFF;
+		}
+	}
+}
+
+static BOOL test_roundtrip(UINT32 format, UINT32 width, UINT32 height, BOOL subsampling)
+{
+	BOOL rc = FALSE;
+	UINT32 x;
+	UINT32 y;
+	const UINT32 stride = width * 4 + 16;
+	BYTE* src = calloc(height, stride);
+	BYTE* dst = calloc(height, width * 4ull);
+	wStream* s = Stream_New(NULL, 1024);
+	NSC_CONTEXT* encoder = nsc_context_new();
+	NSC_CONTEXT* decoder = nsc_context_new();
+
+	if (!src || !dst || !s || !encoder || !decoder)
+		goto fail;
+
+	fill_image(src, width, height, stride, width * height);
+
+	if (!nsc_context_set_parameters(encoder, NSC_COLOR_FORMAT, format) ||
+	    !nsc_context_set_parameters(encoder, NSC_COLOR_LOSS_LEVEL, 1) ||
+	    !nsc_context_set_parameters(encoder, NSC_ALLOW_SUBSAMPLING, subsampling ? 1 : 0))
+		goto fail;
+
+	if (!nsc_compose_message(encoder, s, src, width, height, stride))
+	{
+		fprintf(stderr, "nsc_compose_message %" PRIu32 "x%" PRIu32 " failed\n", width, height);
+		goto fail;
+	}
+
+	if (!nsc_context_reset(decoder, width, height) ||
+	    !nsc_process_message(decoder, 32, width, height, Stream_Buffer(s), Stream_GetPosition(s),
+	                         dst, format, width * 4, 0, 0, width, height, FREERDP_FLIP_VERTICAL))
+	{
+		fprintf(stderr, "nsc_process_message %" PRIu32 "x%" PRIu32 " failed\n", width, height);
+		goto fail;
+	}
+
+	for (y = 0; y < height; y++)
+	{
+		for (x = 0; x < width * 4; x++)
+		{
+			const int a = src[1ull * y * stride + x];
+			const int b = dst[1ull * y * width * 4 + x];
+
+			if (((x % 4) != 3) && (abs(a - b) > NSC_TEST_TOLERANCE))
+			{
+				fprintf(stderr,
+				        "%s %" PRIu32 "x%" PRIu32 " subsampling %d: mismatch at %" PRIu32
+				        "x%" PRIu32 " [%d != %d]\n",
+				        FreeRDPGetColorFormatName(format), width, height, subsampling, x / 4, y,
+				        a, b);
+				goto fail;
+			}
+		}
+	}
+
+	rc = TRUE;
+fail:
+	nsc_context_free(encoder);
+	nsc_context_free(decoder);
+	Stream_Free(s, TRUE);
+	free(src);
+	free(dst);
+	return rc;
+}
+
+static BOOL test_compose(NSC_CONTEXT* context, wStream* s, const BYTE* src, UINT32 width,
+                         UINT32 height, UINT32 stride)
+{
+	Stream_SetPosition(s, 0);
+	return nsc_compose_message(context, s, src, width, height, stride);
+}
+
+static BOOL test_compare_streams(wStream* expected, wStream* s, const char* name, UINT32 format,
+                                 UINT32 width, UINT32 height, BOOL subsampling)
+{
+	size_t x;
+	const BYTE* a = Stream_Buffer(expected);
+	const BYTE* b = Stream_Buffer(s);
+
+	if ((Stream_GetPosition(expected) == Stream_GetPosition(s)) &&
+	    (memcmp(a, b, Stream_GetPosition(s)) == 0))
+		return TRUE;
+
+	for (x = 0; x < MIN(Stream_GetPosition(expected), Stream_GetPosition(s)); x++)
+	{
+		if (a[x] != b[x])
+			break;
+	}
+
+	fprintf(stderr,
+	        "%s %s %" PRIu32 "x%" PRIu32 " subsampling %d: differs from generic at byte %" PRIuz
+	        " of %" PRIuz "\n",
+	        name, FreeRDPGetColorFormatName(format), width, height, subsampling, x,
+	        Stream_GetPosition(expected));
+	return FALSE;
+}
+
+/* The SIMD encoders must produce the output of the generic one byte for byte */
+static BOOL test_simd(UINT32 format, UINT32 width, UINT32 height, BOOL subsampling)
+{
+	BOOL rc = FALSE;
+	size_t x;
+	const UINT32 stride = width * FreeRDPGetBytesPerPixel(format) + 16;
+	BYTE* src = calloc(height, stride);
+	wStream* expected = Stream_New(NULL, 1024);
+	wStream* s = Stream_New(NULL, 1024);
+	NSC_CONTEXT* context = nsc_context_new();
+	UINT32 seed = width * 7919 + height;
+
+	if (!src || !expected || !s || !context)
+		goto fail;
+
+	/* Noise, so no two neighbouring pixels are alike and every lane is used */
+	for (x = 0; x < 1ull * height * stride; x++)
+	{
+		seed = seed * 1103515245 + 12345;
+		src[x] = (BYTE)(seed >> 16);
+	}
+
+	if (!nsc_context_set_parameters(context, NSC_COLOR_FORMAT, format) ||
+	    !nsc_context_set_parameters(context, NSC_COLOR_LOSS_LEVEL, 3) ||
+	    !nsc_context_set_parameters(context, NSC_ALLOW_SUBSAMPLING, subsampling ? 1 : 0))
+		goto fail;
+
+	context->encode_rows = nsc_encode_rows;
+	context->subsample_rows = nsc_subsample_rows;
+
+	if (!test_compose(context, expected, src, width, height, stride))
+		goto fail;
+
+#if defined(WITH_SSE2)
+	if (IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE))
+	{
+		nsc_init_sse2(context);
+
+		if (!test_compose(context, s, src, width, height, stride) ||
+		    !test_compare_streams(expected, s, "SSE2", format, width, height, subsampling))
+			goto fail;
+	}
+#endif
+
+#if defined(WITH_AVX2)
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+	{
+		nsc_init_avx2(context);
+
+		if (!test_compose(context, s, src, width, height, stride) ||
+		    !test_compare_streams(expected, s, "AVX2", format, width, height, subsampling))
+			goto fail;
+	}
+#endif
+
+	rc = TRUE;
+fail:
+	nsc_context_free(context);
+	Stream_Free(expected, TRUE);
+	Stream_Free(s, TRUE);
+	free(src);
+	return rc;
+}
+
+int TestFreeRDPCodecNSC(int argc, char* argv[])
+{
+	size_t x;
+	size_t y;
+	const UINT32 formats[] = { PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_RGBX32 };
+	const UINT32 sizes[][2] = { { 2, 2 }, { 17, 10 }, { 333, 202 }, { 1024, 768 } };
+	/* The vector paths cover the 32bpp formats, the others fall back to the generic code */
+	const UINT32 simdFormats[] = { PIXEL_FORMAT_BGRX32, PIXEL_FORMAT_BGRA32, PIXEL_FORMAT_RGBX32,
+		                           PIXEL_FORMAT_RGBA32, PIXEL_FORMAT_BGR24 };
+	const UINT32 simdSizes[][2] = { { 1, 1 }, { 15, 3 }, { 17, 10 }, { 33, 31 }, { 333, 202 },
+		                            { 1024, 768 } };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	for (x = 0; x < ARRAYSIZE(formats); x++)
+	{
+		for (y = 0; y < ARRAYSIZE(sizes); y++)
+		{
+			if (!test_roundtrip(formats[x], sizes[y][0], sizes[y][1], FALSE) ||
+			    !test_roundtrip(formats[x], sizes[y][0], sizes[y][1], TRUE))
+				return -1;
+		}
+	}
+
+	for (x = 0; x < ARRAYSIZE(simdFormats); x++)
+	{
+		for (y = 0; y < ARRAYSIZE(simdSizes); y++)
+		{
+			if (!test_simd(simdFormats[x], simdSizes[y][0], simdSizes[y][1], FALSE) ||
+			    !test_simd(simdFormats[x], simdSizes[y][0], simdSizes[y][1], TRUE))
+				return -1;
+		}
+	}
+
+	return 0;
+}
@@ -5651,6 +5651,65 @@ fail:
 	return rc;
 }
 
+static BOOL RunTestPlanarLarge(DWORD planarFlags, const UINT32 srcFormat)
+{
+	UINT32 x, y;
+	BOOL rc = FALSE;
+	UINT32 compressedSize = 0;
+	const UINT32 width = 517;
+	const UINT32 height = 301;
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(srcFormat);
+	BYTE* compressedBitmap = NULL;
+	BYTE* bmp = calloc(height, width * bpp);
+	BYTE* decompressedBitmap = calloc(height, width * 4ull);
+	BITMAP_PLANAR_CONTEXT* planar = freerdp_bitmap_planar_context_new(planarFlags, width, height);
+	printf("%s: [%s] 0x%02" PRIx32 ": ", __FUNCTION__, FreeRDPGetColorFormatName(srcFormat),
+	       planarFlags);
+	fflush(stdout);
+
+	if (!bmp || !decompressedBitmap || !planar)
+		goto fail;
+
+	/* noise, a flat area and a gradient, large enough to be encoded in bands */
+	winpr_RAND(bmp, 1ull * width * bpp * height / 3);
+
+	for (y = height / 3; y < height; y++)
+	{
+		BYTE* line = &bmp[1ull * width * bpp * y];
+
+		for (x = 0; x < width; x++)
+		{
+			const BYTE v = (y < 2 * height / 3) ? 0x80 : (BYTE)(x + y);
+			FreeRDPWriteColor(line, srcFormat, FreeRDPGetColor(srcFormat, v, v / 2, 0xFF - v, v));
+			line += bpp;
+		}
+	}
+
+	freerdp_planar_topdown_image(planar, TRUE);
+	compressedBitmap = freerdp_bitmap_compress_planar(planar, bmp, srcFormat, width, height, 0,
+	                                                  NULL, &compressedSize);
+
+	if (!compressedBitmap)
+		goto fail;
+
+	if (!planar_decompress(planar, compressedBitmap, compressedSize, width, height,
+	                       decompressedBitmap, PIXEL_FORMAT_BGRA32, 0, 0, 0, width, height, FALSE))
+		goto fail;
+
+	if (!CompareBitmap(decompressedBitmap, PIXEL_FORMAT_BGRA32, bmp, srcFormat, width, height))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	printf("%s\n", rc ? "SUCCESS" : "FAIL");
+	fflush(stdout);
+	freerdp_bitmap_planar_context_free(planar);
+	free(bmp);
+	free(compressedBitmap);
+	free(decompressedBitmap);
+	return rc;
+}
+
 static UINT32 prand(UINT32 max)
 {
 	UINT32 tmp;
@@ -5773,6 +5832,17 @@ int TestFreeRDPCodecPlanar(int argc, char* argv[])
 	if (!FuzzPlanar())
 		return -2;
 
+	if (!RunTestPlanarLarge(PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE,
+	                        PIXEL_FORMAT_BGRX32))
+		return -3;
+
+	if (!RunTestPlanarLarge(PLANAR_FORMAT_HEADER_RLE, PIXEL_FORMAT_BGRA32))
+		return -3;
+
+	if (!RunTestPlanarLarge(PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE,
+	                        PIXEL_FORMAT_RGB16))
+		return -3;
+
 	for (x = 0; x < colorFormatCount; x++)
 	{
 		if (!TestPlanar(colorFormatList[x]))
@@ -1119,6 +1119,108 @@ fail:
 	return res;
 }
 
+static BOOL test_encode_decode_upgrade(const char* path)
+{
+	int x, y;
+	BOOL res = FALSE;
+	int rc;
+	UINT32 frameId = 0;
+	BYTE* resultData = NULL;
+	BYTE* dstData = NULL;
+	UINT32 dstSize = 0;
+	UINT32 ColorFormat = PIXEL_FORMAT_BGRX32;
+	REGION16 invalidRegion = { 0 };
+	REGION16 finalRegion = { 0 };
+	const RECTANGLE_16* extents;
+	wImage* image = winpr_image_new();
+	char* name = GetCombinedPath(path, "progressive.bmp");
+	PROGRESSIVE_CONTEXT* progressiveEnc = progressive_context_new(TRUE);
+	PROGRESSIVE_CONTEXT* progressiveDec = progressive_context_new(FALSE);
+
+	region16_init(&invalidRegion);
+	region16_init(&finalRegion);
+	if (!image || !name || !progressiveEnc || !progressiveDec)
+		goto fail;
+
+	if (!progressive_context_set_upgrades(progressiveEnc, TRUE))
+		goto fail;
+
+	rc = winpr_image_read(image, name);
+	if (rc <= 0)
+		goto fail;
+
+	resultData = calloc(image->scanline, image->height);
+	if (!resultData)
+		goto fail;
+
+	rc = progressive_create_surface_context(progressiveDec, 0, image->width, image->height);
+	if (rc <= 0)
+		goto fail;
+
+	// First pass
+	rc = progressive_compress(progressiveEnc, image->data, image->scanline * image->height,
+	                          ColorFormat, image->width, image->height, image->scanline, NULL,
+	                          &dstData, &dstSize);
+	if (rc <= 0)
+		goto fail;
+
+	if (progressive_compress_pending(progressiveEnc) == 0)
+		goto fail;
+
+	rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, ColorFormat,
+	                            image->scanline, 0, 0, &invalidRegion, 0, frameId++);
+	if (rc < 0)
+		goto fail;
+
+	// Upgrade passes until all tiles reached the full quality
+	while ((rc = progressive_compress_upgrade(progressiveEnc, &finalRegion, &dstData, &dstSize)) >
+	       0)
+	{
+		rc = progressive_decompress(progressiveDec, dstData, dstSize, resultData, ColorFormat,
+		                            image->scanline, 0, 0, &invalidRegion, 0, frameId++);
+		if (rc < 0)
+			goto fail;
+	}
+
+	if ((rc < 0) || (progressive_compress_pending(progressiveEnc) != 0) || (frameId != 3))
+		goto fail;
+
+	extents = region16_extents(&finalRegion);
+	if ((extents->left != 0) || (extents->top != 0) || (extents->right != image->width) ||
+	    (extents->bottom != image->height))
+		goto fail;
+
+	// Compare result
+	for (y = 0; y < image->height; y++)
+	{
+		const BYTE* orig = &image->data[y * image->scanline];
+		const BYTE* dec = &resultData[y * image->scanline];
+		for (x = 0; x < image->width; x++)
+		{
+			const BYTE* po = &orig[x * 4];
+			const BYTE* pd = &dec[x * 4];
+
+			const DWORD a = FreeRDPReadColor(po, ColorFormat);
+			const DWORD b = FreeRDPReadColor(pd, ColorFormat);
+			if (!colordiff(ColorFormat, a, b))
+			{
+				printf("xxxxxxx [%u:%u] %08X != %08X\n", x, y, a, b);
+				goto fail;
+			}
+		}
+	}
+	res = TRUE;
+fail:
+	region16_uninit(&invalidRegion);
+	region16_uninit(&finalRegion);
+	progressive_context_free(progressiveEnc);
+	progressive_context_free(progressiveDec);
+	winpr_image_free(image, TRUE);
+	free(resultData);
+	free(name);
+	return res;
+}
+
 int TestFreeRDPCodecProgressive(int argc, char* argv[])
 {
 	int rc = -1;
@@ -1150,6 +1252,8 @@ int TestFreeRDPCodecProgressive(int argc, char* argv[])
 		    */
 		if (!test_encode_decode(ms_sample_path))
 			goto fail;
+		if (!test_encode_decode_upgrade(ms_sample_path))
+			goto fail;
 		rc = 0;
 	}
 
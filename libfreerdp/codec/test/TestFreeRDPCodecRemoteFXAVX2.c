@@ -0,0 +1,148 @@
+#include <winpr/crt.h>
+#include <winpr/print.h>
+#include <winpr/crypto.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/codec/rfx.h>
+
+/* The generic routines are built into this test, the library only exports the context */
+#include "../rfx_dwt.h"
+#include "../rfx_quantization.h"
+
+#define TEST_TILE_SIZE (64 * 64)
+#define TEST_TILE_COUNT 64
+
+static void test_random_tile(INT16* tile)
+{
+	winpr_RAND((BYTE*)tile, TEST_TILE_SIZE * sizeof(INT16));
+
+	/* Color converted samples are 11.5 fixed point values in [-4096, 4095] */
+	for (size_t i = 0; i < TEST_TILE_SIZE; i++)
+		tile[i] = (INT16)(tile[i] >> 3);
+}
+
+static void test_random_quant(UINT32* quant)
+{
+	BYTE values[10] = { 0 };
+	winpr_RAND(values, sizeof(values));
+
+	/* Valid quantization values are 6 to 15 */
+	for (size_t i = 0; i < ARRAYSIZE(values); i++)
+		quant[i] = 6 + values[i] % 10;
+}
+
+static BOOL test_compare(const INT16* generic, const INT16* avx2, size_t count, const char* what,
+                         size_t tile)
+{
+	if (memcmp(generic, avx2, count * sizeof(INT16)) == 0)
+		return TRUE;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (generic[i] != avx2[i])
+		{
+			printf("%s: tile %" PRIuz " differs at %" PRIuz ": %" PRId16 " != %" PRId16 "\n", what,
+			       tile, i, generic[i], avx2[i]);
+			break;
+		}
+	}
+
+	return FALSE;
+}
+
+static BOOL test_encode(RFX_CONTEXT* context, INT16* generic, INT16* avx2, INT16* dwt)
+{
+	UINT32 quant[10] = { 0 };
+
+	for (size_t tile = 0; tile < TEST_TILE_COUNT; tile++)
+	{
+		test_random_tile(generic);
+		test_random_quant(quant);
+		CopyMemory(avx2, generic, TEST_TILE_SIZE * sizeof(INT16));
+
+		rfx_dwt_2d_encode(generic, dwt);
+		context->dwt_2d_encode(avx2, dwt);
+
+		if (!test_compare(generic, avx2, TEST_TILE_SIZE, "dwt_2d_encode", tile))
+			return FALSE;
+
+		rfx_quantization_encode(generic, quant);
+		context->quantization_encode(avx2, quant);
+
+		if (!test_compare(generic, avx2, TEST_TILE_SIZE, "quantization_encode", tile))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_decode(RFX_CONTEXT* context, INT16* generic, INT16* avx2, INT16* dwt)
+{
+	UINT32 quant[10] = { 0 };
+
+	for (size_t tile = 0; tile < TEST_TILE_COUNT; tile++)
+	{
+		/* Decode coefficients an encoder produced, random ones overflow the 16 bit range */
+		test_random_tile(generic);
+		test_random_quant(quant);
+		rfx_dwt_2d_encode(generic, dwt);
+		rfx_quantization_encode(generic, quant);
+		CopyMemory(avx2, generic, TEST_TILE_SIZE * sizeof(INT16));
+
+		rfx_quantization_decode(generic, quant);
+		context->quantization_decode(avx2, quant);
+
+		if (!test_compare(generic, avx2, TEST_TILE_SIZE, "quantization_decode", tile))
+			return FALSE;
+
+		rfx_dwt_2d_decode(generic, dwt);
+		context->dwt_2d_decode(avx2, dwt);
+
+		if (!test_compare(generic, avx2, TEST_TILE_SIZE, "dwt_2d_decode", tile))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+int TestFreeRDPCodecRemoteFXAVX2(int argc, char* argv[])
+{
+	int rc = -1;
+	RFX_CONTEXT* context = NULL;
+	INT16* generic = NULL;
+	INT16* avx2 = NULL;
+	INT16* dwt = NULL;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!IsProcessorFeaturePresentEx(PF_EX_AVX2))
+	{
+		printf("AVX2 not available, skipping\n");
+		return 0;
+	}
+
+	/* With AVX2 present the context routines are the AVX2 ones */
+	context = rfx_context_new(TRUE);
+	generic = winpr_aligned_malloc(TEST_TILE_SIZE * sizeof(INT16), 32);
+	avx2 = winpr_aligned_malloc(TEST_TILE_SIZE * sizeof(INT16), 32);
+	dwt = winpr_aligned_malloc(2 * TEST_TILE_SIZE * sizeof(INT16), 32);
+
+	if (!context || !generic || !avx2 || !dwt)
+		goto fail;
+
+	if (!test_encode(context, generic, avx2, dwt))
+		goto fail;
+
+	if (!test_decode(context, generic, avx2, dwt))
+		goto fail;
+
+	rc = 0;
+fail:
+	winpr_aligned_free(generic);
+	winpr_aligned_free(avx2);
+	winpr_aligned_free(dwt);
+	rfx_context_free(context);
+	return rc;
+}
@@ -2,7 +2,10 @@
 #include <winpr/print.h>
 
 #include "../xcrush.h"
+#include "bulk_test.h"
 
+/* The encoder does not produce this output, see the disabled test below */
+#if 0
 static const BYTE TEST_BELLS_DATA[] = "for.whom.the.bell.tolls,.the.bell.tolls.for.thee!";
 
 static const BYTE TEST_BELLS_DATA_XCRUSH[] =
@@ -10,6 +13,7 @@ static const BYTE TEST_BELLS_DATA_XCRUSH[] =
     "\x65\x6c\x6c\x2e\x74\x6f\x6c\x6c\x73\x2c\x2e\x74\x68\x65\x2e\x62"
     "\x65\x6c\x6c\x2e\x74\x6f\x6c\x6c\x73\x2e\x66\x6f\x72\x2e\x74\x68"
     "\x65";
+#endif
 
 static const BYTE TEST_ISLAND_DATA[] = "No man is an island entire of itself; every man "
                                        "is a piece of the continent, a part of the main; "
@@ -111,6 +115,38 @@ static const struct test_argument tests[] = {
 #endif
 };
 
+static int test_compress(void* encoder, const BYTE* pSrcData, UINT32 SrcSize, BYTE* pDstBuffer,
+                         const BYTE** ppDstData, UINT32* pDstSize, UINT32* pFlags)
+{
+	return xcrush_compress((XCRUSH_CONTEXT*)encoder, pSrcData, SrcSize, pDstBuffer, ppDstData,
+	                       pDstSize, pFlags);
+}
+
+static int test_decompress(void* decoder, const BYTE* pSrcData, UINT32 SrcSize,
+                           const BYTE** ppDstData, UINT32* pDstSize, UINT32 flags)
+{
+	return xcrush_decompress((XCRUSH_CONTEXT*)decoder, pSrcData, SrcSize, ppDstData, pDstSize,
+	                         flags);
+}
+
+static BOOL test_roundtrip(BOOL fast)
+{
+	BOOL rc = FALSE;
+	XCRUSH_CONTEXT* encoder = xcrush_context_new(TRUE);
+	XCRUSH_CONTEXT* decoder = xcrush_context_new(FALSE);
+
+	if (!encoder || !decoder)
+		goto fail;
+
+	xcrush_set_fast_mode(encoder, fast);
+	rc = bulk_test_roundtrip(__FUNCTION__, encoder, decoder, test_compress, test_decompress,
+	                         PACKET_COMPRESSED);
+fail:
+	xcrush_context_free(encoder);
+	xcrush_context_free(decoder);
+	return rc;
+}
+
 int TestFreeRDPCodecXCrush(int argc, char* argv[])
 {
 	int rc = 0;
@@ -127,5 +163,8 @@ int TestFreeRDPCodecXCrush(int argc, char* argv[])
 			rc = -1;
 	}
 
+	if (!test_roundtrip(FALSE) || !test_roundtrip(TRUE))
+		rc = -1;
+
 	return rc;
 }
@@ -1,5 +1,6 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
+#include <winpr/crypto.h>
 #include <winpr/bitstream.h>
 
 #include <freerdp/freerdp.h>
@@ -253,6 +254,104 @@ fail:
 	return rc;
 }
 
+static BOOL test_ZGfxRoundTrip(ZGFX_CONTEXT* compressor, ZGFX_CONTEXT* decompressor,
+                               const BYTE* pSrcData, UINT32 SrcSize, UINT32* pCompressedSize)
+{
+	BOOL rc = FALSE;
+	UINT32 Flags = 0;
+	UINT32 DstSize = 0;
+	UINT32 OutSize = 0;
+	BYTE* pDstData = NULL;
+	BYTE* pOutData = NULL;
+
+	if (zgfx_compress(compressor, pSrcData, SrcSize, &pDstData, &DstSize, &Flags) < 0)
+		goto fail;
+
+	if (zgfx_decompress(decompressor, pDstData, DstSize, &pOutData, &OutSize, 0) < 0)
+		goto fail;
+
+	if ((OutSize != SrcSize) || (memcmp(pOutData, pSrcData, SrcSize) != 0))
+	{
+		printf("test_ZGfxCompressRoundTrip: output mismatch, size %" PRIu32 "/%" PRIu32 "\n",
+		       OutSize, SrcSize);
+		goto fail;
+	}
+
+	*pCompressedSize += DstSize;
+	rc = TRUE;
+fail:
+	free(pDstData);
+	free(pOutData);
+	return rc;
+}
+
+static int test_ZGfxCompressRoundTrip(void)
+{
+	int rc = -1;
+	UINT32 x;
+	UINT32 level;
+	const UINT32 size = 200000;
+	BYTE* text = malloc(size);
+	BYTE* noise = malloc(size);
+	BYTE* pixels = malloc(size);
+
+	if (!text || !noise || !pixels)
+		goto fail;
+
+	/* Repetitive text, random bytes and pixel rows repeating with small changes */
+	winpr_RAND(noise, size);
+
+	for (x = 0; x < size; x++)
+	{
+		text[x] = TEST_FOX_DATA[(x * 7 / 5) % (sizeof(TEST_FOX_DATA) - 1)];
+		pixels[x] = (BYTE)(((x % 4096) / 16) ^ ((x % 997) == 0 ? noise[x] : 0));
+	}
+
+	for (level = 0; level <= ZGFX_COMPRESSION_LEVEL_MAX; level++)
+	{
+		UINT32 compressed = 0;
+		const UINT32 total = 2 * size + 2 * 4000 + 1;
+		ZGFX_CONTEXT* compressor = zgfx_context_new(TRUE);
+		ZGFX_CONTEXT* decompressor = zgfx_context_new(FALSE);
+
+		if (!compressor || !decompressor || !zgfx_context_set_compression_level(compressor, level))
+			goto fail_level;
+
+		/* Multipart PDUs, single segment PDUs repeating earlier data and a tiny PDU */
+		if (!test_ZGfxRoundTrip(compressor, decompressor, text, size, &compressed) ||
+		    !test_ZGfxRoundTrip(compressor, decompressor, noise, 4000, &compressed) ||
+		    !test_ZGfxRoundTrip(compressor, decompressor, pixels, size, &compressed) ||
+		    !test_ZGfxRoundTrip(compressor, decompressor, noise, 4000, &compressed) ||
+		    !test_ZGfxRoundTrip(compressor, decompressor, text, 1, &compressed))
+			goto fail_level;
+
+		printf("level %" PRIu32 ": %" PRIu32 " -> %" PRIu32 " bytes\n", level, total, compressed);
+
+		/* Segments never grow beyond their headers, repeated data compresses well */
+		if ((level == 0) && (compressed < total))
+			goto fail_level;
+
+		if ((level > 0) && (compressed > total / 4))
+			goto fail_level;
+
+		zgfx_context_free(compressor);
+		zgfx_context_free(decompressor);
+		continue;
+	fail_level:
+		printf("test_ZGfxCompressRoundTrip: level %" PRIu32 " failed\n", level);
+		zgfx_context_free(compressor);
+		zgfx_context_free(decompressor);
+		goto fail;
+	}
+
+	rc = 0;
+fail:
+	free(text);
+	free(noise);
+	free(pixels);
+	return rc;
+}
+
 int TestFreeRDPCodecZGfx(int argc, char* argv[])
 {
 	WINPR_UNUSED(argc);
@@ -270,5 +369,8 @@ int TestFreeRDPCodecZGfx(int argc, char* argv[])
 	if (test_ZGfxCompressConsistent() < 0)
 		return -1;
 
+	if (test_ZGfxCompressRoundTrip() < 0)
+		return -1;
+
 	return 0;
 }
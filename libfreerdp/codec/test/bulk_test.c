@@ -0,0 +1,99 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Bulk Compression Test Helpers
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include "bulk_test.h"
+
+#define BULK_TEST_PACKETS 300
+#define BULK_TEST_MAX_PACKET 16000
+#define BULK_TEST_MIN_PACKET 200
+
+void bulk_test_fill_packet(BYTE* data, UINT32 size, UINT32* seed)
+{
+	UINT32 x;
+	static const char* words[] = { "the ", "bell ", "tolls ", "for ", "thee, ", "no ", "man ",
+		                           "is ", "an ", "island ", "entire ", "of ", "itself; " };
+
+	for (x = 0; x < size;)
+	{
+		const char* word;
+		size_t len;
+		*seed = *seed * 1103515245 + 12345;
+		word = words[(*seed >> 16) % ARRAYSIZE(words)];
+		len = strnlen(word, 16);
+
+		if (len > size - x)
+			len = size - x;
+
+		memcpy(&data[x], word, len);
+		x += (UINT32)len;
+	}
+}
+
+BOOL bulk_test_roundtrip(const char* name, void* encoder, void* decoder,
+                         bulk_test_compress_fn compress, bulk_test_decompress_fn decompress,
+                         UINT32 decompressFlags)
+{
+	UINT32 x;
+	UINT32 seed = 42;
+	BYTE src[BULK_TEST_MAX_PACKET] = { 0 };
+	BYTE OutputBuffer[65536] = { 0 };
+
+	for (x = 0; x < BULK_TEST_PACKETS; x++)
+	{
+		UINT32 Flags = 0;
+		const BYTE* pDstData = NULL;
+		const BYTE* pPlainData = NULL;
+		UINT32 DstSize = sizeof(OutputBuffer);
+		UINT32 PlainSize = 0;
+		const UINT32 size =
+		    BULK_TEST_MIN_PACKET + (x * 977) % (BULK_TEST_MAX_PACKET - BULK_TEST_MIN_PACKET);
+
+		bulk_test_fill_packet(src, size, &seed);
+
+		if (compress(encoder, src, size, OutputBuffer, &pDstData, &DstSize, &Flags) < 0)
+		{
+			printf("%s: packet %" PRIu32 " failed to compress\n", name, x);
+			return FALSE;
+		}
+
+		if (Flags & decompressFlags)
+		{
+			if (decompress(decoder, pDstData, DstSize, &pPlainData, &PlainSize, Flags) < 0)
+			{
+				printf("%s: packet %" PRIu32 " failed to decompress\n", name, x);
+				return FALSE;
+			}
+		}
+		else
+		{
+			pPlainData = pDstData;
+			PlainSize = DstSize;
+		}
+
+		if ((PlainSize != size) || (memcmp(pPlainData, src, size) != 0))
+		{
+			printf("%s: packet %" PRIu32 " mismatch\n", name, x);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,38 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * Bulk Compression Test Helpers
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_LIB_CODEC_TEST_BULK_TEST_H
+#define FREERDP_LIB_CODEC_TEST_BULK_TEST_H
+
+#include <winpr/wtypes.h>
+
+typedef int (*bulk_test_compress_fn)(void* encoder, const BYTE* pSrcData, UINT32 SrcSize,
+                                     BYTE* pDstBuffer, const BYTE** ppDstData, UINT32* pDstSize,
+                                     UINT32* pFlags);
+typedef int (*bulk_test_decompress_fn)(void* decoder, const BYTE* pSrcData, UINT32 SrcSize,
+                                       const BYTE** ppDstData, UINT32* pDstSize, UINT32 flags);
+
+/* Text like packets that repeat parts of earlier packets */
+void bulk_test_fill_packet(BYTE* data, UINT32 size, UINT32* seed);
+
+/* Compresses a stream of packets of varying size and checks that each one decompresses to the
+ * original. Packets without any of the decompressFlags set are passed through as they are. */
+BOOL bulk_test_roundtrip(const char* name, void* encoder, void* decoder,
+                         bulk_test_compress_fn compress, bulk_test_decompress_fn decompress,
+                         UINT32 decompressFlags);
+
+#endif /* FREERDP_LIB_CODEC_TEST_BULK_TEST_H */
@@ -25,10 +25,15 @@
 #include <winpr/crt.h>
 #include <winpr/print.h>
 #include <winpr/bitstream.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
 #include "xcrush.h"
 
+#if defined(WITH_SSE2)
+#include "bulk_sse2.h"
+#endif
+
 #define TAG FREERDP_TAG("codec")
 
 #pragma pack(push, 1)
@@ -73,6 +78,7 @@ typedef struct
 struct s_XCRUSH_CONTEXT
 {
 	ALIGN64 BOOL Compressor;
+	ALIGN64 BOOL Fast;
 	ALIGN64 MPPC_CONTEXT* mppc;
 	ALIGN64 BYTE* HistoryPtr;
 	ALIGN64 UINT32 HistoryOffset;
@@ -93,6 +99,22 @@ struct s_XCRUSH_CONTEXT
 	ALIGN64 XCRUSH_MATCH_INFO OptimizedMatches[1000];
 };
 
+static BOOL g_XCrushSSE2 = FALSE;
+
+static INIT_ONCE xcrush_init_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK xcrush_init(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+
+#if defined(WITH_SSE2)
+	g_XCrushSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+	return TRUE;
+}
+
 //#define DEBUG_XCRUSH 1
 #if defined(DEBUG_XCRUSH)
 static const char* xcrush_get_level_2_compression_flags_string(UINT32 flags)
@@ -214,24 +236,13 @@ static int xcrush_append_chunk(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT32*
 	return 1;
 }
 
-static int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT32 size,
-                                 UINT32* pIndex)
+static int xcrush_scan_chunks(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT32 size,
+                              UINT32* offset)
 {
 	UINT32 i = 0;
-	UINT32 offset = 0;
 	UINT32 rotation = 0;
 	UINT32 accumulator = 0;
 
-	WINPR_ASSERT(xcrush);
-	WINPR_ASSERT(data);
-	WINPR_ASSERT(pIndex);
-
-	*pIndex = 0;
-	xcrush->SignatureIndex = 0;
-
-	if (size < 128)
-		return 0;
-
 	for (i = 0; i < 32; i++)
 	{
 		rotation = _rotl(accumulator, 1);
@@ -245,7 +256,7 @@ static int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT3
 
 		if (!(accumulator & 0x7F))
 		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
+			if (!xcrush_append_chunk(xcrush, data, offset, i + 32))
 				return 0;
 		}
 
@@ -255,7 +266,7 @@ static int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT3
 
 		if (!(accumulator & 0x7F))
 		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
+			if (!xcrush_append_chunk(xcrush, data, offset, i + 32))
 				return 0;
 		}
 
@@ -265,7 +276,7 @@ static int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT3
 
 		if (!(accumulator & 0x7F))
 		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
+			if (!xcrush_append_chunk(xcrush, data, offset, i + 32))
 				return 0;
 		}
 
@@ -275,11 +286,67 @@ static int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT3
 
 		if (!(accumulator & 0x7F))
 		{
-			if (!xcrush_append_chunk(xcrush, data, &offset, i + 32))
+			if (!xcrush_append_chunk(xcrush, data, offset, i + 32))
 				return 0;
 		}
 	}
 
+	return 1;
+}
+
+#if defined(WITH_SSE2)
+/* Same boundaries as xcrush_scan_chunks, the hash is evaluated for 16 positions at once */
+static int xcrush_scan_chunks_sse2(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT32 size,
+                                   UINT32* offset)
+{
+	UINT32 i = 0;
+	UINT32 boundaries[256];
+	/* the scalar loop scans 4 positions per round */
+	const UINT32 end = (size - 64 + 3) & ~3u;
+
+	while (i < end)
+	{
+		UINT32 x;
+		const UINT32 count =
+		    bulk_chunk_boundaries_sse2(data, &i, end, boundaries, ARRAYSIZE(boundaries));
+
+		for (x = 0; x < count; x++)
+		{
+			if (!xcrush_append_chunk(xcrush, data, offset, boundaries[x] + 32))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+#endif
+
+static int xcrush_compute_chunks(XCRUSH_CONTEXT* xcrush, const BYTE* data, UINT32 size,
+                                 UINT32* pIndex)
+{
+	int status;
+	UINT32 offset = 0;
+
+	WINPR_ASSERT(xcrush);
+	WINPR_ASSERT(data);
+	WINPR_ASSERT(pIndex);
+
+	*pIndex = 0;
+	xcrush->SignatureIndex = 0;
+
+	if (size < 128)
+		return 0;
+
+#if defined(WITH_SSE2)
+	if (g_XCrushSSE2)
+		status = xcrush_scan_chunks_sse2(xcrush, data, size, &offset);
+	else
+#endif
+		status = xcrush_scan_chunks(xcrush, data, size, &offset);
+
+	if (!status)
+		return 0;
+
 	if ((size == offset) || xcrush_append_chunk(xcrush, data, &offset, size))
 	{
 		*pIndex = xcrush->SignatureIndex;
@@ -405,18 +472,29 @@ static int xcrush_insert_chunk(XCRUSH_CONTEXT* xcrush, XCRUSH_SIGNATURE* signatu
 	return 1;
 }
 
+static INLINE UINT32 xcrush_match_length(const BYTE* a, const BYTE* b, size_t max)
+{
+	size_t length = 0;
+
+#if defined(WITH_SSE2)
+	if (g_XCrushSSE2)
+		return (UINT32)bulk_match_length_sse2(a, b, max);
+#endif
+
+	while ((length < max) && (a[length] == b[length]))
+		length++;
+
+	return (UINT32)length;
+}
+
 static int xcrush_find_match_length(XCRUSH_CONTEXT* xcrush, UINT32 MatchOffset, UINT32 ChunkOffset,
                                     UINT32 HistoryOffset, UINT32 SrcSize, UINT32 MaxMatchLength,
                                     XCRUSH_MATCH_INFO* MatchInfo)
 {
-	UINT32 MatchSymbol;
-	UINT32 ChunkSymbol;
 	BYTE* ChunkBuffer;
 	BYTE* MatchBuffer;
 	BYTE* MatchStartPtr;
-	BYTE* ForwardChunkPtr;
 	BYTE* ReverseChunkPtr;
-	BYTE* ForwardMatchPtr;
 	BYTE* ReverseMatchPtr;
 	BYTE* HistoryBufferEnd;
 	UINT32 ReverseMatchLength = 0;
@@ -451,28 +529,15 @@ static int xcrush_find_match_length(XCRUSH_CONTEXT* xcrush, UINT32 MatchOffset,
 	if (ChunkBuffer < HistoryBuffer)
 		return -2005; /* error */
 
-	ForwardMatchPtr = &HistoryBuffer[MatchOffset];
-	ForwardChunkPtr = &HistoryBuffer[ChunkOffset];
-
 	if ((&MatchBuffer[MaxMatchLength + 1] < HistoryBufferEnd) &&
 	    (MatchBuffer[MaxMatchLength + 1] != ChunkBuffer[MaxMatchLength + 1]))
 	{
 		return 0;
 	}
 
-	while (1)
-	{
-		MatchSymbol = *ForwardMatchPtr++;
-		ChunkSymbol = *ForwardChunkPtr++;
-
-		if (MatchSymbol != ChunkSymbol)
-			break;
-
-		if (ForwardMatchPtr > HistoryBufferEnd)
-			break;
-
-		ForwardMatchLength++;
-	}
+	if (MatchBuffer < HistoryBufferEnd)
+		ForwardMatchLength = xcrush_match_length(MatchBuffer, ChunkBuffer,
+		                                         (size_t)(HistoryBufferEnd - MatchBuffer));
 
 	ReverseMatchPtr = MatchBuffer - 1;
 	ReverseChunkPtr = ChunkBuffer - 1;
@@ -513,6 +578,7 @@ static int xcrush_find_all_matches(XCRUSH_CONTEXT* xcrush, UINT32 SignatureIndex
 	UINT32 MatchLength = 0;
 	UINT32 MaxMatchLength = 0;
 	UINT32 PrevMatchEnd = 0;
+	const UINT32 MaxChunkIndex = xcrush->Fast ? 1 : 4;
 	XCRUSH_MATCH_INFO MatchInfo = { 0 };
 	XCRUSH_MATCH_INFO MaxMatchInfo = { 0 };
 	XCRUSH_SIGNATURE* Signatures = NULL;
@@ -566,7 +632,7 @@ static int xcrush_find_all_matches(XCRUSH_CONTEXT* xcrush, UINT32 SignatureIndex
 
 				ChunkIndex = ChunkCount++;
 
-				if (ChunkIndex > 4)
+				if (ChunkIndex > MaxChunkIndex)
 					break;
 
 				status = xcrush_find_next_matching_chunk(xcrush, chunk, &chunk);
@@ -1081,7 +1147,8 @@ int xcrush_compress(XCRUSH_CONTEXT* xcrush, const BYTE* pSrcData, UINT32 SrcSize
 	pDstData = &OriginalData[2];
 	DstSize = OriginalDataSize - 2;
 
-	if (CompressedDataSize > 50)
+	/* the fast mode leaves out the MPPC pass when level 1 found matches */
+	if ((CompressedDataSize > 50) && (!xcrush->Fast || !(Level1ComprFlags & L1_COMPRESSED)))
 	{
 		const BYTE* pUnusedDstData = NULL;
 		status = mppc_compress(xcrush->mppc, CompressedData, CompressedDataSize, pDstData,
@@ -1133,6 +1200,12 @@ int xcrush_compress(XCRUSH_CONTEXT* xcrush, const BYTE* pSrcData, UINT32 SrcSize
 	return 1;
 }
 
+void xcrush_set_fast_mode(XCRUSH_CONTEXT* xcrush, BOOL fast)
+{
+	WINPR_ASSERT(xcrush);
+	xcrush->Fast = fast;
+}
+
 void xcrush_context_reset(XCRUSH_CONTEXT* xcrush, BOOL flush)
 {
 	WINPR_ASSERT(xcrush);
@@ -1162,6 +1235,7 @@ XCRUSH_CONTEXT* xcrush_context_new(BOOL Compressor)
 	if (!xcrush)
 		goto fail;
 
+	InitOnceExecuteOnce(&xcrush_init_once, xcrush_init, NULL, NULL);
 	xcrush->Compressor = Compressor;
 	xcrush->mppc = mppc_context_new(1, Compressor);
 	if (!xcrush->mppc)
@@ -39,6 +39,8 @@ extern "C"
 	                                    UINT32 SrcSize, const BYTE** ppDstData, UINT32* pDstSize,
 	                                    UINT32 flags);
 
+	FREERDP_LOCAL void xcrush_set_fast_mode(XCRUSH_CONTEXT* xcrush, BOOL fast);
+
 	FREERDP_LOCAL void xcrush_context_reset(XCRUSH_CONTEXT* xcrush, BOOL flush);
 
 	FREERDP_LOCAL XCRUSH_CONTEXT* xcrush_context_new(BOOL Compressor);
@@ -161,7 +161,8 @@ BOOL yuv_context_reset(YUV_CONTEXT* context, UINT32 width, UINT32 height)
 
 	context->width = width;
 	context->height = height;
-	context->heightStep = (height / context->nthreads);
+	/* even, so that no two encoder jobs write the same chroma line */
+	context->heightStep = MAX(2, (height / context->nthreads) & ~1u);
 
 	if (context->useThreads)
 	{
@@ -740,6 +741,24 @@ static INLINE YUV_ENCODE_WORK_PARAM pool_encode_fill(const RECTANGLE_16* rect, Y
 	return current;
 }
 
+/* Regions are widened to even pixels, clipped to the frame, so the 2x2 chroma
+ * subsampling of a partial conversion matches a conversion of the whole frame. */
+static INLINE RECTANGLE_16 pool_encode_align(const YUV_CONTEXT* context, const RECTANGLE_16* rect)
+{
+	RECTANGLE_16 r = *rect;
+
+	r.left = (UINT16)(r.left & ~1u);
+	r.top = (UINT16)(r.top & ~1u);
+
+	if (r.right < context->width)
+		r.right = (UINT16)((r.right + 1u) & ~1u);
+
+	if (r.bottom < context->height)
+		r.bottom = (UINT16)((r.bottom + 1u) & ~1u);
+
+	return r;
+}
+
 static BOOL pool_encode(YUV_CONTEXT* context, PTP_WORK_CALLBACK cb, const BYTE* pSrcData,
                         UINT32 nSrcStep, UINT32 SrcFormat, const UINT32 iStride[],
                         BYTE* pYUVLumaData[], BYTE* pYUVChromaData[],
@@ -767,8 +786,9 @@ static BOOL pool_encode(YUV_CONTEXT* context, PTP_WORK_CALLBACK cb, const BYTE*
 	{
 		for (x = 0; x < numRegionRects; x++)
 		{
+			const RECTANGLE_16 rect = pool_encode_align(context, &regionRects[x]);
 			YUV_ENCODE_WORK_PARAM current =
-			    pool_encode_fill(&regionRects[x], context, pSrcData, nSrcStep, SrcFormat, iStride,
+			    pool_encode_fill(&rect, context, pSrcData, nSrcStep, SrcFormat, iStride,
 			                     pYUVLumaData, pYUVChromaData);
 			cb(NULL, &current, NULL);
 		}
@@ -778,22 +798,13 @@ static BOOL pool_encode(YUV_CONTEXT* context, PTP_WORK_CALLBACK cb, const BYTE*
 	/* case where we use threads */
 	for (x = 0; x < numRegionRects; x++)
 	{
-		const RECTANGLE_16* rect = &regionRects[x];
-		const UINT32 height = rect->bottom - rect->top;
-		const UINT32 steps = (height + context->heightStep / 2) / context->heightStep;
-
-		waitCount += steps;
-	}
-
-	for (x = 0; x < numRegionRects; x++)
-	{
-		const RECTANGLE_16* rect = &regionRects[x];
-		const UINT32 height = rect->bottom - rect->top;
-		const UINT32 steps = (height + context->heightStep / 2) / context->heightStep;
+		const RECTANGLE_16 rect = pool_encode_align(context, &regionRects[x]);
+		const UINT32 height = rect.bottom - rect.top;
+		const UINT32 steps = (height + context->heightStep - 1) / context->heightStep;
 
 		for (y = 0; y < steps; y++)
 		{
-			RECTANGLE_16 r = *rect;
+			RECTANGLE_16 r = rect;
 			YUV_ENCODE_WORK_PARAM* current;
 
 			if (context->work_object_count <= waitCount)
@@ -805,6 +816,7 @@ static BOOL pool_encode(YUV_CONTEXT* context, PTP_WORK_CALLBACK cb, const BYTE*
 
 			current = &context->work_enc_params[waitCount];
 			r.top += y * context->heightStep;
+			r.bottom = (UINT16)MIN(r.bottom, r.top + context->heightStep);
 			*current = pool_encode_fill(&r, context, pSrcData, nSrcStep, SrcFormat, iStride,
 			                            pYUVLumaData, pYUVChromaData);
 			if (!submit_object(&context->work_objects[waitCount], cb, current, context))
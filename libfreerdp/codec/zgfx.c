@@ -22,6 +22,7 @@
 #include <freerdp/config.h>
 
 #include <winpr/crt.h>
+#include <winpr/assert.h>
 #include <winpr/print.h>
 #include <winpr/bitstream.h>
 
@@ -63,10 +64,20 @@ struct S_ZGFX_CONTEXT
 
 	BYTE OutputBuffer[65536];
 	UINT32 OutputCount;
+	const BYTE* pOutput; /* OutputBuffer or the data of an uncompressed segment */
 
 	BYTE HistoryBuffer[2500000];
 	UINT32 HistoryIndex;
 	UINT32 HistoryBufferSize;
+
+	/* Compressor */
+	UINT32 CompressionLevel;
+	UINT32 HistoryFill; /* valid bytes in the history, up to HistoryBufferSize */
+	UINT32 Position;    /* total bytes compressed, wraps around */
+	UINT32* HashHead;
+	UINT32* HashChain;
+	UINT32 LiteralCode[256];
+	UINT32 LiteralBits[256];
 };
 
 static const ZGFX_TOKEN ZGFX_TOKEN_TABLE[] = {
@@ -238,6 +249,7 @@ static BOOL zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, wStream* stream, size_t
 
 	Stream_Read_UINT8(stream, flags); /* header (1 byte) */
 	zgfx->OutputCount = 0;
+	zgfx->pOutput = zgfx->OutputBuffer;
 	pbSegment = Stream_Pointer(stream);
 	Stream_Seek(stream, cbSegment);
 
@@ -248,7 +260,8 @@ static BOOL zgfx_decompress_segment(ZGFX_CONTEXT* zgfx, wStream* stream, size_t
 		if (cbSegment > sizeof(zgfx->OutputBuffer))
 			return FALSE;
 
-		CopyMemory(zgfx->OutputBuffer, pbSegment, cbSegment);
+		/* Uncompressed data is used in place instead of staging it in OutputBuffer */
+		zgfx->pOutput = pbSegment;
 		zgfx->OutputCount = cbSegment;
 		return TRUE;
 	}
@@ -401,7 +414,7 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 			goto fail;
 
 		*pDstSize = zgfx->OutputCount;
-		CopyMemory(*ppDstData, zgfx->OutputBuffer, zgfx->OutputCount);
+		CopyMemory(*ppDstData, zgfx->pOutput, zgfx->OutputCount);
 	}
 	else if (descriptor == ZGFX_SEGMENTED_MULTIPART)
 	{
@@ -445,7 +458,7 @@ int zgfx_decompress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BY
 			if (used + zgfx->OutputCount > uncompressedSize)
 				goto fail;
 
-			CopyMemory(pConcatenated, zgfx->OutputBuffer, zgfx->OutputCount);
+			CopyMemory(pConcatenated, zgfx->pOutput, zgfx->OutputCount);
 			pConcatenated += zgfx->OutputCount;
 			used += zgfx->OutputCount;
 		}
@@ -460,19 +473,432 @@ fail:
 	return status;
 }
 
+/**
+ * RDP8 Compressor
+ *
+ * Every segment is appended to the history ring before it is encoded, so the
+ * history always mirrors the one of the decoder. Matches are searched with
+ * hash chains keyed on three bytes and verified against the ring, stale hash
+ * entries only cost time. Segments that do not shrink are sent uncompressed.
+ */
+
+#define ZGFX_HASH_BITS 16
+#define ZGFX_HASH_SIZE (1 << ZGFX_HASH_BITS)
+#define ZGFX_CHAIN_SIZE (1 << 17)
+#define ZGFX_MIN_MATCH 3
+#define ZGFX_UNENCODED_MAX 0x7FFF
+
+typedef struct
+{
+	UINT32 maxChain;   /* candidates tested per position */
+	UINT32 niceLength; /* stop searching once a match is this long */
+	BOOL lazy;         /* defer a match if the next position has a longer one */
+} ZGFX_COMPRESSION_PARAMS;
+
+static const ZGFX_COMPRESSION_PARAMS ZGFX_COMPRESSION_LEVELS[ZGFX_COMPRESSION_LEVEL_MAX + 1] = {
+	{ 0, 0, FALSE },      { 4, 16, FALSE },     { 8, 32, FALSE },
+	{ 16, 64, FALSE },    { 16, 64, TRUE },     { 32, 128, TRUE },
+	{ 64, 256, TRUE },    { 128, 512, TRUE },   { 512, 2048, TRUE },
+	{ 4096, 65535, TRUE }
+};
+
+typedef struct
+{
+	BYTE* data;
+	size_t size;
+	size_t offset;
+	UINT64 bits;
+	UINT32 count;
+	BOOL overflow;
+} ZGFX_BIT_WRITER;
+
+static INLINE void zgfx_PutBits(ZGFX_BIT_WRITER* bw, UINT32 value, UINT32 nbits)
+{
+	bw->bits = (bw->bits << nbits) | value;
+	bw->count += nbits;
+
+	while (bw->count >= 8)
+	{
+		bw->count -= 8;
+
+		if (bw->offset >= bw->size)
+		{
+			bw->overflow = TRUE;
+			return;
+		}
+
+		bw->data[bw->offset++] = (BYTE)(bw->bits >> bw->count);
+	}
+}
+
+static const ZGFX_TOKEN* zgfx_distance_token(UINT32 distance)
+{
+	const ZGFX_TOKEN* token;
+
+	for (token = ZGFX_TOKEN_TABLE; token->prefixLength != 0; token++)
+	{
+		if ((token->tokenType == 1) && (distance >= token->valueBase) &&
+		    (distance - token->valueBase < (1UL << token->valueBits)))
+			return token;
+	}
+
+	return NULL;
+}
+
+static INLINE UINT32 zgfx_length_exponent(UINT32 length)
+{
+	UINT32 k = 2;
+
+	while ((length >> (k + 1)) != 0)
+		k++;
+
+	return k;
+}
+
+static INLINE UINT32 zgfx_match_bits(UINT32 length, UINT32 distance)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+	const UINT32 lengthBits = (length == 3) ? 1 : 2 * zgfx_length_exponent(length);
+
+	WINPR_ASSERT(token);
+	return token->prefixLength + token->valueBits + lengthBits;
+}
+
+static void zgfx_put_match(ZGFX_BIT_WRITER* bw, UINT32 length, UINT32 distance)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(distance);
+
+	WINPR_ASSERT(token);
+	zgfx_PutBits(bw, token->prefixCode, token->prefixLength);
+	zgfx_PutBits(bw, distance - token->valueBase, token->valueBits);
+
+	if (length == 3)
+		zgfx_PutBits(bw, 0, 1);
+	else
+	{
+		/* k - 1 one bits and a zero bit followed by k bits of length - 2^k */
+		const UINT32 k = zgfx_length_exponent(length);
+		zgfx_PutBits(bw, ((1UL << (k - 1)) - 1) << 1, k);
+		zgfx_PutBits(bw, length - (1UL << k), k);
+	}
+}
+
+static void zgfx_put_unencoded(ZGFX_BIT_WRITER* bw, const BYTE* data, UINT32 count)
+{
+	const ZGFX_TOKEN* token = zgfx_distance_token(0);
+
+	/* Distance 0 announces count raw bytes starting at the next byte boundary */
+	WINPR_ASSERT(token);
+	zgfx_PutBits(bw, token->prefixCode, token->prefixLength);
+	zgfx_PutBits(bw, 0, token->valueBits);
+	zgfx_PutBits(bw, count, 15);
+
+	if (bw->count > 0)
+		zgfx_PutBits(bw, 0, 8 - bw->count);
+
+	if (bw->overflow || (count > bw->size - bw->offset))
+	{
+		bw->overflow = TRUE;
+		return;
+	}
+
+	CopyMemory(&bw->data[bw->offset], data, count);
+	bw->offset += count;
+}
+
+static void zgfx_put_literals(const ZGFX_CONTEXT* zgfx, ZGFX_BIT_WRITER* bw, const BYTE* data,
+                              UINT32 count)
+{
+	while ((count > 0) && !bw->overflow)
+	{
+		UINT32 x;
+		UINT64 cost = 0;
+		const UINT32 n = MIN(count, ZGFX_UNENCODED_MAX);
+
+		for (x = 0; x < n; x++)
+			cost += zgfx->LiteralBits[data[x]];
+
+		/* distance token (10 bits), count (15 bits) and up to 7 bits of padding */
+		if (cost > 32 + 8ULL * n)
+			zgfx_put_unencoded(bw, data, n);
+		else
+		{
+			for (x = 0; x < n; x++)
+				zgfx_PutBits(bw, zgfx->LiteralCode[data[x]], zgfx->LiteralBits[data[x]]);
+		}
+
+		data += n;
+		count -= n;
+	}
+}
+
+static INLINE UINT32 zgfx_hash(const BYTE* data)
+{
+	const UINT32 value = data[0] | ((UINT32)data[1] << 8) | ((UINT32)data[2] << 16);
+	return (UINT32)(value * 2654435761U) >> (32 - ZGFX_HASH_BITS);
+}
+
+static INLINE void zgfx_hash_insert(ZGFX_CONTEXT* zgfx, UINT32 position, UINT32 hash)
+{
+	zgfx->HashChain[position & (ZGFX_CHAIN_SIZE - 1)] = zgfx->HashHead[hash];
+	zgfx->HashHead[hash] = position;
+}
+
+/* length of the common prefix of the history at index and data, wrapping around the ring */
+static UINT32 zgfx_match_length(const ZGFX_CONTEXT* zgfx, UINT32 index, const BYTE* data,
+                                UINT32 maxLength)
+{
+	UINT32 length = 0;
+
+	while (length < maxLength)
+	{
+		UINT32 x = 0;
+		const BYTE* ref = &zgfx->HistoryBuffer[index];
+		const UINT32 span = MIN(maxLength - length, zgfx->HistoryBufferSize - index);
+
+		for (; x + 8 <= span; x += 8)
+		{
+			UINT64 a;
+			UINT64 b;
+			memcpy(&a, &ref[x], sizeof(a));
+			memcpy(&b, &data[length + x], sizeof(b));
+
+			if (a != b)
+				break;
+		}
+
+		while ((x < span) && (ref[x] == data[length + x]))
+			x++;
+
+		length += x;
+
+		if (x < span)
+			break;
+
+		index = 0;
+	}
+
+	return length;
+}
+
+static UINT32 zgfx_find_match(const ZGFX_CONTEXT* zgfx, UINT32 chain, UINT32 niceLength,
+                              const BYTE* data, UINT32 maxLength, UINT32 position, UINT32 ringIndex,
+                              UINT32 maxDistance, UINT32 hash, UINT32* pDistance)
+{
+	UINT32 best = 0;
+	UINT32 lastDistance = 0;
+	UINT32 candidate = zgfx->HashHead[hash];
+	const UINT32 size = zgfx->HistoryBufferSize;
+
+	while (chain-- > 0)
+	{
+		UINT32 index;
+		const UINT32 distance = position - candidate;
+
+		/* Chain entries are overwritten by newer positions, distances must keep growing */
+		if ((distance <= lastDistance) || (distance > maxDistance))
+			break;
+
+		lastDistance = distance;
+		index = (ringIndex + size - distance) % size;
+
+		if (zgfx->HistoryBuffer[(index + best) % size] == data[best])
+		{
+			const UINT32 length = zgfx_match_length(zgfx, index, data, maxLength);
+
+			if (length > best)
+			{
+				best = length;
+				*pDistance = distance;
+
+				if ((best >= niceLength) || (best == maxLength))
+					break;
+			}
+		}
+
+		candidate = zgfx->HashChain[candidate & (ZGFX_CHAIN_SIZE - 1)];
+	}
+
+	if (best < ZGFX_MIN_MATCH)
+		return 0;
+
+	/* Short matches far back may cost more than the literals they replace */
+	if (best < 8)
+	{
+		UINT32 x;
+		UINT32 literalBits = 0;
+
+		for (x = 0; x < best; x++)
+			literalBits += zgfx->LiteralBits[data[x]];
+
+		if (zgfx_match_bits(best, *pDistance) >= literalBits)
+			return 0;
+	}
+
+	return best;
+}
+
+static BOOL zgfx_compress_lz77(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize,
+                               UINT32 ringStart, BYTE* pDstData, size_t DstSize, size_t* pDstUsed)
+{
+	UINT32 i = 0;
+	UINT32 misses = 0;
+	UINT32 literalStart = 0;
+	UINT32 prevLength = 0;
+	UINT32 prevDistance = 0;
+	const UINT32 size = zgfx->HistoryBufferSize;
+	const ZGFX_COMPRESSION_PARAMS* params = &ZGFX_COMPRESSION_LEVELS[zgfx->CompressionLevel];
+	/* history bytes overwritten by this segment must not be referenced */
+	const UINT32 maxDistance = size - ZGFX_SEGMENTED_MAXSIZE - 1;
+	ZGFX_BIT_WRITER bw = { 0 };
+
+	bw.data = pDstData;
+	bw.size = DstSize;
+
+	while (i + ZGFX_MIN_MATCH <= SrcSize)
+	{
+		UINT32 distance = 0;
+		UINT32 length;
+		const UINT32 hash = zgfx_hash(&pSrcData[i]);
+		const UINT32 position = zgfx->Position + i;
+		/* Only the most recent candidate is tested while skipping through incompressible data */
+		const UINT32 chain = (misses > 32) ? 1 : params->maxChain;
+
+		length = zgfx_find_match(zgfx, chain, params->niceLength, &pSrcData[i], SrcSize - i,
+		                         position, (ringStart + i) % size,
+		                         MIN(zgfx->HistoryFill + i, maxDistance), hash, &distance);
+		zgfx_hash_insert(zgfx, position, hash);
+
+		if (params->lazy)
+		{
+			/* Emit the match found at the previous position unless this one is longer */
+			if ((prevLength > 0) && (length <= prevLength))
+			{
+				UINT32 x;
+				const UINT32 matchStart = i - 1;
+
+				zgfx_put_literals(zgfx, &bw, &pSrcData[literalStart], matchStart - literalStart);
+				zgfx_put_match(&bw, prevLength, prevDistance);
+
+				for (x = i + 1; (x < matchStart + prevLength) && (x + ZGFX_MIN_MATCH <= SrcSize);
+				     x++)
+					zgfx_hash_insert(zgfx, zgfx->Position + x, zgfx_hash(&pSrcData[x]));
+
+				i = literalStart = matchStart + prevLength;
+				prevLength = 0;
+			}
+			else if ((length > 0) && (length >= params->niceLength))
+			{
+				UINT32 x;
+
+				zgfx_put_literals(zgfx, &bw, &pSrcData[literalStart], i - literalStart);
+				zgfx_put_match(&bw, length, distance);
+
+				for (x = i + 1; (x < i + length) && (x + ZGFX_MIN_MATCH <= SrcSize); x++)
+					zgfx_hash_insert(zgfx, zgfx->Position + x, zgfx_hash(&pSrcData[x]));
+
+				i = literalStart = i + length;
+				prevLength = 0;
+			}
+			else
+			{
+				prevLength = length;
+				prevDistance = distance;
+				i++;
+			}
+		}
+		else if (length > 0)
+		{
+			zgfx_put_literals(zgfx, &bw, &pSrcData[literalStart], i - literalStart);
+			zgfx_put_match(&bw, length, distance);
+
+			if (length <= params->niceLength)
+			{
+				UINT32 x;
+
+				for (x = i + 1; (x < i + length) && (x + ZGFX_MIN_MATCH <= SrcSize); x++)
+					zgfx_hash_insert(zgfx, zgfx->Position + x, zgfx_hash(&pSrcData[x]));
+			}
+
+			i = literalStart = i + length;
+			misses = 0;
+		}
+		else
+		{
+			/* Skip faster through data that does not compress */
+			i += 1 + (misses++ >> 5);
+		}
+
+		if (bw.overflow)
+			return FALSE;
+	}
+
+	if (prevLength > 0)
+	{
+		const UINT32 matchStart = i - 1;
+
+		zgfx_put_literals(zgfx, &bw, &pSrcData[literalStart], matchStart - literalStart);
+		zgfx_put_match(&bw, prevLength, prevDistance);
+		literalStart = matchStart + prevLength;
+	}
+
+	if (literalStart < SrcSize)
+		zgfx_put_literals(zgfx, &bw, &pSrcData[literalStart], SrcSize - literalStart);
+
+	/* The last byte holds the number of unused bits in the byte before */
+	{
+		const UINT32 padding = (8 - bw.count) % 8;
+
+		if (padding > 0)
+			zgfx_PutBits(&bw, 0, padding);
+
+		if (bw.overflow || (bw.offset >= bw.size))
+			return FALSE;
+
+		bw.data[bw.offset++] = (BYTE)padding;
+	}
+
+	*pDstUsed = bw.offset;
+	return TRUE;
+}
+
 static BOOL zgfx_compress_segment(ZGFX_CONTEXT* zgfx, wStream* s, const BYTE* pSrcData,
                                   UINT32 SrcSize, UINT32* pFlags)
 {
-	/* FIXME: Currently compression not implemented. Just copy the raw source */
+	size_t DstSize = 0;
+	BOOL compressed = FALSE;
+	BYTE header = ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
+	const UINT32 ringStart = zgfx->HistoryIndex;
+
 	if (!Stream_EnsureRemainingCapacity(s, SrcSize + 1))
 	{
 		WLog_ERR(TAG, "Stream_EnsureRemainingCapacity failed!");
 		return FALSE;
 	}
 
-	(*pFlags) |= ZGFX_PACKET_COMPR_TYPE_RDP8; /* RDP 8.0 compression format */
-	Stream_Write_UINT8(s, (*pFlags));         /* header (1 byte) */
-	Stream_Write(s, pSrcData, SrcSize);
+	/* The decoder appends uncompressed segments to its history as well */
+	zgfx_history_buffer_ring_write(zgfx, pSrcData, SrcSize);
+
+	if (zgfx->HashHead && (zgfx->CompressionLevel > 0) && (SrcSize > ZGFX_MIN_MATCH))
+		compressed = zgfx_compress_lz77(zgfx, pSrcData, SrcSize, ringStart, Stream_Pointer(s) + 1,
+		                                SrcSize - 1, &DstSize);
+
+	zgfx->Position += SrcSize;
+	zgfx->HistoryFill = MIN(zgfx->HistoryFill + SrcSize, zgfx->HistoryBufferSize);
+
+	if (compressed)
+	{
+		header |= PACKET_COMPRESSED;
+		Stream_Write_UINT8(s, header); /* header (1 byte) */
+		Stream_Seek(s, DstSize);
+	}
+	else
+	{
+		Stream_Write_UINT8(s, header); /* header (1 byte) */
+		Stream_Write(s, pSrcData, SrcSize);
+	}
+
+	(*pFlags) |= header;
 	return TRUE;
 }
 
@@ -570,9 +996,44 @@ int zgfx_compress(ZGFX_CONTEXT* zgfx, const BYTE* pSrcData, UINT32 SrcSize, BYTE
 	return status;
 }
 
+BOOL zgfx_context_set_compression_level(ZGFX_CONTEXT* zgfx, UINT32 level)
+{
+	WINPR_ASSERT(zgfx);
+
+	if (!zgfx->Compressor || (level > ZGFX_COMPRESSION_LEVEL_MAX))
+		return FALSE;
+
+	zgfx->CompressionLevel = level;
+	return TRUE;
+}
+
 void zgfx_context_reset(ZGFX_CONTEXT* zgfx, BOOL flush)
 {
 	zgfx->HistoryIndex = 0;
+	zgfx->HistoryFill = 0;
+}
+
+static void zgfx_init_literals(ZGFX_CONTEXT* zgfx)
+{
+	size_t x;
+	const ZGFX_TOKEN* token;
+
+	/* Any byte is a zero bit followed by its 8 bits, frequent ones have shorter codes */
+	for (x = 0; x < 256; x++)
+	{
+		zgfx->LiteralCode[x] = (UINT32)x;
+		zgfx->LiteralBits[x] = 9;
+	}
+
+	for (token = ZGFX_TOKEN_TABLE; token->prefixLength != 0; token++)
+	{
+		if ((token->tokenType == 0) && (token->valueBits == 0) &&
+		    (token->prefixLength < zgfx->LiteralBits[token->valueBase]))
+		{
+			zgfx->LiteralCode[token->valueBase] = token->prefixCode;
+			zgfx->LiteralBits[token->valueBase] = token->prefixLength;
+		}
+	}
 }
 
 ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
@@ -585,6 +1046,20 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 		zgfx->Compressor = Compressor;
 		zgfx->HistoryBufferSize = sizeof(zgfx->HistoryBuffer);
 		zgfx_context_reset(zgfx, FALSE);
+
+		if (Compressor)
+		{
+			zgfx->CompressionLevel = ZGFX_COMPRESSION_LEVEL_DEFAULT;
+			zgfx->HashHead = (UINT32*)calloc(ZGFX_HASH_SIZE, sizeof(UINT32));
+			zgfx->HashChain = (UINT32*)calloc(ZGFX_CHAIN_SIZE, sizeof(UINT32));
+			zgfx_init_literals(zgfx);
+
+			if (!zgfx->HashHead || !zgfx->HashChain)
+			{
+				zgfx_context_free(zgfx);
+				return NULL;
+			}
+		}
 	}
 
 	return zgfx;
@@ -592,5 +1067,10 @@ ZGFX_CONTEXT* zgfx_context_new(BOOL Compressor)
 
 void zgfx_context_free(ZGFX_CONTEXT* zgfx)
 {
+	if (!zgfx)
+		return;
+
+	free(zgfx->HashHead);
+	free(zgfx->HashChain);
 	free(zgfx);
 }
@@ -192,6 +192,9 @@ BOOL freerdp_settings_get_bool(const rdpSettings* settings, size_t id)
 		case FreeRDP_FIPSMode:
 			return settings->FIPSMode;
 
+		case FreeRDP_FastCompression:
+			return settings->FastCompression;
+
 		case FreeRDP_FastPathInput:
 			return settings->FastPathInput;
 
@@ -785,6 +788,10 @@ BOOL freerdp_settings_set_bool(rdpSettings* settings, size_t id, BOOL val)
 			settings->FIPSMode = cnv.c;
 			break;
 
+		case FreeRDP_FastCompression:
+			settings->FastCompression = cnv.c;
+			break;
+
 		case FreeRDP_FastPathInput:
 			settings->FastPathInput = cnv.c;
 			break;
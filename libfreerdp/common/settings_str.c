@@ -67,6 +67,7 @@ static const struct settings_str_entry settings_map[] = {
 	{ FreeRDP_ExtSecurity, 0, "FreeRDP_ExtSecurity" },
 	{ FreeRDP_ExternalCertificateManagement, 0, "FreeRDP_ExternalCertificateManagement" },
 	{ FreeRDP_FIPSMode, 0, "FreeRDP_FIPSMode" },
+	{ FreeRDP_FastCompression, 0, "FreeRDP_FastCompression" },
 	{ FreeRDP_FastPathInput, 0, "FreeRDP_FastPathInput" },
 	{ FreeRDP_FastPathOutput, 0, "FreeRDP_FastPathOutput" },
 	{ FreeRDP_ForceEncryptedCsPdu, 0, "FreeRDP_ForceEncryptedCsPdu" },
@@ -47,30 +47,32 @@
 
 #define TAG FREERDP_TAG("core.channels")
 
-BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, const BYTE* data, size_t size)
+static const rdpMcsChannel* freerdp_channel_get_mcs_channel(rdpRdp* rdp, UINT16 channelId,
+                                                            const char* caller)
 {
 	DWORD i;
-	size_t left;
-	UINT32 flags;
-	size_t chunkSize;
 	rdpMcs* mcs = rdp->mcs;
-	const rdpMcsChannel* channel = NULL;
 
 	for (i = 0; i < mcs->channelCount; i++)
 	{
 		const rdpMcsChannel* cur = &mcs->channels[i];
 		if (cur->ChannelId == channelId)
-		{
-			channel = cur;
-			break;
-		}
+			return cur;
 	}
 
+	WLog_ERR(TAG, "%s: unknown channelId %" PRIu16 "", caller, channelId);
+	return NULL;
+}
+
+BOOL freerdp_channel_send(rdpRdp* rdp, UINT16 channelId, const BYTE* data, size_t size)
+{
+	size_t left;
+	UINT32 flags;
+	size_t chunkSize;
+	const rdpMcsChannel* channel = freerdp_channel_get_mcs_channel(rdp, channelId, __FUNCTION__);
+
 	if (!channel)
-	{
-		WLog_ERR(TAG, "freerdp_channel_send: unknown channelId %" PRIu16 "", channelId);
 		return FALSE;
-	}
 
 	flags = CHANNEL_FLAG_FIRST;
 	left = size;
@@ -316,3 +318,35 @@ BOOL freerdp_channel_send_packet(rdpRdp* rdp, UINT16 channelId, size_t totalSize
 	/* WLog_DBG(TAG, "%s: sending data (flags=0x%x size=%d)", __FUNCTION__, flags, size); */
 	return rdp_send(rdp, s, channelId);
 }
+
+/**
+ * Send header followed by data as a single, complete channel PDU. The caller keeps
+ * headerSize + dataSize within VirtualChannelChunkSize. As with freerdp_channel_send the
+ * channel must be one of the MCS channels.
+ */
+BOOL freerdp_channel_send_chunk(rdpRdp* rdp, UINT16 channelId, const BYTE* header,
+                                size_t headerSize, const BYTE* data, size_t dataSize)
+{
+	wStream* s;
+	const size_t totalSize = headerSize + dataSize;
+
+	if (!freerdp_channel_get_mcs_channel(rdp, channelId, __FUNCTION__))
+		return FALSE;
+
+	s = rdp_send_stream_init(rdp);
+
+	if (!s)
+		return FALSE;
+
+	if (!Stream_EnsureRemainingCapacity(s, 8 + totalSize))
+	{
+		Stream_Release(s);
+		return FALSE;
+	}
+
+	Stream_Write_UINT32(s, (UINT32)totalSize);
+	Stream_Write_UINT32(s, CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST);
+	Stream_Write(s, header, headerSize);
+	Stream_Write(s, data, dataSize);
+	return rdp_send(rdp, s, channelId);
+}
@@ -339,9 +339,6 @@ static int fastpath_recv_update(rdpFastPath* fastpath, BYTE updateCode, wStream*
 	if (!fastpath || !fastpath->rdp || !s)
 		return -1;
 
-	Stream_SealLength(s);
-	Stream_SetPosition(s, 0);
-
 	update = fastpath->rdp->update;
 
 	if (!update || !update->pointer || !update->context)
@@ -358,6 +355,12 @@ static int fastpath_recv_update(rdpFastPath* fastpath, BYTE updateCode, wStream*
 	          fastpath_update_to_string(updateCode), updateCode, Stream_GetRemainingLength(s));
 #endif
 
+	if (update->FastPathUpdate)
+	{
+		rc = update->FastPathUpdate(context, updateCode, s);
+		goto out;
+	}
+
 	defaultReturn = freerdp_settings_get_bool(context->settings, FreeRDP_DeactivateClientDecoding);
 	switch (updateCode)
 	{
@@ -463,6 +466,7 @@ static int fastpath_recv_update(rdpFastPath* fastpath, BYTE updateCode, wStream*
 			break;
 	}
 
+out:
 	Stream_SetPosition(s, 0);
 	if (!rc)
 	{
@@ -533,20 +537,21 @@ static int fastpath_recv_update_data(rdpFastPath* fastpath, wStream* s)
 		return -1;
 	}
 
-	if (!Stream_EnsureRemainingCapacity(fastpath->updateData, DstSize))
-		return -1;
-
-	Stream_Write(fastpath->updateData, pDstData, DstSize);
-
 	if (fragmentation == FASTPATH_FRAGMENT_SINGLE)
 	{
+		wStream sbuffer = { 0 };
+		wStream* sub;
+
 		if (fastpath->fragmentation != -1)
 		{
 			WLog_ERR(TAG, "Unexpected FASTPATH_FRAGMENT_SINGLE");
 			goto out_fail;
 		}
 
-		status = fastpath_recv_update(fastpath, updateCode, fastpath->updateData);
+		/* Unfragmented updates are parsed in place, either from the received PDU or from the
+		 * bulk decompressor history, without copying them to the reassembly buffer */
+		sub = Stream_StaticConstInit(&sbuffer, pDstData, DstSize);
+		status = fastpath_recv_update(fastpath, updateCode, sub);
 
 		if (status < 0)
 		{
@@ -556,13 +561,19 @@ static int fastpath_recv_update_data(rdpFastPath* fastpath, wStream* s)
 	}
 	else
 	{
+		size_t totalSize;
 		rdpContext* context;
-		const size_t totalSize = Stream_GetPosition(fastpath->updateData);
 
 		context = transport_get_context(transport);
 		WINPR_ASSERT(context);
 		WINPR_ASSERT(context->settings);
 
+		if (!Stream_EnsureRemainingCapacity(fastpath->updateData, DstSize))
+			goto out_fail;
+
+		Stream_Write(fastpath->updateData, pDstData, DstSize);
+		totalSize = Stream_GetPosition(fastpath->updateData);
+
 		if (totalSize > context->settings->MultifragMaxRequestSize)
 		{
 			WLog_ERR(TAG, "Total size (%" PRIuz ") exceeds MultifragMaxRequestSize (%" PRIu32 ")",
@@ -601,6 +612,8 @@ static int fastpath_recv_update_data(rdpFastPath* fastpath, wStream* s)
 			}
 
 			fastpath->fragmentation = -1;
+			Stream_SealLength(fastpath->updateData);
+			Stream_SetPosition(fastpath->updateData, 0);
 			status = fastpath_recv_update(fastpath, updateCode, fastpath->updateData);
 
 			if (status < 0)
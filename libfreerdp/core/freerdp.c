@@ -1036,6 +1036,17 @@ ULONG freerdp_get_transport_sent(rdpContext* context, BOOL resetCount)
 	return transport_get_bytes_sent(context->rdp->transport, resetCount);
 }
 
+wStream* freerdp_receive_slice(rdpContext* context, const BYTE* data, size_t length)
+{
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(context->rdp);
+
+	if (!context->rdp->transport)
+		return NULL;
+
+	return transport_slice_from_pool(context->rdp->transport, data, length);
+}
+
 BOOL freerdp_nla_impersonate(rdpContext* context)
 {
 	rdpNla* nla;
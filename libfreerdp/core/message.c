@@ -43,43 +43,470 @@
 
 #define TAG FREERDP_TAG("core.message")
 
+/* Frame Batching */
+
+#define UPDATE_FRAME_ALIGN 16
+#define UPDATE_FRAME_CHUNK_SIZE (64 * 1024)
+#define UPDATE_FRAME_CHUNK_MAX (4 * 1024 * 1024)
+
+typedef struct s_update_frame_chunk
+{
+	struct s_update_frame_chunk* next;
+	size_t size;
+	size_t used;
+} UPDATE_FRAME_CHUNK;
+
+typedef struct
+{
+	wMessage msg;
+	BOOL pooled; /* payload lives in the frame arena */
+} UPDATE_FRAME_MESSAGE;
+
+struct rdp_update_frame
+{
+	UPDATE_FRAME_MESSAGE* messages;
+	size_t count;
+	size_t capacity;
+
+	UPDATE_FRAME_CHUNK* chunks;
+	size_t arenaUsed;
+};
+
+static BOOL update_message_free_class(wMessage* msg, int msgClass, int msgType);
+static int update_message_process_class(rdpUpdateProxy* proxy, wMessage* msg, int msgClass,
+                                        int msgType);
+
+static size_t update_frame_chunk_offset(void)
+{
+	return (sizeof(UPDATE_FRAME_CHUNK) + UPDATE_FRAME_ALIGN - 1) & ~(UPDATE_FRAME_ALIGN - 1);
+}
+
+static UPDATE_FRAME_CHUNK* update_frame_chunk_new(size_t size)
+{
+	UPDATE_FRAME_CHUNK* chunk =
+	    (UPDATE_FRAME_CHUNK*)winpr_aligned_malloc(update_frame_chunk_offset() + size,
+	                                              UPDATE_FRAME_ALIGN);
+
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+static void update_frame_chunks_free(UPDATE_FRAME_CHUNK* chunk)
+{
+	while (chunk)
+	{
+		UPDATE_FRAME_CHUNK* next = chunk->next;
+		winpr_aligned_free(chunk);
+		chunk = next;
+	}
+}
+
+static void* update_frame_alloc(rdpUpdateFrame* frame, size_t size)
+{
+	BYTE* ptr;
+	UPDATE_FRAME_CHUNK* chunk;
+
+	WINPR_ASSERT(frame);
+
+	size = (size + UPDATE_FRAME_ALIGN - 1) & ~(UPDATE_FRAME_ALIGN - 1);
+	chunk = frame->chunks;
+
+	if (!chunk || (chunk->size - chunk->used < size))
+	{
+		chunk = update_frame_chunk_new(MAX(size, UPDATE_FRAME_CHUNK_SIZE));
+
+		if (!chunk)
+			return NULL;
+
+		chunk->next = frame->chunks;
+		frame->chunks = chunk;
+	}
+
+	ptr = (BYTE*)chunk + update_frame_chunk_offset() + chunk->used;
+	chunk->used += size;
+	frame->arenaUsed += size;
+	return ptr;
+}
+
+static BOOL update_frame_append(rdpUpdateFrame* frame, rdpContext* context, UINT32 id,
+                                void* wParam, void* lParam, BOOL pooled)
+{
+	UPDATE_FRAME_MESSAGE* entry;
+
+	WINPR_ASSERT(frame);
+
+	if (frame->count == frame->capacity)
+	{
+		const size_t capacity = MAX(frame->capacity * 2, 64);
+		UPDATE_FRAME_MESSAGE* messages = (UPDATE_FRAME_MESSAGE*)realloc(
+		    frame->messages, sizeof(UPDATE_FRAME_MESSAGE) * capacity);
+
+		if (!messages)
+			return FALSE;
+
+		frame->messages = messages;
+		frame->capacity = capacity;
+	}
+
+	entry = &frame->messages[frame->count++];
+	ZeroMemory(entry, sizeof(UPDATE_FRAME_MESSAGE));
+	entry->msg.id = id;
+	entry->msg.context = (void*)context;
+	entry->msg.wParam = wParam;
+	entry->msg.lParam = lParam;
+	entry->msg.time = GetTickCount64();
+	entry->pooled = pooled;
+	return TRUE;
+}
+
+/**
+ * Releases the payloads of all messages of a frame. Arena backed payloads are
+ * dropped in bulk, the arena itself is kept for the next frame. When a frame
+ * did not fit in a single chunk the chunks are merged so the next frame of
+ * the same size does not need to allocate again.
+ */
+static void update_frame_clear(rdpUpdateFrame* frame)
+{
+	size_t x;
+
+	if (!frame)
+		return;
+
+	for (x = 0; x < frame->count; x++)
+	{
+		UPDATE_FRAME_MESSAGE* entry = &frame->messages[x];
+
+		if (!entry->pooled)
+			update_message_free_class(&entry->msg, GetMessageClass(entry->msg.id),
+			                          GetMessageType(entry->msg.id));
+	}
+
+	frame->count = 0;
+
+	if (frame->chunks && frame->chunks->next)
+	{
+		const size_t size =
+		    MIN(MAX(frame->arenaUsed, UPDATE_FRAME_CHUNK_SIZE), UPDATE_FRAME_CHUNK_MAX);
+
+		update_frame_chunks_free(frame->chunks);
+		frame->chunks = update_frame_chunk_new(size);
+	}
+	else if (frame->chunks)
+		frame->chunks->used = 0;
+
+	frame->arenaUsed = 0;
+}
+
+static void* update_frame_new(const void* val)
+{
+	rdpUpdateFrame* frame;
+	WINPR_UNUSED(val);
+
+	frame = (rdpUpdateFrame*)calloc(1, sizeof(rdpUpdateFrame));
+
+	if (!frame)
+		return NULL;
+
+	frame->chunks = update_frame_chunk_new(UPDATE_FRAME_CHUNK_SIZE);
+
+	if (!frame->chunks)
+	{
+		free(frame);
+		return NULL;
+	}
+
+	return frame;
+}
+
+static void update_frame_free(void* obj)
+{
+	rdpUpdateFrame* frame = (rdpUpdateFrame*)obj;
+
+	if (!frame)
+		return;
+
+	update_frame_clear(frame);
+	update_frame_chunks_free(frame->chunks);
+	free(frame->messages);
+	free(frame);
+}
+
+static void update_message_frame_release(rdpContext* context, rdpUpdateFrame* frame)
+{
+	rdp_update_internal* up;
+
+	if (!frame)
+		return;
+
+	update_frame_clear(frame);
+	up = update_cast(context->update);
+
+	if (up->proxy)
+		ObjectPool_Return(up->proxy->frames, frame);
+	else
+		update_frame_free(frame);
+}
+
+static BOOL update_message_process_frame(rdpUpdateProxy* proxy, rdpUpdateFrame* frame)
+{
+	size_t x;
+	BOOL rc = TRUE;
+
+	if (!frame)
+		return FALSE;
+
+	for (x = 0; x < frame->count; x++)
+	{
+		wMessage* msg = &frame->messages[x].msg;
+
+		if (update_message_process_class(proxy, msg, GetMessageClass(msg->id),
+		                                 GetMessageType(msg->id)) < 0)
+			rc = FALSE;
+	}
+
+	return rc;
+}
+
+/**
+ * Returns the frame currently being collected, if it belongs to the calling
+ * thread. Only the thread owning the frame allocates payloads from its arena,
+ * other threads allocate them on the heap.
+ */
+static rdpUpdateFrame* update_message_current_frame(rdpContext* context)
+{
+	rdpUpdateFrame* frame = NULL;
+	rdp_update_internal* up = update_cast(context->update);
+	rdpUpdateProxy* proxy = up->proxy;
+
+	if (!proxy)
+		return NULL;
+
+	EnterCriticalSection(&proxy->lock);
+
+	if (proxy->frameThreadId == GetCurrentThreadId())
+		frame = proxy->frame;
+
+	LeaveCriticalSection(&proxy->lock);
+	return frame;
+}
+
+static void* update_message_alloc(rdpContext* context, size_t size)
+{
+	rdpUpdateFrame* frame = update_message_current_frame(context);
+
+	if (frame)
+		return update_frame_alloc(frame, size);
+
+	return malloc(size);
+}
+
+static void update_message_discard(rdpContext* context, void* ptr)
+{
+	if (!update_message_current_frame(context))
+		free(ptr);
+}
+
+/**
+ * Queues a message for the update thread. While a frame is open every message
+ * is appended to it, also those of other threads, so no message overtakes the
+ * batch. Pooled messages of the thread owning the frame have their payload
+ * allocated with update_message_alloc and are not freed individually.
+ */
+static BOOL update_message_post(rdpContext* context, UINT32 id, void* wParam, void* lParam,
+                                BOOL pooled)
+{
+	BOOL rc;
+	rdp_update_internal* up = update_cast(context->update);
+	rdpUpdateProxy* proxy = up->proxy;
+
+	if (!proxy)
+		return MessageQueue_Post(up->queue, (void*)context, id, wParam, lParam);
+
+	EnterCriticalSection(&proxy->lock);
+
+	if (!proxy->frame)
+		rc = MessageQueue_Post(up->queue, (void*)context, id, wParam, lParam);
+	else
+	{
+		/* Payloads of other threads were allocated on the heap */
+		if (proxy->frameThreadId != GetCurrentThreadId())
+			pooled = FALSE;
+
+		rc = update_frame_append(proxy->frame, context, id, wParam, lParam, pooled);
+
+		if (!rc && !pooled)
+		{
+			wMessage msg = { 0 };
+			msg.id = id;
+			msg.context = (void*)context;
+			msg.wParam = wParam;
+			msg.lParam = lParam;
+			update_message_free_class(&msg, GetMessageClass(id), GetMessageType(id));
+		}
+	}
+
+	LeaveCriticalSection(&proxy->lock);
+	return rc;
+}
+
+static BITMAP_UPDATE* update_message_copy_bitmap_update(rdpContext* context,
+                                                        const BITMAP_UPDATE* bitmap)
+{
+	UINT32 x;
+	BITMAP_UPDATE* dst;
+	rdpUpdateFrame* frame = update_message_current_frame(context);
+
+	if (!frame)
+		return copy_bitmap_update(context, bitmap);
+
+	dst = (BITMAP_UPDATE*)update_frame_alloc(frame, sizeof(BITMAP_UPDATE));
+
+	if (!dst)
+		return NULL;
+
+	*dst = *bitmap;
+	dst->rectangles =
+	    (BITMAP_DATA*)update_frame_alloc(frame, sizeof(BITMAP_DATA) * bitmap->number);
+
+	if (!dst->rectangles)
+		return NULL;
+
+	for (x = 0; x < bitmap->number; x++)
+	{
+		const BITMAP_DATA* src = &bitmap->rectangles[x];
+		BITMAP_DATA* data = &dst->rectangles[x];
+
+		*data = *src;
+		data->bitmapDataStream = NULL;
+
+		if (src->bitmapLength > 0)
+		{
+			data->bitmapDataStream = (BYTE*)update_frame_alloc(frame, src->bitmapLength);
+
+			if (!data->bitmapDataStream)
+				return NULL;
+
+			CopyMemory(data->bitmapDataStream, src->bitmapDataStream, src->bitmapLength);
+		}
+	}
+
+	return dst;
+}
+
+static SURFACE_BITS_COMMAND*
+update_message_copy_surface_bits_command(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	SURFACE_BITS_COMMAND* dst;
+	rdpUpdateFrame* frame = update_message_current_frame(context);
+
+	if (!frame)
+		return copy_surface_bits_command(context, cmd);
+
+	dst = (SURFACE_BITS_COMMAND*)update_frame_alloc(frame, sizeof(SURFACE_BITS_COMMAND));
+
+	if (!dst)
+		return NULL;
+
+	*dst = *cmd;
+	dst->bmp.bitmapData = (BYTE*)update_frame_alloc(frame, cmd->bmp.bitmapDataLength);
+
+	if (!dst->bmp.bitmapData)
+		return NULL;
+
+	CopyMemory(dst->bmp.bitmapData, cmd->bmp.bitmapData, cmd->bmp.bitmapDataLength);
+	return dst;
+}
+
 /* Update */
 
 static BOOL update_message_BeginPaint(rdpContext* context)
 {
 	rdp_update_internal* up;
+	rdpUpdateProxy* proxy;
 
 	if (!context || !context->update)
 		return FALSE;
 
 	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, BeginPaint), NULL,
-	                         NULL);
+	proxy = up->proxy;
+
+	if (proxy)
+	{
+		EnterCriticalSection(&proxy->lock);
+
+		/* A paint of another thread while a frame is open joins that frame */
+		if (!proxy->frame)
+		{
+			proxy->frame = (rdpUpdateFrame*)ObjectPool_Take(proxy->frames);
+
+			if (proxy->frame)
+			{
+				proxy->frameDepth = 1;
+				proxy->frameThreadId = GetCurrentThreadId();
+			}
+		}
+		else if (proxy->frameThreadId == GetCurrentThreadId())
+			proxy->frameDepth++;
+
+		LeaveCriticalSection(&proxy->lock);
+	}
+
+	return update_message_post(context, MakeMessageId(Update, BeginPaint), NULL, NULL, FALSE);
 }
 
 static BOOL update_message_EndPaint(rdpContext* context)
 {
+	BOOL rc;
 	rdp_update_internal* up;
+	rdpUpdateProxy* proxy;
+	rdpUpdateFrame* frame;
 
 	if (!context || !context->update)
 		return FALSE;
 
+	rc = update_message_post(context, MakeMessageId(Update, EndPaint), NULL, NULL, FALSE);
 	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, EndPaint), NULL,
-	                         NULL);
+	proxy = up->proxy;
+
+	if (!proxy)
+		return rc;
+
+	EnterCriticalSection(&proxy->lock);
+	frame = proxy->frame;
+
+	if (frame && (proxy->frameThreadId == GetCurrentThreadId()) && (--proxy->frameDepth == 0))
+	{
+		proxy->frameThreadId = 0;
+		proxy->frame = NULL;
+
+		/* Posted with the lock held, messages of other threads queue up behind the batch */
+		if (!MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, FrameBatch),
+		                       (void*)frame, NULL))
+		{
+			update_message_frame_release(context, frame);
+			rc = FALSE;
+		}
+	}
+
+	LeaveCriticalSection(&proxy->lock);
+	return rc;
 }
 
 static BOOL update_message_SetBounds(rdpContext* context, const rdpBounds* bounds)
 {
 	rdpBounds* wParam = NULL;
-	rdp_update_internal* up;
 
 	if (!context || !context->update)
 		return FALSE;
 
 	if (bounds)
 	{
-		wParam = (rdpBounds*)malloc(sizeof(rdpBounds));
+		wParam = (rdpBounds*)update_message_alloc(context, sizeof(rdpBounds));
 
 		if (!wParam)
 			return FALSE;
@@ -87,57 +514,45 @@ static BOOL update_message_SetBounds(rdpContext* context, const rdpBounds* bound
 		CopyMemory(wParam, bounds, sizeof(rdpBounds));
 	}
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, SetBounds),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SetBounds), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_Synchronize(rdpContext* context)
 {
-	rdp_update_internal* up;
-
 	if (!context || !context->update)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, Synchronize), NULL,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(Update, Synchronize), NULL, NULL, FALSE);
 }
 
 static BOOL update_message_DesktopResize(rdpContext* context)
 {
-	rdp_update_internal* up;
-
 	if (!context || !context->update)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, DesktopResize), NULL,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(Update, DesktopResize), NULL, NULL, FALSE);
 }
 
 static BOOL update_message_BitmapUpdate(rdpContext* context, const BITMAP_UPDATE* bitmap)
 {
 	BITMAP_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !bitmap)
 		return FALSE;
 
-	wParam = copy_bitmap_update(context, bitmap);
+	wParam = update_message_copy_bitmap_update(context, bitmap);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, BitmapUpdate),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, BitmapUpdate), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_Palette(rdpContext* context, const PALETTE_UPDATE* palette)
 {
 	PALETTE_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !palette)
 		return FALSE;
@@ -147,89 +562,75 @@ static BOOL update_message_Palette(rdpContext* context, const PALETTE_UPDATE* pa
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, Palette),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, Palette), (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_PlaySound(rdpContext* context, const PLAY_SOUND_UPDATE* playSound)
 {
 	PLAY_SOUND_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !playSound)
 		return FALSE;
 
-	wParam = (PLAY_SOUND_UPDATE*)malloc(sizeof(PLAY_SOUND_UPDATE));
+	wParam = (PLAY_SOUND_UPDATE*)update_message_alloc(context, sizeof(PLAY_SOUND_UPDATE));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, playSound, sizeof(PLAY_SOUND_UPDATE));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, PlaySound),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, PlaySound), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_SetKeyboardIndicators(rdpContext* context, UINT16 led_flags)
 {
-	rdp_update_internal* up;
-
 	if (!context || !context->update)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(Update, SetKeyboardIndicators), (void*)(size_t)led_flags,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(Update, SetKeyboardIndicators),
+	                           (void*)(size_t)led_flags, NULL, FALSE);
 }
 
 static BOOL update_message_SetKeyboardImeStatus(rdpContext* context, UINT16 imeId, UINT32 imeState,
                                                 UINT32 imeConvMode)
 {
-	rdp_update_internal* up;
-
 	if (!context || !context->update)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, SetKeyboardImeStatus),
-	                         (void*)(size_t)((imeId << 16UL) | imeState),
-	                         (void*)(size_t)imeConvMode);
+	return update_message_post(context, MakeMessageId(Update, SetKeyboardImeStatus),
+	                           (void*)(size_t)((imeId << 16UL) | imeState),
+	                           (void*)(size_t)imeConvMode, FALSE);
 }
 
 static BOOL update_message_RefreshRect(rdpContext* context, BYTE count, const RECTANGLE_16* areas)
 {
 	RECTANGLE_16* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !areas)
 		return FALSE;
 
-	lParam = (RECTANGLE_16*)calloc(count, sizeof(RECTANGLE_16));
+	lParam = (RECTANGLE_16*)update_message_alloc(context, sizeof(RECTANGLE_16) * count);
 
 	if (!lParam)
 		return FALSE;
 
 	CopyMemory(lParam, areas, sizeof(RECTANGLE_16) * count);
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, RefreshRect),
-	                         (void*)(size_t)count, (void*)lParam);
+	return update_message_post(context, MakeMessageId(Update, RefreshRect), (void*)(size_t)count,
+	                           (void*)lParam, TRUE);
 }
 
 static BOOL update_message_SuppressOutput(rdpContext* context, BYTE allow, const RECTANGLE_16* area)
 {
 	RECTANGLE_16* lParam = NULL;
-	rdp_update_internal* up;
 
 	if (!context || !context->update)
 		return FALSE;
 
 	if (area)
 	{
-		lParam = (RECTANGLE_16*)malloc(sizeof(RECTANGLE_16));
+		lParam = (RECTANGLE_16*)update_message_alloc(context, sizeof(RECTANGLE_16));
 
 		if (!lParam)
 			return FALSE;
@@ -237,15 +638,13 @@ static BOOL update_message_SuppressOutput(rdpContext* context, BYTE allow, const
 		CopyMemory(lParam, area, sizeof(RECTANGLE_16));
 	}
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, SuppressOutput),
-	                         (void*)(size_t)allow, (void*)lParam);
+	return update_message_post(context, MakeMessageId(Update, SuppressOutput), (void*)(size_t)allow,
+	                           (void*)lParam, TRUE);
 }
 
 static BOOL update_message_SurfaceCommand(rdpContext* context, wStream* s)
 {
 	wStream* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !s)
 		return FALSE;
@@ -258,62 +657,53 @@ static BOOL update_message_SurfaceCommand(rdpContext* context, wStream* s)
 	Stream_Copy(s, wParam, Stream_GetRemainingLength(s));
 	Stream_SetPosition(wParam, 0);
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, SurfaceCommand),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceCommand), (void*)wParam, NULL,
+	                           FALSE);
 }
 
 static BOOL update_message_SurfaceBits(rdpContext* context,
                                        const SURFACE_BITS_COMMAND* surfaceBitsCommand)
 {
 	SURFACE_BITS_COMMAND* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !surfaceBitsCommand)
 		return FALSE;
 
-	wParam = copy_surface_bits_command(context, surfaceBitsCommand);
+	wParam = update_message_copy_surface_bits_command(context, surfaceBitsCommand);
 
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, SurfaceBits),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceBits), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_SurfaceFrameMarker(rdpContext* context,
                                               const SURFACE_FRAME_MARKER* surfaceFrameMarker)
 {
 	SURFACE_FRAME_MARKER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !surfaceFrameMarker)
 		return FALSE;
 
-	wParam = (SURFACE_FRAME_MARKER*)malloc(sizeof(SURFACE_FRAME_MARKER));
+	wParam = (SURFACE_FRAME_MARKER*)update_message_alloc(context, sizeof(SURFACE_FRAME_MARKER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, surfaceFrameMarker, sizeof(SURFACE_FRAME_MARKER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(Update, SurfaceFrameMarker),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceFrameMarker), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_SurfaceFrameAcknowledge(rdpContext* context, UINT32 frameId)
 {
-	rdp_update_internal* up;
-
 	if (!context || !context->update)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(Update, SurfaceFrameAcknowledge), (void*)(size_t)frameId,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(Update, SurfaceFrameAcknowledge),
+	                           (void*)(size_t)frameId, NULL, FALSE);
 }
 
 /* Primary Update */
@@ -321,32 +711,29 @@ static BOOL update_message_SurfaceFrameAcknowledge(rdpContext* context, UINT32 f
 static BOOL update_message_DstBlt(rdpContext* context, const DSTBLT_ORDER* dstBlt)
 {
 	DSTBLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !dstBlt)
 		return FALSE;
 
-	wParam = (DSTBLT_ORDER*)malloc(sizeof(DSTBLT_ORDER));
+	wParam = (DSTBLT_ORDER*)update_message_alloc(context, sizeof(DSTBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, dstBlt, sizeof(DSTBLT_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, DstBlt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, DstBlt), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_PatBlt(rdpContext* context, PATBLT_ORDER* patBlt)
 {
 	PATBLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !patBlt)
 		return FALSE;
 
-	wParam = (PATBLT_ORDER*)malloc(sizeof(PATBLT_ORDER));
+	wParam = (PATBLT_ORDER*)update_message_alloc(context, sizeof(PATBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -354,101 +741,91 @@ static BOOL update_message_PatBlt(rdpContext* context, PATBLT_ORDER* patBlt)
 	CopyMemory(wParam, patBlt, sizeof(PATBLT_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, PatBlt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, PatBlt), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_ScrBlt(rdpContext* context, const SCRBLT_ORDER* scrBlt)
 {
 	SCRBLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !scrBlt)
 		return FALSE;
 
-	wParam = (SCRBLT_ORDER*)malloc(sizeof(SCRBLT_ORDER));
+	wParam = (SCRBLT_ORDER*)update_message_alloc(context, sizeof(SCRBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, scrBlt, sizeof(SCRBLT_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, ScrBlt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, ScrBlt), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_OpaqueRect(rdpContext* context, const OPAQUE_RECT_ORDER* opaqueRect)
 {
 	OPAQUE_RECT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !opaqueRect)
 		return FALSE;
 
-	wParam = (OPAQUE_RECT_ORDER*)malloc(sizeof(OPAQUE_RECT_ORDER));
+	wParam = (OPAQUE_RECT_ORDER*)update_message_alloc(context, sizeof(OPAQUE_RECT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, opaqueRect, sizeof(OPAQUE_RECT_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, OpaqueRect),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, OpaqueRect), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_DrawNineGrid(rdpContext* context,
                                         const DRAW_NINE_GRID_ORDER* drawNineGrid)
 {
 	DRAW_NINE_GRID_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !drawNineGrid)
 		return FALSE;
 
-	wParam = (DRAW_NINE_GRID_ORDER*)malloc(sizeof(DRAW_NINE_GRID_ORDER));
+	wParam = (DRAW_NINE_GRID_ORDER*)update_message_alloc(context, sizeof(DRAW_NINE_GRID_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, drawNineGrid, sizeof(DRAW_NINE_GRID_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, DrawNineGrid),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, DrawNineGrid), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_MultiDstBlt(rdpContext* context, const MULTI_DSTBLT_ORDER* multiDstBlt)
 {
 	MULTI_DSTBLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !multiDstBlt)
 		return FALSE;
 
-	wParam = (MULTI_DSTBLT_ORDER*)malloc(sizeof(MULTI_DSTBLT_ORDER));
+	wParam = (MULTI_DSTBLT_ORDER*)update_message_alloc(context, sizeof(MULTI_DSTBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiDstBlt, sizeof(MULTI_DSTBLT_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MultiDstBlt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiDstBlt), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_MultiPatBlt(rdpContext* context, const MULTI_PATBLT_ORDER* multiPatBlt)
 {
 	MULTI_PATBLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !multiPatBlt)
 		return FALSE;
 
-	wParam = (MULTI_PATBLT_ORDER*)malloc(sizeof(MULTI_PATBLT_ORDER));
+	wParam = (MULTI_PATBLT_ORDER*)update_message_alloc(context, sizeof(MULTI_PATBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -456,62 +833,58 @@ static BOOL update_message_MultiPatBlt(rdpContext* context, const MULTI_PATBLT_O
 	CopyMemory(wParam, multiPatBlt, sizeof(MULTI_PATBLT_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MultiPatBlt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiPatBlt), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_MultiScrBlt(rdpContext* context, const MULTI_SCRBLT_ORDER* multiScrBlt)
 {
 	MULTI_SCRBLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !multiScrBlt)
 		return FALSE;
 
-	wParam = (MULTI_SCRBLT_ORDER*)malloc(sizeof(MULTI_SCRBLT_ORDER));
+	wParam = (MULTI_SCRBLT_ORDER*)update_message_alloc(context, sizeof(MULTI_SCRBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiScrBlt, sizeof(MULTI_SCRBLT_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MultiScrBlt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiScrBlt), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_MultiOpaqueRect(rdpContext* context,
                                            const MULTI_OPAQUE_RECT_ORDER* multiOpaqueRect)
 {
 	MULTI_OPAQUE_RECT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !multiOpaqueRect)
 		return FALSE;
 
-	wParam = (MULTI_OPAQUE_RECT_ORDER*)malloc(sizeof(MULTI_OPAQUE_RECT_ORDER));
+	wParam =
+	    (MULTI_OPAQUE_RECT_ORDER*)update_message_alloc(context, sizeof(MULTI_OPAQUE_RECT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, multiOpaqueRect, sizeof(MULTI_OPAQUE_RECT_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(PrimaryUpdate, MultiOpaqueRect), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiOpaqueRect),
+	                           (void*)wParam, NULL, TRUE);
 }
 
 static BOOL update_message_MultiDrawNineGrid(rdpContext* context,
                                              const MULTI_DRAW_NINE_GRID_ORDER* multiDrawNineGrid)
 {
 	MULTI_DRAW_NINE_GRID_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !multiDrawNineGrid)
 		return FALSE;
 
-	wParam = (MULTI_DRAW_NINE_GRID_ORDER*)malloc(sizeof(MULTI_DRAW_NINE_GRID_ORDER));
+	wParam = (MULTI_DRAW_NINE_GRID_ORDER*)update_message_alloc(
+	    context, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -519,89 +892,82 @@ static BOOL update_message_MultiDrawNineGrid(rdpContext* context,
 	CopyMemory(wParam, multiDrawNineGrid, sizeof(MULTI_DRAW_NINE_GRID_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(PrimaryUpdate, MultiDrawNineGrid), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MultiDrawNineGrid),
+	                           (void*)wParam, NULL, TRUE);
 }
 
 static BOOL update_message_LineTo(rdpContext* context, const LINE_TO_ORDER* lineTo)
 {
 	LINE_TO_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !lineTo)
 		return FALSE;
 
-	wParam = (LINE_TO_ORDER*)malloc(sizeof(LINE_TO_ORDER));
+	wParam = (LINE_TO_ORDER*)update_message_alloc(context, sizeof(LINE_TO_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, lineTo, sizeof(LINE_TO_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, LineTo),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, LineTo), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_Polyline(rdpContext* context, const POLYLINE_ORDER* polyline)
 {
 	POLYLINE_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !polyline)
 		return FALSE;
 
-	wParam = (POLYLINE_ORDER*)malloc(sizeof(POLYLINE_ORDER));
+	wParam = (POLYLINE_ORDER*)update_message_alloc(context, sizeof(POLYLINE_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, polyline, sizeof(POLYLINE_ORDER));
-	wParam->points = (DELTA_POINT*)calloc(wParam->numDeltaEntries, sizeof(DELTA_POINT));
+	wParam->points = (DELTA_POINT*)update_message_alloc(context, sizeof(DELTA_POINT) *
+	                                                                  wParam->numDeltaEntries);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
 	CopyMemory(wParam->points, polyline->points, sizeof(DELTA_POINT) * wParam->numDeltaEntries);
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, Polyline),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, Polyline), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_MemBlt(rdpContext* context, MEMBLT_ORDER* memBlt)
 {
 	MEMBLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !memBlt)
 		return FALSE;
 
-	wParam = (MEMBLT_ORDER*)malloc(sizeof(MEMBLT_ORDER));
+	wParam = (MEMBLT_ORDER*)update_message_alloc(context, sizeof(MEMBLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, memBlt, sizeof(MEMBLT_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, MemBlt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, MemBlt), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_Mem3Blt(rdpContext* context, MEM3BLT_ORDER* mem3Blt)
 {
 	MEM3BLT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !mem3Blt)
 		return FALSE;
 
-	wParam = (MEM3BLT_ORDER*)malloc(sizeof(MEM3BLT_ORDER));
+	wParam = (MEM3BLT_ORDER*)update_message_alloc(context, sizeof(MEM3BLT_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -609,40 +975,36 @@ static BOOL update_message_Mem3Blt(rdpContext* context, MEM3BLT_ORDER* mem3Blt)
 	CopyMemory(wParam, mem3Blt, sizeof(MEM3BLT_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, Mem3Blt),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, Mem3Blt), (void*)wParam, NULL,
+	                           TRUE);
 }
 
 static BOOL update_message_SaveBitmap(rdpContext* context, const SAVE_BITMAP_ORDER* saveBitmap)
 {
 	SAVE_BITMAP_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !saveBitmap)
 		return FALSE;
 
-	wParam = (SAVE_BITMAP_ORDER*)malloc(sizeof(SAVE_BITMAP_ORDER));
+	wParam = (SAVE_BITMAP_ORDER*)update_message_alloc(context, sizeof(SAVE_BITMAP_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, saveBitmap, sizeof(SAVE_BITMAP_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, SaveBitmap),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, SaveBitmap), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_GlyphIndex(rdpContext* context, GLYPH_INDEX_ORDER* glyphIndex)
 {
 	GLYPH_INDEX_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !glyphIndex)
 		return FALSE;
 
-	wParam = (GLYPH_INDEX_ORDER*)malloc(sizeof(GLYPH_INDEX_ORDER));
+	wParam = (GLYPH_INDEX_ORDER*)update_message_alloc(context, sizeof(GLYPH_INDEX_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -650,40 +1012,36 @@ static BOOL update_message_GlyphIndex(rdpContext* context, GLYPH_INDEX_ORDER* gl
 	CopyMemory(wParam, glyphIndex, sizeof(GLYPH_INDEX_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, GlyphIndex),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, GlyphIndex), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_FastIndex(rdpContext* context, const FAST_INDEX_ORDER* fastIndex)
 {
 	FAST_INDEX_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !fastIndex)
 		return FALSE;
 
-	wParam = (FAST_INDEX_ORDER*)malloc(sizeof(FAST_INDEX_ORDER));
+	wParam = (FAST_INDEX_ORDER*)update_message_alloc(context, sizeof(FAST_INDEX_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, fastIndex, sizeof(FAST_INDEX_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, FastIndex),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, FastIndex), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_FastGlyph(rdpContext* context, const FAST_GLYPH_ORDER* fastGlyph)
 {
 	FAST_GLYPH_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !fastGlyph)
 		return FALSE;
 
-	wParam = (FAST_GLYPH_ORDER*)malloc(sizeof(FAST_GLYPH_ORDER));
+	wParam = (FAST_GLYPH_ORDER*)update_message_alloc(context, sizeof(FAST_GLYPH_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -692,11 +1050,11 @@ static BOOL update_message_FastGlyph(rdpContext* context, const FAST_GLYPH_ORDER
 
 	if (wParam->cbData > 1)
 	{
-		wParam->glyphData.aj = (BYTE*)malloc(fastGlyph->glyphData.cb);
+		wParam->glyphData.aj = (BYTE*)update_message_alloc(context, fastGlyph->glyphData.cb);
 
 		if (!wParam->glyphData.aj)
 		{
-			free(wParam);
+			update_message_discard(context, wParam);
 			return FALSE;
 		}
 
@@ -707,99 +1065,93 @@ static BOOL update_message_FastGlyph(rdpContext* context, const FAST_GLYPH_ORDER
 		wParam->glyphData.aj = NULL;
 	}
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, FastGlyph),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, FastGlyph), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_PolygonSC(rdpContext* context, const POLYGON_SC_ORDER* polygonSC)
 {
 	POLYGON_SC_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !polygonSC)
 		return FALSE;
 
-	wParam = (POLYGON_SC_ORDER*)malloc(sizeof(POLYGON_SC_ORDER));
+	wParam = (POLYGON_SC_ORDER*)update_message_alloc(context, sizeof(POLYGON_SC_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, polygonSC, sizeof(POLYGON_SC_ORDER));
-	wParam->points = (DELTA_POINT*)calloc(wParam->numPoints, sizeof(DELTA_POINT));
+	wParam->points =
+	    (DELTA_POINT*)update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->points, polygonSC, sizeof(DELTA_POINT) * wParam->numPoints);
+	CopyMemory(wParam->points, polygonSC->points, sizeof(DELTA_POINT) * wParam->numPoints);
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, PolygonSC),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, PolygonSC), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_PolygonCB(rdpContext* context, POLYGON_CB_ORDER* polygonCB)
 {
 	POLYGON_CB_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !polygonCB)
 		return FALSE;
 
-	wParam = (POLYGON_CB_ORDER*)malloc(sizeof(POLYGON_CB_ORDER));
+	wParam = (POLYGON_CB_ORDER*)update_message_alloc(context, sizeof(POLYGON_CB_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, polygonCB, sizeof(POLYGON_CB_ORDER));
-	wParam->points = (DELTA_POINT*)calloc(wParam->numPoints, sizeof(DELTA_POINT));
+	wParam->points =
+	    (DELTA_POINT*)update_message_alloc(context, sizeof(DELTA_POINT) * wParam->numPoints);
 
 	if (!wParam->points)
 	{
-		free(wParam);
+		update_message_discard(context, wParam);
 		return FALSE;
 	}
 
-	CopyMemory(wParam->points, polygonCB, sizeof(DELTA_POINT) * wParam->numPoints);
+	CopyMemory(wParam->points, polygonCB->points, sizeof(DELTA_POINT) * wParam->numPoints);
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, PolygonCB),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, PolygonCB), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_EllipseSC(rdpContext* context, const ELLIPSE_SC_ORDER* ellipseSC)
 {
 	ELLIPSE_SC_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !ellipseSC)
 		return FALSE;
 
-	wParam = (ELLIPSE_SC_ORDER*)malloc(sizeof(ELLIPSE_SC_ORDER));
+	wParam = (ELLIPSE_SC_ORDER*)update_message_alloc(context, sizeof(ELLIPSE_SC_ORDER));
 
 	if (!wParam)
 		return FALSE;
 
 	CopyMemory(wParam, ellipseSC, sizeof(ELLIPSE_SC_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, EllipseSC),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, EllipseSC), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 static BOOL update_message_EllipseCB(rdpContext* context, const ELLIPSE_CB_ORDER* ellipseCB)
 {
 	ELLIPSE_CB_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !ellipseCB)
 		return FALSE;
 
-	wParam = (ELLIPSE_CB_ORDER*)malloc(sizeof(ELLIPSE_CB_ORDER));
+	wParam = (ELLIPSE_CB_ORDER*)update_message_alloc(context, sizeof(ELLIPSE_CB_ORDER));
 
 	if (!wParam)
 		return FALSE;
@@ -807,9 +1159,8 @@ static BOOL update_message_EllipseCB(rdpContext* context, const ELLIPSE_CB_ORDER
 	CopyMemory(wParam, ellipseCB, sizeof(ELLIPSE_CB_ORDER));
 	wParam->brush.data = (BYTE*)wParam->brush.p8x8;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PrimaryUpdate, EllipseCB),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PrimaryUpdate, EllipseCB), (void*)wParam,
+	                           NULL, TRUE);
 }
 
 /* Secondary Update */
@@ -818,7 +1169,6 @@ static BOOL update_message_CacheBitmap(rdpContext* context,
                                        const CACHE_BITMAP_ORDER* cacheBitmapOrder)
 {
 	CACHE_BITMAP_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !cacheBitmapOrder)
 		return FALSE;
@@ -828,16 +1178,14 @@ static BOOL update_message_CacheBitmap(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBitmap),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBitmap), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_CacheBitmapV2(rdpContext* context,
                                          CACHE_BITMAP_V2_ORDER* cacheBitmapV2Order)
 {
 	CACHE_BITMAP_V2_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !cacheBitmapV2Order)
 		return FALSE;
@@ -847,16 +1195,14 @@ static BOOL update_message_CacheBitmapV2(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheBitmapV2), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBitmapV2),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_CacheBitmapV3(rdpContext* context,
                                          CACHE_BITMAP_V3_ORDER* cacheBitmapV3Order)
 {
 	CACHE_BITMAP_V3_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !cacheBitmapV3Order)
 		return FALSE;
@@ -866,16 +1212,14 @@ static BOOL update_message_CacheBitmapV3(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheBitmapV3), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBitmapV3),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_CacheColorTable(rdpContext* context,
                                            const CACHE_COLOR_TABLE_ORDER* cacheColorTableOrder)
 {
 	CACHE_COLOR_TABLE_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !cacheColorTableOrder)
 		return FALSE;
@@ -885,15 +1229,13 @@ static BOOL update_message_CacheColorTable(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheColorTable), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheColorTable),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_CacheGlyph(rdpContext* context, const CACHE_GLYPH_ORDER* cacheGlyphOrder)
 {
 	CACHE_GLYPH_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !cacheGlyphOrder)
 		return FALSE;
@@ -903,16 +1245,14 @@ static BOOL update_message_CacheGlyph(rdpContext* context, const CACHE_GLYPH_ORD
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheGlyph),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheGlyph), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_CacheGlyphV2(rdpContext* context,
                                         const CACHE_GLYPH_V2_ORDER* cacheGlyphV2Order)
 {
 	CACHE_GLYPH_V2_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !cacheGlyphV2Order)
 		return FALSE;
@@ -922,15 +1262,13 @@ static BOOL update_message_CacheGlyphV2(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(SecondaryUpdate, CacheGlyphV2), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheGlyphV2), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_CacheBrush(rdpContext* context, const CACHE_BRUSH_ORDER* cacheBrushOrder)
 {
 	CACHE_BRUSH_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !cacheBrushOrder)
 		return FALSE;
@@ -940,9 +1278,8 @@ static BOOL update_message_CacheBrush(rdpContext* context, const CACHE_BRUSH_ORD
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(SecondaryUpdate, CacheBrush),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(SecondaryUpdate, CacheBrush), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 /* Alternate Secondary Update */
@@ -952,7 +1289,6 @@ update_message_CreateOffscreenBitmap(rdpContext* context,
                                      const CREATE_OFFSCREEN_BITMAP_ORDER* createOffscreenBitmap)
 {
 	CREATE_OFFSCREEN_BITMAP_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !createOffscreenBitmap)
 		return FALSE;
@@ -976,17 +1312,14 @@ update_message_CreateOffscreenBitmap(rdpContext* context,
 	CopyMemory(wParam->deleteList.indices, createOffscreenBitmap->deleteList.indices,
 	           wParam->deleteList.cIndices);
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, CreateOffscreenBitmap), (void*)wParam,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, CreateOffscreenBitmap),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_SwitchSurface(rdpContext* context,
                                          const SWITCH_SURFACE_ORDER* switchSurface)
 {
 	SWITCH_SURFACE_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !switchSurface)
 		return FALSE;
@@ -998,9 +1331,8 @@ static BOOL update_message_SwitchSurface(rdpContext* context,
 
 	CopyMemory(wParam, switchSurface, sizeof(SWITCH_SURFACE_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(AltSecUpdate, SwitchSurface),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, SwitchSurface), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL
@@ -1008,7 +1340,6 @@ update_message_CreateNineGridBitmap(rdpContext* context,
                                     const CREATE_NINE_GRID_BITMAP_ORDER* createNineGridBitmap)
 {
 	CREATE_NINE_GRID_BITMAP_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !createNineGridBitmap)
 		return FALSE;
@@ -1020,16 +1351,13 @@ update_message_CreateNineGridBitmap(rdpContext* context,
 
 	CopyMemory(wParam, createNineGridBitmap, sizeof(CREATE_NINE_GRID_BITMAP_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, CreateNineGridBitmap), (void*)wParam,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, CreateNineGridBitmap),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_FrameMarker(rdpContext* context, const FRAME_MARKER_ORDER* frameMarker)
 {
 	FRAME_MARKER_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !frameMarker)
 		return FALSE;
@@ -1041,16 +1369,14 @@ static BOOL update_message_FrameMarker(rdpContext* context, const FRAME_MARKER_O
 
 	CopyMemory(wParam, frameMarker, sizeof(FRAME_MARKER_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(AltSecUpdate, FrameMarker),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, FrameMarker), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_StreamBitmapFirst(rdpContext* context,
                                              const STREAM_BITMAP_FIRST_ORDER* streamBitmapFirst)
 {
 	STREAM_BITMAP_FIRST_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !streamBitmapFirst)
 		return FALSE;
@@ -1063,16 +1389,14 @@ static BOOL update_message_StreamBitmapFirst(rdpContext* context,
 	CopyMemory(wParam, streamBitmapFirst, sizeof(STREAM_BITMAP_FIRST_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, StreamBitmapFirst), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, StreamBitmapFirst),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_StreamBitmapNext(rdpContext* context,
                                             const STREAM_BITMAP_NEXT_ORDER* streamBitmapNext)
 {
 	STREAM_BITMAP_NEXT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !streamBitmapNext)
 		return FALSE;
@@ -1085,16 +1409,14 @@ static BOOL update_message_StreamBitmapNext(rdpContext* context,
 	CopyMemory(wParam, streamBitmapNext, sizeof(STREAM_BITMAP_NEXT_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, StreamBitmapNext), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, StreamBitmapNext),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_DrawGdiPlusFirst(rdpContext* context,
                                             const DRAW_GDIPLUS_FIRST_ORDER* drawGdiPlusFirst)
 {
 	DRAW_GDIPLUS_FIRST_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !drawGdiPlusFirst)
 		return FALSE;
@@ -1106,16 +1428,14 @@ static BOOL update_message_DrawGdiPlusFirst(rdpContext* context,
 
 	CopyMemory(wParam, drawGdiPlusFirst, sizeof(DRAW_GDIPLUS_FIRST_ORDER));
 	/* TODO: complete copy */
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusFirst), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusFirst),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_DrawGdiPlusNext(rdpContext* context,
                                            const DRAW_GDIPLUS_NEXT_ORDER* drawGdiPlusNext)
 {
 	DRAW_GDIPLUS_NEXT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !drawGdiPlusNext)
 		return FALSE;
@@ -1128,16 +1448,14 @@ static BOOL update_message_DrawGdiPlusNext(rdpContext* context,
 	CopyMemory(wParam, drawGdiPlusNext, sizeof(DRAW_GDIPLUS_NEXT_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusNext), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusNext), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_DrawGdiPlusEnd(rdpContext* context,
                                           const DRAW_GDIPLUS_END_ORDER* drawGdiPlusEnd)
 {
 	DRAW_GDIPLUS_END_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !drawGdiPlusEnd)
 		return FALSE;
@@ -1150,9 +1468,8 @@ static BOOL update_message_DrawGdiPlusEnd(rdpContext* context,
 	CopyMemory(wParam, drawGdiPlusEnd, sizeof(DRAW_GDIPLUS_END_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(AltSecUpdate, DrawGdiPlusEnd),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusEnd), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL
@@ -1160,7 +1477,6 @@ update_message_DrawGdiPlusCacheFirst(rdpContext* context,
                                      const DRAW_GDIPLUS_CACHE_FIRST_ORDER* drawGdiPlusCacheFirst)
 {
 	DRAW_GDIPLUS_CACHE_FIRST_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !drawGdiPlusCacheFirst)
 		return FALSE;
@@ -1173,10 +1489,8 @@ update_message_DrawGdiPlusCacheFirst(rdpContext* context,
 	CopyMemory(wParam, drawGdiPlusCacheFirst, sizeof(DRAW_GDIPLUS_CACHE_FIRST_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheFirst), (void*)wParam,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusCacheFirst),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL
@@ -1184,7 +1498,6 @@ update_message_DrawGdiPlusCacheNext(rdpContext* context,
                                     const DRAW_GDIPLUS_CACHE_NEXT_ORDER* drawGdiPlusCacheNext)
 {
 	DRAW_GDIPLUS_CACHE_NEXT_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !drawGdiPlusCacheNext)
 		return FALSE;
@@ -1197,10 +1510,8 @@ update_message_DrawGdiPlusCacheNext(rdpContext* context,
 	CopyMemory(wParam, drawGdiPlusCacheNext, sizeof(DRAW_GDIPLUS_CACHE_NEXT_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheNext), (void*)wParam,
-	                         NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusCacheNext),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL
@@ -1208,7 +1519,6 @@ update_message_DrawGdiPlusCacheEnd(rdpContext* context,
                                    const DRAW_GDIPLUS_CACHE_END_ORDER* drawGdiPlusCacheEnd)
 {
 	DRAW_GDIPLUS_CACHE_END_ORDER* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !drawGdiPlusCacheEnd)
 		return FALSE;
@@ -1221,9 +1531,8 @@ update_message_DrawGdiPlusCacheEnd(rdpContext* context,
 	CopyMemory(wParam, drawGdiPlusCacheEnd, sizeof(DRAW_GDIPLUS_CACHE_END_ORDER));
 	/* TODO: complete copy */
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(AltSecUpdate, DrawGdiPlusCacheEnd), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(AltSecUpdate, DrawGdiPlusCacheEnd),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 /* Window Update */
@@ -1233,7 +1542,6 @@ static BOOL update_message_WindowCreate(rdpContext* context, const WINDOW_ORDER_
 {
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_STATE_ORDER* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo || !windowState)
 		return FALSE;
@@ -1254,9 +1562,8 @@ static BOOL update_message_WindowCreate(rdpContext* context, const WINDOW_ORDER_
 
 	CopyMemory(lParam, windowState, sizeof(WINDOW_STATE_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(WindowUpdate, WindowCreate),
-	                         (void*)wParam, (void*)lParam);
+	return update_message_post(context, MakeMessageId(WindowUpdate, WindowCreate), (void*)wParam,
+	                           (void*)lParam, FALSE);
 }
 
 static BOOL update_message_WindowUpdate(rdpContext* context, const WINDOW_ORDER_INFO* orderInfo,
@@ -1264,7 +1571,6 @@ static BOOL update_message_WindowUpdate(rdpContext* context, const WINDOW_ORDER_
 {
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_STATE_ORDER* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo || !windowState)
 		return FALSE;
@@ -1285,9 +1591,8 @@ static BOOL update_message_WindowUpdate(rdpContext* context, const WINDOW_ORDER_
 
 	CopyMemory(lParam, windowState, sizeof(WINDOW_STATE_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(WindowUpdate, WindowUpdate),
-	                         (void*)wParam, (void*)lParam);
+	return update_message_post(context, MakeMessageId(WindowUpdate, WindowUpdate), (void*)wParam,
+	                           (void*)lParam, FALSE);
 }
 
 static BOOL update_message_WindowIcon(rdpContext* context, const WINDOW_ORDER_INFO* orderInfo,
@@ -1295,7 +1600,6 @@ static BOOL update_message_WindowIcon(rdpContext* context, const WINDOW_ORDER_IN
 {
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_ICON_ORDER* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo || !windowIcon)
 		return FALSE;
@@ -1352,9 +1656,8 @@ static BOOL update_message_WindowIcon(rdpContext* context, const WINDOW_ORDER_IN
 		           windowIcon->iconInfo->cbColorTable);
 	}
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(WindowUpdate, WindowIcon),
-	                         (void*)wParam, (void*)lParam);
+	return update_message_post(context, MakeMessageId(WindowUpdate, WindowIcon), (void*)wParam,
+	                           (void*)lParam, FALSE);
 out_fail:
 
 	if (lParam && lParam->iconInfo)
@@ -1375,7 +1678,6 @@ static BOOL update_message_WindowCachedIcon(rdpContext* context, const WINDOW_OR
 {
 	WINDOW_ORDER_INFO* wParam;
 	WINDOW_CACHED_ICON_ORDER* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo || !windowCachedIcon)
 		return FALSE;
@@ -1396,16 +1698,13 @@ static BOOL update_message_WindowCachedIcon(rdpContext* context, const WINDOW_OR
 
 	CopyMemory(lParam, windowCachedIcon, sizeof(WINDOW_CACHED_ICON_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(WindowUpdate, WindowCachedIcon), (void*)wParam,
-	                         (void*)lParam);
+	return update_message_post(context, MakeMessageId(WindowUpdate, WindowCachedIcon),
+	                           (void*)wParam, (void*)lParam, FALSE);
 }
 
 static BOOL update_message_WindowDelete(rdpContext* context, const WINDOW_ORDER_INFO* orderInfo)
 {
 	WINDOW_ORDER_INFO* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo)
 		return FALSE;
@@ -1417,9 +1716,8 @@ static BOOL update_message_WindowDelete(rdpContext* context, const WINDOW_ORDER_
 
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(WindowUpdate, WindowDelete),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(WindowUpdate, WindowDelete), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_NotifyIconCreate(rdpContext* context, const WINDOW_ORDER_INFO* orderInfo,
@@ -1427,7 +1725,6 @@ static BOOL update_message_NotifyIconCreate(rdpContext* context, const WINDOW_OR
 {
 	WINDOW_ORDER_INFO* wParam;
 	NOTIFY_ICON_STATE_ORDER* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo || !notifyIconState)
 		return FALSE;
@@ -1448,10 +1745,8 @@ static BOOL update_message_NotifyIconCreate(rdpContext* context, const WINDOW_OR
 
 	CopyMemory(lParam, notifyIconState, sizeof(NOTIFY_ICON_STATE_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(WindowUpdate, NotifyIconCreate), (void*)wParam,
-	                         (void*)lParam);
+	return update_message_post(context, MakeMessageId(WindowUpdate, NotifyIconCreate),
+	                           (void*)wParam, (void*)lParam, FALSE);
 }
 
 static BOOL update_message_NotifyIconUpdate(rdpContext* context, const WINDOW_ORDER_INFO* orderInfo,
@@ -1459,7 +1754,6 @@ static BOOL update_message_NotifyIconUpdate(rdpContext* context, const WINDOW_OR
 {
 	WINDOW_ORDER_INFO* wParam;
 	NOTIFY_ICON_STATE_ORDER* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo || !notifyIconState)
 		return FALSE;
@@ -1480,16 +1774,13 @@ static BOOL update_message_NotifyIconUpdate(rdpContext* context, const WINDOW_OR
 
 	CopyMemory(lParam, notifyIconState, sizeof(NOTIFY_ICON_STATE_ORDER));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(WindowUpdate, NotifyIconUpdate), (void*)wParam,
-	                         (void*)lParam);
+	return update_message_post(context, MakeMessageId(WindowUpdate, NotifyIconUpdate),
+	                           (void*)wParam, (void*)lParam, FALSE);
 }
 
 static BOOL update_message_NotifyIconDelete(rdpContext* context, const WINDOW_ORDER_INFO* orderInfo)
 {
 	WINDOW_ORDER_INFO* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo)
 		return FALSE;
@@ -1501,9 +1792,8 @@ static BOOL update_message_NotifyIconDelete(rdpContext* context, const WINDOW_OR
 
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(WindowUpdate, NotifyIconDelete), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(WindowUpdate, NotifyIconDelete),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_MonitoredDesktop(rdpContext* context, const WINDOW_ORDER_INFO* orderInfo,
@@ -1511,7 +1801,6 @@ static BOOL update_message_MonitoredDesktop(rdpContext* context, const WINDOW_OR
 {
 	WINDOW_ORDER_INFO* wParam;
 	MONITORED_DESKTOP_ORDER* lParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo || !monitoredDesktop)
 		return FALSE;
@@ -1539,17 +1828,14 @@ static BOOL update_message_MonitoredDesktop(rdpContext* context, const WINDOW_OR
 		CopyMemory(lParam->windowIds, monitoredDesktop->windowIds, lParam->numWindowIds);
 	}
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(WindowUpdate, MonitoredDesktop), (void*)wParam,
-	                         (void*)lParam);
+	return update_message_post(context, MakeMessageId(WindowUpdate, MonitoredDesktop),
+	                           (void*)wParam, (void*)lParam, FALSE);
 }
 
 static BOOL update_message_NonMonitoredDesktop(rdpContext* context,
                                                const WINDOW_ORDER_INFO* orderInfo)
 {
 	WINDOW_ORDER_INFO* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !orderInfo)
 		return FALSE;
@@ -1561,9 +1847,8 @@ static BOOL update_message_NonMonitoredDesktop(rdpContext* context,
 
 	CopyMemory(wParam, orderInfo, sizeof(WINDOW_ORDER_INFO));
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(WindowUpdate, NonMonitoredDesktop), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(WindowUpdate, NonMonitoredDesktop),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 /* Pointer Update */
@@ -1572,7 +1857,6 @@ static BOOL update_message_PointerPosition(rdpContext* context,
                                            const POINTER_POSITION_UPDATE* pointerPosition)
 {
 	POINTER_POSITION_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !pointerPosition)
 		return FALSE;
@@ -1582,16 +1866,14 @@ static BOOL update_message_PointerPosition(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context,
-	                         MakeMessageId(PointerUpdate, PointerPosition), (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PointerUpdate, PointerPosition),
+	                           (void*)wParam, NULL, FALSE);
 }
 
 static BOOL update_message_PointerSystem(rdpContext* context,
                                          const POINTER_SYSTEM_UPDATE* pointerSystem)
 {
 	POINTER_SYSTEM_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !pointerSystem)
 		return FALSE;
@@ -1601,16 +1883,14 @@ static BOOL update_message_PointerSystem(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PointerUpdate, PointerSystem),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PointerUpdate, PointerSystem), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_PointerColor(rdpContext* context,
                                         const POINTER_COLOR_UPDATE* pointerColor)
 {
 	POINTER_COLOR_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !pointerColor)
 		return FALSE;
@@ -1620,15 +1900,13 @@ static BOOL update_message_PointerColor(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PointerUpdate, PointerColor),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PointerUpdate, PointerColor), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_PointerLarge(rdpContext* context, const POINTER_LARGE_UPDATE* pointer)
 {
 	POINTER_LARGE_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !pointer)
 		return FALSE;
@@ -1638,15 +1916,13 @@ static BOOL update_message_PointerLarge(rdpContext* context, const POINTER_LARGE
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PointerUpdate, PointerLarge),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PointerUpdate, PointerLarge), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_PointerNew(rdpContext* context, const POINTER_NEW_UPDATE* pointerNew)
 {
 	POINTER_NEW_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !pointerNew)
 		return FALSE;
@@ -1656,16 +1932,14 @@ static BOOL update_message_PointerNew(rdpContext* context, const POINTER_NEW_UPD
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PointerUpdate, PointerNew),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PointerUpdate, PointerNew), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 static BOOL update_message_PointerCached(rdpContext* context,
                                          const POINTER_CACHED_UPDATE* pointerCached)
 {
 	POINTER_CACHED_UPDATE* wParam;
-	rdp_update_internal* up;
 
 	if (!context || !context->update || !pointerCached)
 		return FALSE;
@@ -1675,9 +1949,8 @@ static BOOL update_message_PointerCached(rdpContext* context,
 	if (!wParam)
 		return FALSE;
 
-	up = update_cast(context->update);
-	return MessageQueue_Post(up->queue, (void*)context, MakeMessageId(PointerUpdate, PointerCached),
-	                         (void*)wParam, NULL);
+	return update_message_post(context, MakeMessageId(PointerUpdate, PointerCached), (void*)wParam,
+	                           NULL, FALSE);
 }
 
 /* Message Queue */
@@ -1757,6 +2030,10 @@ static BOOL update_message_free_update_class(wMessage* msg, int type)
 		case Update_SetKeyboardImeStatus:
 			break;
 
+		case Update_FrameBatch:
+			update_message_frame_release(context, (rdpUpdateFrame*)msg->wParam);
+			break;
+
 		default:
 			return FALSE;
 	}
@@ -1850,6 +2127,10 @@ static BOOL update_message_process_update_class(rdpUpdateProxy* proxy, wMessage*
 		}
 		break;
 
+		case Update_FrameBatch:
+			rc = update_message_process_frame(proxy, (rdpUpdateFrame*)msg->wParam);
+			break;
+
 		default:
 			break;
 	}
@@ -2880,6 +3161,7 @@ static DWORD WINAPI update_message_proxy_thread(LPVOID arg)
 
 rdpUpdateProxy* update_message_proxy_new(rdpUpdate* update)
 {
+	wObject* obj;
 	rdpUpdateProxy* message;
 
 	if (!update)
@@ -2889,11 +3171,31 @@ rdpUpdateProxy* update_message_proxy_new(rdpUpdate* update)
 		return NULL;
 
 	message->update = update;
+	message->frames = ObjectPool_New(TRUE);
+
+	if (!message->frames)
+	{
+		free(message);
+		return NULL;
+	}
+
+	if (!InitializeCriticalSectionAndSpinCount(&message->lock, 4000))
+	{
+		ObjectPool_Free(message->frames);
+		free(message);
+		return NULL;
+	}
+
+	obj = ObjectPool_Object(message->frames);
+	obj->fnObjectNew = update_frame_new;
+	obj->fnObjectFree = update_frame_free;
 	update_message_register_interface(message, update);
 
 	if (!(message->thread = CreateThread(NULL, 0, update_message_proxy_thread, update, 0, NULL)))
 	{
 		WLog_ERR(TAG, "Failed to create proxy thread");
+		DeleteCriticalSection(&message->lock);
+		ObjectPool_Free(message->frames);
 		free(message);
 		return NULL;
 	}
@@ -2910,6 +3212,15 @@ void update_message_proxy_free(rdpUpdateProxy* message)
 			WaitForSingleObject(message->thread, INFINITE);
 
 		CloseHandle(message->thread);
+
+		/* Release what the update thread did not process, the frames go back to the pool */
+		MessageQueue_Clear(up->queue);
+		EnterCriticalSection(&message->lock);
+		update_frame_free(message->frame);
+		message->frame = NULL;
+		LeaveCriticalSection(&message->lock);
+		DeleteCriticalSection(&message->lock);
+		ObjectPool_Free(message->frames);
 		free(message);
 	}
 }
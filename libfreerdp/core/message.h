@@ -30,10 +30,24 @@
 
 /* Update Proxy Interface */
 
+/**
+ * Messages posted between BeginPaint and EndPaint are collected in a frame
+ * and handed to the update thread as a single Update_FrameBatch message.
+ */
+#define Update_FrameBatch 0x80
+
+typedef struct rdp_update_frame rdpUpdateFrame;
+
 struct rdp_update_proxy
 {
 	rdpUpdate* update;
 
+	wObjectPool* frames;
+	CRITICAL_SECTION lock; /* guards the open frame */
+	rdpUpdateFrame* frame;
+	DWORD frameThreadId;
+	UINT32 frameDepth;
+
 	/* Update */
 
 	pBeginPaint BeginPaint;
@@ -35,6 +35,7 @@
 #include <freerdp/channels/drdynvc.h>
 
 #include "rdp.h"
+#include "channels.h"
 
 #include "server.h"
 
@@ -56,6 +57,12 @@ typedef struct
 	UINT32 offset;
 } wtsChannelMessage;
 
+enum
+{
+	WTS_QUEUE_ITEM_SVC = 0, /* wParam is the stream */
+	WTS_QUEUE_ITEM_DVC = 1  /* wParam is the stream, lParam the dynamic channel id */
+};
+
 static DWORD g_SessionId = 1;
 static wHashTable* g_ServerHandles = NULL;
 
@@ -105,18 +112,38 @@ static BOOL wts_queue_receive_data(rdpPeerChannel* channel, const BYTE* Buffer,
 	return MessageQueue_Post(channel->queue, messageCtx, 0, NULL, NULL);
 }
 
-static BOOL wts_queue_send_item(rdpPeerChannel* channel, BYTE* Buffer, UINT32 Length)
+/**
+ * Queue the data of s for sending, the queue takes over the reference on s.
+ * Dynamic channel data is split into chunks when it is sent, the chunks are written
+ * into the transport directly from s.
+ */
+static BOOL wts_queue_send_item(rdpPeerChannel* channel, wStream* s)
 {
-	BYTE* buffer;
-	UINT32 length;
-	UINT16 channelId;
+	BOOL rc;
+	WTSVirtualChannelManager* vcm;
+
 	WINPR_ASSERT(channel);
-	WINPR_ASSERT(channel->vcm);
-	buffer = Buffer;
-	length = Length;
-	channelId = channel->channelId;
-	return MessageQueue_Post(channel->vcm->queue, (void*)(UINT_PTR)channelId, 0, (void*)buffer,
-	                         (void*)(UINT_PTR)length);
+	WINPR_ASSERT(s);
+
+	vcm = channel->vcm;
+	WINPR_ASSERT(vcm);
+
+	Stream_SealLength(s);
+
+	if (channel->channelType == RDP_PEER_CHANNEL_TYPE_DVC)
+	{
+		WINPR_ASSERT(vcm->drdynvc_channel);
+		rc = MessageQueue_Post(vcm->queue, (void*)(UINT_PTR)vcm->drdynvc_channel->channelId,
+		                       WTS_QUEUE_ITEM_DVC, s, (void*)(UINT_PTR)channel->channelId);
+	}
+	else
+		rc = MessageQueue_Post(vcm->queue, (void*)(UINT_PTR)channel->channelId,
+		                       WTS_QUEUE_ITEM_SVC, s, NULL);
+
+	if (!rc)
+		Stream_Release(s);
+
+	return rc;
 }
 
 static int wts_read_variable_uint(wStream* s, int cbLen, UINT32* val)
@@ -564,6 +591,58 @@ BOOL WTSVirtualChannelManagerOpen(HANDLE hServer)
 	return TRUE;
 }
 
+/**
+ * Send the data of a dynamic channel in chunks of at most VirtualChannelChunkSize bytes.
+ * Every chunk is a DATA_FIRST or DATA PDU header followed by the next range of s.
+ */
+static BOOL wts_send_dvc_data(WTSVirtualChannelManager* vcm, UINT16 drdynvcId, UINT32 ChannelId,
+                              wStream* s)
+{
+	BOOL first = TRUE;
+	size_t chunkSize;
+	const BYTE* data = Stream_Buffer(s);
+	size_t left = Stream_Length(s);
+
+	WINPR_ASSERT(vcm->client);
+	WINPR_ASSERT(vcm->client->context);
+	WINPR_ASSERT(vcm->client->context->settings);
+	chunkSize = vcm->client->context->settings->VirtualChannelChunkSize;
+
+	while (left > 0)
+	{
+		int cbChId;
+		size_t written;
+		BYTE header[16] = { 0 };
+		wStream sbuffer = { 0 };
+		wStream* hs = Stream_StaticInit(&sbuffer, header, sizeof(header));
+
+		Stream_Seek_UINT8(hs);
+		cbChId = wts_write_variable_uint(hs, ChannelId);
+
+		if (first && (left > chunkSize - Stream_GetPosition(hs)))
+		{
+			const int cbLen = wts_write_variable_uint(hs, (UINT32)left);
+			header[0] = (DATA_FIRST_PDU << 4) | (cbLen << 2) | cbChId;
+		}
+		else
+		{
+			header[0] = (DATA_PDU << 4) | cbChId;
+		}
+
+		first = FALSE;
+		written = MIN(left, chunkSize - Stream_GetPosition(hs));
+
+		if (!freerdp_channel_send_chunk(vcm->rdp, drdynvcId, header, Stream_GetPosition(hs), data,
+		                                written))
+			return FALSE;
+
+		data += written;
+		left -= written;
+	}
+
+	return TRUE;
+}
+
 BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen)
 {
 	wMessage message;
@@ -583,21 +662,20 @@ BOOL WTSVirtualChannelManagerCheckFileDescriptorEx(HANDLE hServer, BOOL autoOpen
 
 	while (MessageQueue_Peek(vcm->queue, &message, TRUE))
 	{
-		BYTE* buffer;
-		UINT32 length;
-		UINT16 channelId;
-		channelId = (UINT16)(UINT_PTR)message.context;
-		buffer = (BYTE*)message.wParam;
-		length = (UINT32)(UINT_PTR)message.lParam;
+		const UINT16 channelId = (UINT16)(UINT_PTR)message.context;
+		wStream* s = (wStream*)message.wParam;
 
-		WINPR_ASSERT(vcm->client);
-		WINPR_ASSERT(vcm->client->SendChannelData);
-		if (!vcm->client->SendChannelData(vcm->client, channelId, buffer, length))
+		if (message.id == WTS_QUEUE_ITEM_DVC)
+			status = wts_send_dvc_data(vcm, channelId, (UINT32)(UINT_PTR)message.lParam, s);
+		else
 		{
-			status = FALSE;
+			WINPR_ASSERT(vcm->client);
+			WINPR_ASSERT(vcm->client->SendChannelData);
+			status = vcm->client->SendChannelData(vcm->client, channelId, Stream_Buffer(s),
+			                                      Stream_Length(s));
 		}
 
-		free(buffer);
+		Stream_Release(s);
 
 		if (!status)
 			break;
@@ -915,13 +993,8 @@ static void wts_virtual_channel_manager_free_message(void* obj)
 {
 	wMessage* msg = (wMessage*)obj;
 
-	if (msg)
-	{
-		BYTE* buffer = (BYTE*)msg->wParam;
-
-		if (buffer)
-			free(buffer);
-	}
+	if (msg && msg->wParam)
+		Stream_Release((wStream*)msg->wParam);
 }
 
 static void channel_free(rdpPeerChannel* channel);
@@ -973,6 +1046,11 @@ HANDLE WINAPI FreeRDP_WTSOpenServerA(LPSTR pServerName)
 	if (!HashTable_Insert(g_ServerHandles, (void*)(UINT_PTR)vcm->SessionId, (void*)vcm))
 		goto error_free;
 
+	vcm->pool = StreamPool_New(TRUE, 0);
+
+	if (!vcm->pool)
+		goto error_queue;
+
 	queueCallbacks.fnObjectFree = wts_virtual_channel_manager_free_message;
 	vcm->queue = MessageQueue_New(&queueCallbacks);
 
@@ -998,6 +1076,7 @@ error_dynamicVirtualChannels:
 error_queue:
 	HashTable_Remove(g_ServerHandles, (void*)(UINT_PTR)vcm->SessionId);
 error_free:
+	StreamPool_Free(vcm->pool);
 	free(vcm);
 error_vcm_alloc:
 	SetLastError(ERROR_NOT_ENOUGH_MEMORY);
@@ -1032,6 +1111,7 @@ VOID WINAPI FreeRDP_WTSCloseServer(HANDLE hServer)
 		}
 
 		MessageQueue_Free(vcm->queue);
+		StreamPool_Free(vcm->pool);
 		free(vcm);
 	}
 }
@@ -1503,98 +1583,84 @@ BOOL WINAPI FreeRDP_WTSVirtualChannelRead(HANDLE hChannelHandle, ULONG TimeOut,
 	return TRUE;
 }
 
+/* Dynamic channels can only be written once drdynvc is ready */
+static BOOL wts_channel_writable(rdpPeerChannel* channel)
+{
+	if (!channel)
+		return FALSE;
+
+	WINPR_ASSERT(channel->vcm);
+
+	if ((channel->channelType != RDP_PEER_CHANNEL_TYPE_SVC) &&
+	    (!channel->vcm->drdynvc_channel || (channel->vcm->drdynvc_state != DRDYNVC_STATE_READY)))
+	{
+		DEBUG_DVC("drdynvc not ready");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 BOOL WINAPI FreeRDP_WTSVirtualChannelWrite(HANDLE hChannelHandle, PCHAR Buffer, ULONG Length,
                                            PULONG pBytesWritten)
 {
 	wStream* s;
-	int cbLen;
-	int cbChId;
-	int first;
-	BYTE* buffer;
-	UINT32 length;
-	UINT32 written;
-	UINT32 totalWritten = 0;
 	rdpPeerChannel* channel = (rdpPeerChannel*)hChannelHandle;
-	BOOL ret = TRUE;
 
-	if (!channel)
+	if (!wts_channel_writable(channel))
 		return FALSE;
 
-	WINPR_ASSERT(channel->vcm);
-	if (channel->channelType == RDP_PEER_CHANNEL_TYPE_SVC)
-	{
-		length = Length;
-		buffer = (BYTE*)malloc(length);
-
-		if (!buffer)
-		{
-			SetLastError(E_OUTOFMEMORY);
-			return FALSE;
-		}
+	s = StreamPool_Take(channel->vcm->pool, Length);
 
-		CopyMemory(buffer, Buffer, length);
-		totalWritten = Length;
-		ret = wts_queue_send_item(channel, buffer, length);
-	}
-	else if (!channel->vcm->drdynvc_channel || (channel->vcm->drdynvc_state != DRDYNVC_STATE_READY))
+	if (!s)
 	{
-		DEBUG_DVC("drdynvc not ready");
+		WLog_ERR(TAG, "StreamPool_Take failed!");
+		SetLastError(E_OUTOFMEMORY);
 		return FALSE;
 	}
-	else
-	{
-		rdpContext* context;
-
-		first = TRUE;
-		WINPR_ASSERT(channel->client);
-		context = channel->client->context;
-		WINPR_ASSERT(context);
-		WINPR_ASSERT(context->settings);
-		while (Length > 0)
-		{
-			s = Stream_New(NULL, context->settings->VirtualChannelChunkSize);
 
-			if (!s)
-			{
-				WLog_ERR(TAG, "Stream_New failed!");
-				SetLastError(E_OUTOFMEMORY);
-				return FALSE;
-			}
+	Stream_Write(s, Buffer, Length);
 
-			buffer = Stream_Buffer(s);
-			Stream_Seek_UINT8(s);
-			cbChId = wts_write_variable_uint(s, channel->channelId);
+	if (!wts_queue_send_item(channel, s))
+		return FALSE;
 
-			if (first && (Length > (UINT32)Stream_GetRemainingLength(s)))
-			{
-				cbLen = wts_write_variable_uint(s, Length);
-				buffer[0] = (DATA_FIRST_PDU << 4) | (cbLen << 2) | cbChId;
-			}
-			else
-			{
-				buffer[0] = (DATA_PDU << 4) | cbChId;
-			}
+	if (pBytesWritten)
+		*pBytesWritten = Length;
 
-			first = FALSE;
-			written = Stream_GetRemainingLength(s);
+	return TRUE;
+}
 
-			if (written > Length)
-				written = Length;
+wStream* WTSVirtualChannelTakeStream(HANDLE hChannelHandle, size_t size)
+{
+	rdpPeerChannel* channel = (rdpPeerChannel*)hChannelHandle;
 
-			Stream_Write(s, Buffer, written);
-			length = Stream_GetPosition(s);
-			Stream_Free(s, FALSE);
-			Length -= written;
-			Buffer += written;
-			totalWritten += written;
-			ret = wts_queue_send_item(channel->vcm->drdynvc_channel, buffer, length);
-		}
+	if (!channel)
+		return NULL;
+
+	WINPR_ASSERT(channel->vcm);
+	return StreamPool_Take(channel->vcm->pool, size);
+}
+
+BOOL WTSVirtualChannelWriteStream(HANDLE hChannelHandle, wStream* s)
+{
+	rdpPeerChannel* channel = (rdpPeerChannel*)hChannelHandle;
+
+	if (!s)
+		return FALSE;
+
+	if (!s->pool)
+	{
+		Stream_Free(s, TRUE);
+		return FALSE;
 	}
 
-	if (pBytesWritten)
-		*pBytesWritten = totalWritten;
+	if (!wts_channel_writable(channel))
+	{
+		Stream_Release(s);
+		return FALSE;
+	}
 
-	return ret;
+	return wts_queue_send_item(channel, s);
 }
 
 BOOL WINAPI FreeRDP_WTSVirtualChannelPurgeInput(HANDLE hChannelHandle)
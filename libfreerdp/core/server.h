@@ -75,6 +75,7 @@ struct WTSVirtualChannelManager
 
 	DWORD SessionId;
 	wMessageQueue* queue;
+	wStreamPool* pool; /* streams referenced by the send queue */
 
 	rdpPeerChannel* drdynvc_channel;
 	BYTE drdynvc_state;
@@ -0,0 +1,344 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+
+#include "../update.h"
+#include "../message.h"
+
+#define TEST_BEGIN_PAINT 0x1000
+#define TEST_END_PAINT 0x2000
+#define TEST_POLYGON_SC 0x3000
+#define TEST_MAX_CALLS 64
+
+typedef struct
+{
+	CRITICAL_SECTION lock;
+	UINT32 calls[TEST_MAX_CALLS];
+	size_t count;
+	size_t invalid;
+	HANDLE block; /* set while the update thread may run */
+} test_log;
+
+static test_log state = { 0 };
+
+static void test_log_call(UINT32 call)
+{
+	EnterCriticalSection(&state.lock);
+
+	if (state.count < TEST_MAX_CALLS)
+		state.calls[state.count++] = call;
+
+	LeaveCriticalSection(&state.lock);
+}
+
+static size_t test_log_count(void)
+{
+	size_t count;
+	EnterCriticalSection(&state.lock);
+	count = state.count;
+	LeaveCriticalSection(&state.lock);
+	return count;
+}
+
+static void test_log_reset(void)
+{
+	EnterCriticalSection(&state.lock);
+	state.count = 0;
+	state.invalid = 0;
+	LeaveCriticalSection(&state.lock);
+}
+
+static BOOL test_BeginPaint(rdpContext* context)
+{
+	WINPR_UNUSED(context);
+	test_log_call(TEST_BEGIN_PAINT);
+	return TRUE;
+}
+
+static BOOL test_EndPaint(rdpContext* context)
+{
+	WINPR_UNUSED(context);
+	WaitForSingleObject(state.block, INFINITE);
+	test_log_call(TEST_END_PAINT);
+	return TRUE;
+}
+
+/* The surface bits carry their number in destLeft and in every byte of the payload */
+static BOOL test_SurfaceBits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	WINPR_UNUSED(context);
+
+	for (UINT32 x = 0; x < cmd->bmp.bitmapDataLength; x++)
+	{
+		if (cmd->bmp.bitmapData[x] != (BYTE)cmd->destLeft)
+		{
+			EnterCriticalSection(&state.lock);
+			state.invalid++;
+			LeaveCriticalSection(&state.lock);
+			break;
+		}
+	}
+
+	test_log_call(cmd->destLeft);
+	return TRUE;
+}
+
+static BOOL test_PolygonSC(rdpContext* context, const POLYGON_SC_ORDER* polygonSC)
+{
+	WINPR_UNUSED(context);
+
+	for (UINT32 x = 0; x < polygonSC->numPoints; x++)
+	{
+		if ((polygonSC->points[x].x != (INT32)x) || (polygonSC->points[x].y != -(INT32)x))
+		{
+			EnterCriticalSection(&state.lock);
+			state.invalid++;
+			LeaveCriticalSection(&state.lock);
+			break;
+		}
+	}
+
+	test_log_call(TEST_POLYGON_SC + polygonSC->numPoints);
+	return TRUE;
+}
+
+static BOOL test_surface_bits(rdpContext* context, UINT32 id)
+{
+	BYTE data[256];
+	SURFACE_BITS_COMMAND cmd = { 0 };
+
+	memset(data, (BYTE)id, sizeof(data));
+	cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
+	cmd.destLeft = id;
+	cmd.bmp.bitmapDataLength = sizeof(data);
+	cmd.bmp.bitmapData = data;
+	return context->update->SurfaceBits(context, &cmd);
+}
+
+static BOOL test_polygon_sc(rdpContext* context, UINT32 numPoints)
+{
+	DELTA_POINT points[32] = { 0 };
+	POLYGON_SC_ORDER polygonSC = { 0 };
+
+	for (UINT32 x = 0; x < numPoints; x++)
+	{
+		points[x].x = (INT32)x;
+		points[x].y = -(INT32)x;
+	}
+
+	polygonSC.numPoints = numPoints;
+	polygonSC.points = points;
+	return context->update->primary->PolygonSC(context, &polygonSC);
+}
+
+/* Wait for the update thread to deliver the expected calls, in order */
+static BOOL test_expect(const char* what, const UINT32* calls, size_t count)
+{
+	BOOL rc;
+	const UINT64 end = GetTickCount64() + 5000;
+
+	while ((test_log_count() < count) && (GetTickCount64() < end))
+		Sleep(10);
+
+	EnterCriticalSection(&state.lock);
+	rc = (state.count == count) && (state.invalid == 0) &&
+	     (memcmp(state.calls, calls, count * sizeof(UINT32)) == 0);
+
+	if (!rc)
+	{
+		fprintf(stderr, "[%s] %" PRIuz " calls, %" PRIuz " invalid payloads:", what, state.count,
+		        state.invalid);
+
+		for (size_t x = 0; x < state.count; x++)
+			fprintf(stderr, " 0x%04" PRIx32, state.calls[x]);
+
+		fprintf(stderr, "\n");
+	}
+
+	LeaveCriticalSection(&state.lock);
+	test_log_reset();
+	return rc;
+}
+
+/* Nothing of an open frame may reach the update thread */
+static BOOL test_expect_nothing(const char* what)
+{
+	Sleep(50);
+
+	if (test_log_count() == 0)
+		return TRUE;
+
+	fprintf(stderr, "[%s] messages of an open frame were delivered\n", what);
+	return FALSE;
+}
+
+static BOOL test_batching(rdpContext* context)
+{
+	rdpUpdate* update = context->update;
+	const UINT32 calls[] = { TEST_BEGIN_PAINT, 1, TEST_POLYGON_SC + 5, 2, TEST_END_PAINT };
+
+	if (!update->BeginPaint(context) || !test_surface_bits(context, 1) ||
+	    !test_polygon_sc(context, 5) || !test_surface_bits(context, 2))
+		return FALSE;
+
+	if (!test_expect_nothing(__FUNCTION__) || !update->EndPaint(context))
+		return FALSE;
+
+	return test_expect(__FUNCTION__, calls, ARRAYSIZE(calls));
+}
+
+static BOOL test_nested(rdpContext* context)
+{
+	rdpUpdate* update = context->update;
+	const UINT32 calls[] = { TEST_BEGIN_PAINT, 1, TEST_BEGIN_PAINT, 2, TEST_END_PAINT,
+		                     3,                TEST_END_PAINT };
+
+	if (!update->BeginPaint(context) || !test_surface_bits(context, 1) ||
+	    !update->BeginPaint(context) || !test_surface_bits(context, 2) ||
+	    !update->EndPaint(context) || !test_surface_bits(context, 3))
+		return FALSE;
+
+	/* The inner EndPaint does not close the frame */
+	if (!test_expect_nothing(__FUNCTION__) || !update->EndPaint(context))
+		return FALSE;
+
+	return test_expect(__FUNCTION__, calls, ARRAYSIZE(calls));
+}
+
+static DWORD WINAPI test_foreign_thread(LPVOID arg)
+{
+	rdpContext* context = (rdpContext*)arg;
+	return test_surface_bits(context, 2) ? 0 : 1;
+}
+
+static BOOL test_foreign(rdpContext* context)
+{
+	DWORD status = 1;
+	HANDLE thread;
+	rdpUpdate* update = context->update;
+	const UINT32 calls[] = { TEST_BEGIN_PAINT, 1, 2, 3, TEST_END_PAINT };
+	const UINT32 direct[] = { 2 };
+
+	if (!update->BeginPaint(context) || !test_surface_bits(context, 1))
+		return FALSE;
+
+	/* An update of another thread joins the open frame instead of overtaking it */
+	if (!(thread = CreateThread(NULL, 0, test_foreign_thread, context, 0, NULL)))
+		return FALSE;
+
+	WaitForSingleObject(thread, INFINITE);
+	GetExitCodeThread(thread, &status);
+	CloseHandle(thread);
+
+	if ((status != 0) || !test_surface_bits(context, 3) || !test_expect_nothing(__FUNCTION__) ||
+	    !update->EndPaint(context) || !test_expect(__FUNCTION__, calls, ARRAYSIZE(calls)))
+		return FALSE;
+
+	/* Without a frame it is posted directly */
+	if (!(thread = CreateThread(NULL, 0, test_foreign_thread, context, 0, NULL)))
+		return FALSE;
+
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	return test_expect(__FUNCTION__, direct, ARRAYSIZE(direct));
+}
+
+static BOOL test_polygon_sc_copy(rdpContext* context)
+{
+	const UINT32 calls[] = { TEST_POLYGON_SC + 7 };
+
+	/* Outside of a frame the points are copied to the heap */
+	if (!test_polygon_sc(context, 7))
+		return FALSE;
+
+	return test_expect(__FUNCTION__, calls, ARRAYSIZE(calls));
+}
+
+/* Frames queued behind a busy update thread and an open frame are released on disconnect */
+static BOOL test_disconnect(rdpContext* context)
+{
+	rdpUpdate* update = context->update;
+	rdp_update_internal* up = update_cast(update);
+	const UINT32 calls[] = { TEST_BEGIN_PAINT, 1, TEST_END_PAINT,   TEST_BEGIN_PAINT,
+		                     2,                TEST_END_PAINT,   TEST_BEGIN_PAINT,
+		                     3,                TEST_END_PAINT };
+
+	ResetEvent(state.block);
+
+	for (UINT32 x = 1; x <= 3; x++)
+	{
+		if (!update->BeginPaint(context) || !test_surface_bits(context, x) ||
+		    !update->EndPaint(context))
+			return FALSE;
+	}
+
+	/* Left open, never delivered */
+	if (!update->BeginPaint(context) || !test_surface_bits(context, 4) ||
+	    !test_polygon_sc(context, 3))
+		return FALSE;
+
+	SetEvent(state.block);
+	update_post_disconnect(update);
+
+	if (up->proxy || (MessageQueue_Size(up->queue) != 0))
+	{
+		fprintf(stderr, "[%s] messages left after disconnect\n", __FUNCTION__);
+		return FALSE;
+	}
+
+	return test_expect(__FUNCTION__, calls, ARRAYSIZE(calls));
+}
+
+int TestUpdateMessage(int argc, char* argv[])
+{
+	int rc = -1;
+	freerdp* instance = NULL;
+	rdpContext* context;
+	rdpUpdate* update;
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!InitializeCriticalSectionAndSpinCount(&state.lock, 4000))
+		return -1;
+
+	state.block = CreateEvent(NULL, TRUE, TRUE, NULL);
+	instance = freerdp_new();
+
+	if (!state.block || !instance || !freerdp_context_new(instance))
+		goto fail;
+
+	context = instance->context;
+	update = context->update;
+	update->BeginPaint = test_BeginPaint;
+	update->EndPaint = test_EndPaint;
+	update->SurfaceBits = test_SurfaceBits;
+	update->primary->PolygonSC = test_PolygonSC;
+
+	if (!freerdp_settings_set_bool(context->settings, FreeRDP_AsyncUpdate, TRUE) ||
+	    !update_post_connect(update))
+		goto fail;
+
+	if (!test_batching(context) || !test_nested(context) || !test_foreign(context) ||
+	    !test_polygon_sc_copy(context) || !test_disconnect(context))
+		goto fail;
+
+	rc = 0;
+fail:
+	if (instance)
+	{
+		freerdp_context_free(instance);
+		freerdp_free(instance);
+	}
+
+	if (state.block)
+		CloseHandle(state.block);
+
+	DeleteCriticalSection(&state.lock);
+	return rc;
+}
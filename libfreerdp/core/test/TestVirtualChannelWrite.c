@@ -0,0 +1,313 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/stream.h>
+#include <winpr/winsock.h>
+#include <winpr/wtsapi.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/peer.h>
+#include <freerdp/svc.h>
+#include <freerdp/transport_io.h>
+#include <freerdp/channels/channels.h>
+#include <freerdp/channels/drdynvc.h>
+#include <freerdp/channels/wtsvc.h>
+
+#include "../rdp.h"
+#include "../mcs.h"
+
+#define TEST_DRDYNVC_ID 1004
+
+typedef struct
+{
+	size_t pdus;
+	size_t invalid;
+	size_t maxChunk;
+	BYTE firstCmd;
+	UINT32 firstLength;
+	UINT32 dvcChannelId;
+	wStream* payload;
+} test_capture;
+
+static test_capture capture = { 0 };
+
+static BOOL test_read_var(wStream* s, BYTE cb, UINT32* val)
+{
+	switch (cb)
+	{
+		case 0:
+			if (!Stream_CheckAndLogRequiredLength("test", s, 1))
+				return FALSE;
+			Stream_Read_UINT8(s, *val);
+			return TRUE;
+		case 1:
+			if (!Stream_CheckAndLogRequiredLength("test", s, 2))
+				return FALSE;
+			Stream_Read_UINT16(s, *val);
+			return TRUE;
+		case 2:
+			if (!Stream_CheckAndLogRequiredLength("test", s, 4))
+				return FALSE;
+			Stream_Read_UINT32(s, *val);
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/* Unpack the DVC data of a server to client channel PDU, rdp_write_header layout without
+ * security: TPKT, X.224, MCS send data indication (channelId at offset 10), 15 bytes. */
+static int test_write_pdu(rdpTransport* transport, wStream* s)
+{
+	BYTE hdr;
+	UINT16 channelId;
+	UINT32 length;
+	UINT32 flags;
+	UINT32 dvcChannelId;
+	wStream sbuffer = { 0 };
+	wStream* rs = Stream_StaticConstInit(&sbuffer, Stream_Buffer(s), Stream_Length(s));
+
+	WINPR_UNUSED(transport);
+	capture.pdus++;
+
+	if (!Stream_CheckAndLogRequiredLength("test", rs, 15 + 8 + 2))
+		goto invalid;
+
+	Stream_SetPosition(rs, 10);
+	Stream_Read_UINT16_BE(rs, channelId);
+	Stream_SetPosition(rs, 15);
+	Stream_Read_UINT32(rs, length);
+	Stream_Read_UINT32(rs, flags);
+
+	if ((channelId != TEST_DRDYNVC_ID) || (length != Stream_GetRemainingLength(rs)) ||
+	    (flags != (CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST)))
+		goto invalid;
+
+	capture.maxChunk = MAX(capture.maxChunk, length);
+	Stream_Read_UINT8(rs, hdr);
+
+	if (!test_read_var(rs, hdr & 0x03, &dvcChannelId))
+		goto invalid;
+
+	if (capture.pdus == 1)
+	{
+		capture.firstCmd = hdr >> 4;
+		capture.dvcChannelId = dvcChannelId;
+
+		if ((capture.firstCmd == DATA_FIRST_PDU) &&
+		    !test_read_var(rs, (hdr >> 2) & 0x03, &capture.firstLength))
+			goto invalid;
+	}
+	else if (((hdr >> 4) != DATA_PDU) || (dvcChannelId != capture.dvcChannelId))
+		goto invalid;
+
+	if (!Stream_EnsureRemainingCapacity(capture.payload, Stream_GetRemainingLength(rs)))
+		goto invalid;
+
+	Stream_Write(capture.payload, Stream_Pointer(rs), Stream_GetRemainingLength(rs));
+	return (int)Stream_Length(s);
+invalid:
+	capture.invalid++;
+	return (int)Stream_Length(s);
+}
+
+static void test_capture_reset(void)
+{
+	wStream* payload = capture.payload;
+	ZeroMemory(&capture, sizeof(capture));
+	capture.payload = payload;
+	Stream_SetPosition(capture.payload, 0);
+}
+
+static BOOL test_dvc_chunks(HANDLE hServer, HANDLE dvc, UINT32 chunkSize, size_t size)
+{
+	size_t x;
+	ULONG written = 0;
+	BOOL rc = FALSE;
+	BYTE* data = (BYTE*)malloc(size);
+
+	if (!data)
+		return FALSE;
+
+	for (x = 0; x < size; x++)
+		data[x] = (BYTE)(x * 7 + x / 251);
+
+	test_capture_reset();
+
+	if (!WTSVirtualChannelWrite(dvc, (PCHAR)data, (ULONG)size, &written) || (written != size))
+	{
+		fprintf(stderr, "[%s] WTSVirtualChannelWrite of %" PRIuz " bytes failed\n", __FUNCTION__,
+		        size);
+		goto fail;
+	}
+
+	/* Nothing goes out before the queue is drained */
+	if (capture.pdus != 0)
+	{
+		fprintf(stderr, "[%s] data sent before the queue was drained\n", __FUNCTION__);
+		goto fail;
+	}
+
+	if (!WTSVirtualChannelManagerCheckFileDescriptorEx(hServer, FALSE))
+	{
+		fprintf(stderr, "[%s] draining the queue failed\n", __FUNCTION__);
+		goto fail;
+	}
+
+	if (capture.invalid || (capture.pdus < 2) || (capture.maxChunk != chunkSize))
+	{
+		fprintf(stderr,
+		        "[%s] %" PRIuz " bytes: %" PRIuz " PDUs, %" PRIuz " invalid, largest chunk %" PRIuz
+		        " bytes, expected %" PRIu32 "\n",
+		        __FUNCTION__, size, capture.pdus, capture.invalid, capture.maxChunk, chunkSize);
+		goto fail;
+	}
+
+	if ((capture.firstCmd != DATA_FIRST_PDU) || (capture.firstLength != size))
+	{
+		fprintf(stderr, "[%s] first chunk cmd %" PRIu8 " length %" PRIu32 ", expected %" PRIuz "\n",
+		        __FUNCTION__, capture.firstCmd, capture.firstLength, size);
+		goto fail;
+	}
+
+	if ((Stream_GetPosition(capture.payload) != size) ||
+	    (memcmp(Stream_Buffer(capture.payload), data, size) != 0))
+	{
+		fprintf(stderr, "[%s] reassembled %" PRIuz " bytes differ from the %" PRIuz " written\n",
+		        __FUNCTION__, Stream_GetPosition(capture.payload), size);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(data);
+	return rc;
+}
+
+static BOOL test_unknown_channel(HANDLE hServer, HANDLE dvc, rdpMcsChannel* drdynvc)
+{
+	ULONG written = 0;
+	BYTE data[32] = { 0 };
+	BOOL rc = FALSE;
+
+	test_capture_reset();
+
+	if (!WTSVirtualChannelWrite(dvc, (PCHAR)data, sizeof(data), &written))
+		return FALSE;
+
+	/* Chunks are only sent on channels known to MCS */
+	drdynvc->ChannelId = TEST_DRDYNVC_ID + 1;
+
+	if (WTSVirtualChannelManagerCheckFileDescriptorEx(hServer, FALSE) || (capture.pdus != 0))
+		fprintf(stderr, "[%s] DVC data sent on a channel unknown to MCS\n", __FUNCTION__);
+	else
+		rc = TRUE;
+
+	drdynvc->ChannelId = TEST_DRDYNVC_ID;
+	return rc;
+}
+
+int TestVirtualChannelWrite(int argc, char* argv[])
+{
+	int rc = -1;
+	SOCKET sockfd;
+	WSADATA wsaData;
+	rdpRdp* rdp;
+	rdpMcsChannel* drdynvc;
+	rdpTransportIo io;
+	DWORD bytes = 0;
+	ULONG* sessionId = NULL;
+	HANDLE dvc = NULL;
+	HANDLE hServer = INVALID_HANDLE_VALUE;
+	freerdp_peer* client = NULL;
+	UINT32 chunkSize;
+	const BYTE capsResponse[] = { CAPABILITY_REQUEST_PDU << 4, 0x00, 0x01, 0x00 };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	WTSRegisterWtsApiFunctionTable(FreeRDP_InitWtsApi());
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+	capture.payload = Stream_New(NULL, 1024);
+
+	/* The transport needs a socket, the test PDUs never reach it */
+	sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (!capture.payload || (sockfd == INVALID_SOCKET))
+		goto fail;
+
+	client = freerdp_peer_new((int)sockfd);
+
+	if (!client || !freerdp_peer_context_new(client))
+	{
+		fprintf(stderr, "[%s] failed to create the peer\n", __FUNCTION__);
+		goto fail;
+	}
+
+	rdp = client->context->rdp;
+	chunkSize = freerdp_settings_get_uint32(client->context->settings,
+	                                        FreeRDP_VirtualChannelChunkSize);
+	drdynvc = &rdp->mcs->channels[0];
+	sprintf_s(drdynvc->Name, sizeof(drdynvc->Name), "%s", DRDYNVC_SVC_CHANNEL_NAME);
+	drdynvc->ChannelId = TEST_DRDYNVC_ID;
+	drdynvc->joined = TRUE;
+	rdp->mcs->channelCount = 1;
+
+	io = *freerdp_get_io_callbacks(client->context);
+	io.WritePdu = test_write_pdu;
+
+	if (!freerdp_set_io_callbacks(client->context, &io))
+		goto fail;
+
+	hServer = WTSOpenServerA((LPSTR)client->context);
+
+	if ((hServer == INVALID_HANDLE_VALUE) || !WTSVirtualChannelManagerOpen(hServer) ||
+	    !WTSVirtualChannelManagerCheckFileDescriptorEx(hServer, FALSE))
+	{
+		fprintf(stderr, "[%s] failed to open drdynvc\n", __FUNCTION__);
+		goto fail;
+	}
+
+	if (!client->ReceiveChannelData(client, TEST_DRDYNVC_ID, capsResponse, sizeof(capsResponse),
+	                                CHANNEL_FLAG_FIRST | CHANNEL_FLAG_LAST, sizeof(capsResponse)) ||
+	    !WTSQuerySessionInformationA(hServer, WTS_CURRENT_SESSION, WTSSessionId,
+	                                 (LPSTR*)&sessionId, &bytes) ||
+	    !sessionId)
+		goto fail;
+
+	dvc = WTSVirtualChannelOpenEx(*sessionId, "testdvc", WTS_CHANNEL_OPTION_DYNAMIC);
+
+	if (!dvc || !WTSVirtualChannelManagerCheckFileDescriptorEx(hServer, FALSE))
+	{
+		fprintf(stderr, "[%s] failed to open the dynamic channel\n", __FUNCTION__);
+		goto fail;
+	}
+
+	if (!test_dvc_chunks(hServer, dvc, chunkSize, chunkSize + 1) ||
+	    !test_dvc_chunks(hServer, dvc, chunkSize, 3ull * chunkSize) ||
+	    !test_dvc_chunks(hServer, dvc, chunkSize, 256 * 1024 + 17) ||
+	    !test_unknown_channel(hServer, dvc, drdynvc))
+		goto fail;
+
+	rc = 0;
+fail:
+	WTSFreeMemory(sessionId);
+
+	if (dvc)
+		WTSVirtualChannelClose(dvc);
+
+	if (hServer != INVALID_HANDLE_VALUE)
+		WTSCloseServer(hServer);
+
+	if (client)
+	{
+		freerdp_peer_context_free(client);
+		freerdp_peer_free(client);
+	}
+	else if (sockfd != INVALID_SOCKET)
+		closesocket(sockfd);
+
+	Stream_Free(capture.payload, TRUE);
+	WSACleanup();
+	return rc;
+}
@@ -1412,6 +1412,12 @@ wStream* transport_take_from_pool(rdpTransport* transport, size_t size)
 	return StreamPool_Take(transport->ReceivePool, size);
 }
 
+wStream* transport_slice_from_pool(rdpTransport* transport, const BYTE* data, size_t length)
+{
+	WINPR_ASSERT(transport);
+	return StreamPool_Slice(transport->ReceivePool, data, length);
+}
+
 ULONG transport_get_bytes_sent(rdpTransport* transport, BOOL resetCount)
 {
 	ULONG rc;
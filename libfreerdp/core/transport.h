@@ -99,6 +99,8 @@ FREERDP_LOCAL BOOL transport_set_tsg(rdpTransport* transport, rdpTsg* tsg);
 FREERDP_LOCAL rdpTsg* transport_get_tsg(rdpTransport* transport);
 
 FREERDP_LOCAL wStream* transport_take_from_pool(rdpTransport* transport, size_t size);
+FREERDP_LOCAL wStream* transport_slice_from_pool(rdpTransport* transport, const BYTE* data,
+                                                 size_t length);
 
 FREERDP_LOCAL ULONG transport_get_bytes_sent(rdpTransport* transport, BOOL resetCount);
 
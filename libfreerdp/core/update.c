@@ -909,7 +909,10 @@ void update_post_disconnect(rdpUpdate* update)
 	up->asynchronous = update->context->settings->AsyncUpdate;
 
 	if (up->asynchronous)
+	{
 		update_message_proxy_free(up->proxy);
+		up->proxy = NULL;
+	}
 
 	up->initialState = TRUE;
 }
@@ -1227,6 +1230,33 @@ out:
 	return ret;
 }
 
+static BOOL update_send_fastpath_update(rdpContext* context, BYTE updateCode, wStream* s)
+{
+	wStream* update;
+	rdpRdp* rdp;
+	BOOL ret = FALSE;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(s);
+	rdp = context->rdp;
+	WINPR_ASSERT(rdp);
+
+	update_force_flush(context);
+	update = fastpath_update_pdu_init(rdp->fastpath);
+
+	if (!update)
+		return FALSE;
+
+	if (!Stream_EnsureRemainingCapacity(update, Stream_GetRemainingLength(s)))
+		goto out_fail;
+
+	Stream_Write(update, Stream_Pointer(s), Stream_GetRemainingLength(s));
+	ret = fastpath_send_update_pdu(rdp->fastpath, updateCode, update, FALSE);
+out_fail:
+	Stream_Release(update);
+	return ret;
+}
+
 static BOOL update_send_surface_bits(rdpContext* context,
                                      const SURFACE_BITS_COMMAND* surfaceBitsCommand)
 {
@@ -2966,6 +2996,7 @@ void update_register_server_callbacks(rdpUpdate* update)
 	update->SurfaceFrameMarker = update_send_surface_frame_marker;
 	update->SurfaceCommand = update_send_surface_command;
 	update->SurfaceFrameBits = update_send_surface_frame_bits;
+	update->FastPathUpdate = update_send_fastpath_update;
 	update->PlaySound = update_send_play_sound;
 	update->SetKeyboardIndicators = update_send_set_keyboard_indicators;
 	update->SetKeyboardImeStatus = update_send_set_keyboard_ime_status;
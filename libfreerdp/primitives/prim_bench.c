@@ -0,0 +1,519 @@
+/* prim_bench.c
+ * Per primitive implementation report and benchmark.
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <winpr/crt.h>
+#include <winpr/sysinfo.h>
+#include <freerdp/primitives.h>
+
+#include "prim_internal.h"
+
+#include <freerdp/log.h>
+#define TAG FREERDP_TAG("primitives")
+
+#define PRIM_BENCH_WIDTH 256
+#define PRIM_BENCH_HEIGHT 256
+#define PRIM_BENCH_DURATION 10 /* ms per implementation and primitive */
+
+typedef struct
+{
+	prim_size_t roi;
+	UINT32 length; /* elements of the 1D primitives */
+	UINT32 rgbStep;
+	BYTE* rgb[3]; /* two sources and a destination, 32bpp */
+	UINT32 planeStep[3];
+	BYTE* yuv[3];
+	BYTE* main[3];
+	BYTE* aux[3];
+	UINT32 coeffStep; /* bytes */
+	INT16* coeffs[3];
+	INT16* out[3];
+} prim_bench_data;
+
+typedef pstatus_t (*prim_bench_fn)(const primitives_t* prims, prim_bench_data* data);
+typedef pstatus_t (*prim_fn)(void);
+
+typedef struct
+{
+	const char* name;
+	size_t offset;
+	prim_bench_fn bench;
+} prim_slot;
+
+static pstatus_t bench_copy(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->copy(d->rgb[0], d->rgb[2], (INT32)(d->rgbStep * d->roi.height));
+}
+
+static pstatus_t bench_copy_8u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->copy_8u(d->rgb[0], d->rgb[2], (INT32)(d->rgbStep * d->roi.height));
+}
+
+static pstatus_t bench_copy_8u_AC4r(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->copy_8u_AC4r(d->rgb[0], (INT32)d->rgbStep, d->rgb[2], (INT32)d->rgbStep,
+	                           (INT32)d->roi.width, (INT32)d->roi.height);
+}
+
+static pstatus_t bench_set_8u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->set_8u(0xA5, d->rgb[2], d->rgbStep * d->roi.height);
+}
+
+static pstatus_t bench_set_32s(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->set_32s(-0x12345, (INT32*)d->rgb[2], d->length);
+}
+
+static pstatus_t bench_set_32u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->set_32u(0xFF123456, (UINT32*)d->rgb[2], d->length);
+}
+
+static pstatus_t bench_zero(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->zero(d->rgb[2], 1ull * d->rgbStep * d->roi.height);
+}
+
+static pstatus_t bench_add_16s(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->add_16s(d->coeffs[0], d->coeffs[1], d->out[0], d->length);
+}
+
+static pstatus_t bench_andC_32u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->andC_32u((const UINT32*)d->rgb[0], 0x00FFFFFF, (UINT32*)d->rgb[2],
+	                       (INT32)d->length);
+}
+
+static pstatus_t bench_orC_32u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->orC_32u((const UINT32*)d->rgb[0], 0xFF000000, (UINT32*)d->rgb[2],
+	                      (INT32)d->length);
+}
+
+static pstatus_t bench_lShiftC_16s(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->lShiftC_16s(d->coeffs[0], 2, d->out[0], d->length);
+}
+
+static pstatus_t bench_lShiftC_16u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->lShiftC_16u((const UINT16*)d->coeffs[0], 2, (UINT16*)d->out[0], d->length);
+}
+
+static pstatus_t bench_rShiftC_16s(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->rShiftC_16s(d->coeffs[0], 2, d->out[0], d->length);
+}
+
+static pstatus_t bench_rShiftC_16u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->rShiftC_16u((const UINT16*)d->coeffs[0], 2, (UINT16*)d->out[0], d->length);
+}
+
+static pstatus_t bench_shiftC_16s(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->shiftC_16s(d->coeffs[0], -2, d->out[0], d->length);
+}
+
+static pstatus_t bench_shiftC_16u(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->shiftC_16u((const UINT16*)d->coeffs[0], -2, (UINT16*)d->out[0], d->length);
+}
+
+static pstatus_t bench_alphaComp_argb(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->alphaComp_argb(d->rgb[0], d->rgbStep, d->rgb[1], d->rgbStep, d->rgb[2],
+	                             d->rgbStep, d->roi.width, d->roi.height);
+}
+
+static pstatus_t bench_sign_16s(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->sign_16s(d->coeffs[0], d->out[0], d->length);
+}
+
+static pstatus_t bench_yCbCrToRGB_16s8u_P3AC4R(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->yCbCrToRGB_16s8u_P3AC4R((const INT16* const*)d->coeffs, d->coeffStep, d->rgb[2],
+	                                      d->rgbStep, PIXEL_FORMAT_BGRX32, &d->roi);
+}
+
+static pstatus_t bench_yCbCrToRGB_16s16s_P3P3(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->yCbCrToRGB_16s16s_P3P3((const INT16* const*)d->coeffs, (INT32)d->coeffStep,
+	                                     d->out, (INT32)d->coeffStep, &d->roi);
+}
+
+static pstatus_t bench_RGBToYCbCr_16s16s_P3P3(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->RGBToYCbCr_16s16s_P3P3((const INT16* const*)d->coeffs, (INT32)d->coeffStep,
+	                                     d->out, (INT32)d->coeffStep, &d->roi);
+}
+
+static pstatus_t bench_RGBToRGB_16s8u_P3AC4R(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->RGBToRGB_16s8u_P3AC4R((const INT16* const*)d->coeffs, d->coeffStep, d->rgb[2],
+	                                    d->rgbStep, PIXEL_FORMAT_BGRX32, &d->roi);
+}
+
+static pstatus_t bench_YCoCgToRGB_8u_AC4R(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->YCoCgToRGB_8u_AC4R(d->rgb[0], (INT32)d->rgbStep, d->rgb[2], PIXEL_FORMAT_BGRX32,
+	                                 (INT32)d->rgbStep, d->roi.width, d->roi.height, 2, FALSE);
+}
+
+static pstatus_t bench_YUV420ToRGB_8u_P3AC4R(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->YUV420ToRGB_8u_P3AC4R((const BYTE* const*)d->yuv, d->planeStep, d->rgb[2],
+	                                    d->rgbStep, PIXEL_FORMAT_BGRX32, &d->roi);
+}
+
+static pstatus_t bench_RGBToYUV420_8u_P3AC4R(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->RGBToYUV420_8u_P3AC4R(d->rgb[0], PIXEL_FORMAT_BGRX32, d->rgbStep, d->main,
+	                                    d->planeStep, &d->roi);
+}
+
+static pstatus_t bench_RGBToYUV444_8u_P3AC4R(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->RGBToYUV444_8u_P3AC4R(d->rgb[0], PIXEL_FORMAT_BGRX32, d->rgbStep, d->main,
+	                                    d->planeStep, &d->roi);
+}
+
+static pstatus_t bench_YUV420CombineToYUV444(const primitives_t* prims, prim_bench_data* d)
+{
+	const RECTANGLE_16 rect = { 0, 0, (UINT16)d->roi.width, (UINT16)d->roi.height };
+	return prims->YUV420CombineToYUV444(AVC444_LUMA, (const BYTE* const*)d->yuv, d->planeStep,
+	                                    d->roi.width, d->roi.height, d->main, d->planeStep,
+	                                    &rect);
+}
+
+static pstatus_t bench_YUV444SplitToYUV420(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->YUV444SplitToYUV420((const BYTE* const*)d->yuv, d->planeStep, d->main,
+	                                  d->planeStep, d->aux, d->planeStep, &d->roi);
+}
+
+static pstatus_t bench_YUV444ToRGB_8u_P3AC4R(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->YUV444ToRGB_8u_P3AC4R((const BYTE* const*)d->yuv, d->planeStep, d->rgb[2],
+	                                    d->rgbStep, PIXEL_FORMAT_BGRX32, &d->roi);
+}
+
+static pstatus_t bench_RGBToAVC444YUV(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->RGBToAVC444YUV(d->rgb[0], PIXEL_FORMAT_BGRX32, d->rgbStep, d->main,
+	                             d->planeStep, d->aux, d->planeStep, &d->roi);
+}
+
+static pstatus_t bench_RGBToAVC444YUVv2(const primitives_t* prims, prim_bench_data* d)
+{
+	return prims->RGBToAVC444YUVv2(d->rgb[0], PIXEL_FORMAT_BGRX32, d->rgbStep, d->main,
+	                               d->planeStep, d->aux, d->planeStep, &d->roi);
+}
+
+#define PRIM_SLOT(_name_) { #_name_, offsetof(primitives_t, _name_), bench_##_name_ }
+
+static const prim_slot prim_slots[] = {
+	PRIM_SLOT(copy),
+	PRIM_SLOT(copy_8u),
+	PRIM_SLOT(copy_8u_AC4r),
+	PRIM_SLOT(set_8u),
+	PRIM_SLOT(set_32s),
+	PRIM_SLOT(set_32u),
+	PRIM_SLOT(zero),
+	PRIM_SLOT(add_16s),
+	PRIM_SLOT(andC_32u),
+	PRIM_SLOT(orC_32u),
+	PRIM_SLOT(lShiftC_16s),
+	PRIM_SLOT(lShiftC_16u),
+	PRIM_SLOT(rShiftC_16s),
+	PRIM_SLOT(rShiftC_16u),
+	PRIM_SLOT(shiftC_16s),
+	PRIM_SLOT(shiftC_16u),
+	PRIM_SLOT(alphaComp_argb),
+	PRIM_SLOT(sign_16s),
+	PRIM_SLOT(yCbCrToRGB_16s8u_P3AC4R),
+	PRIM_SLOT(yCbCrToRGB_16s16s_P3P3),
+	PRIM_SLOT(RGBToYCbCr_16s16s_P3P3),
+	PRIM_SLOT(RGBToRGB_16s8u_P3AC4R),
+	PRIM_SLOT(YCoCgToRGB_8u_AC4R),
+	PRIM_SLOT(YUV420ToRGB_8u_P3AC4R),
+	PRIM_SLOT(RGBToYUV420_8u_P3AC4R),
+	PRIM_SLOT(RGBToYUV444_8u_P3AC4R),
+	PRIM_SLOT(YUV420CombineToYUV444),
+	PRIM_SLOT(YUV444SplitToYUV420),
+	PRIM_SLOT(YUV444ToRGB_8u_P3AC4R),
+	PRIM_SLOT(RGBToAVC444YUV),
+	PRIM_SLOT(RGBToAVC444YUVv2)
+};
+
+static prim_fn prim_slot_get(const primitives_t* prims, const prim_slot* slot)
+{
+	prim_fn fn = NULL;
+
+	if (prims)
+		memcpy(&fn, (const BYTE*)prims + slot->offset, sizeof(fn));
+
+	return fn;
+}
+
+static void prim_slot_set(primitives_t* prims, const prim_slot* slot, prim_fn fn)
+{
+	memcpy((BYTE*)prims + slot->offset, &fn, sizeof(fn));
+}
+
+static void prim_bench_data_free(prim_bench_data* data)
+{
+	size_t x;
+
+	if (!data)
+		return;
+
+	for (x = 0; x < 3; x++)
+	{
+		winpr_aligned_free(data->rgb[x]);
+		winpr_aligned_free(data->yuv[x]);
+		winpr_aligned_free(data->main[x]);
+		winpr_aligned_free(data->aux[x]);
+		winpr_aligned_free(data->coeffs[x]);
+		winpr_aligned_free(data->out[x]);
+	}
+
+	free(data);
+}
+
+static prim_bench_data* prim_bench_data_new(void)
+{
+	size_t x, y;
+	UINT32 seed = 0x5EED;
+	prim_bench_data* data = calloc(1, sizeof(prim_bench_data));
+
+	if (!data)
+		return NULL;
+
+	data->roi.width = PRIM_BENCH_WIDTH;
+	data->roi.height = PRIM_BENCH_HEIGHT;
+	data->length = PRIM_BENCH_WIDTH * PRIM_BENCH_HEIGHT;
+	data->rgbStep = PRIM_BENCH_WIDTH * 4;
+	data->coeffStep = PRIM_BENCH_WIDTH * sizeof(INT16);
+
+	for (x = 0; x < 3; x++)
+	{
+		data->planeStep[x] = PRIM_BENCH_WIDTH;
+		data->rgb[x] = winpr_aligned_malloc(4ull * data->length, 32);
+		data->yuv[x] = winpr_aligned_malloc(data->length, 32);
+		data->main[x] = winpr_aligned_malloc(data->length, 32);
+		data->aux[x] = winpr_aligned_malloc(data->length, 32);
+		data->coeffs[x] = winpr_aligned_malloc(data->length * sizeof(INT16), 32);
+		data->out[x] = winpr_aligned_malloc(data->length * sizeof(INT16), 32);
+
+		if (!data->rgb[x] || !data->yuv[x] || !data->main[x] || !data->aux[x] ||
+		    !data->coeffs[x] || !data->out[x])
+			goto fail;
+
+		/* Content does not matter much, but avoid the all zero fast paths */
+		for (y = 0; y < data->length; y++)
+		{
+			seed = seed * 1103515245 + 12345;
+			((UINT32*)data->rgb[x])[y] = seed;
+			data->yuv[x][y] = (BYTE)(seed >> 16);
+			/* the range of RemoteFX coefficients, 11.5 fixed point */
+			data->coeffs[x][y] = (INT16)((INT32)((seed >> 8) & 0x1FFF) - 0x1000);
+		}
+	}
+
+	return data;
+fail:
+	prim_bench_data_free(data);
+	return NULL;
+}
+
+/* The tables the implementations are taken from, indexed by primitive_hints */
+static void prim_bench_tables(primitives_t* tables[PRIMITIVES_AUTODETECT])
+{
+	tables[PRIMITIVES_PURE_SOFT] = primitives_get_by_type(PRIMITIVES_PURE_SOFT);
+	tables[PRIMITIVES_ONLY_CPU] = primitives_get_by_type(PRIMITIVES_ONLY_CPU);
+	tables[PRIMITIVES_ONLY_GPU] = primitives_get_by_type(PRIMITIVES_ONLY_GPU);
+}
+
+static BOOL prim_bench_run(const prim_slot* slot, const primitives_t* prims,
+                           prim_bench_data* data, UINT64* nsPerCall)
+{
+	UINT64 count = 0;
+	ULONGLONG start, now;
+
+	/* dry run to warm the caches, also rejects failing implementations */
+	if (slot->bench(prims, data) != PRIMITIVES_SUCCESS)
+		return FALSE;
+
+	start = GetTickCount64();
+
+	do
+	{
+		if (slot->bench(prims, data) != PRIMITIVES_SUCCESS)
+			return FALSE;
+
+		count++;
+		now = GetTickCount64();
+	} while (now - start < PRIM_BENCH_DURATION);
+
+	*nsPerCall = MAX(1, ((now - start) * 1000000ull) / count);
+	return TRUE;
+}
+
+static BOOL prim_slot_info(const prim_slot* slot, primitives_t* tables[PRIMITIVES_AUTODETECT],
+                           const primitives_t* active, prim_bench_data* data,
+                           primitives_slot_info* info)
+{
+	size_t x;
+	const prim_fn generic = prim_slot_get(tables[PRIMITIVES_PURE_SOFT], slot);
+	const prim_fn cpu = prim_slot_get(tables[PRIMITIVES_ONLY_CPU], slot);
+	const prim_fn gpu = prim_slot_get(tables[PRIMITIVES_ONLY_GPU], slot);
+	const prim_fn current = prim_slot_get(active, slot);
+
+	memset(info, 0, sizeof(primitives_slot_info));
+	info->name = slot->name;
+
+	/* The optimized tables start as a copy of the generic one, compare the routines */
+	info->available[PRIMITIVES_PURE_SOFT] = generic != NULL;
+	info->available[PRIMITIVES_ONLY_CPU] = cpu && (cpu != generic);
+	info->available[PRIMITIVES_ONLY_GPU] = gpu && (gpu != cpu) && (gpu != generic);
+
+	if (info->available[PRIMITIVES_ONLY_GPU] && (current == gpu))
+		info->active = PRIMITIVES_ONLY_GPU;
+	else if (info->available[PRIMITIVES_ONLY_CPU] && (current == cpu))
+		info->active = PRIMITIVES_ONLY_CPU;
+	else
+		info->active = PRIMITIVES_PURE_SOFT;
+
+	if (!data)
+		return TRUE;
+
+	for (x = 0; x < PRIMITIVES_AUTODETECT; x++)
+	{
+		if (!info->available[x])
+			continue;
+
+		if (!prim_bench_run(slot, tables[x], data, &info->nsPerCall[x]))
+		{
+			WLog_WARN(TAG, "error running %s %s bench", primitives_hints_name((primitive_hints)x),
+			          slot->name);
+			info->available[x] = FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+const char* primitives_hints_name(primitive_hints hints)
+{
+	switch (hints)
+	{
+		case PRIMITIVES_PURE_SOFT:
+			return "generic";
+		case PRIMITIVES_ONLY_CPU:
+			return "optimized";
+		case PRIMITIVES_ONLY_GPU:
+			return "opencl";
+		case PRIMITIVES_AUTODETECT:
+			return "autodetect";
+		case PRIMITIVES_FASTEST:
+			return "fastest";
+		default:
+			return "unknown";
+	}
+}
+
+size_t primitives_slot_count(void)
+{
+	return ARRAYSIZE(prim_slots);
+}
+
+BOOL primitives_get_slot_info(size_t index, BOOL benchmark, primitives_slot_info* info)
+{
+	BOOL rc;
+	prim_bench_data* data = NULL;
+	primitives_t* tables[PRIMITIVES_AUTODETECT] = { 0 };
+
+	if (!info || (index >= ARRAYSIZE(prim_slots)))
+		return FALSE;
+
+	if (benchmark && !(data = prim_bench_data_new()))
+		return FALSE;
+
+	prim_bench_tables(tables);
+	rc = prim_slot_info(&prim_slots[index], tables, primitives_get(), data, info);
+	prim_bench_data_free(data);
+	return rc;
+}
+
+BOOL primitives_init_fastest(primitives_t* prims)
+{
+	size_t x, y;
+	prim_bench_data* data = prim_bench_data_new();
+	primitives_t* tables[PRIMITIVES_AUTODETECT] = { 0 };
+
+	prim_bench_tables(tables);
+	*prims = *tables[PRIMITIVES_PURE_SOFT];
+	prims->uninit = NULL;
+
+	if (!data)
+		return FALSE;
+
+	WLog_DBG(TAG, "primitives benchmark result [ns]:");
+
+	for (x = 0; x < ARRAYSIZE(prim_slots); x++)
+	{
+		const prim_slot* slot = &prim_slots[x];
+		size_t best = PRIMITIVES_PURE_SOFT;
+		primitives_slot_info info;
+
+		/* the generic table is the reference for the comparison */
+		if (!prim_slot_info(slot, tables, tables[PRIMITIVES_PURE_SOFT], data, &info))
+			continue;
+
+		for (y = 0; y < PRIMITIVES_AUTODETECT; y++)
+		{
+			if (!info.available[y])
+				continue;
+
+			if (!info.available[best] || (info.nsPerCall[y] < info.nsPerCall[best]))
+				best = y;
+		}
+
+		WLog_DBG(TAG, " * %s: generic=%" PRIu64 " optimized=%" PRIu64 " opencl=%" PRIu64
+		              ", using %s",
+		         slot->name, info.nsPerCall[PRIMITIVES_PURE_SOFT],
+		         info.nsPerCall[PRIMITIVES_ONLY_CPU], info.nsPerCall[PRIMITIVES_ONLY_GPU],
+		         primitives_hints_name((primitive_hints)best));
+
+		prim_slot_set(prims, slot, prim_slot_get(tables[best], slot));
+
+		if (best == PRIMITIVES_ONLY_CPU)
+			prims->flags |= PRIM_FLAGS_HAVE_EXTCPU;
+		else if (best == PRIMITIVES_ONLY_GPU)
+			prims->flags |= PRIM_FLAGS_HAVE_EXTGPU;
+	}
+
+	prim_bench_data_free(data);
+	return TRUE;
+}
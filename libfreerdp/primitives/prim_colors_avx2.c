@@ -0,0 +1,229 @@
+/* FreeRDP: A Remote Desktop Protocol Client
+ * AVX2 optimized Color conversion operations.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <freerdp/types.h>
+#include <freerdp/primitives.h>
+#include <winpr/sysinfo.h>
+
+#include <immintrin.h>
+
+#include "prim_internal.h"
+
+static primitives_t* generic = NULL;
+
+#define _mm256_between_epi16(_val, _min, _max)                       \
+	do                                                               \
+	{                                                                \
+		_val = _mm256_min_epi16(_max, _mm256_max_epi16(_val, _min)); \
+	} while (0)
+
+/* The fixed point factors and the rounding match the SSE2 implementation in
+ * prim_colors_opt.c, see there for a description of the math. Loads and stores
+ * are unaligned, so unlike the SSE2 functions there are no alignment requirements.
+ */
+
+/*---------------------------------------------------------------------------*/
+static pstatus_t avx2_yCbCrToRGB_16s8u_P3AC4R_X(const INT16* const pSrc[3], UINT32 srcStep,
+                                                BYTE* pDst, UINT32 dstStep,
+                                                const prim_size_t* roi, BOOL rgbx)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max = _mm256_set1_epi16(255);
+	const __m256i alpha = _mm256_set1_epi16((INT16)0xFF00);
+	const __m256i r_cr = _mm256_set1_epi16(22986);  /*  1.403 << 14 */
+	const __m256i g_cb = _mm256_set1_epi16(-5636);  /* -0.344 << 14 */
+	const __m256i g_cr = _mm256_set1_epi16(-11698); /* -0.714 << 14 */
+	const __m256i b_cb = _mm256_set1_epi16(28999);  /*  1.770 << 14 */
+	const __m256i c4096 = _mm256_set1_epi16(4096);
+	const UINT32 pad = roi->width % 16;
+	const UINT32 width = roi->width - pad;
+	UINT32 yp;
+	UINT32 i;
+
+	for (yp = 0; yp < roi->height; yp++)
+	{
+		const INT16* y_buf = (const INT16*)((const BYTE*)pSrc[0] + 1ULL * yp * srcStep);
+		const INT16* cb_buf = (const INT16*)((const BYTE*)pSrc[1] + 1ULL * yp * srcStep);
+		const INT16* cr_buf = (const INT16*)((const BYTE*)pSrc[2] + 1ULL * yp * srcStep);
+		BYTE* d_buf = pDst + 1ULL * yp * dstStep;
+
+		for (i = 0; i < width; i += 16)
+		{
+			__m256i y, cb, cr, r, g, b, c0, c1, lo, hi;
+			/* y = (y_r_buf[i] + 4096) >> 2 */
+			y = _mm256_loadu_si256((const __m256i*)&y_buf[i]);
+			y = _mm256_srai_epi16(_mm256_add_epi16(y, c4096), 2);
+			cb = _mm256_loadu_si256((const __m256i*)&cb_buf[i]);
+			cr = _mm256_loadu_si256((const __m256i*)&cr_buf[i]);
+			/* (y + HIWORD(cr*22986)) >> 3 */
+			r = _mm256_add_epi16(y, _mm256_mulhi_epi16(cr, r_cr));
+			r = _mm256_srai_epi16(r, 3);
+			_mm256_between_epi16(r, zero, max);
+			/* (y + HIWORD(cb*-5636) + HIWORD(cr*-11698)) >> 3 */
+			g = _mm256_add_epi16(y, _mm256_mulhi_epi16(cb, g_cb));
+			g = _mm256_add_epi16(g, _mm256_mulhi_epi16(cr, g_cr));
+			g = _mm256_srai_epi16(g, 3);
+			_mm256_between_epi16(g, zero, max);
+			/* (y + HIWORD(cb*28999)) >> 3 */
+			b = _mm256_add_epi16(y, _mm256_mulhi_epi16(cb, b_cb));
+			b = _mm256_srai_epi16(b, 3);
+			_mm256_between_epi16(b, zero, max);
+
+			/* c0 holds the first two bytes of each pixel, c1 the last two */
+			if (rgbx)
+			{
+				c0 = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+				c1 = _mm256_or_si256(b, alpha);
+			}
+			else
+			{
+				c0 = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+				c1 = _mm256_or_si256(r, alpha);
+			}
+
+			/* unpack works per 128 bit lane, the permutes restore the pixel order */
+			lo = _mm256_unpacklo_epi16(c0, c1);
+			hi = _mm256_unpackhi_epi16(c0, c1);
+			_mm256_storeu_si256((__m256i*)&d_buf[4ULL * i],
+			                    _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256((__m256i*)&d_buf[4ULL * i + 32],
+			                    _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+
+		d_buf += 4ULL * width;
+
+		for (i = width; i < roi->width; i++)
+		{
+			const INT32 divisor = 16;
+			const INT32 Y = (y_buf[i] + 4096) << divisor;
+			const INT32 Cb = cb_buf[i];
+			const INT32 Cr = cr_buf[i];
+			const INT32 CrR = Cr * (INT32)(1.402525f * (1 << divisor));
+			const INT32 CrG = Cr * (INT32)(0.714401f * (1 << divisor));
+			const INT32 CbG = Cb * (INT32)(0.343730f * (1 << divisor));
+			const INT32 CbB = Cb * (INT32)(1.769905f * (1 << divisor));
+			const INT16 R = ((INT16)((CrR + Y) >> divisor) >> 5);
+			const INT16 G = ((INT16)((Y - CbG - CrG) >> divisor) >> 5);
+			const INT16 B = ((INT16)((CbB + Y) >> divisor) >> 5);
+
+			if (rgbx)
+			{
+				*d_buf++ = CLIP(R);
+				*d_buf++ = CLIP(G);
+				*d_buf++ = CLIP(B);
+			}
+			else
+			{
+				*d_buf++ = CLIP(B);
+				*d_buf++ = CLIP(G);
+				*d_buf++ = CLIP(R);
+			}
+
+			*d_buf++ = 0xFF;
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+static pstatus_t avx2_yCbCrToRGB_16s8u_P3AC4R(const INT16* const pSrc[3], UINT32 srcStep,
+                                              BYTE* pDst, UINT32 dstStep, UINT32 DstFormat,
+                                              const prim_size_t* roi) /* region of interest */
+{
+	switch (DstFormat)
+	{
+		case PIXEL_FORMAT_BGRA32:
+		case PIXEL_FORMAT_BGRX32:
+			return avx2_yCbCrToRGB_16s8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, roi, FALSE);
+
+		case PIXEL_FORMAT_RGBA32:
+		case PIXEL_FORMAT_RGBX32:
+			return avx2_yCbCrToRGB_16s8u_P3AC4R_X(pSrc, srcStep, pDst, dstStep, roi, TRUE);
+
+		default:
+			return generic->yCbCrToRGB_16s8u_P3AC4R(pSrc, srcStep, pDst, dstStep, DstFormat, roi);
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static pstatus_t avx2_RGBToYCbCr_16s16s_P3P3(const INT16* const pSrc[3], int srcStep,
+                                             INT16* pDst[3], int dstStep,
+                                             const prim_size_t* roi) /* region of interest */
+{
+	const __m256i min = _mm256_set1_epi16(-128 * 32);
+	const __m256i max = _mm256_set1_epi16(127 * 32);
+	const __m256i y_r = _mm256_set1_epi16(9798);    /*  0.299000 << 15 */
+	const __m256i y_g = _mm256_set1_epi16(19235);   /*  0.587000 << 15 */
+	const __m256i y_b = _mm256_set1_epi16(3735);    /*  0.114000 << 15 */
+	const __m256i cb_r = _mm256_set1_epi16(-5535);  /* -0.168935 << 15 */
+	const __m256i cb_g = _mm256_set1_epi16(-10868); /* -0.331665 << 15 */
+	const __m256i cb_b = _mm256_set1_epi16(16403);  /*  0.500590 << 15 */
+	const __m256i cr_r = _mm256_set1_epi16(16377);  /*  0.499813 << 15 */
+	const __m256i cr_g = _mm256_set1_epi16(-13714); /* -0.418531 << 15 */
+	const __m256i cr_b = _mm256_set1_epi16(-2663);  /* -0.081282 << 15 */
+	UINT32 yp;
+	UINT32 i;
+
+	if ((roi->width % 16) != 0)
+		return generic->RGBToYCbCr_16s16s_P3P3(pSrc, srcStep, pDst, dstStep, roi);
+
+	for (yp = 0; yp < roi->height; yp++)
+	{
+		const INT16* r_buf = (const INT16*)((const BYTE*)pSrc[0] + 1ULL * yp * srcStep);
+		const INT16* g_buf = (const INT16*)((const BYTE*)pSrc[1] + 1ULL * yp * srcStep);
+		const INT16* b_buf = (const INT16*)((const BYTE*)pSrc[2] + 1ULL * yp * srcStep);
+		INT16* y_buf = (INT16*)((BYTE*)pDst[0] + 1ULL * yp * dstStep);
+		INT16* cb_buf = (INT16*)((BYTE*)pDst[1] + 1ULL * yp * dstStep);
+		INT16* cr_buf = (INT16*)((BYTE*)pDst[2] + 1ULL * yp * dstStep);
+
+		for (i = 0; i < roi->width; i += 16)
+		{
+			__m256i r, g, b, y, cb, cr;
+			/* r<<6; g<<6; b<<6 */
+			r = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)&r_buf[i]), 6);
+			g = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)&g_buf[i]), 6);
+			b = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i*)&b_buf[i]), 6);
+			/* y = HIWORD(r*y_r) + HIWORD(g*y_g) + HIWORD(b*y_b) + min */
+			y = _mm256_mulhi_epi16(r, y_r);
+			y = _mm256_add_epi16(y, _mm256_mulhi_epi16(g, y_g));
+			y = _mm256_add_epi16(y, _mm256_mulhi_epi16(b, y_b));
+			y = _mm256_add_epi16(y, min);
+			_mm256_between_epi16(y, min, max);
+			/* cb = HIWORD(r*cb_r) + HIWORD(g*cb_g) + HIWORD(b*cb_b) */
+			cb = _mm256_mulhi_epi16(r, cb_r);
+			cb = _mm256_add_epi16(cb, _mm256_mulhi_epi16(g, cb_g));
+			cb = _mm256_add_epi16(cb, _mm256_mulhi_epi16(b, cb_b));
+			_mm256_between_epi16(cb, min, max);
+			/* cr = HIWORD(r*cr_r) + HIWORD(g*cr_g) + HIWORD(b*cr_b) */
+			cr = _mm256_mulhi_epi16(r, cr_r);
+			cr = _mm256_add_epi16(cr, _mm256_mulhi_epi16(g, cr_g));
+			cr = _mm256_add_epi16(cr, _mm256_mulhi_epi16(b, cr_b));
+			_mm256_between_epi16(cr, min, max);
+			_mm256_storeu_si256((__m256i*)&y_buf[i], y);
+			_mm256_storeu_si256((__m256i*)&cb_buf[i], cb);
+			_mm256_storeu_si256((__m256i*)&cr_buf[i], cr);
+		}
+	}
+
+	return PRIMITIVES_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+void primitives_init_colors_avx2(primitives_t* prims)
+{
+	generic = primitives_get_generic();
+	prims->yCbCrToRGB_16s8u_P3AC4R = avx2_yCbCrToRGB_16s8u_P3AC4R;
+	prims->RGBToYCbCr_16s16s_P3P3 = avx2_RGBToYCbCr_16s16s_P3P3;
+}
@@ -1502,6 +1502,13 @@ void primitives_init_colors_opt(primitives_t* prims)
 		prims->RGBToYCbCr_16s16s_P3P3 = sse2_RGBToYCbCr_16s16s_P3P3;
 	}
 
+#if defined(WITH_AVX2)
+
+	if (IsProcessorFeaturePresentEx(PF_EX_AVX2))
+		primitives_init_colors_avx2(prims);
+
+#endif /* WITH_AVX2 */
+
 #elif defined(WITH_NEON)
 
 	if (IsProcessorFeaturePresent(PF_ARM_NEON_INSTRUCTIONS_AVAILABLE))
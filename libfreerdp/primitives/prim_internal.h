@@ -275,10 +275,15 @@ FREERDP_LOCAL void primitives_init_YCoCg_opt(primitives_t* prims);
 FREERDP_LOCAL void primitives_init_YUV_opt(primitives_t* prims);
 #endif
 
+#if defined(WITH_AVX2)
+FREERDP_LOCAL void primitives_init_colors_avx2(primitives_t* prims);
+#endif
+
 #if defined(WITH_OPENCL)
 FREERDP_LOCAL BOOL primitives_init_opencl(primitives_t* prims);
 #endif
 
 FREERDP_LOCAL primitives_t* primitives_get_by_type(DWORD type);
+FREERDP_LOCAL BOOL primitives_init_fastest(primitives_t* prims);
 
 #endif /* FREERDP_LIB_PRIM_INTERNAL_H */
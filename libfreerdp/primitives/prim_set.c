@@ -56,7 +56,7 @@ static pstatus_t general_set_32s(INT32 val, INT32* pDst, UINT32 len)
 	span = 1;
 	*dptr = val;
 	remaining = len - 1;
-	prims = primitives_get();
+	prims = primitives_get_generic();
 
 	while (remaining)
 	{
@@ -92,7 +92,7 @@ static pstatus_t general_set_32u(UINT32 val, UINT32* pDst, UINT32 len)
 	span = 1;
 	*dptr = val;
 	remaining = len - 1;
-	prims = primitives_get();
+	prims = primitives_get_generic();
 
 	while (remaining)
 	{
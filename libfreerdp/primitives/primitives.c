@@ -311,6 +311,8 @@ BOOL primitives_init(primitives_t* p, primitive_hints hints)
 	{
 		case PRIMITIVES_AUTODETECT:
 			return primitives_autodetect_best(p);
+		case PRIMITIVES_FASTEST:
+			return primitives_init_fastest(p);
 		case PRIMITIVES_PURE_SOFT:
 			*p = pPrimitivesGeneric;
 			return TRUE;
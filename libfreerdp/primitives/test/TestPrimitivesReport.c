@@ -0,0 +1,104 @@
+/* TestPrimitivesReport.c
+ * vi:ts=4 sw=4
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at http://www.apache.org/licenses/LICENSE-2.0.
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+ * or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include "prim_test.h"
+
+/* ------------------------------------------------------------------------- */
+static BOOL test_slot_info(BOOL benchmark)
+{
+	size_t x, y;
+	const size_t count = primitives_slot_count();
+	primitives_slot_info info;
+
+	if (count == 0)
+		return FALSE;
+
+	if (primitives_get_slot_info(count, FALSE, &info))
+		return FALSE;
+
+	for (x = 0; x < count; x++)
+	{
+		if (!primitives_get_slot_info(x, benchmark, &info))
+			return FALSE;
+
+		if (!info.name || !info.available[PRIMITIVES_PURE_SOFT] || !info.available[info.active])
+		{
+			fprintf(stderr, "slot %" PRIuz " is inconsistent\n", x);
+			return FALSE;
+		}
+
+		for (y = 0; benchmark && (y < PRIMITIVES_AUTODETECT); y++)
+		{
+			if (info.available[y] && (info.nsPerCall[y] == 0))
+			{
+				fprintf(stderr, "%s %s was not measured\n", info.name,
+				        primitives_hints_name((primitive_hints)y));
+				return FALSE;
+			}
+		}
+
+		if (benchmark)
+			printf("%-24s %-10s generic=%8" PRIu64 "ns optimized=%8" PRIu64 "ns\n", info.name,
+			       primitives_hints_name(info.active), info.nsPerCall[PRIMITIVES_PURE_SOFT],
+			       info.nsPerCall[PRIMITIVES_ONLY_CPU]);
+	}
+
+	return TRUE;
+}
+
+static BOOL test_init_fastest(void)
+{
+	primitives_t prims = { 0 };
+	primitives_t cpu = { 0 };
+
+	if (!primitives_init(&prims, PRIMITIVES_FASTEST))
+		return FALSE;
+
+	/* without CPU optimizations there is only the generic table */
+	if (!primitives_init(&cpu, PRIMITIVES_ONLY_CPU))
+		cpu = *generic;
+
+	/* every routine is taken from one of the existing tables */
+	if ((prims.sign_16s != generic->sign_16s) && (prims.sign_16s != cpu.sign_16s))
+		return FALSE;
+
+	if ((prims.YUV420ToRGB_8u_P3AC4R != generic->YUV420ToRGB_8u_P3AC4R) &&
+	    (prims.YUV420ToRGB_8u_P3AC4R != cpu.YUV420ToRGB_8u_P3AC4R))
+		return FALSE;
+
+	return prims.copy && prims.RGBToAVC444YUVv2;
+}
+
+int TestPrimitivesReport(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	prim_test_setup(FALSE);
+
+	if (!test_slot_info(FALSE))
+		return 1;
+
+	if (!test_init_fastest())
+		return 1;
+
+	if (g_TestPrimitivesPerformance)
+	{
+		if (!test_slot_info(TRUE))
+			return 1;
+	}
+
+	return 0;
+}
@@ -8,6 +8,7 @@
 #include <winpr/wlog.h>
 #include <winpr/crypto.h>
 #include <freerdp/primitives.h>
+#include <freerdp/codec/yuv.h>
 #include <freerdp/utils/profiler.h>
 
 #define TAG __FILE__
@@ -678,6 +679,104 @@ static BOOL compare_yuv420(BYTE** planesA, BYTE** planesB, UINT32 width, UINT32
 	return rc;
 }
 
+static BOOL compare_yuv420_exact(BYTE** planesA, BYTE** planesB, UINT32 width, UINT32 height)
+{
+	const size_t size = 1ull * width * height;
+	const size_t uvsize = (height + 1ull) / 2 * ((width + 1ull) / 2);
+	const size_t sizes[3] = { size, uvsize, uvsize };
+	const char* names[3] = { "Y", "U", "V" };
+	BOOL rc = TRUE;
+
+	for (size_t x = 0; x < 3; x++)
+	{
+		for (size_t i = 0; i < sizes[x]; i++)
+		{
+			if (planesA[x][i] != planesB[x][i])
+			{
+				fprintf(stderr, "%s plane differs at %" PRIuz ": %02" PRIx8 " != %02" PRIx8 "\n",
+				        names[x], i, planesA[x][i], planesB[x][i]);
+				rc = FALSE;
+				break;
+			}
+		}
+	}
+
+	return rc;
+}
+
+/* Converting only the changed regions of a frame into the planes of the previous one must give
+ * the same planes as converting the whole frame, also for regions starting or ending on odd
+ * pixels which share their chroma samples with unchanged neighbours. */
+static BOOL TestYUV420ContextPartialEncode(UINT32 width, UINT32 height, UINT32 ThreadingFlags)
+{
+	BOOL res = FALSE;
+	const size_t padding = 0x1000;
+	const UINT32 format = PIXEL_FORMAT_BGRX32;
+	const UINT32 bpp = FreeRDPGetBytesPerPixel(format);
+	const UINT32 srcStep = width * bpp + 12;
+	const UINT32 stride[3] = { width, (width + 1) / 2, (width + 1) / 2 };
+	const RECTANGLE_16 full = { 0, 0, (UINT16)width, (UINT16)height };
+	/* Odd offsets and sizes, a single pixel and regions on the right and bottom edges */
+	const RECTANGLE_16 rects[] = { { 3, 5, 20, 18 },
+		                           { 31, 31, 32, 32 },
+		                           { 1, 40, 8, (UINT16)height },
+		                           { (UINT16)(width - 7), 1, (UINT16)width, 2 },
+		                           { 10, (UINT16)(height - 1), 11, (UINT16)height },
+		                           { 22, 9, 57, 10 } };
+	BYTE* partial[3] = { 0 };
+	BYTE* expected[3] = { 0 };
+	BYTE* rgb = NULL;
+	YUV_CONTEXT* context = yuv_context_new(TRUE, ThreadingFlags);
+
+	printf("%s [%" PRIu32 "x%" PRIu32 "] threading flags %" PRIu32 "\n", __func__, width, height,
+	       ThreadingFlags);
+
+	if (!context || !yuv_context_reset(context, width, height))
+		goto fail;
+
+	rgb = set_padding(1ull * srcStep * height, padding);
+
+	if (!rgb || !allocate_yuv420(partial, width, height, padding) ||
+	    !allocate_yuv420(expected, width, height, padding))
+		goto fail;
+
+	winpr_RAND(rgb, 1ull * srcStep * height);
+
+	if (!yuv420_context_encode(context, rgb, srcStep, format, stride, partial, &full, 1))
+		goto fail;
+
+	for (size_t x = 0; x < ARRAYSIZE(rects); x++)
+	{
+		const RECTANGLE_16* rect = &rects[x];
+
+		for (UINT32 y = rect->top; y < rect->bottom; y++)
+			winpr_RAND(&rgb[1ull * y * srcStep + rect->left * bpp],
+			           (rect->right - rect->left) * bpp);
+	}
+
+	if (!yuv420_context_encode(context, rgb, srcStep, format, stride, partial, rects,
+	                           ARRAYSIZE(rects)))
+		goto fail;
+
+	if (!yuv420_context_encode(context, rgb, srcStep, format, stride, expected, &full, 1))
+		goto fail;
+
+	if (!check_yuv420(partial, width, height, padding) ||
+	    !check_yuv420(expected, width, height, padding))
+		goto fail;
+
+	if (!compare_yuv420_exact(partial, expected, width, height))
+		goto fail;
+
+	res = TRUE;
+fail:
+	free_padding(rgb, padding);
+	free_yuv420(partial, padding);
+	free_yuv420(expected, padding);
+	yuv_context_free(context);
+	return res;
+}
+
 static BOOL TestPrimitiveRgbToLumaChroma(primitives_t* prims, prim_size_t roi, UINT32 version)
 {
 	BOOL res = FALSE;
@@ -872,6 +971,7 @@ int TestPrimitivesYUV(int argc, char* argv[])
 	BOOL large = (argc > 1);
 	UINT32 x;
 	int rc = -1;
+	const UINT32 sizes[][2] = { { 131, 67 }, { 64, 45 }, { 67, 131 } };
 	WINPR_UNUSED(argc);
 	WINPR_UNUSED(argv);
 	prim_test_setup(FALSE);
@@ -968,6 +1068,17 @@ int TestPrimitivesYUV(int argc, char* argv[])
 		printf("---------------------- END --------------------------\n");
 	}
 
+	for (x = 0; x < ARRAYSIZE(sizes); x++)
+	{
+		if (!TestYUV420ContextPartialEncode(sizes[x][0], sizes[x][1], 0) ||
+		    !TestYUV420ContextPartialEncode(sizes[x][0], sizes[x][1],
+		                                    THREADING_FLAGS_DISABLE_THREADS))
+		{
+			printf("TestYUV420ContextPartialEncode failed.\n");
+			goto end;
+		}
+	}
+
 	rc = 0;
 end:
 	return rc;
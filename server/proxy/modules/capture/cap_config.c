@@ -17,33 +17,100 @@
  * limitations under the License.
  */
 
+#include <winpr/string.h>
 #include <winpr/environment.h>
 #include <freerdp/types.h>
 #include <errno.h>
 
 #include "cap_config.h"
+#include "cap_protocol.h"
 
-BOOL capture_plugin_init_config(captureConfig* config)
+static char* capture_plugin_get_env(const char* name)
 {
-	const char* name = "PROXY_CAPTURE_TARGET";
-	char* tmp = NULL;
+	char* value;
 	DWORD nSize = GetEnvironmentVariableA(name, NULL, 0);
 
-	if (nSize > 0)
+	if (nSize == 0)
+		return NULL;
+
+	value = (LPSTR)malloc(nSize);
+	if (!value)
+		return NULL;
+
+	if (GetEnvironmentVariableA(name, value, nSize) != nSize - 1)
 	{
-		char* colon;
-		int addrLen;
-		unsigned long port;
+		free(value);
+		return NULL;
+	}
+
+	return value;
+}
+
+static BOOL capture_plugin_init_stream_config(captureConfig* config)
+{
+	char* tmp;
 
-		tmp = (LPSTR)malloc(nSize);
-		if (!tmp)
+	config->mode = CAPTURE_MODE_FULL;
+	config->codec = CAPTURE_CODEC_PLANAR;
+	config->maxQueuedFrames = 4;
+
+	tmp = capture_plugin_get_env("PROXY_CAPTURE_MODE");
+	if (tmp)
+	{
+		if (_stricmp(tmp, "delta") == 0)
+			config->mode = CAPTURE_MODE_DELTA;
+		else if (_stricmp(tmp, "full") != 0)
+		{
+			free(tmp);
 			return FALSE;
+		}
+		free(tmp);
+	}
 
-		if (GetEnvironmentVariableA(name, tmp, nSize) != nSize - 1)
+	tmp = capture_plugin_get_env("PROXY_CAPTURE_CODEC");
+	if (tmp)
+	{
+		if (_stricmp(tmp, "none") == 0)
+			config->codec = CAPTURE_CODEC_UNCOMPRESSED;
+		else if (_stricmp(tmp, "planar") != 0)
 		{
 			free(tmp);
 			return FALSE;
 		}
+		free(tmp);
+	}
+
+	tmp = capture_plugin_get_env("PROXY_CAPTURE_QUEUE");
+	if (tmp)
+	{
+		unsigned long depth;
+
+		errno = 0;
+		depth = strtoul(tmp, NULL, 0);
+		free(tmp);
+
+		if ((errno != 0) || (depth == 0) || (depth > UINT16_MAX))
+			return FALSE;
+
+		config->maxQueuedFrames = (UINT32)depth;
+	}
+
+	return TRUE;
+}
+
+BOOL capture_plugin_init_config(captureConfig* config)
+{
+	char* tmp;
+
+	if (!capture_plugin_init_stream_config(config))
+		return FALSE;
+
+	tmp = capture_plugin_get_env("PROXY_CAPTURE_TARGET");
+	if (tmp)
+	{
+		char* colon;
+		int addrLen;
+		unsigned long port;
 
 		colon = strchr(tmp, ':');
 
@@ -19,10 +19,26 @@
 
 #include <freerdp/types.h>
 
+/*
+ * configured from the environment:
+ * PROXY_CAPTURE_TARGET  host:port of the receiver, default 127.0.0.1:8889
+ * PROXY_CAPTURE_MODE    "full" sends every frame as bitmap (default), "delta" changed regions
+ * PROXY_CAPTURE_CODEC   "planar" (default) or "none", the encoding of delta regions
+ * PROXY_CAPTURE_QUEUE   frames waiting for the sender before new ones are dropped, default 4
+ */
+typedef enum
+{
+	CAPTURE_MODE_FULL = 0,
+	CAPTURE_MODE_DELTA = 1
+} captureMode;
+
 typedef struct capture_config
 {
 	UINT16 port;
 	char* host;
+	captureMode mode;       /* full frame bitmaps or invalidated regions only */
+	UINT16 codec;           /* CAPTURE_CODEC_* of region payloads */
+	UINT32 maxQueuedFrames; /* frames waiting for the sender before new ones are dropped */
 } captureConfig;
 
 BOOL capture_plugin_init_config(captureConfig* config);
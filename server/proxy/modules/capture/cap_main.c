@@ -21,7 +21,14 @@
 
 #include <errno.h>
 #include <winpr/image.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+#include <winpr/collections.h>
 #include <freerdp/gdi/gdi.h>
+#include <freerdp/codec/color.h>
+#include <freerdp/codec/planar.h>
+#include <freerdp/codec/region.h>
 #include <winpr/winsock.h>
 
 #include <freerdp/server/proxy/proxy_modules_api.h>
@@ -37,6 +44,40 @@
 #define PLUGIN_DESC "stream egfx connections over tcp"
 
 #define BUFSIZE 8092
+#define FLUSH_TIMEOUT 5000 /* ms to send the queued frames when a session ends */
+
+typedef struct
+{
+	UINT16 type;  /* MESSAGE_TYPE_* */
+	UINT32 width; /* desktop size at the time of capture */
+	UINT32 height;
+	UINT32 bpp;
+	UINT32 nrects;
+	RECTANGLE_16* rects; /* MESSAGE_TYPE_CAPTURED_REGIONS only */
+	BYTE* data;          /* desktop copy or BGRX32 region copies, one after another */
+	size_t size;
+} captureFrame;
+
+/*
+ * Frames are copied from the desktop in client_end_paint and handed to a sender thread, which
+ * compresses and transmits them. A slow capture link thus delays the recording but not the
+ * proxied session: once maxQueuedFrames frames are waiting new frames are dropped. In delta mode
+ * the regions of a dropped frame are kept and sent with the next frame that is queued.
+ */
+typedef struct
+{
+	SOCKET socket;
+	const captureConfig* config;
+	wQueue* frames;
+	HANDLE thread;
+	volatile LONG failed;
+	REGION16 pending; /* regions of dropped frames, only used by the proxy client */
+	BOOL stale;       /* the last frame was dropped */
+	UINT32 width;     /* desktop size the pending regions refer to */
+	UINT32 height;
+	UINT64 dropped;
+	BITMAP_PLANAR_CONTEXT* planar; /* only used by the sender thread */
+} captureSession;
 
 static SOCKET capture_plugin_init_socket(const captureConfig* cconfig)
 {
@@ -96,7 +137,7 @@ static BOOL capture_plugin_send_packet(SOCKET sockfd, wStream* packet)
 		return FALSE;
 
 	buffer = Stream_Buffer(packet);
-	len = Stream_Capacity(packet);
+	len = Stream_GetPosition(packet);
 
 	if (!capture_plugin_send_data(sockfd, buffer, len))
 	{
@@ -111,62 +152,88 @@ error:
 	return result;
 }
 
-static SOCKET capture_plugin_get_socket(proxyPlugin* plugin, proxyData* pdata)
+/* tells the sender thread to end the recording */
+static captureFrame capture_plugin_end_frame = { MESSAGE_TYPE_SESSION_END };
+
+static void capture_plugin_frame_free(void* obj)
 {
-	void* custom;
+	captureFrame* frame = obj;
 
-	WINPR_ASSERT(plugin);
-	WINPR_ASSERT(plugin->mgr);
+	if (!frame || (frame == &capture_plugin_end_frame))
+		return;
 
-	custom = plugin->mgr->GetPluginData(plugin->mgr, PLUGIN_NAME, pdata);
-	if (!custom)
-		return -1;
+	free(frame->rects);
+	free(frame->data);
+	free(frame);
+}
+
+static captureFrame* capture_plugin_frame_new(UINT16 type)
+{
+	captureFrame* frame = calloc(1, sizeof(captureFrame));
 
-	return (SOCKET)custom;
+	if (!frame)
+		return NULL;
+
+	frame->type = type;
+	return frame;
 }
 
-static BOOL capture_plugin_session_end(proxyPlugin* plugin, proxyData* pdata, void* custom)
+static void capture_plugin_session_free(captureSession* session)
 {
-	SOCKET socket;
-	BOOL ret;
-	wStream* s;
+	if (!session)
+		return;
 
-	WINPR_ASSERT(pdata);
-	WINPR_ASSERT(custom);
-	WINPR_ASSERT(plugin);
-	WINPR_ASSERT(plugin->mgr);
+	if (session->thread)
+	{
+		/* queued regardless of the limit, the frames before it are sent first */
+		Queue_Enqueue(session->frames, &capture_plugin_end_frame);
 
-	socket = capture_plugin_get_socket(plugin, pdata);
-	if (socket == INVALID_SOCKET)
-		return FALSE;
+		if (WaitForSingleObject(session->thread, FLUSH_TIMEOUT) == WAIT_TIMEOUT)
+		{
+			WLog_WARN(TAG, "capture link is too slow, dropping the rest of the recording");
+			_shutdown(session->socket, SD_BOTH);
+			WaitForSingleObject(session->thread, INFINITE);
+		}
 
-	s = capture_plugin_packet_new(SESSION_END_PDU_BASE_SIZE, MESSAGE_TYPE_SESSION_END);
-	if (!s)
-		return FALSE;
+		CloseHandle(session->thread);
+	}
 
-	ret = capture_plugin_send_packet(socket, s);
+	Queue_Free(session->frames);
+	freerdp_bitmap_planar_context_free(session->planar);
+	region16_uninit(&session->pending);
 
-	closesocket(socket);
-	return ret;
+	if (session->socket != INVALID_SOCKET)
+		closesocket(session->socket);
+
+	free(session);
+}
+
+/* stored in place of a session once it ended, the plugin data can not be removed */
+static char capture_plugin_session_ended;
+
+static captureSession* capture_plugin_get_session(proxyPlugin* plugin, proxyData* pdata)
+{
+	void* custom;
+
+	WINPR_ASSERT(plugin);
+	WINPR_ASSERT(plugin->mgr);
+
+	custom = plugin->mgr->GetPluginData(plugin->mgr, PLUGIN_NAME, pdata);
+	if (custom == &capture_plugin_session_ended)
+		return NULL;
+
+	return custom;
 }
 
-static BOOL capture_plugin_send_frame(pClientContext* pc, SOCKET socket, const BYTE* buffer)
+static BOOL capture_plugin_send_frame(SOCKET socket, const captureFrame* frame)
 {
-	size_t frame_size;
 	BOOL ret = FALSE;
 	wStream* s = NULL;
 	BYTE* bmp_header = NULL;
-	rdpSettings* settings;
 
-	WINPR_ASSERT(pc);
-	settings = pc->context.settings;
-	WINPR_ASSERT(settings);
+	WINPR_ASSERT(frame);
 
-	frame_size = settings->DesktopWidth * settings->DesktopHeight *
-	             (freerdp_settings_get_uint32(settings, FreeRDP_ColorDepth) / 8);
-	bmp_header =
-	    winpr_bitmap_construct_header(settings->DesktopWidth, settings->DesktopHeight,
-	                                  freerdp_settings_get_uint32(settings, FreeRDP_ColorDepth));
+	bmp_header = winpr_bitmap_construct_header(frame->width, frame->height, frame->bpp);
 
 	if (!bmp_header)
 		return FALSE;
@@ -187,18 +254,365 @@ static BOOL capture_plugin_send_frame(pClientContext* pc, SOCKET socket, const B
 	if (!ret)
 		goto error;
 
-	ret = capture_plugin_send_data(socket, buffer, frame_size);
+	ret = capture_plugin_send_data(socket, frame->data, frame->size);
 
 error:
 	free(bmp_header);
 	return ret;
 }
 
+static BOOL capture_plugin_write_region(captureSession* session, wStream* s,
+                                        const RECTANGLE_16* rect, const BYTE* data)
+{
+	const UINT32 width = rect->right - rect->left;
+	const UINT32 height = rect->bottom - rect->top;
+	const UINT32 size = width * height * 4;
+	BYTE* planar = NULL;
+	UINT32 length = size;
+
+	WINPR_ASSERT(session);
+	WINPR_ASSERT(session->config);
+
+	if (session->config->codec == CAPTURE_CODEC_PLANAR)
+	{
+		if (!session->planar)
+			session->planar = freerdp_bitmap_planar_context_new(
+			    PLANAR_FORMAT_HEADER_RLE | PLANAR_FORMAT_HEADER_NA, width, height);
+
+		if (!freerdp_bitmap_planar_context_reset(session->planar, width, height))
+			return FALSE;
+
+		freerdp_planar_topdown_image(session->planar, TRUE);
+		length = 0;
+		planar = freerdp_bitmap_compress_planar(session->planar, data, PIXEL_FORMAT_BGRX32,
+		                                        width, height, width * 4, NULL, &length);
+		if (!planar)
+			return FALSE;
+
+		data = planar;
+	}
+
+	if (!Stream_EnsureRemainingCapacity(s, CAPTURED_REGION_BASE_SIZE + length))
+	{
+		free(planar);
+		return FALSE;
+	}
+
+	Stream_Write_UINT16(s, rect->left);     /* left (2 bytes) */
+	Stream_Write_UINT16(s, rect->top);      /* top (2 bytes) */
+	Stream_Write_UINT16(s, (UINT16)width);  /* width (2 bytes) */
+	Stream_Write_UINT16(s, (UINT16)height); /* height (2 bytes) */
+	Stream_Write_UINT32(s, length);         /* data length (4 bytes) */
+	Stream_Write(s, data, length);          /* data */
+	free(planar);
+	return TRUE;
+}
+
+/*
+ * captured regions packet: codec (2 bytes), number of regions (2 bytes), desktop width (2 bytes)
+ * and desktop height (2 bytes), followed by the regions. Each region carries its rectangle and
+ * the length of its codec data.
+ */
+static BOOL capture_plugin_send_regions(captureSession* session, const captureFrame* frame)
+{
+	const BYTE* data;
+	wStream* s;
+
+	WINPR_ASSERT(session);
+	WINPR_ASSERT(frame);
+
+	s = capture_plugin_packet_new(CAPTURED_REGIONS_PDU_BASE_SIZE, MESSAGE_TYPE_CAPTURED_REGIONS);
+	if (!s)
+		return FALSE;
+
+	Stream_Write_UINT16(s, session->config->codec); /* codec (2 bytes) */
+	Stream_Write_UINT16(s, (UINT16)frame->nrects);  /* number of regions (2 bytes) */
+	Stream_Write_UINT16(s, (UINT16)frame->width);   /* desktop width (2 bytes) */
+	Stream_Write_UINT16(s, (UINT16)frame->height);  /* desktop height (2 bytes) */
+
+	data = frame->data;
+	for (UINT32 x = 0; x < frame->nrects; x++)
+	{
+		const RECTANGLE_16* rect = &frame->rects[x];
+
+		if (!capture_plugin_write_region(session, s, rect, data))
+		{
+			WLog_ERR(TAG, "failed to encode captured region");
+			Stream_Free(s, TRUE);
+			return FALSE;
+		}
+
+		data += 4ull * (rect->right - rect->left) * (rect->bottom - rect->top);
+	}
+
+	if (!capture_plugin_packet_seal(s))
+	{
+		Stream_Free(s, TRUE);
+		return FALSE;
+	}
+
+	return capture_plugin_send_packet(session->socket, s);
+}
+
+static DWORD WINAPI capture_plugin_sender_thread(LPVOID arg)
+{
+	captureSession* session = arg;
+	HANDLE event;
+
+	WINPR_ASSERT(session);
+
+	event = Queue_Event(session->frames);
+	while (WaitForSingleObject(event, INFINITE) == WAIT_OBJECT_0)
+	{
+		BOOL rc = FALSE;
+		captureFrame* frame = Queue_Dequeue(session->frames);
+
+		if (!frame)
+			continue;
+
+		switch (frame->type)
+		{
+			case MESSAGE_TYPE_CAPTURED_FRAME:
+				rc = capture_plugin_send_frame(session->socket, frame);
+				break;
+
+			case MESSAGE_TYPE_CAPTURED_REGIONS:
+				rc = capture_plugin_send_regions(session, frame);
+				break;
+
+			case MESSAGE_TYPE_SESSION_END:
+				capture_plugin_send_packet(
+				    session->socket,
+				    capture_plugin_packet_new(SESSION_END_PDU_BASE_SIZE, MESSAGE_TYPE_SESSION_END));
+				goto out;
+
+			default:
+				break;
+		}
+
+		capture_plugin_frame_free(frame);
+
+		if (!rc)
+		{
+			WLog_ERR(TAG, "failed to send captured frame!");
+			InterlockedExchange(&session->failed, TRUE);
+			break;
+		}
+	}
+
+out:
+	ExitThread(0);
+	return 0;
+}
+
+static captureFrame* capture_plugin_copy_frame(pClientContext* pc)
+{
+	rdpGdi* gdi;
+	rdpSettings* settings;
+	captureFrame* frame;
+
+	WINPR_ASSERT(pc);
+	gdi = pc->context.gdi;
+	settings = pc->context.settings;
+	WINPR_ASSERT(gdi);
+	WINPR_ASSERT(settings);
+
+	frame = capture_plugin_frame_new(MESSAGE_TYPE_CAPTURED_FRAME);
+	if (!frame)
+		return NULL;
+
+	frame->width = settings->DesktopWidth;
+	frame->height = settings->DesktopHeight;
+	frame->bpp = freerdp_settings_get_uint32(settings, FreeRDP_ColorDepth);
+	frame->size = 1ull * frame->width * frame->height * (frame->bpp / 8);
+	frame->size = MIN(frame->size, 1ull * gdi->stride * gdi->height);
+	frame->data = malloc(frame->size);
+	if (!frame->data)
+	{
+		capture_plugin_frame_free(frame);
+		return NULL;
+	}
+
+	memcpy(frame->data, gdi->primary_buffer, frame->size);
+	return frame;
+}
+
+static captureFrame* capture_plugin_copy_regions(rdpGdi* gdi, const REGION16* region)
+{
+	UINT32 nrects = 0;
+	const RECTANGLE_16* rects;
+	captureFrame* frame;
+	BYTE* data;
+
+	WINPR_ASSERT(gdi);
+	WINPR_ASSERT(region);
+
+	rects = region16_rects(region, &nrects);
+	if (nrects > UINT16_MAX)
+	{
+		rects = region16_extents(region);
+		nrects = 1;
+	}
+
+	frame = capture_plugin_frame_new(MESSAGE_TYPE_CAPTURED_REGIONS);
+	if (!frame)
+		return NULL;
+
+	frame->width = gdi->width;
+	frame->height = gdi->height;
+	frame->nrects = nrects;
+	frame->rects = calloc(nrects, sizeof(RECTANGLE_16));
+	if (!frame->rects)
+		goto fail;
+
+	for (UINT32 x = 0; x < nrects; x++)
+	{
+		const RECTANGLE_16* rect = &rects[x];
+
+		frame->rects[x] = *rect;
+		frame->size += 4ull * (rect->right - rect->left) * (rect->bottom - rect->top);
+	}
+
+	frame->data = malloc(frame->size);
+	if (!frame->data)
+		goto fail;
+
+	data = frame->data;
+	for (UINT32 x = 0; x < nrects; x++)
+	{
+		const RECTANGLE_16* rect = &frame->rects[x];
+		const UINT32 width = rect->right - rect->left;
+		const UINT32 height = rect->bottom - rect->top;
+
+		if (!freerdp_image_copy(data, PIXEL_FORMAT_BGRX32, width * 4, 0, 0, width, height,
+		                        gdi->primary_buffer, gdi->dstFormat, gdi->stride, rect->left,
+		                        rect->top, NULL, FREERDP_FLIP_NONE))
+			goto fail;
+
+		data += 4ull * width * height;
+	}
+
+	return frame;
+
+fail:
+	capture_plugin_frame_free(frame);
+	return NULL;
+}
+
+/* collects the invalidated rectangles of the desktop, clipped to its size */
+static BOOL capture_plugin_invalid_region(captureSession* session, rdpGdi* gdi)
+{
+	REGION16* region = &session->pending;
+	const HGDI_WND hwnd = gdi->primary->hdc->hwnd;
+	const RECTANGLE_16 desktop = { 0, 0, (UINT16)MIN(gdi->width, UINT16_MAX),
+		                           (UINT16)MIN(gdi->height, UINT16_MAX) };
+
+	/* the receiver has no image yet or the desktop was resized, send all of it */
+	if ((session->width != gdi->width) || (session->height != gdi->height))
+	{
+		region16_clear(region);
+		session->width = gdi->width;
+		session->height = gdi->height;
+		return region16_union_rect(region, region, &desktop);
+	}
+
+	for (INT32 x = 0; x < hwnd->ninvalid; x++)
+	{
+		const HGDI_RGN rgn = &hwnd->cinvalid[x];
+		RECTANGLE_16 rect = { 0 };
+		RECTANGLE_16 clipped = { 0 };
+
+		if ((rgn->w <= 0) || (rgn->h <= 0))
+			continue;
+
+		rect.left = (UINT16)MAX(0, MIN(rgn->x, UINT16_MAX));
+		rect.top = (UINT16)MAX(0, MIN(rgn->y, UINT16_MAX));
+		rect.right = (UINT16)MAX(0, MIN(1ll * rgn->x + rgn->w, UINT16_MAX));
+		rect.bottom = (UINT16)MAX(0, MIN(1ll * rgn->y + rgn->h, UINT16_MAX));
+
+		if (!rectangles_intersection(&rect, &desktop, &clipped))
+			continue;
+
+		if (!region16_union_rect(region, region, &clipped))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* copies the invalidated desktop, unless the sender is busy. A forced frame is always queued */
+static BOOL capture_plugin_queue_frame(captureSession* session, pClientContext* pc, BOOL force)
+{
+	rdpGdi* gdi = pc->context.gdi;
+	captureFrame* frame;
+	const BOOL busy = Queue_Count(session->frames) >= session->config->maxQueuedFrames;
+
+	if (session->config->mode == CAPTURE_MODE_DELTA)
+	{
+		if (!capture_plugin_invalid_region(session, gdi))
+			return FALSE;
+
+		if (region16_is_empty(&session->pending))
+			return TRUE;
+	}
+
+	if (busy && !force)
+	{
+		session->stale = TRUE;
+		session->dropped++;
+		WLog_DBG(TAG, "capture link is busy, %" PRIu64 " frames dropped", session->dropped);
+		return TRUE;
+	}
+
+	if (session->config->mode == CAPTURE_MODE_DELTA)
+		frame = capture_plugin_copy_regions(gdi, &session->pending);
+	else
+		frame = capture_plugin_copy_frame(pc);
+
+	if (!frame)
+		return FALSE;
+
+	if (!Queue_Enqueue(session->frames, frame))
+	{
+		capture_plugin_frame_free(frame);
+		return FALSE;
+	}
+
+	region16_clear(&session->pending);
+	session->stale = FALSE;
+	return TRUE;
+}
+
+static BOOL capture_plugin_session_end(proxyPlugin* plugin, proxyData* pdata, void* custom)
+{
+	captureSession* session;
+
+	WINPR_ASSERT(pdata);
+	WINPR_ASSERT(custom);
+	WINPR_ASSERT(plugin);
+	WINPR_ASSERT(plugin->mgr);
+
+	session = capture_plugin_get_session(plugin, pdata);
+	if (!session)
+		return FALSE;
+
+	/*
+	 * the client has been aborted but might still be painting, the session is freed once it is
+	 * gone. In reactor mode both sides of a session run on the same worker.
+	 */
+	if (pdata->client_thread)
+		WaitForSingleObject(pdata->client_thread, INFINITE);
+
+	plugin->mgr->SetPluginData(plugin->mgr, PLUGIN_NAME, pdata, &capture_plugin_session_ended);
+	capture_plugin_session_free(session);
+	return TRUE;
+}
+
 static BOOL capture_plugin_client_end_paint(proxyPlugin* plugin, proxyData* pdata, void* custom)
 {
 	pClientContext* pc = pdata->pc;
 	rdpGdi* gdi = pc->context.gdi;
-	SOCKET socket;
+	captureSession* session;
 
 	WINPR_ASSERT(pdata);
 	WINPR_ASSERT(custom);
@@ -211,13 +625,16 @@ static BOOL capture_plugin_client_end_paint(proxyPlugin* plugin, proxyData* pdat
 	if (gdi->primary->hdc->hwnd->ninvalid < 1)
 		return TRUE;
 
-	socket = capture_plugin_get_socket(plugin, pdata);
-	if (socket == INVALID_SOCKET)
+	session = capture_plugin_get_session(plugin, pdata);
+	if (!session)
 		return FALSE;
 
-	if (!capture_plugin_send_frame(pc, socket, gdi->primary_buffer))
+	if (InterlockedCompareExchange(&session->failed, 0, 0))
+		return FALSE;
+
+	if (!capture_plugin_queue_frame(session, pc, FALSE))
 	{
-		WLog_ERR(TAG, "capture_plugin_send_frame failed!");
+		WLog_ERR(TAG, "failed to capture frame!");
 		return FALSE;
 	}
 
@@ -226,10 +643,72 @@ static BOOL capture_plugin_client_end_paint(proxyPlugin* plugin, proxyData* pdat
 	return TRUE;
 }
 
+/* the recording ends with the last image of the target, even if frames were dropped */
+static BOOL capture_plugin_client_post_disconnect(proxyPlugin* plugin, proxyData* pdata,
+                                                  void* custom)
+{
+	pClientContext* pc = pdata->pc;
+	rdpGdi* gdi = pc->context.gdi;
+	captureSession* session;
+
+	WINPR_ASSERT(pdata);
+	WINPR_ASSERT(custom);
+	WINPR_ASSERT(plugin);
+	WINPR_ASSERT(plugin->mgr);
+
+	session = capture_plugin_get_session(plugin, pdata);
+	if (!session || !gdi || InterlockedCompareExchange(&session->failed, 0, 0))
+		return TRUE;
+
+	if (!session->stale && (gdi->primary->hdc->hwnd->ninvalid < 1))
+		return TRUE;
+
+	if (!capture_plugin_queue_frame(session, pc, TRUE))
+		WLog_WARN(TAG, "failed to capture the final frame");
+
+	gdi->primary->hdc->hwnd->invalid->null = TRUE;
+	gdi->primary->hdc->hwnd->ninvalid = 0;
+	return TRUE;
+}
+
+static captureSession* capture_plugin_session_new(const captureConfig* cconfig)
+{
+	wObject* obj;
+	captureSession* session = calloc(1, sizeof(captureSession));
+
+	if (!session)
+		return NULL;
+
+	session->config = cconfig;
+	session->socket = INVALID_SOCKET;
+	region16_init(&session->pending);
+
+	/* room for the frames, the final frame and the end marker, the queue never grows */
+	session->frames = Queue_New(TRUE, cconfig->maxQueuedFrames + 2, -1);
+	if (!session->frames)
+		goto fail;
+
+	obj = Queue_Object(session->frames);
+	obj->fnObjectFree = capture_plugin_frame_free;
+
+	session->socket = capture_plugin_init_socket(cconfig);
+	if (session->socket == INVALID_SOCKET)
+	{
+		WLog_ERR(TAG, "failed to establish a connection");
+		goto fail;
+	}
+
+	return session;
+
+fail:
+	capture_plugin_session_free(session);
+	return NULL;
+}
+
 static BOOL capture_plugin_client_post_connect(proxyPlugin* plugin, proxyData* pdata, void* custom)
 {
 	captureConfig* cconfig;
-	SOCKET socket;
+	captureSession* session;
 	wStream* s;
 
 	WINPR_ASSERT(pdata);
@@ -240,20 +719,29 @@ static BOOL capture_plugin_client_post_connect(proxyPlugin* plugin, proxyData* p
 	cconfig = plugin->custom;
 	WINPR_ASSERT(cconfig);
 
-	socket = capture_plugin_init_socket(cconfig);
-	if (socket == INVALID_SOCKET)
+	/* a redirected or reconnected session starts a new recording */
+	capture_plugin_session_free(capture_plugin_get_session(plugin, pdata));
+	plugin->mgr->SetPluginData(plugin->mgr, PLUGIN_NAME, pdata, &capture_plugin_session_ended);
+
+	session = capture_plugin_session_new(cconfig);
+	if (!session)
+		return FALSE;
+
+	s = capture_plugin_create_session_info_packet(pdata->pc);
+	if (!s || !capture_plugin_send_packet(session->socket, s))
 	{
-		WLog_ERR(TAG, "failed to establish a connection");
+		capture_plugin_session_free(session);
 		return FALSE;
 	}
 
-	plugin->mgr->SetPluginData(plugin->mgr, PLUGIN_NAME, pdata, (void*)socket);
-
-	s = capture_plugin_create_session_info_packet(pdata->pc);
-	if (!s)
+	session->thread = CreateThread(NULL, 0, capture_plugin_sender_thread, session, 0, NULL);
+	if (!session->thread)
+	{
+		capture_plugin_session_free(session);
 		return FALSE;
+	}
 
-	return capture_plugin_send_packet(socket, s);
+	return plugin->mgr->SetPluginData(plugin->mgr, PLUGIN_NAME, pdata, session);
 }
 
 static BOOL capture_plugin_server_post_connect(proxyPlugin* plugin, proxyData* pdata, void* custom)
@@ -317,14 +805,15 @@ BOOL proxy_module_entry_point(proxyPluginsManager* plugins_manager, void* userda
 {
 	proxyPlugin plugin = { 0 };
 
-	plugin.name = PLUGIN_NAME;                                     /* name */
-	plugin.description = PLUGIN_DESC;                              /* description */
-	plugin.PluginUnload = capture_plugin_unload;                   /* PluginUnload */
-	plugin.ClientPostConnect = capture_plugin_client_post_connect; /* ClientPostConnect */
-	plugin.ClientEndPaint = capture_plugin_client_end_paint;       /* ClientEndPaint */
-	plugin.ServerPostConnect = capture_plugin_server_post_connect; /* ServerPostConnect */
-	plugin.ServerSessionEnd = capture_plugin_session_end;          /* Session End */
-	plugin.userdata = userdata;                                    /* userdata */
+	plugin.name = PLUGIN_NAME;                                           /* name */
+	plugin.description = PLUGIN_DESC;                                    /* description */
+	plugin.PluginUnload = capture_plugin_unload;                         /* PluginUnload */
+	plugin.ClientPostConnect = capture_plugin_client_post_connect;       /* ClientPostConnect */
+	plugin.ClientEndPaint = capture_plugin_client_end_paint;             /* ClientEndPaint */
+	plugin.ClientPostDisconnect = capture_plugin_client_post_disconnect; /* ClientPostDisconnect */
+	plugin.ServerPostConnect = capture_plugin_server_post_connect;       /* ServerPostConnect */
+	plugin.ServerSessionEnd = capture_plugin_session_end;                /* Session End */
+	plugin.userdata = userdata;                                          /* userdata */
 	captureConfig* cconfig = calloc(1, sizeof(captureConfig));
 	if (!cconfig)
 		return FALSE;
@@ -336,6 +825,8 @@ BOOL proxy_module_entry_point(proxyPluginsManager* plugins_manager, void* userda
 		return FALSE;
 	}
 
-	WLog_INFO(TAG, "host: %s, port: %" PRIu16 "", cconfig->host, cconfig->port);
+	WLog_INFO(TAG, "host: %s, port: %" PRIu16 ", mode: %s, queue: %" PRIu32 "", cconfig->host,
+	          cconfig->port, (cconfig->mode == CAPTURE_MODE_DELTA) ? "delta" : "full",
+	          cconfig->maxQueuedFrames);
 	return plugins_manager->RegisterPlugin(plugins_manager, &plugin);
 }
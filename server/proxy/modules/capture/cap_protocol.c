@@ -31,6 +31,20 @@ wStream* capture_plugin_packet_new(UINT32 payload_size, UINT16 type)
 	return stream;
 }
 
+/* sets the payload size of a packet that grew while it was written */
+BOOL capture_plugin_packet_seal(wStream* s)
+{
+	const size_t length = Stream_GetPosition(s);
+
+	if ((length < HEADER_SIZE) || (length - HEADER_SIZE > UINT32_MAX))
+		return FALSE;
+
+	Stream_SetPosition(s, 0);
+	Stream_Write_UINT32(s, (UINT32)(length - HEADER_SIZE));
+	Stream_SetPosition(s, length);
+	return TRUE;
+}
+
 wStream* capture_plugin_create_session_info_packet(pClientContext* pc)
 {
 	size_t username_length;
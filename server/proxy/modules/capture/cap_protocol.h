@@ -27,11 +27,19 @@
 #define SESSION_INFO_PDU_BASE_SIZE 46
 #define SESSION_END_PDU_BASE_SIZE 0
 #define CAPTURED_FRAME_PDU_BASE_SIZE 0
+#define CAPTURED_REGIONS_PDU_BASE_SIZE 8
+#define CAPTURED_REGION_BASE_SIZE 12
 
 /* protocol message types */
 #define MESSAGE_TYPE_SESSION_INFO 1
 #define MESSAGE_TYPE_CAPTURED_FRAME 2
 #define MESSAGE_TYPE_SESSION_END 3
+#define MESSAGE_TYPE_CAPTURED_REGIONS 4
+
+/* captured regions payload codecs */
+#define CAPTURE_CODEC_UNCOMPRESSED 0 /* BGRX32, top-down, width * 4 bytes per line */
+#define CAPTURE_CODEC_PLANAR 1       /* RDP 6.0 planar bitmap, see [MS-RDPEGDI] 2.2.2.5.1 */
 
 wStream* capture_plugin_packet_new(UINT32 payload_size, UINT16 type);
+BOOL capture_plugin_packet_seal(wStream* s);
 wStream* capture_plugin_create_session_info_packet(pClientContext* pc);
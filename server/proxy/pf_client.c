@@ -51,8 +51,16 @@
 static void channel_data_free(void* obj);
 static BOOL proxy_server_reactivate(rdpContext* ps, const rdpContext* pc)
 {
+	proxyData* pdata;
+
 	WINPR_ASSERT(ps);
 	WINPR_ASSERT(pc);
+	pdata = ((pServerContext*)ps)->pdata;
+	WINPR_ASSERT(pdata);
+	WINPR_ASSERT(pdata->pc);
+
+	/* the peer is reactivated, decode until its capabilities have been checked again */
+	InterlockedExchange(&pdata->pc->raw_updates, 0);
 
 	if (!pf_context_copy_settings(ps->settings, pc->settings))
 		return FALSE;
@@ -749,6 +757,81 @@ out:
 	return rc;
 }
 
+/**
+ * Runs the connect hooks and connects to the target server.
+ * The session is aborted if the connection fails.
+ */
+static BOOL pf_client_session_connect(pClientContext* pc)
+{
+	proxyData* pdata;
+
+	WINPR_ASSERT(pc);
+
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+
+	if (!pf_modules_run_hook(pdata->module, HOOK_TYPE_CLIENT_INIT_CONNECT, pdata, pc))
+	{
+		proxy_data_abort_connect(pdata);
+		return FALSE;
+	}
+
+	if (!pf_client_connect(pc->context.instance))
+	{
+		proxy_data_abort_connect(pdata);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+DWORD pf_client_session_get_event_handles(pClientContext* pc, HANDLE* events, DWORD count)
+{
+	DWORD nCount = 0;
+	DWORD tmp;
+
+	WINPR_ASSERT(pc);
+	WINPR_ASSERT(events);
+
+	if (count < 2)
+		return 0;
+
+	events[nCount++] = Queue_Event(pc->cached_server_channel_data);
+
+	tmp = freerdp_get_event_handles(&pc->context, &events[nCount], count - nCount);
+	if (tmp == 0)
+		return 0;
+
+	return nCount + tmp;
+}
+
+BOOL pf_client_session_check(pClientContext* pc)
+{
+	freerdp* instance;
+
+	WINPR_ASSERT(pc);
+
+	instance = pc->context.instance;
+	WINPR_ASSERT(instance);
+
+	if (freerdp_shall_disconnect_context(instance->context))
+		return FALSE;
+
+	if (proxy_data_shall_disconnect(pc->pdata))
+		return FALSE;
+
+	if (!freerdp_check_event_handles(instance->context))
+	{
+		if (freerdp_get_last_error(instance->context) == FREERDP_ERROR_SUCCESS)
+			WLog_ERR(TAG, "Failed to check FreeRDP event handles");
+
+		return FALSE;
+	}
+
+	sendQueuedChannelData(pc);
+	return TRUE;
+}
+
 /**
  * RDP main loop.
  * Connects RDP, loops while running and handles event and dispatch, cleans up
@@ -778,23 +861,13 @@ static DWORD WINAPI pf_client_thread_proc(pClientContext* pc)
 	 */
 	handles[nCount++] = pdata->abort_event;
 
-	if (!pf_modules_run_hook(pdata->module, HOOK_TYPE_CLIENT_INIT_CONNECT, pdata, pc))
-	{
-		proxy_data_abort_connect(pdata);
-		goto end;
-	}
-
-	if (!pf_client_connect(instance))
-	{
-		proxy_data_abort_connect(pdata);
+	if (!pf_client_session_connect(pc))
 		goto end;
-	}
-	handles[nCount++] = Queue_Event(pc->cached_server_channel_data);
 
 	while (!freerdp_shall_disconnect_context(instance->context))
 	{
-		UINT32 tmp = freerdp_get_event_handles(instance->context, &handles[nCount],
-		                                       ARRAYSIZE(handles) - nCount);
+		UINT32 tmp = pf_client_session_get_event_handles(pc, &handles[nCount],
+		                                                 ARRAYSIZE(handles) - nCount);
 
 		if (tmp == 0)
 		{
@@ -815,20 +888,8 @@ static DWORD WINAPI pf_client_thread_proc(pClientContext* pc)
 		if (status == WAIT_OBJECT_0)
 			break;
 
-		if (freerdp_shall_disconnect_context(instance->context))
-			break;
-
-		if (proxy_data_shall_disconnect(pdata))
-			break;
-
-		if (!freerdp_check_event_handles(instance->context))
-		{
-			if (freerdp_get_last_error(instance->context) == FREERDP_ERROR_SUCCESS)
-				WLog_ERR(TAG, "Failed to check FreeRDP event handles");
-
+		if (!pf_client_session_check(pc))
 			break;
-		}
-		sendQueuedChannelData(pc);
 	}
 
 	freerdp_disconnect(instance);
@@ -1044,3 +1105,32 @@ DWORD WINAPI pf_client_start(LPVOID arg)
 	freerdp_client_stop(&pc->context);
 	return rc;
 }
+
+BOOL pf_client_session_start(pClientContext* pc)
+{
+	WINPR_ASSERT(pc);
+
+	if (freerdp_client_start(&pc->context) != 0)
+	{
+		freerdp_client_stop(&pc->context);
+		return FALSE;
+	}
+
+	if (!pf_client_session_connect(pc))
+	{
+		pf_modules_run_hook(pc->pdata->module, HOOK_TYPE_CLIENT_UNINIT_CONNECT, pc->pdata, pc);
+		freerdp_client_stop(&pc->context);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void pf_client_session_stop(pClientContext* pc)
+{
+	WINPR_ASSERT(pc);
+
+	freerdp_disconnect(pc->context.instance);
+	pf_modules_run_hook(pc->pdata->module, HOOK_TYPE_CLIENT_UNINIT_CONNECT, pc->pdata, pc);
+	freerdp_client_stop(&pc->context);
+}
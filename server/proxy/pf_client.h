@@ -23,9 +23,16 @@
 #define FREERDP_SERVER_PROXY_PFCLIENT_H
 
 #include <freerdp/freerdp.h>
+#include <freerdp/server/proxy/proxy_context.h>
 #include <winpr/wtypes.h>
 
 int RdpClientEntry(RDP_CLIENT_ENTRY_POINTS* pEntryPoints);
 DWORD WINAPI pf_client_start(LPVOID arg);
 
+/* Single steps of pf_client_start for callers that multiplex many sessions */
+BOOL pf_client_session_start(pClientContext* pc);
+DWORD pf_client_session_get_event_handles(pClientContext* pc, HANDLE* events, DWORD count);
+BOOL pf_client_session_check(pClientContext* pc);
+void pf_client_session_stop(pClientContext* pc);
+
 #endif /* FREERDP_SERVER_PROXY_PFCLIENT_H */
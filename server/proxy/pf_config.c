@@ -170,6 +170,13 @@ static BOOL pf_config_load_server(wIniFile* ini, proxyConfig* config)
 	const char* host;
 
 	WINPR_ASSERT(config);
+	config->FastCompression = pf_config_get_bool(ini, "Server", "FastCompression", FALSE);
+	config->Reactor = pf_config_get_bool(ini, "Server", "Reactor", FALSE);
+	if (!pf_config_get_uint32(ini, "Server", "ReactorThreads", &config->ReactorThreads, FALSE))
+		return FALSE;
+	if (!pf_config_get_uint32(ini, "Server", "ReactorConnectThreads",
+	                          &config->ReactorConnectThreads, FALSE))
+		return FALSE;
 	host = pf_config_get_str(ini, "Server", "Host", FALSE);
 
 	if (!host)
@@ -311,6 +318,7 @@ static BOOL pf_config_load_gfx_settings(wIniFile* ini, proxyConfig* config)
 {
 	WINPR_ASSERT(config);
 	config->DecodeGFX = pf_config_get_bool(ini, "GFXSettings", "DecodeGFX", FALSE);
+	config->RawPassthrough = pf_config_get_bool(ini, "GFXSettings", "RawPassthrough", TRUE);
 	return TRUE;
 }
 
@@ -446,6 +454,14 @@ BOOL pf_server_config_dump(const char* file)
 		goto fail;
 	if (IniFile_SetKeyValueInt(ini, "Server", "Port", 3389) < 0)
 		goto fail;
+	if (IniFile_SetKeyValueString(ini, "Server", "FastCompression", "false") < 0)
+		goto fail;
+	if (IniFile_SetKeyValueString(ini, "Server", "Reactor", "false") < 0)
+		goto fail;
+	if (IniFile_SetKeyValueInt(ini, "Server", "ReactorThreads", 0) < 0)
+		goto fail;
+	if (IniFile_SetKeyValueInt(ini, "Server", "ReactorConnectThreads", 0) < 0)
+		goto fail;
 
 	/* Target configuration */
 	if (IniFile_SetKeyValueString(ini, "Target", "Host", "somehost.example.com") < 0)
@@ -522,6 +538,8 @@ BOOL pf_server_config_dump(const char* file)
 	/* GFX configuration */
 	if (IniFile_SetKeyValueString(ini, "GFXSettings", "DecodeGFX", "false") < 0)
 		goto fail;
+	if (IniFile_SetKeyValueString(ini, "GFXSettings", "RawPassthrough", "true") < 0)
+		goto fail;
 
 	/* Certificate configuration */
 	if (IniFile_SetKeyValueString(ini, "Certificates", "CertificateFile",
@@ -616,6 +634,13 @@ void pf_server_config_print(const proxyConfig* config)
 	CONFIG_PRINT_SECTION("Server");
 	CONFIG_PRINT_STR(config, Host);
 	CONFIG_PRINT_UINT16(config, Port);
+	CONFIG_PRINT_BOOL(config, FastCompression);
+	CONFIG_PRINT_BOOL(config, Reactor);
+	if (config->Reactor)
+	{
+		CONFIG_PRINT_UINT32(config, ReactorThreads);
+		CONFIG_PRINT_UINT32(config, ReactorConnectThreads);
+	}
 
 	if (config->FixedTarget)
 	{
@@ -675,6 +700,7 @@ void pf_server_config_print(const proxyConfig* config)
 
 	CONFIG_PRINT_SECTION("GFXSettings");
 	CONFIG_PRINT_BOOL(config, DecodeGFX);
+	CONFIG_PRINT_BOOL(config, RawPassthrough);
 
 	/* modules */
 	CONFIG_PRINT_SECTION("Plugins/Modules");
@@ -430,6 +430,23 @@ BOOL pf_modules_is_plugin_loaded(proxyModule* module, const char* plugin_name)
 	return ArrayList_ForEach(module->plugins, pf_modules_load_ArrayList_ForEachFkt, plugin_name);
 }
 
+static BOOL pf_modules_paint_ArrayList_ForEachFkt(void* data, size_t index, va_list ap)
+{
+	proxyPlugin* plugin = (proxyPlugin*)data;
+
+	WINPR_UNUSED(index);
+	WINPR_UNUSED(ap);
+
+	return plugin->ClientEndPaint == NULL;
+}
+
+BOOL pf_modules_has_paint_hook(proxyModule* module)
+{
+	WINPR_ASSERT(module);
+	WINPR_ASSERT(module->plugins);
+	return !ArrayList_ForEach(module->plugins, pf_modules_paint_ArrayList_ForEachFkt);
+}
+
 static BOOL pf_modules_print_ArrayList_ForEachFkt(void* data, size_t index, va_list ap)
 {
 	proxyPlugin* plugin = (proxyPlugin*)data;
@@ -0,0 +1,963 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * FreeRDP Proxy Server Session Reactor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <winpr/crt.h>
+#include <winpr/pool.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+#include <winpr/collections.h>
+
+#include <freerdp/server/proxy/proxy_log.h>
+#include <freerdp/server/proxy/proxy_context.h>
+
+#include "pf_reactor.h"
+#include "pf_client.h"
+
+#define TAG PROXY_TAG("reactor")
+
+/* Sessions are checked at least this often (ms), like the wait timeout of the peer threads */
+#define PF_REACTOR_POLL_INTERVAL 1000
+#define PF_REACTOR_MAX_EVENTS 64
+#define PF_REACTOR_DEFAULT_CONNECT_THREADS 16
+/* Time (ms) the sessions get to end on the server stop event before they are closed */
+#define PF_REACTOR_SHUTDOWN_TIMEOUT 5000
+
+typedef struct pf_reactor_session pfReactorSession;
+typedef struct pf_reactor_worker pfReactorWorker;
+
+enum
+{
+	PF_REACTOR_ATTACH_FRONT = 1, /* the front end is activated */
+	PF_REACTOR_ATTACH_BACK,      /* connecting the target finished */
+	PF_REACTOR_CLOSE             /* the front end ended before it was activated */
+};
+
+typedef struct
+{
+	HANDLE handle;
+	int fd;
+} pfReactorHandle;
+
+/* A set of handles registered with the epoll instance of a worker */
+typedef struct
+{
+	pfReactorSession* session; /* NULL for the handles of the worker */
+	pfReactorHandle handles[MAXIMUM_WAIT_OBJECTS];
+	size_t count;
+	UINT64 batch; /* last epoll_wait batch the source was checked in */
+} pfReactorSource;
+
+struct pf_reactor_session
+{
+	volatile LONG refs; /* one for the session, one per pending message */
+	proxyReactor* reactor;
+	pfReactorWorker* worker;
+	freerdp_peer* peer;
+	PTP_WORK front_work;
+	PTP_WORK back_work;
+	pfReactorSource front;
+	pfReactorSource back;
+	volatile LONG back_connected; /* the target is connected and not stopped yet */
+	volatile LONG front_ended;    /* the front end was ended, its socket is closed */
+
+	/* owned by the front work until the front end is attached, then by the worker */
+	BOOL back_started;
+
+	/* owned by the worker */
+	BOOL front_attached;
+	BOOL back_attached;
+	BOOL listed;
+	BOOL closed;
+};
+
+struct pf_reactor_worker
+{
+	proxyReactor* reactor;
+	HANDLE thread;
+	int epfd;
+	wMessageQueue* queue;
+	pfReactorSource queueSource;
+	pfReactorSource stopSource;
+	wArrayList* sessions; /* sessions with attached handles */
+	wArrayList* release;  /* references released after the current batch */
+	UINT64 batch;
+	UINT64 lastPoll;
+};
+
+struct pf_reactor
+{
+	proxyServer* server;
+	PTP_POOL pool;
+	TP_CALLBACK_ENVIRON environment;
+	pfReactorWorker* workers;
+	size_t workerCount;
+	volatile LONG next;
+	wArrayList* sessions; /* all sessions, emptied before the workers stop */
+	HANDLE idle;          /* set while there is no session */
+};
+
+static proxyData* pf_reactor_session_data(pfReactorSession* session)
+{
+	pServerContext* ps;
+
+	WINPR_ASSERT(session);
+	WINPR_ASSERT(session->peer);
+
+	ps = (pServerContext*)session->peer->context;
+	if (!ps)
+		return NULL;
+
+	return ps->pdata;
+}
+
+static void pf_reactor_session_free(pfReactorSession* session)
+{
+	if (!session)
+		return;
+
+	if (session->front_work)
+	{
+		WaitForThreadpoolWorkCallbacks(session->front_work, FALSE);
+		CloseThreadpoolWork(session->front_work);
+	}
+
+	if (session->back_work)
+	{
+		WaitForThreadpoolWorkCallbacks(session->back_work, FALSE);
+		CloseThreadpoolWork(session->back_work);
+	}
+
+	if (session->peer)
+		pf_server_session_free(session->peer);
+
+	ArrayList_Lock(session->reactor->sessions);
+	ArrayList_Remove(session->reactor->sessions, session);
+
+	if (ArrayList_Count(session->reactor->sessions) == 0)
+		SetEvent(session->reactor->idle);
+
+	ArrayList_Unlock(session->reactor->sessions);
+	free(session);
+}
+
+static void pf_reactor_session_release(pfReactorSession* session)
+{
+	WINPR_ASSERT(session);
+
+	if (InterlockedDecrement(&session->refs) == 0)
+		pf_reactor_session_free(session);
+}
+
+static void pf_reactor_session_end_front(pfReactorSession* session)
+{
+	WINPR_ASSERT(session);
+
+	if (!InterlockedExchange(&session->front_ended, 1))
+		pf_server_session_end(session->peer);
+}
+
+/**
+ * Posts a message for the session to its worker, the reference of the caller is passed on
+ * with the message.
+ *
+ * Without the message the worker never learns about the session, the connect work ends
+ * both sides itself. The reference is dropped without freeing the session, a callback can
+ * not wait for its own work. A session left without references is freed by
+ * pf_reactor_free.
+ */
+static void pf_reactor_session_post(pfReactorSession* session, UINT32 id)
+{
+	proxyData* pdata;
+
+	WINPR_ASSERT(session);
+	WINPR_ASSERT(session->worker);
+
+	if (MessageQueue_Post(session->worker->queue, session, id, NULL, NULL))
+		return;
+
+	WLog_ERR(TAG, "MessageQueue_Post failed, closing session");
+	pdata = pf_reactor_session_data(session);
+
+	if (pdata)
+		proxy_data_abort_connect(pdata);
+
+	/* the front end of an attached back end ends through the abort event */
+	if (id != PF_REACTOR_ATTACH_BACK)
+		pf_reactor_session_end_front(session);
+
+	if (pdata && pdata->pc && InterlockedExchange(&session->back_connected, 0))
+		pf_client_session_stop(pdata->pc);
+
+	InterlockedDecrement(&session->refs);
+}
+
+static BOOL pf_reactor_handle_contains(const pfReactorHandle* handles, size_t count,
+                                       const pfReactorHandle* handle)
+{
+	size_t x;
+
+	for (x = 0; x < count; x++)
+	{
+		if ((handles[x].handle == handle->handle) && (handles[x].fd == handle->fd))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void pf_reactor_source_clear(pfReactorWorker* worker, pfReactorSource* source)
+{
+	size_t x;
+
+	WINPR_ASSERT(worker);
+	WINPR_ASSERT(source);
+
+	for (x = 0; x < source->count; x++)
+		epoll_ctl(worker->epfd, EPOLL_CTL_DEL, source->handles[x].fd, NULL);
+
+	source->count = 0;
+}
+
+/**
+ * Registers the file descriptors of the events with the epoll instance of the worker and
+ * removes the ones no longer in use. Handles without a file descriptor are only polled.
+ */
+static BOOL pf_reactor_source_update(pfReactorWorker* worker, pfReactorSource* source,
+                                     const HANDLE* events, DWORD count)
+{
+	size_t x;
+	size_t nextCount = 0;
+	pfReactorHandle next[MAXIMUM_WAIT_OBJECTS] = { 0 };
+
+	WINPR_ASSERT(worker);
+	WINPR_ASSERT(source);
+	WINPR_ASSERT(count <= ARRAYSIZE(next));
+
+	for (x = 0; x < count; x++)
+	{
+		const int fd = GetEventFileDescriptor(events[x]);
+
+		if (fd < 0)
+			continue;
+
+		next[nextCount].handle = events[x];
+		next[nextCount].fd = fd;
+		nextCount++;
+	}
+
+	for (x = 0; x < source->count; x++)
+	{
+		/* The descriptor might already be closed, which removed it from the set */
+		if (!pf_reactor_handle_contains(next, nextCount, &source->handles[x]))
+			epoll_ctl(worker->epfd, EPOLL_CTL_DEL, source->handles[x].fd, NULL);
+	}
+
+	for (x = 0; x < nextCount; x++)
+	{
+		struct epoll_event event = { 0 };
+
+		if (pf_reactor_handle_contains(source->handles, source->count, &next[x]))
+			continue;
+
+		event.events = EPOLLIN;
+		event.data.ptr = source;
+
+		if ((epoll_ctl(worker->epfd, EPOLL_CTL_ADD, next[x].fd, &event) < 0) &&
+		    (errno != EEXIST))
+		{
+			WLog_ERR(TAG, "epoll_ctl failed with %s [%d]", strerror(errno), errno);
+			memcpy(source->handles, next, nextCount * sizeof(pfReactorHandle));
+			source->count = nextCount;
+			pf_reactor_source_clear(worker, source);
+			return FALSE;
+		}
+	}
+
+	memcpy(source->handles, next, nextCount * sizeof(pfReactorHandle));
+	source->count = nextCount;
+	return TRUE;
+}
+
+/* Starts connecting the target once the front end created the client context */
+static void pf_reactor_session_start_back(pfReactorSession* session)
+{
+	proxyData* pdata = pf_reactor_session_data(session);
+
+	WINPR_ASSERT(pdata);
+
+	if (session->back_started || !pdata->pc)
+		return;
+
+	session->back_started = TRUE;
+	InterlockedIncrement(&session->refs);
+	SubmitThreadpoolWork(session->back_work);
+}
+
+static BOOL pf_reactor_session_update_front(pfReactorWorker* worker, pfReactorSession* session)
+{
+	HANDLE events[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	const DWORD count =
+	    pf_server_session_get_event_handles(session->peer, events, ARRAYSIZE(events));
+
+	if (count == 0)
+		return FALSE;
+
+	return pf_reactor_source_update(worker, &session->front, events, count);
+}
+
+static BOOL pf_reactor_session_update_back(pfReactorWorker* worker, pfReactorSession* session)
+{
+	HANDLE events[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	proxyData* pdata = pf_reactor_session_data(session);
+	DWORD count;
+
+	WINPR_ASSERT(pdata);
+
+	count = pf_client_session_get_event_handles(pdata->pc, events, ARRAYSIZE(events));
+	if (count == 0)
+	{
+		PROXY_LOG_ERR(TAG, pdata->pc, "freerdp_get_event_handles failed!");
+		return FALSE;
+	}
+
+	return pf_reactor_source_update(worker, &session->back, events, count);
+}
+
+static void pf_reactor_session_stop_back(pfReactorSession* session)
+{
+	proxyData* pdata = pf_reactor_session_data(session);
+
+	WINPR_ASSERT(pdata);
+
+	if (InterlockedExchange(&session->back_connected, 0))
+		pf_client_session_stop(pdata->pc);
+
+	session->back_attached = FALSE;
+}
+
+static void pf_reactor_session_list(pfReactorWorker* worker, pfReactorSession* session)
+{
+	if (session->listed)
+		return;
+
+	if (ArrayList_Append(worker->sessions, session))
+		session->listed = TRUE;
+}
+
+/**
+ * Ends both sides of the session. The session is released after the current batch, events
+ * of this batch might still refer to it.
+ */
+static void pf_reactor_session_close(pfReactorWorker* worker, pfReactorSession* session)
+{
+	proxyData* pdata;
+
+	WINPR_ASSERT(worker);
+	WINPR_ASSERT(session);
+
+	if (session->closed)
+		return;
+
+	session->closed = TRUE;
+	pf_reactor_source_clear(worker, &session->front);
+	pf_reactor_source_clear(worker, &session->back);
+
+	pdata = pf_reactor_session_data(session);
+	if (pdata)
+		proxy_data_abort_connect(pdata);
+
+	if (session->front_attached)
+	{
+		pf_reactor_session_end_front(session);
+		session->front_attached = FALSE;
+	}
+
+	/* a target that is still connecting is stopped when its message arrives */
+	if (pdata && pdata->pc)
+		pf_reactor_session_stop_back(session);
+
+	if (session->listed)
+	{
+		ArrayList_Remove(worker->sessions, session);
+		session->listed = FALSE;
+	}
+
+	if (!ArrayList_Append(worker->release, session))
+		pf_reactor_session_release(session);
+}
+
+static BOOL pf_reactor_session_check_front(pfReactorWorker* worker, pfReactorSession* session)
+{
+	if (!pf_server_session_check(session->peer))
+		return FALSE;
+
+	pf_reactor_session_start_back(session);
+	return pf_reactor_session_update_front(worker, session);
+}
+
+static BOOL pf_reactor_session_check_back(pfReactorWorker* worker, pfReactorSession* session)
+{
+	proxyData* pdata = pf_reactor_session_data(session);
+
+	WINPR_ASSERT(pdata);
+
+	if (!pf_client_session_check(pdata->pc))
+		return FALSE;
+
+	return pf_reactor_session_update_back(worker, session);
+}
+
+static void pf_reactor_session_check(pfReactorWorker* worker, pfReactorSource* source)
+{
+	BOOL rc;
+	pfReactorSession* session = source->session;
+
+	WINPR_ASSERT(session);
+
+	if (session->closed || (source->batch == worker->batch))
+		return;
+
+	source->batch = worker->batch;
+
+	if (source == &session->front)
+		rc = pf_reactor_session_check_front(worker, session);
+	else
+		rc = pf_reactor_session_check_back(worker, session);
+
+	if (!rc)
+		pf_reactor_session_close(worker, session);
+}
+
+static void pf_reactor_worker_message(pfReactorWorker* worker, const wMessage* message)
+{
+	pfReactorSession* session = (pfReactorSession*)message->context;
+
+	WINPR_ASSERT(session);
+
+	switch (message->id)
+	{
+		case PF_REACTOR_ATTACH_FRONT:
+			if (session->closed)
+			{
+				pf_reactor_session_end_front(session);
+				break;
+			}
+
+			session->front_attached = TRUE;
+			pf_reactor_session_list(worker, session);
+
+			/* pending input is picked up by the level triggered epoll */
+			if (!pf_reactor_session_update_front(worker, session))
+				pf_reactor_session_close(worker, session);
+			break;
+
+		case PF_REACTOR_ATTACH_BACK:
+			if (!session->back_connected)
+				break; /* the front end ends through the abort event */
+
+			if (session->closed)
+			{
+				pf_reactor_session_stop_back(session);
+				break;
+			}
+
+			session->back_attached = TRUE;
+			pf_reactor_session_list(worker, session);
+
+			if (!pf_reactor_session_update_back(worker, session))
+				pf_reactor_session_close(worker, session);
+			break;
+
+		case PF_REACTOR_CLOSE:
+			pf_reactor_session_close(worker, session);
+			break;
+
+		default:
+			break;
+	}
+
+	/* the reference that came with the message */
+	if (!ArrayList_Append(worker->release, session))
+		pf_reactor_session_release(session);
+}
+
+/* Returns FALSE once the worker has to quit */
+static BOOL pf_reactor_worker_dispatch(pfReactorWorker* worker)
+{
+	wMessage message = { 0 };
+
+	while (MessageQueue_Peek(worker->queue, &message, TRUE))
+	{
+		if (message.id == WMQ_QUIT)
+			return FALSE;
+
+		pf_reactor_worker_message(worker, &message);
+	}
+
+	return TRUE;
+}
+
+static void pf_reactor_worker_close_all(pfReactorWorker* worker)
+{
+	size_t x = ArrayList_Count(worker->sessions);
+
+	while (x > 0)
+	{
+		pfReactorSession* session = ArrayList_GetItem(worker->sessions, --x);
+		pf_reactor_session_close(worker, session);
+	}
+}
+
+/* Checks every session, input without a file descriptor and lost wake ups are caught here */
+static void pf_reactor_worker_poll(pfReactorWorker* worker)
+{
+	size_t x = ArrayList_Count(worker->sessions);
+
+	while (x > 0)
+	{
+		pfReactorSession* session = ArrayList_GetItem(worker->sessions, --x);
+
+		if (session->front_attached)
+			pf_reactor_session_check(worker, &session->front);
+
+		if (session->back_attached)
+			pf_reactor_session_check(worker, &session->back);
+	}
+}
+
+static void pf_reactor_worker_release(pfReactorWorker* worker)
+{
+	size_t x;
+
+	for (x = 0; x < ArrayList_Count(worker->release); x++)
+		pf_reactor_session_release(ArrayList_GetItem(worker->release, x));
+
+	ArrayList_Clear(worker->release);
+}
+
+static DWORD WINAPI pf_reactor_worker_thread(LPVOID arg)
+{
+	BOOL running = TRUE;
+	pfReactorWorker* worker = (pfReactorWorker*)arg;
+
+	WINPR_ASSERT(worker);
+
+	while (running)
+	{
+		int x;
+		UINT64 now;
+		struct epoll_event events[PF_REACTOR_MAX_EVENTS] = { 0 };
+		const int status =
+		    epoll_wait(worker->epfd, events, ARRAYSIZE(events), PF_REACTOR_POLL_INTERVAL);
+
+		if (status < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			WLog_ERR(TAG, "epoll_wait failed with %s [%d]", strerror(errno), errno);
+			break;
+		}
+
+		worker->batch++;
+
+		for (x = 0; x < status; x++)
+		{
+			pfReactorSource* source = (pfReactorSource*)events[x].data.ptr;
+
+			if (source == &worker->queueSource)
+				running = pf_reactor_worker_dispatch(worker) && running;
+			else if (source == &worker->stopSource)
+			{
+				WLog_INFO(TAG, "Server shutting down, terminating peers");
+				pf_reactor_source_clear(worker, &worker->stopSource);
+				pf_reactor_worker_close_all(worker);
+			}
+			else
+				pf_reactor_session_check(worker, source);
+		}
+
+		now = GetTickCount64();
+		if (now - worker->lastPoll >= PF_REACTOR_POLL_INTERVAL)
+		{
+			worker->lastPoll = now;
+			pf_reactor_worker_poll(worker);
+		}
+
+		pf_reactor_worker_release(worker);
+	}
+
+	pf_reactor_worker_close_all(worker);
+	pf_reactor_worker_release(worker);
+	ExitThread(0);
+	return 0;
+}
+
+static void CALLBACK pf_reactor_front_work(PTP_CALLBACK_INSTANCE instance, void* context,
+                                           PTP_WORK work)
+{
+	BOOL activated = FALSE;
+	pfReactorSession* session = (pfReactorSession*)context;
+	freerdp_peer* peer;
+	HANDLE stopEvent;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	WINPR_ASSERT(session);
+
+	peer = session->peer;
+	stopEvent = session->reactor->server->stopEvent;
+
+	if (!pf_server_session_start(peer))
+	{
+		pf_reactor_session_post(session, PF_REACTOR_CLOSE);
+		return;
+	}
+
+	/* TLS and NLA accept block, run the connection sequence here until the peer is active */
+	while (!peer->activated)
+	{
+		HANDLE events[MAXIMUM_WAIT_OBJECTS] = { 0 };
+		DWORD count = pf_server_session_get_event_handles(peer, events, ARRAYSIZE(events) - 1);
+
+		if (count == 0)
+			break;
+
+		events[count++] = stopEvent;
+
+		if (WaitForMultipleObjects(count, events, FALSE, PF_REACTOR_POLL_INTERVAL) ==
+		    WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitForMultipleObjects failed");
+			break;
+		}
+
+		if (!pf_server_session_check(peer))
+			break;
+
+		if (WaitForSingleObject(stopEvent, 0) == WAIT_OBJECT_0)
+			break;
+
+		pf_reactor_session_start_back(session);
+		activated = peer->activated;
+	}
+
+	if (activated)
+	{
+		pf_reactor_session_post(session, PF_REACTOR_ATTACH_FRONT);
+		return;
+	}
+
+	pf_reactor_session_end_front(session);
+	pf_reactor_session_post(session, PF_REACTOR_CLOSE);
+}
+
+static void CALLBACK pf_reactor_back_work(PTP_CALLBACK_INSTANCE instance, void* context,
+                                          PTP_WORK work)
+{
+	pfReactorSession* session = (pfReactorSession*)context;
+	proxyData* pdata;
+
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	WINPR_ASSERT(session);
+
+	pdata = pf_reactor_session_data(session);
+	WINPR_ASSERT(pdata);
+
+	if (pf_client_session_start(pdata->pc))
+		InterlockedExchange(&session->back_connected, 1);
+	else
+		proxy_data_abort_connect(pdata);
+
+	pf_reactor_session_post(session, PF_REACTOR_ATTACH_BACK);
+}
+
+BOOL pf_reactor_add_peer(proxyReactor* reactor, freerdp_peer* peer)
+{
+	size_t index;
+	pfReactorSession* session;
+
+	WINPR_ASSERT(reactor);
+	WINPR_ASSERT(peer);
+
+	session = calloc(1, sizeof(pfReactorSession));
+	if (!session)
+		return FALSE;
+
+	session->reactor = reactor;
+	session->peer = peer;
+	session->front.session = session;
+	session->back.session = session;
+
+	index = (size_t)InterlockedIncrement(&reactor->next) % reactor->workerCount;
+	session->worker = &reactor->workers[index];
+
+	session->front_work =
+	    CreateThreadpoolWork(pf_reactor_front_work, session, &reactor->environment);
+	session->back_work = CreateThreadpoolWork(pf_reactor_back_work, session, &reactor->environment);
+
+	if (!session->front_work || !session->back_work)
+		goto fail;
+
+	ArrayList_Lock(reactor->sessions);
+
+	if (!ArrayList_Append(reactor->sessions, session))
+	{
+		ArrayList_Unlock(reactor->sessions);
+		goto fail;
+	}
+
+	ResetEvent(reactor->idle);
+	ArrayList_Unlock(reactor->sessions);
+
+	/* one reference for the session, one for the front work */
+	session->refs = 2;
+	SubmitThreadpoolWork(session->front_work);
+	return TRUE;
+
+fail:
+	if (session->front_work)
+		CloseThreadpoolWork(session->front_work);
+	if (session->back_work)
+		CloseThreadpoolWork(session->back_work);
+	free(session);
+	return FALSE;
+}
+
+static BOOL pf_reactor_worker_init(proxyReactor* reactor, pfReactorWorker* worker)
+{
+	HANDLE event;
+
+	worker->reactor = reactor;
+	worker->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (worker->epfd < 0)
+	{
+		WLog_ERR(TAG, "epoll_create1 failed with %s [%d]", strerror(errno), errno);
+		return FALSE;
+	}
+
+	worker->queue = MessageQueue_New(NULL);
+	worker->sessions = ArrayList_New(FALSE);
+	worker->release = ArrayList_New(FALSE);
+
+	if (!worker->queue || !worker->sessions || !worker->release)
+		return FALSE;
+
+	event = MessageQueue_Event(worker->queue);
+	if (!pf_reactor_source_update(worker, &worker->queueSource, &event, 1))
+		return FALSE;
+
+	event = reactor->server->stopEvent;
+	if (!pf_reactor_source_update(worker, &worker->stopSource, &event, 1))
+		return FALSE;
+
+	worker->lastPoll = GetTickCount64();
+	worker->thread = CreateThread(NULL, 0, pf_reactor_worker_thread, worker, 0, NULL);
+	return worker->thread != NULL;
+}
+
+static void pf_reactor_worker_stop(pfReactorWorker* worker)
+{
+	if (!worker->thread)
+		return;
+
+	MessageQueue_PostQuit(worker->queue, 0);
+	WaitForSingleObject(worker->thread, INFINITE);
+	CloseHandle(worker->thread);
+	worker->thread = NULL;
+}
+
+static void pf_reactor_worker_uninit(pfReactorWorker* worker)
+{
+	pf_reactor_worker_stop(worker);
+
+	if (worker->epfd >= 0)
+		close(worker->epfd);
+
+	MessageQueue_Free(worker->queue);
+	ArrayList_Free(worker->sessions);
+	ArrayList_Free(worker->release);
+}
+
+proxyReactor* pf_reactor_new(proxyServer* server)
+{
+	size_t x;
+	UINT32 connectThreads;
+	proxyReactor* reactor;
+	const proxyConfig* config;
+
+	WINPR_ASSERT(server);
+
+	config = server->config;
+	WINPR_ASSERT(config);
+
+	reactor = calloc(1, sizeof(proxyReactor));
+	if (!reactor)
+		return NULL;
+
+	reactor->server = server;
+	reactor->workerCount = config->ReactorThreads;
+
+	if (reactor->workerCount == 0)
+	{
+		SYSTEM_INFO sysInfos;
+		GetNativeSystemInfo(&sysInfos);
+		reactor->workerCount = MAX(1, sysInfos.dwNumberOfProcessors);
+	}
+
+	connectThreads = config->ReactorConnectThreads;
+	if (connectThreads == 0)
+		connectThreads = PF_REACTOR_DEFAULT_CONNECT_THREADS;
+
+	reactor->sessions = ArrayList_New(TRUE);
+	if (!reactor->sessions)
+		goto fail;
+
+	reactor->idle = CreateEvent(NULL, TRUE, TRUE, NULL);
+	if (!reactor->idle)
+		goto fail;
+
+	reactor->pool = CreateThreadpool(NULL);
+	if (!reactor->pool)
+		goto fail;
+
+	InitializeThreadpoolEnvironment(&reactor->environment);
+	SetThreadpoolCallbackPool(&reactor->environment, reactor->pool);
+
+	if (!SetThreadpoolThreadMinimum(reactor->pool, connectThreads))
+		goto fail;
+
+	SetThreadpoolThreadMaximum(reactor->pool, connectThreads);
+
+	reactor->workers = calloc(reactor->workerCount, sizeof(pfReactorWorker));
+	if (!reactor->workers)
+		goto fail;
+
+	for (x = 0; x < reactor->workerCount; x++)
+		reactor->workers[x].epfd = -1;
+
+	for (x = 0; x < reactor->workerCount; x++)
+	{
+		if (!pf_reactor_worker_init(reactor, &reactor->workers[x]))
+			goto fail;
+	}
+
+	WLog_INFO(TAG, "reactor mode with %" PRIuz " workers and %" PRIu32 " connect threads",
+	          reactor->workerCount, connectThreads);
+	return reactor;
+
+fail:
+	WLog_ERR(TAG, "failed to create the session reactor");
+	pf_reactor_free(reactor);
+	return NULL;
+}
+
+/**
+ * Closes the sessions that did not end on the server stop event. A connect work blocked in
+ * the TLS or NLA accept of the front end or in the connection to the target returns once
+ * the connection is aborted and the socket of the peer is shut down.
+ */
+static void pf_reactor_close_sessions(proxyReactor* reactor)
+{
+	size_t x;
+
+	ArrayList_Lock(reactor->sessions);
+	WLog_WARN(TAG, "%" PRIuz " sessions did not end within %" PRIu32 "ms, closing them",
+	          ArrayList_Count(reactor->sessions), PF_REACTOR_SHUTDOWN_TIMEOUT);
+
+	for (x = 0; x < ArrayList_Count(reactor->sessions); x++)
+	{
+		pfReactorSession* session = ArrayList_GetItem(reactor->sessions, x);
+		proxyData* pdata = pf_reactor_session_data(session);
+
+		if (pdata)
+			proxy_data_abort_connect(pdata);
+
+		if (!session->front_ended && (session->peer->sockfd >= 0))
+			shutdown(session->peer->sockfd, SHUT_RDWR);
+	}
+
+	ArrayList_Unlock(reactor->sessions);
+}
+
+/* Frees the sessions left once the workers stopped, no message refers to them any more */
+static void pf_reactor_free_sessions(proxyReactor* reactor)
+{
+	pfReactorSession* session;
+
+	while ((session = ArrayList_GetItem(reactor->sessions, 0)))
+	{
+		WLog_WARN(TAG, "freeing session with %" PRId32 " references", session->refs);
+		pf_reactor_session_free(session);
+	}
+}
+
+void pf_reactor_free(proxyReactor* reactor)
+{
+	size_t x;
+
+	if (!reactor)
+		return;
+
+	/* sessions end on the server stop event, their connect work and messages have to finish */
+	if (reactor->idle &&
+	    (WaitForSingleObject(reactor->idle, PF_REACTOR_SHUTDOWN_TIMEOUT) != WAIT_OBJECT_0))
+	{
+		pf_reactor_close_sessions(reactor);
+		WaitForSingleObject(reactor->idle, PF_REACTOR_SHUTDOWN_TIMEOUT);
+	}
+
+	if (reactor->workers)
+	{
+		for (x = 0; x < reactor->workerCount; x++)
+			pf_reactor_worker_stop(&reactor->workers[x]);
+	}
+
+	if (reactor->sessions)
+		pf_reactor_free_sessions(reactor);
+
+	if (reactor->workers)
+	{
+		for (x = 0; x < reactor->workerCount; x++)
+			pf_reactor_worker_uninit(&reactor->workers[x]);
+	}
+
+	free(reactor->workers);
+
+	if (reactor->pool)
+	{
+		CloseThreadpool(reactor->pool);
+		DestroyThreadpoolEnvironment(&reactor->environment);
+	}
+
+	ArrayList_Free(reactor->sessions);
+
+	if (reactor->idle)
+		CloseHandle(reactor->idle);
+
+	free(reactor);
+}
@@ -0,0 +1,47 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ * FreeRDP Proxy Server Session Reactor
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_PROXY_PFREACTOR_H
+#define FREERDP_SERVER_PROXY_PFREACTOR_H
+
+#include <freerdp/peer.h>
+#include <freerdp/server/proxy/proxy_server.h>
+
+#include "pf_server.h"
+
+/**
+ * The reactor runs established sessions on a fixed set of worker threads, each waiting on
+ * the handles of all its sessions with a single epoll instance.
+ *
+ * The TLS/NLA accept of the front end and the connection to the target block, so a session
+ * is first driven by a pool of connect threads. The front end is handed to its worker once
+ * it is activated, the back end once the target is connected.
+ */
+proxyReactor* pf_reactor_new(proxyServer* server);
+
+/**
+ * Waits for all sessions to end and stops the workers. The server stop event must be set.
+ * Sessions still running after a timeout are closed.
+ */
+void pf_reactor_free(proxyReactor* reactor);
+
+/**
+ * Starts a session for an accepted peer. On failure the caller still owns the peer.
+ */
+BOOL pf_reactor_add_peer(proxyReactor* reactor, freerdp_peer* peer);
+
+#endif /* FREERDP_SERVER_PROXY_PFREACTOR_H */
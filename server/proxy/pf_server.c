@@ -55,6 +55,10 @@
 #include "channels/pf_channel_drdynvc.h"
 #include "channels/pf_channel_rdpdr.h"
 
+#if defined(WITH_PROXY_REACTOR)
+#include "pf_reactor.h"
+#endif
+
 #define TAG PROXY_TAG("server")
 
 typedef struct
@@ -271,12 +275,16 @@ static BOOL pf_server_post_connect(freerdp_peer* peer)
 	rdpSettings* client_settings;
 	proxyData* pdata;
 	rdpSettings* frontSettings;
+	proxyServer* server;
 
 	WINPR_ASSERT(peer);
 
 	ps = (pServerContext*)peer->context;
 	WINPR_ASSERT(ps);
 
+	server = (proxyServer*)peer->ContextExtra;
+	WINPR_ASSERT(server);
+
 	frontSettings = peer->context->settings;
 	WINPR_ASSERT(frontSettings);
 
@@ -314,6 +322,10 @@ static BOOL pf_server_post_connect(freerdp_peer* peer)
 	if (!pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_POST_CONNECT, pdata, peer))
 		return FALSE;
 
+	/* The reactor connects the target from its own pool once this callback returned */
+	if (server->reactor)
+		return TRUE;
+
 	/* Start a proxy's client in it's own thread */
 	if (!(pdata->client_thread = CreateThread(NULL, 0, pf_client_start, pc, 0, NULL)))
 	{
@@ -345,6 +357,8 @@ static BOOL pf_server_activate(freerdp_peer* peer)
 	if (!pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_ACTIVATE, pdata, peer))
 		return FALSE;
 
+	pf_server_check_raw_updates(ps);
+
 	return TRUE;
 }
 
@@ -480,6 +494,8 @@ static BOOL pf_server_initialize_peer_connection(freerdp_peer* peer)
 		return FALSE;
 	if (!freerdp_settings_set_bool(settings, FreeRDP_SupportGraphicsPipeline, config->GFX))
 		return FALSE;
+	if (!freerdp_settings_set_bool(settings, FreeRDP_FastCompression, config->FastCompression))
+		return FALSE;
 
 	if (pf_utils_is_passthrough(config))
 	{
@@ -547,26 +563,13 @@ static BOOL pf_server_initialize_peer_connection(freerdp_peer* peer)
 	return TRUE;
 }
 
-/**
- * Handles an incoming client connection, to be run in it's own thread.
- *
- * arg is a pointer to a freerdp_peer representing the client.
- */
-static DWORD WINAPI pf_server_handle_peer(LPVOID arg)
+BOOL pf_server_session_start(freerdp_peer* client)
 {
-	HANDLE eventHandles[MAXIMUM_WAIT_OBJECTS] = { 0 };
-	DWORD tmp;
-	DWORD status;
-	pServerContext* ps = NULL;
-	proxyData* pdata = NULL;
-	freerdp_peer* client;
+	pServerContext* ps;
+	proxyData* pdata;
 	proxyServer* server;
 	size_t count;
-	peer_thread_args* args = arg;
 
-	WINPR_ASSERT(args);
-
-	client = args->client;
 	WINPR_ASSERT(client);
 
 	server = (proxyServer*)client->ContextExtra;
@@ -575,10 +578,10 @@ static DWORD WINAPI pf_server_handle_peer(LPVOID arg)
 	count = ArrayList_Count(server->peer_list);
 
 	if (!pf_context_init_server_context(client))
-		goto out_free_peer;
+		return FALSE;
 
 	if (!pf_server_initialize_peer_connection(client))
-		goto out_free_peer;
+		return FALSE;
 
 	ps = (pServerContext*)client->context;
 	WINPR_ASSERT(ps);
@@ -596,96 +599,123 @@ static DWORD WINAPI pf_server_handle_peer(LPVOID arg)
 	               pdata->config->Host, client->hostname);
 
 	pf_modules_run_hook(pdata->module, HOOK_TYPE_SERVER_SESSION_STARTED, pdata, client);
+	return TRUE;
+}
 
-	while (1)
+DWORD pf_server_session_get_event_handles(freerdp_peer* client, HANDLE* events, DWORD count)
+{
+	DWORD eventCount;
+	HANDLE ChannelEvent;
+	pServerContext* ps;
+	proxyData* pdata;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(events);
+
+	ps = (pServerContext*)client->context;
+	WINPR_ASSERT(ps);
+
+	pdata = ps->pdata;
+	WINPR_ASSERT(pdata);
+
+	if (count < 3)
+		return 0;
+
+	WINPR_ASSERT(client->GetEventHandles);
+	eventCount = client->GetEventHandles(client, events, count - 2);
+
+	if (eventCount == 0)
 	{
-		HANDLE ChannelEvent = INVALID_HANDLE_VALUE;
-		DWORD eventCount = 0;
-		{
-			WINPR_ASSERT(client->GetEventHandles);
-			tmp = client->GetEventHandles(client, &eventHandles[eventCount],
-			                              ARRAYSIZE(eventHandles) - eventCount);
+		WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
+		return 0;
+	}
 
-			if (tmp == 0)
-			{
-				WLog_ERR(TAG, "Failed to get FreeRDP transport event handles");
-				break;
-			}
+	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
 
-			eventCount += tmp;
-		}
-		/* Main client event handling loop */
-		ChannelEvent = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
+	WINPR_ASSERT(ChannelEvent && (ChannelEvent != INVALID_HANDLE_VALUE));
+	WINPR_ASSERT(pdata->abort_event && (pdata->abort_event != INVALID_HANDLE_VALUE));
+	events[eventCount++] = ChannelEvent;
+	events[eventCount++] = pdata->abort_event;
+	return eventCount;
+}
 
-		WINPR_ASSERT(ChannelEvent && (ChannelEvent != INVALID_HANDLE_VALUE));
-		WINPR_ASSERT(pdata->abort_event && (pdata->abort_event != INVALID_HANDLE_VALUE));
-		eventHandles[eventCount++] = ChannelEvent;
-		eventHandles[eventCount++] = pdata->abort_event;
-		eventHandles[eventCount++] = server->stopEvent;
+BOOL pf_server_session_check(freerdp_peer* client)
+{
+	HANDLE ChannelEvent;
+	pServerContext* ps;
+	proxyData* pdata;
 
-		status = WaitForMultipleObjects(eventCount, eventHandles, FALSE,
-		                                1000); /* Do periodic polling to avoid client hang */
+	WINPR_ASSERT(client);
 
-		if (status == WAIT_FAILED)
+	ps = (pServerContext*)client->context;
+	WINPR_ASSERT(ps);
+
+	pdata = ps->pdata;
+	WINPR_ASSERT(pdata);
+
+	WINPR_ASSERT(client->CheckFileDescriptor);
+	if (client->CheckFileDescriptor(client) != TRUE)
+		return FALSE;
+
+	ChannelEvent = WTSVirtualChannelManagerGetEventHandle(ps->vcm);
+
+	if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
+	{
+		if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
 		{
-			WLog_ERR(TAG, "WaitForMultipleObjects failed (status: %d)", status);
-			break;
+			WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
+			return FALSE;
 		}
+	}
 
-		WINPR_ASSERT(client->CheckFileDescriptor);
-		if (client->CheckFileDescriptor(client) != TRUE)
-			break;
+	/* only disconnect after checking client's and vcm's file descriptors  */
+	if (proxy_data_shall_disconnect(pdata))
+	{
+		WLog_INFO(TAG, "abort event is set, closing connection with peer %s", client->hostname);
+		return FALSE;
+	}
 
-		if (WaitForSingleObject(ChannelEvent, 0) == WAIT_OBJECT_0)
-		{
+	switch (WTSVirtualChannelManagerGetDrdynvcState(ps->vcm))
+	{
+		/* Dynamic channel status may have been changed after processing */
+		case DRDYNVC_STATE_NONE:
+
+			/* Initialize drdynvc channel */
 			if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
 			{
-				WLog_ERR(TAG, "WTSVirtualChannelManagerCheckFileDescriptor failure");
-				goto fail;
+				WLog_ERR(TAG, "Failed to initialize drdynvc channel");
+				return FALSE;
 			}
-		}
 
-		/* only disconnect after checking client's and vcm's file descriptors  */
-		if (proxy_data_shall_disconnect(pdata))
-		{
-			WLog_INFO(TAG, "abort event is set, closing connection with peer %s", client->hostname);
 			break;
-		}
 
-		if (WaitForSingleObject(server->stopEvent, 0) == WAIT_OBJECT_0)
-		{
-			WLog_INFO(TAG, "Server shutting down, terminating peer");
-			break;
-		}
+		case DRDYNVC_STATE_READY:
+			if (WaitForSingleObject(ps->dynvcReady, 0) == WAIT_TIMEOUT)
+			{
+				SetEvent(ps->dynvcReady);
+			}
 
-		switch (WTSVirtualChannelManagerGetDrdynvcState(ps->vcm))
-		{
-			/* Dynamic channel status may have been changed after processing */
-			case DRDYNVC_STATE_NONE:
+			break;
 
-				/* Initialize drdynvc channel */
-				if (!WTSVirtualChannelManagerCheckFileDescriptor(ps->vcm))
-				{
-					WLog_ERR(TAG, "Failed to initialize drdynvc channel");
-					goto fail;
-				}
+		default:
+			break;
+	}
 
-				break;
+	return TRUE;
+}
 
-			case DRDYNVC_STATE_READY:
-				if (WaitForSingleObject(ps->dynvcReady, 0) == WAIT_TIMEOUT)
-				{
-					SetEvent(ps->dynvcReady);
-				}
+void pf_server_session_end(freerdp_peer* client)
+{
+	pServerContext* ps;
+	proxyData* pdata;
 
-				break;
+	WINPR_ASSERT(client);
 
-			default:
-				break;
-		}
-	}
+	ps = (pServerContext*)client->context;
+	WINPR_ASSERT(ps);
 
-fail:
+	pdata = ps->pdata;
+	WINPR_ASSERT(pdata);
 
 	PROXY_LOG_INFO(TAG, ps, "starting shutdown of connection");
 	PROXY_LOG_INFO(TAG, ps, "stopping proxy's client");
@@ -702,10 +732,93 @@ fail:
 
 	WINPR_ASSERT(client->Disconnect);
 	client->Disconnect(client);
+}
+
+void pf_server_session_free(freerdp_peer* client)
+{
+	pServerContext* ps;
+	proxyData* pdata = NULL;
+
+	WINPR_ASSERT(client);
+
+	ps = (pServerContext*)client->context;
+	if (ps)
+		pdata = ps->pdata;
 
-out_free_peer:
 	PROXY_LOG_INFO(TAG, ps, "freeing proxy data");
 
+	freerdp_peer_context_free(client);
+	freerdp_peer_free(client);
+	proxy_data_free(pdata);
+
+#if defined(WITH_DEBUG_EVENTS)
+	DumpEventHandles();
+#endif
+}
+
+/**
+ * Handles an incoming client connection, to be run in it's own thread.
+ *
+ * arg is a pointer to a freerdp_peer representing the client.
+ */
+static DWORD WINAPI pf_server_handle_peer(LPVOID arg)
+{
+	HANDLE eventHandles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+	DWORD status;
+	pServerContext* ps = NULL;
+	proxyData* pdata = NULL;
+	freerdp_peer* client;
+	proxyServer* server;
+	size_t count;
+	peer_thread_args* args = arg;
+
+	WINPR_ASSERT(args);
+
+	client = args->client;
+	WINPR_ASSERT(client);
+
+	server = (proxyServer*)client->ContextExtra;
+	WINPR_ASSERT(server);
+
+	if (!pf_server_session_start(client))
+		goto out_free_peer;
+
+	ps = (pServerContext*)client->context;
+	pdata = ps->pdata;
+
+	while (1)
+	{
+		DWORD eventCount = pf_server_session_get_event_handles(client, eventHandles,
+		                                                       ARRAYSIZE(eventHandles) - 1);
+
+		if (eventCount == 0)
+			break;
+
+		/* Main client event handling loop */
+		eventHandles[eventCount++] = server->stopEvent;
+
+		status = WaitForMultipleObjects(eventCount, eventHandles, FALSE,
+		                                1000); /* Do periodic polling to avoid client hang */
+
+		if (status == WAIT_FAILED)
+		{
+			WLog_ERR(TAG, "WaitForMultipleObjects failed (status: %d)", status);
+			break;
+		}
+
+		if (!pf_server_session_check(client))
+			break;
+
+		if (WaitForSingleObject(server->stopEvent, 0) == WAIT_OBJECT_0)
+		{
+			WLog_INFO(TAG, "Server shutting down, terminating peer");
+			break;
+		}
+	}
+
+	pf_server_session_end(client);
+
+out_free_peer:
 	if (pdata && pdata->client_thread)
 	{
 		proxy_data_abort_connect(pdata);
@@ -719,13 +832,7 @@ out_free_peer:
 		ArrayList_Unlock(server->peer_list);
 	}
 	PROXY_LOG_DBG(TAG, ps, "Removed peer, %" PRIuz " connected", count);
-	freerdp_peer_context_free(client);
-	freerdp_peer_free(client);
-	proxy_data_free(pdata);
-
-#if defined(WITH_DEBUG_EVENTS)
-	DumpEventHandles();
-#endif
+	pf_server_session_free(client);
 	free(args);
 	ExitThread(0);
 	return 0;
@@ -735,16 +842,24 @@ static BOOL pf_server_start_peer(freerdp_peer* client)
 {
 	HANDLE hThread;
 	proxyServer* server;
-	peer_thread_args* args = calloc(1, sizeof(peer_thread_args));
-	if (!args)
-		return FALSE;
+	peer_thread_args* args;
 
 	WINPR_ASSERT(client);
-	args->client = client;
 
 	server = (proxyServer*)client->ContextExtra;
 	WINPR_ASSERT(server);
 
+#if defined(WITH_PROXY_REACTOR)
+	if (server->reactor)
+		return pf_reactor_add_peer(server->reactor, client);
+#endif
+
+	args = calloc(1, sizeof(peer_thread_args));
+	if (!args)
+		return FALSE;
+
+	args->client = client;
+
 	hThread = CreateThread(NULL, 0, pf_server_handle_peer, args, CREATE_SUSPENDED, NULL);
 	if (!hThread)
 		return FALSE;
@@ -949,6 +1064,17 @@ proxyServer* pf_server_new(const proxyConfig* config)
 
 	obj->fnObjectFree = peer_free;
 
+	if (server->config->Reactor)
+	{
+#if defined(WITH_PROXY_REACTOR)
+		server->reactor = pf_reactor_new(server);
+		if (!server->reactor)
+			goto out;
+#else
+		WLog_WARN(TAG, "reactor mode is not supported on this platform, using threads");
+#endif
+	}
+
 	server->listener->info = server;
 	server->listener->PeerAccepted = pf_server_peer_accepted;
 
@@ -1045,6 +1171,9 @@ void pf_server_free(proxyServer* server)
 		 */
 		Sleep(100);
 	}
+#if defined(WITH_PROXY_REACTOR)
+	pf_reactor_free(server->reactor);
+#endif
 	ArrayList_Free(server->peer_list);
 	freerdp_listener_free(server->listener);
 
@@ -30,6 +30,8 @@
 #include <freerdp/server/proxy/proxy_config.h>
 #include "proxy_modules.h"
 
+typedef struct pf_reactor proxyReactor;
+
 struct proxy_server
 {
 	proxyModule* module;
@@ -38,6 +40,14 @@ struct proxy_server
 	freerdp_listener* listener;
 	HANDLE stopEvent; /* an event used to signal the main thread to stop */
 	wArrayList* peer_list;
+	proxyReactor* reactor; /* multiplexes the sessions in reactor mode, NULL otherwise */
 };
 
+/* Steps of a front end session, shared by the per peer threads and the reactor */
+BOOL pf_server_session_start(freerdp_peer* client);
+DWORD pf_server_session_get_event_handles(freerdp_peer* client, HANDLE* events, DWORD count);
+BOOL pf_server_session_check(freerdp_peer* client);
+void pf_server_session_end(freerdp_peer* client);
+void pf_server_session_free(freerdp_peer* client);
+
 #endif /* INT_FREERDP_SERVER_PROXY_SERVER_H */
@@ -25,6 +25,7 @@
 #include <freerdp/session.h>
 #include <winpr/assert.h>
 #include <winpr/image.h>
+#include <winpr/interlocked.h>
 #include <winpr/sysinfo.h>
 
 #include <freerdp/server/proxy/proxy_log.h>
@@ -63,6 +64,21 @@ static BOOL pf_server_suppress_output(rdpContext* context, BYTE allow, const REC
 
 /* Proxy from PC to PS */
 
+static BOOL pf_client_fastpath_update(rdpContext* context, BYTE updateCode, wStream* s)
+{
+	pClientContext* pc = (pClientContext*)context;
+	proxyData* pdata;
+	rdpContext* ps;
+	WINPR_ASSERT(pc);
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+	ps = (rdpContext*)pdata->ps;
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(ps->update);
+	WINPR_ASSERT(ps->update->FastPathUpdate);
+	return ps->update->FastPathUpdate(ps, updateCode, s);
+}
+
 /**
  * This function is called whenever a new frame starts.
  * It can be used to reset invalidated areas.
@@ -80,6 +96,14 @@ static BOOL pf_client_begin_paint(rdpContext* context)
 	WINPR_ASSERT(ps->update);
 	WINPR_ASSERT(ps->update->BeginPaint);
 	WLog_DBG(TAG, __FUNCTION__);
+
+	/* the decision is made on the server side, switch over between two fast-path PDUs */
+	WINPR_ASSERT(context->update);
+	if (InterlockedCompareExchange(&pc->raw_updates, 0, 0))
+		context->update->FastPathUpdate = pf_client_fastpath_update;
+	else
+		context->update->FastPathUpdate = NULL;
+
 	return ps->update->BeginPaint(ps);
 }
 
@@ -129,6 +153,38 @@ static BOOL pf_client_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bi
 	return ps->update->BitmapUpdate(ps, bitmap);
 }
 
+static BOOL pf_client_surface_bits(rdpContext* context, const SURFACE_BITS_COMMAND* cmd)
+{
+	pClientContext* pc = (pClientContext*)context;
+	proxyData* pdata;
+	rdpContext* ps;
+	WINPR_ASSERT(pc);
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+	ps = (rdpContext*)pdata->ps;
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(ps->update);
+	WINPR_ASSERT(ps->update->SurfaceBits);
+	WLog_DBG(TAG, __FUNCTION__);
+	return ps->update->SurfaceBits(ps, cmd);
+}
+
+static BOOL pf_client_surface_frame_marker(rdpContext* context, const SURFACE_FRAME_MARKER* marker)
+{
+	pClientContext* pc = (pClientContext*)context;
+	proxyData* pdata;
+	rdpContext* ps;
+	WINPR_ASSERT(pc);
+	pdata = pc->pdata;
+	WINPR_ASSERT(pdata);
+	ps = (rdpContext*)pdata->ps;
+	WINPR_ASSERT(ps);
+	WINPR_ASSERT(ps->update);
+	WINPR_ASSERT(ps->update->SurfaceFrameMarker);
+	WLog_DBG(TAG, __FUNCTION__);
+	return ps->update->SurfaceFrameMarker(ps, marker);
+}
+
 static BOOL pf_client_desktop_resize(rdpContext* context)
 {
 	pClientContext* pc = (pClientContext*)context;
@@ -144,6 +200,9 @@ static BOOL pf_client_desktop_resize(rdpContext* context)
 	WINPR_ASSERT(context->settings);
 	WINPR_ASSERT(ps->settings);
 	WLog_DBG(TAG, __FUNCTION__);
+
+	/* the peer is reactivated, decode until its capabilities have been checked again */
+	InterlockedExchange(&pc->raw_updates, 0);
 	ps->settings->DesktopWidth = context->settings->DesktopWidth;
 	ps->settings->DesktopHeight = context->settings->DesktopHeight;
 	return ps->update->DesktopResize(ps);
@@ -598,6 +657,8 @@ void pf_client_register_update_callbacks(rdpUpdate* update)
 	update->BeginPaint = pf_client_begin_paint;
 	update->EndPaint = pf_client_end_paint;
 	update->BitmapUpdate = pf_client_bitmap_update;
+	update->SurfaceBits = pf_client_surface_bits;
+	update->SurfaceFrameMarker = pf_client_surface_frame_marker;
 	update->DesktopResize = pf_client_desktop_resize;
 	update->RemoteMonitors = pf_client_remote_monitors;
 	update->SaveSessionInfo = pf_client_save_session_info;
@@ -625,3 +686,75 @@ void pf_client_register_update_callbacks(rdpUpdate* update)
 	update->pointer->PointerNew = pf_client_send_pointer_new;
 	update->pointer->PointerCached = pf_client_send_pointer_cached;
 }
+
+/**
+ * Checks if the peer accepts everything the target may send on the fast-path, so the updates
+ * can be forwarded as they are.
+ */
+static BOOL pf_update_raw_compatible(const rdpSettings* front, const rdpSettings* back)
+{
+	size_t x;
+
+	WINPR_ASSERT(front);
+	WINPR_ASSERT(back);
+
+	if (!front->FastPathOutput || !back->FastPathOutput)
+		return FALSE;
+
+	if ((front->ColorDepth != back->ColorDepth) || (front->DesktopWidth != back->DesktopWidth) ||
+	    (front->DesktopHeight != back->DesktopHeight))
+		return FALSE;
+
+	if (front->MultifragMaxRequestSize < back->MultifragMaxRequestSize)
+		return FALSE;
+
+	/* the proxy disables drawing orders, glyph and bitmap caches are not kept in sync */
+	for (x = 0; x < 32; x++)
+	{
+		if (back->OrderSupport[x])
+			return FALSE;
+	}
+
+	if (back->SurfaceCommandsEnabled && !front->SurfaceCommandsEnabled)
+		return FALSE;
+	if (back->SurfaceFrameMarkerEnabled && !front->SurfaceFrameMarkerEnabled)
+		return FALSE;
+	if (back->FrameMarkerCommandEnabled && !front->FrameMarkerCommandEnabled)
+		return FALSE;
+
+	if (back->RemoteFxCodec &&
+	    (!front->RemoteFxCodec || (front->RemoteFxCodecId != back->RemoteFxCodecId)))
+		return FALSE;
+	if (back->NSCodec && (!front->NSCodec || (front->NSCodecId != back->NSCodecId)))
+		return FALSE;
+
+	if ((back->LargePointerFlag & ~front->LargePointerFlag) != 0)
+		return FALSE;
+	if (front->PointerCacheSize < back->PointerCacheSize)
+		return FALSE;
+
+	return TRUE;
+}
+
+void pf_server_check_raw_updates(pServerContext* ps)
+{
+	proxyData* pdata;
+	pClientContext* pc;
+	BOOL raw;
+
+	WINPR_ASSERT(ps);
+	pdata = ps->pdata;
+	WINPR_ASSERT(pdata);
+	WINPR_ASSERT(pdata->config);
+
+	/* the peer is reactivated once the target is connected */
+	pc = pdata->pc;
+	if (!pc || !pc->connected)
+		return;
+
+	raw = pdata->config->RawPassthrough && !pf_modules_has_paint_hook(pdata->module) &&
+	      pf_update_raw_compatible(ps->context.settings, pc->context.settings);
+
+	InterlockedExchange(&pc->raw_updates, raw ? 1 : 0);
+	PROXY_LOG_INFO(TAG, ps, "fast-path updates are %s", raw ? "forwarded raw" : "decoded");
+}
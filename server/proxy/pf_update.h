@@ -31,4 +31,10 @@
 void pf_server_register_update_callbacks(rdpUpdate* update);
 void pf_client_register_update_callbacks(rdpUpdate* update);
 
+/**
+ * Decides if the fast-path updates of the target are forwarded to the peer without decoding
+ * them. Must be called whenever the peer has been (re)activated.
+ */
+void pf_server_check_raw_updates(pServerContext* ps);
+
 #endif /* FREERDP_SERVER_PROXY_PFUPDATE_H */
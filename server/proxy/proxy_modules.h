@@ -79,6 +79,12 @@ extern "C"
 	BOOL pf_modules_add(proxyModule* module, proxyModuleEntryPoint ep, void* userdata);
 
 	BOOL pf_modules_is_plugin_loaded(proxyModule* module, const char* plugin_name);
+
+	/**
+	 * @brief pf_modules_has_paint_hook Checks if a plugin looks at the painted frames
+	 * @return TRUE if any loaded plugin registered a HOOK_TYPE_CLIENT_END_PAINT hook
+	 */
+	BOOL pf_modules_has_paint_hook(proxyModule* module);
 	void pf_modules_list_loaded_plugins(proxyModule* module);
 
 	BOOL pf_modules_run_filter(proxyModule* module, PF_FILTER_TYPE type, proxyData* pdata,
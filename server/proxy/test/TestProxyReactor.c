@@ -0,0 +1,474 @@
+#include <stdio.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <winpr/crt.h>
+#include <winpr/path.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/crypto.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/freerdp.h>
+#include <freerdp/listener.h>
+#include <freerdp/client/cmdline.h>
+#include <freerdp/server/proxy/proxy_config.h>
+#include <freerdp/server/proxy/proxy_server.h>
+
+#define TEST_BITMAP_SIZE 16
+
+typedef struct
+{
+	char* cert;
+	char* key;
+	HANDLE stopEvent;
+	freerdp_listener* listener;
+	volatile LONG sessions; /* sessions of the target still running */
+} test_target;
+
+static volatile LONG s_updates = 0;
+
+static char* concatenate(size_t count, ...)
+{
+	size_t x;
+	char* rc;
+	va_list ap;
+	va_start(ap, count);
+	rc = _strdup(va_arg(ap, char*));
+	for (x = 1; x < count; x++)
+	{
+		const char* cur = va_arg(ap, const char*);
+		char* tmp = GetCombinedPath(rc, cur);
+		free(rc);
+		rc = tmp;
+	}
+	va_end(ap);
+	return rc;
+}
+
+static BOOL prepare_certificates(const char* path)
+{
+	BOOL rc = FALSE;
+	STARTUPINFOA si = { 0 };
+	PROCESS_INFORMATION process = { 0 };
+	char commandLine[8192] = { 0 };
+	char* exe = concatenate(5, TESTING_OUTPUT_DIRECTORY, "winpr", "tools", "makecert-cli",
+	                        "winpr-makecert");
+
+	if (!exe)
+		return FALSE;
+
+	si.cb = sizeof(si);
+	_snprintf(commandLine, sizeof(commandLine), "%s -format crt -path . -n server", exe);
+	rc = CreateProcessA(exe, commandLine, NULL, NULL, FALSE, 0, NULL, path, &si, &process);
+	free(exe);
+
+	if (!rc)
+		return FALSE;
+
+	rc = WaitForSingleObject(process.hProcess, 30000) == WAIT_OBJECT_0;
+	CloseHandle(process.hProcess);
+	CloseHandle(process.hThread);
+	return rc;
+}
+
+/* The target draws an uncompressed bitmap, the proxy relays it to the client */
+static BOOL test_target_draw(freerdp_peer* peer)
+{
+	BYTE data[TEST_BITMAP_SIZE * TEST_BITMAP_SIZE * 4];
+	BITMAP_DATA rectangle = { 0 };
+	BITMAP_UPDATE bitmap = { 0 };
+	rdpUpdate* update = peer->context->update;
+
+	memset(data, 0x80, sizeof(data));
+	rectangle.destRight = TEST_BITMAP_SIZE - 1;
+	rectangle.destBottom = TEST_BITMAP_SIZE - 1;
+	rectangle.width = TEST_BITMAP_SIZE;
+	rectangle.height = TEST_BITMAP_SIZE;
+	rectangle.bitsPerPixel = 32;
+	rectangle.bitmapLength = sizeof(data);
+	rectangle.bitmapDataStream = data;
+	bitmap.number = 1;
+	bitmap.rectangles = &rectangle;
+
+	return update->BeginPaint(peer->context) && update->BitmapUpdate(peer->context, &bitmap) &&
+	       update->EndPaint(peer->context);
+}
+
+/* The target runs no channels, their data is dropped */
+static BOOL test_target_channel_data(freerdp_peer* peer, UINT16 channelId, const BYTE* data,
+                                     size_t size, UINT32 flags, size_t totalSize)
+{
+	WINPR_UNUSED(peer);
+	WINPR_UNUSED(channelId);
+	WINPR_UNUSED(data);
+	WINPR_UNUSED(size);
+	WINPR_UNUSED(flags);
+	WINPR_UNUSED(totalSize);
+	return TRUE;
+}
+
+static BOOL test_target_activate(freerdp_peer* peer)
+{
+	WINPR_UNUSED(peer);
+	return TRUE;
+}
+
+static DWORD WINAPI test_target_peer_thread(LPVOID arg)
+{
+	freerdp_peer* peer = (freerdp_peer*)arg;
+	test_target* target = (test_target*)peer->ContextExtra;
+	rdpSettings* settings;
+
+	peer->ContextSize = sizeof(rdpContext);
+
+	if (!freerdp_peer_context_new(peer))
+		goto fail;
+
+	settings = peer->context->settings;
+
+	if (!freerdp_settings_set_string(settings, FreeRDP_CertificateFile, target->cert) ||
+	    !freerdp_settings_set_string(settings, FreeRDP_PrivateKeyFile, target->key) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_RdpSecurity, FALSE) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_TlsSecurity, TRUE) ||
+	    !freerdp_settings_set_bool(settings, FreeRDP_NlaSecurity, FALSE) ||
+	    !freerdp_settings_set_uint32(settings, FreeRDP_ColorDepth, 32))
+		goto fail;
+
+	peer->context->update->autoCalculateBitmapData = FALSE;
+	peer->ReceiveChannelData = test_target_channel_data;
+	peer->PostConnect = test_target_activate;
+	peer->Activate = test_target_activate;
+
+	if (!peer->Initialize(peer))
+		goto fail;
+
+	while (WaitForSingleObject(target->stopEvent, 0) != WAIT_OBJECT_0)
+	{
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+		const DWORD count = peer->GetEventHandles(peer, handles, ARRAYSIZE(handles));
+
+		if ((count == 0) || (WaitForMultipleObjects(count, handles, FALSE, 100) == WAIT_FAILED))
+			break;
+
+		if (!peer->CheckFileDescriptor(peer))
+			break;
+
+		/* the client sees the bitmap once the proxy activated both sides */
+		if (peer->activated && !test_target_draw(peer))
+			break;
+	}
+
+	peer->Disconnect(peer);
+fail:
+	freerdp_peer_context_free(peer);
+	freerdp_peer_free(peer);
+	InterlockedDecrement(&target->sessions);
+	return 0;
+}
+
+static BOOL test_target_peer_accepted(freerdp_listener* listener, freerdp_peer* peer)
+{
+	HANDLE thread;
+	test_target* target = (test_target*)listener->info;
+
+	peer->ContextExtra = target;
+	InterlockedIncrement(&target->sessions);
+
+	if (!(thread = CreateThread(NULL, 0, test_target_peer_thread, peer, 0, NULL)))
+	{
+		InterlockedDecrement(&target->sessions);
+		return FALSE;
+	}
+
+	CloseHandle(thread);
+	return TRUE;
+}
+
+static DWORD WINAPI test_target_thread(LPVOID arg)
+{
+	test_target* target = (test_target*)arg;
+	freerdp_listener* listener = target->listener;
+
+	while (WaitForSingleObject(target->stopEvent, 0) != WAIT_OBJECT_0)
+	{
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+		const DWORD count = listener->GetEventHandles(listener, handles, ARRAYSIZE(handles));
+
+		if ((count == 0) || (WaitForMultipleObjects(count, handles, FALSE, 100) == WAIT_FAILED))
+			break;
+
+		if (!listener->CheckFileDescriptor(listener))
+			break;
+	}
+
+	listener->Close(listener);
+	return 0;
+}
+
+static BOOL test_client_bitmap_update(rdpContext* context, const BITMAP_UPDATE* bitmap)
+{
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(bitmap);
+	InterlockedIncrement(&s_updates);
+	return TRUE;
+}
+
+static BOOL test_client_post_connect(freerdp* instance)
+{
+	instance->context->update->BitmapUpdate = test_client_bitmap_update;
+	return TRUE;
+}
+
+/* Connects through the proxy and waits for the updates of the target */
+static BOOL test_client(int port)
+{
+	BOOL rc = FALSE;
+	char arg1[32] = { 0 };
+	char* argv[] = { "test", arg1, "/cert-ignore", "-sec-nla" };
+	RDP_CLIENT_ENTRY_POINTS clientEntryPoints = { 0 };
+	rdpContext* context;
+	UINT64 end;
+
+	_snprintf(arg1, sizeof(arg1), "/v:127.0.0.1:%d", port);
+	clientEntryPoints.Size = sizeof(RDP_CLIENT_ENTRY_POINTS);
+	clientEntryPoints.Version = RDP_CLIENT_INTERFACE_VERSION;
+	clientEntryPoints.ContextSize = sizeof(rdpContext);
+	context = freerdp_client_context_new(&clientEntryPoints);
+
+	if (!context)
+		return FALSE;
+
+	context->instance->PostConnect = test_client_post_connect;
+
+	if (freerdp_client_settings_parse_command_line(context->settings, ARRAYSIZE(argv), argv,
+	                                               FALSE) < 0)
+		goto fail;
+
+	if (!freerdp_connect(context->instance))
+	{
+		fprintf(stderr, "[%s] connecting through the proxy failed\n", __FUNCTION__);
+		goto fail;
+	}
+
+	end = GetTickCount64() + 10000;
+
+	while ((InterlockedCompareExchange(&s_updates, 0, 0) == 0) && (GetTickCount64() < end))
+	{
+		HANDLE handles[MAXIMUM_WAIT_OBJECTS] = { 0 };
+		const DWORD count = freerdp_get_event_handles(context, handles, ARRAYSIZE(handles));
+
+		if ((count == 0) || (WaitForMultipleObjects(count, handles, FALSE, 100) == WAIT_FAILED))
+			break;
+
+		if (!freerdp_check_event_handles(context))
+			break;
+	}
+
+	rc = InterlockedCompareExchange(&s_updates, 0, 0) > 0;
+
+	if (!rc)
+		fprintf(stderr, "[%s] no update of the target was relayed\n", __FUNCTION__);
+
+	if (!freerdp_disconnect(context->instance))
+		rc = FALSE;
+
+fail:
+	freerdp_client_context_free(context);
+	return rc;
+}
+
+/* Requests TLS and stops answering, the proxy blocks in the TLS accept of the session */
+static int test_stalled_client(int port)
+{
+	const BYTE request[] = { 0x03, 0x00, 0x00, 0x13, 0x0e, 0xe0, 0x00, 0x00, 0x00, 0x00,
+		                     0x00, 0x01, 0x00, 0x08, 0x00, 0x01, 0x00, 0x00, 0x00 };
+	struct sockaddr_in addr = { 0 };
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (fd < 0)
+		return -1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((UINT16)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if ((connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) ||
+	    (send(fd, request, sizeof(request), 0) != sizeof(request)))
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Waits for the sessions of the target to end, the proxy closed its side */
+static BOOL test_target_idle(test_target* target, DWORD timeout)
+{
+	const UINT64 end = GetTickCount64() + timeout;
+
+	while (InterlockedCompareExchange(&target->sessions, 0, 0) > 0)
+	{
+		if (GetTickCount64() > end)
+			return FALSE;
+
+		Sleep(10);
+	}
+
+	return TRUE;
+}
+
+static DWORD WINAPI test_proxy_thread(LPVOID arg)
+{
+	proxyServer* server = (proxyServer*)arg;
+	return pf_server_run(server) ? 0 : 1;
+}
+
+static proxyServer* test_proxy_new(const test_target* target, int port, int targetPort)
+{
+	char buffer[4096] = { 0 };
+	proxyConfig* config;
+	proxyServer* server;
+
+	_snprintf(buffer, sizeof(buffer),
+	          "[Server]\nHost=127.0.0.1\nPort=%d\nReactor=true\nReactorThreads=2\n"
+	          "ReactorConnectThreads=2\n"
+	          "[Target]\nFixedTarget=true\nHost=127.0.0.1\nPort=%d\n"
+	          "[Channels]\nGFX=false\n"
+	          "[Security]\nServerNlaSecurity=false\nClientNlaSecurity=false\n"
+	          "[Certificates]\nCertificateFile=%s\nPrivateKeyFile=%s\n",
+	          port, targetPort, target->cert, target->key);
+
+	if (!(config = pf_server_config_load_buffer(buffer)))
+		return NULL;
+
+	/* the server keeps a copy of the configuration */
+	server = pf_server_new(config);
+	pf_server_config_free(config);
+
+	if (server && !pf_server_start(server))
+	{
+		pf_server_free(server);
+		return NULL;
+	}
+
+	return server;
+}
+
+static int test_reactor(test_target* target, int port, int targetPort)
+{
+	int rc = -1;
+	int stalled = -1;
+	UINT64 start;
+	HANDLE thread;
+	proxyServer* server = test_proxy_new(target, port, targetPort);
+
+	if (!server)
+		return -1;
+
+	if (!(thread = CreateThread(NULL, 0, test_proxy_thread, server, 0, NULL)))
+	{
+		pf_server_free(server);
+		return -1;
+	}
+
+	/* accept, relay the connection and the updates, the disconnect ends the target session */
+	if (!test_client(port))
+		goto fail;
+
+	if (!test_target_idle(target, 10000))
+	{
+		fprintf(stderr, "[%s] the proxy did not end the target session\n", __FUNCTION__);
+		goto fail;
+	}
+
+	if ((stalled = test_stalled_client(port)) < 0)
+		goto fail;
+
+	Sleep(500); /* let the proxy accept the stalled connection */
+	rc = 0;
+fail:
+	/* the sessions end on the stop event, the stalled one is closed after a timeout */
+	start = GetTickCount64();
+	pf_server_stop(server);
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	pf_server_free(server);
+
+	if (GetTickCount64() - start > 20000)
+	{
+		fprintf(stderr, "[%s] stopping the proxy took %" PRIu64 "ms\n", __FUNCTION__,
+		        GetTickCount64() - start);
+		rc = -1;
+	}
+
+	if (stalled >= 0)
+		close(stalled);
+
+	return rc;
+}
+
+int TestProxyReactor(int argc, char* argv[])
+{
+	int rc = -1;
+	int random = 0;
+	int port;
+	HANDLE thread = NULL;
+	test_target target = { 0 };
+	char* path = concatenate(4, TESTING_OUTPUT_DIRECTORY, "server", "proxy", "test");
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!path || !prepare_certificates(path))
+		goto fail;
+
+	target.cert = GetCombinedPath(path, "server.crt");
+	target.key = GetCombinedPath(path, "server.key");
+	target.stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	target.listener = freerdp_listener_new();
+
+	if (!target.cert || !target.key || !target.stopEvent || !target.listener)
+		goto fail;
+
+	winpr_RAND((BYTE*)&random, sizeof(random));
+	port = 4389 + (int)((UINT32)random % 200);
+	target.listener->info = &target;
+	target.listener->PeerAccepted = test_target_peer_accepted;
+
+	/* the target listens on the port, the proxy 200 ports above */
+	if (!target.listener->Open(target.listener, "127.0.0.1", (UINT16)port))
+		goto fail;
+
+	if (!(thread = CreateThread(NULL, 0, test_target_thread, &target, 0, NULL)))
+		goto fail;
+
+	rc = test_reactor(&target, port + 200, port);
+fail:
+	if (target.stopEvent)
+		SetEvent(target.stopEvent);
+
+	if (thread)
+	{
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+	}
+
+	if (!test_target_idle(&target, 10000))
+		rc = -1;
+
+	freerdp_listener_free(target.listener);
+
+	if (target.stopEvent)
+		CloseHandle(target.stopEvent);
+
+	free(target.cert);
+	free(target.key);
+	free(path);
+	return rc;
+}
@@ -576,6 +576,28 @@ static int x11_shadow_handle_xevent(x11ShadowSubsystem* subsystem, XEvent* xeven
 		x11_shadow_query_cursor(subsystem, TRUE);
 	}
 
+#endif
+#ifdef WITH_XDAMAGE
+	else if (subsystem->use_xdamage && (xevent->type == subsystem->xdamage_notify_event))
+	{
+		const XDamageNotifyEvent* notify = (const XDamageNotifyEvent*)xevent;
+		rdpShadowSurface* surface = subsystem->common.server->surface;
+		const INT64 left = MAX(0, (INT64)notify->area.x - surface->x);
+		const INT64 top = MAX(0, (INT64)notify->area.y - surface->y);
+		const INT64 right = (INT64)notify->area.x + notify->area.width - surface->x;
+		const INT64 bottom = (INT64)notify->area.y + notify->area.height - surface->y;
+
+		if ((right > left) && (bottom > top))
+		{
+			const RECTANGLE_16 rect = { (UINT16)left, (UINT16)top,
+				                        (UINT16)MIN(right, UINT16_MAX),
+				                        (UINT16)MIN(bottom, UINT16_MAX) };
+
+			if (!shadow_subsystem_damage_add(&subsystem->common, &rect))
+				shadow_subsystem_damage_invalidate(&subsystem->common);
+		}
+	}
+
 #endif
 	else
 	{
@@ -719,6 +741,7 @@ static BOOL x11_shadow_check_resize(x11ShadowSubsystem* subsystem)
 		/* Screen size changed. Refresh monitor definitions and trigger screen resize */
 		subsystem->common.numMonitors = x11_shadow_enum_monitors(subsystem->common.monitors, 16);
 		shadow_screen_resize(subsystem->common.server->screen);
+		shadow_subsystem_damage_invalidate(&subsystem->common);
 		subsystem->width = attr.width;
 		subsystem->height = attr.height;
 
@@ -749,19 +772,65 @@ static int x11_shadow_error_handler_for_capture(Display* display, XErrorEvent* e
 	return 0;
 }
 
+#if defined(WITH_XDAMAGE)
+/* Turns the pending XDamage notifications into damage hints for the next capture */
+static void x11_shadow_collect_damage(x11ShadowSubsystem* subsystem)
+{
+	XEvent xevent;
+
+	if (!subsystem->use_xdamage)
+		return;
+
+	/* Changes after this point raise new notifications, earlier ones are queued by the sync */
+	XDamageSubtract(subsystem->display, subsystem->xdamage, None, None);
+	XSync(subsystem->display, False);
+
+	while (XEventsQueued(subsystem->display, QueuedAlready))
+	{
+		XNextEvent(subsystem->display, &xevent);
+		x11_shadow_handle_xevent(subsystem, &xevent);
+	}
+}
+#endif
+
+static BOOL x11_shadow_translate_region(REGION16* dst, const REGION16* src, INT32 dx, INT32 dy)
+{
+	UINT32 nbRects = 0;
+	const RECTANGLE_16* rects = region16_rects(src, &nbRects);
+
+	region16_clear(dst);
+
+	for (UINT32 index = 0; index < nbRects; index++)
+	{
+		const RECTANGLE_16 rect = { (UINT16)(rects[index].left + dx),
+			                        (UINT16)(rects[index].top + dy),
+			                        (UINT16)(rects[index].right + dx),
+			                        (UINT16)(rects[index].bottom + dy) };
+
+		if (!region16_union_rect(dst, dst, &rect))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 {
 	int rc = 0;
 	size_t count;
+	int hinted;
 	int status = -1;
-	int x, y;
-	int width, height;
-	XImage* image;
+	XImage* image = NULL;
+	const BYTE* pImage = NULL;
+	UINT32 nImageStep = 0;
+	UINT32 bpp;
 	rdpShadowServer* server;
 	rdpShadowSurface* surface;
-	RECTANGLE_16 invalidRect;
+	REGION16 damage;
+	REGION16 hints;
+	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
-	const RECTANGLE_16* extents;
+	RECTANGLE_16 grabRect;
 	server = subsystem->common.server;
 	surface = server->surface;
 	count = ArrayList_Count(server->clients);
@@ -769,13 +838,41 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	if (count < 1)
 		return 1;
 
+	region16_init(&damage);
+	region16_init(&hints);
+	region16_init(&invalidRegion);
+
 	EnterCriticalSection(&surface->lock);
 	surfaceRect.left = 0;
 	surfaceRect.top = 0;
 	surfaceRect.right = surface->width;
 	surfaceRect.bottom = surface->height;
+	bpp = FreeRDPGetBytesPerPixel(surface->format);
 	LeaveCriticalSection(&surface->lock);
 
+#if defined(WITH_XDAMAGE)
+	XLockDisplay(subsystem->display);
+	x11_shadow_collect_damage(subsystem);
+	XUnlockDisplay(subsystem->display);
+#endif
+
+	/* With trusted hints only the damaged area is fetched and compared */
+	grabRect = surfaceRect;
+	hinted = shadow_subsystem_damage_take(&subsystem->common, &damage);
+
+	if (hinted > 0)
+	{
+		region16_intersect_rect(&damage, &damage, &surfaceRect);
+
+		if (region16_is_empty(&damage))
+		{
+			rc = 1;
+			goto fail_capture;
+		}
+
+		grabRect = *region16_extents(&damage);
+	}
+
 	XLockDisplay(subsystem->display);
 	/*
 	 * Ignore BadMatch error during image capture. The screen size may be
@@ -787,28 +884,22 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	{
 		image = subsystem->fb_image;
 		XCopyArea(subsystem->display, subsystem->root_window, subsystem->fb_pixmap,
-		          subsystem->xshm_gc, 0, 0, subsystem->width, subsystem->height, 0, 0);
+		          subsystem->xshm_gc, grabRect.left, grabRect.top,
+		          grabRect.right - grabRect.left, grabRect.bottom - grabRect.top, grabRect.left,
+		          grabRect.top);
 
-		EnterCriticalSection(&surface->lock);
-		status = shadow_capture_compare(surface->data, surface->scanline, surface->width,
-		                                surface->height, (BYTE*)&(image->data[surface->width * 4]),
-		                                image->bytes_per_line, &invalidRect);
-		LeaveCriticalSection(&surface->lock);
+		/* The shared image always holds the full screen */
+		grabRect = surfaceRect;
+		pImage = (const BYTE*)&(image->data[surface->width * 4]);
 	}
 	else
 #endif
 	{
-		EnterCriticalSection(&surface->lock);
-		image = XGetImage(subsystem->display, subsystem->root_window, surface->x, surface->y,
-		                  surface->width, surface->height, AllPlanes, ZPixmap);
+		image = XGetImage(subsystem->display, subsystem->root_window,
+		                  surface->x + grabRect.left, surface->y + grabRect.top,
+		                  grabRect.right - grabRect.left, grabRect.bottom - grabRect.top, AllPlanes,
+		                  ZPixmap);
 
-		if (image)
-		{
-			status = shadow_capture_compare(surface->data, surface->scanline, surface->width,
-			                                surface->height, (BYTE*)image->data,
-			                                image->bytes_per_line, &invalidRect);
-		}
-		LeaveCriticalSection(&surface->lock);
 		if (!image)
 		{
 			/*
@@ -817,6 +908,33 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 			 */
 			goto fail_capture;
 		}
+
+		pImage = (const BYTE*)image->data;
+	}
+
+	WINPR_ASSERT(image->bytes_per_line >= 0);
+	nImageStep = (UINT32)image->bytes_per_line;
+
+	if ((hinted > 0) && (subsystem->common.damageMode == SHADOW_DAMAGE_EXACT))
+	{
+		status = region16_copy(&invalidRegion, &damage) ? 1 : -1;
+	}
+	else if (x11_shadow_translate_region(&hints, &damage, -grabRect.left, -grabRect.top))
+	{
+		REGION16 changed;
+		region16_init(&changed);
+		EnterCriticalSection(&surface->lock);
+		status = shadow_capture_compare_region(
+		    server->capture, &surface->data[grabRect.top * surface->scanline + grabRect.left * bpp],
+		    surface->scanline, grabRect.right - grabRect.left, grabRect.bottom - grabRect.top,
+		    pImage, nImageStep, (hinted > 0) ? &hints : NULL, &changed);
+		LeaveCriticalSection(&surface->lock);
+
+		if ((status > 0) &&
+		    !x11_shadow_translate_region(&invalidRegion, &changed, grabRect.left, grabRect.top))
+			status = -1;
+
+		region16_uninit(&changed);
 	}
 
 	/* Restore the default error handler */
@@ -824,32 +942,38 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 	XSync(subsystem->display, False);
 	XUnlockDisplay(subsystem->display);
 
-	if (status)
+	if (status > 0)
 	{
 		BOOL empty;
+		UINT32 nbRects = 0;
+		const RECTANGLE_16* rects = region16_rects(&invalidRegion, &nbRects);
 		EnterCriticalSection(&surface->lock);
-		region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
+
+		for (UINT32 index = 0; index < nbRects; index++)
+			region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion),
+			                    &rects[index]);
+
 		region16_intersect_rect(&(surface->invalidRegion), &(surface->invalidRegion), &surfaceRect);
 		empty = region16_is_empty(&(surface->invalidRegion));
 		LeaveCriticalSection(&surface->lock);
 
 		if (!empty)
 		{
-			BOOL success;
+			BOOL success = TRUE;
 			EnterCriticalSection(&surface->lock);
-			extents = region16_extents(&(surface->invalidRegion));
-			x = extents->left;
-			y = extents->top;
-			width = extents->right - extents->left;
-			height = extents->bottom - extents->top;
-			WINPR_ASSERT(image);
-			WINPR_ASSERT(image->bytes_per_line >= 0);
-			WINPR_ASSERT(width >= 0);
-			WINPR_ASSERT(height >= 0);
-			success = freerdp_image_copy(surface->data, surface->format, surface->scanline, x, y,
-			                             (UINT32)width, (UINT32)height, (BYTE*)image->data,
-			                             PIXEL_FORMAT_BGRX32, (UINT32)image->bytes_per_line, x, y,
-			                             NULL, FREERDP_FLIP_NONE);
+			rects = region16_rects(&(surface->invalidRegion), &nbRects);
+
+			/* Only the changed tiles are copied, not their bounding rectangle */
+			for (UINT32 index = 0; success && (index < nbRects); index++)
+			{
+				const RECTANGLE_16* rect = &rects[index];
+				success = freerdp_image_copy(
+				    surface->data, surface->format, surface->scanline, rect->left, rect->top,
+				    rect->right - rect->left, rect->bottom - rect->top, (BYTE*)image->data,
+				    PIXEL_FORMAT_BGRX32, nImageStep, rect->left - grabRect.left,
+				    rect->top - grabRect.top, NULL, FREERDP_FLIP_NONE);
+			}
+
 			LeaveCriticalSection(&surface->lock);
 			if (!success)
 				goto fail_capture;
@@ -876,6 +1000,10 @@ static int x11_shadow_screen_grab(x11ShadowSubsystem* subsystem)
 
 	rc = 1;
 fail_capture:
+	region16_uninit(&damage);
+	region16_uninit(&hints);
+	region16_uninit(&invalidRegion);
+
 	if (!subsystem->use_xshm && image)
 		XDestroyImage(image);
 
@@ -1365,6 +1493,9 @@ static int x11_shadow_subsystem_init(rdpShadowSubsystem* sub)
 			subsystem->use_xdamage = FALSE;
 	}
 
+	/* XDamage reports drawn areas, the pixels in there might still be unchanged */
+	subsystem->common.damageMode = subsystem->use_xdamage ? SHADOW_DAMAGE_HINT : SHADOW_DAMAGE_NONE;
+
 	if (!(subsystem->common.event =
 	          CreateFileDescriptorEvent(NULL, FALSE, FALSE, subsystem->xfds, WINPR_FD_READ)))
 		return -1;
@@ -1470,7 +1601,7 @@ static rdpShadowSubsystem* x11_shadow_subsystem_new(void)
 	subsystem->composite = FALSE;
 	subsystem->use_xshm = FALSE; /* temporarily disabled */
 	subsystem->use_xfixes = TRUE;
-	subsystem->use_xdamage = FALSE;
+	subsystem->use_xdamage = TRUE;
 	subsystem->use_xinerama = TRUE;
 	return (rdpShadowSubsystem*)subsystem;
 }
@@ -26,6 +26,8 @@
 #include "shadow_screen.h"
 #include "shadow_surface.h"
 #include "shadow_encoder.h"
+#include "shadow_encode_cache.h"
+#include "shadow_frame.h"
 #include "shadow_capture.h"
 #include "shadow_channels.h"
 #include "shadow_subsystem.h"
@@ -19,7 +19,9 @@
 #include <freerdp/config.h>
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
 #include <winpr/print.h>
+#include <winpr/sysinfo.h>
 
 #include <freerdp/log.h>
 
@@ -27,8 +29,28 @@
 
 #include "shadow_capture.h"
 
+#if defined(WITH_SSE2) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#include <emmintrin.h>
+#define SHADOW_CAPTURE_SSE2
+#elif defined(WITH_NEON) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SHADOW_CAPTURE_NEON
+#endif
+
 #define TAG SERVER_TAG("shadow")
 
+#define SHADOW_CAPTURE_TILE_SIZE 16
+
+/* Tile rows per band before comparing in parallel is worth a thread pool callback */
+#define SHADOW_CAPTURE_BAND_ROWS 16
+
+enum
+{
+	SHADOW_CAPTURE_TILE_SKIP = 0,
+	SHADOW_CAPTURE_TILE_CHECK = 1,
+	SHADOW_CAPTURE_TILE_DIRTY = 2
+};
+
 int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 {
 	int dx, dy;
@@ -77,154 +99,391 @@ int shadow_capture_align_clip_rect(RECTANGLE_16* rect, RECTANGLE_16* clip)
 	return 1;
 }
 
-int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
-                           UINT32 nStep2, RECTANGLE_16* rect)
+static INLINE BOOL shadow_capture_line_equal(const BYTE* p1, const BYTE* p2, size_t length)
 {
-	BOOL equal;
-	BOOL allEqual;
-	UINT32 tw, th;
-	UINT32 tx, ty, k;
-	UINT32 nrow, ncol;
-	UINT32 l, t, r, b;
-	BYTE *p1, *p2;
-	BOOL rows[1024];
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	BOOL cols[1024];
-#endif
-	allEqual = TRUE;
-	ZeroMemory(rect, sizeof(RECTANGLE_16));
-	FillMemory(rows, sizeof(rows), 0xFF);
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-	FillMemory(cols, sizeof(cols), 0xFF);
+#if defined(SHADOW_CAPTURE_SSE2)
+	while (length >= 64)
+	{
+		const __m128i a0 = _mm_loadu_si128((const __m128i*)&p1[0]);
+		const __m128i a1 = _mm_loadu_si128((const __m128i*)&p1[16]);
+		const __m128i a2 = _mm_loadu_si128((const __m128i*)&p1[32]);
+		const __m128i a3 = _mm_loadu_si128((const __m128i*)&p1[48]);
+		const __m128i b0 = _mm_loadu_si128((const __m128i*)&p2[0]);
+		const __m128i b1 = _mm_loadu_si128((const __m128i*)&p2[16]);
+		const __m128i b2 = _mm_loadu_si128((const __m128i*)&p2[32]);
+		const __m128i b3 = _mm_loadu_si128((const __m128i*)&p2[48]);
+		const __m128i e01 = _mm_and_si128(_mm_cmpeq_epi8(a0, b0), _mm_cmpeq_epi8(a1, b1));
+		const __m128i e23 = _mm_and_si128(_mm_cmpeq_epi8(a2, b2), _mm_cmpeq_epi8(a3, b3));
+
+		if (_mm_movemask_epi8(_mm_and_si128(e01, e23)) != 0xFFFF)
+			return FALSE;
+
+		p1 += 64;
+		p2 += 64;
+		length -= 64;
+	}
+
+	while (length >= 16)
+	{
+		const __m128i a = _mm_loadu_si128((const __m128i*)p1);
+		const __m128i b = _mm_loadu_si128((const __m128i*)p2);
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF)
+			return FALSE;
+
+		p1 += 16;
+		p2 += 16;
+		length -= 16;
+	}
+#elif defined(SHADOW_CAPTURE_NEON)
+	while (length >= 16)
+	{
+		const uint8x16_t eq = vceqq_u8(vld1q_u8(p1), vld1q_u8(p2));
+		const uint64x2_t v = vreinterpretq_u64_u8(eq);
+
+		if ((vgetq_lane_u64(v, 0) & vgetq_lane_u64(v, 1)) != UINT64_MAX)
+			return FALSE;
+
+		p1 += 16;
+		p2 += 16;
+		length -= 16;
+	}
 #endif
-	nrow = (nHeight + 15) / 16;
-	ncol = (nWidth + 15) / 16;
-	l = ncol + 1;
-	r = 0;
-	t = nrow + 1;
-	b = 0;
 
-	for (ty = 0; ty < nrow; ty++)
+	return (length == 0) || (memcmp(p1, p2, length) == 0);
+}
+
+/**
+ * Compares the tile rows [first, last) line by line, so both frames are read
+ * sequentially. A tile is skipped as soon as one of its lines differs.
+ */
+static void shadow_capture_compare_band(SHADOW_CAPTURE_GRID* grid, UINT32 first, UINT32 last)
+{
+	WINPR_ASSERT(grid);
+
+	for (UINT32 ty = first; ty < last; ty++)
 	{
-		th = ((ty + 1) == nrow) ? (nHeight % 16) : 16;
+		BYTE* tiles = &grid->tiles[1ull * ty * grid->ncol];
+		const UINT32 y = ty * SHADOW_CAPTURE_TILE_SIZE;
+		const UINT32 th = MIN(SHADOW_CAPTURE_TILE_SIZE, grid->nHeight - y);
+		UINT32 pending = 0;
 
-		if (!th)
-			th = 16;
+		for (UINT32 tx = 0; tx < grid->ncol; tx++)
+		{
+			if (tiles[tx] == SHADOW_CAPTURE_TILE_CHECK)
+				pending++;
+		}
 
-		for (tx = 0; tx < ncol; tx++)
+		for (UINT32 k = 0; (k < th) && (pending > 0); k++)
 		{
-			equal = TRUE;
-			tw = ((tx + 1) == ncol) ? (nWidth % 16) : 16;
+			const BYTE* p1 = &grid->pData1[1ull * (y + k) * grid->nStep1];
+			const BYTE* p2 = &grid->pData2[1ull * (y + k) * grid->nStep2];
 
-			if (!tw)
-				tw = 16;
+			for (UINT32 tx = 0; tx < grid->ncol; tx++)
+			{
+				const UINT32 x = tx * SHADOW_CAPTURE_TILE_SIZE;
+				const UINT32 tw = MIN(SHADOW_CAPTURE_TILE_SIZE, grid->nWidth - x);
 
-			p1 = &pData1[(ty * 16 * nStep1) + (tx * 16 * 4)];
-			p2 = &pData2[(ty * 16 * nStep2) + (tx * 16 * 4)];
+				if (tiles[tx] != SHADOW_CAPTURE_TILE_CHECK)
+					continue;
 
-			for (k = 0; k < th; k++)
-			{
-				if (memcmp(p1, p2, tw * 4) != 0)
+				if (!shadow_capture_line_equal(&p1[x * 4ull], &p2[x * 4ull], tw * 4ull))
 				{
-					equal = FALSE;
-					break;
+					tiles[tx] = SHADOW_CAPTURE_TILE_DIRTY;
+					pending--;
 				}
-
-				p1 += nStep1;
-				p2 += nStep2;
 			}
+		}
+	}
+}
+
+static void CALLBACK shadow_capture_compare_work_callback(PTP_CALLBACK_INSTANCE instance,
+                                                          void* context, PTP_WORK work)
+{
+	SHADOW_CAPTURE_BAND* band = (SHADOW_CAPTURE_BAND*)context;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	WINPR_ASSERT(band);
+	shadow_capture_compare_band(band->grid, band->first, band->last);
+}
+
+static UINT32 shadow_capture_band_count(const rdpShadowCapture* capture, UINT32 nrow)
+{
+	UINT32 count = nrow / SHADOW_CAPTURE_BAND_ROWS;
+
+	if (!capture)
+		return 1;
+
+	/* One band per work object plus the one compared by the calling thread */
+	if (count > capture->workCount + 1)
+		count = capture->workCount + 1;
 
-			if (!equal)
+	return MAX(count, 1);
+}
+
+static void shadow_capture_compare_grid(rdpShadowCapture* capture, SHADOW_CAPTURE_GRID* grid)
+{
+	UINT32 count;
+	SHADOW_CAPTURE_BAND* bands;
+
+	WINPR_ASSERT(grid);
+	count = shadow_capture_band_count(capture, grid->nrow);
+
+	if (count <= 1)
+	{
+		shadow_capture_compare_band(grid, 0, grid->nrow);
+		return;
+	}
+
+	bands = capture->bands;
+
+	for (UINT32 i = 0; i < count; i++)
+	{
+		bands[i].grid = grid;
+		bands[i].first = (UINT32)((1ull * grid->nrow * i) / count);
+		bands[i].last = (UINT32)((1ull * grid->nrow * (i + 1)) / count);
+	}
+
+	/* Band i + 1 belongs to work[i], the first band is compared by the calling thread */
+	winpr_SubmitThreadpoolWorkBatch(capture->work, count - 1);
+	shadow_capture_compare_band(grid, bands[0].first, bands[0].last);
+
+	for (UINT32 i = 0; i < count - 1; i++)
+		WaitForThreadpoolWorkCallbacks(capture->work[i], FALSE);
+}
+
+static BOOL shadow_capture_mark_hints(SHADOW_CAPTURE_GRID* grid, const REGION16* hints)
+{
+	UINT32 nbRects = 0;
+	const RECTANGLE_16* rects;
+
+	WINPR_ASSERT(grid);
+
+	if (!hints)
+	{
+		FillMemory(grid->tiles, 1ull * grid->ncol * grid->nrow, SHADOW_CAPTURE_TILE_CHECK);
+		return TRUE;
+	}
+
+	rects = region16_rects(hints, &nbRects);
+
+	for (UINT32 i = 0; i < nbRects; i++)
+	{
+		const RECTANGLE_16* rect = &rects[i];
+		const UINT32 right = MIN(rect->right, grid->nWidth);
+		const UINT32 bottom = MIN(rect->bottom, grid->nHeight);
+
+		if ((rect->left >= right) || (rect->top >= bottom))
+			continue;
+
+		for (UINT32 ty = rect->top / SHADOW_CAPTURE_TILE_SIZE;
+		     ty < (bottom + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE; ty++)
+		{
+			BYTE* tiles = &grid->tiles[1ull * ty * grid->ncol];
+			const UINT32 l = rect->left / SHADOW_CAPTURE_TILE_SIZE;
+			const UINT32 r = (right + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+			FillMemory(&tiles[l], r - l, SHADOW_CAPTURE_TILE_CHECK);
+		}
+	}
+
+	return nbRects > 0;
+}
+
+/**
+ * Turns the dirty tiles into rectangles: horizontal runs per tile row, and runs
+ * repeated on consecutive tile rows are merged before they are added to the region.
+ */
+static BOOL shadow_capture_build_region(const SHADOW_CAPTURE_GRID* grid, REGION16* region)
+{
+	BOOL rc = FALSE;
+	UINT32 count = 0;
+	UINT32 previous = 0;
+	RECTANGLE_16* runs = NULL;
+
+	WINPR_ASSERT(grid);
+	WINPR_ASSERT(region);
+
+	/* Runs of the previous and of the current tile row, at most ncol each */
+	runs = (RECTANGLE_16*)calloc(grid->ncol + 1, 2 * sizeof(RECTANGLE_16));
+
+	if (!runs)
+		return FALSE;
+
+	for (UINT32 ty = 0; ty <= grid->nrow; ty++)
+	{
+		RECTANGLE_16* current = &runs[grid->ncol + 1];
+		BOOL extend;
+		count = 0;
+
+		if (ty < grid->nrow)
+		{
+			const BYTE* tiles = &grid->tiles[1ull * ty * grid->ncol];
+
+			for (UINT32 tx = 0; tx < grid->ncol; tx++)
 			{
-				rows[ty] = FALSE;
-#ifdef WITH_DEBUG_SHADOW_CAPTURE
-				cols[tx] = FALSE;
-#endif
+				UINT32 end = tx;
 
-				if (l > tx)
-					l = tx;
+				if (tiles[tx] != SHADOW_CAPTURE_TILE_DIRTY)
+					continue;
 
-				if (r < tx)
-					r = tx;
+				while ((end < grid->ncol) && (tiles[end] == SHADOW_CAPTURE_TILE_DIRTY))
+					end++;
+
+				current[count].left = (UINT16)(tx * SHADOW_CAPTURE_TILE_SIZE);
+				current[count].right = (UINT16)MIN(end * SHADOW_CAPTURE_TILE_SIZE, grid->nWidth);
+				current[count].top = (UINT16)(ty * SHADOW_CAPTURE_TILE_SIZE);
+				current[count].bottom =
+				    (UINT16)MIN((ty + 1) * SHADOW_CAPTURE_TILE_SIZE, grid->nHeight);
+				count++;
+				tx = end;
 			}
 		}
 
-		if (!rows[ty])
+		extend = (count > 0) && (count == previous);
+
+		for (UINT32 i = 0; extend && (i < count); i++)
 		{
-			allEqual = FALSE;
+			if ((runs[i].left != current[i].left) || (runs[i].right != current[i].right))
+				extend = FALSE;
+		}
 
-			if (t > ty)
-				t = ty;
+		if (extend)
+		{
+			for (UINT32 i = 0; i < count; i++)
+				runs[i].bottom = current[i].bottom;
 
-			if (b < ty)
-				b = ty;
+			continue;
 		}
+
+		for (UINT32 i = 0; i < previous; i++)
+		{
+			if (!region16_union_rect(region, region, &runs[i]))
+				goto fail;
+		}
+
+		CopyMemory(runs, current, count * sizeof(RECTANGLE_16));
+		previous = count;
 	}
 
-	if (allEqual)
-		return 0;
+	rc = TRUE;
+fail:
+	free(runs);
+	return rc;
+}
 
-	WINPR_ASSERT(l * 16 <= UINT16_MAX);
-	WINPR_ASSERT(t * 16 <= UINT16_MAX);
-	WINPR_ASSERT((r + 1) * 16 <= UINT16_MAX);
-	WINPR_ASSERT((b + 1) * 16 <= UINT16_MAX);
-	rect->left = (UINT16)l * 16;
-	rect->top = (UINT16)t * 16;
-	rect->right = (UINT16)(r + 1) * 16;
-	rect->bottom = (UINT16)(b + 1) * 16;
+static int shadow_capture_compare_tiles(rdpShadowCapture* capture, SHADOW_CAPTURE_GRID* grid,
+                                        const REGION16* hints, REGION16* region)
+{
+	WINPR_ASSERT(grid);
+
+	if (!shadow_capture_mark_hints(grid, hints))
+		return 0;
 
-	WINPR_ASSERT(nWidth <= UINT16_MAX);
-	if (rect->right > nWidth)
-		rect->right = (UINT16)nWidth;
+	shadow_capture_compare_grid(capture, grid);
 
-	WINPR_ASSERT(nHeight <= UINT16_MAX);
-	if (rect->bottom > nHeight)
-		rect->bottom = (UINT16)nHeight;
+	if (!shadow_capture_build_region(grid, region))
+		return -1;
 
 #ifdef WITH_DEBUG_SHADOW_CAPTURE
-	size_t size = ncol + 1;
-	char* col_str = calloc(size, sizeof(char));
+	region16_print(region);
+#endif
+	return region16_is_empty(region) ? 0 : 1;
+}
 
-	if (!col_str)
-	{
-		WLog_ERR(TAG, "calloc failed!");
-		return 1;
-	}
+int shadow_capture_compare_region(rdpShadowCapture* capture, const BYTE* pData1, UINT32 nStep1,
+                                  UINT32 nWidth, UINT32 nHeight, const BYTE* pData2,
+                                  UINT32 nStep2, const REGION16* hints, REGION16* region)
+{
+	int status = -1;
+	size_t size;
+	SHADOW_CAPTURE_GRID local = { 0 };
+	SHADOW_CAPTURE_GRID* grid = &local;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	if (!pData1 || !pData2 || !region)
+		return -1;
 
-	WLog_INFO(TAG, "%s", col_str);
+	if ((nWidth > UINT16_MAX) || (nHeight > UINT16_MAX))
+		return -1;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+	region16_clear(region);
 
-	WLog_INFO(TAG, "%s", col_str);
+	if ((nWidth == 0) || (nHeight == 0))
+		return 0;
 
-	for (tx = 0; tx < ncol; tx++)
-		sprintf_s(&col_str[tx], size - tx, "-");
+	if (capture)
+	{
+		EnterCriticalSection(&capture->lock);
+		grid = &capture->grid;
+	}
 
-	WLog_INFO(TAG, "%s", col_str);
+	grid->pData1 = pData1;
+	grid->nStep1 = nStep1;
+	grid->pData2 = pData2;
+	grid->nStep2 = nStep2;
+	grid->nWidth = nWidth;
+	grid->nHeight = nHeight;
+	grid->ncol = (nWidth + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	grid->nrow = (nHeight + SHADOW_CAPTURE_TILE_SIZE - 1) / SHADOW_CAPTURE_TILE_SIZE;
+	size = 1ull * grid->ncol * grid->nrow;
 
-	for (ty = 0; ty < nrow; ty++)
+	if (!capture)
+		grid->tiles = (BYTE*)calloc(size, 1);
+	else if (capture->tilesSize < size)
 	{
-		for (tx = 0; tx < ncol; tx++)
-			sprintf_s(&col_str[tx], size - tx, "%c", cols[tx] ? 'O' : 'X');
+		BYTE* tiles = (BYTE*)realloc(grid->tiles, size);
 
-		WLog_INFO(TAG, "%s", col_str);
-		WLog_INFO(TAG, "|%s|", rows[ty] ? "O" : "X");
+		if (tiles)
+		{
+			grid->tiles = tiles;
+			capture->tilesSize = size;
+		}
+		else
+		{
+			free(grid->tiles);
+			grid->tiles = NULL;
+			capture->tilesSize = 0;
+		}
 	}
 
-	WLog_INFO(TAG, "left: %d top: %d right: %d bottom: %d ncol: %d nrow: %d", l, t, r, b, ncol,
-	          nrow);
-	free(col_str);
-#endif
-	return 1;
+	if (grid->tiles)
+	{
+		ZeroMemory(grid->tiles, size);
+		status = shadow_capture_compare_tiles(capture, grid, hints, region);
+	}
+
+	if (capture)
+		LeaveCriticalSection(&capture->lock);
+	else
+		free(grid->tiles);
+
+	return status;
+}
+
+int shadow_capture_compare(BYTE* pData1, UINT32 nStep1, UINT32 nWidth, UINT32 nHeight, BYTE* pData2,
+                           UINT32 nStep2, RECTANGLE_16* rect)
+{
+	int status;
+	REGION16 region;
+
+	WINPR_ASSERT(rect);
+	ZeroMemory(rect, sizeof(RECTANGLE_16));
+	region16_init(&region);
+	status = shadow_capture_compare_region(NULL, pData1, nStep1, nWidth, nHeight, pData2, nStep2,
+	                                       NULL, &region);
+
+	if (status > 0)
+		*rect = *region16_extents(&region);
+
+	region16_uninit(&region);
+	return status;
 }
 
 rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
 {
 	rdpShadowCapture* capture;
+	SYSTEM_INFO sysinfo = { 0 };
+	UINT32 count;
 	capture = (rdpShadowCapture*)calloc(1, sizeof(rdpShadowCapture));
 
 	if (!capture)
@@ -238,6 +497,21 @@ rdpShadowCapture* shadow_capture_new(rdpShadowServer* server)
 		return NULL;
 	}
 
+	GetNativeSystemInfo(&sysinfo);
+	count = MIN(MAX(sysinfo.dwNumberOfProcessors, 1), SHADOW_CAPTURE_MAX_BANDS);
+
+	/* Work i compares band i + 1, if a work object can not be created fewer bands are used */
+	for (UINT32 i = 0; i + 1 < count; i++)
+	{
+		SHADOW_CAPTURE_BAND* band = &capture->bands[i + 1];
+		capture->work[i] = CreateThreadpoolWork(shadow_capture_compare_work_callback, band, NULL);
+
+		if (!capture->work[i])
+			break;
+
+		capture->workCount++;
+	}
+
 	return capture;
 }
 
@@ -246,6 +520,10 @@ void shadow_capture_free(rdpShadowCapture* capture)
 	if (!capture)
 		return;
 
+	for (UINT32 i = 0; i < capture->workCount; i++)
+		CloseThreadpoolWork(capture->work[i]);
+
+	free(capture->grid.tiles);
 	DeleteCriticalSection(&(capture->lock));
 	free(capture);
 }
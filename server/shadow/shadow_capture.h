@@ -22,8 +22,31 @@
 #include <freerdp/server/shadow.h>
 
 #include <winpr/crt.h>
+#include <winpr/pool.h>
 #include <winpr/synch.h>
 
+#define SHADOW_CAPTURE_MAX_BANDS 16
+
+typedef struct
+{
+	const BYTE* pData1;
+	UINT32 nStep1;
+	const BYTE* pData2;
+	UINT32 nStep2;
+	UINT32 nWidth;
+	UINT32 nHeight;
+	UINT32 ncol;
+	UINT32 nrow;
+	BYTE* tiles;
+} SHADOW_CAPTURE_GRID;
+
+typedef struct
+{
+	SHADOW_CAPTURE_GRID* grid;
+	UINT32 first;
+	UINT32 last;
+} SHADOW_CAPTURE_BAND;
+
 struct rdp_shadow_capture
 {
 	rdpShadowServer* server;
@@ -32,18 +55,13 @@ struct rdp_shadow_capture
 	int height;
 
 	CRITICAL_SECTION lock;
-};
-
-#ifdef __cplusplus
-extern "C"
-{
-#endif
 
-	rdpShadowCapture* shadow_capture_new(rdpShadowServer* server);
-	void shadow_capture_free(rdpShadowCapture* capture);
-
-#ifdef __cplusplus
-}
-#endif
+	/* Compare state reused by every frame, guarded by lock */
+	SHADOW_CAPTURE_GRID grid;
+	size_t tilesSize;
+	UINT32 workCount;
+	SHADOW_CAPTURE_BAND bands[SHADOW_CAPTURE_MAX_BANDS];
+	PTP_WORK work[SHADOW_CAPTURE_MAX_BANDS];
+};
 
 #endif /* FREERDP_SERVER_SHADOW_CAPTURE_H */
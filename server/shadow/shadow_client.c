@@ -36,6 +36,13 @@
 
 #define TAG CLIENT_TAG("shadow")
 
+/* Published frames waiting for the encoder, older ones are dropped */
+#define SHADOW_CLIENT_ENCODE_QUEUE_DEPTH 2
+/* Frames sent without acknowledgement before the next frame is held back */
+#define SHADOW_CLIENT_MAX_INFLIGHT_FRAMES 3
+/* Longest time a pending frame is held back for a client not acknowledging frames */
+#define SHADOW_CLIENT_MAX_FRAME_DELAY 1000
+
 typedef struct
 {
 	BOOL gfxOpened;
@@ -228,9 +235,20 @@ static BOOL shadow_client_context_new(freerdp_peer* peer, rdpContext* context)
 	if (!(client->encoder = shadow_encoder_new(client)))
 		goto fail_encoder_new;
 
+	client->encodeQueue = shadow_frame_queue_new(SHADOW_CLIENT_ENCODE_QUEUE_DEPTH);
+	client->sendQueue = shadow_frame_queue_new(SHADOW_CLIENT_MAX_INFLIGHT_FRAMES);
+
+	if (!client->encodeQueue || !client->sendQueue)
+		goto fail_frame_queue;
+
 	if (ArrayList_Append(server->clients, (void*)client))
 		return TRUE;
 
+fail_frame_queue:
+	shadow_frame_queue_free(client->encodeQueue);
+	client->encodeQueue = NULL;
+	shadow_frame_queue_free(client->sendQueue);
+	client->sendQueue = NULL;
 	shadow_encoder_free(client->encoder);
 	client->encoder = NULL;
 fail_encoder_new:
@@ -259,6 +277,14 @@ static void shadow_client_context_free(freerdp_peer* peer, rdpContext* context)
 	server = client->server;
 	WINPR_ASSERT(server);
 
+	/* The server frees the encode cache once the last client was removed */
+	shadow_frame_queue_free(client->encodeQueue);
+	client->encodeQueue = NULL;
+	shadow_frame_queue_free(client->sendQueue);
+	client->sendQueue = NULL;
+	shadow_frame_release(client->frame);
+	client->frame = NULL;
+
 	WINPR_ASSERT(server->clients);
 	ArrayList_Remove(server->clients, (void*)client);
 
@@ -276,6 +302,8 @@ static void shadow_client_context_free(freerdp_peer* peer, rdpContext* context)
 	client->vcm = NULL;
 	region16_uninit(&(client->invalidRegion));
 	DeleteCriticalSection(&(client->lock));
+	free(client->cacheImportOffer);
+	client->cacheImportOffer = NULL;
 }
 
 static INLINE void shadow_client_mark_invalid(rdpShadowClient* client, UINT32 numRects,
@@ -698,6 +726,7 @@ static INLINE void shadow_client_common_frame_acknowledge(rdpShadowClient* clien
 	WINPR_ASSERT(client);
 	WINPR_ASSERT(client->encoder);
 	client->encoder->lastAckframeId = frameId;
+	shadow_frame_queue_ack(client->sendQueue, frameId);
 }
 
 static BOOL shadow_client_surface_frame_acknowledge(rdpContext* context, UINT32 frameId)
@@ -728,6 +757,39 @@ shadow_client_rdpgfx_frame_acknowledge(RdpgfxServerContext* context,
 	WINPR_ASSERT(client);
 	WINPR_ASSERT(client->encoder);
 	client->encoder->queueDepth = frameAcknowledge->queueDepth;
+
+	/* The client stopped acknowledging, nothing in flight is waited for */
+	if (frameAcknowledge->queueDepth == SUSPEND_FRAME_ACKNOWLEDGEMENT)
+		shadow_frame_queue_clear(client->sendQueue);
+
+	return CHANNEL_RC_OK;
+}
+
+static UINT
+shadow_client_rdpgfx_cache_import_offer(RdpgfxServerContext* context,
+                                        const RDPGFX_CACHE_IMPORT_OFFER_PDU* cacheImportOffer)
+{
+	rdpShadowClient* client;
+	RDPGFX_CACHE_IMPORT_OFFER_PDU* offer;
+
+	WINPR_ASSERT(context);
+	WINPR_ASSERT(cacheImportOffer);
+
+	client = (rdpShadowClient*)context->custom;
+	WINPR_ASSERT(client);
+
+	offer = (RDPGFX_CACHE_IMPORT_OFFER_PDU*)malloc(sizeof(RDPGFX_CACHE_IMPORT_OFFER_PDU));
+
+	if (!offer)
+		return CHANNEL_RC_NO_MEMORY;
+
+	*offer = *cacheImportOffer;
+
+	/* The tile cache belongs to the client thread, the offer is answered before the next frame */
+	EnterCriticalSection(&(client->lock));
+	free(client->cacheImportOffer);
+	client->cacheImportOffer = offer;
+	LeaveCriticalSection(&(client->lock));
 	return CHANNEL_RC_OK;
 }
 
@@ -993,216 +1055,968 @@ static INLINE UINT32 rdpgfx_estimate_h264_avc420(RDPGFX_AVC420_BITMAP_STREAM* ha
 	       havc420->length;
 }
 
+static INLINE void shadow_client_encode_cache_key(rdpShadowClient* client, BOOL gfx,
+                                                  UINT32 codecId, UINT32 codecFlags,
+                                                  UINT32 codecParam, UINT16 nXSrc, UINT16 nYSrc,
+                                                  UINT16 nWidth, UINT16 nHeight,
+                                                  SHADOW_ENCODE_CACHE_KEY* key)
+{
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(key);
+
+	ZeroMemory(key, sizeof(SHADOW_ENCODE_CACHE_KEY));
+	WINPR_ASSERT(client->frame);
+	key->surface = client->frame->surface;
+	key->gfx = gfx;
+	key->codecId = codecId;
+	key->codecFlags = codecFlags;
+	key->codecParam = codecParam;
+	key->rect.left = nXSrc;
+	key->rect.top = nYSrc;
+	key->rect.right = nXSrc + nWidth;
+	key->rect.bottom = nYSrc + nHeight;
+	key->frameId = client->frame->cacheFrameId;
+}
+
+/**
+ * Function description
+ * RemoteFX writes the codec headers only with the first message after a context reset, a
+ * payload encoded by an initialized context carries none and can not be decoded by a client that
+ * never received them. The header state is therefore part of the cache key.
+ *
+ * @return TRUE if the next RemoteFX message sent to the client carries the codec headers
+ */
+static BOOL shadow_client_rfx_headers_pending(rdpShadowClient* client)
+{
+	rdpShadowEncoder* encoder;
+
+	WINPR_ASSERT(client);
+	encoder = client->encoder;
+	WINPR_ASSERT(encoder);
+	WINPR_ASSERT(encoder->rfx);
+
+	return rfx_context_headers_pending(encoder->rfx);
+}
+
+/**
+ * Function description
+ * A shared payload with headers was sent, the client decoder is initialized now.
+ */
+static void shadow_client_rfx_headers_sent(rdpShadowClient* client)
+{
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(client->encoder);
+
+	if (!rfx_context_set_headers_sent(client->encoder->rfx))
+		WLog_WARN(TAG, "rfx_context_set_headers_sent failed");
+}
+
 /**
  * Function description
+ * Fill the encode cache key for a GFX surface command.
+ *
+ * @return TRUE if the encoded data may be shared with other clients
+ */
+static BOOL shadow_client_gfx_encode_cache_key(rdpShadowClient* client, UINT32 codecId,
+                                               UINT32 codecFlags, const RECTANGLE_16* rect,
+                                               const REGION16* region, SHADOW_ENCODE_CACHE_KEY* key)
+{
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(client->server);
+	WINPR_ASSERT(rect);
+
+	if (!client->server->encodeCache)
+		return FALSE;
+
+	shadow_client_encode_cache_key(client, TRUE, codecId, codecFlags, 0, rect->left, rect->top,
+	                               rect->right - rect->left, rect->bottom - rect->top, key);
+
+	if (region)
+		key->rects = region16_rects(region, &key->numRects);
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Send a surface command, either from the encode cache or encoded by the caller.
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE* pSrcData,
-                                           UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nXSrc,
-                                           UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight)
+static BOOL shadow_client_send_gfx_command(rdpShadowClient* client, RDPGFX_SURFACE_COMMAND* cmd,
+                                           const SHADOW_ENCODE_CACHE_KEY* key)
 {
-	UINT32 id;
 	UINT error = CHANNEL_RC_OK;
-	const rdpContext* context = (const rdpContext*)client;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(cmd);
+
+	if (key)
+		shadow_encode_cache_store(client->server->encodeCache, key, cmd->data, cmd->length, 1);
+
+	IFCALLRET(client->rdpgfx->SurfaceCommand, error, client->rdpgfx, cmd);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "SurfaceCommand failed with error %" PRIu32 "", error);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Send a surface command already encoded by another client.
+ *
+ * @return 1 if sent, 0 if not cached, -1 on failure
+ */
+static int shadow_client_send_gfx_shared(rdpShadowClient* client, RDPGFX_SURFACE_COMMAND* cmd,
+                                         const SHADOW_ENCODE_CACHE_KEY* key)
+{
+	BOOL rc;
+	SHADOW_ENCODE_CACHE_ENTRY* entry;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(cmd);
+	WINPR_ASSERT(key);
+
+	entry = shadow_encode_cache_acquire(client->server->encodeCache, key);
+
+	if (!entry)
+		return 0;
+
+	cmd->codecId = key->codecId;
+	cmd->data = entry->data;
+	cmd->length = entry->length;
+	rc = shadow_client_send_gfx_command(client, cmd, NULL);
+	shadow_encode_cache_release(entry);
+	cmd->data = NULL;
+	cmd->length = 0;
+	return rc ? 1 : -1;
+}
+
+/**
+ * Function description
+ * Progressive tiles are sent at a coarse quality first and upgraded while the client is idle.
+ *
+ * @return TRUE if the surface is encoded with progressive upgrades
+ */
+static BOOL shadow_client_gfx_progressive_upgrades(rdpShadowClient* client)
+{
 	const rdpSettings* settings;
-	rdpShadowEncoder* encoder;
-	RDPGFX_SURFACE_COMMAND cmd = { 0 };
-	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
-	RDPGFX_END_FRAME_PDU cmdend = { 0 };
-	SYSTEMTIME sTime = { 0 };
 
-	if (!context || !pSrcData)
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(client->server);
+	settings = client->context.settings;
+	WINPR_ASSERT(settings);
+
+	if (!client->server->progressiveUpgrades)
 		return FALSE;
 
-	settings = context->settings;
+	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) &&
+	    (freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId) != 0))
+		return FALSE;
+
+	return freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive);
+}
+
+/**
+ * Function description
+ * Encode a region of the surface with the negotiated (non H.264) codec.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_gfx_codec(rdpShadowClient* client, const BYTE* pSrcData,
+                                                 UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nWidth,
+                                                 UINT16 nHeight, const REGION16* region)
+{
+	int status;
+	UINT32 index;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects;
+	const RECTANGLE_16* extents;
+	const rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+	SHADOW_ENCODE_CACHE_KEY key;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(region);
+	settings = client->context.settings;
 	encoder = client->encoder;
+	WINPR_ASSERT(settings);
+	WINPR_ASSERT(encoder);
 
-	if (!settings || !encoder)
-		return FALSE;
+	rects = region16_rects(region, &numRects);
+	extents = region16_extents(region);
 
-	if (client->first_frame)
-	{
-		rfx_context_reset(encoder->rfx, nWidth, nHeight);
-		client->first_frame = FALSE;
-	}
+	if (numRects == 0)
+		return TRUE;
 
-	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
-	GetSystemTime(&sTime);
-	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
-	                              sTime.wMilliseconds);
-	cmdend.frameId = cmdstart.frameId;
 	cmd.surfaceId = client->surfaceId;
 	cmd.format = PIXEL_FORMAT_BGRX32;
-	cmd.left = nXSrc;
-	cmd.top = nYSrc;
-	cmd.right = cmd.left + nWidth;
-	cmd.bottom = cmd.top + nHeight;
+	cmd.left = 0;
+	cmd.top = 0;
+	cmd.right = nWidth;
+	cmd.bottom = nHeight;
 	cmd.width = nWidth;
 	cmd.height = nHeight;
 
-	id = freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId);
-	if (settings->GfxAVC444 || settings->GfxAVC444v2)
+	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) &&
+	    (freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId) != 0))
 	{
-		INT32 rc;
-		RDPGFX_AVC444_BITMAP_STREAM avc444 = { 0 };
-		RECTANGLE_16 regionRect = { 0 };
-		BYTE version = settings->GfxAVC444v2 ? 2 : 1;
+		BOOL rc;
+		wStream* s;
+		RFX_RECT* rfxRects;
+		BOOL share;
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC444) < 0)
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC444");
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
 			return FALSE;
 		}
 
-		WINPR_ASSERT(cmd.left <= UINT16_MAX);
-		WINPR_ASSERT(cmd.top <= UINT16_MAX);
-		WINPR_ASSERT(cmd.right <= UINT16_MAX);
-		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
-		regionRect.left = (UINT16)cmd.left;
-		regionRect.top = (UINT16)cmd.top;
-		regionRect.right = (UINT16)cmd.right;
-		regionRect.bottom = (UINT16)cmd.bottom;
-		rc = avc444_compress(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth, nHeight,
-		                     version, &regionRect, &avc444.LC, &avc444.bitstream[0].data,
-		                     &avc444.bitstream[0].length, &avc444.bitstream[1].data,
-		                     &avc444.bitstream[1].length, &avc444.bitstream[0].meta,
-		                     &avc444.bitstream[1].meta);
-		if (rc < 0)
+		share = shadow_client_gfx_encode_cache_key(client, RDPGFX_CODECID_CAVIDEO,
+		                                           client->server->rfxMode, extents, region, &key);
+		key.headers = shadow_client_rfx_headers_pending(client);
+
+		/* Another client might already have encoded this frame with the same codec settings */
+		if (share && ((status = shadow_client_send_gfx_shared(client, &cmd, &key)) != 0))
 		{
-			WLog_ERR(TAG, "avc420_compress failed for avc444");
+			if ((status > 0) && key.headers)
+				shadow_client_rfx_headers_sent(client);
+
+			return status > 0;
+		}
+
+		rfxRects = (RFX_RECT*)calloc(numRects, sizeof(RFX_RECT));
+
+		if (!rfxRects)
 			return FALSE;
+
+		for (index = 0; index < numRects; index++)
+		{
+			rfxRects[index].x = rects[index].left;
+			rfxRects[index].y = rects[index].top;
+			rfxRects[index].width = rects[index].right - rects[index].left;
+			rfxRects[index].height = rects[index].bottom - rects[index].top;
 		}
 
-		/* rc > 0 means new data */
-		if (rc > 0)
+		s = Stream_New(NULL, 1024);
+
+		if (!s)
 		{
-			avc444.cbAvc420EncodedBitstream1 = rdpgfx_estimate_h264_avc420(&avc444.bitstream[0]);
-			cmd.codecId = settings->GfxAVC444v2 ? RDPGFX_CODECID_AVC444v2 : RDPGFX_CODECID_AVC444;
-			cmd.extra = (void*)&avc444;
-			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-			          &cmdend);
+			free(rfxRects);
+			return FALSE;
 		}
 
-		free_h264_metablock(&avc444.bitstream[0].meta);
-		free_h264_metablock(&avc444.bitstream[1].meta);
-		if (error)
+		rc = rfx_compose_message(encoder->rfx, s, rfxRects, numRects, pSrcData, nWidth, nHeight,
+		                         nSrcStep);
+		free(rfxRects);
+
+		if (!rc)
 		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+			WLog_ERR(TAG, "rfx_compose_message failed");
+			Stream_Free(s, TRUE);
 			return FALSE;
 		}
+
+		WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
+		cmd.codecId = RDPGFX_CODECID_CAVIDEO;
+		cmd.data = Stream_Buffer(s);
+		cmd.length = (UINT32)Stream_GetPosition(s);
+		rc = shadow_client_send_gfx_command(client, &cmd, share ? &key : NULL);
+		Stream_Free(s, TRUE);
+		return rc;
 	}
-	else if (settings->GfxH264)
+	else if (!client->server->clearCodec &&
+	         freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive))
 	{
 		INT32 rc;
-		RDPGFX_AVC420_BITMAP_STREAM avc420 = { 0 };
-		RECTANGLE_16 regionRect;
+		/* Upgrade passes depend on what was sent to this client before, never share them */
+		const BOOL share = !shadow_client_gfx_progressive_upgrades(client) &&
+		                   shadow_client_gfx_encode_cache_key(client, RDPGFX_CODECID_CAPROGRESSIVE,
+		                                                      0, extents, region, &key);
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420) < 0)
+		if (share && ((status = shadow_client_send_gfx_shared(client, &cmd, &key)) != 0))
+			return status > 0;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC420");
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PROGRESSIVE");
 			return FALSE;
 		}
 
-		WINPR_ASSERT(cmd.left <= UINT16_MAX);
-		WINPR_ASSERT(cmd.top <= UINT16_MAX);
-		WINPR_ASSERT(cmd.right <= UINT16_MAX);
-		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
-		regionRect.left = (UINT16)cmd.left;
-		regionRect.top = (UINT16)cmd.top;
-		regionRect.right = (UINT16)cmd.right;
-		regionRect.bottom = (UINT16)cmd.bottom;
-		rc = avc420_compress(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth, nHeight,
-		                     &regionRect, &avc420.data, &avc420.length, &avc420.meta);
+		rc = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight, cmd.format,
+		                          nWidth, nHeight, nSrcStep, region, &cmd.data, &cmd.length);
 		if (rc < 0)
 		{
-			WLog_ERR(TAG, "avc420_compress failed");
+			WLog_ERR(TAG, "progressive_compress failed");
 			return FALSE;
 		}
 
 		/* rc > 0 means new data */
-		if (rc > 0)
-		{
-			cmd.codecId = RDPGFX_CODECID_AVC420;
-			cmd.extra = (void*)&avc420;
-
-			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-			          &cmdend);
-		}
-		free_h264_metablock(&avc420.meta);
+		if (rc == 0)
+			return TRUE;
 
-		if (error)
-		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
-			return FALSE;
-		}
+		cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
+		return shadow_client_send_gfx_command(client, &cmd, share ? &key : NULL);
 	}
-	else if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) && (id != 0))
+
+	/* ClearCodec, planar and uncompressed bitmaps are sent per rectangle */
+	for (index = 0; index < numRects; index++)
 	{
 		BOOL rc;
-		wStream* s;
-		RFX_RECT rect;
-
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
+		BOOL share;
+		const RECTANGLE_16* rect = &rects[index];
+		const UINT32 w = rect->right - rect->left;
+		const UINT32 h = rect->bottom - rect->top;
+
+		cmd.left = rect->left;
+		cmd.top = rect->top;
+		cmd.right = rect->right;
+		cmd.bottom = rect->bottom;
+		cmd.width = w;
+		cmd.height = h;
+
+		if (client->server->clearCodec)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
-			return FALSE;
-		}
+			const UINT32 bpp = FreeRDPGetBytesPerPixel(SrcFormat);
+			const BYTE* src = &pSrcData[rect->top * nSrcStep + rect->left * bpp];
 
-		s = Stream_New(NULL, 1024);
-		WINPR_ASSERT(s);
+			/* The encoder mirrors the caches of this client, the result can not be shared */
+			if (shadow_encoder_prepare(encoder, FREERDP_CODEC_CLEARCODEC) < 0)
+			{
+				WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_CLEARCODEC");
+				return FALSE;
+			}
 
-		WINPR_ASSERT(cmd.left <= UINT16_MAX);
-		WINPR_ASSERT(cmd.top <= UINT16_MAX);
-		WINPR_ASSERT(cmd.right <= UINT16_MAX);
-		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
-		rect.x = (UINT16)cmd.left;
-		rect.y = (UINT16)cmd.top;
-		rect.width = (UINT16)cmd.right - cmd.left;
-		rect.height = (UINT16)cmd.bottom - cmd.top;
+			status = clear_compress(encoder->clear, src, nSrcStep * (h - 1) + w * bpp, SrcFormat,
+			                        w, h, nSrcStep, &cmd.data, &cmd.length);
 
-		rc = rfx_compose_message(encoder->rfx, s, &rect, 1, pSrcData, nWidth, nHeight, nSrcStep);
+			if (status < 0)
+			{
+				WLog_ERR(TAG, "clear_compress failed");
+				return FALSE;
+			}
 
-		if (!rc)
+			/* The encoded data belongs to the ClearCodec context */
+			cmd.codecId = RDPGFX_CODECID_CLEARCODEC;
+			rc = shadow_client_send_gfx_command(client, &cmd, NULL);
+			cmd.data = NULL;
+
+			if (!rc)
+				return FALSE;
+
+			continue;
+		}
+
+		if (freerdp_settings_get_bool(settings, FreeRDP_GfxPlanar))
 		{
-			WLog_ERR(TAG, "rfx_compose_message failed");
-			Stream_Free(s, TRUE);
+			const BYTE* src =
+			    &pSrcData[rect->top * nSrcStep + rect->left * FreeRDPGetBytesPerPixel(SrcFormat)];
+			share = shadow_client_gfx_encode_cache_key(
+			    client, RDPGFX_CODECID_PLANAR,
+			    freerdp_settings_get_bool(settings, FreeRDP_DrawAllowSkipAlpha), rect, NULL, &key);
+
+			if (share && ((status = shadow_client_send_gfx_shared(client, &cmd, &key)) != 0))
+			{
+				if (status < 0)
+					return FALSE;
+
+				continue;
+			}
+
+			if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
+			{
+				WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
+				return FALSE;
+			}
+
+			rc = freerdp_bitmap_planar_context_reset(encoder->planar, w, h);
+			WINPR_ASSERT(rc);
+			freerdp_planar_topdown_image(encoder->planar, TRUE);
+
+			cmd.data = freerdp_bitmap_compress_planar(encoder->planar, src, SrcFormat, w, h,
+			                                          nSrcStep, NULL, &cmd.length);
+			WINPR_ASSERT(cmd.data || (cmd.length == 0));
+			cmd.codecId = RDPGFX_CODECID_PLANAR;
+		}
+		else
+		{
+			const UINT32 length = w * 4 * h;
+			share = shadow_client_gfx_encode_cache_key(client, RDPGFX_CODECID_UNCOMPRESSED, 0,
+			                                           rect, NULL, &key);
+
+			if (share && ((status = shadow_client_send_gfx_shared(client, &cmd, &key)) != 0))
+			{
+				if (status < 0)
+					return FALSE;
+
+				continue;
+			}
+
+			cmd.data = malloc(length);
+
+			if (!cmd.data)
+				return FALSE;
+
+			rc = freerdp_image_copy(cmd.data, PIXEL_FORMAT_BGRA32, 0, 0, 0, w, h, pSrcData,
+			                        SrcFormat, nSrcStep, rect->left, rect->top, NULL, 0);
+			WINPR_ASSERT(rc);
+			cmd.length = length;
+			cmd.codecId = RDPGFX_CODECID_UNCOMPRESSED;
+		}
+
+		rc = shadow_client_send_gfx_command(client, &cmd, share ? &key : NULL);
+		free(cmd.data);
+		cmd.data = NULL;
+
+		if (!rc)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Send the cache hits of a frame, grouping consecutive hits of the same slot.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_gfx_cache_hits(rdpShadowClient* client,
+                                              const SHADOW_TILE_CACHE_FRAME* frame, BOOL late,
+                                              RDPGFX_POINT16* points)
+{
+	size_t index = 0;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(frame);
+
+	while (index < frame->numHits)
+	{
+		UINT error = CHANNEL_RC_OK;
+		RDPGFX_CACHE_TO_SURFACE_PDU pdu = { 0 };
+		const SHADOW_TILE_HIT* hit = &frame->hits[index++];
+
+		if (hit->late != late)
+			continue;
+
+		pdu.cacheSlot = hit->cacheSlot;
+		pdu.surfaceId = client->surfaceId;
+		pdu.destPts = points;
+		points[pdu.destPtsCount++] = hit->destPt;
+
+		while ((index < frame->numHits) && (frame->hits[index].cacheSlot == hit->cacheSlot) &&
+		       (pdu.destPtsCount < UINT16_MAX))
+			points[pdu.destPtsCount++] = frame->hits[index++].destPt;
+
+		IFCALLRET(client->rdpgfx->CacheToSurface, error, client->rdpgfx, &pdu);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "CacheToSurface failed with error %" PRIu32 "", error);
 			return FALSE;
 		}
+	}
 
-		/* rc > 0 means new data */
-		if (rc > 0)
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Send the tiles changed since the last frame which are already known to
+ * the client, either as surface copies, cache hits or solid fills.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_gfx_tile_updates(rdpShadowClient* client,
+                                                const SHADOW_TILE_CACHE_FRAME* frame,
+                                                RDPGFX_POINT16* points, RECTANGLE_16* fillRects)
+{
+	size_t index = 0;
+	UINT error = CHANNEL_RC_OK;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(frame);
+
+	while (index < frame->numCopies)
+	{
+		RDPGFX_SURFACE_TO_SURFACE_PDU pdu = { 0 };
+		const SHADOW_TILE_COPY* copy = &frame->copies[index++];
+
+		pdu.surfaceIdSrc = client->surfaceId;
+		pdu.surfaceIdDest = client->surfaceId;
+		pdu.rectSrc = copy->rectSrc;
+		pdu.destPts = points;
+		points[pdu.destPtsCount++] = copy->destPt;
+
+		while ((index < frame->numCopies) &&
+		       (memcmp(&frame->copies[index].rectSrc, &copy->rectSrc, sizeof(RECTANGLE_16)) ==
+		        0) &&
+		       (pdu.destPtsCount < UINT16_MAX))
+			points[pdu.destPtsCount++] = frame->copies[index++].destPt;
+
+		IFCALLRET(client->rdpgfx->SurfaceToSurface, error, client->rdpgfx, &pdu);
+
+		if (error)
 		{
-			const size_t pos = Stream_GetPosition(s);
-			WINPR_ASSERT(pos <= UINT32_MAX);
+			WLog_ERR(TAG, "SurfaceToSurface failed with error %" PRIu32 "", error);
+			return FALSE;
+		}
+	}
 
-			cmd.codecId = RDPGFX_CODECID_CAVIDEO;
-			cmd.data = Stream_Buffer(s);
-			cmd.length = (UINT32)pos;
+	index = 0;
 
-			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-			          &cmdend);
+	while (index < frame->numFills)
+	{
+		RDPGFX_SOLID_FILL_PDU pdu = { 0 };
+		const SHADOW_TILE_FILL* fill = &frame->fills[index++];
+
+		pdu.surfaceId = client->surfaceId;
+		pdu.fillPixel = fill->color;
+		pdu.fillRects = fillRects;
+		fillRects[pdu.fillRectCount++] = fill->rect;
+
+		while ((index < frame->numFills) &&
+		       (memcmp(&frame->fills[index].color, &fill->color, sizeof(RDPGFX_COLOR32)) == 0) &&
+		       (pdu.fillRectCount < UINT16_MAX))
+			fillRects[pdu.fillRectCount++] = frame->fills[index++].rect;
+
+		IFCALLRET(client->rdpgfx->SolidFill, error, client->rdpgfx, &pdu);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SolidFill failed with error %" PRIu32 "", error);
+			return FALSE;
 		}
+	}
+
+	return shadow_client_send_gfx_cache_hits(client, frame, FALSE, points);
+}
+
+/**
+ * Function description
+ * Update the client bitmap cache with the tiles just sent through the codec.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_gfx_cache_stores(rdpShadowClient* client,
+                                                const SHADOW_TILE_CACHE_FRAME* frame,
+                                                RDPGFX_POINT16* points)
+{
+	size_t index;
+	UINT error = CHANNEL_RC_OK;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(frame);
+
+	/* Slots are reused, drop the old entries first */
+	for (index = 0; index < frame->numEvictions; index++)
+	{
+		RDPGFX_EVICT_CACHE_ENTRY_PDU pdu = { 0 };
+		pdu.cacheSlot = frame->evictions[index];
+		IFCALLRET(client->rdpgfx->EvictCacheEntry, error, client->rdpgfx, &pdu);
 
-		Stream_Free(s, TRUE);
 		if (error)
 		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
+			WLog_ERR(TAG, "EvictCacheEntry failed with error %" PRIu32 "", error);
+			return FALSE;
+		}
+	}
+
+	for (index = 0; index < frame->numStores; index++)
+	{
+		RDPGFX_SURFACE_TO_CACHE_PDU pdu = { 0 };
+		const SHADOW_TILE_STORE* store = &frame->stores[index];
+
+		pdu.surfaceId = client->surfaceId;
+		pdu.cacheKey = store->cacheKey;
+		pdu.cacheSlot = store->cacheSlot;
+		pdu.rectSrc = store->rectSrc;
+		IFCALLRET(client->rdpgfx->SurfaceToCache, error, client->rdpgfx, &pdu);
+
+		if (error)
+		{
+			WLog_ERR(TAG, "SurfaceToCache failed with error %" PRIu32 "", error);
+			return FALSE;
+		}
+	}
+
+	return shadow_client_send_gfx_cache_hits(client, frame, TRUE, points);
+}
+
+/**
+ * Function description
+ * Tiles restored from the client surface or bitmap cache are shown at full quality,
+ * drop their pending progressive upgrades.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_discard_gfx_upgrades(rdpShadowClient* client,
+                                               const SHADOW_TILE_CACHE_FRAME* frame)
+{
+	size_t index;
+	BOOL rc = TRUE;
+	REGION16 region;
+	rdpShadowEncoder* encoder;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(frame);
+	encoder = client->encoder;
+	WINPR_ASSERT(encoder);
+
+	if (!encoder->progressive || (progressive_compress_pending(encoder->progressive) == 0))
+		return TRUE;
+
+	region16_init(&region);
+
+	for (index = 0; rc && (index < frame->numFills); index++)
+		rc = region16_union_rect(&region, &region, &frame->fills[index].rect);
+
+	for (index = 0; rc && (index < frame->numCopies); index++)
+	{
+		const SHADOW_TILE_COPY* copy = &frame->copies[index];
+		const RECTANGLE_16 rect = { copy->destPt.x, copy->destPt.y,
+			                        copy->destPt.x + copy->rectSrc.right - copy->rectSrc.left,
+			                        copy->destPt.y + copy->rectSrc.bottom - copy->rectSrc.top };
+		rc = region16_union_rect(&region, &region, &rect);
+	}
+
+	for (index = 0; rc && (index < frame->numHits); index++)
+	{
+		const SHADOW_TILE_HIT* hit = &frame->hits[index];
+		const RECTANGLE_16 rect = { hit->destPt.x, hit->destPt.y, hit->destPt.x + 1,
+			                        hit->destPt.y + 1 };
+		rc = region16_union_rect(&region, &region, &rect);
+	}
+
+	if (rc)
+		rc = progressive_compress_discard(encoder->progressive, &region);
+
+	region16_uninit(&region);
+	return rc;
+}
+
+/**
+ * Function description
+ * Answer a pending cache import offer of the client. Without a tile cache
+ * the reply is empty and the client drops its imported entries.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_rdpgfx_cache_import(rdpShadowClient* client, SHADOW_TILE_CACHE* cache)
+{
+	BOOL rc = FALSE;
+	UINT error = CHANNEL_RC_OK;
+	RDPGFX_CACHE_IMPORT_OFFER_PDU* offer;
+	RDPGFX_CACHE_IMPORT_REPLY_PDU* reply = NULL;
+
+	WINPR_ASSERT(client);
+
+	EnterCriticalSection(&(client->lock));
+	offer = client->cacheImportOffer;
+	client->cacheImportOffer = NULL;
+	LeaveCriticalSection(&(client->lock));
+
+	if (!offer)
+		return TRUE;
+
+	reply = (RDPGFX_CACHE_IMPORT_REPLY_PDU*)calloc(1, sizeof(RDPGFX_CACHE_IMPORT_REPLY_PDU));
+
+	if (!reply)
+		goto out;
+
+	if (cache && !shadow_tile_cache_import(cache, offer, reply))
+		goto out;
+
+	IFCALLRET(client->rdpgfx->CacheImportReply, error, client->rdpgfx, reply);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "CacheImportReply failed with error %" PRIu32 "", error);
+		goto out;
+	}
+
+	rc = TRUE;
+out:
+	free(reply);
+	free(offer);
+	return rc;
+}
+
+/**
+ * Function description
+ * Send a GFX frame for the invalid region. Tiles already known to the client
+ * are restored from the client surface or bitmap cache, only new content is
+ * encoded.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_gfx_tiles(rdpShadowClient* client, const BYTE* pSrcData,
+                                                 UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nWidth,
+                                                 UINT16 nHeight, const REGION16* invalidRegion,
+                                                 const RDPGFX_START_FRAME_PDU* cmdstart,
+                                                 const RDPGFX_END_FRAME_PDU* cmdend)
+{
+	BOOL rc = FALSE;
+	UINT error = CHANNEL_RC_OK;
+	size_t count;
+	rdpShadowEncoder* encoder;
+	RDPGFX_POINT16* points = NULL;
+	RECTANGLE_16* fillRects = NULL;
+	SHADOW_TILE_CACHE_FRAME* frame = NULL;
+	const REGION16* encodeRegion = invalidRegion;
+	BOOL tiles;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(invalidRegion);
+	encoder = client->encoder;
+	WINPR_ASSERT(encoder);
+
+	/* The tile hashes require 32bpp surfaces */
+	tiles = (FreeRDPGetBytesPerPixel(SrcFormat) == 4) &&
+	        (shadow_encoder_prepare_tile_cache(encoder) > 0);
+
+	if (!shadow_client_rdpgfx_cache_import(client, tiles ? encoder->tileCache : NULL))
+		return FALSE;
+
+	if (tiles)
+	{
+		const BOOL upgrades = shadow_client_gfx_progressive_upgrades(client);
+
+		if (!shadow_tile_cache_update(encoder->tileCache, pSrcData, nSrcStep, nWidth, nHeight,
+		                              invalidRegion, upgrades, &frame))
+		{
+			WLog_ERR(TAG, "shadow_tile_cache_update failed");
 			return FALSE;
 		}
+
+		if (upgrades && !shadow_client_discard_gfx_upgrades(client, frame))
+			return FALSE;
+
+		encodeRegion = &frame->encodeRegion;
+		count = MAX(frame->numCopies, MAX(frame->numFills, frame->numHits));
+		points = (RDPGFX_POINT16*)calloc(count + 1, sizeof(RDPGFX_POINT16));
+		fillRects = (RECTANGLE_16*)calloc(frame->numFills + 1, sizeof(RECTANGLE_16));
+
+		if (!points || !fillRects)
+			goto out;
+	}
+
+	IFCALLRET(client->rdpgfx->StartFrame, error, client->rdpgfx, cmdstart);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "StartFrame failed with error %" PRIu32 "", error);
+		goto out;
+	}
+
+	if (frame && !shadow_client_send_gfx_tile_updates(client, frame, points, fillRects))
+		goto out;
+
+	if (!shadow_client_send_surface_gfx_codec(client, pSrcData, nSrcStep, SrcFormat, nWidth,
+	                                          nHeight, encodeRegion))
+		goto out;
+
+	if (frame && !shadow_client_send_gfx_cache_stores(client, frame, points))
+		goto out;
+
+	IFCALLRET(client->rdpgfx->EndFrame, error, client->rdpgfx, cmdend);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "EndFrame failed with error %" PRIu32 "", error);
+		goto out;
+	}
+
+	rc = TRUE;
+out:
+	free(points);
+	free(fillRects);
+	return rc;
+}
+
+/**
+ * Function description
+ * Send the next quality step of the progressive tiles still shown at reduced quality.
+ * Tiles reaching their final quality are added to the client bitmap cache.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_gfx_upgrade(rdpShadowClient* client)
+{
+	INT32 status;
+	BOOL rc = FALSE;
+	UINT error = CHANNEL_RC_OK;
+	REGION16 finalRegion;
+	SYSTEMTIME sTime = { 0 };
+	const rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+	RDPGFX_POINT16* points = NULL;
+	SHADOW_TILE_CACHE_FRAME* frame = NULL;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
+	RDPGFX_END_FRAME_PDU cmdend = { 0 };
+
+	WINPR_ASSERT(client);
+	settings = client->context.settings;
+	encoder = client->encoder;
+	WINPR_ASSERT(settings);
+	WINPR_ASSERT(encoder);
+
+	region16_init(&finalRegion);
+	status = progressive_compress_upgrade(encoder->progressive, &finalRegion, &cmd.data,
+	                                      &cmd.length);
+
+	if (status <= 0)
+	{
+		region16_uninit(&finalRegion);
+
+		if (status < 0)
+			WLog_ERR(TAG, "progressive_compress_upgrade failed");
+
+		return status == 0;
+	}
+
+	if (encoder->tileCache)
+	{
+		if (!shadow_tile_cache_finalize(encoder->tileCache, &finalRegion, &frame))
+			goto out;
+
+		points = (RDPGFX_POINT16*)calloc(frame->numHits + 1, sizeof(RDPGFX_POINT16));
+
+		if (!points)
+			goto out;
+	}
+
+	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+	GetSystemTime(&sTime);
+	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
+	                              sTime.wMilliseconds);
+	cmdend.frameId = cmdstart.frameId;
+	cmd.surfaceId = client->surfaceId;
+	cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.right = freerdp_settings_get_uint32(settings, FreeRDP_DesktopWidth);
+	cmd.bottom = freerdp_settings_get_uint32(settings, FreeRDP_DesktopHeight);
+	cmd.width = cmd.right;
+	cmd.height = cmd.bottom;
+
+	IFCALLRET(client->rdpgfx->StartFrame, error, client->rdpgfx, &cmdstart);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "StartFrame failed with error %" PRIu32 "", error);
+		goto out;
+	}
+
+	if (!shadow_client_send_gfx_command(client, &cmd, NULL))
+		goto out;
+
+	if (frame && !shadow_client_send_gfx_cache_stores(client, frame, points))
+		goto out;
+
+	IFCALLRET(client->rdpgfx->EndFrame, error, client->rdpgfx, &cmdend);
+
+	if (error)
+	{
+		WLog_ERR(TAG, "EndFrame failed with error %" PRIu32 "", error);
+		goto out;
+	}
+
+	rc = TRUE;
+out:
+	free(points);
+	region16_uninit(&finalRegion);
+	return rc;
+}
+
+/**
+ * Feed the measured client bandwidth to the AVC rate control, keeping 20%
+ * headroom for the other channels.
+ */
+static void shadow_client_update_h264_rate(rdpShadowClient* client, H264_CONTEXT* h264)
+{
+	const rdpAutoDetect* autodetect;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(h264);
+
+	h264->AdaptiveQP = client->server->h264AdaptiveQP;
+	autodetect = client->context.autodetect;
+
+	if (!h264->AdaptiveQP || !autodetect || (autodetect->netCharBandwidth == 0))
+		return;
+
+	h264->TargetBitRate = (UINT32)MIN(autodetect->netCharBandwidth * 800ULL, UINT32_MAX);
+}
+
+/**
+ * Function description
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE* pSrcData,
+                                           UINT32 nSrcStep, UINT32 SrcFormat, UINT16 nXSrc,
+                                           UINT16 nYSrc, UINT16 nWidth, UINT16 nHeight,
+                                           const REGION16* invalidRegion)
+{
+	UINT error = CHANNEL_RC_OK;
+	const rdpContext* context = (const rdpContext*)client;
+	const rdpSettings* settings;
+	rdpShadowEncoder* encoder;
+	RDPGFX_SURFACE_COMMAND cmd = { 0 };
+	RDPGFX_START_FRAME_PDU cmdstart = { 0 };
+	RDPGFX_END_FRAME_PDU cmdend = { 0 };
+	SYSTEMTIME sTime = { 0 };
+
+	if (!context || !pSrcData)
+		return FALSE;
+
+	settings = context->settings;
+	encoder = client->encoder;
+
+	if (!settings || !encoder)
+		return FALSE;
+
+	if (client->first_frame)
+	{
+		rfx_context_reset(encoder->rfx, nWidth, nHeight);
+		client->first_frame = FALSE;
 	}
-	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxProgressive))
+
+	cmdstart.frameId = shadow_encoder_create_frame_id(encoder);
+	GetSystemTime(&sTime);
+	cmdstart.timestamp = (UINT32)(sTime.wHour << 22U | sTime.wMinute << 16U | sTime.wSecond << 10U |
+	                              sTime.wMilliseconds);
+	cmdend.frameId = cmdstart.frameId;
+	cmd.surfaceId = client->surfaceId;
+	cmd.format = PIXEL_FORMAT_BGRX32;
+	cmd.left = nXSrc;
+	cmd.top = nYSrc;
+	cmd.right = cmd.left + nWidth;
+	cmd.bottom = cmd.top + nHeight;
+	cmd.width = nWidth;
+	cmd.height = nHeight;
+
+	if (settings->GfxAVC444 || settings->GfxAVC444v2)
 	{
 		INT32 rc;
-		REGION16 region;
-		RECTANGLE_16 regionRect;
+		RDPGFX_AVC444_BITMAP_STREAM avc444 = { 0 };
+		RECTANGLE_16 regionRect = { 0 };
+		BYTE version = settings->GfxAVC444v2 ? 2 : 1;
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PROGRESSIVE) < 0)
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC444) < 0)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PROGRESSIVE");
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC444");
 			return FALSE;
 		}
 
+		shadow_client_update_h264_rate(client, encoder->h264);
+
 		WINPR_ASSERT(cmd.left <= UINT16_MAX);
 		WINPR_ASSERT(cmd.top <= UINT16_MAX);
 		WINPR_ASSERT(cmd.right <= UINT16_MAX);
@@ -1211,58 +2025,76 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 		regionRect.top = (UINT16)cmd.top;
 		regionRect.right = (UINT16)cmd.right;
 		regionRect.bottom = (UINT16)cmd.bottom;
-		region16_init(&region);
-		region16_union_rect(&region, &region, &regionRect);
-		rc = progressive_compress(encoder->progressive, pSrcData, nSrcStep * nHeight, cmd.format,
-		                          nWidth, nHeight, nSrcStep, &region, &cmd.data, &cmd.length);
-		region16_uninit(&region);
+		rc = avc444_compress(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth, nHeight,
+		                     version, &regionRect, &avc444.LC, &avc444.bitstream[0].data,
+		                     &avc444.bitstream[0].length, &avc444.bitstream[1].data,
+		                     &avc444.bitstream[1].length, &avc444.bitstream[0].meta,
+		                     &avc444.bitstream[1].meta);
 		if (rc < 0)
 		{
-			WLog_ERR(TAG, "progressive_compress failed");
+			WLog_ERR(TAG, "avc420_compress failed for avc444");
 			return FALSE;
 		}
 
 		/* rc > 0 means new data */
 		if (rc > 0)
 		{
-			cmd.codecId = RDPGFX_CODECID_CAPROGRESSIVE;
-
+			avc444.cbAvc420EncodedBitstream1 = rdpgfx_estimate_h264_avc420(&avc444.bitstream[0]);
+			cmd.codecId = settings->GfxAVC444v2 ? RDPGFX_CODECID_AVC444v2 : RDPGFX_CODECID_AVC444;
+			cmd.extra = (void*)&avc444;
 			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
 			          &cmdend);
 		}
 
+		free_h264_metablock(&avc444.bitstream[0].meta);
+		free_h264_metablock(&avc444.bitstream[1].meta);
 		if (error)
 		{
 			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
 			return FALSE;
 		}
 	}
-	else if (freerdp_settings_get_bool(settings, FreeRDP_GfxPlanar))
+	else if (settings->GfxH264)
 	{
-		BOOL rc;
-		const UINT32 w = cmd.right - cmd.left;
-		const UINT32 h = cmd.bottom - cmd.top;
-		const BYTE* src =
-		    &pSrcData[cmd.top * nSrcStep + cmd.left * FreeRDPGetBytesPerPixel(SrcFormat)];
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_PLANAR) < 0)
+		INT32 rc;
+		RDPGFX_AVC420_BITMAP_STREAM avc420 = { 0 };
+		RECTANGLE_16 regionRect;
+
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_AVC420) < 0)
 		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_PLANAR");
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_AVC420");
 			return FALSE;
 		}
 
-		rc = freerdp_bitmap_planar_context_reset(encoder->planar, w, h);
-		WINPR_ASSERT(rc);
-		freerdp_planar_topdown_image(encoder->planar, TRUE);
+		shadow_client_update_h264_rate(client, encoder->h264);
 
-		cmd.data = freerdp_bitmap_compress_planar(encoder->planar, src, SrcFormat, w, h, nSrcStep,
-		                                          NULL, &cmd.length);
-		WINPR_ASSERT(cmd.data || (cmd.length == 0));
+		WINPR_ASSERT(cmd.left <= UINT16_MAX);
+		WINPR_ASSERT(cmd.top <= UINT16_MAX);
+		WINPR_ASSERT(cmd.right <= UINT16_MAX);
+		WINPR_ASSERT(cmd.bottom <= UINT16_MAX);
+		regionRect.left = (UINT16)cmd.left;
+		regionRect.top = (UINT16)cmd.top;
+		regionRect.right = (UINT16)cmd.right;
+		regionRect.bottom = (UINT16)cmd.bottom;
+		rc = avc420_compress(encoder->h264, pSrcData, cmd.format, nSrcStep, nWidth, nHeight,
+		                     &regionRect, &avc420.data, &avc420.length, &avc420.meta);
+		if (rc < 0)
+		{
+			WLog_ERR(TAG, "avc420_compress failed");
+			return FALSE;
+		}
+
+		/* rc > 0 means new data */
+		if (rc > 0)
+		{
+			cmd.codecId = RDPGFX_CODECID_AVC420;
+			cmd.extra = (void*)&avc420;
 
-		cmd.codecId = RDPGFX_CODECID_PLANAR;
+			IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
+			          &cmdend);
+		}
+		free_h264_metablock(&avc420.meta);
 
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-		          &cmdend);
-		free(cmd.data);
 		if (error)
 		{
 			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
@@ -1271,32 +2103,88 @@ static BOOL shadow_client_send_surface_gfx(rdpShadowClient* client, const BYTE*
 	}
 	else
 	{
-		BOOL rc;
-		const UINT32 w = cmd.right - cmd.left;
-		const UINT32 h = cmd.bottom - cmd.top;
-		const UINT32 length = w * 4 * h;
-		BYTE* data = malloc(length);
+		WINPR_ASSERT(invalidRegion);
+		return shadow_client_send_surface_gfx_tiles(client, pSrcData, nSrcStep, SrcFormat, nWidth,
+		                                            nHeight, invalidRegion, &cmdstart, &cmdend);
+	}
 
-		WINPR_ASSERT(data);
+	return TRUE;
+}
 
-		rc = freerdp_image_copy(data, PIXEL_FORMAT_BGRA32, 0, 0, 0, w, h, pSrcData, SrcFormat,
-		                        nSrcStep, cmd.left, cmd.top, NULL, 0);
-		WINPR_ASSERT(rc);
+static BOOL shadow_client_send_surface_frame_bits(rdpShadowClient* client,
+                                                  const SURFACE_BITS_COMMAND* cmd, BOOL first,
+                                                  BOOL last, UINT32 frameId)
+{
+	BOOL ret = TRUE;
+	rdpUpdate* update;
 
-		cmd.data = data;
-		cmd.length = length;
-		cmd.codecId = RDPGFX_CODECID_UNCOMPRESSED;
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(client->encoder);
+	update = client->context.update;
+	WINPR_ASSERT(update);
 
-		IFCALLRET(client->rdpgfx->SurfaceFrameCommand, error, client->rdpgfx, &cmd, &cmdstart,
-		          &cmdend);
-		free(data);
-		if (error)
+	if (!client->encoder->frameAck)
+		IFCALLRET(update->SurfaceBits, ret, update->context, cmd);
+	else
+		IFCALLRET(update->SurfaceFrameBits, ret, update->context, cmd, first, last, frameId);
+
+	return ret;
+}
+
+/**
+ * Function description
+ * Acquire every message of a shared frame. Messages are evicted independently, a frame that is
+ * not cached completely is encoded again by the caller.
+ *
+ * @return the acquired entries or NULL if the frame is not cached completely
+ */
+static SHADOW_ENCODE_CACHE_ENTRY** shadow_client_acquire_messages(rdpShadowEncodeCache* cache,
+                                                                  SHADOW_ENCODE_CACHE_KEY* key,
+                                                                  size_t* count)
+{
+	size_t i;
+	SHADOW_ENCODE_CACHE_ENTRY* first;
+	SHADOW_ENCODE_CACHE_ENTRY** entries = NULL;
+
+	WINPR_ASSERT(key);
+	WINPR_ASSERT(count);
+
+	*count = 0;
+	key->index = 0;
+	first = shadow_encode_cache_acquire(cache, key);
+
+	if (!first)
+		return NULL;
+
+	if ((first->count == 0) ||
+	    !(entries = (SHADOW_ENCODE_CACHE_ENTRY**)calloc(first->count, sizeof(*entries))))
+	{
+		shadow_encode_cache_release(first);
+		return NULL;
+	}
+
+	entries[0] = first;
+
+	for (i = 1; i < first->count; i++)
+	{
+		key->index = (UINT32)i;
+
+		if (!(entries[i] = shadow_encode_cache_acquire(cache, key)))
 		{
-			WLog_ERR(TAG, "SurfaceFrameCommand failed with error %" PRIu32 "", error);
-			return FALSE;
+			WLog_DBG(TAG, "Shared message %" PRIuz " evicted, encoding again", i);
+
+			while (i > 0)
+				shadow_encode_cache_release(entries[--i]);
+
+			free(entries);
+			key->index = 0;
+			return NULL;
 		}
 	}
-	return TRUE;
+
+	key->index = 0;
+	*count = first->count;
+	return entries;
 }
 
 /**
@@ -1319,6 +2207,10 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 	rdpContext* context = (rdpContext*)client;
 	rdpSettings* settings;
 	rdpShadowEncoder* encoder;
+	rdpShadowEncodeCache* cache;
+	SHADOW_ENCODE_CACHE_KEY key;
+	SHADOW_ENCODE_CACHE_ENTRY* entry;
+	SHADOW_ENCODE_CACHE_ENTRY** entries;
 	SURFACE_BITS_COMMAND cmd = { 0 };
 	UINT32 nsID, rfxID;
 
@@ -1335,6 +2227,7 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 	if (encoder->frameAck)
 		frameId = shadow_encoder_create_frame_id(encoder);
 
+	cache = client->server->encodeCache;
 	nsID = freerdp_settings_get_uint32(settings, FreeRDP_NSCodecId);
 	rfxID = freerdp_settings_get_uint32(settings, FreeRDP_RemoteFxCodecId);
 	if (freerdp_settings_get_bool(settings, FreeRDP_RemoteFxCodec) && (rfxID != 0))
@@ -1343,26 +2236,6 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		RFX_MESSAGE* messages;
 		RFX_RECT* messageRects = NULL;
 
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
-		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
-			return FALSE;
-		}
-
-		s = encoder->bs;
-		rect.x = nXSrc;
-		rect.y = nYSrc;
-		rect.width = nWidth;
-		rect.height = nHeight;
-
-		if (!(messages = rfx_encode_messages(
-		          encoder->rfx, &rect, 1, pSrcData, settings->DesktopWidth, settings->DesktopHeight,
-		          nSrcStep, &numMessages, settings->MultifragMaxRequestSize)))
-		{
-			WLog_ERR(TAG, "rfx_encode_messages failed");
-			return FALSE;
-		}
-
 		cmd.cmdType = CMDTYPE_STREAM_SURFACE_BITS;
 		WINPR_ASSERT(rfxID <= UINT16_MAX);
 		cmd.bmp.codecID = (UINT16)rfxID;
@@ -1378,60 +2251,111 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		cmd.bmp.height = (UINT16)settings->DesktopHeight;
 		cmd.skipCompression = TRUE;
 
-		if (numMessages > 0)
-			messageRects = messages[0].rects;
-
-		for (i = 0; i < numMessages; i++)
+		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_REMOTEFX) < 0)
 		{
-			Stream_SetPosition(s, 0);
+			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_REMOTEFX");
+			return FALSE;
+		}
 
-			if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+		/* The message split depends on the client request size limit */
+		shadow_client_encode_cache_key(client, FALSE, rfxID, client->server->rfxMode,
+		                               settings->MultifragMaxRequestSize, nXSrc, nYSrc, nWidth,
+		                               nHeight, &key);
+		key.headers = shadow_client_rfx_headers_pending(client);
+		entries = shadow_client_acquire_messages(cache, &key, &numMessages);
+
+		if (entries)
+		{
+			for (i = 0; i < numMessages; i++)
 			{
-				while (i < numMessages)
+				cmd.bmp.bitmapDataLength = entries[i]->length;
+				cmd.bmp.bitmapData = entries[i]->data;
+				first = (i == 0) ? TRUE : FALSE;
+				last = ((i + 1) == numMessages) ? TRUE : FALSE;
+				ret = shadow_client_send_surface_frame_bits(client, &cmd, first, last, frameId);
+
+				if (!ret)
 				{
-					rfx_message_free(encoder->rfx, &messages[i++]);
+					WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
+					break;
 				}
-
-				WLog_ERR(TAG, "rfx_write_message failed");
-				ret = FALSE;
-				break;
 			}
 
-			rfx_message_free(encoder->rfx, &messages[i]);
-			WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
-			cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
-			cmd.bmp.bitmapData = Stream_Buffer(s);
-			first = (i == 0) ? TRUE : FALSE;
-			last = ((i + 1) == numMessages) ? TRUE : FALSE;
+			for (i = 0; i < numMessages; i++)
+				shadow_encode_cache_release(entries[i]);
 
-			if (!encoder->frameAck)
-				IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
-			else
-				IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last,
-				          frameId);
+			free(entries);
 
-			if (!ret)
+			if (ret && key.headers)
+				shadow_client_rfx_headers_sent(client);
+		}
+		else
+		{
+			s = encoder->bs;
+			rect.x = nXSrc;
+			rect.y = nYSrc;
+			rect.width = nWidth;
+			rect.height = nHeight;
+
+			if (!(messages = rfx_encode_messages(encoder->rfx, &rect, 1, pSrcData,
+			                                     settings->DesktopWidth, settings->DesktopHeight,
+			                                     nSrcStep, &numMessages,
+			                                     settings->MultifragMaxRequestSize)))
 			{
-				WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
-				break;
+				WLog_ERR(TAG, "rfx_encode_messages failed");
+				return FALSE;
+			}
+
+			if (numMessages > 0)
+				messageRects = messages[0].rects;
+
+			for (i = 0; i < numMessages; i++)
+			{
+				Stream_SetPosition(s, 0);
+
+				if (!rfx_write_message(encoder->rfx, s, &messages[i]))
+				{
+					while (i < numMessages)
+					{
+						rfx_message_free(encoder->rfx, &messages[i++]);
+					}
+
+					WLog_ERR(TAG, "rfx_write_message failed");
+					ret = FALSE;
+					break;
+				}
+
+				rfx_message_free(encoder->rfx, &messages[i]);
+				WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
+				cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
+				cmd.bmp.bitmapData = Stream_Buffer(s);
+				first = (i == 0) ? TRUE : FALSE;
+				last = ((i + 1) == numMessages) ? TRUE : FALSE;
+
+				key.index = (UINT32)i;
+				shadow_encode_cache_store(cache, &key, cmd.bmp.bitmapData,
+				                          cmd.bmp.bitmapDataLength, (UINT32)numMessages);
+
+				ret = shadow_client_send_surface_frame_bits(client, &cmd, first, last, frameId);
+
+				if (!ret)
+				{
+					WLog_ERR(TAG, "Send surface bits(RemoteFxCodec) failed");
+					break;
+				}
 			}
-		}
 
-		free(messageRects);
-		free(messages);
+			free(messageRects);
+			free(messages);
+		}
 	}
 	if (freerdp_settings_get_bool(settings, FreeRDP_NSCodec) && (nsID != 0))
 	{
-		if (shadow_encoder_prepare(encoder, FREERDP_CODEC_NSCODEC) < 0)
-		{
-			WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_NSCODEC");
-			return FALSE;
-		}
+		const UINT32 nscFlags =
+		    (settings->NSCodecColorLossLevel & 0xFF) |
+		    (settings->NSCodecAllowSubsampling ? 0x100 : 0) |
+		    (settings->NSCodecAllowDynamicColorFidelity ? 0x200 : 0);
 
-		s = encoder->bs;
-		Stream_SetPosition(s, 0);
-		pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
-		nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
 		cmd.cmdType = CMDTYPE_SET_SURFACE_BITS;
 		cmd.bmp.bpp = 32;
 		WINPR_ASSERT(nsID <= UINT16_MAX);
@@ -1442,16 +2366,39 @@ static BOOL shadow_client_send_surface_bits(rdpShadowClient* client, BYTE* pSrcD
 		cmd.destBottom = cmd.destTop + nHeight;
 		cmd.bmp.width = nWidth;
 		cmd.bmp.height = nHeight;
-		WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
-		cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
-		cmd.bmp.bitmapData = Stream_Buffer(s);
-		first = TRUE;
-		last = TRUE;
 
-		if (!encoder->frameAck)
-			IFCALLRET(update->SurfaceBits, ret, update->context, &cmd);
+		shadow_client_encode_cache_key(client, FALSE, nsID, nscFlags, 0, nXSrc, nYSrc, nWidth,
+		                               nHeight, &key);
+		entry = shadow_encode_cache_acquire(cache, &key);
+
+		if (entry)
+		{
+			cmd.bmp.bitmapDataLength = entry->length;
+			cmd.bmp.bitmapData = entry->data;
+		}
 		else
-			IFCALLRET(update->SurfaceFrameBits, ret, update->context, &cmd, first, last, frameId);
+		{
+			if (shadow_encoder_prepare(encoder, FREERDP_CODEC_NSCODEC) < 0)
+			{
+				WLog_ERR(TAG, "Failed to prepare encoder FREERDP_CODEC_NSCODEC");
+				return FALSE;
+			}
+
+			s = encoder->bs;
+			Stream_SetPosition(s, 0);
+			pSrcData = &pSrcData[(nYSrc * nSrcStep) + (nXSrc * 4)];
+			nsc_compose_message(encoder->nsc, s, pSrcData, nWidth, nHeight, nSrcStep);
+			WINPR_ASSERT(Stream_GetPosition(s) <= UINT32_MAX);
+			cmd.bmp.bitmapDataLength = (UINT32)Stream_GetPosition(s);
+			cmd.bmp.bitmapData = Stream_Buffer(s);
+			shadow_encode_cache_store(cache, &key, cmd.bmp.bitmapData, cmd.bmp.bitmapDataLength,
+			                          1);
+		}
+
+		first = TRUE;
+		last = TRUE;
+		ret = shadow_client_send_surface_frame_bits(client, &cmd, first, last, frameId);
+		shadow_encode_cache_release(entry);
 
 		if (!ret)
 		{
@@ -1682,6 +2629,63 @@ out:
 	return ret;
 }
 
+/**
+ * Function description
+ * Take the next queued frame to encode and the region to send from it. The
+ * last frame is kept to serve refresh requests while nothing is queued.
+ *
+ * @return TRUE on success
+ */
+static BOOL shadow_client_next_frame(rdpShadowClient* client, REGION16* region)
+{
+	BOOL rc = TRUE;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects;
+	rdpShadowFrame* frame = NULL;
+	rdpShadowServer* server;
+	rdpShadowSurface* surface;
+
+	WINPR_ASSERT(client);
+	WINPR_ASSERT(region);
+	server = client->server;
+	WINPR_ASSERT(server);
+	surface = client->inLobby ? server->lobby : server->surface;
+
+	while (shadow_frame_queue_pop(client->encodeQueue, &frame, region))
+	{
+		if (frame && (frame->surface == surface))
+		{
+			shadow_frame_release(client->frame);
+			client->frame = frame;
+			break;
+		}
+
+		/* Left over from before the client entered or left the lobby */
+		shadow_frame_release(frame);
+		frame = NULL;
+		region16_clear(region);
+	}
+
+	if (client->frame && (client->frame->surface != surface))
+	{
+		shadow_frame_release(client->frame);
+		client->frame = NULL;
+	}
+
+	if (!client->frame && !(client->frame = shadow_frame_acquire(surface, server->encodeCache)))
+		return FALSE;
+
+	EnterCriticalSection(&(client->lock));
+	rects = region16_rects(&(client->invalidRegion), &numRects);
+
+	for (UINT32 index = 0; rc && (index < numRects); index++)
+		rc = region16_union_rect(region, region, &rects[index]);
+
+	region16_clear(&(client->invalidRegion));
+	LeaveCriticalSection(&(client->lock));
+	return rc;
+}
+
 /**
  * Function description
  *
@@ -1695,7 +2699,6 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	rdpContext* context = (rdpContext*)client;
 	rdpSettings* settings;
 	rdpShadowServer* server;
-	rdpShadowSurface* surface;
 	REGION16 invalidRegion;
 	RECTANGLE_16 surfaceRect;
 	const RECTANGLE_16* extents;
@@ -1714,29 +2717,20 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	if (!settings || !server)
 		return FALSE;
 
-	surface = client->inLobby ? server->lobby : server->surface;
-
-	if (!surface)
-		return FALSE;
-
-	EnterCriticalSection(&(client->lock));
 	region16_init(&invalidRegion);
-	region16_copy(&invalidRegion, &(client->invalidRegion));
-	region16_clear(&(client->invalidRegion));
-	LeaveCriticalSection(&(client->lock));
-
-	EnterCriticalSection(&surface->lock);
-	rects = region16_rects(&(surface->invalidRegion), &numRects);
 
-	for (index = 0; index < numRects; index++)
-		region16_union_rect(&invalidRegion, &invalidRegion, &rects[index]);
+	if (!shadow_client_next_frame(client, &invalidRegion))
+	{
+		ret = FALSE;
+		goto out;
+	}
 
 	surfaceRect.left = 0;
 	surfaceRect.top = 0;
-	WINPR_ASSERT(surface->width <= UINT16_MAX);
-	WINPR_ASSERT(surface->height <= UINT16_MAX);
-	surfaceRect.right = (UINT16)surface->width;
-	surfaceRect.bottom = (UINT16)surface->height;
+	WINPR_ASSERT(client->frame->width <= UINT16_MAX);
+	WINPR_ASSERT(client->frame->height <= UINT16_MAX);
+	surfaceRect.right = (UINT16)client->frame->width;
+	surfaceRect.bottom = (UINT16)client->frame->height;
 	region16_intersect_rect(&invalidRegion, &invalidRegion, &surfaceRect);
 
 	if (server->shareSubRect)
@@ -1755,9 +2749,9 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	nYSrc = extents->top;
 	nWidth = extents->right - extents->left;
 	nHeight = extents->bottom - extents->top;
-	pSrcData = surface->data;
-	nSrcStep = surface->scanline;
-	SrcFormat = surface->format;
+	pSrcData = client->frame->data;
+	nSrcStep = client->frame->scanline;
+	SrcFormat = client->frame->format;
 
 	/* Move to new pSrcData / nXSrc / nYSrc according to sub rect */
 	if (server->shareSubRect)
@@ -1779,9 +2773,19 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 
 	if (settings->SupportGraphicsPipeline && pStatus->gfxOpened)
 	{
+		REGION16 gfxRegion;
+		RECTANGLE_16 gfxRect = { 0 };
+		BOOL surfaceCreated = FALSE;
+
 		/* GFX/h264 always full screen encoded */
 		nWidth = settings->DesktopWidth;
 		nHeight = settings->DesktopHeight;
+		WINPR_ASSERT(nWidth >= 0);
+		WINPR_ASSERT(nWidth <= UINT16_MAX);
+		WINPR_ASSERT(nHeight >= 0);
+		WINPR_ASSERT(nHeight <= UINT16_MAX);
+		gfxRect.right = (UINT16)nWidth;
+		gfxRect.bottom = (UINT16)nHeight;
 
 		/* Create primary surface if have not */
 		if (!pStatus->gfxSurfaceCreated)
@@ -1794,14 +2798,43 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 				goto out;
 
 			pStatus->gfxSurfaceCreated = TRUE;
+			surfaceCreated = TRUE;
+		}
+
+		region16_init(&gfxRegion);
+
+		if (surfaceCreated)
+		{
+			/* The new surface is blank, send all of it */
+			shadow_tile_cache_reset(client->encoder->tileCache);
+			region16_union_rect(&gfxRegion, &gfxRegion, &gfxRect);
+		}
+		else
+		{
+			/* Codecs other than H.264 only encode the invalid region, in surface coordinates */
+			rects = region16_rects(&invalidRegion, &numRects);
+
+			for (index = 0; index < numRects; index++)
+			{
+				RECTANGLE_16 rect = rects[index];
+
+				if (server->shareSubRect)
+				{
+					rect.left -= server->subRect.left;
+					rect.top -= server->subRect.top;
+					rect.right -= server->subRect.left;
+					rect.bottom -= server->subRect.top;
+				}
+
+				region16_union_rect(&gfxRegion, &gfxRegion, &rect);
+			}
+
+			region16_intersect_rect(&gfxRegion, &gfxRegion, &gfxRect);
 		}
 
-		WINPR_ASSERT(nWidth >= 0);
-		WINPR_ASSERT(nWidth <= UINT16_MAX);
-		WINPR_ASSERT(nHeight >= 0);
-		WINPR_ASSERT(nHeight <= UINT16_MAX);
 		ret = shadow_client_send_surface_gfx(client, pSrcData, nSrcStep, SrcFormat, 0, 0,
-		                                     (UINT16)nWidth, (UINT16)nHeight);
+		                                     (UINT16)nWidth, (UINT16)nHeight, &gfxRegion);
+		region16_uninit(&gfxRegion);
 	}
 	else if (settings->RemoteFxCodec || freerdp_settings_get_bool(settings, FreeRDP_NSCodec))
 	{
@@ -1831,7 +2864,6 @@ static BOOL shadow_client_send_surface_update(rdpShadowClient* client, SHADOW_GF
 	}
 
 out:
-	LeaveCriticalSection(&surface->lock);
 	region16_uninit(&invalidRegion);
 	return ret;
 }
@@ -1888,6 +2920,12 @@ static BOOL shadow_client_send_resize(rdpShadowClient* client, SHADOW_GFX_STATUS
 	EnterCriticalSection(&(client->lock));
 	region16_clear(&(client->invalidRegion));
 	LeaveCriticalSection(&(client->lock));
+
+	/* Frames of the old size are not sent any more */
+	shadow_frame_queue_clear(client->encodeQueue);
+	shadow_frame_queue_clear(client->sendQueue);
+	shadow_frame_release(client->frame);
+	client->frame = NULL;
 	WLog_INFO(TAG, "Client from %s is resized (%" PRIu32 "x%" PRIu32 "@%" PRIu32 ")",
 	          peer->hostname, settings->DesktopWidth, settings->DesktopHeight,
 	          freerdp_settings_get_uint32(settings, FreeRDP_ColorDepth));
@@ -1896,36 +2934,79 @@ static BOOL shadow_client_send_resize(rdpShadowClient* client, SHADOW_GFX_STATUS
 
 /**
  * Function description
- * Mark invalid region for client
+ * Queue the frame published with the update event for encoding. Called while
+ * handling the update event, the snapshot is shared with the other clients so
+ * the capture is not held up by this client. The lobby is not updated, its
+ * clients are served from a snapshot of the lobby taken on refresh.
  *
  * @return TRUE on success
  */
-static BOOL shadow_client_surface_update(rdpShadowClient* client, REGION16* region)
+static BOOL shadow_client_queue_frame(rdpShadowClient* client)
 {
-	UINT32 numRects = 0;
-	const RECTANGLE_16* rects;
-	rects = region16_rects(region, &numRects);
-	shadow_client_mark_invalid(client, numRects, rects);
-	return TRUE;
+	BOOL rc = TRUE;
+	rdpShadowFrame* frame;
+	rdpShadowServer* server;
+	rdpShadowSurface* surface;
+
+	WINPR_ASSERT(client);
+	server = client->server;
+	WINPR_ASSERT(server);
+	surface = server->surface;
+
+	if (client->inLobby || !surface)
+		return TRUE;
+
+	EnterCriticalSection(&surface->lock);
+
+	if (!region16_is_empty(&(surface->invalidRegion)))
+	{
+		frame = shadow_frame_acquire(surface, server->encodeCache);
+		rc = frame &&
+		     shadow_frame_queue_push(client->encodeQueue, frame, 0, &(surface->invalidRegion));
+		shadow_frame_release(frame);
+	}
+
+	LeaveCriticalSection(&surface->lock);
+	return rc;
 }
 
 /**
  * Function description
- * Only union invalid region from server surface
+ * Queued frames are encoded at most at the preferred frame rate of the
+ * encoder and only while the client keeps up with acknowledging frames and
+ * the transport accepts data. A client falling behind fills its encode queue,
+ * which then drops the oldest frames and merges their changes into the next.
  *
- * @return TRUE on success
+ * @return milliseconds until the next frame is due, INFINITE if there is none
  */
-static INLINE BOOL shadow_client_no_surface_update(rdpShadowClient* client,
-                                                   SHADOW_GFX_STATUS* pStatus)
+static DWORD shadow_client_frame_delay(rdpShadowClient* client)
 {
-	rdpShadowServer* server;
-	rdpShadowSurface* surface;
-	WINPR_UNUSED(pStatus);
+	BOOL pending;
+	BOOL backpressure;
+	UINT64 blockedSince;
+	freerdp_peer* peer;
+
 	WINPR_ASSERT(client);
-	server = client->server;
-	WINPR_ASSERT(server);
-	surface = client->inLobby ? server->lobby : server->surface;
-	return shadow_client_surface_update(client, &(surface->invalidRegion));
+	WINPR_ASSERT(client->encoder);
+	peer = client->context.peer;
+	WINPR_ASSERT(peer);
+
+	if (!client->activated || client->suppressOutput)
+		return INFINITE;
+
+	EnterCriticalSection(&(client->lock));
+	pending = !region16_is_empty(&(client->invalidRegion));
+	LeaveCriticalSection(&(client->lock));
+
+	if (!pending && (shadow_frame_queue_count(client->encodeQueue) == 0))
+		return INFINITE;
+
+	/* A full send queue holds back from its oldest frame, a blocked transport from the last */
+	blockedSince = client->lastFrameTime;
+	backpressure = shadow_frame_queue_full(client->sendQueue, &blockedSince) ||
+	               (peer->IsWriteBlocked && peer->IsWriteBlocked(peer));
+	return shadow_frame_pacing_delay(GetTickCount64(), client->lastFrameTime, client->encoder->fps,
+	                                 backpressure, blockedSince, SHADOW_CLIENT_MAX_FRAME_DELAY);
 }
 
 static int shadow_client_subsystem_process_message(rdpShadowClient* client, wMessage* message)
@@ -2120,6 +3201,16 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 
 	while (1)
 	{
+		DWORD timeout = shadow_client_frame_delay(client);
+		const BOOL upgrade = (timeout == INFINITE) && client->activated &&
+		                     !client->suppressOutput && gfxstatus.gfxSurfaceCreated &&
+		                     client->encoder->progressive &&
+		                     (progressive_compress_pending(client->encoder->progressive) > 0);
+
+		/* Pending progressive upgrades are sent when no new frame arrives in time */
+		if (upgrade)
+			timeout = 1000 / MAX(client->encoder->fps, 1);
+
 		nCount = 0;
 		events[nCount++] = UpdateEvent;
 		{
@@ -2135,11 +3226,22 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 		}
 		events[nCount++] = ChannelEvent;
 		events[nCount++] = MessageQueue_Event(MsgQueue);
-		status = WaitForMultipleObjects(nCount, events, FALSE, INFINITE);
+		status = WaitForMultipleObjects(nCount, events, FALSE, timeout);
 
 		if (status == WAIT_FAILED)
 			goto fail;
 
+		/* Only upgrade when the client keeps up, the frame acks throttle the upgrade rate */
+		if ((status == WAIT_TIMEOUT) && upgrade &&
+		    (shadow_encoder_inflight_frames(client->encoder) <= 1))
+		{
+			if (!shadow_client_send_gfx_upgrade(client))
+			{
+				WLog_ERR(TAG, "Failed to send progressive upgrade");
+				break;
+			}
+		}
+
 		if (WaitForSingleObject(UpdateEvent, 0) == WAIT_OBJECT_0)
 		{
 			/* The UpdateEvent means to start sending current frame. It is
@@ -2149,36 +3251,22 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 			 * (at shadow_multiclient_consume). As best practice, subsystem
 			 * implementation should invoke shadow_subsystem_frame_update which
 			 * triggers the event and then wait for completion */
-			if (client->activated && !client->suppressOutput)
+			if (client->activated && !client->suppressOutput &&
+			    shadow_client_recalc_desktop_size(client))
 			{
-				/* Send screen update or resize to this client */
-
-				/* Check resize */
-				if (shadow_client_recalc_desktop_size(client))
-				{
-					/* Screen size changed, do resize */
-					if (!shadow_client_send_resize(client, &gfxstatus))
-					{
-						WLog_ERR(TAG, "Failed to send resize message");
-						break;
-					}
-				}
-				else
+				/* Screen size changed, do resize */
+				if (!shadow_client_send_resize(client, &gfxstatus))
 				{
-					/* Send frame */
-					if (!shadow_client_send_surface_update(client, &gfxstatus))
-					{
-						WLog_ERR(TAG, "Failed to send surface update");
-						break;
-					}
+					WLog_ERR(TAG, "Failed to send resize message");
+					break;
 				}
 			}
 			else
 			{
-				/* Our client don't receive graphic updates. Just save the invalid region */
-				if (!shadow_client_no_surface_update(client, &gfxstatus))
+				/* The frame is encoded after the capture is released */
+				if (!shadow_client_queue_frame(client))
 				{
-					WLog_ERR(TAG, "Failed to handle surface update");
+					WLog_ERR(TAG, "Failed to queue surface update");
 					break;
 				}
 			}
@@ -2190,6 +3278,28 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 			(void)shadow_multiclient_consume(UpdateSubscriber);
 		}
 
+		if (shadow_client_frame_delay(client) == 0)
+		{
+			const UINT32 frameId = client->encoder->frameId;
+
+			if (!shadow_client_send_surface_update(client, &gfxstatus))
+			{
+				WLog_ERR(TAG, "Failed to send surface update");
+				break;
+			}
+
+			/* A frame the client acknowledges is in flight until it does */
+			if ((client->encoder->frameId != frameId) &&
+			    (client->encoder->queueDepth != SUSPEND_FRAME_ACKNOWLEDGEMENT) &&
+			    !shadow_frame_queue_push(client->sendQueue, NULL, client->encoder->frameId, NULL))
+			{
+				WLog_ERR(TAG, "Failed to queue sent frame");
+				break;
+			}
+
+			client->lastFrameTime = GetTickCount64();
+		}
+
 		WINPR_ASSERT(peer->CheckFileDescriptor);
 		if (!peer->CheckFileDescriptor(peer))
 		{
@@ -2232,6 +3342,8 @@ static DWORD WINAPI shadow_client_thread(LPVOID arg)
 							client->rdpgfx->FrameAcknowledge =
 							    shadow_client_rdpgfx_frame_acknowledge;
 							client->rdpgfx->CapsAdvertise = shadow_client_rdpgfx_caps_advertise;
+							client->rdpgfx->CacheImportOffer =
+							    shadow_client_rdpgfx_cache_import_offer;
 
 							if (!client->rdpgfx->Open(client->rdpgfx))
 							{
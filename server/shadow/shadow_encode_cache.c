@@ -0,0 +1,395 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+
+#include <freerdp/log.h>
+#include "shadow.h"
+
+#include "shadow_encode_cache.h"
+
+#define TAG SERVER_TAG("shadow.encodecache")
+
+typedef struct
+{
+	UINT32 frameId;
+	size_t holders;
+} SHADOW_ENCODE_CACHE_FRAME;
+
+struct rdp_shadow_encode_cache
+{
+	wArrayList* entries; /* oldest first */
+	size_t usedBytes;
+	size_t maxBytes;
+	UINT32 frameId; /* frame published last */
+
+	/* Frames held by clients */
+	SHADOW_ENCODE_CACHE_FRAME* frames;
+	size_t numFrames;
+	size_t maxFrames;
+
+	/* Statistics, reported on every frame change */
+	UINT64 hits;
+	UINT64 misses;
+	UINT64 evictions;
+};
+
+static BOOL shadow_encode_cache_key_equals(const SHADOW_ENCODE_CACHE_KEY* a,
+                                           const SHADOW_ENCODE_CACHE_KEY* b)
+{
+	WINPR_ASSERT(a);
+	WINPR_ASSERT(b);
+
+	return (a->surface == b->surface) && (a->gfx == b->gfx) && (a->codecId == b->codecId) &&
+	       (a->codecFlags == b->codecFlags) && (a->codecParam == b->codecParam) &&
+	       (a->headers == b->headers) &&
+	       (a->rect.left == b->rect.left) && (a->rect.top == b->rect.top) &&
+	       (a->rect.right == b->rect.right) && (a->rect.bottom == b->rect.bottom) &&
+	       (a->index == b->index) && (a->frameId == b->frameId) &&
+	       (a->numRects == b->numRects) &&
+	       ((a->numRects == 0) ||
+	        (memcmp(a->rects, b->rects, a->numRects * sizeof(RECTANGLE_16)) == 0));
+}
+
+static void shadow_encode_cache_entry_free(void* obj)
+{
+	shadow_encode_cache_release((SHADOW_ENCODE_CACHE_ENTRY*)obj);
+}
+
+static void shadow_encode_cache_remove_at(rdpShadowEncodeCache* cache, size_t index)
+{
+	const SHADOW_ENCODE_CACHE_ENTRY* entry =
+	    (const SHADOW_ENCODE_CACHE_ENTRY*)ArrayList_GetItem(cache->entries, index);
+	WINPR_ASSERT(entry);
+
+	/* Entries still referenced by a sending client are freed on release */
+	cache->usedBytes -= entry->length;
+	ArrayList_RemoveAt(cache->entries, index);
+}
+
+/* Called with the entries locked */
+static void shadow_encode_cache_drop_frame(rdpShadowEncodeCache* cache, UINT32 frameId)
+{
+	size_t index = ArrayList_Count(cache->entries);
+
+	while (index > 0)
+	{
+		const SHADOW_ENCODE_CACHE_ENTRY* entry =
+		    (const SHADOW_ENCODE_CACHE_ENTRY*)ArrayList_GetItem(cache->entries, --index);
+		WINPR_ASSERT(entry);
+
+		if (entry->key.frameId == frameId)
+			shadow_encode_cache_remove_at(cache, index);
+	}
+}
+
+/* Called with the entries locked */
+static SHADOW_ENCODE_CACHE_FRAME* shadow_encode_cache_find_frame(rdpShadowEncodeCache* cache,
+                                                                 UINT32 frameId)
+{
+	size_t index;
+
+	for (index = 0; index < cache->numFrames; index++)
+	{
+		if (cache->frames[index].frameId == frameId)
+			return &cache->frames[index];
+	}
+
+	return NULL;
+}
+
+/* Called with the entries locked */
+static BOOL shadow_encode_cache_hold_frame(rdpShadowEncodeCache* cache, UINT32 frameId)
+{
+	SHADOW_ENCODE_CACHE_FRAME* frame = shadow_encode_cache_find_frame(cache, frameId);
+
+	if (!frame)
+	{
+		if (cache->numFrames >= cache->maxFrames)
+		{
+			const size_t count = cache->maxFrames * 2 + 4;
+			SHADOW_ENCODE_CACHE_FRAME* tmp = (SHADOW_ENCODE_CACHE_FRAME*)realloc(
+			    cache->frames, count * sizeof(SHADOW_ENCODE_CACHE_FRAME));
+
+			if (!tmp)
+				return FALSE;
+
+			cache->frames = tmp;
+			cache->maxFrames = count;
+		}
+
+		frame = &cache->frames[cache->numFrames++];
+		frame->frameId = frameId;
+		frame->holders = 0;
+	}
+
+	frame->holders++;
+	return TRUE;
+}
+
+/* Called with the entries locked */
+static void shadow_encode_cache_unhold_frame(rdpShadowEncodeCache* cache, UINT32 frameId)
+{
+	SHADOW_ENCODE_CACHE_FRAME* frame = shadow_encode_cache_find_frame(cache, frameId);
+
+	if (!frame)
+		return;
+
+	WINPR_ASSERT(frame->holders > 0);
+
+	if (--frame->holders > 0)
+		return;
+
+	*frame = cache->frames[--cache->numFrames];
+
+	/* The current frame is kept for clients staging it later */
+	if (frameId != cache->frameId)
+		shadow_encode_cache_drop_frame(cache, frameId);
+}
+
+rdpShadowEncodeCache* shadow_encode_cache_new(size_t maxBytes)
+{
+	wObject* obj;
+	rdpShadowEncodeCache* cache = (rdpShadowEncodeCache*)calloc(1, sizeof(rdpShadowEncodeCache));
+
+	if (!cache)
+		return NULL;
+
+	cache->entries = ArrayList_New(TRUE);
+
+	if (!cache->entries)
+	{
+		free(cache);
+		return NULL;
+	}
+
+	obj = ArrayList_Object(cache->entries);
+	WINPR_ASSERT(obj);
+	obj->fnObjectFree = shadow_encode_cache_entry_free;
+	cache->maxBytes = maxBytes;
+	cache->frameId = 1; /* 0 is no frame */
+	return cache;
+}
+
+void shadow_encode_cache_free(rdpShadowEncodeCache* cache)
+{
+	if (!cache)
+		return;
+
+	ArrayList_Free(cache->entries);
+	free(cache->frames);
+	free(cache);
+}
+
+/**
+ * Publish a new frame. The entries of the previous frame are dropped unless a client still
+ * holds it.
+ *
+ * @return the id of the new frame
+ */
+UINT32 shadow_encode_cache_advance(rdpShadowEncodeCache* cache)
+{
+	UINT32 frameId;
+
+	if (!cache)
+		return 0;
+
+	ArrayList_Lock(cache->entries);
+
+	if (cache->hits > 0)
+		WLog_VRB(TAG,
+		         "frame %" PRIu32 ": %" PRIu64 " shared, %" PRIu64 " encoded, %" PRIu64
+		         " evicted, %" PRIuz " frames held",
+		         cache->frameId, cache->hits, cache->misses, cache->evictions, cache->numFrames);
+
+	if (!shadow_encode_cache_find_frame(cache, cache->frameId))
+		shadow_encode_cache_drop_frame(cache, cache->frameId);
+
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
+	cache->frameId++;
+
+	if (cache->frameId == 0)
+		cache->frameId = 1;
+
+	frameId = cache->frameId;
+	ArrayList_Unlock(cache->entries);
+	return frameId;
+}
+
+/**
+ * Hold the current frame until it is released, a surface snapshot holds the frame it was
+ * taken for. The previously held frame is released.
+ *
+ * @return the id of the held frame, 0 if none could be held
+ */
+UINT32 shadow_encode_cache_frame_acquire(rdpShadowEncodeCache* cache, UINT32 previous)
+{
+	UINT32 frameId;
+
+	if (!cache)
+		return 0;
+
+	ArrayList_Lock(cache->entries);
+	frameId = cache->frameId;
+
+	if (frameId != previous)
+	{
+		if (!shadow_encode_cache_hold_frame(cache, frameId))
+			frameId = 0;
+
+		shadow_encode_cache_unhold_frame(cache, previous);
+	}
+
+	ArrayList_Unlock(cache->entries);
+	return frameId;
+}
+
+void shadow_encode_cache_frame_release(rdpShadowEncodeCache* cache, UINT32 frameId)
+{
+	if (!cache || (frameId == 0))
+		return;
+
+	ArrayList_Lock(cache->entries);
+	shadow_encode_cache_unhold_frame(cache, frameId);
+	ArrayList_Unlock(cache->entries);
+}
+
+SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_acquire(rdpShadowEncodeCache* cache,
+                                                       const SHADOW_ENCODE_CACHE_KEY* key)
+{
+	size_t index;
+	SHADOW_ENCODE_CACHE_ENTRY* found = NULL;
+
+	if (!cache || !key)
+		return NULL;
+
+	ArrayList_Lock(cache->entries);
+
+	for (index = 0; index < ArrayList_Count(cache->entries); index++)
+	{
+		SHADOW_ENCODE_CACHE_ENTRY* entry =
+		    (SHADOW_ENCODE_CACHE_ENTRY*)ArrayList_GetItem(cache->entries, index);
+		WINPR_ASSERT(entry);
+
+		if (shadow_encode_cache_key_equals(&entry->key, key))
+		{
+			InterlockedIncrement(&entry->refCount);
+			found = entry;
+			break;
+		}
+	}
+
+	if (found)
+		cache->hits++;
+	else
+		cache->misses++;
+
+	ArrayList_Unlock(cache->entries);
+	return found;
+}
+
+BOOL shadow_encode_cache_store(rdpShadowEncodeCache* cache, const SHADOW_ENCODE_CACHE_KEY* key,
+                               const BYTE* data, UINT32 length, UINT32 count)
+{
+	BOOL rc = FALSE;
+	SHADOW_ENCODE_CACHE_ENTRY* entry;
+
+	if (!cache || !key || (!data && (length > 0)) || (length > cache->maxBytes))
+		return FALSE;
+
+	entry = (SHADOW_ENCODE_CACHE_ENTRY*)calloc(1, sizeof(SHADOW_ENCODE_CACHE_ENTRY));
+
+	if (!entry)
+		return FALSE;
+
+	if (length > 0)
+	{
+		entry->data = (BYTE*)malloc(length);
+
+		if (!entry->data)
+		{
+			free(entry);
+			return FALSE;
+		}
+
+		CopyMemory(entry->data, data, length);
+	}
+
+	entry->key = *key;
+	entry->key.rects = NULL;
+
+	if (key->numRects > 0)
+	{
+		RECTANGLE_16* rects = (RECTANGLE_16*)calloc(key->numRects, sizeof(RECTANGLE_16));
+
+		if (!rects)
+		{
+			free(entry->data);
+			free(entry);
+			return FALSE;
+		}
+
+		CopyMemory(rects, key->rects, key->numRects * sizeof(RECTANGLE_16));
+		entry->key.rects = rects;
+	}
+
+	entry->length = length;
+	entry->count = count;
+	entry->refCount = 1;
+
+	ArrayList_Lock(cache->entries);
+
+	/* Nobody would look up entries of a frame that is neither current nor held */
+	if ((key->frameId == cache->frameId) || shadow_encode_cache_find_frame(cache, key->frameId))
+	{
+		while ((cache->usedBytes + length > cache->maxBytes) &&
+		       (ArrayList_Count(cache->entries) > 0))
+		{
+			shadow_encode_cache_remove_at(cache, 0);
+			cache->evictions++;
+		}
+
+		rc = ArrayList_Append(cache->entries, entry);
+
+		if (rc)
+			cache->usedBytes += length;
+	}
+
+	ArrayList_Unlock(cache->entries);
+
+	if (!rc)
+		shadow_encode_cache_release(entry);
+
+	return rc;
+}
+
+void shadow_encode_cache_release(SHADOW_ENCODE_CACHE_ENTRY* entry)
+{
+	if (!entry)
+		return;
+
+	if (InterlockedDecrement(&entry->refCount) > 0)
+		return;
+
+	free((void*)entry->key.rects);
+	free(entry->data);
+	free(entry);
+}
@@ -0,0 +1,95 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+#define FREERDP_SERVER_SHADOW_ENCODE_CACHE_H
+
+#include <freerdp/server/shadow.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+#include <winpr/collections.h>
+
+/*
+ * Encoded frames shared between clients of the same surface.
+ *
+ * Every update event (see shadow_mcevent.h) publishes a new frame id. The
+ * first client to encode a region of a frame with a given codec configuration
+ * stores the result and every other client with an identical configuration
+ * sends the stored payload instead of encoding again.
+ *
+ * Clients encode a frame at different times, a slow client may still encode
+ * frame N after frame N + 1 was published. The surface snapshot of a frame
+ * (see shadow_frame.h) therefore holds the frame while it is referenced, and
+ * the entries of a frame are dropped once it is no longer current and no
+ * snapshot holds it.
+ * The memory used by all frames is bounded, the oldest entries are evicted
+ * first and have to be encoded again.
+ *
+ * Only stateless codecs may be shared. Codecs that keep inter-frame state
+ * per client (H.264) must always be encoded by the client itself.
+ */
+
+#define SHADOW_ENCODE_CACHE_MAX_BYTES (64ULL * 1024ULL * 1024ULL)
+
+typedef struct
+{
+	const rdpShadowSurface* surface;
+	BOOL gfx;                  /* TRUE for RDPGFX surface commands, FALSE for surface bits */
+	UINT32 codecId;            /* RDPGFX_CODECID_* or negotiated surface bits codec id */
+	UINT32 codecFlags;         /* codec specific settings affecting the encoded output */
+	UINT32 codecParam;         /* codec specific settings affecting the encoded output */
+	BOOL headers;              /* payload carries the codec headers (RemoteFX) */
+	RECTANGLE_16 rect;         /* encoded region of the surface */
+	const RECTANGLE_16* rects; /* rectangles of a multi rectangle region, copied on store */
+	UINT32 numRects;
+	UINT32 index;   /* message index for codecs splitting a frame */
+	UINT32 frameId; /* frame the encoded surface content belongs to */
+} SHADOW_ENCODE_CACHE_KEY;
+
+typedef struct
+{
+	SHADOW_ENCODE_CACHE_KEY key;
+	volatile LONG refCount;
+
+	BYTE* data;
+	UINT32 length;
+	UINT32 count; /* number of messages stored for this frame */
+} SHADOW_ENCODE_CACHE_ENTRY;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	rdpShadowEncodeCache* shadow_encode_cache_new(size_t maxBytes);
+	void shadow_encode_cache_free(rdpShadowEncodeCache* cache);
+
+	UINT32 shadow_encode_cache_advance(rdpShadowEncodeCache* cache);
+	UINT32 shadow_encode_cache_frame_acquire(rdpShadowEncodeCache* cache, UINT32 previous);
+	void shadow_encode_cache_frame_release(rdpShadowEncodeCache* cache, UINT32 frameId);
+
+	SHADOW_ENCODE_CACHE_ENTRY* shadow_encode_cache_acquire(rdpShadowEncodeCache* cache,
+	                                                       const SHADOW_ENCODE_CACHE_KEY* key);
+	BOOL shadow_encode_cache_store(rdpShadowEncodeCache* cache, const SHADOW_ENCODE_CACHE_KEY* key,
+	                               const BYTE* data, UINT32 length, UINT32 count);
+	void shadow_encode_cache_release(SHADOW_ENCODE_CACHE_ENTRY* entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_ENCODE_CACHE_H */
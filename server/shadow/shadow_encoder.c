@@ -265,6 +265,10 @@ static int shadow_encoder_init_progressive(rdpShadowEncoder* encoder)
 	if (!progressive_context_reset(encoder->progressive))
 		goto fail;
 
+	if (!progressive_context_set_upgrades(encoder->progressive,
+	                                      encoder->server->progressiveUpgrades))
+		goto fail;
+
 	encoder->codecs |= FREERDP_CODEC_PROGRESSIVE;
 	return 1;
 fail:
@@ -272,6 +276,19 @@ fail:
 	return -1;
 }
 
+static int shadow_encoder_init_clear(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+	if (!encoder->clear)
+		encoder->clear = clear_context_new(TRUE);
+
+	if (!encoder->clear)
+		return -1;
+
+	encoder->codecs |= FREERDP_CODEC_CLEARCODEC;
+	return 1;
+}
+
 static int shadow_encoder_init(rdpShadowEncoder* encoder)
 {
 	encoder->width = encoder->server->screen->width;
@@ -362,6 +379,19 @@ static int shadow_encoder_uninit_progressive(rdpShadowEncoder* encoder)
 	return 1;
 }
 
+static int shadow_encoder_uninit_clear(rdpShadowEncoder* encoder)
+{
+	WINPR_ASSERT(encoder);
+	if (encoder->clear)
+	{
+		clear_context_free(encoder->clear);
+		encoder->clear = NULL;
+	}
+
+	encoder->codecs &= (UINT32)~FREERDP_CODEC_CLEARCODEC;
+	return 1;
+}
+
 static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 {
 	shadow_encoder_uninit_grid(encoder);
@@ -383,6 +413,7 @@ static int shadow_encoder_uninit(rdpShadowEncoder* encoder)
 
 	shadow_encoder_uninit_progressive(encoder);
 
+	/* The client keeps its ClearCodec caches across a reset, keep the encoder mirroring them */
 	return 1;
 }
 
@@ -407,6 +438,9 @@ int shadow_encoder_reset(rdpShadowEncoder* encoder)
 	if (status < 0)
 		return -1;
 
+	/* The client bitmap cache outlives the surface, only forget the surface content */
+	shadow_tile_cache_reset(encoder->tileCache);
+
 	encoder->fps = 16;
 	encoder->maxFps = 32;
 	encoder->frameId = 0;
@@ -474,6 +508,43 @@ int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs)
 			return -1;
 	}
 
+	if ((codecs & FREERDP_CODEC_CLEARCODEC) && !(encoder->codecs & FREERDP_CODEC_CLEARCODEC))
+	{
+		WLog_DBG(TAG, "initializing ClearCodec encoder");
+		status = shadow_encoder_init_clear(encoder);
+
+		if (status < 0)
+			return -1;
+	}
+
+	return 1;
+}
+
+int shadow_encoder_prepare_tile_cache(rdpShadowEncoder* encoder)
+{
+	const rdpSettings* settings;
+
+	WINPR_ASSERT(encoder);
+
+	if (encoder->tileCache)
+		return 1;
+
+	WINPR_ASSERT(encoder->server);
+
+	if (!encoder->server->gfxTileCache)
+		return 0;
+
+	WINPR_ASSERT(encoder->client);
+	settings = encoder->client->context.settings;
+	WINPR_ASSERT(settings);
+
+	/* The cache limits depend on the capabilities confirmed by the client */
+	WLog_DBG(TAG, "initializing RDPGFX tile cache");
+	encoder->tileCache = shadow_tile_cache_new(settings->GfxSmallCache);
+
+	if (!encoder->tileCache)
+		return -1;
+
 	return 1;
 }
 
@@ -506,5 +577,7 @@ void shadow_encoder_free(rdpShadowEncoder* encoder)
 		return;
 
 	shadow_encoder_uninit(encoder);
+	shadow_encoder_uninit_clear(encoder);
+	shadow_tile_cache_free(encoder->tileCache);
 	free(encoder);
 }
@@ -27,6 +27,8 @@
 
 #include <freerdp/server/shadow.h>
 
+#include "shadow_tile_cache.h"
+
 struct rdp_shadow_encoder
 {
 	rdpShadowClient* client;
@@ -51,6 +53,8 @@ struct rdp_shadow_encoder
 	BITMAP_INTERLEAVED_CONTEXT* interleaved;
 	H264_CONTEXT* h264;
 	PROGRESSIVE_CONTEXT* progressive;
+	CLEAR_CONTEXT* clear;
+	SHADOW_TILE_CACHE* tileCache;
 
 	UINT32 fps;
 	UINT32 maxFps;
@@ -67,6 +71,7 @@ extern "C"
 
 	int shadow_encoder_reset(rdpShadowEncoder* encoder);
 	int shadow_encoder_prepare(rdpShadowEncoder* encoder, UINT32 codecs);
+	int shadow_encoder_prepare_tile_cache(rdpShadowEncoder* encoder);
 	UINT32 shadow_encoder_create_frame_id(rdpShadowEncoder* encoder);
 
 	rdpShadowEncoder* shadow_encoder_new(rdpShadowClient* client);
@@ -0,0 +1,498 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <winpr/interlocked.h>
+#include <winpr/sysinfo.h>
+
+#include <freerdp/log.h>
+#include <freerdp/codec/color.h>
+
+#include "shadow.h"
+
+#include "shadow_frame.h"
+
+#define TAG SERVER_TAG("shadow.frame")
+
+typedef struct
+{
+	rdpShadowFrame* frame;
+	UINT32 id;
+	UINT64 time;
+	REGION16 region;
+} SHADOW_FRAME_QUEUE_ITEM;
+
+struct rdp_shadow_frame_queue
+{
+	CRITICAL_SECTION lock;
+	SHADOW_FRAME_QUEUE_ITEM* items;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	size_t dropped;
+};
+
+static BOOL shadow_frame_region_add(REGION16* dst, const REGION16* src)
+{
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects = region16_rects(src, &numRects);
+
+	for (UINT32 index = 0; index < numRects; index++)
+	{
+		if (!region16_union_rect(dst, dst, &rects[index]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL shadow_frame_matches(const rdpShadowFrame* frame, const rdpShadowSurface* surface)
+{
+	return frame && (frame->width == surface->width) && (frame->height == surface->height) &&
+	       (frame->scanline == surface->scanline) && (frame->format == surface->format);
+}
+
+static rdpShadowFrame* shadow_frame_new(const rdpShadowSurface* surface)
+{
+	rdpShadowFrame* frame = (rdpShadowFrame*)calloc(1, sizeof(rdpShadowFrame));
+
+	if (!frame)
+		return NULL;
+
+	frame->refCount = 1;
+	frame->surface = surface;
+	frame->width = surface->width;
+	frame->height = surface->height;
+	frame->scanline = surface->scanline;
+	frame->format = surface->format;
+	frame->data = (BYTE*)winpr_aligned_malloc(1ull * frame->scanline * frame->height, 32);
+	region16_init(&frame->changed);
+
+	if (!frame->data)
+	{
+		region16_uninit(&frame->changed);
+		free(frame);
+		return NULL;
+	}
+
+	return frame;
+}
+
+static void shadow_frame_free(rdpShadowFrame* frame)
+{
+	if (!frame)
+		return;
+
+	shadow_encode_cache_frame_release(frame->cache, frame->cacheFrameId);
+	region16_uninit(&frame->changed);
+	winpr_aligned_free(frame->data);
+	free(frame);
+}
+
+static BOOL shadow_frame_copy(rdpShadowFrame* frame, const rdpShadowSurface* surface,
+                              const REGION16* region)
+{
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects = region16_rects(region, &numRects);
+
+	for (UINT32 index = 0; index < numRects; index++)
+	{
+		const RECTANGLE_16* rect = &rects[index];
+
+		if (!freerdp_image_copy(frame->data, frame->format, frame->scanline, rect->left, rect->top,
+		                        rect->right - rect->left, rect->bottom - rect->top, surface->data,
+		                        surface->format, surface->scanline, rect->left, rect->top, NULL,
+		                        FREERDP_FLIP_NONE))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Called with the surface locked */
+static BOOL shadow_frame_publish_locked(rdpShadowSurface* surface, rdpShadowEncodeCache* cache)
+{
+	BOOL rc;
+	REGION16 update;
+	RECTANGLE_16 surfaceRect = { 0 };
+	rdpShadowFrame* latest = surface->frame;
+	rdpShadowFrame* frame = surface->previousFrame;
+
+	/* Nothing changed, the latest snapshot is still current */
+	if (shadow_frame_matches(latest, surface) && region16_is_empty(&surface->invalidRegion))
+		return TRUE;
+
+	WINPR_ASSERT(surface->width <= UINT16_MAX);
+	WINPR_ASSERT(surface->height <= UINT16_MAX);
+	surfaceRect.right = (UINT16)surface->width;
+	surfaceRect.bottom = (UINT16)surface->height;
+	region16_init(&update);
+
+	/* Only the surface references the older snapshot, catch up with the changes since */
+	if (shadow_frame_matches(frame, surface) && shadow_frame_matches(latest, surface) &&
+	    (InterlockedCompareExchange(&frame->refCount, 1, 1) == 1))
+	{
+		surface->previousFrame = NULL;
+		rc = shadow_frame_region_add(&update, &latest->changed) &&
+		     shadow_frame_region_add(&update, &surface->invalidRegion);
+	}
+	else
+	{
+		frame = shadow_frame_new(surface);
+		rc = frame && region16_union_rect(&update, &update, &surfaceRect);
+	}
+
+	if (rc)
+	{
+		rc = region16_intersect_rect(&update, &update, &surfaceRect) &&
+		     shadow_frame_copy(frame, surface, &update) &&
+		     region16_intersect_rect(&frame->changed, &surface->invalidRegion, &surfaceRect);
+	}
+
+	region16_uninit(&update);
+
+	if (!rc)
+	{
+		WLog_ERR(TAG, "failed to publish a frame of %" PRIu32 "x%" PRIu32, surface->width,
+		         surface->height);
+		shadow_frame_free(frame);
+		return FALSE;
+	}
+
+	if (frame->cache != cache)
+	{
+		shadow_encode_cache_frame_release(frame->cache, frame->cacheFrameId);
+		frame->cache = cache;
+		frame->cacheFrameId = 0;
+	}
+
+	frame->cacheFrameId = shadow_encode_cache_frame_acquire(cache, frame->cacheFrameId);
+	shadow_frame_release(surface->previousFrame);
+	surface->previousFrame = latest;
+	surface->frame = frame;
+	return TRUE;
+}
+
+/**
+ * Function description
+ * Take a snapshot of the surface for the clients, the changes are taken from
+ * the invalid region of the surface.
+ *
+ * @return TRUE on success
+ */
+BOOL shadow_frame_publish(rdpShadowSurface* surface, rdpShadowEncodeCache* cache)
+{
+	BOOL rc;
+
+	if (!surface)
+		return FALSE;
+
+	EnterCriticalSection(&surface->lock);
+	rc = shadow_frame_publish_locked(surface, cache);
+	LeaveCriticalSection(&surface->lock);
+	return rc;
+}
+
+/**
+ * Function description
+ * Reference the latest snapshot of the surface, taking one if the surface was
+ * not published yet.
+ *
+ * @return the frame, release with shadow_frame_release
+ */
+rdpShadowFrame* shadow_frame_acquire(rdpShadowSurface* surface, rdpShadowEncodeCache* cache)
+{
+	rdpShadowFrame* frame = NULL;
+
+	if (!surface)
+		return NULL;
+
+	EnterCriticalSection(&surface->lock);
+
+	if (shadow_frame_matches(surface->frame, surface) ||
+	    shadow_frame_publish_locked(surface, cache))
+		frame = shadow_frame_ref(surface->frame);
+
+	LeaveCriticalSection(&surface->lock);
+	return frame;
+}
+
+rdpShadowFrame* shadow_frame_ref(rdpShadowFrame* frame)
+{
+	if (frame)
+		InterlockedIncrement(&frame->refCount);
+
+	return frame;
+}
+
+void shadow_frame_release(rdpShadowFrame* frame)
+{
+	if (frame && (InterlockedDecrement(&frame->refCount) == 0))
+		shadow_frame_free(frame);
+}
+
+/**
+ * Function description
+ * Drop the snapshots of the surface after its content was replaced, the next
+ * client acquiring a frame takes a new one.
+ */
+void shadow_frame_reset(rdpShadowSurface* surface)
+{
+	if (!surface)
+		return;
+
+	EnterCriticalSection(&surface->lock);
+	shadow_frame_release(surface->frame);
+	shadow_frame_release(surface->previousFrame);
+	surface->frame = NULL;
+	surface->previousFrame = NULL;
+	LeaveCriticalSection(&surface->lock);
+}
+
+rdpShadowFrameQueue* shadow_frame_queue_new(size_t capacity)
+{
+	rdpShadowFrameQueue* queue;
+
+	if (capacity == 0)
+		return NULL;
+
+	queue = (rdpShadowFrameQueue*)calloc(1, sizeof(rdpShadowFrameQueue));
+
+	if (!queue)
+		return NULL;
+
+	queue->capacity = capacity;
+	queue->items = (SHADOW_FRAME_QUEUE_ITEM*)calloc(capacity, sizeof(SHADOW_FRAME_QUEUE_ITEM));
+
+	if (!queue->items || !InitializeCriticalSectionAndSpinCount(&queue->lock, 4000))
+	{
+		free(queue->items);
+		free(queue);
+		return NULL;
+	}
+
+	for (size_t index = 0; index < capacity; index++)
+		region16_init(&queue->items[index].region);
+
+	return queue;
+}
+
+void shadow_frame_queue_free(rdpShadowFrameQueue* queue)
+{
+	if (!queue)
+		return;
+
+	shadow_frame_queue_clear(queue);
+
+	for (size_t index = 0; index < queue->capacity; index++)
+		region16_uninit(&queue->items[index].region);
+
+	DeleteCriticalSection(&queue->lock);
+	free(queue->items);
+	free(queue);
+}
+
+/* Called with the queue locked */
+static void shadow_frame_queue_remove(rdpShadowFrameQueue* queue)
+{
+	SHADOW_FRAME_QUEUE_ITEM* item = &queue->items[queue->head];
+
+	shadow_frame_release(item->frame);
+	item->frame = NULL;
+	region16_clear(&item->region);
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+}
+
+/**
+ * Function description
+ * Append a frame, referenced by the queue, and the region to send with it. A
+ * full queue drops its oldest frame, the region of the dropped frame is sent
+ * with the next one.
+ *
+ * @return TRUE on success
+ */
+BOOL shadow_frame_queue_push(rdpShadowFrameQueue* queue, rdpShadowFrame* frame, UINT32 id,
+                             const REGION16* region)
+{
+	BOOL rc = TRUE;
+	SHADOW_FRAME_QUEUE_ITEM* item;
+
+	if (!queue)
+		return FALSE;
+
+	EnterCriticalSection(&queue->lock);
+
+	if (queue->count == queue->capacity)
+	{
+		SHADOW_FRAME_QUEUE_ITEM* oldest = &queue->items[queue->head];
+		SHADOW_FRAME_QUEUE_ITEM* next = &queue->items[(queue->head + 1) % queue->capacity];
+
+		/* A single slot keeps the region for the frame replacing it */
+		if (next != oldest)
+		{
+			rc = shadow_frame_region_add(&next->region, &oldest->region);
+			region16_clear(&oldest->region);
+		}
+
+		shadow_frame_release(oldest->frame);
+		oldest->frame = NULL;
+		queue->head = (queue->head + 1) % queue->capacity;
+		queue->count--;
+		queue->dropped++;
+	}
+
+	item = &queue->items[(queue->head + queue->count) % queue->capacity];
+
+	if (region && !shadow_frame_region_add(&item->region, region))
+		rc = FALSE;
+
+	item->frame = shadow_frame_ref(frame);
+	item->id = id;
+	item->time = GetTickCount64();
+	queue->count++;
+	LeaveCriticalSection(&queue->lock);
+	return rc;
+}
+
+/**
+ * Function description
+ * Take the oldest frame, the reference of the queue is passed to the caller.
+ *
+ * @return TRUE if a frame was taken
+ */
+BOOL shadow_frame_queue_pop(rdpShadowFrameQueue* queue, rdpShadowFrame** frame, REGION16* region)
+{
+	BOOL rc = FALSE;
+	SHADOW_FRAME_QUEUE_ITEM* item;
+
+	if (!queue || !frame)
+		return FALSE;
+
+	EnterCriticalSection(&queue->lock);
+
+	if (queue->count > 0)
+	{
+		item = &queue->items[queue->head];
+		*frame = shadow_frame_ref(item->frame);
+		rc = !region || region16_copy(region, &item->region);
+		shadow_frame_queue_remove(queue);
+	}
+
+	LeaveCriticalSection(&queue->lock);
+	return rc;
+}
+
+/**
+ * Function description
+ * Remove the frames up to and including the acknowledged frame id.
+ */
+void shadow_frame_queue_ack(rdpShadowFrameQueue* queue, UINT32 id)
+{
+	if (!queue)
+		return;
+
+	EnterCriticalSection(&queue->lock);
+
+	while ((queue->count > 0) && ((INT32)(queue->items[queue->head].id - id) <= 0))
+		shadow_frame_queue_remove(queue);
+
+	LeaveCriticalSection(&queue->lock);
+}
+
+void shadow_frame_queue_clear(rdpShadowFrameQueue* queue)
+{
+	if (!queue)
+		return;
+
+	EnterCriticalSection(&queue->lock);
+
+	while (queue->count > 0)
+		shadow_frame_queue_remove(queue);
+
+	LeaveCriticalSection(&queue->lock);
+}
+
+size_t shadow_frame_queue_count(rdpShadowFrameQueue* queue)
+{
+	size_t count;
+
+	if (!queue)
+		return 0;
+
+	EnterCriticalSection(&queue->lock);
+	count = queue->count;
+	LeaveCriticalSection(&queue->lock);
+	return count;
+}
+
+/**
+ * Function description
+ * @param oldest receives the time the oldest frame was queued, if the queue is full
+ *
+ * @return TRUE if the next push drops a frame
+ */
+BOOL shadow_frame_queue_full(rdpShadowFrameQueue* queue, UINT64* oldest)
+{
+	BOOL full;
+
+	if (!queue)
+		return FALSE;
+
+	EnterCriticalSection(&queue->lock);
+	full = queue->count == queue->capacity;
+
+	if (full && oldest)
+		*oldest = queue->items[queue->head].time;
+
+	LeaveCriticalSection(&queue->lock);
+	return full;
+}
+
+size_t shadow_frame_queue_dropped(rdpShadowFrameQueue* queue)
+{
+	size_t dropped;
+
+	if (!queue)
+		return 0;
+
+	EnterCriticalSection(&queue->lock);
+	dropped = queue->dropped;
+	LeaveCriticalSection(&queue->lock);
+	return dropped;
+}
+
+/**
+ * Function description
+ * Frames are encoded at most at the given frame rate. Under backpressure, a
+ * full send queue or a blocked transport, the next frame waits until the
+ * backpressure is gone but never longer than maxDelay after it started, as
+ * some clients skip acknowledgements.
+ *
+ * @return milliseconds until the next frame may be encoded
+ */
+DWORD shadow_frame_pacing_delay(UINT64 now, UINT64 lastFrameTime, UINT32 fps, BOOL backpressure,
+                                UINT64 blockedSince, UINT32 maxDelay)
+{
+	UINT64 due = lastFrameTime + 1000 / MAX(fps, 1);
+
+	if (backpressure)
+		due = MAX(due, blockedSince + maxDelay);
+
+	return (now >= due) ? 0 : (DWORD)(due - now);
+}
@@ -0,0 +1,91 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_FRAME_H
+#define FREERDP_SERVER_SHADOW_FRAME_H
+
+#include <freerdp/server/shadow.h>
+#include <freerdp/codec/region.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+/*
+ * Frames shared between the clients of a surface.
+ *
+ * Every update event publishes a read only snapshot of the surface. All clients
+ * encode from the same reference counted snapshot instead of copying the
+ * surface themselves, so the capture is released as soon as the snapshot is
+ * taken and the memory used does not grow with the number of clients.
+ *
+ * A snapshot reuses the buffer of the one published two updates earlier when
+ * no client references it any more and only copies the regions changed since,
+ * otherwise the whole surface is copied.
+ *
+ * Each client runs a bounded encode queue of published frames and a bounded
+ * send queue of frames handed to the transport but not yet acknowledged. A full
+ * send queue holds encoding back, a full encode queue drops its oldest frame
+ * and merges the changes into the next one.
+ */
+
+struct rdp_shadow_frame
+{
+	volatile LONG refCount;
+	const rdpShadowSurface* surface; /* source of the frame, used in encode cache keys */
+	rdpShadowEncodeCache* cache;
+	UINT32 cacheFrameId; /* encode cache frame held while the snapshot is referenced */
+
+	BYTE* data;
+	UINT32 width;
+	UINT32 height;
+	UINT32 scanline;
+	UINT32 format;
+	REGION16 changed; /* changed since the previous snapshot of the surface */
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	BOOL shadow_frame_publish(rdpShadowSurface* surface, rdpShadowEncodeCache* cache);
+	rdpShadowFrame* shadow_frame_acquire(rdpShadowSurface* surface, rdpShadowEncodeCache* cache);
+	rdpShadowFrame* shadow_frame_ref(rdpShadowFrame* frame);
+	void shadow_frame_release(rdpShadowFrame* frame);
+	void shadow_frame_reset(rdpShadowSurface* surface);
+
+	rdpShadowFrameQueue* shadow_frame_queue_new(size_t capacity);
+	void shadow_frame_queue_free(rdpShadowFrameQueue* queue);
+
+	BOOL shadow_frame_queue_push(rdpShadowFrameQueue* queue, rdpShadowFrame* frame, UINT32 id,
+	                             const REGION16* region);
+	BOOL shadow_frame_queue_pop(rdpShadowFrameQueue* queue, rdpShadowFrame** frame,
+	                            REGION16* region);
+	void shadow_frame_queue_ack(rdpShadowFrameQueue* queue, UINT32 id);
+	void shadow_frame_queue_clear(rdpShadowFrameQueue* queue);
+
+	size_t shadow_frame_queue_count(rdpShadowFrameQueue* queue);
+	BOOL shadow_frame_queue_full(rdpShadowFrameQueue* queue, UINT64* oldest);
+	size_t shadow_frame_queue_dropped(rdpShadowFrameQueue* queue);
+
+	DWORD shadow_frame_pacing_delay(UINT64 now, UINT64 lastFrameTime, UINT32 fps,
+	                                BOOL backpressure, UINT64 blockedSince, UINT32 maxDelay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_FRAME_H */
@@ -81,5 +81,7 @@ BOOL shadow_client_init_lobby(rdpShadowServer* server)
 
 	region16_union_rect(&(lobby->invalidRegion), &(lobby->invalidRegion), &invalidRect);
 
+	/* Clients in the lobby take a new snapshot with their next refresh */
+	shadow_frame_reset(lobby);
 	return TRUE;
 }
@@ -392,6 +392,26 @@ int shadow_server_parse_command_line(rdpShadowServer* server, int argc, char** a
 			if (!freerdp_settings_set_bool(settings, FreeRDP_GfxAVC444, arg->Value ? TRUE : FALSE))
 				return COMMAND_LINE_ERROR;
 		}
+		CommandLineSwitchCase(arg, "gfx-avc-adaptive")
+		{
+			server->h264AdaptiveQP = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "gfx-clear")
+		{
+			server->clearCodec = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "gfx-progressive-upgrade")
+		{
+			server->progressiveUpgrades = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "gfx-tile-cache")
+		{
+			server->gfxTileCache = arg->Value ? TRUE : FALSE;
+		}
+		CommandLineSwitchCase(arg, "encode-cache")
+		{
+			server->shareEncodedFrames = arg->Value ? TRUE : FALSE;
+		}
 		CommandLineSwitchCase(arg, "keytab")
 		{
 			if (!freerdp_settings_set_string(settings, FreeRDP_KerberosKeytab, arg->Value))
@@ -574,6 +594,17 @@ int shadow_server_start(rdpShadowServer* server)
 		return -1;
 	}
 
+	if (server->shareEncodedFrames)
+	{
+		server->encodeCache = shadow_encode_cache_new(SHADOW_ENCODE_CACHE_MAX_BYTES);
+
+		if (!server->encodeCache)
+		{
+			WLog_ERR(TAG, "encode_cache_new failed");
+			return -1;
+		}
+	}
+
 	/* Bind magic:
 	 *
 	 * emtpy                 ... bind TCP all
@@ -661,6 +692,12 @@ int shadow_server_stop(rdpShadowServer* server)
 		server->capture = NULL;
 	}
 
+	if (server->encodeCache)
+	{
+		shadow_encode_cache_free(server->encodeCache);
+		server->encodeCache = NULL;
+	}
+
 	return 0;
 }
 
@@ -913,6 +950,9 @@ rdpShadowServer* shadow_server_new(void)
 	server->h264FrameRate = 30;
 	server->h264QP = 0;
 	server->authentication = FALSE;
+	server->shareEncodedFrames = TRUE;
+	server->progressiveUpgrades = FALSE;
+	server->gfxTileCache = TRUE;
 	server->settings = freerdp_settings_new(FREERDP_SETTINGS_SERVER_MODE);
 	return server;
 }
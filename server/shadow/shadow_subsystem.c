@@ -22,6 +22,8 @@
 
 #include "shadow_subsystem.h"
 
+#define SHADOW_DAMAGE_MAX_RECTS 256
+
 static pfnShadowSubsystemEntry pSubsystemEntry = NULL;
 
 void shadow_subsystem_set_entry(pfnShadowSubsystemEntry pEntry)
@@ -84,9 +86,17 @@ int shadow_subsystem_init(rdpShadowSubsystem* subsystem, rdpShadowServer* server
 	if (!(subsystem->updateEvent = shadow_multiclient_new()))
 		goto fail;
 
+	if (!InitializeCriticalSectionAndSpinCount(&subsystem->damageLock, 4000))
+		goto fail;
+
+	region16_init(&subsystem->damageRegion);
+	subsystem->damageOverflow = TRUE;
+
 	if ((status = subsystem->ep.Init(subsystem)) >= 0)
 		return status;
 
+	region16_uninit(&subsystem->damageRegion);
+	DeleteCriticalSection(&subsystem->damageLock);
 fail:
 	if (subsystem->MsgPipe)
 	{
@@ -143,6 +153,9 @@ void shadow_subsystem_uninit(rdpShadowSubsystem* subsystem)
 		shadow_multiclient_free(subsystem->updateEvent);
 		subsystem->updateEvent = NULL;
 	}
+
+	region16_uninit(&subsystem->damageRegion);
+	DeleteCriticalSection(&subsystem->damageLock);
 }
 
 int shadow_subsystem_start(rdpShadowSubsystem* subsystem)
@@ -279,5 +292,91 @@ int shadow_subsystem_pointer_convert_alpha_pointer_data(
 
 void shadow_subsystem_frame_update(rdpShadowSubsystem* subsystem)
 {
+	/* Surface content may have changed, previously shared encodes are stale */
+	if (subsystem->server)
+	{
+		shadow_encode_cache_advance(subsystem->server->encodeCache);
+
+		/* One snapshot per update shared by all clients, on failure they keep the previous one */
+		(void)shadow_frame_publish(subsystem->server->surface, subsystem->server->encodeCache);
+	}
+
 	shadow_multiclient_publish_and_wait(subsystem->updateEvent);
 }
+
+BOOL shadow_subsystem_damage_add(rdpShadowSubsystem* subsystem, const RECTANGLE_16* rect)
+{
+	BOOL rc = TRUE;
+
+	if (!subsystem || !rect)
+		return FALSE;
+
+	if (subsystem->damageMode == SHADOW_DAMAGE_NONE)
+		return TRUE;
+
+	if (rectangle_is_empty(rect))
+		return TRUE;
+
+	EnterCriticalSection(&subsystem->damageLock);
+
+	if (!subsystem->damageOverflow)
+	{
+		/* Too many rectangles cost more to track than to compare their bounds */
+		if (region16_n_rects(&subsystem->damageRegion) >= SHADOW_DAMAGE_MAX_RECTS)
+		{
+			const RECTANGLE_16 extents = *region16_extents(&subsystem->damageRegion);
+			region16_clear(&subsystem->damageRegion);
+			rc = region16_union_rect(&subsystem->damageRegion, &subsystem->damageRegion,
+			                         &extents);
+		}
+
+		if (rc)
+			rc = region16_union_rect(&subsystem->damageRegion, &subsystem->damageRegion, rect);
+
+		if (!rc)
+		{
+			region16_clear(&subsystem->damageRegion);
+			subsystem->damageOverflow = TRUE;
+		}
+	}
+
+	LeaveCriticalSection(&subsystem->damageLock);
+	return rc;
+}
+
+void shadow_subsystem_damage_invalidate(rdpShadowSubsystem* subsystem)
+{
+	if (!subsystem)
+		return;
+
+	EnterCriticalSection(&subsystem->damageLock);
+	region16_clear(&subsystem->damageRegion);
+	subsystem->damageOverflow = TRUE;
+	LeaveCriticalSection(&subsystem->damageLock);
+}
+
+int shadow_subsystem_damage_take(rdpShadowSubsystem* subsystem, REGION16* region)
+{
+	int status = 1;
+
+	if (!subsystem || !region)
+		return -1;
+
+	region16_clear(region);
+
+	if (subsystem->damageMode == SHADOW_DAMAGE_NONE)
+		return 0;
+
+	EnterCriticalSection(&subsystem->damageLock);
+
+	if (subsystem->damageOverflow)
+		status = 0;
+	else if (!region16_copy(region, &subsystem->damageRegion))
+		status = -1;
+
+	/* Hints collected from now on describe the changes since this capture */
+	region16_clear(&subsystem->damageRegion);
+	subsystem->damageOverflow = FALSE;
+	LeaveCriticalSection(&subsystem->damageLock);
+	return status;
+}
@@ -64,6 +64,7 @@ void shadow_surface_free(rdpShadowSurface* surface)
 	if (!surface)
 		return;
 
+	shadow_frame_reset(surface);
 	free(surface->data);
 	DeleteCriticalSection(&(surface->lock));
 	region16_uninit(&(surface->invalidRegion));
@@ -97,6 +98,7 @@ BOOL shadow_surface_resize(rdpShadowSurface* surface, UINT16 x, UINT16 y, UINT32
 		surface->height = height;
 		surface->scanline = scanline;
 		surface->data = buffer;
+		shadow_frame_reset(surface);
 		return TRUE;
 	}
 
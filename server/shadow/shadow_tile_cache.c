@@ -0,0 +1,797 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <freerdp/config.h>
+
+#include <winpr/assert.h>
+#include <winpr/crypto.h>
+#include <winpr/synch.h>
+
+#include <freerdp/log.h>
+
+#include "shadow_tile_cache.h"
+
+#define TAG SERVER_TAG("shadow.tilecache")
+
+/* [MS-RDPEGFX] 3.3.1.4 Bitmap Cache limits */
+#define SHADOW_TILE_CACHE_MAX_SLOTS 25600
+#define SHADOW_TILE_CACHE_MAX_SLOTS_SMALL 4096
+#define SHADOW_TILE_CACHE_MAX_BYTES (100ULL * 1024ULL * 1024ULL)
+#define SHADOW_TILE_CACHE_MAX_BYTES_SMALL (16ULL * 1024ULL * 1024ULL)
+
+#define SHADOW_TILE_CACHE_BUCKETS 32768
+#define SHADOW_TILE_CACHE_MAX_TILE_BYTES (4UL * SHADOW_TILE_SIZE * SHADOW_TILE_SIZE)
+
+#define SHADOW_TILE_NONE 0
+#define SHADOW_TILE_UNCHANGED 1
+#define SHADOW_TILE_CHANGED 2
+
+typedef struct
+{
+	UINT64 hash;
+	UINT64 check;
+	UINT32 size;
+	UINT32 frameId; /* frame the slot was stored in */
+	UINT16 next;    /* next slot of the bucket chain, 0 terminates */
+	BOOL used;
+	BOOL referenced;
+	BOOL imported; /* imported from the client persistent cache, only the check is known */
+} SHADOW_TILE_CACHE_SLOT;
+
+typedef struct
+{
+	UINT64 hash;
+	UINT64 check;
+	BOOL valid;
+	BOOL provisional; /* shown at reduced quality, a codec upgrade is pending */
+} SHADOW_TILE_STATE;
+
+struct s_shadow_tile_cache
+{
+	UINT16 maxSlots;
+	size_t maxBytes;
+	size_t usedBytes;
+	UINT16 hand;
+	UINT32 frameId;
+	BOOL importDone;
+	UINT64 seed; /* secret key of the check hash */
+	SHADOW_TILE_CACHE_SLOT* slots; /* cache slots are 1-based, slots[0] is unused */
+	UINT16* buckets;
+
+	UINT32 width;
+	UINT32 height;
+	UINT32 gridWidth;
+	UINT32 gridHeight;
+	SHADOW_TILE_STATE* tiles; /* tiles as currently shown by the client */
+
+	/* per frame scratch data */
+	BYTE* status;
+	UINT64* hashes;
+	UINT64* checks;
+	UINT32* colors;
+	BOOL* solid;
+	UINT32* lookup;
+	size_t lookupSize;
+	size_t maxEvictions;
+	SHADOW_TILE_CACHE_FRAME frame;
+};
+
+static INIT_ONCE shadow_tile_seed_once = INIT_ONCE_STATIC_INIT;
+static UINT64 shadow_tile_seed = 0;
+
+static BOOL CALLBACK shadow_tile_init_seed(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+	WINPR_UNUSED(once);
+	WINPR_UNUSED(param);
+	WINPR_UNUSED(context);
+	winpr_RAND(&shadow_tile_seed, sizeof(shadow_tile_seed));
+	return TRUE;
+}
+
+/* A tile is identified by a FNV-1a hash and a second hash keyed with a process wide secret.
+ * Colliding FNV-1a hashes are easy to construct on purpose, both must match before content shown
+ * by the client is reused. The keyed hash is sent as cache key, it stays valid for all
+ * connections of the process and lets clients import their persistent cache. */
+static INLINE UINT64 shadow_tile_hash(const BYTE* pSrcData, UINT32 nSrcStep, UINT32 width,
+                                      UINT32 height, UINT64 seed, UINT64* pCheck, BOOL* pSolid,
+                                      UINT32* pColor)
+{
+	UINT32 x, y;
+	UINT32 first;
+	BOOL solid = TRUE;
+	UINT64 hash = 0xCBF29CE484222325ULL ^ ((UINT64)width << 16) ^ height;
+	UINT64 check = seed ^ ((UINT64)width << 32) ^ height;
+
+	CopyMemory(&first, pSrcData, sizeof(UINT32));
+	first &= 0x00FFFFFF;
+
+	for (y = 0; y < height; y++)
+	{
+		const BYTE* pSrc = &pSrcData[y * nSrcStep];
+
+		for (x = 0; x < width; x++)
+		{
+			UINT32 pixel;
+			CopyMemory(&pixel, &pSrc[x * 4], sizeof(UINT32));
+			pixel &= 0x00FFFFFF; /* ignore the unused alpha byte */
+
+			if (pixel != first)
+				solid = FALSE;
+
+			hash = (hash ^ pixel) * 0x100000001B3ULL;
+			check += pixel * 0xC2B2AE3D27D4EB4FULL;
+			check = ((check << 31) | (check >> 33)) * 0x9E3779B185EBCA87ULL;
+		}
+	}
+
+	check ^= check >> 29;
+	*pCheck = check * 0x165667B19E3779F9ULL;
+	*pSolid = solid;
+	*pColor = first;
+	return hash;
+}
+
+static INLINE UINT32 shadow_tile_bucket(UINT64 hash)
+{
+	return (UINT32)((hash ^ (hash >> 32)) & (SHADOW_TILE_CACHE_BUCKETS - 1));
+}
+
+static UINT16 shadow_tile_cache_find(SHADOW_TILE_CACHE* cache, UINT64 hash, UINT64 check)
+{
+	UINT16 index = cache->buckets[shadow_tile_bucket(check)];
+
+	while (index != 0)
+	{
+		SHADOW_TILE_CACHE_SLOT* slot = &cache->slots[index];
+
+		/* Imported slots only know the keyed hash, the first match completes them */
+		if ((slot->check == check) && (slot->imported || (slot->hash == hash)))
+		{
+			slot->hash = hash;
+			slot->imported = FALSE;
+			return index;
+		}
+
+		index = slot->next;
+	}
+
+	return 0;
+}
+
+static void shadow_tile_cache_unlink(SHADOW_TILE_CACHE* cache, UINT16 index)
+{
+	SHADOW_TILE_CACHE_SLOT* slot = &cache->slots[index];
+	UINT16* link = &cache->buckets[shadow_tile_bucket(slot->check)];
+
+	while (*link != 0)
+	{
+		if (*link == index)
+		{
+			*link = slot->next;
+			break;
+		}
+
+		link = &cache->slots[*link].next;
+	}
+
+	slot->next = 0;
+}
+
+static BOOL shadow_tile_cache_add_eviction(SHADOW_TILE_CACHE* cache, UINT16 index)
+{
+	SHADOW_TILE_CACHE_FRAME* frame = &cache->frame;
+
+	if (frame->numEvictions >= cache->maxEvictions)
+	{
+		const size_t count = cache->maxEvictions * 2 + 64;
+		UINT16* tmp = (UINT16*)realloc(frame->evictions, count * sizeof(UINT16));
+
+		if (!tmp)
+			return FALSE;
+
+		frame->evictions = tmp;
+		cache->maxEvictions = count;
+	}
+
+	frame->evictions[frame->numEvictions++] = index;
+	return TRUE;
+}
+
+/**
+ * Advance the clock hand to the next slot which is free or may be evicted.
+ * Slots stored in the current frame are never evicted, their SurfaceToCache
+ * PDU has not been sent yet.
+ *
+ * @return the slot index, 0 if no slot could be found
+ */
+static UINT16 shadow_tile_cache_next_victim(SHADOW_TILE_CACHE* cache, BOOL freeOnly)
+{
+	UINT32 i;
+
+	for (i = 0; i < 2UL * cache->maxSlots; i++)
+	{
+		SHADOW_TILE_CACHE_SLOT* slot;
+		cache->hand = (cache->hand % cache->maxSlots) + 1;
+		slot = &cache->slots[cache->hand];
+
+		if (!slot->used)
+		{
+			if (freeOnly)
+				return cache->hand;
+
+			continue;
+		}
+
+		if (slot->frameId == cache->frameId)
+			continue;
+
+		if (slot->referenced)
+		{
+			slot->referenced = FALSE;
+			continue;
+		}
+
+		if (!shadow_tile_cache_add_eviction(cache, cache->hand))
+			return 0;
+
+		shadow_tile_cache_unlink(cache, cache->hand);
+		cache->usedBytes -= slot->size;
+		slot->used = FALSE;
+		return cache->hand;
+	}
+
+	return 0;
+}
+
+static UINT16 shadow_tile_cache_store(SHADOW_TILE_CACHE* cache, UINT64 hash, UINT64 check,
+                                      UINT32 size, BOOL imported)
+{
+	UINT16 index;
+	UINT32 bucket;
+	SHADOW_TILE_CACHE_SLOT* slot;
+
+	if (size > cache->maxBytes)
+		return 0;
+
+	index = shadow_tile_cache_next_victim(cache, TRUE);
+
+	if (index == 0)
+		return 0;
+
+	while (cache->usedBytes + size > cache->maxBytes)
+	{
+		if (shadow_tile_cache_next_victim(cache, FALSE) == 0)
+			return 0;
+	}
+
+	bucket = shadow_tile_bucket(check);
+	slot = &cache->slots[index];
+	slot->hash = hash;
+	slot->check = check;
+	slot->size = size;
+	slot->frameId = cache->frameId;
+	slot->used = TRUE;
+	slot->referenced = FALSE;
+	slot->imported = imported;
+	slot->next = cache->buckets[bucket];
+	cache->buckets[bucket] = index;
+	cache->usedBytes += size;
+	return index;
+}
+
+static void shadow_tile_cache_uninit_grid(SHADOW_TILE_CACHE* cache)
+{
+	SHADOW_TILE_CACHE_FRAME* frame = &cache->frame;
+
+	free(cache->tiles);
+	free(cache->status);
+	free(cache->hashes);
+	free(cache->checks);
+	free(cache->colors);
+	free(cache->solid);
+	free(cache->lookup);
+	free(frame->fills);
+	free(frame->copies);
+	free(frame->hits);
+	free(frame->stores);
+	cache->tiles = NULL;
+	cache->status = NULL;
+	cache->hashes = NULL;
+	cache->checks = NULL;
+	cache->colors = NULL;
+	cache->solid = NULL;
+	cache->lookup = NULL;
+	frame->fills = NULL;
+	frame->copies = NULL;
+	frame->hits = NULL;
+	frame->stores = NULL;
+	cache->width = 0;
+	cache->height = 0;
+	cache->gridWidth = 0;
+	cache->gridHeight = 0;
+}
+
+static BOOL shadow_tile_cache_init_grid(SHADOW_TILE_CACHE* cache, UINT32 width, UINT32 height)
+{
+	size_t count;
+	SHADOW_TILE_CACHE_FRAME* frame = &cache->frame;
+
+	shadow_tile_cache_uninit_grid(cache);
+	cache->gridWidth = (width + SHADOW_TILE_SIZE - 1) / SHADOW_TILE_SIZE;
+	cache->gridHeight = (height + SHADOW_TILE_SIZE - 1) / SHADOW_TILE_SIZE;
+	count = 1ULL * cache->gridWidth * cache->gridHeight;
+
+	cache->lookupSize = 64;
+
+	while (cache->lookupSize < count * 2)
+		cache->lookupSize *= 2;
+
+	cache->tiles = (SHADOW_TILE_STATE*)calloc(count, sizeof(SHADOW_TILE_STATE));
+	cache->status = (BYTE*)calloc(count, sizeof(BYTE));
+	cache->hashes = (UINT64*)calloc(count, sizeof(UINT64));
+	cache->checks = (UINT64*)calloc(count, sizeof(UINT64));
+	cache->colors = (UINT32*)calloc(count, sizeof(UINT32));
+	cache->solid = (BOOL*)calloc(count, sizeof(BOOL));
+	cache->lookup = (UINT32*)calloc(cache->lookupSize, sizeof(UINT32));
+	frame->fills = (SHADOW_TILE_FILL*)calloc(count, sizeof(SHADOW_TILE_FILL));
+	frame->copies = (SHADOW_TILE_COPY*)calloc(count, sizeof(SHADOW_TILE_COPY));
+	frame->hits = (SHADOW_TILE_HIT*)calloc(count, sizeof(SHADOW_TILE_HIT));
+	frame->stores = (SHADOW_TILE_STORE*)calloc(count, sizeof(SHADOW_TILE_STORE));
+
+	if (!cache->tiles || !cache->status || !cache->hashes || !cache->checks || !cache->colors ||
+	    !cache->solid || !cache->lookup || !frame->fills || !frame->copies || !frame->hits ||
+	    !frame->stores)
+	{
+		shadow_tile_cache_uninit_grid(cache);
+		return FALSE;
+	}
+
+	cache->width = width;
+	cache->height = height;
+	return TRUE;
+}
+
+static INLINE void shadow_tile_rect(const SHADOW_TILE_CACHE* cache, UINT32 index,
+                                    RECTANGLE_16* rect)
+{
+	const UINT32 x = (index % cache->gridWidth) * SHADOW_TILE_SIZE;
+	const UINT32 y = (index / cache->gridWidth) * SHADOW_TILE_SIZE;
+
+	rect->left = (UINT16)x;
+	rect->top = (UINT16)y;
+	rect->right = (UINT16)MIN(x + SHADOW_TILE_SIZE, cache->width);
+	rect->bottom = (UINT16)MIN(y + SHADOW_TILE_SIZE, cache->height);
+}
+
+static void shadow_tile_cache_build_lookup(SHADOW_TILE_CACHE* cache)
+{
+	UINT32 index;
+	const size_t count = 1ULL * cache->gridWidth * cache->gridHeight;
+	const size_t mask = cache->lookupSize - 1;
+
+	ZeroMemory(cache->lookup, cache->lookupSize * sizeof(UINT32));
+
+	for (index = 0; index < count; index++)
+	{
+		size_t pos;
+		const SHADOW_TILE_STATE* tile = &cache->tiles[index];
+
+		/* Only tiles not modified in this frame and shown at full quality may be used as
+		 * copy source */
+		if (!tile->valid || tile->provisional || (cache->status[index] == SHADOW_TILE_CHANGED))
+			continue;
+
+		pos = (size_t)tile->hash & mask;
+
+		while (cache->lookup[pos] != 0)
+		{
+			const SHADOW_TILE_STATE* other = &cache->tiles[cache->lookup[pos] - 1];
+
+			if ((other->hash == tile->hash) && (other->check == tile->check))
+				break;
+
+			pos = (pos + 1) & mask;
+		}
+
+		if (cache->lookup[pos] == 0)
+			cache->lookup[pos] = index + 1;
+	}
+}
+
+static BOOL shadow_tile_equal(const SHADOW_TILE_CACHE* cache, const BYTE* pSrcData,
+                              UINT32 nSrcStep, UINT32 a, UINT32 b)
+{
+	UINT32 y;
+	RECTANGLE_16 rectA;
+	RECTANGLE_16 rectB;
+
+	shadow_tile_rect(cache, a, &rectA);
+	shadow_tile_rect(cache, b, &rectB);
+
+	if (((rectA.right - rectA.left) != (rectB.right - rectB.left)) ||
+	    ((rectA.bottom - rectA.top) != (rectB.bottom - rectB.top)))
+		return FALSE;
+
+	for (y = 0; y < (UINT32)(rectA.bottom - rectA.top); y++)
+	{
+		const BYTE* pA = &pSrcData[(rectA.top + y) * nSrcStep + rectA.left * 4];
+		const BYTE* pB = &pSrcData[(rectB.top + y) * nSrcStep + rectB.left * 4];
+
+		if (memcmp(pA, pB, 4ULL * (rectA.right - rectA.left)) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Find a tile of the client surface with the content of tile dst. Copy sources are unchanged in
+ * this frame, so their content is verified against the source surface.
+ */
+static BOOL shadow_tile_cache_find_tile(SHADOW_TILE_CACHE* cache, const BYTE* pSrcData,
+                                        UINT32 nSrcStep, UINT32 dst, UINT32* pIndex)
+{
+	const UINT64 hash = cache->hashes[dst];
+	const size_t mask = cache->lookupSize - 1;
+	size_t pos = (size_t)hash & mask;
+
+	while (cache->lookup[pos] != 0)
+	{
+		const UINT32 index = cache->lookup[pos] - 1;
+		const SHADOW_TILE_STATE* tile = &cache->tiles[index];
+
+		if ((tile->hash == hash) && (tile->check == cache->checks[dst]))
+		{
+			if (!shadow_tile_equal(cache, pSrcData, nSrcStep, index, dst))
+				return FALSE;
+
+			*pIndex = index;
+			return TRUE;
+		}
+
+		pos = (pos + 1) & mask;
+	}
+
+	return FALSE;
+}
+
+SHADOW_TILE_CACHE* shadow_tile_cache_new(BOOL smallCache)
+{
+	SHADOW_TILE_CACHE* cache = (SHADOW_TILE_CACHE*)calloc(1, sizeof(SHADOW_TILE_CACHE));
+
+	if (!cache)
+		return NULL;
+
+	cache->maxSlots = smallCache ? SHADOW_TILE_CACHE_MAX_SLOTS_SMALL : SHADOW_TILE_CACHE_MAX_SLOTS;
+	cache->maxBytes = smallCache ? SHADOW_TILE_CACHE_MAX_BYTES_SMALL : SHADOW_TILE_CACHE_MAX_BYTES;
+	cache->slots =
+	    (SHADOW_TILE_CACHE_SLOT*)calloc(cache->maxSlots + 1ULL, sizeof(SHADOW_TILE_CACHE_SLOT));
+	cache->buckets = (UINT16*)calloc(SHADOW_TILE_CACHE_BUCKETS, sizeof(UINT16));
+	region16_init(&cache->frame.encodeRegion);
+
+	if (!InitOnceExecuteOnce(&shadow_tile_seed_once, shadow_tile_init_seed, NULL, NULL))
+	{
+		shadow_tile_cache_free(cache);
+		return NULL;
+	}
+
+	cache->seed = shadow_tile_seed;
+
+	if (!cache->slots || !cache->buckets)
+	{
+		shadow_tile_cache_free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+void shadow_tile_cache_free(SHADOW_TILE_CACHE* cache)
+{
+	if (!cache)
+		return;
+
+	shadow_tile_cache_uninit_grid(cache);
+	region16_uninit(&cache->frame.encodeRegion);
+	free(cache->frame.evictions);
+	free(cache->slots);
+	free(cache->buckets);
+	free(cache);
+}
+
+void shadow_tile_cache_reset(SHADOW_TILE_CACHE* cache)
+{
+	if (!cache)
+		return;
+
+	/* The client surface content is unknown, the bitmap cache is kept */
+	if (cache->tiles)
+		ZeroMemory(cache->tiles, 1ULL * cache->gridWidth * cache->gridHeight *
+		                             sizeof(SHADOW_TILE_STATE));
+}
+
+BOOL shadow_tile_cache_import(SHADOW_TILE_CACHE* cache, const RDPGFX_CACHE_IMPORT_OFFER_PDU* offer,
+                              RDPGFX_CACHE_IMPORT_REPLY_PDU* reply)
+{
+	UINT16 index;
+
+	if (!cache || !offer || !reply)
+		return FALSE;
+
+	reply->importedEntriesCount = 0;
+
+	/* [MS-RDPEGFX] 3.2.5.2 the offer is only accepted once, before any cache slot was used */
+	if (cache->importDone || (cache->frameId != 0))
+	{
+		WLog_WARN(TAG, "ignoring cache import offer after the first frame");
+		return TRUE;
+	}
+
+	cache->importDone = TRUE;
+
+	/* The client maps the reply to its entries by position, only a prefix can be accepted */
+	for (index = 0; index < MIN(offer->cacheEntriesCount, RDPGFX_CACHE_ENTRY_MAX_COUNT); index++)
+	{
+		UINT16 slot;
+		const RDPGFX_CACHE_ENTRY_METADATA* entry = &offer->cacheEntries[index];
+
+		if ((entry->bitmapLength == 0) ||
+		    (entry->bitmapLength > SHADOW_TILE_CACHE_MAX_TILE_BYTES) ||
+		    (cache->usedBytes + entry->bitmapLength > cache->maxBytes))
+			break;
+
+		slot = shadow_tile_cache_store(cache, 0, entry->cacheKey, entry->bitmapLength, TRUE);
+
+		if (slot == 0)
+			break;
+
+		reply->cacheSlots[reply->importedEntriesCount++] = slot;
+	}
+
+	WLog_DBG(TAG, "imported %" PRIu16 " of %" PRIu16 " offered cache entries",
+	         reply->importedEntriesCount, offer->cacheEntriesCount);
+	return TRUE;
+}
+
+static void shadow_tile_cache_begin_frame(SHADOW_TILE_CACHE* cache)
+{
+	SHADOW_TILE_CACHE_FRAME* frame = &cache->frame;
+
+	region16_clear(&frame->encodeRegion);
+	frame->numFills = 0;
+	frame->numCopies = 0;
+	frame->numHits = 0;
+	frame->numEvictions = 0;
+	frame->numStores = 0;
+	cache->frameId++;
+}
+
+BOOL shadow_tile_cache_update(SHADOW_TILE_CACHE* cache, const BYTE* pSrcData, UINT32 nSrcStep,
+                              UINT32 nWidth, UINT32 nHeight, const REGION16* invalidRegion,
+                              BOOL provisional, SHADOW_TILE_CACHE_FRAME** ppFrame)
+{
+	UINT32 i, index;
+	UINT32 numRects = 0;
+	BOOL needLookup = FALSE;
+	const RECTANGLE_16* rects;
+	SHADOW_TILE_CACHE_FRAME* frame;
+	size_t count;
+
+	if (!cache || !pSrcData || !invalidRegion || !ppFrame)
+		return FALSE;
+
+	if ((nWidth != cache->width) || (nHeight != cache->height))
+	{
+		if (!shadow_tile_cache_init_grid(cache, nWidth, nHeight))
+			return FALSE;
+	}
+
+	frame = &cache->frame;
+	shadow_tile_cache_begin_frame(cache);
+
+	count = 1ULL * cache->gridWidth * cache->gridHeight;
+	ZeroMemory(cache->status, count * sizeof(BYTE));
+	rects = region16_rects(invalidRegion, &numRects);
+
+	/* Hash all tiles touched by the invalid region */
+	for (i = 0; i < numRects; i++)
+	{
+		UINT32 x, y;
+		const RECTANGLE_16* rect = &rects[i];
+		const UINT32 right = MIN(rect->right, nWidth);
+		const UINT32 bottom = MIN(rect->bottom, nHeight);
+
+		if ((rect->left >= right) || (rect->top >= bottom))
+			continue;
+
+		for (y = rect->top / SHADOW_TILE_SIZE; y <= (bottom - 1) / SHADOW_TILE_SIZE; y++)
+		{
+			for (x = rect->left / SHADOW_TILE_SIZE; x <= (right - 1) / SHADOW_TILE_SIZE; x++)
+			{
+				RECTANGLE_16 tileRect;
+				const SHADOW_TILE_STATE* tile;
+				index = y * cache->gridWidth + x;
+
+				if (cache->status[index] != SHADOW_TILE_NONE)
+					continue;
+
+				shadow_tile_rect(cache, index, &tileRect);
+				cache->hashes[index] = shadow_tile_hash(
+				    &pSrcData[tileRect.top * nSrcStep + tileRect.left * 4], nSrcStep,
+				    tileRect.right - tileRect.left, tileRect.bottom - tileRect.top, cache->seed,
+				    &cache->checks[index], &cache->solid[index], &cache->colors[index]);
+				tile = &cache->tiles[index];
+
+				if (tile->valid && (tile->hash == cache->hashes[index]) &&
+				    (tile->check == cache->checks[index]))
+					cache->status[index] = SHADOW_TILE_UNCHANGED;
+				else
+				{
+					cache->status[index] = SHADOW_TILE_CHANGED;
+
+					if (!cache->solid[index])
+						needLookup = TRUE;
+				}
+			}
+		}
+	}
+
+	if (needLookup)
+		shadow_tile_cache_build_lookup(cache);
+
+	/* Classify changed tiles */
+	for (index = 0; index < count; index++)
+	{
+		UINT16 slot;
+		UINT32 source;
+		RECTANGLE_16 tileRect;
+		BOOL encoded = FALSE;
+		const UINT64 hash = cache->hashes[index];
+		const UINT64 check = cache->checks[index];
+
+		if (cache->status[index] != SHADOW_TILE_CHANGED)
+			continue;
+
+		shadow_tile_rect(cache, index, &tileRect);
+
+		if (cache->solid[index])
+		{
+			SHADOW_TILE_FILL* fill = &frame->fills[frame->numFills++];
+			const UINT32 color = cache->colors[index];
+			fill->color.B = (BYTE)(color & 0xFF);
+			fill->color.G = (BYTE)((color >> 8) & 0xFF);
+			fill->color.R = (BYTE)((color >> 16) & 0xFF);
+			fill->color.XA = 0xFF;
+			fill->rect = tileRect;
+		}
+		else if (shadow_tile_cache_find_tile(cache, pSrcData, nSrcStep, index, &source))
+		{
+			SHADOW_TILE_COPY* copy = &frame->copies[frame->numCopies++];
+			shadow_tile_rect(cache, source, &copy->rectSrc);
+			copy->destPt.x = tileRect.left;
+			copy->destPt.y = tileRect.top;
+		}
+		else if ((slot = shadow_tile_cache_find(cache, hash, check)) != 0)
+		{
+			SHADOW_TILE_HIT* hit = &frame->hits[frame->numHits++];
+			SHADOW_TILE_CACHE_SLOT* cacheSlot = &cache->slots[slot];
+			cacheSlot->referenced = TRUE;
+			hit->cacheSlot = slot;
+			hit->destPt.x = tileRect.left;
+			hit->destPt.y = tileRect.top;
+			hit->late = (cacheSlot->frameId == cache->frameId);
+		}
+		else
+		{
+			const UINT32 size =
+			    4UL * (tileRect.right - tileRect.left) * (tileRect.bottom - tileRect.top);
+
+			if (!region16_union_rect(&frame->encodeRegion, &frame->encodeRegion, &tileRect))
+				return FALSE;
+
+			/* Provisional tiles are stored once their final quality was sent */
+			encoded = TRUE;
+			slot = provisional ? 0 : shadow_tile_cache_store(cache, hash, check, size, FALSE);
+
+			if (slot != 0)
+			{
+				SHADOW_TILE_STORE* store = &frame->stores[frame->numStores++];
+				store->cacheSlot = slot;
+				store->cacheKey = check;
+				store->rectSrc = tileRect;
+			}
+		}
+
+		cache->tiles[index].hash = hash;
+		cache->tiles[index].check = check;
+		cache->tiles[index].valid = TRUE;
+		cache->tiles[index].provisional = encoded && provisional;
+	}
+
+	WLog_VRB(TAG,
+	         "frame %" PRIu32 ": %" PRIuz " fills, %" PRIuz " copies, %" PRIuz " hits, %" PRIuz
+	         " stores, %" PRIuz " evictions",
+	         cache->frameId, frame->numFills, frame->numCopies, frame->numHits, frame->numStores,
+	         frame->numEvictions);
+	*ppFrame = frame;
+	return TRUE;
+}
+
+BOOL shadow_tile_cache_finalize(SHADOW_TILE_CACHE* cache, const REGION16* finalRegion,
+                                SHADOW_TILE_CACHE_FRAME** ppFrame)
+{
+	UINT32 i, index;
+	UINT32 numRects = 0;
+	const RECTANGLE_16* rects;
+	SHADOW_TILE_CACHE_FRAME* frame;
+
+	if (!cache || !finalRegion || !ppFrame)
+		return FALSE;
+
+	frame = &cache->frame;
+	shadow_tile_cache_begin_frame(cache);
+	rects = region16_rects(finalRegion, &numRects);
+
+	for (i = 0; i < numRects; i++)
+	{
+		UINT32 x, y;
+		const RECTANGLE_16* rect = &rects[i];
+		const UINT32 right = MIN(rect->right, cache->width);
+		const UINT32 bottom = MIN(rect->bottom, cache->height);
+
+		if ((rect->left >= right) || (rect->top >= bottom))
+			continue;
+
+		for (y = rect->top / SHADOW_TILE_SIZE; y <= (bottom - 1) / SHADOW_TILE_SIZE; y++)
+		{
+			for (x = rect->left / SHADOW_TILE_SIZE; x <= (right - 1) / SHADOW_TILE_SIZE; x++)
+			{
+				UINT16 slot;
+				UINT32 size;
+				RECTANGLE_16 tileRect;
+				SHADOW_TILE_STATE* tile;
+				index = y * cache->gridWidth + x;
+				tile = &cache->tiles[index];
+
+				if (!tile->valid || !tile->provisional)
+					continue;
+
+				tile->provisional = FALSE;
+
+				/* An identical tile may have been stored meanwhile */
+				if (shadow_tile_cache_find(cache, tile->hash, tile->check) != 0)
+					continue;
+
+				shadow_tile_rect(cache, index, &tileRect);
+				size = 4UL * (tileRect.right - tileRect.left) * (tileRect.bottom - tileRect.top);
+				slot = shadow_tile_cache_store(cache, tile->hash, tile->check, size, FALSE);
+
+				if (slot != 0)
+				{
+					SHADOW_TILE_STORE* store = &frame->stores[frame->numStores++];
+					store->cacheSlot = slot;
+					store->cacheKey = tile->check;
+					store->rectSrc = tileRect;
+				}
+			}
+		}
+	}
+
+	WLog_VRB(TAG, "frame %" PRIu32 ": %" PRIuz " stores, %" PRIuz " evictions after upgrade",
+	         cache->frameId, frame->numStores, frame->numEvictions);
+	*ppFrame = frame;
+	return TRUE;
+}
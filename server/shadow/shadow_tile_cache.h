@@ -0,0 +1,115 @@
+/**
+ * FreeRDP: A Remote Desktop Protocol Implementation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FREERDP_SERVER_SHADOW_TILE_CACHE_H
+#define FREERDP_SERVER_SHADOW_TILE_CACHE_H
+
+#include <winpr/crt.h>
+
+#include <freerdp/channels/rdpgfx.h>
+#include <freerdp/codec/region.h>
+
+/*
+ * Server side model of a RDPGFX client surface and bitmap cache.
+ *
+ * The surface is split into 64x64 tiles, each identified by a hash of its
+ * pixels. For every frame the changed tiles are classified into
+ * SolidFill, SurfaceToSurface (content still present elsewhere on the
+ * client surface), CacheToSurface (content present in the client bitmap
+ * cache) or codec updates. Tiles sent through a codec are added to the
+ * client bitmap cache with SurfaceToCache, honoring the slot and memory
+ * limits of [MS-RDPEGFX] 3.3.1.4.
+ *
+ * The PDUs of a frame must be sent in the order
+ * copies, fills, hits (not late), codec update, evictions, stores, late hits
+ *
+ * Tiles sent by a multi pass codec are provisional: they are neither used as
+ * copy source nor stored until shadow_tile_cache_finalize reports that their
+ * final quality was sent. The finalize frame only holds evictions and stores.
+ *
+ * A cache import offer of the client is accepted once, before the first frame.
+ */
+
+#define SHADOW_TILE_SIZE 64
+
+typedef struct
+{
+	RDPGFX_COLOR32 color;
+	RECTANGLE_16 rect;
+} SHADOW_TILE_FILL;
+
+typedef struct
+{
+	RECTANGLE_16 rectSrc;
+	RDPGFX_POINT16 destPt;
+} SHADOW_TILE_COPY;
+
+typedef struct
+{
+	UINT16 cacheSlot;
+	RDPGFX_POINT16 destPt;
+	BOOL late; /* the slot is stored in this frame, send after the stores */
+} SHADOW_TILE_HIT;
+
+typedef struct
+{
+	UINT16 cacheSlot;
+	UINT64 cacheKey;
+	RECTANGLE_16 rectSrc;
+} SHADOW_TILE_STORE;
+
+typedef struct
+{
+	REGION16 encodeRegion; /* tiles requiring a codec update */
+
+	size_t numFills;
+	SHADOW_TILE_FILL* fills;
+	size_t numCopies;
+	SHADOW_TILE_COPY* copies;
+	size_t numHits;
+	SHADOW_TILE_HIT* hits;
+	size_t numEvictions;
+	UINT16* evictions;
+	size_t numStores;
+	SHADOW_TILE_STORE* stores;
+} SHADOW_TILE_CACHE_FRAME;
+
+typedef struct s_shadow_tile_cache SHADOW_TILE_CACHE;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	SHADOW_TILE_CACHE* shadow_tile_cache_new(BOOL smallCache);
+	void shadow_tile_cache_free(SHADOW_TILE_CACHE* cache);
+
+	void shadow_tile_cache_reset(SHADOW_TILE_CACHE* cache);
+	BOOL shadow_tile_cache_import(SHADOW_TILE_CACHE* cache,
+	                              const RDPGFX_CACHE_IMPORT_OFFER_PDU* offer,
+	                              RDPGFX_CACHE_IMPORT_REPLY_PDU* reply);
+
+	BOOL shadow_tile_cache_update(SHADOW_TILE_CACHE* cache, const BYTE* pSrcData, UINT32 nSrcStep,
+	                              UINT32 nWidth, UINT32 nHeight, const REGION16* invalidRegion,
+	                              BOOL provisional, SHADOW_TILE_CACHE_FRAME** ppFrame);
+	BOOL shadow_tile_cache_finalize(SHADOW_TILE_CACHE* cache, const REGION16* finalRegion,
+	                                SHADOW_TILE_CACHE_FRAME** ppFrame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREERDP_SERVER_SHADOW_TILE_CACHE_H */
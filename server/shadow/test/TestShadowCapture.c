@@ -0,0 +1,320 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/print.h>
+
+#include <freerdp/server/shadow.h>
+
+typedef struct
+{
+	UINT32 width;
+	UINT32 height;
+	UINT32 step;
+	BYTE* frame1;
+	BYTE* frame2;
+} TEST_SHADOW_FRAMES;
+
+static BOOL test_frames_init(TEST_SHADOW_FRAMES* frames, UINT32 width, UINT32 height)
+{
+	ZeroMemory(frames, sizeof(TEST_SHADOW_FRAMES));
+	frames->width = width;
+	frames->height = height;
+	/* Pad the lines so a compare that ignores the step or reads past the width shows up */
+	frames->step = width * 4 + 12;
+	frames->frame1 = (BYTE*)calloc(height, frames->step);
+	frames->frame2 = (BYTE*)calloc(height, frames->step);
+
+	if (!frames->frame1 || !frames->frame2)
+		return FALSE;
+
+	for (size_t i = 0; i < 1ull * height * frames->step; i++)
+		frames->frame1[i] = (BYTE)(i * 7 + (i >> 8));
+
+	CopyMemory(frames->frame2, frames->frame1, 1ull * height * frames->step);
+
+	/* The padding differs, it must never be reported */
+	for (UINT32 y = 0; y < height; y++)
+		FillMemory(&frames->frame2[1ull * y * frames->step + width * 4], 12, 0xAA);
+
+	return TRUE;
+}
+
+static void test_frames_uninit(TEST_SHADOW_FRAMES* frames)
+{
+	free(frames->frame1);
+	free(frames->frame2);
+}
+
+static void test_frames_touch(TEST_SHADOW_FRAMES* frames, UINT32 x, UINT32 y)
+{
+	frames->frame2[1ull * y * frames->step + x * 4ull + 1] ^= 0x01;
+}
+
+static void test_frames_reset(TEST_SHADOW_FRAMES* frames)
+{
+	for (UINT32 y = 0; y < frames->height; y++)
+	{
+		const size_t offset = 1ull * y * frames->step;
+		CopyMemory(&frames->frame2[offset], &frames->frame1[offset], frames->width * 4ull);
+	}
+}
+
+/* The tile of a pixel, clipped to the frame */
+static BOOL test_expect_tile(REGION16* expected, const TEST_SHADOW_FRAMES* frames, UINT32 x,
+                             UINT32 y)
+{
+	RECTANGLE_16 rect;
+	rect.left = (UINT16)(x - x % 16);
+	rect.top = (UINT16)(y - y % 16);
+	rect.right = (UINT16)MIN(rect.left + 16, frames->width);
+	rect.bottom = (UINT16)MIN(rect.top + 16, frames->height);
+	return region16_union_rect(expected, expected, &rect);
+}
+
+/* Both regions are made of clipped tiles, but the expected one is not merged the same way, so
+ * compare the tiles they cover instead of their rectangles. */
+static BOOL test_region_equal(const TEST_SHADOW_FRAMES* frames, const REGION16* region,
+                              const REGION16* expected)
+{
+	if (!rectangles_equal(region16_extents(region), region16_extents(expected)))
+		return FALSE;
+
+	for (UINT32 y = 0; y < frames->height; y += 16)
+	{
+		for (UINT32 x = 0; x < frames->width; x += 16)
+		{
+			const RECTANGLE_16 tile = { (UINT16)x, (UINT16)y, (UINT16)MIN(x + 16, frames->width),
+				                        (UINT16)MIN(y + 16, frames->height) };
+			const RECTANGLE_16 corner = { tile.right - 1, tile.bottom - 1, tile.right,
+				                          tile.bottom };
+
+			if (region16_intersects_rect(region, &tile) !=
+			    region16_intersects_rect(expected, &tile))
+				return FALSE;
+
+			/* A reported tile covers all of its pixels */
+			if (region16_intersects_rect(region, &tile) &&
+			    !region16_intersects_rect(region, &corner))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static BOOL test_compare(rdpShadowCapture* capture, const TEST_SHADOW_FRAMES* frames,
+                         const REGION16* hints, const REGION16* expected, const char* what)
+{
+	BOOL rc = FALSE;
+	int status;
+	REGION16 region;
+
+	region16_init(&region);
+	status = shadow_capture_compare_region(capture, frames->frame1, frames->step, frames->width,
+	                                       frames->height, frames->frame2, frames->step, hints,
+	                                       &region);
+
+	if (status != (region16_is_empty(expected) ? 0 : 1))
+	{
+		fprintf(stderr, "%s [%" PRIu32 "x%" PRIu32 "]: unexpected status %d\n", what,
+		        frames->width, frames->height, status);
+		goto out;
+	}
+
+	if (!test_region_equal(frames, &region, expected))
+	{
+		fprintf(stderr, "%s [%" PRIu32 "x%" PRIu32 "]: unexpected region\n", what,
+		        frames->width, frames->height);
+		region16_print(&region);
+		goto out;
+	}
+
+	rc = TRUE;
+out:
+	region16_uninit(&region);
+	return rc;
+}
+
+/* Single pixel changes on both sides of every tile edge of the first tiles and on the last
+ * column and row, each one must mark exactly its own tile. */
+static BOOL test_single_pixels(rdpShadowCapture* capture, TEST_SHADOW_FRAMES* frames)
+{
+	const UINT32 w = frames->width;
+	const UINT32 h = frames->height;
+	const UINT32 points[][2] = { { 0, 0 },         { 15, 0 },         { 16, 0 },
+		                         { 15, 15 },       { 16, 16 },        { 31, 17 },
+		                         { w - 1, 0 },     { 0, h - 1 },      { w - 1, h - 1 },
+		                         { w - 1, h / 2 }, { w / 2, h - 1 },  { (w - 1) & ~15u, h - 1 } };
+	BOOL rc = TRUE;
+
+	for (size_t i = 0; i < ARRAYSIZE(points); i++)
+	{
+		REGION16 expected;
+
+		if ((points[i][0] >= w) || (points[i][1] >= h))
+			continue;
+
+		region16_init(&expected);
+		test_frames_reset(frames);
+		test_frames_touch(frames, points[i][0], points[i][1]);
+
+		if (!test_expect_tile(&expected, frames, points[i][0], points[i][1]) ||
+		    !test_compare(capture, frames, NULL, &expected, "single pixel"))
+		{
+			fprintf(stderr, "pixel %" PRIu32 "x%" PRIu32 "\n", points[i][0], points[i][1]);
+			rc = FALSE;
+		}
+
+		region16_uninit(&expected);
+	}
+
+	return rc;
+}
+
+/* Changes in several tile rows at once, so rows compared by different bands and runs merged
+ * across tile rows are covered. */
+static BOOL test_scattered(rdpShadowCapture* capture, TEST_SHADOW_FRAMES* frames)
+{
+	BOOL rc;
+	REGION16 expected;
+
+	region16_init(&expected);
+	test_frames_reset(frames);
+	rc = TRUE;
+
+	for (UINT32 y = 0; y < frames->height; y += 37)
+	{
+		const UINT32 x = (y * 13) % frames->width;
+		test_frames_touch(frames, x, y);
+		test_frames_touch(frames, x, frames->height - 1 - y);
+
+		if (!test_expect_tile(&expected, frames, x, y) ||
+		    !test_expect_tile(&expected, frames, x, frames->height - 1 - y))
+			rc = FALSE;
+	}
+
+	/* A full column of tiles that merges across tile rows */
+	for (UINT32 y = 0; y < frames->height; y++)
+	{
+		const UINT32 x = MIN(17, frames->width - 1);
+		test_frames_touch(frames, x, y);
+
+		if (!test_expect_tile(&expected, frames, x, y))
+			rc = FALSE;
+	}
+
+	if (rc)
+		rc = test_compare(capture, frames, NULL, &expected, "scattered");
+
+	region16_uninit(&expected);
+	return rc;
+}
+
+static BOOL test_hints(rdpShadowCapture* capture, TEST_SHADOW_FRAMES* frames)
+{
+	BOOL rc = FALSE;
+	REGION16 hints;
+	REGION16 empty;
+	REGION16 expected;
+	const UINT32 x = frames->width - 1;
+	const UINT32 y = frames->height - 1;
+	const RECTANGLE_16 away = { 0, 0, 16, 16 };
+	/* A hint covering a single pixel of the last tile selects the whole tile */
+	const RECTANGLE_16 near = { (UINT16)x, (UINT16)y, (UINT16)(x + 1), (UINT16)(y + 1) };
+
+	region16_init(&hints);
+	region16_init(&empty);
+	region16_init(&expected);
+	test_frames_reset(frames);
+	test_frames_touch(frames, x, y);
+	test_frames_touch(frames, 0, y);
+
+	/* Neither change is hinted */
+	if (!region16_union_rect(&hints, &hints, &away))
+		goto out;
+
+	if (!test_compare(capture, frames, &hints, &empty, "hints excluding the change"))
+		goto out;
+
+	/* An empty hint region compares nothing */
+	region16_clear(&hints);
+
+	if (!test_compare(capture, frames, &hints, &empty, "empty hints"))
+		goto out;
+
+	/* Only the hinted change is reported */
+	if (!region16_union_rect(&hints, &hints, &near) ||
+	    !test_expect_tile(&expected, frames, x, y))
+		goto out;
+
+	if (!test_compare(capture, frames, &hints, &expected, "hints including one change"))
+		goto out;
+
+	rc = TRUE;
+out:
+	region16_uninit(&hints);
+	region16_uninit(&empty);
+	region16_uninit(&expected);
+	return rc;
+}
+
+static BOOL test_size(rdpShadowCapture* capture, UINT32 width, UINT32 height)
+{
+	BOOL rc = FALSE;
+	REGION16 empty;
+	TEST_SHADOW_FRAMES frames;
+
+	region16_init(&empty);
+
+	if (!test_frames_init(&frames, width, height))
+		goto out;
+
+	if (!test_compare(capture, &frames, NULL, &empty, "identical frames"))
+		goto out;
+
+	if (!test_single_pixels(capture, &frames))
+		goto out;
+
+	if (!test_scattered(capture, &frames))
+		goto out;
+
+	if (!test_hints(capture, &frames))
+		goto out;
+
+	rc = TRUE;
+out:
+	test_frames_uninit(&frames);
+	region16_uninit(&empty);
+	return rc;
+}
+
+int TestShadowCapture(int argc, char* argv[])
+{
+	int rc = -1;
+	rdpShadowCapture* capture = NULL;
+	/* Odd sizes, sizes just past a tile edge and one tall enough to split into bands */
+	const UINT32 sizes[][2] = { { 67, 45 }, { 17, 33 }, { 33, 17 }, { 64, 64 }, { 1025, 769 } };
+
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	capture = shadow_capture_new(NULL);
+
+	if (!capture)
+		return -1;
+
+	for (size_t i = 0; i < ARRAYSIZE(sizes); i++)
+	{
+		/* The inline compare and the one split across the capture work must agree */
+		if (!test_size(NULL, sizes[i][0], sizes[i][1]))
+			goto out;
+
+		if (!test_size(capture, sizes[i][0], sizes[i][1]))
+			goto out;
+	}
+
+	rc = 0;
+out:
+	shadow_capture_free(capture);
+	return rc;
+}
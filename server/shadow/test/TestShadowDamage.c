@@ -0,0 +1,259 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+#include <winpr/synch.h>
+
+#include <freerdp/server/shadow.h>
+
+/* Must match SHADOW_DAMAGE_MAX_RECTS in shadow_subsystem.c */
+#define TEST_DAMAGE_MAX_RECTS 256
+
+/* The damage state as shadow_subsystem_init leaves it, nothing was captured yet */
+static BOOL test_damage_init(rdpShadowSubsystem* subsystem, SHADOW_DAMAGE_MODE mode)
+{
+	ZeroMemory(subsystem, sizeof(rdpShadowSubsystem));
+
+	if (!InitializeCriticalSectionAndSpinCount(&subsystem->damageLock, 4000))
+		return FALSE;
+
+	region16_init(&subsystem->damageRegion);
+	subsystem->damageOverflow = TRUE;
+	subsystem->damageMode = mode;
+	return TRUE;
+}
+
+static void test_damage_uninit(rdpShadowSubsystem* subsystem)
+{
+	region16_uninit(&subsystem->damageRegion);
+	DeleteCriticalSection(&subsystem->damageLock);
+}
+
+static BOOL test_damage_expect(rdpShadowSubsystem* subsystem, int expected,
+                               const RECTANGLE_16* extents, const char* what)
+{
+	BOOL rc = FALSE;
+	int status;
+	REGION16 region;
+
+	region16_init(&region);
+	status = shadow_subsystem_damage_take(subsystem, &region);
+
+	if (status != expected)
+	{
+		fprintf(stderr, "%s: take returned %d instead of %d\n", what, status, expected);
+		goto out;
+	}
+
+	if (!extents && !region16_is_empty(&region))
+	{
+		fprintf(stderr, "%s: take returned damage\n", what);
+		goto out;
+	}
+
+	if (extents && !rectangles_equal(region16_extents(&region), extents))
+	{
+		fprintf(stderr, "%s: unexpected damage\n", what);
+		region16_print(&region);
+		goto out;
+	}
+
+	rc = TRUE;
+out:
+	region16_uninit(&region);
+	return rc;
+}
+
+static BOOL test_damage_first_frame(void)
+{
+	BOOL rc = FALSE;
+	rdpShadowSubsystem subsystem;
+	const RECTANGLE_16 rect = { 10, 20, 30, 40 };
+
+	if (!test_damage_init(&subsystem, SHADOW_DAMAGE_HINT))
+		return FALSE;
+
+	if (shadow_subsystem_damage_take(&subsystem, NULL) != -1)
+		goto out;
+
+	/* Nothing is known about the surface before the first capture, even with hints */
+	if (!shadow_subsystem_damage_add(&subsystem, &rect))
+		goto out;
+
+	if (!test_damage_expect(&subsystem, 0, NULL, "first frame"))
+		goto out;
+
+	/* From the second frame on the hints describe everything that changed */
+	if (!shadow_subsystem_damage_add(&subsystem, &rect))
+		goto out;
+
+	if (!test_damage_expect(&subsystem, 1, &rect, "second frame"))
+		goto out;
+
+	/* No hints means no change, not an unknown one */
+	if (!test_damage_expect(&subsystem, 1, NULL, "frame without damage"))
+		goto out;
+
+	rc = TRUE;
+out:
+	test_damage_uninit(&subsystem);
+	return rc;
+}
+
+static BOOL test_damage_invalidate(void)
+{
+	BOOL rc = FALSE;
+	rdpShadowSubsystem subsystem;
+	const RECTANGLE_16 rect = { 0, 0, 64, 64 };
+	const RECTANGLE_16 empty = { 5, 5, 5, 9 };
+
+	if (!test_damage_init(&subsystem, SHADOW_DAMAGE_EXACT))
+		return FALSE;
+
+	if (!test_damage_expect(&subsystem, 0, NULL, "initial"))
+		goto out;
+
+	/* Damage published before and after an invalidate is not enough to skip the compare */
+	if (!shadow_subsystem_damage_add(&subsystem, &rect))
+		goto out;
+
+	shadow_subsystem_damage_invalidate(&subsystem);
+
+	if (!shadow_subsystem_damage_add(&subsystem, &rect))
+		goto out;
+
+	if (!test_damage_expect(&subsystem, 0, NULL, "invalidated"))
+		goto out;
+
+	/* Empty rectangles are ignored */
+	if (!shadow_subsystem_damage_add(&subsystem, &empty))
+		goto out;
+
+	if (!test_damage_expect(&subsystem, 1, NULL, "after invalidate"))
+		goto out;
+
+	rc = TRUE;
+out:
+	test_damage_uninit(&subsystem);
+	return rc;
+}
+
+static BOOL test_damage_overflow(void)
+{
+	BOOL rc = FALSE;
+	UINT32 nbRects = 0;
+	REGION16 region;
+	rdpShadowSubsystem subsystem;
+	const UINT32 count = TEST_DAMAGE_MAX_RECTS + 44;
+	const RECTANGLE_16 extents = { 0, 0, (UINT16)(count * 4 - 2), (UINT16)(count * 4 - 2) };
+
+	region16_init(&region);
+
+	if (!test_damage_init(&subsystem, SHADOW_DAMAGE_HINT))
+		goto fail;
+
+	if (!test_damage_expect(&subsystem, 0, NULL, "initial"))
+		goto out;
+
+	/* Disjoint rectangles on a diagonal, each one adds a band to the region */
+	for (UINT32 i = 0; i < count; i++)
+	{
+		const RECTANGLE_16 rect = { (UINT16)(i * 4), (UINT16)(i * 4), (UINT16)(i * 4 + 2),
+			                        (UINT16)(i * 4 + 2) };
+
+		if (!shadow_subsystem_damage_add(&subsystem, &rect))
+			goto out;
+
+		if ((i + 1 < TEST_DAMAGE_MAX_RECTS) &&
+		    (region16_n_rects(&subsystem.damageRegion) != i + 1))
+		{
+			fprintf(stderr, "overflow: rectangles merged before the limit\n");
+			goto out;
+		}
+	}
+
+	if (shadow_subsystem_damage_take(&subsystem, &region) != 1)
+		goto out;
+
+	/* Past the limit the region collapsed to its extents, nothing was lost */
+	region16_rects(&region, &nbRects);
+
+	if ((nbRects == 0) || (nbRects > TEST_DAMAGE_MAX_RECTS))
+	{
+		fprintf(stderr, "overflow: %" PRIu32 " rectangles after collapsing\n", nbRects);
+		goto out;
+	}
+
+	if (!rectangles_equal(region16_extents(&region), &extents))
+	{
+		fprintf(stderr, "overflow: damage lost while collapsing\n");
+		region16_print(&region);
+		goto out;
+	}
+
+	for (UINT32 i = 0; i < count; i++)
+	{
+		const RECTANGLE_16 rect = { (UINT16)(i * 4), (UINT16)(i * 4), (UINT16)(i * 4 + 2),
+			                        (UINT16)(i * 4 + 2) };
+
+		if (!region16_intersects_rect(&region, &rect))
+		{
+			fprintf(stderr, "overflow: rectangle %" PRIu32 " lost\n", i);
+			goto out;
+		}
+	}
+
+	rc = TRUE;
+out:
+	test_damage_uninit(&subsystem);
+fail:
+	region16_uninit(&region);
+	return rc;
+}
+
+static BOOL test_damage_none(void)
+{
+	BOOL rc = FALSE;
+	rdpShadowSubsystem subsystem;
+	const RECTANGLE_16 rect = { 0, 0, 16, 16 };
+
+	if (!test_damage_init(&subsystem, SHADOW_DAMAGE_NONE))
+		return FALSE;
+
+	for (UINT32 i = 0; i < 3; i++)
+	{
+		/* Hints are accepted and dropped, every frame is compared in full */
+		if (!shadow_subsystem_damage_add(&subsystem, &rect))
+			goto out;
+
+		if (!region16_is_empty(&subsystem.damageRegion))
+			goto out;
+
+		if (!test_damage_expect(&subsystem, 0, NULL, "no damage mode"))
+			goto out;
+	}
+
+	rc = TRUE;
+out:
+	test_damage_uninit(&subsystem);
+	return rc;
+}
+
+int TestShadowDamage(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_damage_first_frame())
+		return -1;
+
+	if (!test_damage_invalidate())
+		return -1;
+
+	if (!test_damage_overflow())
+		return -1;
+
+	if (!test_damage_none())
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include "../shadow_encode_cache.h"
+
+static const BYTE test_payload[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+static const RECTANGLE_16 test_rects[] = { { 0, 0, 64, 64 }, { 128, 0, 192, 64 } };
+
+static void test_key_init(SHADOW_ENCODE_CACHE_KEY* key, UINT32 frameId)
+{
+	ZeroMemory(key, sizeof(SHADOW_ENCODE_CACHE_KEY));
+	key->surface = (const rdpShadowSurface*)test_rects;
+	key->gfx = TRUE;
+	key->codecId = 3;
+	key->codecFlags = 0x100;
+	key->rect.right = 192;
+	key->rect.bottom = 64;
+	key->rects = test_rects;
+	key->numRects = ARRAYSIZE(test_rects);
+	key->frameId = frameId;
+}
+
+static BOOL test_expect(rdpShadowEncodeCache* cache, const SHADOW_ENCODE_CACHE_KEY* key, BOOL hit,
+                        const char* what)
+{
+	SHADOW_ENCODE_CACHE_ENTRY* entry = shadow_encode_cache_acquire(cache, key);
+	const BOOL found = entry != NULL;
+
+	if (entry && ((entry->length != sizeof(test_payload)) ||
+	              (memcmp(entry->data, test_payload, sizeof(test_payload)) != 0)))
+	{
+		fprintf(stderr, "[%s] cached payload differs\n", what);
+		shadow_encode_cache_release(entry);
+		return FALSE;
+	}
+
+	shadow_encode_cache_release(entry);
+
+	if (found != hit)
+	{
+		fprintf(stderr, "[%s] %s, expected a %s\n", what, found ? "hit" : "miss",
+		        hit ? "hit" : "miss");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_encode_cache_lookup(void)
+{
+	BOOL rc = FALSE;
+	UINT32 frameId;
+	SHADOW_ENCODE_CACHE_KEY key;
+	SHADOW_ENCODE_CACHE_KEY other;
+	RECTANGLE_16 rects[ARRAYSIZE(test_rects)];
+	rdpShadowEncodeCache* cache = shadow_encode_cache_new(SHADOW_ENCODE_CACHE_MAX_BYTES);
+
+	if (!cache)
+		return FALSE;
+
+	frameId = shadow_encode_cache_frame_acquire(cache, 0);
+	test_key_init(&key, frameId);
+
+	if ((frameId == 0) || !test_expect(cache, &key, FALSE, "empty cache") ||
+	    !shadow_encode_cache_store(cache, &key, test_payload, sizeof(test_payload), 1))
+		goto fail;
+
+	/* The rectangles are copied on store */
+	CopyMemory(rects, test_rects, sizeof(rects));
+	other = key;
+	other.rects = rects;
+
+	if (!test_expect(cache, &other, TRUE, "hit"))
+		goto fail;
+
+	other.codecId++;
+
+	if (!test_expect(cache, &other, FALSE, "codec id"))
+		goto fail;
+
+	other = key;
+	other.codecFlags = 0;
+
+	if (!test_expect(cache, &other, FALSE, "codec flags"))
+		goto fail;
+
+	other = key;
+	other.headers = TRUE;
+
+	if (!test_expect(cache, &other, FALSE, "headers"))
+		goto fail;
+
+	other = key;
+	other.rect.left = 1;
+
+	if (!test_expect(cache, &other, FALSE, "rect"))
+		goto fail;
+
+	other = key;
+	other.rects = rects;
+	rects[1].right++;
+
+	if (!test_expect(cache, &other, FALSE, "rects"))
+		goto fail;
+
+	other = key;
+	other.numRects = 1;
+
+	if (!test_expect(cache, &other, FALSE, "rect count"))
+		goto fail;
+
+	other = key;
+	other.index = 1;
+
+	if (!test_expect(cache, &other, FALSE, "message index"))
+		goto fail;
+
+	other = key;
+	other.gfx = FALSE;
+
+	if (!test_expect(cache, &other, FALSE, "surface bits"))
+		goto fail;
+
+	other = key;
+	other.surface = NULL;
+
+	if (!test_expect(cache, &other, FALSE, "surface"))
+		goto fail;
+
+	other = key;
+	other.frameId++;
+
+	if (!test_expect(cache, &other, FALSE, "frame id"))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	shadow_encode_cache_free(cache);
+	return rc;
+}
+
+/* Two clients staged frame 1, the second one encodes it after frame 2 was published */
+static BOOL test_encode_cache_frames(void)
+{
+	BOOL rc = FALSE;
+	UINT32 fast, slow;
+	SHADOW_ENCODE_CACHE_KEY key;
+	SHADOW_ENCODE_CACHE_ENTRY* entry = NULL;
+	rdpShadowEncodeCache* cache = shadow_encode_cache_new(SHADOW_ENCODE_CACHE_MAX_BYTES);
+
+	if (!cache)
+		return FALSE;
+
+	fast = shadow_encode_cache_frame_acquire(cache, 0);
+	slow = shadow_encode_cache_frame_acquire(cache, 0);
+	test_key_init(&key, fast);
+
+	if ((fast != slow) ||
+	    !shadow_encode_cache_store(cache, &key, test_payload, sizeof(test_payload), 1))
+		goto fail;
+
+	/* The fast client moves on, the slow one still holds frame 1 */
+	if (shadow_encode_cache_advance(cache) == fast)
+		goto fail;
+
+	fast = shadow_encode_cache_frame_acquire(cache, fast);
+
+	if ((fast == slow) || !test_expect(cache, &key, TRUE, "held frame"))
+		goto fail;
+
+	/* An entry in use survives the frame being dropped */
+	entry = shadow_encode_cache_acquire(cache, &key);
+	slow = shadow_encode_cache_frame_acquire(cache, slow);
+
+	if (!entry || (slow != fast) || !test_expect(cache, &key, FALSE, "consumed frame") ||
+	    (memcmp(entry->data, test_payload, sizeof(test_payload)) != 0))
+		goto fail;
+
+	shadow_encode_cache_release(entry);
+	entry = NULL;
+
+	/* Entries of a frame nobody holds are not stored */
+	if (shadow_encode_cache_store(cache, &key, test_payload, sizeof(test_payload), 1))
+		goto fail;
+
+	/* The current frame is kept for clients staging it later */
+	test_key_init(&key, fast);
+	shadow_encode_cache_frame_release(cache, fast);
+	shadow_encode_cache_frame_release(cache, slow);
+
+	if (!shadow_encode_cache_store(cache, &key, test_payload, sizeof(test_payload), 1) ||
+	    !test_expect(cache, &key, TRUE, "current frame"))
+		goto fail;
+
+	/* Nobody staged it before the next frame was published */
+	shadow_encode_cache_advance(cache);
+
+	if (!test_expect(cache, &key, FALSE, "skipped frame"))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	shadow_encode_cache_release(entry);
+	shadow_encode_cache_free(cache);
+	return rc;
+}
+
+/* The memory limit evicts the oldest entries, held or not */
+static BOOL test_encode_cache_evict(void)
+{
+	BOOL rc = FALSE;
+	UINT32 index;
+	UINT32 frameId;
+	SHADOW_ENCODE_CACHE_KEY key;
+	BYTE large[4 * sizeof(test_payload)] = { 0 };
+	rdpShadowEncodeCache* cache = shadow_encode_cache_new(3 * sizeof(test_payload));
+
+	if (!cache)
+		return FALSE;
+
+	frameId = shadow_encode_cache_frame_acquire(cache, 0);
+	test_key_init(&key, frameId);
+
+	for (index = 0; index < 4; index++)
+	{
+		key.index = index;
+
+		if (!shadow_encode_cache_store(cache, &key, test_payload, sizeof(test_payload), 4))
+			goto fail;
+	}
+
+	for (index = 0; index < 4; index++)
+	{
+		key.index = index;
+
+		if (!test_expect(cache, &key, index > 0, "memory limit"))
+			goto fail;
+	}
+
+	/* Larger than the whole cache */
+	if (shadow_encode_cache_store(cache, &key, large, sizeof(large), 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	shadow_encode_cache_free(cache);
+	return rc;
+}
+
+int TestShadowEncodeCache(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_encode_cache_lookup())
+		return -1;
+
+	if (!test_encode_cache_frames())
+		return -1;
+
+	if (!test_encode_cache_evict())
+		return -1;
+
+	return 0;
+}
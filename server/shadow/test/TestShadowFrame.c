@@ -0,0 +1,334 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include "../shadow_surface.h"
+#include "../shadow_encode_cache.h"
+#include "../shadow_frame.h"
+
+#define TEST_WIDTH 64
+#define TEST_HEIGHT 32
+
+static const RECTANGLE_16 test_rects[] = { { 0, 0, 16, 16 }, { 32, 8, 48, 24 }, { 8, 16, 40, 32 } };
+
+static void test_draw(rdpShadowSurface* surface, const RECTANGLE_16* rect, BYTE value)
+{
+	UINT32 y;
+
+	for (y = rect->top; y < rect->bottom; y++)
+		memset(&surface->data[y * surface->scanline + rect->left * 4U], value,
+		       (rect->right - rect->left) * 4U);
+
+	region16_union_rect(&surface->invalidRegion, &surface->invalidRegion, rect);
+}
+
+static BOOL test_frame_equal(const rdpShadowFrame* frame, const rdpShadowSurface* surface)
+{
+	UINT32 y;
+
+	if ((frame->width != surface->width) || (frame->height != surface->height))
+		return FALSE;
+
+	for (y = 0; y < surface->height; y++)
+	{
+		if (memcmp(&frame->data[y * frame->scanline], &surface->data[y * surface->scanline],
+		           surface->width * 4ULL) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static BOOL test_region_equal(const REGION16* region, const RECTANGLE_16* rects, UINT32 count)
+{
+	BOOL rc;
+	UINT32 numRects = 0;
+	UINT32 numExpected = 0;
+	const RECTANGLE_16* actual;
+	const RECTANGLE_16* expected;
+	REGION16 other;
+
+	region16_init(&other);
+
+	for (UINT32 index = 0; index < count; index++)
+		region16_union_rect(&other, &other, &rects[index]);
+
+	actual = region16_rects(region, &numRects);
+	expected = region16_rects(&other, &numExpected);
+	rc = (numRects == numExpected) &&
+	     ((numRects == 0) || (memcmp(actual, expected, numRects * sizeof(RECTANGLE_16)) == 0));
+	region16_uninit(&other);
+	return rc;
+}
+
+/* Publish a frame after drawing a rectangle, check the snapshot against the surface */
+static rdpShadowFrame* test_publish(rdpShadowSurface* surface, rdpShadowEncodeCache* cache,
+                                    const RECTANGLE_16* rect, BYTE value)
+{
+	UINT32 cacheFrameId;
+	rdpShadowFrame* frame;
+
+	test_draw(surface, rect, value);
+	cacheFrameId = shadow_encode_cache_advance(cache);
+
+	if (!shadow_frame_publish(surface, cache))
+		return NULL;
+
+	region16_clear(&surface->invalidRegion);
+	frame = shadow_frame_acquire(surface, cache);
+
+	if (frame && (!test_frame_equal(frame, surface) || (frame->cacheFrameId != cacheFrameId) ||
+	              !test_region_equal(&frame->changed, rect, 1)))
+	{
+		fprintf(stderr, "[%s] snapshot differs from the surface\n", __FUNCTION__);
+		shadow_frame_release(frame);
+		return NULL;
+	}
+
+	return frame;
+}
+
+static BOOL test_frame_publish(void)
+{
+	BOOL rc = FALSE;
+	const RECTANGLE_16 full = { 0, 0, TEST_WIDTH, TEST_HEIGHT };
+	rdpShadowFrame* frames[4] = { 0 };
+	rdpShadowFrame* same = NULL;
+	rdpShadowEncodeCache* cache = shadow_encode_cache_new(SHADOW_ENCODE_CACHE_MAX_BYTES);
+	rdpShadowSurface* surface = shadow_surface_new(NULL, 0, 0, TEST_WIDTH, TEST_HEIGHT);
+
+	if (!cache || !surface)
+		goto fail;
+
+	if (!(frames[0] = test_publish(surface, cache, &full, 0x11)) ||
+	    !(frames[1] = test_publish(surface, cache, &test_rects[0], 0x22)))
+		goto fail;
+
+	/* Frame 0 is still used by a client, the next frame is a new copy */
+	if (!(frames[2] = test_publish(surface, cache, &test_rects[1], 0x33)) ||
+	    (frames[2] == frames[0]) || (frames[2] == frames[1]))
+		goto fail;
+
+	shadow_frame_release(frames[0]);
+	shadow_frame_release(frames[1]);
+	frames[0] = frames[1];
+	frames[1] = NULL;
+
+	/* Frame 1 is unused, its buffer catches up with the changes of frames 2 and 3 */
+	if (!(frames[3] = test_publish(surface, cache, &test_rects[2], 0x44)) ||
+	    (frames[3] != frames[0]))
+	{
+		fprintf(stderr, "[%s] unused snapshot was not recycled\n", __FUNCTION__);
+		goto fail;
+	}
+
+	frames[0] = NULL;
+
+	/* Publishing without changes keeps the latest snapshot */
+	if (!shadow_frame_publish(surface, cache) ||
+	    ((same = shadow_frame_acquire(surface, cache)) != frames[3]))
+		goto fail;
+
+	/* A reset takes a new snapshot on the next acquire, the frames in use stay valid */
+	shadow_frame_reset(surface);
+	shadow_frame_release(same);
+
+	if (!(same = shadow_frame_acquire(surface, cache)) || (same == frames[3]) ||
+	    !test_frame_equal(same, surface) || !test_frame_equal(frames[3], surface))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	shadow_frame_release(same);
+
+	for (size_t index = 0; index < ARRAYSIZE(frames); index++)
+		shadow_frame_release(frames[index]);
+
+	shadow_surface_free(surface);
+	shadow_encode_cache_free(cache);
+	return rc;
+}
+
+static BOOL test_frame_queue_drop(void)
+{
+	BOOL rc = FALSE;
+	REGION16 region;
+	rdpShadowFrame* frame = NULL;
+	rdpShadowFrame* popped = NULL;
+	rdpShadowFrameQueue* queue = shadow_frame_queue_new(2);
+	rdpShadowSurface* surface = shadow_surface_new(NULL, 0, 0, TEST_WIDTH, TEST_HEIGHT);
+
+	region16_init(&region);
+
+	if (!queue || !surface || !(frame = shadow_frame_acquire(surface, NULL)))
+		goto fail;
+
+	for (size_t index = 0; index < ARRAYSIZE(test_rects); index++)
+	{
+		region16_clear(&region);
+		region16_union_rect(&region, &region, &test_rects[index]);
+
+		if (!shadow_frame_queue_push(queue, frame, 0, &region))
+			goto fail;
+	}
+
+	/* The oldest frame was dropped, its changes are sent with the next one */
+	if ((shadow_frame_queue_count(queue) != 2) || (shadow_frame_queue_dropped(queue) != 1) ||
+	    !shadow_frame_queue_full(queue, NULL))
+	{
+		fprintf(stderr, "[%s] full queue did not drop the oldest frame\n", __FUNCTION__);
+		goto fail;
+	}
+
+	if (!shadow_frame_queue_pop(queue, &popped, &region) || (popped != frame) ||
+	    !test_region_equal(&region, test_rects, 2))
+	{
+		fprintf(stderr, "[%s] dropped changes were not merged\n", __FUNCTION__);
+		goto fail;
+	}
+
+	shadow_frame_release(popped);
+	popped = NULL;
+
+	if (!shadow_frame_queue_pop(queue, &popped, &region) ||
+	    !test_region_equal(&region, &test_rects[2], 1) ||
+	    shadow_frame_queue_pop(queue, &popped, &region))
+		goto fail;
+
+	shadow_frame_release(popped);
+	popped = NULL;
+
+	/* Queued references are released with the queue */
+	if (!shadow_frame_queue_push(queue, frame, 0, &region))
+		goto fail;
+
+	shadow_frame_queue_free(queue);
+	queue = NULL;
+
+	if (frame->refCount != 2)
+	{
+		fprintf(stderr, "[%s] %" PRId32 " frame references, expected 2\n", __FUNCTION__,
+		        frame->refCount);
+		goto fail;
+	}
+
+	/* A single slot keeps the merged changes in place */
+	if (!(queue = shadow_frame_queue_new(1)))
+		goto fail;
+
+	for (size_t index = 0; index < ARRAYSIZE(test_rects); index++)
+	{
+		region16_clear(&region);
+		region16_union_rect(&region, &region, &test_rects[index]);
+
+		if (!shadow_frame_queue_push(queue, frame, 0, &region))
+			goto fail;
+	}
+
+	if (!shadow_frame_queue_pop(queue, &popped, &region) ||
+	    !test_region_equal(&region, test_rects, ARRAYSIZE(test_rects)))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	region16_uninit(&region);
+	shadow_frame_release(popped);
+	shadow_frame_release(frame);
+	shadow_frame_queue_free(queue);
+	shadow_surface_free(surface);
+	return rc;
+}
+
+static BOOL test_frame_queue_ack(void)
+{
+	UINT64 oldest = 0;
+	rdpShadowFrameQueue* queue = shadow_frame_queue_new(3);
+
+	if (!queue)
+		return FALSE;
+
+	for (UINT32 id = 1; id <= 3; id++)
+		shadow_frame_queue_push(queue, NULL, id, NULL);
+
+	/* Acknowledging a frame acknowledges the ones before */
+	if (!shadow_frame_queue_full(queue, &oldest) || (oldest == 0))
+		goto fail;
+
+	shadow_frame_queue_ack(queue, 2);
+
+	if (shadow_frame_queue_full(queue, NULL) || (shadow_frame_queue_count(queue) != 1))
+		goto fail;
+
+	shadow_frame_queue_ack(queue, 3);
+
+	/* Frame ids wrap around */
+	shadow_frame_queue_push(queue, NULL, UINT32_MAX, NULL);
+	shadow_frame_queue_push(queue, NULL, 0, NULL);
+	shadow_frame_queue_ack(queue, 0);
+
+	if (shadow_frame_queue_count(queue) != 0)
+		goto fail;
+
+	shadow_frame_queue_free(queue);
+	return TRUE;
+fail:
+	fprintf(stderr, "[%s] unexpected queue state after acknowledgement\n", __FUNCTION__);
+	shadow_frame_queue_free(queue);
+	return FALSE;
+}
+
+static BOOL test_frame_pacing(void)
+{
+	const UINT64 last = 10000;
+	const struct
+	{
+		UINT64 now;
+		UINT32 fps;
+		BOOL backpressure;
+		UINT64 since;
+		DWORD delay;
+	} tests[] = {
+		{ last, 25, FALSE, 0, 40 },              /* frame rate */
+		{ last + 40, 25, FALSE, 0, 0 },          /* due */
+		{ last + 500, 0, FALSE, 0, 500 },        /* no frame rate */
+		{ last, 25, TRUE, last, 1000 },          /* blocked transport */
+		{ last + 40, 25, TRUE, last - 900, 60 }, /* full send queue */
+		{ last + 40, 25, TRUE, last - 2000, 0 }  /* acknowledgements missing for too long */
+	};
+
+	for (size_t index = 0; index < ARRAYSIZE(tests); index++)
+	{
+		const DWORD delay = shadow_frame_pacing_delay(tests[index].now, last, tests[index].fps,
+		                                              tests[index].backpressure,
+		                                              tests[index].since, 1000);
+
+		if (delay != tests[index].delay)
+		{
+			fprintf(stderr, "[%s] test %" PRIuz ": delay %" PRIu32 ", expected %" PRIu32 "\n",
+			        __FUNCTION__, index, delay, tests[index].delay);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+int TestShadowFrame(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_frame_publish())
+		return -1;
+
+	if (!test_frame_queue_drop())
+		return -1;
+
+	if (!test_frame_queue_ack())
+		return -1;
+
+	if (!test_frame_pacing())
+		return -1;
+
+	return 0;
+}
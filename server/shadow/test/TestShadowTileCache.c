@@ -0,0 +1,480 @@
+#include <stdio.h>
+
+#include <winpr/crt.h>
+
+#include <freerdp/codec/region.h>
+
+#include "../shadow_tile_cache.h"
+
+/* Must match the small cache limits in shadow_tile_cache.c */
+#define TEST_SMALL_SLOTS 4096
+#define TEST_SMALL_BYTES (16 * 1024 * 1024)
+#define TEST_TILE_BYTES (4 * SHADOW_TILE_SIZE * SHADOW_TILE_SIZE)
+
+typedef struct
+{
+	BYTE* data;
+	UINT32 width;
+	UINT32 height;
+	UINT32 step;
+	UINT32 gridWidth;
+} test_surface;
+
+static BOOL test_surface_init(test_surface* surface, UINT32 width, UINT32 height)
+{
+	surface->width = width;
+	surface->height = height;
+	surface->step = width * 4;
+	surface->gridWidth = (width + SHADOW_TILE_SIZE - 1) / SHADOW_TILE_SIZE;
+	surface->data = (BYTE*)calloc(height, surface->step);
+	return surface->data != NULL;
+}
+
+static void test_tile_rect(const test_surface* surface, UINT32 tile, RECTANGLE_16* rect)
+{
+	const UINT32 x = (tile % surface->gridWidth) * SHADOW_TILE_SIZE;
+	const UINT32 y = (tile / surface->gridWidth) * SHADOW_TILE_SIZE;
+
+	rect->left = (UINT16)x;
+	rect->top = (UINT16)y;
+	rect->right = (UINT16)MIN(x + SHADOW_TILE_SIZE, surface->width);
+	rect->bottom = (UINT16)MIN(y + SHADOW_TILE_SIZE, surface->height);
+}
+
+/* Fill a tile with a pattern, every seed gives different content, seed 0 a solid color */
+static void test_tile_fill(test_surface* surface, UINT32 tile, UINT32 seed)
+{
+	UINT32 x, y;
+	RECTANGLE_16 rect;
+	UINT32 state = seed * 2654435761u + 1;
+
+	test_tile_rect(surface, tile, &rect);
+
+	for (y = rect.top; y < rect.bottom; y++)
+	{
+		BYTE* pDst = &surface->data[y * surface->step];
+
+		for (x = rect.left; x < rect.right; x++)
+		{
+			UINT32 pixel = 0x00336699;
+
+			if (seed != 0)
+			{
+				state = state * 1664525u + 1013904223u;
+				pixel = (state >> 8) ^ seed;
+			}
+
+			CopyMemory(&pDst[x * 4], &pixel, sizeof(pixel));
+		}
+	}
+}
+
+static BOOL test_update(SHADOW_TILE_CACHE* cache, const test_surface* surface,
+                        const RECTANGLE_16* rect, SHADOW_TILE_CACHE_FRAME** ppFrame)
+{
+	BOOL rc;
+	REGION16 region;
+	RECTANGLE_16 full = { 0, 0, (UINT16)surface->width, (UINT16)surface->height };
+
+	region16_init(&region);
+	rc = region16_union_rect(&region, &region, rect ? rect : &full) &&
+	     shadow_tile_cache_update(cache, surface->data, surface->step, surface->width,
+	                              surface->height, &region, FALSE, ppFrame);
+	region16_uninit(&region);
+	return rc;
+}
+
+static BOOL test_update_tile(SHADOW_TILE_CACHE* cache, const test_surface* surface, UINT32 tile,
+                             SHADOW_TILE_CACHE_FRAME** ppFrame)
+{
+	RECTANGLE_16 rect;
+	test_tile_rect(surface, tile, &rect);
+	return test_update(cache, surface, &rect, ppFrame);
+}
+
+static BOOL test_frame_counts(const SHADOW_TILE_CACHE_FRAME* frame, size_t fills, size_t copies,
+                              size_t hits, size_t stores, size_t evictions, const char* what)
+{
+	if ((frame->numFills == fills) && (frame->numCopies == copies) && (frame->numHits == hits) &&
+	    (frame->numStores == stores) && (frame->numEvictions == evictions))
+		return TRUE;
+
+	fprintf(stderr,
+	        "[%s] %" PRIuz " fills, %" PRIuz " copies, %" PRIuz " hits, %" PRIuz " stores, %" PRIuz
+	        " evictions, expected %" PRIuz ", %" PRIuz ", %" PRIuz ", %" PRIuz ", %" PRIuz "\n",
+	        what, frame->numFills, frame->numCopies, frame->numHits, frame->numStores,
+	        frame->numEvictions, fills, copies, hits, stores, evictions);
+	return FALSE;
+}
+
+static BOOL test_tile_cache_classify(void)
+{
+	BOOL rc = FALSE;
+	UINT32 tile;
+	UINT16 slot3 = 0;
+	UINT32 numRects = 0;
+	RECTANGLE_16 rect;
+	test_surface surface = { 0 };
+	SHADOW_TILE_CACHE_FRAME* frame = NULL;
+	SHADOW_TILE_CACHE* cache = shadow_tile_cache_new(TRUE);
+
+	/* 4x2 tiles, tile 0 is solid and tile 2 repeats tile 1 */
+	if (!cache || !test_surface_init(&surface, 4 * SHADOW_TILE_SIZE, 2 * SHADOW_TILE_SIZE))
+		goto fail;
+
+	for (tile = 0; tile < 8; tile++)
+		test_tile_fill(&surface, tile, (tile == 2) ? 1 : tile);
+
+	if (!test_update(cache, &surface, NULL, &frame) ||
+	    !test_frame_counts(frame, 1, 0, 1, 6, 0, "first frame"))
+		goto fail;
+
+	test_tile_rect(&surface, 0, &rect);
+
+	if ((frame->fills[0].color.B != 0x99) || (frame->fills[0].color.G != 0x66) ||
+	    (frame->fills[0].color.R != 0x33) || (memcmp(&frame->fills[0].rect, &rect, sizeof(rect))))
+	{
+		fprintf(stderr, "[%s] wrong solid fill\n", __FUNCTION__);
+		goto fail;
+	}
+
+	/* Tile 1 is stored in this frame, the hit for tile 2 must follow the store */
+	if (!frame->hits[0].late || (frame->hits[0].cacheSlot != frame->stores[0].cacheSlot) ||
+	    (frame->hits[0].destPt.x != 2 * SHADOW_TILE_SIZE) || (frame->hits[0].destPt.y != 0))
+	{
+		fprintf(stderr, "[%s] tile 2 is not a late hit of tile 1\n", __FUNCTION__);
+		goto fail;
+	}
+
+	region16_rects(&frame->encodeRegion, &numRects);
+
+	if (numRects == 0)
+		goto fail;
+
+	slot3 = frame->stores[1].cacheSlot;
+
+	/* Nothing changed */
+	if (!test_update(cache, &surface, NULL, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 0, 0, 0, "unchanged frame") ||
+	    !region16_is_empty(&frame->encodeRegion))
+		goto fail;
+
+	/* Tile 3 shows the unchanged tile 4 */
+	test_tile_fill(&surface, 3, 4);
+
+	if (!test_update_tile(cache, &surface, 3, &frame) ||
+	    !test_frame_counts(frame, 0, 1, 0, 0, 0, "copy frame"))
+		goto fail;
+
+	test_tile_rect(&surface, 4, &rect);
+
+	if (memcmp(&frame->copies[0].rectSrc, &rect, sizeof(rect)) ||
+	    (frame->copies[0].destPt.x != 3 * SHADOW_TILE_SIZE) || (frame->copies[0].destPt.y != 0))
+	{
+		fprintf(stderr, "[%s] tile 3 is not copied from tile 4\n", __FUNCTION__);
+		goto fail;
+	}
+
+	/* Tile 5 shows the former content of tile 3, no longer on the surface */
+	test_tile_fill(&surface, 5, 3);
+
+	if (!test_update_tile(cache, &surface, 5, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 1, 0, 0, "hit frame"))
+		goto fail;
+
+	if (frame->hits[0].late || (frame->hits[0].cacheSlot != slot3))
+	{
+		fprintf(stderr, "[%s] tile 5 is not a hit of slot %" PRIu16 "\n", __FUNCTION__, slot3);
+		goto fail;
+	}
+
+	/* New content is encoded and stored */
+	test_tile_fill(&surface, 6, 100);
+
+	if (!test_update_tile(cache, &surface, 6, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 0, 1, 0, "store frame"))
+		goto fail;
+
+	test_tile_rect(&surface, 6, &rect);
+
+	if (memcmp(&frame->stores[0].rectSrc, &rect, sizeof(rect)) ||
+	    (frame->stores[0].cacheSlot == 0) || (frame->stores[0].cacheKey == 0))
+	{
+		fprintf(stderr, "[%s] tile 6 is not stored\n", __FUNCTION__);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(surface.data);
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+/* Store new tiles until the cache is full, evictions must start exactly at the limit */
+static BOOL test_tile_cache_limit(UINT32 width, UINT32 height, size_t capacity, const char* what)
+{
+	BOOL rc = FALSE;
+	UINT32 tile, seed = 1;
+	size_t stored = 0;
+	size_t round;
+	size_t rounds;
+	test_surface surface = { 0 };
+	SHADOW_TILE_CACHE_FRAME* frame = NULL;
+	SHADOW_TILE_CACHE* cache = shadow_tile_cache_new(TRUE);
+
+	if (!cache || !test_surface_init(&surface, width, height))
+		goto fail;
+
+	rounds = capacity / surface.gridWidth + 2;
+
+	for (round = 0; round < rounds; round++)
+	{
+		size_t x;
+		const size_t expected =
+		    (stored + surface.gridWidth > capacity) ? stored + surface.gridWidth - capacity : 0;
+
+		for (tile = 0; tile < surface.gridWidth; tile++)
+			test_tile_fill(&surface, tile, seed++);
+
+		if (!test_update(cache, &surface, NULL, &frame) ||
+		    !test_frame_counts(frame, 0, 0, 0, surface.gridWidth, expected, what))
+			goto fail;
+
+		for (x = 0; x < frame->numStores; x++)
+		{
+			if ((frame->stores[x].cacheSlot == 0) ||
+			    (frame->stores[x].cacheSlot > TEST_SMALL_SLOTS))
+			{
+				fprintf(stderr, "[%s] invalid slot %" PRIu16 "\n", what,
+				        frame->stores[x].cacheSlot);
+				goto fail;
+			}
+		}
+
+		stored = MIN(stored + surface.gridWidth, capacity);
+	}
+
+	rc = TRUE;
+fail:
+	free(surface.data);
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+static BOOL test_tile_cache_eviction_order(void)
+{
+	BOOL rc = FALSE;
+	UINT32 tile, seed = 1;
+	size_t x;
+	const size_t capacity = TEST_SMALL_BYTES / TEST_TILE_BYTES;
+	test_surface surface = { 0 };
+	SHADOW_TILE_CACHE_FRAME* frame = NULL;
+	SHADOW_TILE_CACHE* cache = shadow_tile_cache_new(TRUE);
+
+	if (!cache || !test_surface_init(&surface, 16 * SHADOW_TILE_SIZE, SHADOW_TILE_SIZE))
+		goto fail;
+
+	/* Fill slots 1 to capacity in order */
+	for (x = 0; x < capacity / surface.gridWidth; x++)
+	{
+		for (tile = 0; tile < surface.gridWidth; tile++)
+			test_tile_fill(&surface, tile, seed++);
+
+		if (!test_update(cache, &surface, NULL, &frame))
+			goto fail;
+	}
+
+	/* A hit on slot 1 gives it a second chance */
+	test_tile_fill(&surface, 0, 1);
+
+	if (!test_update_tile(cache, &surface, 0, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 1, 0, 0, "second chance") ||
+	    (frame->hits[0].cacheSlot != 1))
+		goto fail;
+
+	for (tile = 0; tile < surface.gridWidth; tile++)
+		test_tile_fill(&surface, tile, seed++);
+
+	if (!test_update(cache, &surface, NULL, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 0, surface.gridWidth, surface.gridWidth, "eviction"))
+		goto fail;
+
+	/* The clock hand skips the referenced slot 1 and evicts the oldest unreferenced slots */
+	for (x = 0; x < frame->numEvictions; x++)
+	{
+		if (frame->evictions[x] != x + 2)
+		{
+			fprintf(stderr, "[%s] eviction %" PRIuz " of slot %" PRIu16 ", expected %" PRIuz "\n",
+			        __FUNCTION__, x, frame->evictions[x], x + 2);
+			goto fail;
+		}
+	}
+
+	/* Slot 1 survived */
+	test_tile_fill(&surface, 0, 1);
+
+	if (!test_update_tile(cache, &surface, 0, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 1, 0, 0, "survivor") || (frame->hits[0].cacheSlot != 1))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(surface.data);
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+static BOOL test_tile_cache_reset(void)
+{
+	BOOL rc = FALSE;
+	UINT32 tile;
+	test_surface surface = { 0 };
+	SHADOW_TILE_CACHE_FRAME* frame = NULL;
+	SHADOW_TILE_CACHE* cache = shadow_tile_cache_new(FALSE);
+
+	if (!cache || !test_surface_init(&surface, 4 * SHADOW_TILE_SIZE, SHADOW_TILE_SIZE))
+		goto fail;
+
+	for (tile = 0; tile < 4; tile++)
+		test_tile_fill(&surface, tile, tile + 1);
+
+	if (!test_update(cache, &surface, NULL, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 0, 4, 0, "before reset"))
+		goto fail;
+
+	/* The client surface is blank, its bitmap cache is kept */
+	shadow_tile_cache_reset(cache);
+
+	if (!test_update(cache, &surface, NULL, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 4, 0, 0, "after reset") ||
+	    !region16_is_empty(&frame->encodeRegion))
+		goto fail;
+
+	rc = TRUE;
+fail:
+	free(surface.data);
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+static BOOL test_tile_cache_import(void)
+{
+	BOOL rc = FALSE;
+	UINT16 x;
+	UINT64 cacheKey;
+	test_surface surface = { 0 };
+	SHADOW_TILE_CACHE_FRAME* frame = NULL;
+	SHADOW_TILE_CACHE* source = shadow_tile_cache_new(TRUE);
+	SHADOW_TILE_CACHE* cache = shadow_tile_cache_new(TRUE);
+	RDPGFX_CACHE_IMPORT_OFFER_PDU* offer =
+	    (RDPGFX_CACHE_IMPORT_OFFER_PDU*)calloc(1, sizeof(RDPGFX_CACHE_IMPORT_OFFER_PDU));
+	RDPGFX_CACHE_IMPORT_REPLY_PDU* reply =
+	    (RDPGFX_CACHE_IMPORT_REPLY_PDU*)calloc(1, sizeof(RDPGFX_CACHE_IMPORT_REPLY_PDU));
+
+	if (!source || !cache || !offer || !reply ||
+	    !test_surface_init(&surface, SHADOW_TILE_SIZE, SHADOW_TILE_SIZE))
+		goto fail;
+
+	/* The cache key of a tile sent by an earlier connection */
+	test_tile_fill(&surface, 0, 42);
+
+	if (!test_update(source, &surface, NULL, &frame) || (frame->numStores != 1))
+		goto fail;
+
+	cacheKey = frame->stores[0].cacheKey;
+
+	/* Entries after the first one that does not fit are rejected */
+	offer->cacheEntriesCount = 4;
+	offer->cacheEntries[0].cacheKey = 0x1234;
+	offer->cacheEntries[0].bitmapLength = TEST_TILE_BYTES;
+	offer->cacheEntries[1].cacheKey = cacheKey;
+	offer->cacheEntries[1].bitmapLength = TEST_TILE_BYTES;
+	offer->cacheEntries[2].cacheKey = 0x5678;
+	offer->cacheEntries[2].bitmapLength = TEST_TILE_BYTES + 1;
+	offer->cacheEntries[3].cacheKey = 0x9ABC;
+	offer->cacheEntries[3].bitmapLength = TEST_TILE_BYTES;
+
+	if (!shadow_tile_cache_import(cache, offer, reply) || (reply->importedEntriesCount != 2) ||
+	    (reply->cacheSlots[0] == 0) || (reply->cacheSlots[1] == 0) ||
+	    (reply->cacheSlots[0] == reply->cacheSlots[1]))
+	{
+		fprintf(stderr, "[%s] %" PRIu16 " entries imported, expected 2\n", __FUNCTION__,
+		        reply->importedEntriesCount);
+		goto fail;
+	}
+
+	/* Only one offer is accepted */
+	if (!shadow_tile_cache_import(cache, offer, reply) || (reply->importedEntriesCount != 0))
+		goto fail;
+
+	/* The imported entry is used instead of encoding the tile */
+	if (!test_update(cache, &surface, NULL, &frame) ||
+	    !test_frame_counts(frame, 0, 0, 1, 0, 0, "imported hit") ||
+	    (frame->hits[0].cacheSlot != reply->cacheSlots[1]) || frame->hits[0].late)
+		goto fail;
+
+	/* No import after the first frame */
+	shadow_tile_cache_free(cache);
+	cache = shadow_tile_cache_new(TRUE);
+
+	if (!cache || !test_update(cache, &surface, NULL, &frame) ||
+	    !shadow_tile_cache_import(cache, offer, reply) || (reply->importedEntriesCount != 0))
+		goto fail;
+
+	/* The memory limit applies to imported entries */
+	shadow_tile_cache_free(cache);
+	cache = shadow_tile_cache_new(TRUE);
+	offer->cacheEntriesCount = 1100;
+
+	for (x = 0; x < offer->cacheEntriesCount; x++)
+	{
+		offer->cacheEntries[x].cacheKey = x + 1ULL;
+		offer->cacheEntries[x].bitmapLength = TEST_TILE_BYTES;
+	}
+
+	if (!cache || !shadow_tile_cache_import(cache, offer, reply) ||
+	    (reply->importedEntriesCount != TEST_SMALL_BYTES / TEST_TILE_BYTES))
+	{
+		fprintf(stderr, "[%s] %" PRIu16 " entries imported, expected %d\n", __FUNCTION__,
+		        reply->importedEntriesCount, TEST_SMALL_BYTES / TEST_TILE_BYTES);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	free(surface.data);
+	free(offer);
+	free(reply);
+	shadow_tile_cache_free(source);
+	shadow_tile_cache_free(cache);
+	return rc;
+}
+
+int TestShadowTileCache(int argc, char* argv[])
+{
+	WINPR_UNUSED(argc);
+	WINPR_UNUSED(argv);
+
+	if (!test_tile_cache_classify())
+		return -1;
+
+	/* 64x1 tiles hit the slot limit, 64x64 tiles the memory limit */
+	if (!test_tile_cache_limit(64 * SHADOW_TILE_SIZE, 1, TEST_SMALL_SLOTS, "slot limit"))
+		return -1;
+
+	if (!test_tile_cache_limit(16 * SHADOW_TILE_SIZE, SHADOW_TILE_SIZE,
+	                           TEST_SMALL_BYTES / TEST_TILE_BYTES, "memory limit"))
+		return -1;
+
+	if (!test_tile_cache_eviction_order())
+		return -1;
+
+	if (!test_tile_cache_reset())
+		return -1;
+
+	if (!test_tile_cache_import())
+		return -1;
+
+	return 0;
+}
@@ -234,6 +234,17 @@ extern "C"
 
 #endif /* WINPR_THREAD_POOL */
 
+	/**
+	 * WinPR extensions, available with the native thread pool as well.
+	 *
+	 * winpr_SubmitThreadpoolWorkBatch posts a callback for every work object in one call,
+	 * neighbouring work objects are preferably executed by the same worker thread.
+	 * winpr_SetThreadpoolWorkAffinity binds the callbacks of a work object to a preferred
+	 * worker, pass (DWORD)-1 to remove the hint. Idle workers still steal the work.
+	 */
+	WINPR_API VOID winpr_SubmitThreadpoolWorkBatch(PTP_WORK* pwks, size_t count);
+	WINPR_API VOID winpr_SetThreadpoolWorkAffinity(PTP_WORK pwk, DWORD hint);
+
 #if !defined(_WIN32)
 #define WINPR_CALLBACK_ENVIRON 1
 #elif defined(_WIN32) && (_WIN32_WINNT < 0x0600)
@@ -480,6 +480,10 @@ extern "C"
 
 	WINPR_API wStream* StreamPool_Find(wStreamPool* pool, BYTE* ptr);
 
+	/* References length bytes at ptr inside a stream in use without copying them, the slice
+	 * keeps that stream and the pool alive until it is released with Stream_Release */
+	WINPR_API wStream* StreamPool_Slice(wStreamPool* pool, const BYTE* ptr, size_t length);
+
 	WINPR_API void StreamPool_Clear(wStreamPool* pool);
 
 	WINPR_API wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize);
@@ -21,6 +21,7 @@
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/interlocked.h>
 #include <winpr/library.h>
 
 #include "pool.h"
@@ -51,102 +52,585 @@ static BOOL CALLBACK init_module(PINIT_ONCE once, PVOID param, PVOID* context)
 static TP_POOL DEFAULT_POOL = {
 	0,    /* DWORD Minimum */
 	500,  /* DWORD Maximum */
-	NULL, /* wArrayList* Threads */
-	NULL, /* wQueue* PendingQueue */
+	NULL, /* TP_WORKER** Workers */
+	0,    /* LONG WorkerCount */
+	0,    /* LONG WorkerCapacity */
+	NULL, /* TP_WORKER_ARRAY* Retired */
+	0,    /* LONG NextWorker */
+	0,    /* LONG Queued */
+	0,    /* LONG Idle */
+	0,    /* LONG Waiters */
+	0,    /* LONG Terminate */
 	NULL, /* HANDLE TerminateEvent */
-	NULL, /* wCountdownEvent* WorkComplete */
+	{ 0 }, /* CRITICAL_SECTION WaitLock */
+	NULL, /* TP_WAITER* WaitList */
 };
 
+/**
+ * Every worker owns a queue of pending callbacks. Submitted work is spread over
+ * the worker queues, a worker running out of work steals from the tail of the
+ * other queues before going idle. Sleeping workers are only woken when work is
+ * submitted while they are idle, a busy pool does not touch any kernel object.
+ * Every worker sleeps on its own event: a semaphore shared by all workers is not
+ * safe with more than one thread waiting on it through WaitForMultipleObjects.
+ */
+
+static BOOL work_queue_init(TP_WORK_QUEUE* queue)
+{
+	WINPR_ASSERT(queue);
+
+	queue->Head = 0;
+	queue->Size = 0;
+	queue->Capacity = 64;
+	queue->Items = (PTP_WORK*)calloc(queue->Capacity, sizeof(PTP_WORK));
+
+	if (!queue->Items)
+		return FALSE;
+
+	if (!InitializeCriticalSectionAndSpinCount(&queue->Lock, 4000))
+	{
+		free(queue->Items);
+		queue->Items = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void work_queue_uninit(TP_WORK_QUEUE* queue)
+{
+	WINPR_ASSERT(queue);
+
+	DeleteCriticalSection(&queue->Lock);
+	free(queue->Items);
+	queue->Items = NULL;
+}
+
+/* must be called with the queue lock held */
+static BOOL work_queue_push(TP_WORK_QUEUE* queue, PTP_WORK work)
+{
+	WINPR_ASSERT(queue);
+
+	if (queue->Size >= queue->Capacity)
+	{
+		size_t index;
+		const size_t capacity = queue->Capacity * 2;
+		PTP_WORK* items = (PTP_WORK*)calloc(capacity, sizeof(PTP_WORK));
+
+		if (!items)
+			return FALSE;
+
+		for (index = 0; index < queue->Size; index++)
+			items[index] = queue->Items[(queue->Head + index) % queue->Capacity];
+
+		free(queue->Items);
+		queue->Items = items;
+		queue->Head = 0;
+		queue->Capacity = capacity;
+	}
+
+	queue->Items[(queue->Head + queue->Size) % queue->Capacity] = work;
+	queue->Size++;
+	return TRUE;
+}
+
+static PTP_WORK work_queue_pop(TP_WORK_QUEUE* queue, BOOL steal)
+{
+	PTP_WORK work = NULL;
+
+	WINPR_ASSERT(queue);
+
+	EnterCriticalSection(&queue->Lock);
+
+	if (queue->Size > 0)
+	{
+		if (steal)
+			work = queue->Items[(queue->Head + queue->Size - 1) % queue->Capacity];
+		else
+		{
+			work = queue->Items[queue->Head];
+			queue->Head = (queue->Head + 1) % queue->Capacity;
+		}
+
+		queue->Size--;
+	}
+
+	LeaveCriticalSection(&queue->Lock);
+	return work;
+}
+
+static PTP_WORK thread_pool_take(TP_WORKER* worker)
+{
+	LONG index;
+	PTP_WORK work;
+	PTP_POOL pool;
+	LONG count;
+
+	WINPR_ASSERT(worker);
+	pool = worker->Pool;
+	WINPR_ASSERT(pool);
+
+	if (pool->Queued <= 0)
+		return NULL;
+
+	work = work_queue_pop(&worker->Queue, FALSE);
+	count = pool->WorkerCount;
+
+	for (index = 1; !work && (index < count); index++)
+		work = work_queue_pop(&pool->Workers[(worker->Index + index) % count]->Queue, TRUE);
+
+	if (work)
+		InterlockedDecrement(&pool->Queued);
+
+	return work;
+}
+
+static void thread_pool_wake_waiters(PTP_POOL pool, PTP_WORK work)
+{
+	TP_WAITER* waiter;
+
+	WINPR_ASSERT(pool);
+
+	/* Only the address of the work object is compared, it may already be closed */
+	EnterCriticalSection(&pool->WaitLock);
+
+	for (waiter = pool->WaitList; waiter; waiter = waiter->Next)
+	{
+		if (waiter->Work == work)
+			SetEvent(waiter->Event);
+	}
+
+	LeaveCriticalSection(&pool->WaitLock);
+}
+
+static void thread_pool_work_done(PTP_POOL pool, PTP_WORK work)
+{
+	WINPR_ASSERT(pool);
+	WINPR_ASSERT(work);
+
+	/* The work object may be closed as soon as the last callback finished */
+	if ((InterlockedDecrement(&work->Pending) == 0) && (pool->Waiters > 0))
+		thread_pool_wake_waiters(pool, work);
+}
+
+void thread_pool_wait(PTP_POOL pool, PTP_WORK work)
+{
+	BOOL blocked = FALSE;
+	TP_WAITER waiter = { 0 };
+	TP_WAITER** cur;
+
+	WINPR_ASSERT(pool);
+	WINPR_ASSERT(work);
+
+	if (work->Pending == 0)
+		return;
+
+	waiter.Work = work;
+
+	/* Every waiter gets its own event, a completion must not be consumed by a thread
+	 * waiting for another work object */
+	if (!(waiter.Event = CreateEvent(NULL, TRUE, FALSE, NULL)))
+	{
+		while (work->Pending > 0)
+			Sleep(1);
+
+		return;
+	}
+
+	/* Register before checking again, a worker completing the work object either sees the
+	 * waiter or the check below sees the completion */
+	InterlockedIncrement(&pool->Waiters);
+	EnterCriticalSection(&pool->WaitLock);
+
+	if (work->Pending > 0)
+	{
+		waiter.Next = pool->WaitList;
+		pool->WaitList = &waiter;
+		blocked = TRUE;
+	}
+
+	LeaveCriticalSection(&pool->WaitLock);
+
+	if (blocked)
+	{
+		/* A late wake up for a closed work object at the same address is possible, check
+		 * the counter again after resetting the event */
+		while (WaitForSingleObject(waiter.Event, INFINITE) == WAIT_OBJECT_0)
+		{
+			if (work->Pending == 0)
+				break;
+
+			ResetEvent(waiter.Event);
+
+			if (work->Pending == 0)
+				break;
+		}
+
+		EnterCriticalSection(&pool->WaitLock);
+
+		for (cur = &pool->WaitList; *cur; cur = &(*cur)->Next)
+		{
+			if (*cur == &waiter)
+			{
+				*cur = waiter.Next;
+				break;
+			}
+		}
+
+		LeaveCriticalSection(&pool->WaitLock);
+	}
+
+	InterlockedDecrement(&pool->Waiters);
+	CloseHandle(waiter.Event);
+}
+
 static DWORD WINAPI thread_pool_work_func(LPVOID arg)
 {
 	DWORD status;
 	PTP_POOL pool;
 	PTP_WORK work;
 	HANDLE events[2];
-	PTP_CALLBACK_INSTANCE callbackInstance;
+	TP_WORKER* worker = (TP_WORKER*)arg;
 
-	pool = (PTP_POOL)arg;
+	WINPR_ASSERT(worker);
+	pool = worker->Pool;
+	WINPR_ASSERT(pool);
 
 	events[0] = pool->TerminateEvent;
-	events[1] = Queue_Event(pool->PendingQueue);
+	events[1] = worker->WorkAvailable;
 
-	while (1)
+	while (!pool->Terminate)
 	{
+		work = thread_pool_take(worker);
+
+		if (work)
+		{
+			TP_CALLBACK_INSTANCE callbackInstance = { 0 };
+			callbackInstance.Work = work;
+			work->WorkCallback(&callbackInstance, work->CallbackParameter, work);
+			thread_pool_work_done(pool, work);
+			continue;
+		}
+
+		/* Announce the worker as idle before the final check, a concurrent submit either
+		 * sees the idle worker or the queued work is seen here */
+		InterlockedExchange(&worker->Idle, 1);
+		InterlockedIncrement(&pool->Idle);
+
+		if (pool->Queued > 0)
+		{
+			/* If a submit already claimed this worker its wake up is consumed below */
+			if (InterlockedExchange(&worker->Idle, 0) == 1)
+				InterlockedDecrement(&pool->Idle);
+
+			continue;
+		}
+
 		status = WaitForMultipleObjects(2, events, FALSE, INFINITE);
+		ResetEvent(worker->WorkAvailable);
 
-		if (status == WAIT_OBJECT_0)
-			break;
+		if (InterlockedExchange(&worker->Idle, 0) == 1)
+			InterlockedDecrement(&pool->Idle);
 
 		if (status != (WAIT_OBJECT_0 + 1))
 			break;
+	}
+
+	ExitThread(0);
+	return 0;
+}
+
+static void thread_pool_wake_workers(PTP_POOL pool, size_t count)
+{
+	LONG index;
+	const LONG workers = pool->WorkerCount;
+	const LONG start = (LONG)((ULONG)InterlockedIncrement(&pool->NextWorker) % (ULONG)workers);
 
-		callbackInstance = (PTP_CALLBACK_INSTANCE)Queue_Dequeue(pool->PendingQueue);
+	for (index = 0; (index < workers) && (count > 0); index++)
+	{
+		TP_WORKER* worker = pool->Workers[(start + index) % workers];
 
-		if (callbackInstance)
+		/* Claim the idle worker, only one submit wakes it */
+		if (InterlockedCompareExchange(&worker->Idle, 0, 1) == 1)
 		{
-			work = callbackInstance->Work;
-			work->WorkCallback(callbackInstance, work->CallbackParameter, work);
-			CountdownEvent_Signal(pool->WorkComplete, 1);
-			free(callbackInstance);
+			InterlockedDecrement(&pool->Idle);
+			SetEvent(worker->WorkAvailable);
+			count--;
 		}
 	}
+}
 
-	ExitThread(0);
-	return 0;
+BOOL thread_pool_enqueue(PTP_POOL pool, PTP_WORK* works, size_t count)
+{
+	size_t index;
+	LONG workers;
+	BOOL rc = TRUE;
+	TP_WORKER* locked = NULL;
+
+	WINPR_ASSERT(pool);
+	WINPR_ASSERT(works || (count == 0));
+
+	workers = pool->WorkerCount;
+
+	if ((count == 0) || (workers <= 0))
+		return count == 0;
+
+	for (index = 0; index < count; index++)
+	{
+		LONG target;
+		TP_WORKER* worker;
+		PTP_WORK work = works[index];
+
+		/* Without a hint neighbouring items of a batch go to the same worker */
+		if (work->Affinity >= 0)
+			target = work->Affinity % workers;
+		else if (count > 1)
+			target = (LONG)((index * (size_t)workers) / count);
+		else
+			target = (LONG)((ULONG)InterlockedIncrement(&pool->NextWorker) % (ULONG)workers);
+
+		worker = pool->Workers[target];
+
+		if (worker != locked)
+		{
+			if (locked)
+				LeaveCriticalSection(&locked->Queue.Lock);
+
+			locked = worker;
+			EnterCriticalSection(&locked->Queue.Lock);
+		}
+
+		InterlockedIncrement(&work->Pending);
+
+		if (!work_queue_push(&worker->Queue, work))
+		{
+			InterlockedDecrement(&work->Pending);
+			rc = FALSE;
+			break;
+		}
+
+		InterlockedIncrement(&pool->Queued);
+	}
+
+	if (locked)
+		LeaveCriticalSection(&locked->Queue.Lock);
+
+	/* Wake only as many workers as are idle and required */
+	if (pool->Idle > 0)
+		thread_pool_wake_workers(pool, index);
+
+	return rc;
 }
 
-static void threads_close(void* thread)
+LONG thread_pool_cancel(PTP_POOL pool, PTP_WORK work)
 {
-	WaitForSingleObject(thread, INFINITE);
-	CloseHandle(thread);
+	LONG index;
+	LONG cancelled = 0;
+
+	WINPR_ASSERT(pool);
+	WINPR_ASSERT(work);
+
+	for (index = 0; index < pool->WorkerCount; index++)
+	{
+		size_t x;
+		size_t size = 0;
+		TP_WORK_QUEUE* queue = &pool->Workers[index]->Queue;
+
+		EnterCriticalSection(&queue->Lock);
+
+		for (x = 0; x < queue->Size; x++)
+		{
+			PTP_WORK cur = queue->Items[(queue->Head + x) % queue->Capacity];
+
+			if (cur == work)
+				continue;
+
+			queue->Items[(queue->Head + size) % queue->Capacity] = cur;
+			size++;
+		}
+
+		cancelled += (LONG)(queue->Size - size);
+		queue->Size = size;
+		LeaveCriticalSection(&queue->Lock);
+	}
+
+	if (cancelled > 0)
+	{
+		InterlockedExchangeAdd(&pool->Queued, -cancelled);
+
+		if ((InterlockedExchangeAdd(&work->Pending, -cancelled) == cancelled) &&
+		    (pool->Waiters > 0))
+			thread_pool_wake_waiters(pool, work);
+	}
+
+	return cancelled;
+}
+
+static BOOL thread_pool_reserve_workers(PTP_POOL pool, DWORD count)
+{
+	LONG capacity;
+	TP_WORKER** workers;
+	TP_WORKER_ARRAY* retired = NULL;
+
+	WINPR_ASSERT(pool);
+
+	if ((LONG)count <= pool->WorkerCapacity)
+		return TRUE;
+
+	if (count > INT32_MAX / 2)
+		return FALSE;
+
+	capacity = (pool->WorkerCapacity > 4) ? pool->WorkerCapacity : 4;
+
+	while (capacity < (LONG)count)
+		capacity *= 2;
+
+	workers = (TP_WORKER**)calloc((size_t)capacity, sizeof(TP_WORKER*));
+
+	if (!workers)
+		return FALSE;
+
+	if (pool->Workers)
+	{
+		if (!(retired = (TP_WORKER_ARRAY*)calloc(1, sizeof(TP_WORKER_ARRAY))))
+		{
+			free(workers);
+			return FALSE;
+		}
+
+		CopyMemory(workers, pool->Workers, sizeof(TP_WORKER*) * (size_t)pool->WorkerCount);
+		retired->Workers = pool->Workers;
+		retired->Next = pool->Retired;
+		pool->Retired = retired;
+	}
+
+	/* Workers still reading the old array see the same entries */
+	InterlockedCompareExchangePointer((PVOID volatile*)&pool->Workers, workers, pool->Workers);
+	pool->WorkerCapacity = capacity;
+	return TRUE;
+}
+
+static BOOL thread_pool_add_worker(PTP_POOL pool)
+{
+	TP_WORKER* worker;
+
+	WINPR_ASSERT(pool);
+
+	if (!thread_pool_reserve_workers(pool, (DWORD)pool->WorkerCount + 1))
+		return FALSE;
+
+	worker = (TP_WORKER*)calloc(1, sizeof(TP_WORKER));
+
+	if (!worker)
+		return FALSE;
+
+	worker->Pool = pool;
+	worker->Index = pool->WorkerCount;
+
+	if (!work_queue_init(&worker->Queue))
+	{
+		free(worker);
+		return FALSE;
+	}
+
+	if (!(worker->WorkAvailable = CreateEvent(NULL, TRUE, FALSE, NULL)))
+	{
+		work_queue_uninit(&worker->Queue);
+		free(worker);
+		return FALSE;
+	}
+
+	if (!(worker->Thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)worker,
+	                                    CREATE_SUSPENDED, NULL)))
+	{
+		CloseHandle(worker->WorkAvailable);
+		work_queue_uninit(&worker->Queue);
+		free(worker);
+		return FALSE;
+	}
+
+	/* Publish the worker before it starts stealing from the others */
+	pool->Workers[worker->Index] = worker;
+	InterlockedIncrement(&pool->WorkerCount);
+	ResumeThread(worker->Thread);
+	return TRUE;
+}
+
+static void thread_pool_free_workers(PTP_POOL pool)
+{
+	LONG index;
+
+	WINPR_ASSERT(pool);
+
+	while (pool->Retired)
+	{
+		TP_WORKER_ARRAY* retired = pool->Retired;
+		pool->Retired = retired->Next;
+		free(retired->Workers);
+		free(retired);
+	}
+
+	if (!pool->Workers)
+		return;
+
+	pool->Terminate = TRUE;
+
+	if (pool->TerminateEvent)
+		SetEvent(pool->TerminateEvent);
+
+	for (index = 0; index < pool->WorkerCount; index++)
+	{
+		TP_WORKER* worker = pool->Workers[index];
+		WaitForSingleObject(worker->Thread, INFINITE);
+		CloseHandle(worker->Thread);
+		CloseHandle(worker->WorkAvailable);
+		work_queue_uninit(&worker->Queue);
+		free(worker);
+	}
+
+	free(pool->Workers);
+	pool->Workers = NULL;
+	pool->WorkerCount = 0;
 }
 
 static BOOL InitializeThreadpool(PTP_POOL pool)
 {
-	BOOL rc = FALSE;
 	int index;
-	wObject* obj;
-	HANDLE thread;
 
-	if (pool->Threads)
+	if (pool->Workers)
 		return TRUE;
 
 	pool->Minimum = 0;
 	pool->Maximum = 500;
-
-	if (!(pool->PendingQueue = Queue_New(TRUE, -1, -1)))
-		goto fail;
-
-	if (!(pool->WorkComplete = CountdownEvent_New(0)))
-		goto fail;
+	pool->Terminate = FALSE;
+	pool->WorkerCapacity = 0;
+	pool->Retired = NULL;
+	pool->WaitList = NULL;
+	InitializeCriticalSection(&pool->WaitLock);
 
 	if (!(pool->TerminateEvent = CreateEvent(NULL, TRUE, FALSE, NULL)))
 		goto fail;
 
-	if (!(pool->Threads = ArrayList_New(TRUE)))
+	if (!thread_pool_reserve_workers(pool, 4))
 		goto fail;
 
-	obj = ArrayList_Object(pool->Threads);
-	obj->fnObjectFree = threads_close;
-
 	for (index = 0; index < 4; index++)
 	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)pool, 0, NULL)))
-		{
-			goto fail;
-		}
-
-		if (!ArrayList_Append(pool->Threads, thread))
-		{
-			CloseHandle(thread);
+		if (!thread_pool_add_worker(pool))
 			goto fail;
-		}
 	}
 
-	rc = TRUE;
+	return TRUE;
 
 fail:
-	return rc;
+	thread_pool_free_workers(pool);
+
+	if (pool->TerminateEvent)
+		CloseHandle(pool->TerminateEvent);
+
+	pool->TerminateEvent = NULL;
+	DeleteCriticalSection(&pool->WaitLock);
+	return FALSE;
 }
 
 PTP_POOL GetDefaultThreadpool(void)
@@ -176,7 +660,7 @@ PTP_POOL winpr_CreateThreadpool(PVOID reserved)
 
 	if (!InitializeThreadpool(pool))
 	{
-		winpr_CloseThreadpool(pool);
+		free(pool);
 		return NULL;
 	}
 
@@ -193,12 +677,9 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 		return;
 	}
 #endif
-	SetEvent(ptpp->TerminateEvent);
-
-	ArrayList_Free(ptpp->Threads);
-	Queue_Free(ptpp->PendingQueue);
-	CountdownEvent_Free(ptpp->WorkComplete);
+	thread_pool_free_workers(ptpp);
 	CloseHandle(ptpp->TerminateEvent);
+	DeleteCriticalSection(&ptpp->WaitLock);
 
 	{
 		TP_POOL empty = { 0 };
@@ -211,7 +692,6 @@ VOID winpr_CloseThreadpool(PTP_POOL ptpp)
 
 BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 {
-	HANDLE thread;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 	if (pSetThreadpoolThreadMinimum)
@@ -219,18 +699,14 @@ BOOL winpr_SetThreadpoolThreadMinimum(PTP_POOL ptpp, DWORD cthrdMic)
 #endif
 	ptpp->Minimum = cthrdMic;
 
-	while (ArrayList_Count(ptpp->Threads) < (INT64)ptpp->Minimum)
-	{
-		if (!(thread = CreateThread(NULL, 0, thread_pool_work_func, (void*)ptpp, 0, NULL)))
-		{
-			return FALSE;
-		}
+	if (ptpp->Maximum < cthrdMic)
+		ptpp->Maximum = cthrdMic;
 
-		if (!ArrayList_Append(ptpp->Threads, thread))
-		{
-			CloseHandle(thread);
+	/* The worker array grows as required, the minimum is not bounded by its initial size */
+	while (ptpp->WorkerCount < (LONG)ptpp->Minimum)
+	{
+		if (!thread_pool_add_worker(ptpp))
 			return FALSE;
-		}
 	}
 
 	return TRUE;
@@ -247,6 +723,9 @@ VOID winpr_SetThreadpoolThreadMaximum(PTP_POOL ptpp, DWORD cthrdMost)
 	}
 #endif
 	ptpp->Maximum = cthrdMost;
+
+	if (ptpp->Minimum > cthrdMost)
+		ptpp->Minimum = cthrdMost;
 }
 
 #endif /* WINPR_THREAD_POOL defined */
@@ -33,14 +33,60 @@ struct _TP_CALLBACK_INSTANCE
 	PTP_WORK Work;
 };
 
+/* Callbacks queued for one worker, the owner takes from the head, idle workers steal from the
+ * tail */
+typedef struct
+{
+	CRITICAL_SECTION Lock;
+	PTP_WORK* Items;
+	size_t Head;
+	size_t Size;
+	size_t Capacity;
+} TP_WORK_QUEUE;
+
+typedef struct
+{
+	PTP_POOL Pool;
+	HANDLE Thread;
+	LONG Index;
+	TP_WORK_QUEUE Queue;
+	HANDLE WorkAvailable;
+	volatile LONG Idle;
+} TP_WORKER;
+
+/* A worker array replaced by a larger one. Workers index the array without a lock, so it is
+ * only freed with the pool. */
+typedef struct S_TP_WORKER_ARRAY
+{
+	TP_WORKER** Workers;
+	struct S_TP_WORKER_ARRAY* Next;
+} TP_WORKER_ARRAY;
+
+/* A thread blocked in WaitForThreadpoolWorkCallbacks, signalled once Work has no pending
+ * callbacks left */
+typedef struct S_TP_WAITER
+{
+	PTP_WORK Work;
+	HANDLE Event;
+	struct S_TP_WAITER* Next;
+} TP_WAITER;
+
 struct _TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
+	TP_WORKER** Workers;
+	volatile LONG WorkerCount;
+	LONG WorkerCapacity;
+	TP_WORKER_ARRAY* Retired;
+	volatile LONG NextWorker;
+	volatile LONG Queued;
+	volatile LONG Idle;
+	volatile LONG Waiters;
+	volatile LONG Terminate;
 	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	CRITICAL_SECTION WaitLock;
+	TP_WAITER* WaitList;
 };
 
 struct _TP_WORK
@@ -48,6 +94,8 @@ struct _TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	volatile LONG Pending;
+	LONG Affinity;
 };
 
 struct _TP_TIMER
@@ -77,14 +125,60 @@ struct S_TP_CALLBACK_INSTANCE
 	PTP_WORK Work;
 };
 
+/* Callbacks queued for one worker, the owner takes from the head, idle workers steal from the
+ * tail */
+typedef struct
+{
+	CRITICAL_SECTION Lock;
+	PTP_WORK* Items;
+	size_t Head;
+	size_t Size;
+	size_t Capacity;
+} TP_WORK_QUEUE;
+
+typedef struct
+{
+	PTP_POOL Pool;
+	HANDLE Thread;
+	LONG Index;
+	TP_WORK_QUEUE Queue;
+	HANDLE WorkAvailable;
+	volatile LONG Idle;
+} TP_WORKER;
+
+/* A worker array replaced by a larger one. Workers index the array without a lock, so it is
+ * only freed with the pool. */
+typedef struct S_TP_WORKER_ARRAY
+{
+	TP_WORKER** Workers;
+	struct S_TP_WORKER_ARRAY* Next;
+} TP_WORKER_ARRAY;
+
+/* A thread blocked in WaitForThreadpoolWorkCallbacks, signalled once Work has no pending
+ * callbacks left */
+typedef struct S_TP_WAITER
+{
+	PTP_WORK Work;
+	HANDLE Event;
+	struct S_TP_WAITER* Next;
+} TP_WAITER;
+
 struct S_TP_POOL
 {
 	DWORD Minimum;
 	DWORD Maximum;
-	wArrayList* Threads;
-	wQueue* PendingQueue;
+	TP_WORKER** Workers;
+	volatile LONG WorkerCount;
+	LONG WorkerCapacity;
+	TP_WORKER_ARRAY* Retired;
+	volatile LONG NextWorker;
+	volatile LONG Queued;
+	volatile LONG Idle;
+	volatile LONG Waiters;
+	volatile LONG Terminate;
 	HANDLE TerminateEvent;
-	wCountdownEvent* WorkComplete;
+	CRITICAL_SECTION WaitLock;
+	TP_WAITER* WaitList;
 };
 
 struct S_TP_WORK
@@ -92,6 +186,8 @@ struct S_TP_WORK
 	PVOID CallbackParameter;
 	PTP_WORK_CALLBACK WorkCallback;
 	PTP_CALLBACK_ENVIRON CallbackEnvironment;
+	volatile LONG Pending;
+	LONG Affinity;
 };
 
 struct S_TP_TIMER
@@ -119,4 +215,8 @@ struct S_TP_CLEANUP_GROUP
 
 PTP_POOL GetDefaultThreadpool(void);
 
+BOOL thread_pool_enqueue(PTP_POOL pool, PTP_WORK* works, size_t count);
+LONG thread_pool_cancel(PTP_POOL pool, PTP_WORK work);
+void thread_pool_wait(PTP_POOL pool, PTP_WORK work);
+
 #endif /* WINPR_POOL_PRIVATE_H */
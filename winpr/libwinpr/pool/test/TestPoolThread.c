@@ -1,6 +1,7 @@
 
 #include <winpr/crt.h>
 #include <winpr/pool.h>
+#include <winpr/interlocked.h>
 
 /**
  * Improve Scalability With New Thread Pool APIs:
@@ -14,6 +15,59 @@
  * http://blogs.msdn.com/b/harip/archive/2010/10/12/introduction-to-the-windows-threadpool-part-2.aspx
  */
 
+static LONG g_Executed = 0;
+
+static void CALLBACK test_count_work(PTP_CALLBACK_INSTANCE instance, void* context, PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(context);
+	WINPR_UNUSED(work);
+	InterlockedIncrement(&g_Executed);
+}
+
+/* The worker array starts small and grows past the default maximum of 500 */
+static BOOL test_large_minimum(void)
+{
+	BOOL rc = FALSE;
+	PTP_WORK work = NULL;
+	TP_POOL* pool = CreateThreadpool(NULL);
+	TP_CALLBACK_ENVIRON environment;
+
+	if (!pool)
+		return FALSE;
+
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+
+	if (!SetThreadpoolThreadMinimum(pool, 520))
+	{
+		printf("SetThreadpoolThreadMinimum above 500 failed\n");
+		goto fail;
+	}
+
+	if (!(work = CreateThreadpoolWork(test_count_work, NULL, &environment)))
+		goto fail;
+
+	for (size_t x = 0; x < 2000; x++)
+		SubmitThreadpoolWork(work);
+
+	WaitForThreadpoolWorkCallbacks(work, FALSE);
+
+	if (g_Executed != 2000)
+	{
+		printf("%" PRId32 " of 2000 callbacks executed\n", g_Executed);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	if (work)
+		CloseThreadpoolWork(work);
+	CloseThreadpool(pool);
+	DestroyThreadpoolEnvironment(&environment);
+	return rc;
+}
+
 int TestPoolThread(int argc, char* argv[])
 {
 	TP_POOL* pool;
@@ -37,5 +91,8 @@ int TestPoolThread(int argc, char* argv[])
 
 	CloseThreadpool(pool);
 
+	if (!test_large_minimum())
+		return -1;
+
 	return 0;
 }
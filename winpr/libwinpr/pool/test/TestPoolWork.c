@@ -2,6 +2,9 @@
 #include <winpr/crt.h>
 #include <winpr/pool.h>
 #include <winpr/interlocked.h>
+#include <winpr/synch.h>
+#include <winpr/thread.h>
+#include <winpr/sysinfo.h>
 
 static LONG count = 0;
 
@@ -123,6 +126,215 @@ fail:
 	return rc;
 }
 
+static void CALLBACK test_BatchCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                        PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	InterlockedIncrement((LONG*)context);
+}
+
+static BOOL test3(void)
+{
+	size_t index;
+	BOOL rc = TRUE;
+	PTP_WORK works[64] = { 0 };
+	LONG counters[ARRAYSIZE(works)] = { 0 };
+	printf("Batch submission\n");
+
+	for (index = 0; index < ARRAYSIZE(works); index++)
+	{
+		if (!(works[index] = CreateThreadpoolWork(test_BatchCallback, &counters[index], NULL)))
+		{
+			printf("CreateThreadpoolWork failure\n");
+			rc = FALSE;
+			goto fail;
+		}
+
+		if (index % 2)
+			winpr_SetThreadpoolWorkAffinity(works[index], (DWORD)index);
+	}
+
+	winpr_SubmitThreadpoolWorkBatch(works, ARRAYSIZE(works));
+	winpr_SubmitThreadpoolWorkBatch(works, ARRAYSIZE(works));
+
+	for (index = 0; index < ARRAYSIZE(works); index++)
+	{
+		WaitForThreadpoolWorkCallbacks(works[index], FALSE);
+
+		if (counters[index] != 2)
+		{
+			printf("work %" PRIuz " executed %" PRId32 " times\n", index, counters[index]);
+			rc = FALSE;
+		}
+	}
+
+fail:
+	for (index = 0; index < ARRAYSIZE(works); index++)
+	{
+		if (works[index])
+			CloseThreadpoolWork(works[index]);
+	}
+
+	return rc;
+}
+
+static HANDLE release = NULL;
+
+static void CALLBACK test_BlockingCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                           PTP_WORK work)
+{
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+	WaitForSingleObject(release, INFINITE);
+	InterlockedIncrement((LONG*)context);
+}
+
+static DWORD WINAPI test_WaitThread(LPVOID arg)
+{
+	WaitForThreadpoolWorkCallbacks((PTP_WORK)arg, FALSE);
+	return 0;
+}
+
+static BOOL test4(void)
+{
+	size_t index;
+	BOOL rc = FALSE;
+	LONG counter = 0;
+	PTP_WORK work = NULL;
+	HANDLE threads[8] = { 0 };
+	printf("Concurrent waiters\n");
+
+	if (!(release = CreateEvent(NULL, TRUE, FALSE, NULL)))
+		return FALSE;
+
+	if (!(work = CreateThreadpoolWork(test_BlockingCallback, &counter, NULL)))
+		goto fail;
+
+	for (index = 0; index < 16; index++)
+		SubmitThreadpoolWork(work);
+
+	for (index = 0; index < ARRAYSIZE(threads); index++)
+	{
+		if (!(threads[index] = CreateThread(NULL, 0, test_WaitThread, work, 0, NULL)))
+			goto fail;
+	}
+
+	/* Let every waiter block before the callbacks are released */
+	Sleep(100);
+	SetEvent(release);
+
+	if (WaitForMultipleObjects(ARRAYSIZE(threads), threads, TRUE, 10000) != WAIT_OBJECT_0)
+	{
+		printf("waiters did not return\n");
+		goto fail;
+	}
+
+	if (counter != 16)
+	{
+		printf("work executed %" PRId32 " times\n", counter);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	SetEvent(release);
+
+	for (index = 0; index < ARRAYSIZE(threads); index++)
+	{
+		if (!threads[index])
+			continue;
+
+		WaitForSingleObject(threads[index], INFINITE);
+		CloseHandle(threads[index]);
+	}
+
+	if (work)
+		CloseThreadpoolWork(work);
+
+	CloseHandle(release);
+	release = NULL;
+	return rc;
+}
+
+#define TEST5_WORKERS 8
+
+static volatile LONG started = 0;
+
+static void CALLBACK test_BarrierCallback(PTP_CALLBACK_INSTANCE instance, void* context,
+                                          PTP_WORK work)
+{
+	const UINT64 end = GetTickCount64() + 10000;
+	WINPR_UNUSED(instance);
+	WINPR_UNUSED(work);
+
+	/* Only returns once every callback of the batch runs on its own worker at the same time */
+	InterlockedIncrement(&started);
+
+	while (started < TEST5_WORKERS)
+	{
+		if (GetTickCount64() > end)
+			return;
+
+		Sleep(1);
+	}
+
+	InterlockedIncrement((LONG*)context);
+}
+
+static BOOL test5(void)
+{
+	size_t index;
+	BOOL rc = FALSE;
+	LONG counter = 0;
+	PTP_POOL pool;
+	PTP_WORK works[TEST5_WORKERS] = { 0 };
+	TP_CALLBACK_ENVIRON environment;
+	printf("Batch wakes idle workers\n");
+
+	if (!(pool = CreateThreadpool(NULL)))
+		return FALSE;
+
+	InitializeThreadpoolEnvironment(&environment);
+	SetThreadpoolCallbackPool(&environment, pool);
+	SetThreadpoolThreadMaximum(pool, TEST5_WORKERS);
+
+	if (!SetThreadpoolThreadMinimum(pool, TEST5_WORKERS))
+		goto fail;
+
+	for (index = 0; index < ARRAYSIZE(works); index++)
+	{
+		if (!(works[index] = CreateThreadpoolWork(test_BarrierCallback, &counter, &environment)))
+			goto fail;
+	}
+
+	/* Let all workers go idle, then wake them with a single submission */
+	Sleep(100);
+	started = 0;
+	winpr_SubmitThreadpoolWorkBatch(works, ARRAYSIZE(works));
+
+	for (index = 0; index < ARRAYSIZE(works); index++)
+		WaitForThreadpoolWorkCallbacks(works[index], FALSE);
+
+	if (counter != TEST5_WORKERS)
+	{
+		printf("only %" PRId32 " of %d workers ran concurrently\n", counter, TEST5_WORKERS);
+		goto fail;
+	}
+
+	rc = TRUE;
+fail:
+	for (index = 0; index < ARRAYSIZE(works); index++)
+	{
+		if (works[index])
+			CloseThreadpoolWork(works[index]);
+	}
+
+	DestroyThreadpoolEnvironment(&environment);
+	CloseThreadpool(pool);
+	return rc;
+}
+
 int TestPoolWork(int argc, char* argv[])
 {
 
@@ -135,5 +347,14 @@ int TestPoolWork(int argc, char* argv[])
 	if (!test2())
 		return -1;
 
+	if (!test3())
+		return -1;
+
+	if (!test4())
+		return -1;
+
+	if (!test5())
+		return -1;
+
 	return 0;
 }
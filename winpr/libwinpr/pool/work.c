@@ -91,6 +91,7 @@ PTP_WORK winpr_CreateThreadpoolWork(PTP_WORK_CALLBACK pfnwk, PVOID pv, PTP_CALLB
 		work->CallbackEnvironment = pcbe;
 		work->WorkCallback = pfnwk;
 		work->CallbackParameter = pv;
+		work->Affinity = -1;
 #ifndef _WIN32
 
 		if (pcbe->CleanupGroup)
@@ -124,8 +125,6 @@ VOID winpr_CloseThreadpoolWork(PTP_WORK pwk)
 
 VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 {
-	PTP_POOL pool;
-	PTP_CALLBACK_INSTANCE callbackInstance;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
 
@@ -136,15 +135,8 @@ VOID winpr_SubmitThreadpoolWork(PTP_WORK pwk)
 	}
 
 #endif
-	pool = pwk->CallbackEnvironment->Pool;
-	callbackInstance = (PTP_CALLBACK_INSTANCE)calloc(1, sizeof(TP_CALLBACK_INSTANCE));
-
-	if (callbackInstance)
-	{
-		callbackInstance->Work = pwk;
-		CountdownEvent_AddCount(pool->WorkComplete, 1);
-		Queue_Enqueue(pool->PendingQueue, callbackInstance);
-	}
+	if (!thread_pool_enqueue(pwk->CallbackEnvironment->Pool, &pwk, 1))
+		WLog_ERR(TAG, "error submitting work");
 }
 
 BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
@@ -163,7 +155,6 @@ BOOL winpr_TrySubmitThreadpoolCallback(PTP_SIMPLE_CALLBACK pfns, PVOID pv,
 
 VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallbacks)
 {
-	HANDLE event;
 	PTP_POOL pool;
 #ifdef _WIN32
 	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
@@ -176,10 +167,66 @@ VOID winpr_WaitForThreadpoolWorkCallbacks(PTP_WORK pwk, BOOL fCancelPendingCallb
 
 #endif
 	pool = pwk->CallbackEnvironment->Pool;
-	event = CountdownEvent_WaitHandle(pool->WorkComplete);
 
-	if (WaitForSingleObject(event, INFINITE) != WAIT_OBJECT_0)
-		WLog_ERR(TAG, "error waiting on work completion");
+	if (fCancelPendingCallbacks)
+		thread_pool_cancel(pool, pwk);
+
+	thread_pool_wait(pool, pwk);
 }
 
 #endif /* WINPR_THREAD_POOL defined */
+
+VOID winpr_SubmitThreadpoolWorkBatch(PTP_WORK* pwks, size_t count)
+{
+	size_t index;
+#ifdef WINPR_THREAD_POOL
+	size_t first = 0;
+#endif
+
+	if (!pwks)
+		return;
+
+#ifdef WINPR_THREAD_POOL
+#ifdef _WIN32
+	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
+
+	if (!pSubmitThreadpoolWork)
+#endif
+	{
+		/* Items of one pool are queued at once */
+		for (index = 1; index <= count; index++)
+		{
+			if ((index < count) && (pwks[index]->CallbackEnvironment->Pool ==
+			                        pwks[first]->CallbackEnvironment->Pool))
+				continue;
+
+			if (!thread_pool_enqueue(pwks[first]->CallbackEnvironment->Pool, &pwks[first],
+			                         index - first))
+				WLog_ERR(TAG, "error submitting work");
+
+			first = index;
+		}
+
+		return;
+	}
+#endif
+
+	for (index = 0; index < count; index++)
+		SubmitThreadpoolWork(pwks[index]);
+}
+
+VOID winpr_SetThreadpoolWorkAffinity(PTP_WORK pwk, DWORD hint)
+{
+#ifdef WINPR_THREAD_POOL
+#ifdef _WIN32
+	InitOnceExecuteOnce(&init_once_module, init_module, NULL, NULL);
+
+	if (pSubmitThreadpoolWork)
+		return;
+#endif
+	pwk->Affinity = (hint > INT32_MAX) ? -1 : (LONG)hint;
+#else
+	WINPR_UNUSED(pwk);
+	WINPR_UNUSED(hint);
+#endif
+}
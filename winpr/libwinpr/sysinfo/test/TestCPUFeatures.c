@@ -27,6 +27,7 @@ int TestCPUFeatures(int argc, char* argv[])
 	TEST_FEATURE_EX(PF_EX_SSE41);
 	TEST_FEATURE_EX(PF_EX_SSE42);
 	TEST_FEATURE_EX(PF_EX_AVX);
+	TEST_FEATURE_EX(PF_EX_AVX2);
 	TEST_FEATURE_EX(PF_EX_FMA);
 	TEST_FEATURE_EX(PF_EX_AVX_AES);
 	TEST_FEATURE_EX(PF_EX_AVX_PCLMULQDQ);
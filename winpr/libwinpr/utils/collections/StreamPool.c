@@ -21,20 +21,69 @@
 
 #include <winpr/crt.h>
 #include <winpr/wlog.h>
+#include <winpr/interlocked.h>
 
 #include <winpr/collections.h>
 
 #include "../stream.h"
 
+/*
+ * Available streams are kept in size classes of powers of two. Every class
+ * holds a fixed number of nodes linked into two lock free stacks, one for the
+ * nodes holding an available stream and one for the unused nodes. The stack
+ * heads combine the node index with a tag incremented on every change, which
+ * protects the compare exchange against ABA.
+ *
+ * Take and Return only touch the stacks of one class, the pool lock is only
+ * required to create and free streams.
+ *
+ * Slices reference a range of the buffer of a stream in use without copying
+ * it. A slice holds a reference on that stream and on the pool, the pool is
+ * destroyed once StreamPool_Free was called and the last slice is released.
+ */
+
+#define STREAMPOOL_MIN_CLASS_SHIFT 8 /* 256 bytes */
+#define STREAMPOOL_CLASSES 15        /* up to 4 MiB */
+#define STREAMPOOL_CLASS_NODES 64
+
+typedef struct
+{
+	wStream* stream;
+	volatile LONG next; /* index + 1 of the next node, 0 terminates the stack */
+} wStreamPoolNode;
+
+typedef struct
+{
+	size_t size;
+	volatile LONGLONG available; /* stack of nodes holding a stream */
+	volatile LONGLONG unused;    /* stack of nodes without a stream */
+	wStreamPoolNode nodes[STREAMPOOL_CLASS_NODES];
+
+	volatile LONG depth;
+	volatile LONG hits;
+	volatile LONG misses;
+	volatile LONG drops;
+} wStreamPoolClass;
+
+typedef struct s_wStreamPoolEntry
+{
+	wStream s; /* must be the first member, Stream_Free releases the entry */
+	struct s_wStreamPoolEntry* prev;
+	struct s_wStreamPoolEntry* next;
+	wStream* parent; /* stream referenced by a slice, slices are not linked into entries */
+} wStreamPoolEntry;
+
 struct s_wStreamPool
 {
-	size_t aSize;
-	size_t aCapacity;
-	wStream** aArray;
+	wStreamPoolClass classes[STREAMPOOL_CLASSES];
+	volatile LONG used;
+	volatile LONG oversized;
+	volatile LONG slices;
+	volatile LONG refs;
 
-	size_t uSize;
-	size_t uCapacity;
-	wStream** uArray;
+	/* All streams created by the pool, available or in use */
+	wStreamPoolEntry* entries;
+	size_t count;
 
 	CRITICAL_SECTION lock;
 	BOOL synchronized;
@@ -63,180 +112,264 @@ static INLINE void StreamPool_Unlock(wStreamPool* pool)
 		LeaveCriticalSection(&pool->lock);
 }
 
-static BOOL StreamPool_EnsureCapacity(wStreamPool* pool, size_t count, BOOL usedOrAvailable)
+/**
+ * Lock free node stacks
+ */
+
+static INLINE LONGLONG StreamPool_StackHead(LONGLONG head, UINT32 index)
 {
-	size_t new_cap = 0;
-	size_t* cap;
-	size_t* size;
-	wStream*** array;
+	const ULONGLONG tag = ((ULONGLONG)head >> 32) + 1;
+	return (LONGLONG)((tag << 32) | index);
+}
 
-	WINPR_ASSERT(pool);
+static UINT32 StreamPool_StackPop(wStreamPoolClass* cls, volatile LONGLONG* stack)
+{
+	WINPR_ASSERT(cls);
+	WINPR_ASSERT(stack);
 
-	cap = (usedOrAvailable) ? &pool->uCapacity : &pool->aCapacity;
-	size = (usedOrAvailable) ? &pool->uSize : &pool->aSize;
-	array = (usedOrAvailable) ? &pool->uArray : &pool->aArray;
-	if (*cap == 0)
-		new_cap = *size + count;
-	else if (*size + count > *cap)
-		new_cap = *cap * 2;
-	else if ((*size + count) < *cap / 3)
-		new_cap = *cap / 2;
-
-	if (new_cap > 0)
+	while (TRUE)
 	{
-		wStream** new_arr;
+		UINT32 next;
+		const LONGLONG head = *stack;
+		const UINT32 index = (UINT32)(head & 0xFFFFFFFF);
 
-		if (*cap < *size + count)
-			*cap += count;
+		if (index == 0)
+			return 0;
 
-		new_arr = (wStream**)realloc(*array, sizeof(wStream*) * new_cap);
-		if (!new_arr)
-			return FALSE;
-		*cap = new_cap;
-		*array = new_arr;
+		/* A stale next is harmless, the tag of the head changed and the exchange fails */
+		next = (UINT32)cls->nodes[index - 1].next;
+
+		if (InterlockedCompareExchange64(stack, StreamPool_StackHead(head, next), head) == head)
+			return index;
 	}
-	return TRUE;
 }
 
-/**
- * Methods
- */
-
-static void StreamPool_ShiftUsed(wStreamPool* pool, size_t index, INT64 count)
+static void StreamPool_StackPush(wStreamPoolClass* cls, volatile LONGLONG* stack, UINT32 index)
 {
-	WINPR_ASSERT(pool);
-	if (count > 0)
+	WINPR_ASSERT(cls);
+	WINPR_ASSERT(stack);
+	WINPR_ASSERT((index > 0) && (index <= STREAMPOOL_CLASS_NODES));
+
+	while (TRUE)
 	{
-		const size_t pcount = (size_t)count;
-		StreamPool_EnsureCapacity(pool, pcount, TRUE);
+		const LONGLONG head = *stack;
+
+		cls->nodes[index - 1].next = (LONG)(head & 0xFFFFFFFF);
 
-		MoveMemory(&pool->uArray[index + pcount], &pool->uArray[index],
-		           (pool->uSize - index) * sizeof(wStream*));
-		pool->uSize += pcount;
+		if (InterlockedCompareExchange64(stack, StreamPool_StackHead(head, index), head) == head)
+			return;
 	}
-	else if (count < 0)
+}
+
+static void StreamPool_InitClasses(wStreamPool* pool)
+{
+	size_t x;
+
+	WINPR_ASSERT(pool);
+
+	for (x = 0; x < STREAMPOOL_CLASSES; x++)
 	{
-		const size_t pcount = (size_t)-count;
-		if ((pool->uSize - index - pcount) > 0)
+		UINT32 index;
+		wStreamPoolClass* cls = &pool->classes[x];
+
+		cls->size = 1ULL << (STREAMPOOL_MIN_CLASS_SHIFT + x);
+		cls->available = 0;
+		cls->unused = 0;
+		cls->depth = 0;
+
+		for (index = STREAMPOOL_CLASS_NODES; index > 0; index--)
 		{
-			MoveMemory(&pool->uArray[index], &pool->uArray[index + pcount],
-			           (pool->uSize - index - pcount) * sizeof(wStream*));
+			cls->nodes[index - 1].stream = NULL;
+			StreamPool_StackPush(cls, &cls->unused, index);
 		}
-
-		pool->uSize -= pcount;
 	}
 }
 
 /**
- * Adds a used stream to the pool.
+ * Size classes
  */
 
-static void StreamPool_AddUsed(wStreamPool* pool, wStream* s)
+/* smallest class holding streams of at least size bytes */
+static INLINE SSIZE_T StreamPool_ClassForTake(size_t size)
+{
+	SSIZE_T x;
+
+	for (x = 0; x < STREAMPOOL_CLASSES; x++)
+	{
+		if (size <= (1ULL << (STREAMPOOL_MIN_CLASS_SHIFT + x)))
+			return x;
+	}
+
+	return -1;
+}
+
+/* largest class a stream with this capacity satisfies */
+static INLINE SSIZE_T StreamPool_ClassForReturn(size_t capacity)
+{
+	SSIZE_T x;
+
+	for (x = STREAMPOOL_CLASSES - 1; x >= 0; x--)
+	{
+		if (capacity >= (1ULL << (STREAMPOOL_MIN_CLASS_SHIFT + x)))
+			return x;
+	}
+
+	return -1;
+}
+
+static wStream* StreamPool_PopClass(wStreamPoolClass* cls)
+{
+	wStream* s;
+	UINT32 index;
+
+	WINPR_ASSERT(cls);
+
+	index = StreamPool_StackPop(cls, &cls->available);
+
+	if (index == 0)
+		return NULL;
+
+	s = cls->nodes[index - 1].stream;
+	cls->nodes[index - 1].stream = NULL;
+	StreamPool_StackPush(cls, &cls->unused, index);
+	InterlockedDecrement(&cls->depth);
+	return s;
+}
+
+static BOOL StreamPool_PushClass(wStreamPoolClass* cls, wStream* s)
 {
-	StreamPool_EnsureCapacity(pool, 1, TRUE);
-	pool->uArray[(pool->uSize)++] = s;
+	UINT32 index;
+
+	WINPR_ASSERT(cls);
+	WINPR_ASSERT(s);
+
+	index = StreamPool_StackPop(cls, &cls->unused);
+
+	if (index == 0)
+		return FALSE;
+
+	cls->nodes[index - 1].stream = s;
+	StreamPool_StackPush(cls, &cls->available, index);
+	InterlockedIncrement(&cls->depth);
+	return TRUE;
 }
 
 /**
- * Removes a used stream from the pool.
+ * Streams owned by the pool
  */
 
-static void StreamPool_RemoveUsed(wStreamPool* pool, wStream* s)
+static wStream* StreamPool_NewStream(wStreamPool* pool, size_t size)
 {
-	size_t index;
-	BOOL found = FALSE;
+	wStreamPoolEntry* entry;
 
 	WINPR_ASSERT(pool);
-	for (index = 0; index < pool->uSize; index++)
+
+	entry = (wStreamPoolEntry*)calloc(1, sizeof(wStreamPoolEntry));
+
+	if (!entry)
+		return NULL;
+
+	entry->s.buffer = (BYTE*)malloc(size);
+
+	if (!entry->s.buffer)
 	{
-		if (pool->uArray[index] == s)
-		{
-			found = TRUE;
-			break;
-		}
+		free(entry);
+		return NULL;
 	}
 
-	if (found)
-		StreamPool_ShiftUsed(pool, index, -1);
+	entry->s.pointer = entry->s.buffer;
+	entry->s.capacity = size;
+	entry->s.length = size;
+	entry->s.isAllocatedStream = TRUE;
+	entry->s.isOwner = TRUE;
+
+	StreamPool_Lock(pool);
+	entry->next = pool->entries;
+	if (pool->entries)
+		pool->entries->prev = entry;
+	pool->entries = entry;
+	pool->count++;
+	StreamPool_Unlock(pool);
+	return &entry->s;
 }
 
-static void StreamPool_ShiftAvailable(wStreamPool* pool, size_t index, INT64 count)
+static void StreamPool_FreeStreamLocked(wStreamPool* pool, wStream* s)
 {
+	wStreamPoolEntry* entry = (wStreamPoolEntry*)s;
+
 	WINPR_ASSERT(pool);
-	if (count > 0)
-	{
-		const size_t pcount = (size_t)count;
+	WINPR_ASSERT(entry);
 
-		StreamPool_EnsureCapacity(pool, pcount, FALSE);
-		MoveMemory(&pool->aArray[index + pcount], &pool->aArray[index],
-		           (pool->aSize - index) * sizeof(wStream*));
-		pool->aSize += pcount;
-	}
-	else if (count < 0)
-	{
-		const size_t pcount = (size_t)-count;
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		pool->entries = entry->next;
 
-		if ((pool->aSize - index - pcount) > 0)
-		{
-			MoveMemory(&pool->aArray[index], &pool->aArray[index + pcount],
-			           (pool->aSize - index - pcount) * sizeof(wStream*));
-		}
+	if (entry->next)
+		entry->next->prev = entry->prev;
 
-		pool->aSize -= pcount;
-	}
+	pool->count--;
+	Stream_Free(s, s->isAllocatedStream);
 }
 
+static void StreamPool_FreeStream(wStreamPool* pool, wStream* s)
+{
+	StreamPool_Lock(pool);
+	StreamPool_FreeStreamLocked(pool, s);
+	StreamPool_Unlock(pool);
+}
+
+/**
+ * Methods
+ */
+
 /**
  * Gets a stream from the pool.
  */
 
 wStream* StreamPool_Take(wStreamPool* pool, size_t size)
 {
-	size_t index;
-	SSIZE_T foundIndex;
+	SSIZE_T x;
 	wStream* s = NULL;
 
-	StreamPool_Lock(pool);
+	WINPR_ASSERT(pool);
 
 	if (size == 0)
 		size = pool->defaultSize;
 
-	foundIndex = -1;
+	x = StreamPool_ClassForTake(size);
 
-	for (index = 0; index < pool->aSize; index++)
+	if (x >= 0)
 	{
-		s = pool->aArray[index];
+		/* Fall back to the next larger class before allocating */
+		s = StreamPool_PopClass(&pool->classes[x]);
 
-		if (Stream_Capacity(s) >= size)
+		if (!s && (x + 1 < STREAMPOOL_CLASSES))
+			s = StreamPool_PopClass(&pool->classes[x + 1]);
+
+		if (s)
+			InterlockedIncrement(&pool->classes[x].hits);
+		else
 		{
-			foundIndex = index;
-			break;
+			InterlockedIncrement(&pool->classes[x].misses);
+			size = pool->classes[x].size;
 		}
 	}
-
-	if (foundIndex < 0)
-	{
-		s = Stream_New(NULL, size);
-		if (!s)
-			goto out_fail;
-	}
 	else
-	{
-		Stream_SetPosition(s, 0);
-		Stream_SetLength(s, Stream_Capacity(s));
-		StreamPool_ShiftAvailable(pool, foundIndex, -1);
-	}
+		InterlockedIncrement(&pool->oversized);
 
-	if (s)
+	if (!s)
 	{
-		s->pool = pool;
-		s->count = 1;
-		StreamPool_AddUsed(pool, s);
+		s = StreamPool_NewStream(pool, size);
+		if (!s)
+			return NULL;
 	}
 
-out_fail:
-	StreamPool_Unlock(pool);
-
+	Stream_SetPosition(s, 0);
+	Stream_SetLength(s, Stream_Capacity(s));
+	s->pool = pool;
+	s->count = 1;
+	InterlockedIncrement(&pool->used);
 	return s;
 }
 
@@ -244,28 +377,63 @@ out_fail:
  * Returns an object to the pool.
  */
 
+static void StreamPool_Unref(wStreamPool* pool);
+
+static void StreamPool_FreeSlice(wStreamPool* pool, wStream* s)
+{
+	wStreamPoolEntry* entry = (wStreamPoolEntry*)s;
+	wStream* parent = entry->parent;
+
+	InterlockedDecrement(&pool->slices);
+	Stream_Free(s, TRUE);
+	Stream_Release(parent);
+	StreamPool_Unref(pool);
+}
+
 static void StreamPool_Remove(wStreamPool* pool, wStream* s)
 {
-	StreamPool_EnsureCapacity(pool, 1, FALSE);
+	SSIZE_T x;
+
+	WINPR_ASSERT(pool);
+	WINPR_ASSERT(s->pool == pool);
+
 	Stream_EnsureValidity(s);
-	for (size_t x = 0; x < pool->aSize; x++)
+
+	if (((wStreamPoolEntry*)s)->parent)
+	{
+		StreamPool_FreeSlice(pool, s);
+		return;
+	}
+
+	InterlockedDecrement(&pool->used);
+	x = StreamPool_ClassForReturn(Stream_Capacity(s));
+
+	/* Streams grown beyond the largest class or exceeding the class limit are released */
+	if ((x < 0) || (Stream_Capacity(s) > pool->classes[STREAMPOOL_CLASSES - 1].size) ||
+	    !StreamPool_PushClass(&pool->classes[x], s))
 	{
-		wStream* cs = pool->aArray[x];
+		if (x >= 0)
+			InterlockedIncrement(&pool->classes[x].drops);
 
-		WINPR_ASSERT(cs != s);
+		StreamPool_FreeStream(pool, s);
 	}
-	pool->aArray[(pool->aSize)++] = s;
-	StreamPool_RemoveUsed(pool, s);
 }
 
 static void StreamPool_ReleaseOrReturn(wStreamPool* pool, wStream* s)
 {
-	StreamPool_Lock(pool);
-	if (s->count > 0)
-		s->count--;
-	if (s->count == 0)
+	LONG count;
+	volatile LONG* pcount = (volatile LONG*)&s->count;
+
+	do
+	{
+		count = *pcount;
+
+		if (count == 0)
+			return;
+	} while (InterlockedCompareExchange(pcount, count - 1, count) != count);
+
+	if (count == 1)
 		StreamPool_Remove(pool, s);
-	StreamPool_Unlock(pool);
 }
 
 void StreamPool_Return(wStreamPool* pool, wStream* s)
@@ -274,9 +442,24 @@ void StreamPool_Return(wStreamPool* pool, wStream* s)
 	if (!s)
 		return;
 
-	StreamPool_Lock(pool);
+	s->count = 0;
 	StreamPool_Remove(pool, s);
-	StreamPool_Unlock(pool);
+}
+
+static BOOL StreamPool_AddRefIfUsed(wStream* s)
+{
+	LONG count;
+	volatile LONG* pcount = (volatile LONG*)&s->count;
+
+	do
+	{
+		count = *pcount;
+
+		if (count == 0)
+			return FALSE;
+	} while (InterlockedCompareExchange(pcount, count + 1, count) != count);
+
+	return TRUE;
 }
 
 /**
@@ -287,11 +470,7 @@ void Stream_AddRef(wStream* s)
 {
 	WINPR_ASSERT(s);
 	if (s->pool)
-	{
-		StreamPool_Lock(s->pool);
-		s->count++;
-		StreamPool_Unlock(s->pool);
-	}
+		InterlockedIncrement((volatile LONG*)&s->count);
 }
 
 /**
@@ -311,48 +490,123 @@ void Stream_Release(wStream* s)
 
 wStream* StreamPool_Find(wStreamPool* pool, BYTE* ptr)
 {
-	size_t index;
-	wStream* s = NULL;
-	BOOL found = FALSE;
+	wStreamPoolEntry* entry;
+	wStream* found = NULL;
 
 	StreamPool_Lock(pool);
 
-	for (index = 0; index < pool->uSize; index++)
+	for (entry = pool->entries; entry; entry = entry->next)
 	{
-		s = pool->uArray[index];
+		wStream* s = &entry->s;
 
-		if ((ptr >= Stream_Buffer(s)) && (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
+		if ((s->count > 0) && (ptr >= Stream_Buffer(s)) &&
+		    (ptr < (Stream_Buffer(s) + Stream_Capacity(s))))
 		{
-			found = TRUE;
+			found = s;
 			break;
 		}
 	}
 
 	StreamPool_Unlock(pool);
 
-	return (found) ? s : NULL;
+	return found;
 }
 
 /**
- * Releases the streams currently cached in the pool.
+ * Creates a stream referencing length bytes at ptr inside a stream in use,
+ * without copying them. The referenced stream is kept until the slice is released.
  */
 
-void StreamPool_Clear(wStreamPool* pool)
+wStream* StreamPool_Slice(wStreamPool* pool, const BYTE* ptr, size_t length)
 {
+	wStreamPoolEntry* entry;
+	wStreamPoolEntry* slice;
+	wStream* parent = NULL;
+
+	WINPR_ASSERT(pool);
+
+	if (!ptr)
+		return NULL;
+
+	slice = (wStreamPoolEntry*)calloc(1, sizeof(wStreamPoolEntry));
+
+	if (!slice)
+		return NULL;
+
 	StreamPool_Lock(pool);
 
-	while (pool->aSize > 0)
+	for (entry = pool->entries; entry; entry = entry->next)
+	{
+		wStream* s = &entry->s;
+		const BYTE* buffer = Stream_Buffer(s);
+
+		if ((ptr < buffer) || (ptr >= buffer + Stream_Capacity(s)))
+			continue;
+
+		if ((length <= Stream_Capacity(s) - (size_t)(ptr - buffer)) && StreamPool_AddRefIfUsed(s))
+			parent = s;
+
+		break;
+	}
+
+	if (parent)
 	{
-		wStream* s = pool->aArray[--pool->aSize];
-		Stream_Free(s, s->isAllocatedStream);
+		InterlockedIncrement(&pool->refs);
+		InterlockedIncrement(&pool->slices);
+	}
+
+	StreamPool_Unlock(pool);
+
+	if (!parent)
+	{
+		free(slice);
+		return NULL;
 	}
 
-	while (pool->uSize > 0)
+	slice->parent = parent;
+	slice->s.buffer = (BYTE*)ptr;
+	slice->s.pointer = slice->s.buffer;
+	slice->s.capacity = length;
+	slice->s.length = length;
+	slice->s.isAllocatedStream = TRUE;
+	slice->s.isOwner = FALSE;
+	slice->s.pool = pool;
+	slice->s.count = 1;
+	return &slice->s;
+}
+
+/**
+ * Releases the streams currently cached in the pool.
+ */
+
+static void StreamPool_ClearClasses(wStreamPool* pool)
+{
+	size_t x;
+
+	WINPR_ASSERT(pool);
+
+	for (x = 0; x < STREAMPOOL_CLASSES; x++)
 	{
-		wStream* s = pool->uArray[--pool->uSize];
-		Stream_Free(s, s->isAllocatedStream);
+		wStream* s;
+
+		while ((s = StreamPool_PopClass(&pool->classes[x])))
+			StreamPool_FreeStream(pool, s);
 	}
+}
+
+void StreamPool_Clear(wStreamPool* pool)
+{
+	WINPR_ASSERT(pool);
+
+	StreamPool_ClearClasses(pool);
+
+	/* Streams still in use are released as well */
+	StreamPool_Lock(pool);
 
+	while (pool->entries)
+		StreamPool_FreeStreamLocked(pool, &pool->entries->s);
+
+	pool->used = 0;
 	StreamPool_Unlock(pool);
 }
 
@@ -370,45 +624,81 @@ wStreamPool* StreamPool_New(BOOL synchronized, size_t defaultSize)
 	{
 		pool->synchronized = synchronized;
 		pool->defaultSize = defaultSize;
-
-		if (!StreamPool_EnsureCapacity(pool, 32, FALSE))
-			goto fail;
-		if (!StreamPool_EnsureCapacity(pool, 32, TRUE))
-			goto fail;
+		pool->refs = 1;
+		StreamPool_InitClasses(pool);
 
 		InitializeCriticalSectionAndSpinCount(&pool->lock, 4000);
 	}
 
 	return pool;
-fail:
-	StreamPool_Free(pool);
-	return NULL;
+}
+
+static void StreamPool_Unref(wStreamPool* pool)
+{
+	WINPR_ASSERT(pool);
+
+	if (InterlockedDecrement(&pool->refs) != 0)
+		return;
+
+	StreamPool_Clear(pool);
+
+	DeleteCriticalSection(&pool->lock);
+
+	free(pool);
 }
 
 void StreamPool_Free(wStreamPool* pool)
 {
 	if (pool)
 	{
-		StreamPool_Clear(pool);
-
-		DeleteCriticalSection(&pool->lock);
-
-		free(pool->aArray);
-		free(pool->uArray);
+		/* Streams referenced by slices are kept until the last slice is released */
+		if (pool->slices > 0)
+			StreamPool_ClearClasses(pool);
 
-		free(pool);
+		StreamPool_Unref(pool);
 	}
 }
 
 char* StreamPool_GetStatistics(wStreamPool* pool, char* buffer, size_t size)
 {
+	size_t x;
+	int rc;
+	size_t offset;
+
 	WINPR_ASSERT(pool);
 
 	if (!buffer || (size < 1))
 		return NULL;
-	_snprintf(buffer, size - 1,
-	          "aSize    =%" PRIuz ", uSize    =%" PRIuz "aCapacity=%" PRIuz ", uCapacity=%" PRIuz,
-	          pool->aSize, pool->uSize, pool->aCapacity, pool->uCapacity);
+
+	StreamPool_Lock(pool);
+	rc = _snprintf(buffer, size - 1,
+	               "streams=%" PRIuz ", used=%" PRId32 ", slices=%" PRId32 ", oversized=%" PRId32,
+	               pool->count, pool->used, pool->slices, pool->oversized);
+	StreamPool_Unlock(pool);
+	offset = (rc > 0) ? (size_t)rc : 0;
+
+	/* hit rate per size class, classes never requested are skipped */
+	for (x = 0; (x < STREAMPOOL_CLASSES) && (offset < size - 1); x++)
+	{
+		const wStreamPoolClass* cls = &pool->classes[x];
+		const LONG hits = cls->hits;
+		const LONG misses = cls->misses;
+
+		if ((hits == 0) && (misses == 0) && (cls->depth == 0))
+			continue;
+
+		rc = _snprintf(&buffer[offset], size - 1 - offset,
+		               ", [%" PRIuz "] available=%" PRId32 " hits=%" PRId32 " misses=%" PRId32
+		               " drops=%" PRId32 " hitrate=%" PRId32 "%%",
+		               cls->size, cls->depth, hits, misses, cls->drops,
+		               (hits + misses > 0) ? (LONG)(100LL * hits / (hits + misses)) : 0);
+
+		if (rc < 0)
+			break;
+
+		offset += (size_t)rc;
+	}
+
 	buffer[size - 1] = '\0';
 	return buffer;
 }
@@ -73,7 +73,59 @@ int TestStreamPool(int argc, char* argv[])
 
 	printf("%s\n", StreamPool_GetStatistics(pool, buffer, sizeof(buffer)));
 
+	Stream_Release(s[2]);
+	Stream_Release(s[3]);
+	Stream_Release(s[4]);
+
+	/* Returned streams are reused for requests of the same size class */
+	s[0] = StreamPool_Take(pool, BUFFER_SIZE + 1);
+	if (!s[0] || (Stream_Capacity(s[0]) < BUFFER_SIZE + 1))
+		return -1;
+
+	Stream_Release(s[0]);
+	s[1] = StreamPool_Take(pool, BUFFER_SIZE + 2);
+	if (s[1] != s[0])
+		return -1;
+
+	if (StreamPool_Find(pool, Stream_Buffer(s[1]) + 1) != s[1])
+		return -1;
+
+	Stream_Release(s[1]);
+	if (StreamPool_Find(pool, Stream_Buffer(s[1]) + 1))
+		return -1;
+
+	printf("%s\n", StreamPool_GetStatistics(pool, buffer, sizeof(buffer)));
+
+	/* Slices reference the data of a stream in use and keep it alive */
+	s[0] = StreamPool_Take(pool, 0);
+	if (!s[0])
+		return -1;
+
+	Stream_Write_UINT32(s[0], 0x11223344);
+	Stream_Write_UINT32(s[0], 0x55667788);
+
+	if (StreamPool_Slice(pool, Stream_Buffer(s[0]), Stream_Capacity(s[0]) + 1))
+		return -1;
+
+	s[1] = StreamPool_Slice(pool, Stream_Buffer(s[0]) + 4, 4);
+	if (!s[1] || (Stream_Buffer(s[1]) != Stream_Buffer(s[0]) + 4) || (Stream_Length(s[1]) != 4))
+		return -1;
+
+	Stream_Release(s[0]);
+	if (StreamPool_Find(pool, Stream_Buffer(s[1])) != s[0])
+		return -1;
+
+	/* The pool is destroyed once the last slice is released */
 	StreamPool_Free(pool);
 
+	{
+		UINT32 value;
+		Stream_Read_UINT32(s[1], value);
+		if (value != 0x55667788)
+			return -1;
+	}
+
+	Stream_Release(s[1]);
+
 	return 0;
 }